@@ -0,0 +1,253 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/allocation_profile.h"
+
+#include <string.h>
+
+#include "vm/heap.h"
+#include "vm/interpreter.h"
+#include "vm/os.h"
+#include "vm/pprof.h"
+
+namespace psoup {
+
+namespace {
+
+// profile.proto's string table. Its indices double as the ids of the function
+// and location named by each string.
+class StringTable {
+ public:
+  StringTable() : strings_(nullptr), size_(0), capacity_(0) {
+    Intern("");
+  }
+  ~StringTable() { delete[] strings_; }
+
+  intptr_t size() const { return size_; }
+  const char* At(intptr_t index) const { return strings_[index]; }
+
+  // Sites share few distinct names, so a linear search is fine here.
+  intptr_t Intern(const char* cstr) {
+    for (intptr_t i = 0; i < size_; i++) {
+      if (strcmp(strings_[i], cstr) == 0) {
+        return i;
+      }
+    }
+    if (size_ == capacity_) {
+      intptr_t new_capacity = capacity_ == 0 ? 64 : capacity_ * 2;
+      const char** new_strings = new const char*[new_capacity];
+      for (intptr_t i = 0; i < size_; i++) {
+        new_strings[i] = strings_[i];
+      }
+      delete[] strings_;
+      strings_ = new_strings;
+      capacity_ = new_capacity;
+    }
+    strings_[size_] = cstr;
+    return size_++;
+  }
+
+ private:
+  const char** strings_;
+  intptr_t size_;
+  intptr_t capacity_;
+};
+
+}  // namespace
+
+AllocationProfile::AllocationProfile(intptr_t interval, uint64_t seed)
+    : interval_(interval),
+      random_(seed),
+      start_nanos_(OS::CurrentRealtimeNanos()),
+      start_monotonic_nanos_(OS::CurrentMonotonicNanos()),
+      sites_(nullptr),
+      size_(0),
+      capacity_(0) {
+  ASSERT(interval > 0);
+}
+
+AllocationProfile::~AllocationProfile() {
+  for (intptr_t i = 0; i < capacity_; i++) {
+    if (sites_[i].class_name != nullptr) {
+      delete[] sites_[i].class_name;
+      delete[] sites_[i].method_name;
+    }
+  }
+  delete[] sites_;
+}
+
+intptr_t AllocationProfile::NextSampleDistance() {
+  intptr_t half = interval_ / 2;
+  return half + 1 + static_cast<intptr_t>(random_.NextUInt64() % interval_);
+}
+
+void AllocationProfile::RecordSample(Heap* heap, intptr_t cid, intptr_t size,
+                                     Object method) {
+  NameBuffer class_name;
+  class_name.AddMixin(heap->ClassAt(cid)->mixin());
+
+  NameBuffer method_name;
+  if (method == heap->interpreter()->nil_obj()) {
+    method_name.Add("<unknown>");
+  } else {
+    method_name.AddMethod(static_cast<Method>(method));
+  }
+
+  uword hash = HashCString(kFNVOffsetBasis, class_name.chars());
+  hash = HashCString(hash, method_name.chars());
+  Site* site = Lookup(class_name.chars(), method_name.chars(), hash);
+
+  // Objects of at least the interval are all sampled, so each stands for just
+  // itself rather than for the bytes since the previous sample.
+  if (size < interval_) {
+    site->objects += interval_ / size;
+    site->bytes += interval_;
+  } else {
+    site->objects += 1;
+    site->bytes += size;
+  }
+}
+
+AllocationProfile::Site* AllocationProfile::Lookup(const char* class_name,
+                                                   const char* method_name,
+                                                   uword hash) {
+  if (size_ * 2 >= capacity_) {
+    Grow();
+  }
+  intptr_t mask = capacity_ - 1;
+  intptr_t index = hash & mask;
+  for (;;) {
+    Site* site = &sites_[index];
+    if (site->class_name == nullptr) {
+      site->class_name = CopyCString(class_name);
+      site->method_name = CopyCString(method_name);
+      site->hash = hash;
+      size_++;
+      return site;
+    }
+    if ((site->hash == hash) &&
+        (strcmp(site->class_name, class_name) == 0) &&
+        (strcmp(site->method_name, method_name) == 0)) {
+      return site;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+void AllocationProfile::Grow() {
+  intptr_t old_capacity = capacity_;
+  Site* old_sites = sites_;
+  capacity_ = old_capacity == 0 ? 64 : old_capacity * 2;
+  sites_ = new Site[capacity_];
+  memset(sites_, 0, capacity_ * sizeof(Site));
+  intptr_t mask = capacity_ - 1;
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    if (old_sites[i].class_name != nullptr) {
+      intptr_t index = old_sites[i].hash & mask;
+      while (sites_[index].class_name != nullptr) {
+        index = (index + 1) & mask;
+      }
+      sites_[index] = old_sites[i];
+    }
+  }
+  delete[] old_sites;
+}
+
+// See https://github.com/google/pprof/blob/main/proto/profile.proto. Each
+// sample's stack is a frame named by the class allocated, called from the
+// method that allocated it, so pprof's flat view lists classes and its
+// cumulative view lists methods.
+uint8_t* AllocationProfile::Encode(intptr_t* length) const {
+  enum {
+    kProfileSampleType = 1,
+    kProfileSample = 2,
+    kProfileLocation = 4,
+    kProfileFunction = 5,
+    kProfileStringTable = 6,
+    kProfileTimeNanos = 9,
+    kProfileDurationNanos = 10,
+    kProfilePeriodType = 11,
+    kProfilePeriod = 12,
+  };
+  enum { kValueTypeType = 1, kValueTypeUnit = 2 };
+  enum { kSampleLocationId = 1, kSampleValue = 2 };
+  enum { kLocationId = 1, kLocationLine = 4 };
+  enum { kLineFunctionId = 1 };
+  enum { kFunctionId = 1, kFunctionName = 2, kFunctionSystemName = 3 };
+
+  // Names first, so that they are exactly the ids from 1 to |last_name|.
+  StringTable strings;
+  ProtoBuffer samples;
+  for (intptr_t i = 0; i < capacity_; i++) {
+    const Site& site = sites_[i];
+    if (site.class_name == nullptr) {
+      continue;
+    }
+    ProtoBuffer locations;
+    locations.AddVarint(strings.Intern(site.class_name));
+    locations.AddVarint(strings.Intern(site.method_name));
+    ProtoBuffer values;
+    values.AddVarint(site.objects);
+    values.AddVarint(site.bytes);
+    ProtoBuffer sample;
+    sample.AddMessageField(kSampleLocationId, locations);
+    sample.AddMessageField(kSampleValue, values);
+    samples.AddMessageField(kProfileSample, sample);
+  }
+  intptr_t last_name = strings.size() - 1;
+  intptr_t alloc_objects = strings.Intern("alloc_objects");
+  intptr_t count = strings.Intern("count");
+  intptr_t alloc_space = strings.Intern("alloc_space");
+  intptr_t bytes = strings.Intern("bytes");
+  intptr_t space = strings.Intern("space");
+
+  ProtoBuffer profile;
+  {
+    ProtoBuffer value_type;
+    value_type.AddIntField(kValueTypeType, alloc_objects);
+    value_type.AddIntField(kValueTypeUnit, count);
+    profile.AddMessageField(kProfileSampleType, value_type);
+  }
+  {
+    ProtoBuffer value_type;
+    value_type.AddIntField(kValueTypeType, alloc_space);
+    value_type.AddIntField(kValueTypeUnit, bytes);
+    profile.AddMessageField(kProfileSampleType, value_type);
+  }
+  profile.Add(samples);
+
+  for (intptr_t id = 1; id <= last_name; id++) {
+    ProtoBuffer line;
+    line.AddIntField(kLineFunctionId, id);
+    ProtoBuffer location;
+    location.AddIntField(kLocationId, id);
+    location.AddMessageField(kLocationLine, line);
+    profile.AddMessageField(kProfileLocation, location);
+
+    ProtoBuffer function;
+    function.AddIntField(kFunctionId, id);
+    function.AddIntField(kFunctionName, id);
+    function.AddIntField(kFunctionSystemName, id);
+    profile.AddMessageField(kProfileFunction, function);
+  }
+
+  for (intptr_t i = 0; i < strings.size(); i++) {
+    profile.AddStringField(kProfileStringTable, strings.At(i));
+  }
+
+  profile.AddIntField(kProfileTimeNanos, start_nanos_);
+  profile.AddIntField(kProfileDurationNanos,
+                      OS::CurrentMonotonicNanos() - start_monotonic_nanos_);
+  {
+    ProtoBuffer value_type;
+    value_type.AddIntField(kValueTypeType, space);
+    value_type.AddIntField(kValueTypeUnit, bytes);
+    profile.AddMessageField(kProfilePeriodType, value_type);
+  }
+  profile.AddIntField(kProfilePeriod, interval_);
+
+  return profile.Take(length);
+}
+
+}  // namespace psoup
@@ -0,0 +1,64 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_ALLOCATION_PROFILE_H_
+#define VM_ALLOCATION_PROFILE_H_
+
+#include "vm/globals.h"
+#include "vm/object.h"
+#include "vm/random.h"
+
+namespace psoup {
+
+class Heap;
+
+// Sampled allocations, aggregated by the class allocated and the method that
+// was running when it was allocated. One allocation is sampled about every
+// |interval| bytes, and each sample stands for the bytes allocated since the
+// previous one. Objects of |interval| bytes or more are always sampled.
+class AllocationProfile {
+ public:
+  AllocationProfile(intptr_t interval, uint64_t seed);
+  ~AllocationProfile();
+
+  intptr_t interval() const { return interval_; }
+
+  // Bytes to allocate before the next sample: uniform in [interval/2,
+  // 3*interval/2), so allocation patterns with the same period as the interval
+  // are not always sampled at the same point.
+  intptr_t NextSampleDistance();
+
+  // Does not allocate in the heap.
+  void RecordSample(Heap* heap, intptr_t cid, intptr_t size, Object method);
+
+  // Encodes the samples as an uncompressed profile.proto message, the format
+  // read by pprof. The caller deletes the result.
+  uint8_t* Encode(intptr_t* length) const;
+
+ private:
+  struct Site {
+    char* class_name;
+    char* method_name;
+    uword hash;
+    int64_t objects;
+    int64_t bytes;
+  };
+
+  Site* Lookup(const char* class_name, const char* method_name, uword hash);
+  void Grow();
+
+  intptr_t interval_;
+  Random random_;
+  int64_t start_nanos_;
+  int64_t start_monotonic_nanos_;
+  Site* sites_;
+  intptr_t size_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(AllocationProfile);
+};
+
+}  // namespace psoup
+
+#endif  // VM_ALLOCATION_PROFILE_H_
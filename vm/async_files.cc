@@ -0,0 +1,204 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/async_files.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(OS_WINDOWS)
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "vm/isolate.h"
+#include "vm/message_loop.h"
+#include "vm/object.h"
+#include "vm/thread_pool.h"
+
+namespace psoup {
+
+#if defined(OS_WINDOWS)
+intptr_t AsyncFiles::OpenForReading(const char* filename) {
+  return _open(filename, _O_RDONLY | _O_BINARY);
+}
+
+intptr_t AsyncFiles::OpenForWriting(const char* filename) {
+  return _open(filename, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+               _S_IREAD | _S_IWRITE);
+}
+
+intptr_t AsyncFiles::Close(intptr_t fd) {
+  return _close(fd);
+}
+
+// Positioned transfers through a handle opened without FILE_FLAG_OVERLAPPED
+// complete synchronously and leave other threads' positions alone.
+static intptr_t Transfer(intptr_t fd, uint8_t* data, intptr_t length,
+                         int64_t position, bool is_write) {
+  HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+  if (handle == INVALID_HANDLE_VALUE) {
+    errno = EBADF;
+    return -1;
+  }
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset = static_cast<DWORD>(position);
+  overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+  DWORD size = length > kMaxInt32 ? kMaxInt32 : static_cast<DWORD>(length);
+  DWORD transferred = 0;
+  BOOL ok = is_write
+      ? WriteFile(handle, data, size, &transferred, &overlapped)
+      : ReadFile(handle, data, size, &transferred, &overlapped);
+  if (!ok) {
+    if (!is_write && (GetLastError() == ERROR_HANDLE_EOF)) {
+      return 0;
+    }
+    errno = EIO;
+    return -1;
+  }
+  return transferred;
+}
+#else
+intptr_t AsyncFiles::OpenForReading(const char* filename) {
+  return open(filename, O_RDONLY | O_CLOEXEC);
+}
+
+intptr_t AsyncFiles::OpenForWriting(const char* filename) {
+  return open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+}
+
+intptr_t AsyncFiles::Close(intptr_t fd) {
+  return close(fd);
+}
+
+static intptr_t Transfer(intptr_t fd, uint8_t* data, intptr_t length,
+                         int64_t position, bool is_write) {
+  return is_write ? pwrite(fd, data, length, position)
+                  : pread(fd, data, length, position);
+}
+#endif
+
+class FileTask : public ThreadPool::Task {
+ public:
+  FileTask(Port port, intptr_t id, intptr_t fd, int64_t position,
+           uint8_t* data, intptr_t length, bool is_write)
+      : port_(port), id_(id), fd_(fd), position_(position),
+        data_(data), length_(length), is_write_(is_write) {}
+
+  void Run() {
+    intptr_t done = 0;
+    intptr_t status = 0;
+    while (done < length_) {
+      intptr_t result = Transfer(fd_, &data_[done], length_ - done,
+                                 position_ + done, is_write_);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        status = errno;
+        break;
+      }
+      if (result == 0) {
+        break;  // End of file.
+      }
+      done += result;
+    }
+
+    intptr_t signals = is_write_ ? kWriteEvent : kReadEvent;
+    if (status != 0) {
+      signals |= kErrorEvent;
+    }
+    if (is_write_) {
+      free(data_);
+      data_ = NULL;
+    }
+    // Dropped if the isolate has already exited.
+    PortMap::PostMessage(new IsolateMessage(port_, id_, status, signals, done,
+                                            data_, is_write_ ? 0 : done));
+  }
+
+ private:
+  const Port port_;
+  const intptr_t id_;
+  const intptr_t fd_;
+  const int64_t position_;
+  uint8_t* data_;
+  const intptr_t length_;
+  const bool is_write_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileTask);
+};
+
+AsyncFiles::AsyncFiles(Isolate* isolate)
+    : isolate_(isolate), results_(nullptr) {}
+
+AsyncFiles::~AsyncFiles() {
+  while (results_ != nullptr) {
+    Result* result = results_;
+    results_ = result->next;
+    free(result->data);
+    delete result;
+  }
+}
+
+intptr_t AsyncFiles::StartRead(intptr_t fd, int64_t position,
+                               intptr_t length) {
+  // One extra byte so an empty read still has a buffer.
+  uint8_t* data = reinterpret_cast<uint8_t*>(malloc(length + 1));
+  if (data == nullptr) {
+    return 0;
+  }
+  return Start(fd, position, data, length, false);
+}
+
+intptr_t AsyncFiles::StartWrite(intptr_t fd, int64_t position,
+                                uint8_t* data, intptr_t length) {
+  return Start(fd, position, data, length, true);
+}
+
+intptr_t AsyncFiles::Start(intptr_t fd, int64_t position,
+                           uint8_t* data, intptr_t length, bool is_write) {
+  intptr_t id = isolate_->loop()->NewSignalId();
+  Port port = isolate_->loop()->OpenPort();
+  FileTask* task = new FileTask(port, id, fd, position,
+                                data, length, is_write);
+  if (!Isolate::thread_pool()->Run(task)) {
+    FATAL("Failed to start file task");
+  }
+  return id;
+}
+
+void AsyncFiles::Complete(IsolateMessage* message) {
+  // Other signals carry no bytes.
+  if (((message->signals() & kReadEvent) == 0) ||
+      (message->data() == nullptr)) {
+    return;
+  }
+  Result* result = new Result;
+  result->id = message->handle();
+  result->length = message->length();
+  result->data = message->TakeData();
+  result->next = results_;
+  results_ = result;
+}
+
+uint8_t* AsyncFiles::TakeResult(intptr_t id, intptr_t* length) {
+  for (Result** link = &results_; *link != nullptr; link = &(*link)->next) {
+    Result* result = *link;
+    if (result->id == id) {
+      *link = result->next;
+      uint8_t* data = result->data;
+      *length = result->length;
+      delete result;
+      return data;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace psoup
@@ -0,0 +1,66 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_ASYNC_FILES_H_
+#define VM_ASYNC_FILES_H_
+
+#include "vm/globals.h"
+
+namespace psoup {
+
+class Isolate;
+class IsolateMessage;
+
+// Chunked reads and writes of one isolate's files, done on the thread pool so
+// the isolate keeps running. Readiness polling does not apply to regular
+// files, so each operation blocks a worker instead, then posts its completion
+// to the isolate's message loop, which dispatches it as a signal for the
+// operation's id; see MessageLoop::NewSignalId. Each operation holds a port
+// open, so the isolate does not exit before it completes.
+class AsyncFiles {
+ public:
+  explicit AsyncFiles(Isolate* isolate);
+  ~AsyncFiles();
+
+  // Return a file descriptor, or -1 with errno set.
+  static intptr_t OpenForReading(const char* filename);
+  static intptr_t OpenForWriting(const char* filename);
+  static intptr_t Close(intptr_t fd);
+
+  // Each returns the operation's id. The completion's status is 0 or an errno
+  // value, and its count is the number of bytes read or written. Fewer bytes
+  // than asked for are read only at the end of the file. StartRead returns 0
+  // if it cannot allocate the buffer.
+  intptr_t StartRead(intptr_t fd, int64_t position, intptr_t length);
+  // Takes ownership of |data|, which must come from malloc.
+  intptr_t StartWrite(intptr_t fd, int64_t position,
+                      uint8_t* data, intptr_t length);
+
+  // Called by the message loop before dispatching a completion's signal.
+  void Complete(IsolateMessage* message);
+
+  // Returns the bytes of a completed read, which the caller frees, or
+  // nullptr if there are none for |id|.
+  uint8_t* TakeResult(intptr_t id, intptr_t* length);
+
+ private:
+  struct Result {
+    intptr_t id;
+    uint8_t* data;
+    intptr_t length;
+    Result* next;
+  };
+
+  intptr_t Start(intptr_t fd, int64_t position,
+                 uint8_t* data, intptr_t length, bool is_write);
+
+  Isolate* const isolate_;
+  Result* results_;
+
+  DISALLOW_COPY_AND_ASSIGN(AsyncFiles);
+};
+
+}  // namespace psoup
+
+#endif  // VM_ASYNC_FILES_H_
@@ -0,0 +1,63 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_ATOMIC_H_
+#define VM_ATOMIC_H_
+
+#include <atomic>
+
+#include "vm/allocation.h"
+#include "vm/globals.h"
+
+namespace psoup {
+
+// Atomic access to plain words in the heap or in GC data structures. The
+// words are not declared std::atomic because they are laid out as part of
+// objects or arrays that are also accessed non-atomically while the world is
+// stopped.
+class AtomicOperations : public AllStatic {
+ public:
+  template <typename T>
+  static T LoadRelaxed(T* ptr) {
+    return reinterpret_cast<std::atomic<T>*>(ptr)->load(
+        std::memory_order_relaxed);
+  }
+
+  template <typename T>
+  static T LoadAcquire(T* ptr) {
+    return reinterpret_cast<std::atomic<T>*>(ptr)->load(
+        std::memory_order_acquire);
+  }
+
+  template <typename T>
+  static void StoreRelaxed(T* ptr, T value) {
+    reinterpret_cast<std::atomic<T>*>(ptr)->store(value,
+                                                  std::memory_order_relaxed);
+  }
+
+  template <typename T>
+  static void StoreRelease(T* ptr, T value) {
+    reinterpret_cast<std::atomic<T>*>(ptr)->store(value,
+                                                  std::memory_order_release);
+  }
+
+  // On failure, updates *expected with the current value.
+  template <typename T>
+  static bool CompareAndSwap(T* ptr, T* expected, T desired) {
+    return reinterpret_cast<std::atomic<T>*>(ptr)->compare_exchange_strong(
+        *expected, desired, std::memory_order_acq_rel,
+        std::memory_order_acquire);
+  }
+
+  // Returns the value before the addition.
+  template <typename T>
+  static T FetchAndAddRelaxed(T* ptr, T value) {
+    return reinterpret_cast<std::atomic<T>*>(ptr)->fetch_add(
+        value, std::memory_order_relaxed);
+  }
+};
+
+}  // namespace psoup
+
+#endif  // VM_ATOMIC_H_
@@ -0,0 +1,462 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/compressed_snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "vm/flags.h"
+#include "vm/isolate.h"
+#include "vm/lockers.h"
+#include "vm/os.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
+
+namespace psoup {
+
+static constexpr uint16_t kCompressedMagic = 0x1985;
+static constexpr intptr_t kBlockLength = 256 * KB;
+static constexpr intptr_t kMaxDecompressors = 8;
+static constexpr intptr_t kMaxLEB128Length = 10;
+
+// LZ4 block format: matches are at least four bytes, offsets fit in 16 bits,
+// the last five bytes are literals and the last match starts at least twelve
+// bytes before the end.
+static constexpr intptr_t kMinMatch = 4;
+static constexpr intptr_t kMaxOffset = 65535;
+static constexpr intptr_t kLastLiterals = 5;
+static constexpr intptr_t kMatchStartLimit = 12;
+static constexpr intptr_t kHashBits = 14;
+
+struct CompressedSnapshot::Entry {
+  const void* data;
+  size_t length;
+  uint8_t* snapshot;
+  size_t snapshot_length;
+  Entry* next;
+};
+
+Mutex* CompressedSnapshot::mutex_ = NULL;
+CompressedSnapshot::Entry* CompressedSnapshot::entries_ = NULL;
+
+static const uint8_t* SkipDirective(const uint8_t* data, const uint8_t* end) {
+  if ((end - data >= 2) && (data[0] == '#') && (data[1] == '!')) {
+    while ((data < end) && (*data++ != '\n')) {}
+  }
+  return data;
+}
+
+static bool ReadLEB128(const uint8_t** cursor, const uint8_t* end,
+                       uintptr_t* result) {
+  uintptr_t value = 0;
+  uintptr_t shift = 0;
+  for (;;) {
+    if ((*cursor >= end) || (shift >= kBitsPerWord)) {
+      return false;
+    }
+    uint8_t byte = *(*cursor)++;
+    value |= static_cast<uintptr_t>(byte & 0x7F) << shift;
+    shift += 7;
+    if ((byte & 0x80) == 0) {
+      *result = value;
+      return true;
+    }
+  }
+}
+
+static uint8_t* WriteLEB128(uint8_t* cursor, uintptr_t value) {
+  while (value >= 0x80) {
+    *cursor++ = 0x80 | (value & 0x7F);
+    value >>= 7;
+  }
+  *cursor++ = value;
+  return cursor;
+}
+
+static uint8_t* WriteLength(uint8_t* cursor, intptr_t length) {
+  while (length >= 255) {
+    *cursor++ = 255;
+    length -= 255;
+  }
+  *cursor++ = length;
+  return cursor;
+}
+
+static uint32_t Load32(const uint8_t* p) {
+  uint32_t result;
+  memcpy(&result, p, sizeof(result));
+  return result;
+}
+
+static intptr_t Hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - kHashBits);
+}
+
+static uint8_t* WriteSequence(uint8_t* cursor,
+                              const uint8_t* literals,
+                              intptr_t num_literals,
+                              intptr_t offset,
+                              intptr_t match_length) {
+  uint8_t* token = cursor++;
+  *token = (num_literals < 15 ? num_literals : 15) << 4;
+  if (num_literals >= 15) {
+    cursor = WriteLength(cursor, num_literals - 15);
+  }
+  memcpy(cursor, literals, num_literals);
+  cursor += num_literals;
+  if (match_length == 0) {
+    return cursor;  // The last sequence.
+  }
+  *cursor++ = offset & 0xFF;
+  *cursor++ = offset >> 8;
+  intptr_t length = match_length - kMinMatch;
+  *token |= length < 15 ? length : 15;
+  if (length >= 15) {
+    cursor = WriteLength(cursor, length - 15);
+  }
+  return cursor;
+}
+
+// Greedy, with one candidate per hash of the next four bytes.
+static uint8_t* CompressBlock(const uint8_t* block, intptr_t length,
+                              uint8_t* cursor, int32_t* table) {
+  for (intptr_t i = 0; i < (1 << kHashBits); i++) {
+    table[i] = -1;
+  }
+  intptr_t anchor = 0;
+  intptr_t position = 0;
+  intptr_t match_limit = length - kLastLiterals;
+  while (position < length - kMatchStartLimit) {
+    uint32_t sequence = Load32(&block[position]);
+    intptr_t hash = Hash(sequence);
+    intptr_t candidate = table[hash];
+    table[hash] = position;
+    if ((candidate < 0) || (position - candidate > kMaxOffset) ||
+        (Load32(&block[candidate]) != sequence)) {
+      position++;
+      continue;
+    }
+    intptr_t match_length = kMinMatch;
+    while ((position + match_length < match_limit) &&
+           (block[candidate + match_length] ==
+            block[position + match_length])) {
+      match_length++;
+    }
+    cursor = WriteSequence(cursor, &block[anchor], position - anchor,
+                           position - candidate, match_length);
+    position += match_length;
+    anchor = position;
+  }
+  return WriteSequence(cursor, &block[anchor], length - anchor, 0, 0);
+}
+
+static bool ReadLength(const uint8_t** cursor, const uint8_t* end,
+                       intptr_t* length) {
+  uint8_t byte;
+  do {
+    if (*cursor >= end) {
+      return false;
+    }
+    byte = *(*cursor)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+static bool DecompressBlock(const uint8_t* cursor, const uint8_t* end,
+                            uint8_t* block, intptr_t length) {
+  uint8_t* out = block;
+  uint8_t* out_end = block + length;
+  for (;;) {
+    if (cursor >= end) {
+      return false;
+    }
+    uint8_t token = *cursor++;
+    intptr_t num_literals = token >> 4;
+    if ((num_literals == 15) && !ReadLength(&cursor, end, &num_literals)) {
+      return false;
+    }
+    if ((num_literals > end - cursor) || (num_literals > out_end - out)) {
+      return false;
+    }
+    memcpy(out, cursor, num_literals);
+    out += num_literals;
+    cursor += num_literals;
+    if (cursor == end) {
+      return out == out_end;  // The last sequence has no match.
+    }
+
+    if (end - cursor < 2) {
+      return false;
+    }
+    intptr_t offset = cursor[0] | (cursor[1] << 8);
+    cursor += 2;
+    intptr_t match_length = token & 15;
+    if ((match_length == 15) && !ReadLength(&cursor, end, &match_length)) {
+      return false;
+    }
+    match_length += kMinMatch;
+    if ((offset == 0) || (offset > out - block) ||
+        (match_length > out_end - out)) {
+      return false;
+    }
+    const uint8_t* match = out - offset;
+    if (offset >= match_length) {
+      memcpy(out, match, match_length);
+      out += match_length;
+    } else {
+      // Overlapping: repeats the last |offset| bytes.
+      for (intptr_t i = 0; i < match_length; i++) {
+        *out++ = *match++;
+      }
+    }
+  }
+}
+
+// The blocks of one snapshot, claimed in order by the calling thread and any
+// helpers.
+class Decompression {
+ public:
+  Decompression(const uint8_t** blocks, const uint8_t** block_ends,
+                uint8_t* snapshot, intptr_t snapshot_length,
+                intptr_t block_length, intptr_t num_blocks)
+      : blocks_(blocks),
+        block_ends_(block_ends),
+        snapshot_(snapshot),
+        snapshot_length_(snapshot_length),
+        block_length_(block_length),
+        num_blocks_(num_blocks),
+        next_(0),
+        failed_(false),
+        running_helpers_(0) {}
+
+  void Run() {
+    for (;;) {
+      intptr_t i = next_.fetch_add(1);
+      if (i >= num_blocks_) {
+        return;
+      }
+      intptr_t start = i * block_length_;
+      intptr_t length = snapshot_length_ - start < block_length_
+                            ? snapshot_length_ - start
+                            : block_length_;
+      if (!DecompressBlock(blocks_[i], block_ends_[i], &snapshot_[start],
+                           length)) {
+        failed_ = true;
+      }
+    }
+  }
+
+  void StartHelpers(ThreadPool* pool, intptr_t num_helpers);
+  void HelperDone() {
+    MonitorLocker ml(&monitor_);
+    running_helpers_--;
+    ml.NotifyAll();
+  }
+  void WaitForHelpers() {
+    MonitorLocker ml(&monitor_);
+    while (running_helpers_ > 0) {
+      ml.Wait();
+    }
+  }
+
+  bool failed() const { return failed_; }
+
+ private:
+  const uint8_t** const blocks_;
+  const uint8_t** const block_ends_;
+  uint8_t* const snapshot_;
+  const intptr_t snapshot_length_;
+  const intptr_t block_length_;
+  const intptr_t num_blocks_;
+  std::atomic<intptr_t> next_;
+  std::atomic<bool> failed_;
+  Monitor monitor_;
+  intptr_t running_helpers_;
+
+  DISALLOW_COPY_AND_ASSIGN(Decompression);
+};
+
+class DecompressionTask : public ThreadPool::Task {
+ public:
+  explicit DecompressionTask(Decompression* decompression)
+      : decompression_(decompression) {}
+
+  virtual void Run() {
+    decompression_->Run();
+    decompression_->HelperDone();
+  }
+
+ private:
+  Decompression* decompression_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecompressionTask);
+};
+
+void Decompression::StartHelpers(ThreadPool* pool, intptr_t num_helpers) {
+  for (intptr_t i = 0; i < num_helpers; i++) {
+    {
+      MonitorLocker ml(&monitor_);
+      running_helpers_++;
+    }
+    DecompressionTask* task = new DecompressionTask(this);
+    if (!pool->Run(task)) {
+      delete task;  // The pool is shutting down.
+      HelperDone();
+    }
+  }
+}
+
+// static
+void CompressedSnapshot::Startup() {
+  mutex_ = new Mutex();
+}
+
+// static
+void CompressedSnapshot::Shutdown() {
+  while (entries_ != NULL) {
+    Entry* entry = entries_;
+    entries_ = entry->next;
+    free(entry->snapshot);
+    delete entry;
+  }
+  delete mutex_;
+  mutex_ = NULL;
+}
+
+// static
+bool CompressedSnapshot::IsCompressed(const void* data, size_t length) {
+  const uint8_t* start = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* end = start + length;
+  const uint8_t* cursor = SkipDirective(start, end);
+  return (end - cursor >= 2) && (cursor[0] == (kCompressedMagic & 0xFF)) &&
+         (cursor[1] == (kCompressedMagic >> 8));
+}
+
+// static
+void* CompressedSnapshot::Decompress(const void* data, size_t length,
+                                     size_t* snapshot_length) {
+  MutexLocker ml(mutex_);
+  for (Entry* entry = entries_; entry != NULL; entry = entry->next) {
+    if ((entry->data == data) && (entry->length == length)) {
+      *snapshot_length = entry->snapshot_length;
+      return entry->snapshot;
+    }
+  }
+
+  int64_t start_nanos = OS::CurrentMonotonicNanos();
+  const uint8_t* end = reinterpret_cast<const uint8_t*>(data) + length;
+  const uint8_t* cursor =
+      SkipDirective(reinterpret_cast<const uint8_t*>(data), end) + 2;
+  uintptr_t total, block_length;
+  if (!ReadLEB128(&cursor, end, &total) ||
+      !ReadLEB128(&cursor, end, &block_length) || (block_length == 0) ||
+      (total > kMaxInt32)) {
+    FATAL("Corrupt compressed snapshot");
+  }
+  intptr_t num_blocks = (total + block_length - 1) / block_length;
+  const uint8_t** blocks = new const uint8_t*[num_blocks];
+  const uint8_t** block_ends = new const uint8_t*[num_blocks];
+  for (intptr_t i = 0; i < num_blocks; i++) {
+    uintptr_t compressed_length;
+    if (!ReadLEB128(&cursor, end, &compressed_length) ||
+        (compressed_length > static_cast<uintptr_t>(end - cursor))) {
+      FATAL("Corrupt compressed snapshot");
+    }
+    blocks[i] = cursor;
+    cursor += compressed_length;
+    block_ends[i] = cursor;
+  }
+
+  uint8_t* snapshot = reinterpret_cast<uint8_t*>(malloc(total));
+  {
+    Decompression decompression(blocks, block_ends, snapshot, total,
+                                block_length, num_blocks);
+    intptr_t num_helpers = num_blocks - 1;
+    if (num_helpers > OS::NumberOfAvailableProcessors() - 1) {
+      num_helpers = OS::NumberOfAvailableProcessors() - 1;
+    }
+    if (num_helpers > kMaxDecompressors - 1) {
+      num_helpers = kMaxDecompressors - 1;
+    }
+#if defined(OS_EMSCRIPTEN)
+    num_helpers = 0;
+#endif
+    if ((num_helpers > 0) && (Isolate::thread_pool() != NULL)) {
+      decompression.StartHelpers(Isolate::thread_pool(), num_helpers);
+    }
+    decompression.Run();
+    decompression.WaitForHelpers();
+    if (decompression.failed()) {
+      FATAL("Corrupt compressed snapshot");
+    }
+  }
+  delete[] blocks;
+  delete[] block_ends;
+
+  if (TRACE_GROWTH) {
+    int64_t time = OS::CurrentMonotonicNanos() - start_nanos;
+    OS::PrintErr("Decompressed %" Pd "kB snapshot from %" Pd "kB in %" Pd64
+                 " us\n", static_cast<intptr_t>(total / KB),
+                 static_cast<intptr_t>(length / KB),
+                 time / kNanosecondsPerMicrosecond);
+  }
+
+  Entry* entry = new Entry;
+  entry->data = data;
+  entry->length = length;
+  entry->snapshot = snapshot;
+  entry->snapshot_length = total;
+  entry->next = entries_;
+  entries_ = entry;
+  *snapshot_length = total;
+  return snapshot;
+}
+
+// static
+uint8_t* CompressedSnapshot::Compress(const void* snapshot,
+                                      size_t snapshot_length,
+                                      size_t* length) {
+  const uint8_t* directive = reinterpret_cast<const uint8_t*>(snapshot);
+  const uint8_t* end = directive + snapshot_length;
+  const uint8_t* start = SkipDirective(directive, end);
+  intptr_t total = end - start;
+  intptr_t num_blocks = (total + kBlockLength - 1) / kBlockLength;
+  // Incompressible data grows by one byte in 255, plus a token and the
+  // framing per block.
+  intptr_t capacity = (start - directive) + 2 + 2 * kMaxLEB128Length + total +
+                      total / 255 + num_blocks * (16 + kMaxLEB128Length);
+  uint8_t* result = reinterpret_cast<uint8_t*>(malloc(capacity));
+  uint8_t* block_buffer = reinterpret_cast<uint8_t*>(
+      malloc(kBlockLength + kBlockLength / 255 + 16));
+  int32_t* table = new int32_t[1 << kHashBits];
+
+  uint8_t* cursor = result;
+  memcpy(cursor, directive, start - directive);  // Stays runnable.
+  cursor += start - directive;
+  *cursor++ = kCompressedMagic & 0xFF;
+  *cursor++ = kCompressedMagic >> 8;
+  cursor = WriteLEB128(cursor, total);
+  cursor = WriteLEB128(cursor, kBlockLength);
+  for (intptr_t offset = 0; offset < total; offset += kBlockLength) {
+    intptr_t block_length =
+        total - offset < kBlockLength ? total - offset : kBlockLength;
+    uint8_t* block_end =
+        CompressBlock(&start[offset], block_length, block_buffer, table);
+    cursor = WriteLEB128(cursor, block_end - block_buffer);
+    memcpy(cursor, block_buffer, block_end - block_buffer);
+    cursor += block_end - block_buffer;
+  }
+  ASSERT(cursor - result <= capacity);
+
+  delete[] table;
+  free(block_buffer);
+  *length = cursor - result;
+  return result;
+}
+
+}  // namespace psoup
@@ -0,0 +1,50 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_COMPRESSED_SNAPSHOT_H_
+#define VM_COMPRESSED_SNAPSHOT_H_
+
+#include "vm/allocation.h"
+#include "vm/globals.h"
+
+namespace psoup {
+
+class Mutex;
+
+// A container for a snapshot compressed with the LZ4 block format. The
+// snapshot is cut into blocks that are compressed independently, so they can
+// be decompressed in parallel. The container may start with an interpreter
+// directive, like a snapshot.
+//
+//   uint16 magic (0x1985)
+//   leb128 snapshot length
+//   leb128 block length (the last block may be shorter)
+//   for each block: leb128 compressed length, LZ4 sequences
+class CompressedSnapshot : public AllStatic {
+ public:
+  static void Startup();
+  static void Shutdown();
+
+  static bool IsCompressed(const void* data, size_t length);
+
+  // Returns the snapshot in |data|, which is kept until Shutdown, so the
+  // isolates spawned from it can read it too. Decompressing the same data
+  // again returns the same snapshot.
+  static void* Decompress(const void* data, size_t length,
+                          size_t* snapshot_length);
+
+  // The caller frees the result.
+  static uint8_t* Compress(const void* snapshot, size_t snapshot_length,
+                           size_t* length);
+
+ private:
+  struct Entry;
+
+  static Mutex* mutex_;
+  static Entry* entries_;
+};
+
+}  // namespace psoup
+
+#endif  // VM_COMPRESSED_SNAPSHOT_H_
@@ -0,0 +1,340 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/cpu_profile.h"
+
+#include <string.h>
+
+#include "vm/interpreter.h"
+#include "vm/lockers.h"
+#include "vm/os.h"
+#include "vm/pprof.h"
+
+namespace psoup {
+
+CpuProfile::CpuProfile(Interpreter* interpreter, int64_t period)
+    : interpreter_(interpreter),
+      period_(period),
+      start_nanos_(OS::CurrentRealtimeNanos()),
+      start_monotonic_nanos_(OS::CurrentMonotonicNanos()),
+      sample_depth_(0),
+      sample_truncated_(false),
+      names_(nullptr),
+      names_by_id_(nullptr),
+      num_names_(0),
+      names_capacity_(0),
+      stacks_(nullptr),
+      num_stacks_(0),
+      stacks_capacity_(0),
+      frames_(nullptr),
+      num_frames_(0),
+      frames_capacity_(0),
+      sampler_running_(false),
+      sampler_done_(false),
+      sampler_join_id_(Thread::kInvalidThreadJoinId) {
+  ASSERT(period > 0);
+}
+
+CpuProfile::~CpuProfile() {
+  bool join = false;
+  {
+    MonitorLocker ml(&monitor_);
+    if (sampler_running_) {
+      sampler_done_ = true;
+      ml.Notify();
+      while (sampler_running_) {
+        ml.Wait();
+      }
+      join = true;
+    }
+  }
+  if (join) {
+    Thread::Join(sampler_join_id_);
+  }
+
+  for (intptr_t i = 1; i <= num_names_; i++) {
+    delete[] names_by_id_[i];
+  }
+  delete[] names_;
+  delete[] names_by_id_;
+  delete[] stacks_;
+  delete[] frames_;
+}
+
+bool CpuProfile::StartSampler() {
+#if defined(OS_EMSCRIPTEN)
+  return false;
+#else
+  MonitorLocker ml(&monitor_);
+  ASSERT(!sampler_running_);
+  if (Thread::Start("PSoup CPU Profiler", &CpuProfile::SamplerMain,
+                    reinterpret_cast<uword>(this)) != 0) {
+    return false;
+  }
+  sampler_running_ = true;
+  return true;
+#endif
+}
+
+// static
+void CpuProfile::SamplerMain(uword parameter) {
+  reinterpret_cast<CpuProfile*>(parameter)->RunSampler();
+}
+
+void CpuProfile::RunSampler() {
+  MonitorLocker ml(&monitor_);
+  sampler_join_id_ = Thread::GetCurrentThreadJoinId();
+  int64_t next = OS::CurrentMonotonicNanos() + period_;
+  while (!sampler_done_) {
+    ml.WaitUntilNanos(next);
+    int64_t now = OS::CurrentMonotonicNanos();
+    if (!sampler_done_ && (now >= next)) {
+      interpreter_->RequestSample();
+      // Don't make up for periods missed while descheduled.
+      next += period_;
+      if (next <= now) {
+        next = now + period_;
+      }
+    }
+  }
+  sampler_running_ = false;
+  ml.Notify();
+}
+
+void CpuProfile::BeginSample() {
+  sample_depth_ = 0;
+  sample_truncated_ = false;
+}
+
+bool CpuProfile::AddFrame(Method method, bool is_closure) {
+  if (sample_depth_ == kMaxDepth - 1) {
+    sample_truncated_ = true;
+    return false;
+  }
+  NameBuffer name;
+  if (is_closure) {
+    name.Add("[] in ");
+  }
+  name.AddMethod(method);
+  sample_[sample_depth_++] = InternName(name.chars());
+  return true;
+}
+
+void CpuProfile::EndSample() {
+  if (sample_truncated_) {
+    sample_[sample_depth_++] = InternName("<truncated>");
+  }
+  AddFrameIds(sample_, sample_depth_);
+}
+
+intptr_t CpuProfile::InternName(const char* chars) {
+  if (num_names_ * 2 >= names_capacity_) {
+    GrowNames();
+  }
+  uword hash = HashCString(kFNVOffsetBasis, chars);
+  intptr_t mask = names_capacity_ - 1;
+  intptr_t index = hash & mask;
+  for (;;) {
+    Name* name = &names_[index];
+    if (name->chars == nullptr) {
+      name->chars = CopyCString(chars);
+      name->hash = hash;
+      name->id = ++num_names_;
+      names_by_id_[name->id] = name->chars;
+      return name->id;
+    }
+    if ((name->hash == hash) && (strcmp(name->chars, chars) == 0)) {
+      return name->id;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+void CpuProfile::GrowNames() {
+  intptr_t old_capacity = names_capacity_;
+  Name* old_names = names_;
+  names_capacity_ = old_capacity == 0 ? 64 : old_capacity * 2;
+  names_ = new Name[names_capacity_];
+  memset(names_, 0, names_capacity_ * sizeof(Name));
+  intptr_t mask = names_capacity_ - 1;
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    if (old_names[i].chars != nullptr) {
+      intptr_t index = old_names[i].hash & mask;
+      while (names_[index].chars != nullptr) {
+        index = (index + 1) & mask;
+      }
+      names_[index] = old_names[i];
+    }
+  }
+  delete[] old_names;
+
+  // At most half full, so ids stay below the capacity.
+  char** old_names_by_id = names_by_id_;
+  names_by_id_ = new char*[names_capacity_];
+  if (old_names_by_id != nullptr) {
+    memcpy(names_by_id_, old_names_by_id, (num_names_ + 1) * sizeof(char*));
+  }
+  delete[] old_names_by_id;
+}
+
+void CpuProfile::AddFrameIds(const intptr_t* ids, intptr_t depth) {
+  if (num_stacks_ * 2 >= stacks_capacity_) {
+    GrowStacks();
+  }
+  uword hash = kFNVOffsetBasis;
+  for (intptr_t i = 0; i < depth; i++) {
+    hash = (hash ^ static_cast<uword>(ids[i])) * kFNVPrime;
+  }
+  intptr_t mask = stacks_capacity_ - 1;
+  intptr_t index = hash & mask;
+  for (;;) {
+    Stack* stack = &stacks_[index];
+    if (stack->count == 0) {
+      if (num_frames_ + depth > frames_capacity_) {
+        intptr_t new_capacity = frames_capacity_ == 0 ? 1024
+                                                      : frames_capacity_ * 2;
+        while (new_capacity < num_frames_ + depth) {
+          new_capacity *= 2;
+        }
+        intptr_t* new_frames = new intptr_t[new_capacity];
+        if (num_frames_ != 0) {
+          memcpy(new_frames, frames_, num_frames_ * sizeof(intptr_t));
+        }
+        delete[] frames_;
+        frames_ = new_frames;
+        frames_capacity_ = new_capacity;
+      }
+      memcpy(&frames_[num_frames_], ids, depth * sizeof(intptr_t));
+      stack->start = num_frames_;
+      stack->depth = depth;
+      stack->hash = hash;
+      stack->count = 1;
+      num_frames_ += depth;
+      num_stacks_++;
+      return;
+    }
+    if ((stack->hash == hash) && (stack->depth == depth) &&
+        (memcmp(&frames_[stack->start], ids, depth * sizeof(intptr_t)) == 0)) {
+      stack->count++;
+      return;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+void CpuProfile::GrowStacks() {
+  intptr_t old_capacity = stacks_capacity_;
+  Stack* old_stacks = stacks_;
+  stacks_capacity_ = old_capacity == 0 ? 64 : old_capacity * 2;
+  stacks_ = new Stack[stacks_capacity_];
+  memset(stacks_, 0, stacks_capacity_ * sizeof(Stack));
+  intptr_t mask = stacks_capacity_ - 1;
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    if (old_stacks[i].count != 0) {
+      intptr_t index = old_stacks[i].hash & mask;
+      while (stacks_[index].count != 0) {
+        index = (index + 1) & mask;
+      }
+      stacks_[index] = old_stacks[i];
+    }
+  }
+  delete[] old_stacks;
+}
+
+// See https://github.com/google/pprof/blob/main/proto/profile.proto. Each name
+// id is also the id of its function and of a location in that function.
+uint8_t* CpuProfile::Encode(intptr_t* length) const {
+  enum {
+    kProfileSampleType = 1,
+    kProfileSample = 2,
+    kProfileLocation = 4,
+    kProfileFunction = 5,
+    kProfileStringTable = 6,
+    kProfileTimeNanos = 9,
+    kProfileDurationNanos = 10,
+    kProfilePeriodType = 11,
+    kProfilePeriod = 12,
+  };
+  enum { kValueTypeType = 1, kValueTypeUnit = 2 };
+  enum { kSampleLocationId = 1, kSampleValue = 2 };
+  enum { kLocationId = 1, kLocationLine = 4 };
+  enum { kLineFunctionId = 1 };
+  enum { kFunctionId = 1, kFunctionName = 2, kFunctionSystemName = 3 };
+
+  intptr_t samples = num_names_ + 1;
+  intptr_t count = num_names_ + 2;
+  intptr_t cpu = num_names_ + 3;
+  intptr_t nanoseconds = num_names_ + 4;
+
+  ProtoBuffer profile;
+  {
+    ProtoBuffer value_type;
+    value_type.AddIntField(kValueTypeType, samples);
+    value_type.AddIntField(kValueTypeUnit, count);
+    profile.AddMessageField(kProfileSampleType, value_type);
+  }
+  {
+    ProtoBuffer value_type;
+    value_type.AddIntField(kValueTypeType, cpu);
+    value_type.AddIntField(kValueTypeUnit, nanoseconds);
+    profile.AddMessageField(kProfileSampleType, value_type);
+  }
+
+  for (intptr_t i = 0; i < stacks_capacity_; i++) {
+    const Stack& stack = stacks_[i];
+    if (stack.count == 0) {
+      continue;
+    }
+    ProtoBuffer locations;
+    for (intptr_t j = 0; j < stack.depth; j++) {
+      locations.AddVarint(frames_[stack.start + j]);
+    }
+    ProtoBuffer values;
+    values.AddVarint(stack.count);
+    values.AddVarint(stack.count * period_);
+    ProtoBuffer sample;
+    sample.AddMessageField(kSampleLocationId, locations);
+    sample.AddMessageField(kSampleValue, values);
+    profile.AddMessageField(kProfileSample, sample);
+  }
+
+  for (intptr_t id = 1; id <= num_names_; id++) {
+    ProtoBuffer line;
+    line.AddIntField(kLineFunctionId, id);
+    ProtoBuffer location;
+    location.AddIntField(kLocationId, id);
+    location.AddMessageField(kLocationLine, line);
+    profile.AddMessageField(kProfileLocation, location);
+
+    ProtoBuffer function;
+    function.AddIntField(kFunctionId, id);
+    function.AddIntField(kFunctionName, id);
+    function.AddIntField(kFunctionSystemName, id);
+    profile.AddMessageField(kProfileFunction, function);
+  }
+
+  profile.AddStringField(kProfileStringTable, "");
+  for (intptr_t id = 1; id <= num_names_; id++) {
+    profile.AddStringField(kProfileStringTable, names_by_id_[id]);
+  }
+  profile.AddStringField(kProfileStringTable, "samples");
+  profile.AddStringField(kProfileStringTable, "count");
+  profile.AddStringField(kProfileStringTable, "cpu");
+  profile.AddStringField(kProfileStringTable, "nanoseconds");
+
+  profile.AddIntField(kProfileTimeNanos, start_nanos_);
+  profile.AddIntField(kProfileDurationNanos,
+                      OS::CurrentMonotonicNanos() - start_monotonic_nanos_);
+  {
+    ProtoBuffer value_type;
+    value_type.AddIntField(kValueTypeType, cpu);
+    value_type.AddIntField(kValueTypeUnit, nanoseconds);
+    profile.AddMessageField(kProfilePeriodType, value_type);
+  }
+  profile.AddIntField(kProfilePeriod, period_);
+
+  return profile.Take(length);
+}
+
+}  // namespace psoup
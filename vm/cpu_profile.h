@@ -0,0 +1,102 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_CPU_PROFILE_H_
+#define VM_CPU_PROFILE_H_
+
+#include "vm/globals.h"
+#include "vm/object.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+class Interpreter;
+
+// Sampled stacks of one isolate's interpreter, aggregated by stack. A sampler
+// thread asks the interpreter for a sample about every |period| nanoseconds,
+// and the interpreter records its frames at its next stack check, so only
+// code that makes sends is seen and a sample never races with the mutator.
+class CpuProfile {
+ public:
+  CpuProfile(Interpreter* interpreter, int64_t period);
+  // Stops the sampler thread.
+  ~CpuProfile();
+
+  int64_t period() const { return period_; }
+
+  // Returns false if the sampler thread could not be started.
+  bool StartSampler();
+
+  // Called by the interpreter with its frames from the innermost out, between
+  // BeginSample and EndSample. AddFrame returns false once the sample is full.
+  // Does not allocate in the heap.
+  void BeginSample();
+  bool AddFrame(Method method, bool is_closure);
+  void EndSample();
+
+  // Encodes the samples as an uncompressed profile.proto message, the format
+  // read by pprof. The caller deletes the result.
+  uint8_t* Encode(intptr_t* length) const;
+
+ private:
+  // Stacks deeper than this keep their innermost frames.
+  static constexpr intptr_t kMaxDepth = 128;
+
+  struct Name {
+    char* chars;
+    uword hash;
+    intptr_t id;
+  };
+
+  // A distinct stack: |depth| name ids from frames_[start], innermost first.
+  struct Stack {
+    intptr_t start;
+    intptr_t depth;
+    uword hash;
+    int64_t count;
+  };
+
+  static void SamplerMain(uword parameter);
+  void RunSampler();
+
+  intptr_t InternName(const char* chars);
+  void GrowNames();
+  void GrowStacks();
+  void AddFrameIds(const intptr_t* ids, intptr_t depth);
+
+  Interpreter* const interpreter_;
+  const int64_t period_;
+  int64_t start_nanos_;
+  int64_t start_monotonic_nanos_;
+
+  // The sample being recorded.
+  intptr_t sample_[kMaxDepth];
+  intptr_t sample_depth_;
+  bool sample_truncated_;
+
+  // Name ids start at 1, so they are also their indices in the encoded string
+  // table.
+  Name* names_;  // Hash table.
+  char** names_by_id_;
+  intptr_t num_names_;
+  intptr_t names_capacity_;
+
+  Stack* stacks_;  // Hash table.
+  intptr_t num_stacks_;
+  intptr_t stacks_capacity_;
+  intptr_t* frames_;
+  intptr_t num_frames_;
+  intptr_t frames_capacity_;
+
+  Monitor monitor_;
+  bool sampler_running_;
+  bool sampler_done_;
+  ThreadJoinId sampler_join_id_;
+
+  DISALLOW_COPY_AND_ASSIGN(CpuProfile);
+};
+
+}  // namespace psoup
+
+#endif  // VM_CPU_PROFILE_H_
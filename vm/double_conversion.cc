@@ -7,6 +7,7 @@
 #include "vm/assert.h"
 
 #include "double-conversion/double-conversion.h"
+#include "double-conversion/strtod.h"
 
 namespace psoup {
 
@@ -155,4 +156,28 @@ bool CStringToDouble(const char* str, int length, double* result) {
   return (parsed_count == length);
 }
 
+double DecimalDigitsToDouble(const char* digits, int length, int exponent) {
+#if defined(DOUBLE_CONVERSION_CORRECT_DOUBLE_OPERATIONS)
+  // Both the significand and the power of ten are exact doubles, so one
+  // rounded operation gives the correctly rounded result.
+  static const double kExactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  if ((length <= 15) && (exponent >= -22) && (exponent <= 22)) {
+    int64_t significand = 0;
+    for (int i = 0; i < length; i++) {
+      significand = significand * 10 + (digits[i] - '0');
+    }
+    double result = static_cast<double>(significand);
+    if (exponent < 0) {
+      return result / kExactPowersOfTen[-exponent];
+    }
+    return result * kExactPowersOfTen[exponent];
+  }
+#endif
+  return double_conversion::Strtod(
+      double_conversion::Vector<const char>(digits, length), exponent);
+}
+
 }  // namespace psoup
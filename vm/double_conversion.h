@@ -17,6 +17,9 @@ int DoubleToCStringAsExponential(double d, int fraction_digits,
 int DoubleToCStringAsPrecision(double d, int precision,
                                char* buffer, int buffer_size);
 bool CStringToDouble(const char* str, int length, double* result);
+// Answers digits * 10^exponent, correctly rounded. |digits| has no sign,
+// point or leading zeros.
+double DecimalDigitsToDouble(const char* digits, int length, int exponent);
 
 }  // namespace psoup
 
@@ -0,0 +1,142 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/execution_counts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/pprof.h"
+
+namespace psoup {
+
+ExecutionCounts::ExecutionCounts()
+    : num_recent_(0),
+      totals_(nullptr),
+      num_totals_(0),
+      totals_capacity_(0) {
+  for (intptr_t i = 0; i < kRecentSize; i++) {
+    recent_[i].count = 0;
+  }
+}
+
+ExecutionCounts::~ExecutionCounts() {
+  for (intptr_t i = 0; i < totals_capacity_; i++) {
+    delete[] totals_[i].name;
+  }
+  delete[] totals_;
+}
+
+void ExecutionCounts::Flush() {
+  if (num_recent_ == 0) {
+    return;
+  }
+  for (intptr_t i = 0; i < kRecentSize; i++) {
+    Recent* recent = &recent_[i];
+    if (recent->count == 0) {
+      continue;
+    }
+    NameBuffer name;
+    name.AddMethod(recent->method);
+    if (recent->ip != nullptr) {
+      char bci[32];
+      snprintf(bci, sizeof(bci), " @%" Pd " #",
+               recent->method->BCI(recent->ip)->value());
+      name.Add(bci);
+      name.Add(recent->selector);
+    }
+    AddTotal(name.chars(), recent->ip != nullptr, recent->count);
+    recent->count = 0;
+  }
+  num_recent_ = 0;
+}
+
+void ExecutionCounts::AddTotal(const char* name, bool is_miss, int64_t count) {
+  if (num_totals_ * 2 >= totals_capacity_) {
+    GrowTotals();
+  }
+  uword hash = HashCString(kFNVOffsetBasis, name);
+  intptr_t mask = totals_capacity_ - 1;
+  intptr_t index = hash & mask;
+  for (;;) {
+    Total* total = &totals_[index];
+    if (total->name == nullptr) {
+      total->name = CopyCString(name);
+      total->hash = hash;
+      total->is_miss = is_miss;
+      total->count = count;
+      num_totals_++;
+      return;
+    }
+    if ((total->hash == hash) && (total->is_miss == is_miss) &&
+        (strcmp(total->name, name) == 0)) {
+      total->count += count;
+      return;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+void ExecutionCounts::GrowTotals() {
+  intptr_t old_capacity = totals_capacity_;
+  Total* old_totals = totals_;
+  totals_capacity_ = old_capacity == 0 ? 256 : old_capacity * 2;
+  totals_ = new Total[totals_capacity_];
+  memset(totals_, 0, totals_capacity_ * sizeof(Total));
+  intptr_t mask = totals_capacity_ - 1;
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    if (old_totals[i].name != nullptr) {
+      intptr_t index = old_totals[i].hash & mask;
+      while (totals_[index].name != nullptr) {
+        index = (index + 1) & mask;
+      }
+      totals_[index] = old_totals[i];
+    }
+  }
+  delete[] old_totals;
+}
+
+// static
+int ExecutionCounts::CompareTotals(const void* a, const void* b) {
+  const Total* left = *reinterpret_cast<const Total* const*>(a);
+  const Total* right = *reinterpret_cast<const Total* const*>(b);
+  if (left->is_miss != right->is_miss) {
+    return left->is_miss ? 1 : -1;
+  }
+  if (left->count != right->count) {
+    return left->count > right->count ? -1 : 1;
+  }
+  return strcmp(left->name, right->name);
+}
+
+char* ExecutionCounts::Report(intptr_t* length) {
+  Flush();
+
+  Total** sorted = new Total*[num_totals_ + 1];
+  intptr_t num_sorted = 0;
+  intptr_t capacity = 1;
+  for (intptr_t i = 0; i < totals_capacity_; i++) {
+    if (totals_[i].name != nullptr) {
+      sorted[num_sorted++] = &totals_[i];
+      capacity += strlen(totals_[i].name) + 40;
+    }
+  }
+  qsort(sorted, num_sorted, sizeof(Total*), CompareTotals);
+
+  char* report = reinterpret_cast<char*>(malloc(capacity));
+  intptr_t used = 0;
+  for (intptr_t i = 0; i < num_sorted; i++) {
+    used += snprintf(&report[used], capacity - used, "%s\t%" Pd64 "\t%s\n",
+                     sorted[i]->is_miss ? "misses" : "activations",
+                     sorted[i]->count, sorted[i]->name);
+  }
+  report[used] = 0;
+  delete[] sorted;
+
+  *length = used;
+  return report;
+}
+
+}  // namespace psoup
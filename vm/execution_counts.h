@@ -0,0 +1,101 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_EXECUTION_COUNTS_H_
+#define VM_EXECUTION_COUNTS_H_
+
+#include "vm/globals.h"
+#include "vm/object.h"
+
+namespace psoup {
+
+// Exact counts of method activations and of send sites missing their cache,
+// for finding what dominates a run. Counts are first kept by method and
+// instruction pointer, which is cheap but only valid until objects move, so
+// they are folded into counts by name before every GC.
+class ExecutionCounts {
+ public:
+  ExecutionCounts();
+  ~ExecutionCounts();
+
+  void CountActivation(Method method) {
+    Count(method, nullptr, static_cast<String>(Object()));
+  }
+  // |ip| identifies the send site in |method|.
+  void CountSendMiss(Method method, const uint8_t* ip, String selector) {
+    Count(method, ip, selector);
+  }
+
+  // Must be called while the counted methods are still where they were when
+  // counted, i.e., before GC moves them. Does not allocate in the heap.
+  void Flush();
+
+  // Flushes, then answers a report with one line per method or send site,
+  // most frequent first within each kind:
+  //   activations <tab> count <tab> Mixin>>selector
+  //   misses <tab> count <tab> Mixin>>selector @bci #selector
+  // where bci follows the send. The caller frees the result.
+  char* Report(intptr_t* length);
+
+ private:
+  struct Recent {
+    Method method;
+    const uint8_t* ip;  // nullptr for an activation.
+    String selector;
+    int64_t count;
+  };
+
+  struct Total {
+    char* name;
+    uword hash;
+    bool is_miss;
+    int64_t count;
+  };
+
+  static constexpr intptr_t kRecentSize = 4 * KB;
+
+  void Count(Method method, const uint8_t* ip, String selector) {
+    uword hash = (static_cast<uword>(method) ^ reinterpret_cast<uword>(ip)) >>
+                 kObjectAlignmentLog2;
+    intptr_t index = hash & (kRecentSize - 1);
+    for (;;) {
+      Recent* recent = &recent_[index];
+      if (recent->count == 0) {
+        if (num_recent_ * 2 >= kRecentSize) {
+          Flush();
+          Count(method, ip, selector);
+          return;
+        }
+        recent->method = method;
+        recent->ip = ip;
+        recent->selector = selector;
+        recent->count = 1;
+        num_recent_++;
+        return;
+      }
+      if ((recent->method == method) && (recent->ip == ip)) {
+        recent->count++;
+        return;
+      }
+      index = (index + 1) & (kRecentSize - 1);
+    }
+  }
+
+  void AddTotal(const char* name, bool is_miss, int64_t count);
+  void GrowTotals();
+  static int CompareTotals(const void* a, const void* b);
+
+  Recent recent_[kRecentSize];  // Hash table.
+  intptr_t num_recent_;
+
+  Total* totals_;  // Hash table.
+  intptr_t num_totals_;
+  intptr_t totals_capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(ExecutionCounts);
+};
+
+}  // namespace psoup
+
+#endif  // VM_EXECUTION_COUNTS_H_
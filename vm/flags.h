@@ -5,14 +5,23 @@
 #ifndef VM_FLAGS_H_
 #define VM_FLAGS_H_
 
+#define HUGE_PAGES false
+#define INCREMENTAL_MARKING true
+#define INLINE_CACHE true
+#define IO_URING true
 #define LOOKUP_CACHE true
+#define PRETENURING true
+#define SCHEDULED_ISOLATES false
 #define STATIC_PREDICTION_BYTECODES true
+#define SUPERINSTRUCTIONS true
+#define THREADED_DISPATCH false
+#define WIDE_DIGITS false
 
-#define REPORT_GC false
 #define TEST_SLOW_PATH false
 #define TRACE_BECOME false
 #define TRACE_DNU false
 #define TRACE_GROWTH false
+#define TRACE_PRETENURING false
 #define TRACE_PRIMITIVES false
 #define TRACE_SIGNALS false
 #define TRACE_SPECIAL_CONTROL false
@@ -43,6 +43,10 @@
 #define OS_FUCHSIA 1
 #elif defined(__EMSCRIPTEN__)
 #define OS_EMSCRIPTEN 1
+#if defined(__EMSCRIPTEN_PTHREADS__)
+// Built with -pthread: threads are Web Workers sharing the wasm memory.
+#define EMSCRIPTEN_THREADS 1
+#endif
 #else
 #error Automatic OS detection failed.
 #endif
@@ -4,28 +4,84 @@
 
 #include "vm/heap.h"
 
+#include "vm/allocation_profile.h"
+#include "vm/atomic.h"
 #include "vm/interpreter.h"
+#include "vm/lockers.h"
 #include "vm/os.h"
+#include "vm/perf_counters.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
+#include "vm/trace_events.h"
 
 namespace psoup {
 
 class Region {
  public:
-  static Region* Allocate(intptr_t size) {
-    VirtualMemory memory = VirtualMemory::Allocate(size,
-                                                   VirtualMemory::kReadWrite,
-                                                   "primordialsoup-heap");
+  // Large regions hold a single large object, preceded by its card table.
+  static Region* Allocate(intptr_t size, intptr_t card_table_size,
+                          intptr_t numa_node) {
+    VirtualMemory memory = AllocateHeapMemory(size, numa_node);
 #if defined(DEBUG)
     memset(reinterpret_cast<void*>(memory.base()), kUnallocatedByte, size);
 #endif
     Region* region = reinterpret_cast<Region*>(memory.base());
     region->memory_ = memory;
-    region->object_end_ = region->object_start();
+    region->object_start_ = memory.base() + AllocationSize(sizeof(Region)) +
+        card_table_size;
+    region->object_end_ = region->object_start_;
+    region->is_large_ = card_table_size != 0;
+    memset(reinterpret_cast<void*>(region->object_start_ - card_table_size),
+           0, card_table_size);
     return region;
   }
 
   void Free() { memory_.Free(); }
 
+  // Moves a large region to a new mapping and answers it, or nullptr if the
+  // OS cannot move pages. Only the first |keep| bytes are copied; the pages
+  // after them move without copying, and this region shrinks to |keep|.
+  Region* MovePages(intptr_t keep, intptr_t numa_node) {
+    ASSERT(is_large_);
+    VirtualMemory memory = AllocateHeapMemory(size(), numa_node);
+    uword old_base = memory_.base();
+    if (!memory_.MovePages(keep, &memory)) {
+      memory.Free();
+      return nullptr;
+    }
+    memcpy(reinterpret_cast<void*>(memory.base()),
+           reinterpret_cast<void*>(old_base), keep);
+    Region* result = reinterpret_cast<Region*>(memory.base());
+    intptr_t delta = memory.base() - old_base;
+    result->next_ = nullptr;
+    result->memory_ = memory;
+    result->object_start_ += delta;
+    result->object_end_ += delta;
+    return result;
+  }
+
+  // Makes an empty region ready to be allocated from again.
+  void Reset() {
+    ASSERT(!is_large_);
+    object_end_ = object_start_;
+#if defined(DEBUG)
+    memset(reinterpret_cast<void*>(object_start_), kUnallocatedByte,
+           limit() - object_start_);
+#endif
+  }
+
+  // Returns the pages that lie wholly inside [start, start + size) to the OS.
+  // Part of a huge page would split it.
+  void Decommit(uword start, intptr_t size) {
+    intptr_t page_size = HUGE_PAGES ? VirtualMemory::kHugePageSize
+                                    : VirtualMemory::PageSize();
+    uword first = Utils::RoundUp(start, page_size);
+    uword last = Utils::RoundDown(start + size, page_size);
+    if (first < last) {
+      memory_.Decommit(first, last - first);
+    }
+  }
+
   uword TryAllocate(intptr_t size) {
     ASSERT(Utils::IsAligned(size, kObjectAlignment));
     uword result = object_end_;
@@ -40,19 +96,21 @@ class Region {
 
   uword size() const { return memory_.size(); }
   uword limit() const { return memory_.limit(); }
-  uword object_start() const {
-    return reinterpret_cast<uword>(this) + AllocationSize(sizeof(Region));
-  }
+  uword object_start() const { return object_start_; }
   uword object_end() const { return object_end_; }
   void set_object_end(uword value) { object_end_ = value; }
 
   Region* next() const { return next_; }
   void set_next(Region* next) { next_ = next; }
 
+  bool is_large() const { return is_large_; }
+
  private:
   Region* next_;
   VirtualMemory memory_;
+  uword object_start_;
   uword object_end_;
+  bool is_large_;
 };
 
 class MarkStack {
@@ -70,6 +128,14 @@ class MarkStack {
       *top_++ = obj;
     }
   }
+  // Returns false if the stack is full.
+  bool TryPush(HeapObject obj) {
+    if (top_ == end_) {
+      return false;
+    }
+    *top_++ = obj;
+    return true;
+  }
   HeapObject Pop() { return *--top_; }
 
  private:
@@ -78,35 +144,133 @@ class MarkStack {
   HeapObject stack_[];
 };
 
-Heap::Heap() :
+// Visits the slots of a carded object that lie in dirty cards. |visit| returns
+// whether the slot refers to new-space afterwards, and a card stays dirty only
+// if one of its slots does. Clean cards hold no references to new-space, so a
+// scavenge has nothing to do in them.
+template <typename Visitor>
+static bool VisitDirtyCards(HeapObject obj, Visitor visit) {
+  ASSERT(obj->is_carded());
+  Object* from;
+  Object* to;
+  obj->Pointers(&from, &to);
+  bool has_new_target = false;
+  if (from > to) {
+    return has_new_target;
+  }
+  const intptr_t slots_per_card = kCardSize / sizeof(Object);
+  intptr_t last = obj->CardIndexOf(to);
+  for (intptr_t i = obj->CardIndexOf(from); i <= last; i++) {
+    uint8_t* card = obj->CardAt(i);
+    if (*card == 0) {
+      continue;
+    }
+    Object* card_from =
+        reinterpret_cast<Object*>(obj->Addr() + (i << kCardSizeLog2));
+    Object* card_to = card_from + slots_per_card - 1;
+    if (card_from < from) card_from = from;
+    if (card_to > to) card_to = to;
+    bool card_has_new_target = false;
+    for (Object* ptr = card_from; ptr <= card_to; ptr++) {
+      if (visit(ptr)) {
+        card_has_new_target = true;
+      }
+    }
+    *card = card_has_new_target ? 1 : 0;
+    has_new_target |= card_has_new_target;
+  }
+  return has_new_target;
+}
+
+static size_t SemispaceCapacityFor(size_t requested, size_t default_size) {
+  if (requested == 0) {
+    return default_size;
+  }
+  // Rounded to a power of two so that doubling reaches the maximum exactly.
+  size_t capacity = 64 * KB;
+  while (capacity < requested) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+Heap::GCEventCallback Heap::gc_event_callback_ = nullptr;
+
+Heap::Heap(const HeapPolicy& policy) :
+    policy_(policy),
     top_(0),
     end_(0),
+    limit_(0),
     survivor_end_(0),
     to_(),
     from_(),
-    next_semispace_capacity_(kInitialSemispaceCapacity),
+    next_semispace_capacity_(0),
     regions_(nullptr),
+    unswept_regions_(nullptr),
+    large_regions_(nullptr),
+    free_regions_(nullptr),
+    free_regions_size_(0),
     freelist_(),
+    tenure_top_(0),
+    tenure_end_(0),
     old_size_(0),
     old_capacity_(0),
     old_limit_(0),
-    remembered_set_(nullptr),
-    remembered_set_size_(0),
-    remembered_set_capacity_(0),
+    old_marking_threshold_(0),
+    old_marked_size_(0),
+    marking_(false),
+    marking_old_size_(0),
+    marking_stack_(),
+    marking_deferred_(),
+    mark_overflow_(),
+    remembered_set_(),
     class_table_(nullptr),
     class_table_size_(0),
     class_table_capacity_(0),
     class_table_free_(0),
+    new_class_ids_(nullptr),
+    new_class_ids_size_(0),
+    new_class_ids_capacity_(0),
+    pretenuring_(nullptr),
+    scavenges_until_census_(kPretenureCensusInterval),
+    tenuring_threshold_(kMaxTenuringThreshold),
+    survivor_sizes_(),
+    gc_events_(),
+    gc_event_count_(0),
+    gc_totals_(),
+    allocation_profile_(nullptr),
+    allocation_countdown_(0),
+    allocation_top_(0),
+    perf_counters_(nullptr),
+    scavenger_pool_(nullptr),
+    scavenger_workers_(1),
     interpreter_(nullptr),
     handles_(),
     handles_size_(0),
     ephemeron_list_(nullptr),
+    waiting_ephemerons_(),
     weak_list_(nullptr) {
-  to_.Allocate(kInitialSemispaceCapacity);
-  from_.Allocate(kInitialSemispaceCapacity);
+  policy_.initial_semispace_capacity =
+      SemispaceCapacityFor(policy.initial_semispace_capacity,
+                           kInitialSemispaceCapacity);
+  policy_.max_semispace_capacity =
+      SemispaceCapacityFor(policy.max_semispace_capacity,
+                           kMaxSemispaceCapacity);
+  if (policy_.max_semispace_capacity < policy_.initial_semispace_capacity) {
+    policy_.max_semispace_capacity = policy_.initial_semispace_capacity;
+  }
+  if (policy_.retained_free_size == 0) {
+    policy_.retained_free_size = kDefaultRetainedFreeSize;
+  }
+  if (policy_.old_growth_percent == 0) {
+    policy_.old_growth_percent = kDefaultOldGrowthPercent;
+  } else if (policy_.old_growth_percent < 0) {
+    FATAL("Old-space growth must be positive");
+  }
 
-  remembered_set_capacity_ = 1024;
-  remembered_set_ = new HeapObject[remembered_set_capacity_];
+  next_semispace_capacity_ = policy_.initial_semispace_capacity;
+  to_.Allocate(policy_.initial_semispace_capacity, policy_.numa_node);
+  from_.Allocate(policy_.initial_semispace_capacity, policy_.numa_node);
 
   // Class table.
   class_table_capacity_ = 1024;
@@ -120,6 +284,7 @@ Heap::Heap() :
   }
 #endif
   class_table_size_ = kFirstRegularObjectCid;
+  pretenuring_ = new Pretenuring[class_table_capacity_]();
 }
 
 Heap::~Heap() {
@@ -131,8 +296,124 @@ Heap::~Heap() {
     region->Free();
     region = next;
   }
-  delete[] remembered_set_;
+  region = unswept_regions_;
+  while (region != nullptr) {
+    Region* next = region->next();
+    region->Free();
+    region = next;
+  }
+  region = large_regions_;
+  while (region != nullptr) {
+    Region* next = region->next();
+    region->Free();
+    region = next;
+  }
+  region = free_regions_;
+  while (region != nullptr) {
+    Region* next = region->next();
+    region->Free();
+    region = next;
+  }
   delete[] class_table_;
+  delete[] new_class_ids_;
+  delete[] pretenuring_;
+  delete allocation_profile_;
+  delete perf_counters_;
+}
+
+#if defined(ARCH_IS_32_BIT)
+static constexpr uword kFibonacciMultiplier = 2654435769u;
+#elif defined(ARCH_IS_64_BIT)
+static constexpr uword kFibonacciMultiplier = 11400714819323198485u;
+#endif
+
+intptr_t IdentityHashTable::IndexFor(uword addr) const {
+  ASSERT(capacity_ > 0);
+  uword h = (addr >> kObjectAlignmentLog2) * kFibonacciMultiplier;
+  return h >> (kBitsPerWord - Utils::HighestBit(capacity_));
+}
+
+intptr_t IdentityHashTable::Lookup(uword addr) const {
+  ASSERT(addr != 0);
+  if (size_ == 0) {
+    return 0;
+  }
+  intptr_t mask = capacity_ - 1;
+  for (intptr_t i = IndexFor(addr); ; i = (i + 1) & mask) {
+    if (entries_[i].addr == addr) {
+      return entries_[i].hash;
+    }
+    if (entries_[i].addr == 0) {
+      return 0;
+    }
+  }
+}
+
+void IdentityHashTable::Insert(uword addr, intptr_t hash) {
+  ASSERT(addr != 0);
+  ASSERT(hash != 0);
+  if (2 * (size_ + 1) > capacity_) {
+    Grow();
+  }
+  intptr_t mask = capacity_ - 1;
+  for (intptr_t i = IndexFor(addr); ; i = (i + 1) & mask) {
+    if (entries_[i].addr == addr) {
+      entries_[i].hash = hash;
+      return;
+    }
+    if (entries_[i].addr == 0) {
+      entries_[i].addr = addr;
+      entries_[i].hash = hash;
+      size_++;
+      return;
+    }
+  }
+}
+
+void IdentityHashTable::Remove(uword addr) {
+  ASSERT(addr != 0);
+  if (size_ == 0) {
+    return;
+  }
+  intptr_t mask = capacity_ - 1;
+  intptr_t i = IndexFor(addr);
+  while (entries_[i].addr != addr) {
+    if (entries_[i].addr == 0) {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+  size_--;
+
+  // Shift back later entries of the probe sequence into the hole.
+  intptr_t hole = i;
+  for (i = (i + 1) & mask; entries_[i].addr != 0; i = (i + 1) & mask) {
+    intptr_t home = IndexFor(entries_[i].addr);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      entries_[hole] = entries_[i];
+      hole = i;
+    }
+  }
+  entries_[hole].addr = 0;
+}
+
+void IdentityHashTable::Grow() {
+  intptr_t old_capacity;
+  Entry* old_entries = Release(&old_capacity);
+  capacity_ = old_capacity == 0 ? 64 : old_capacity * 2;
+  if (TRACE_GROWTH) {
+    OS::PrintErr("Growing identity hash table to %" Pd "\n", capacity_);
+  }
+  entries_ = new Entry[capacity_];
+  for (intptr_t i = 0; i < capacity_; i++) {
+    entries_[i].addr = 0;
+  }
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    if (old_entries[i].addr != 0) {
+      Insert(old_entries[i].addr, old_entries[i].hash);
+    }
+  }
+  delete[] old_entries;
 }
 
 Message Heap::AllocateMessage() {
@@ -155,7 +436,11 @@ Message Heap::AllocateMessage() {
   return static_cast<Message>(new_instance);
 }
 
-uword Heap::AllocateNormal(intptr_t size) {
+uword Heap::AllocateNormal(intptr_t size, intptr_t cid) {
+  if (allocation_profile_ != nullptr) {
+    SampleAllocation(size, cid);
+  }
+
   if (size >= kLargeAllocation) {
     return AllocateOldLarge(size, kControlGrowth);
   }
@@ -165,6 +450,8 @@ uword Heap::AllocateNormal(intptr_t size) {
     Scavenge(kNewSpace);
     if (old_size_ > old_limit_) {
       MarkSweep(kTenure);
+    } else if (IsIncrementalMarkingComplete()) {
+      MarkSweep(kMarkingComplete);
     }
     addr = top_;
     if (addr + size > end_) {
@@ -172,12 +459,77 @@ uword Heap::AllocateNormal(intptr_t size) {
     }
   }
   top_ = addr + size;
+  UpdateAllocationLimit();
 #if defined(DEBUG)
   memset(reinterpret_cast<void*>(addr), kUninitializedByte, size);
 #endif
   return addr;
 }
 
+uword Heap::AllocatePretenured(intptr_t size, intptr_t cid) {
+  if (allocation_profile_ != nullptr) {
+    SampleAllocation(size, cid);
+  }
+
+  if (size >= kLargeAllocation) {
+    return AllocateOldLarge(size, kControlGrowth);
+  }
+  return AllocateOldSmall(size, kControlGrowth);
+}
+
+AllocationProfile* Heap::SetAllocationProfile(AllocationProfile* profile) {
+  AllocationProfile* previous = allocation_profile_;
+  allocation_profile_ = profile;
+  if (profile != nullptr) {
+    allocation_countdown_ = profile->NextSampleDistance();
+  }
+  UpdateAllocationLimit();
+  return previous;
+}
+
+PerfCounters* Heap::SetPerfCounters(PerfCounters* counters) {
+  PerfCounters* previous = perf_counters_;
+  perf_counters_ = counters;
+  return previous;
+}
+
+// Called before the allocation it samples: the object is not yet initialized,
+// and allocating it may collect garbage.
+void Heap::SampleAllocation(intptr_t size, intptr_t cid) {
+  if (size >= allocation_profile_->interval()) {
+    allocation_profile_->RecordSample(this, cid, size,
+                                      interpreter_->CurrentMethod());
+    return;
+  }
+  ChargeAllocationCountdown();
+  allocation_countdown_ -= size;
+  if (allocation_countdown_ <= 0) {
+    allocation_profile_->RecordSample(this, cid, size,
+                                      interpreter_->CurrentMethod());
+    allocation_countdown_ = allocation_profile_->NextSampleDistance();
+  }
+  UpdateAllocationLimit();
+}
+
+void Heap::ChargeAllocationCountdown() {
+  if (allocation_profile_ != nullptr) {
+    allocation_countdown_ -= top_ - allocation_top_;
+    allocation_top_ = top_;
+  }
+}
+
+// Whenever top_ or end_ is moved other than by the fast path.
+void Heap::UpdateAllocationLimit() {
+  limit_ = end_;
+  if (allocation_profile_ != nullptr) {
+    ASSERT(allocation_countdown_ >= 0);
+    allocation_top_ = top_;
+    if (static_cast<uword>(allocation_countdown_) < end_ - top_) {
+      limit_ = top_ + allocation_countdown_;
+    }
+  }
+}
+
 uword Heap::AllocateCopy(intptr_t size) {
   uword result = top_;
   intptr_t remaining = end_ - top_;
@@ -188,14 +540,56 @@ uword Heap::AllocateCopy(intptr_t size) {
 }
 
 uword Heap::AllocateTenure(intptr_t size) {
-  uword result = AllocateOldSmall(size, kForceGrowth);
+  uword result = tenure_top_;
+  if (result + size <= tenure_end_) {
+    tenure_top_ = result + size;
+  } else {
+    result = RefillTenureBuffer(size);
+  }
   PushTenureStack(result);
   return result;
 }
 
-uword Heap::AllocateOldSmall(intptr_t size, GrowthPolicy growth) {
+uword Heap::RefillTenureBuffer(intptr_t size) {
+  if (size > kTenureBufferSize / 4) {
+    // Don't waste the rest of the buffer on a large object.
+    return AllocateOldSmall(size, kForceGrowth);
+  }
+
+  RetireTenureBuffer();
+  intptr_t chunk_size = 0;
+  uword chunk = freelist_.TryAllocateChunk(kTenureBufferSize, &chunk_size);
+  while ((chunk == 0) && SweepNextRegion()) {
+    chunk = freelist_.TryAllocateChunk(kTenureBufferSize, &chunk_size);
+  }
+  if (chunk == 0) {
+    // Only fragments are left. Allocating a region puts its remainder on the
+    // free list, for the next refill to take.
+    return AllocateOldSmall(size, kForceGrowth);
+  }
+  old_size_ += chunk_size;
+  tenure_top_ = chunk + size;
+  tenure_end_ = chunk + chunk_size;
+  return chunk;
+}
+
+void Heap::RetireTenureBuffer() {
+  intptr_t remaining = tenure_end_ - tenure_top_;
+  if (remaining > 0) {
+    freelist_.EnqueueRange(tenure_top_, remaining);
+    old_size_ -= remaining;
+  }
+  tenure_top_ = tenure_end_ = 0;
+}
+
+uword Heap::AllocateOldSmall(intptr_t size,
+                             GrowthPolicy growth,
+                             SweepPolicy sweep) {
   ASSERT(size < kLargeAllocation);
   uword addr = freelist_.TryAllocate(size);
+  while ((addr == 0) && (sweep == kMaySweep) && SweepNextRegion()) {
+    addr = freelist_.TryAllocate(size);
+  }
   if (addr == 0) {
     Region* region = AllocateRegion(kRegionSize, growth);
     addr = region->TryAllocate(size);
@@ -213,10 +607,19 @@ uword Heap::AllocateOldSmall(intptr_t size, GrowthPolicy growth) {
   return addr;
 }
 
+// Whether a large object will use its cards is only known after allocation,
+// and the table costs 1/kCardSize of the object, so every large object gets
+// one.
+static intptr_t CardTableSize(intptr_t size) {
+  return AllocationSize(Utils::RoundUp(size, kCardSize) >> kCardSizeLog2);
+}
+
 uword Heap::AllocateOldLarge(intptr_t size, GrowthPolicy growth) {
   ASSERT(size >= kLargeAllocation);
-  Region* region = AllocateRegion(size + AllocationSize(sizeof(Region)),
-                                  growth);
+  intptr_t card_table_size = CardTableSize(size);
+  Region* region = AllocateRegion(size + card_table_size +
+                                      AllocationSize(sizeof(Region)),
+                                  growth, card_table_size);
   uword addr = region->TryAllocate(size);
   ASSERT(addr != 0);
   old_size_ += size;
@@ -233,83 +636,282 @@ uword Heap::AllocateSnapshot(intptr_t size) {
 
   uword addr = top_;
   if (addr + size > end_) {
-    intptr_t remaining = end_ - top_;
-    if (remaining > 0) {
-      freelist_.EnqueueRange(top_, remaining);
-      old_size_ -= remaining;
-    }
-    Region* region = AllocateRegion(kRegionSize, kForceGrowth);
-    top_ = region->object_start();
-    end_ = region->limit();
-    region->set_object_end(end_);
-    remaining = end_ - top_;
-    old_size_ += remaining;
-    ASSERT(size <= remaining);
+    StartSnapshotRegion(kRegionSize);
+    ASSERT(size <= static_cast<intptr_t>(end_ - top_));
     addr = top_;
   }
   top_ = addr + size;
+  UpdateAllocationLimit();
 #if defined(DEBUG)
   memset(reinterpret_cast<void*>(addr), kUninitializedByte, size);
 #endif
   return addr;
 }
 
-Region* Heap::AllocateRegion(intptr_t region_size, GrowthPolicy growth) {
+void Heap::ReserveSnapshot(intptr_t size) {
+  if (size <= static_cast<intptr_t>(end_ - top_)) {
+    return;
+  }
+  StartSnapshotRegion(Utils::RoundUp(size + AllocationSize(sizeof(Region)),
+                                     kRegionSize));
+  UpdateAllocationLimit();
+}
+
+void Heap::StartSnapshotRegion(intptr_t region_size) {
+  intptr_t remaining = end_ - top_;
+  if (remaining > 0) {
+    freelist_.EnqueueRange(top_, remaining);
+    old_size_ -= remaining;
+  }
+  Region* region = AllocateRegion(region_size, kForceGrowth);
+  top_ = region->object_start();
+  end_ = region->limit();
+  region->set_object_end(end_);
+  old_size_ += end_ - top_;
+}
+
+Region* Heap::AllocateRegion(intptr_t region_size,
+                             GrowthPolicy growth,
+                             intptr_t card_table_size) {
   if ((growth == kControlGrowth) && ((old_size_ + region_size) > old_limit_)) {
     MarkSweep(kOldSpace);
   }
-  Region* region = Region::Allocate(region_size);
+  Region* region;
+  if ((card_table_size == 0) && (region_size == kRegionSize) &&
+      (free_regions_ != nullptr)) {
+    region = free_regions_;
+    free_regions_ = region->next();
+    free_regions_size_ -= region->size();
+    region->Reset();
+  } else {
+    region = Region::Allocate(region_size, card_table_size,
+                              policy_.numa_node);
+  }
   old_capacity_ += region->size();
-  region->set_next(regions_);
-  regions_ = region;
+  if (region->is_large()) {
+    region->set_next(large_regions_);
+    large_regions_ = region;
+  } else {
+    region->set_next(regions_);
+    regions_ = region;
+  }
+  return region;
+}
+
+// static
+Region* Heap::NewDetachedByteArray(intptr_t length) {
+  intptr_t heap_size =
+      AllocationSize(length * sizeof(uint8_t) + sizeof(ByteArray::Layout));
+  if (heap_size < kLargeAllocation) {
+    return nullptr;
+  }
+  intptr_t card_table_size = CardTableSize(heap_size);
+  Region* region = Region::Allocate(heap_size + card_table_size +
+                                        AllocationSize(sizeof(Region)),
+                                    card_table_size, -1);
+  uword addr = region->TryAllocate(heap_size);
+  ASSERT(addr != 0);
+  HeapObject obj = HeapObject::Initialize(addr, kByteArrayCid, heap_size);
+  ByteArray result = static_cast<ByteArray>(obj);
+  result->set_size(SmallInteger::New(length));
   return region;
 }
 
-void Heap::GrowRememberedSet() {
+// static
+ByteArray Heap::DetachedByteArray(Region* region) {
+  ASSERT(region->is_large());
+  return static_cast<ByteArray>(HeapObject::FromAddr(region->object_start()));
+}
+
+// static
+void Heap::FreeDetachedRegion(Region* region) {
+  ASSERT(region->is_large());
+  region->Free();
+}
+
+Region* Heap::DetachByteArray(ByteArray bytes) {
+  ASSERT(bytes->IsByteArray());
+  intptr_t heap_size = bytes->HeapSize();
+  if (!bytes->IsOldObject() || (heap_size < kLargeAllocation)) {
+    return nullptr;
+  }
+  Region* region = reinterpret_cast<Region*>(
+      bytes->Addr() - CardTableSize(heap_size) -
+      AllocationSize(sizeof(Region)));
+  ASSERT(region->is_large());
+  ASSERT(region->object_start() == bytes->Addr());
+
+  // The sender keeps an empty ByteArray with the same identity, on pages that
+  // are copied. Its mark bit must survive in case marking is under way.
+  intptr_t empty_size = AllocationSize(sizeof(ByteArray::Layout));
+  intptr_t keep = Utils::RoundUp(bytes->Addr() + empty_size,
+                                 VirtualMemory::PageSize()) -
+                  reinterpret_cast<uword>(region);
+  if (keep >= static_cast<intptr_t>(region->size())) {
+    return nullptr;
+  }
+  intptr_t old_region_size = region->size();
+  Region* detached = region->MovePages(keep, policy_.numa_node);
+  if (detached == nullptr) {
+    return nullptr;
+  }
+  old_capacity_ -= old_region_size - region->size();
+
+  bool is_marked = bytes->is_marked();
+  HeapObject obj =
+      HeapObject::Initialize(bytes->Addr(), kByteArrayCid, empty_size);
+  ByteArray empty = static_cast<ByteArray>(obj);
+  empty->set_size(SmallInteger::New(0));
+  empty->set_is_marked(is_marked);
+  ASSERT(empty->HeapSize() == empty_size);
+  region->set_object_end(empty->Addr() + empty_size);
+  old_size_ -= heap_size - empty_size;
+  return detached;
+}
+
+ByteArray Heap::AdoptByteArray(Region* region) {
+  ASSERT(region->is_large());
+  if ((old_size_ + region->size()) > old_limit_) {
+    MarkSweep(kOldSpace);
+  }
+  old_capacity_ += region->size();
+  old_size_ += region->object_end() - region->object_start();
+  region->set_next(large_regions_);
+  large_regions_ = region;
+
+  HeapObject obj = HeapObject::FromAddr(region->object_start());
+  ByteArray result = static_cast<ByteArray>(obj);
+  result->set_is_marked(false);  // By the sender's marker.
+  ASSERT(result->IsByteArray());
+  ASSERT(result->Addr() + result->HeapSize() == region->object_end());
+  return result;
+}
+
+StoreBuffer::StoreBuffer()
+    : head_(nullptr), size_(0), blocks_(0), pool_(nullptr), pooled_(0) {}
+
+StoreBuffer::~StoreBuffer() {
+  Clear();
+  while (pool_ != nullptr) {
+    Block* next = pool_->next;
+    delete pool_;
+    pool_ = next;
+  }
+}
+
+void StoreBuffer::AddBlock() {
   // TODO(rmacnak): Investigate a limit to trigger GC instead of letting this
   // grow in an unbounded way.
-  remembered_set_capacity_ += (remembered_set_capacity_ >> 1);
-  if (TRACE_GROWTH) {
-    OS::PrintErr("Growing remembered set to %" Pd "\n",
-                 remembered_set_capacity_);
+  Block* block = pool_;
+  if (block != nullptr) {
+    pool_ = block->next;
+    pooled_--;
+  } else {
+    block = new Block;
+    if (TRACE_GROWTH) {
+      OS::PrintErr("Growing remembered set to %" Pd " blocks\n",
+                   blocks_ + 1);
+    }
   }
-  HeapObject* old_remembered_set = remembered_set_;
-  remembered_set_ = new HeapObject[remembered_set_capacity_];
-  for (intptr_t i = 0; i < remembered_set_size_; i++) {
-    remembered_set_[i] = old_remembered_set[i];
+  block->next = head_;
+  block->size = 0;
+  head_ = block;
+  blocks_++;
+}
+
+void StoreBuffer::Append(StoreBuffer* other) {
+  Block* blocks = other->head_;
+  if (blocks == nullptr) {
+    return;
+  }
+  Block* last = blocks;
+  while (last->next != nullptr) {
+    last = last->next;
   }
-  delete[] old_remembered_set;
+  // Behind the block being filled, which stays first.
+  if (head_ == nullptr) {
+    head_ = blocks;
+  } else {
+    last->next = head_->next;
+    head_->next = blocks;
+  }
+  size_ += other->size_;
+  blocks_ += other->blocks_;
+  other->head_ = nullptr;
+  other->size_ = 0;
+  other->blocks_ = 0;
+}
+
+StoreBuffer::Block* StoreBuffer::TakeBlocks() {
+  Block* blocks = head_;
+  head_ = nullptr;
+  size_ = 0;
+  return blocks;
 }
 
-void Heap::ShrinkRememberedSet() {
-  intptr_t preferred_capacity =
-      Utils::RoundUp(remembered_set_size_ + (remembered_set_size_ >> 1) + 1,
-                     KB);
+void StoreBuffer::Release(Block* block) {
+  block->next = pool_;
+  pool_ = block;
+  pooled_++;
+  blocks_--;
+}
+
+void StoreBuffer::Clear() {
+  Block* block = TakeBlocks();
+  while (block != nullptr) {
+    Block* next = block->next;
+    Release(block);
+    block = next;
+  }
+  ASSERT(blocks_ == 0);
+}
 
-  if (remembered_set_capacity_ <= preferred_capacity) {
+void StoreBuffer::Trim() {
+  intptr_t keep = kMinPooled + (blocks_ >> 1);
+  if (pooled_ <= keep) {
     return;
   }
-  remembered_set_capacity_ = preferred_capacity;
   if (TRACE_GROWTH) {
-    OS::PrintErr("Shrinking remembered set to %" Pd "\n",
-                 remembered_set_capacity_);
+    OS::PrintErr("Shrinking remembered set pool to %" Pd " blocks\n", keep);
   }
-  HeapObject* old_remembered_set = remembered_set_;
-  remembered_set_ = new HeapObject[remembered_set_capacity_];
-  for (intptr_t i = 0; i < remembered_set_size_; i++) {
-    remembered_set_[i] = old_remembered_set[i];
+  while (pooled_ > keep) {
+    Block* next = pool_->next;
+    delete pool_;
+    pool_ = next;
+    pooled_--;
+  }
+}
+
+void MarkingStack::Grow() {
+  intptr_t new_capacity = capacity_ == 0 ? 1024 : capacity_ + (capacity_ >> 1);
+  if (TRACE_GROWTH) {
+    OS::PrintErr("Growing marking stack to %" Pd "\n", new_capacity);
+  }
+  HeapObject* old_objects = objects_;
+  objects_ = new HeapObject[new_capacity];
+  for (intptr_t i = 0; i < size_; i++) {
+    objects_[i] = old_objects[i];
   }
-  delete[] old_remembered_set;
+  delete[] old_objects;
+  capacity_ = new_capacity;
+}
+
+// A heap that has not yet been given its interpreter belongs to no isolate.
+static const Isolate* TraceIsolate(Interpreter* interpreter) {
+  return interpreter == nullptr ? nullptr : interpreter->isolate();
 }
 
 NOINLINE
 void Heap::Scavenge(Reason reason) {
-#if REPORT_GC
+  PerfScope perf_scope(this, PerfCounters::kScavenge);
+  TraceScope trace_scope("scavenge", TraceIsolate(interpreter_));
   int64_t start = OS::CurrentMonotonicNanos();
   size_t new_before = top_ - to_.object_start();
-#endif
   size_t old_before = old_size_;
 
+  bool parallel = ShouldScavengeInParallel(top_ - to_.object_start());
+
+  ChargeAllocationCountdown();
   FlipSpaces();
 
 #if defined(DEBUG)
@@ -319,27 +921,55 @@ void Heap::Scavenge(Reason reason) {
   interpreter_->GCPrologue();
 
   // Strong references.
-  ScavengeRoots();
-  uword scan = to_.object_start();
-  while (scan < top_ || end_ < to_.limit()) {
-    scan = ScavengeToSpace(scan);
-    ProcessTenureStack();
-    ScavengeEphemeronList();
+  if (parallel) {
+    ScavengeParallel();
+  } else {
+    ScavengeRoots();
+    uword scan = to_.object_start();
+    while (scan < top_ || end_ < to_.limit() ||
+           ephemeron_list_ != nullptr) {
+      scan = ScavengeToSpace(scan);
+      ProcessTenureStack();
+      ScavengeEphemeronList();
+    }
+    RetireTenureBuffer();
   }
 
   // Weak references.
   MournEphemeronList();
   MournWeakListScavenge();
   MournClassTableScavenge();
+  MournIdentityHashesScavenge();
+
+  if (PRETENURING && (--scavenges_until_census_ == 0)) {
+    scavenges_until_census_ = kPretenureCensusInterval;
+    // Survivors of the previous scavenge were copied first.
+    uword start = survivor_end_ < from_.object_start()
+        ? from_.object_start()
+        : survivor_end_;
+    PretenureCensus(start, from_.object_start() + new_before);
+  }
 
 #if defined(DEBUG)
   from_.MarkUnallocated();
   from_.NoAccess();
 #endif
 
+  if (INCREMENTAL_MARKING) {
+    if (marking_) {
+      ASSERT(old_size_ >= marking_old_size_);
+      intptr_t growth = old_size_ - marking_old_size_;
+      IncrementalMarkingStep(kMinMarkingStep + kMarkingStepRatio * growth);
+    } else if (old_size_ > old_marking_threshold_) {
+      StartIncrementalMarking();
+    }
+  }
+
   interpreter_->GCEpilogue();
 
   survivor_end_ = top_;
+  UpdateAllocationLimit();
+  AdaptTenuringThreshold();
 
   size_t new_after = top_ - to_.object_start();
   size_t old_after = old_size_;
@@ -348,20 +978,20 @@ void Heap::Scavenge(Reason reason) {
 
   if (survived > (to_.size() / 3)) {
     next_semispace_capacity_ = to_.size() * 2;
-    if (next_semispace_capacity_ > kMaxSemispaceCapacity) {
-      next_semispace_capacity_ = kMaxSemispaceCapacity;
+    if (next_semispace_capacity_ > policy_.max_semispace_capacity) {
+      next_semispace_capacity_ = policy_.max_semispace_capacity;
     }
   }
 
-#if REPORT_GC
-  size_t freed = (new_before + old_before) - (new_after + old_after);
-  int64_t stop = OS::CurrentMonotonicNanos();
-  int64_t time = stop - start;
-  OS::PrintErr("Scavenge (%s, %" Pd "kB new, "
-               "%" Pd "kB tenured, %" Pd "kB freed, %" Pd64 " us)\n",
-               ReasonToCString(reason), new_after / KB, tenured / KB,
-               freed / KB, time / kNanosecondsPerMicrosecond);
-#endif
+  GCEvent event;
+  event.kind = GCEvent::kScavenge;
+  event.reason = reason;
+  event.flags = parallel ? GCEvent::kParallel : 0;
+  event.start = start;
+  event.size_before = new_before + old_before;
+  event.size_after = new_after + old_after;
+  event.tenured = tenured;
+  RecordGCEvent(&event);
 }
 
 void Heap::FlipSpaces() {
@@ -369,14 +999,14 @@ void Heap::FlipSpaces() {
   to_ = from_;
   from_ = temp;
 
-  ASSERT(next_semispace_capacity_ <= kMaxSemispaceCapacity);
+  ASSERT(next_semispace_capacity_ <= policy_.max_semispace_capacity);
   if (to_.size() < next_semispace_capacity_) {
     if (TRACE_GROWTH && (from_.size() < next_semispace_capacity_)) {
       OS::PrintErr("Growing new space to %" Pd "MB\n",
                    next_semispace_capacity_ / MB);
     }
     to_.Free();
-    to_.Allocate(next_semispace_capacity_);
+    to_.Allocate(next_semispace_capacity_, policy_.numa_node);
   }
 
   ASSERT(to_.size() >= from_.size());
@@ -386,6 +1016,45 @@ void Heap::FlipSpaces() {
   ASSERT((top_ & kObjectAlignmentMask) == kNewObjectAlignmentOffset);
 }
 
+void Heap::CollectIdle() {
+  // Nothing survives in new-space, and with no survivors to count the
+  // scavenge sets the threshold back to its maximum.
+  tenuring_threshold_ = 0;
+  Scavenge(kIdle);
+  ASSERT(top_ == to_.object_start());
+
+  next_semispace_capacity_ = policy_.initial_semispace_capacity;
+  if ((to_.size() > next_semispace_capacity_) ||
+      (from_.size() > next_semispace_capacity_)) {
+    if (TRACE_GROWTH) {
+      OS::PrintErr("Shrinking new space to %" Pd "MB\n",
+                   next_semispace_capacity_ / MB);
+    }
+    to_.Free();
+    from_.Free();
+    to_.Allocate(next_semispace_capacity_, policy_.numa_node);
+    from_.Allocate(next_semispace_capacity_, policy_.numa_node);
+#if defined(DEBUG)
+    from_.NoAccess();
+#endif
+    top_ = to_.object_start();
+    end_ = to_.limit();
+    survivor_end_ = top_;
+    UpdateAllocationLimit();
+  }
+
+  MarkSweep(kIdle);
+  FinishSweeping();
+  Region* region = free_regions_;
+  while (region != nullptr) {
+    Region* next = region->next();
+    region->Free();
+    region = next;
+  }
+  free_regions_ = nullptr;
+  free_regions_size_ = 0;
+}
+
 static bool ForwardClass(Heap* heap, HeapObject object) {
   ASSERT(object->IsHeapObject());
   Behavior old_class = heap->ClassAt(object->cid());
@@ -414,15 +1083,20 @@ static bool ForwardPointer(Object* ptr) {
 
 void Heap::ScavengeRoots() {
   // Process the remembered set first so we can visit and reset in one pass.
-  intptr_t saved_remembered_set_size = remembered_set_size_;
-  remembered_set_size_ = 0;
-
-  for (intptr_t i = 0; i < saved_remembered_set_size; i++) {
-    HeapObject obj = remembered_set_[i];
-    ASSERT(obj->IsOldObject());
-    ASSERT(obj->is_remembered());
-    obj->set_is_remembered(false);
-    ScavengeOldObject(obj);
+  // Each block goes back to the pool once visited, to take the entries that
+  // remain.
+  StoreBuffer::Block* block = remembered_set_.TakeBlocks();
+  while (block != nullptr) {
+    StoreBuffer::Block* next = block->next;
+    for (intptr_t i = 0; i < block->size; i++) {
+      HeapObject obj = block->objects[i];
+      ASSERT(obj->IsOldObject());
+      ASSERT(obj->is_remembered());
+      obj->set_is_remembered(false);
+      ScavengeOldObject(obj);
+    }
+    remembered_set_.Release(block);
+    block = next;
   }
 
   for (intptr_t i = 0; i < handles_size_; i++) {
@@ -435,9 +1109,10 @@ void Heap::ScavengeRoots() {
   for (Object* ptr = from; ptr <= to; ptr++) {
     ScavengePointer(ptr);
   }
-  interpreter_->StackPointers(&from, &to);
-  for (Object* ptr = from; ptr <= to; ptr++) {
-    ScavengePointer(ptr);
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ScavengePointer(ptr);
+    }
   }
 }
 
@@ -487,6 +1162,10 @@ bool Heap::IsTenureStackEmpty() {
 void Heap::ProcessTenureStack() {
   while (!IsTenureStackEmpty()) {
     HeapObject obj = HeapObject::FromAddr(PopTenureStack());
+    if (marking_) {
+      // The copied slots never went through the marking barrier.
+      ShadeObject(obj);
+    }
     ScavengeOldObject(obj);
   }
 }
@@ -527,9 +1206,10 @@ bool Heap::ScavengePointer(Object* ptr) {
   } else {
     // Target is now known to be reachable. Move it to to-space.
     intptr_t size = old_target->HeapSize();
+    intptr_t age = old_target->age();
 
     uword new_target_addr;
-    if (old_target->Addr() < survivor_end_) {
+    if (age >= tenuring_threshold_) {
       new_target_addr = AllocateTenure(size);
     } else {
       new_target_addr = AllocateCopy(size);
@@ -540,7 +1220,12 @@ bool Heap::ScavengePointer(Object* ptr) {
            reinterpret_cast<void*>(old_target->Addr()),
            size);
     new_target = HeapObject::FromAddr(new_target_addr);
+    CountSurvivor(new_target, age, size);
     SetForwarded(old_target, new_target);
+    if (new_target->is_waiting_key()) {
+      new_target->set_is_waiting_key(false);
+      WakeEphemerons(old_target->Addr());
+    }
   }
 
   DEBUG_ASSERT(new_target->IsOldObject() || InToSpace(new_target));
@@ -560,13 +1245,21 @@ void Heap::ScavengeOldObject(HeapObject obj) {
     if (ScavengeClass(cid)) {
       has_new_target = true;
     }
-    Object* from;
-    Object* to;
-    obj->Pointers(&from, &to);
-    for (Object* ptr = from; ptr <= to; ptr++) {
-      if (ScavengePointer(ptr)) {
+    if (obj->is_carded()) {
+      if (VisitDirtyCards(obj, [this](Object* ptr) {
+            return ScavengePointer(ptr);
+          })) {
         has_new_target = true;
       }
+    } else {
+      Object* from;
+      Object* to;
+      obj->Pointers(&from, &to);
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        if (ScavengePointer(ptr)) {
+          has_new_target = true;
+        }
+      }
     }
     if (has_new_target) {
       AddToRememberedSet(obj);
@@ -592,9 +1285,10 @@ bool Heap::ScavengeClass(intptr_t cid) {
 
   // Target is now known to be reachable. Move it to to-space.
   intptr_t size = old_target->HeapSize();
+  intptr_t age = old_target->age();
 
   uword new_target_addr;
-  if (old_target->Addr() < survivor_end_) {
+  if (age >= tenuring_threshold_) {
     new_target_addr = AllocateTenure(size);
   } else {
     new_target_addr = AllocateCopy(size);
@@ -605,135 +1299,1730 @@ bool Heap::ScavengeClass(intptr_t cid) {
          reinterpret_cast<void*>(old_target->Addr()),
          size);
   HeapObject new_target = HeapObject::FromAddr(new_target_addr);
+  CountSurvivor(new_target, age, size);
   SetForwarded(old_target, new_target);
+  if (new_target->is_waiting_key()) {
+    new_target->set_is_waiting_key(false);
+    WakeEphemerons(old_target->Addr());
+  }
   return true;
 }
 
-NOINLINE
-void Heap::MarkSweep(Reason reason) {
-#if REPORT_GC
-  int64_t start = OS::CurrentMonotonicNanos();
-  size_t size_before = old_size_;
-#endif
-
-#if defined(DEBUG)
-  from_.ReadWrite();
-#endif
+// Ages a survivor kept in new-space. Old objects carry no age.
+void Heap::CountSurvivor(HeapObject new_target, intptr_t age, intptr_t size) {
+  if (new_target->IsNewObject()) {
+    ASSERT(age < kMaxTenuringThreshold);
+    new_target->set_age(age + 1);
+    survivor_sizes_[age + 1] += size;
+  } else {
+    new_target->set_age(0);
+  }
+}
 
-  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
-  mark_stack->Init(from_.limit());
+// Tenures the survivors of as many scavenges as keep the survivors of fewer
+// within the target share of a semispace, so medium-lived objects die in
+// new-space when there is room for them and the survivors of a burst of
+// allocation do not crowd out the next scavenge's. A new object always stays
+// through its first scavenge.
+void Heap::AdaptTenuringThreshold() {
+  size_t desired = to_.size() / 100 * kTargetSurvivorPercent;
+  size_t total = 0;
+  intptr_t threshold = 1;
+  while (threshold < kMaxTenuringThreshold) {
+    total += survivor_sizes_[threshold];
+    if (total > desired) {
+      break;
+    }
+    threshold++;
+  }
+  tenuring_threshold_ = threshold;
+  for (intptr_t age = 0; age <= kMaxTenuringThreshold; age++) {
+    survivor_sizes_[age] = 0;
+  }
+}
+
+// Visits the objects of from-space allocated since the previous scavenge, after
+// the survivors among them have been forwarded.
+void Heap::PretenureCensus(uword start, uword end) {
+  for (uword scan = start; scan < end;) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    bool survived = IsForwarded(obj);
+    HeapObject object = survived ? ForwardingTarget(obj) : obj;
+    intptr_t cid = object->cid();
+    intptr_t size = object->HeapSize();
+    if (cid >= kFirstRegularObjectCid) {
+      pretenuring_[cid].allocated += size;
+      if (survived) {
+        pretenuring_[cid].survived += size;
+      }
+    }
+    scan += size;
+  }
+
+  for (intptr_t cid = kFirstRegularObjectCid; cid < class_table_size_; cid++) {
+    Pretenuring* entry = &pretenuring_[cid];
+    if (!entry->pretenured &&
+        (entry->allocated >= kPretenureMinAllocation) &&
+        (entry->survived * 100 >=
+         entry->allocated * kPretenureSurvivalPercent)) {
+      if (TRACE_PRETENURING) {
+        OS::PrintErr("Pretenuring cid %" Pd ": %" Pd " of %" Pd
+                     " bytes survived\n", cid,
+                     static_cast<intptr_t>(entry->survived),
+                     static_cast<intptr_t>(entry->allocated));
+      }
+      entry->pretenured = true;
+    }
+    entry->allocated = 0;
+    entry->survived = 0;
+  }
+}
+
+void Heap::ResetPretenuring() {
+  for (intptr_t cid = kFirstRegularObjectCid; cid < class_table_size_; cid++) {
+    pretenuring_[cid].pretenured = false;
+  }
+}
+
+void Heap::ConfigureParallelScavenge(ThreadPool* pool, intptr_t workers) {
+  if (workers > kMaxScavengerWorkers) {
+    workers = kMaxScavengerWorkers;
+  }
+  if ((pool == nullptr) || (workers < 1)) {
+    workers = 1;
+  }
+  scavenger_pool_ = pool;
+  scavenger_workers_ = workers;
+}
+
+bool Heap::ShouldScavengeInParallel(size_t new_used) const {
+  return (scavenger_workers_ > 1) && (new_used >= kParallelScavengeThreshold);
+}
+
+uword Heap::TryAllocateCopyBuffer(intptr_t min_size,
+                                  intptr_t preferred_size,
+                                  intptr_t* size) {
+  ASSERT(min_size <= preferred_size);
+  uword top = AtomicOperations::LoadRelaxed(&top_);
+  intptr_t taken;
+  do {
+    // New-space starts off double-word alignment, so the last buffer leaves
+    // the final word unused.
+    intptr_t remaining = Utils::RoundDown(end_ - top, kObjectAlignment);
+    if (remaining < min_size) {
+      return 0;
+    }
+    taken = remaining < preferred_size ? remaining : preferred_size;
+  } while (!AtomicOperations::CompareAndSwap(&top_, &top, top + taken));
+  *size = taken;
+  return top;
+}
+
+// Written into the header of a from-space object while a worker copies it.
+// Has the mark bit set like a forwarding pointer, but is never a valid
+// address.
+static constexpr uword kClaimedHeader = kHeapObjectTag;
+
+static void FillWithFreeListElement(uword addr, intptr_t size) {
+  HeapObject object = HeapObject::Initialize(addr, kFreeListElementCid, size);
+  FreeListElement element = static_cast<FreeListElement>(object);
+  if (element->heap_size() == 0) {
+    ASSERT(size > kObjectAlignment);
+    element->set_overflow_size(size);
+  }
+  ASSERT(object->HeapSize() == size);
+  ASSERT(element->HeapSize() == size);
+}
+
+// The state shared by the threads of one parallel scavenge: the remembered set
+// being claimed in chunks, and a queue of copied-but-unscanned ranges that
+// idle workers take from. The scavenge terminates when every worker is idle
+// and the queue is empty.
+class ParallelScavenge {
+ public:
+  ParallelScavenge(Heap* heap, intptr_t num_workers);
+  ~ParallelScavenge();
+
+  Heap* heap() const { return heap_; }
+  intptr_t num_workers() const { return num_workers_; }
+  ScavengerWorker* worker(intptr_t i) const;
+  Mutex* old_space_mutex() { return &old_space_mutex_; }
+
+  void StartHelpers(ThreadPool* pool);
+  void HelperDone();
+  void WaitForHelpers();
+
+  StoreBuffer::Block* ClaimRememberedSetBlock();
+
+  void PushRange(uword start, uword end);
+  // Blocks until a range is available or the scavenge has terminated.
+  bool PopRange(uword* start, uword* end);
+
+  // Following drains are run by worker 0 alone.
+  void BeginSerialPhase() {
+    ASSERT(running_helpers_ == 0);
+    active_workers_ = 1;
+    idle_workers_ = 0;
+  }
+
+  // Takes the remembered set's blocks to be claimed, and hands them back to
+  // it empty.
+  void TakeRememberedSet(StoreBuffer* remembered_set);
+  void ReleaseRememberedSet(StoreBuffer* remembered_set);
+
+ private:
+  struct Range {
+    uword start;
+    uword end;
+  };
+
+  Heap* const heap_;
+  const intptr_t num_workers_;
+  ScavengerWorker* workers_;
+
+  Mutex old_space_mutex_;
+
+  Monitor monitor_;
+  Range* ranges_;
+  intptr_t ranges_size_;
+  intptr_t ranges_capacity_;
+  intptr_t active_workers_;
+  intptr_t idle_workers_;
+  intptr_t running_helpers_;
+
+  StoreBuffer::Block** remembered_set_blocks_;
+  intptr_t remembered_set_cursor_;
+  intptr_t remembered_set_size_;  // In blocks.
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelScavenge);
+};
+
+// One thread's part of a parallel scavenge. Each worker copies into its own
+// to-space and old-space buffers and Cheney-scans them, handing buffers it
+// retires before they are fully scanned to the shared queue. Workers race to
+// forward an object by claiming its header with a compare-and-swap.
+class ScavengerWorker {
+ public:
+  ScavengerWorker();
+  ~ScavengerWorker();
+
+  void Init(ParallelScavenge* scavenge);
+
+  void ScavengeRoots();
+  void ScavengeRememberedSet();
+  void Drain();
+  bool ScavengeEphemeronList();
+  void Finish();
+
+ private:
+  static constexpr intptr_t kCopyBufferSize = 64 * KB;
+  static constexpr intptr_t kTenureBufferSize = 16 * KB;
+
+  HeapObject Forward(HeapObject old_target);
+  bool ScavengePointer(Object* ptr);
+  bool ScavengeClass(intptr_t cid);
+  void ScavengeNewObject(HeapObject obj);
+  void ScavengeOldObject(HeapObject obj);
+  void ScavengeTenuredObject(HeapObject obj);
+  void ScanRange(uword start, uword end);
+
+  uword AllocateCopy(intptr_t size, bool* direct);
+  uword AllocateTenure(intptr_t size, bool* direct);
+  void RetireCopyBuffer();
+  void RetireTenureBuffer();
+
+  void AddToRememberedSet(HeapObject obj);
+  void AddToWeakList(WeakArray survivor);
+  void AddToEphemeronList(Ephemeron survivor);
+
+  ParallelScavenge* scavenge_;
+  Heap* heap_;
+
+  uword copy_scan_;
+  uword copy_top_;
+  uword copy_end_;
+
+  uword tenure_scan_;
+  uword tenure_top_;
+  uword tenure_end_;
+
+  StoreBuffer remembered_set_;
+
+  WeakArray weak_list_;
+  Ephemeron ephemeron_list_;
+
+  // Objects tenured while incremental marking is in progress.
+  MarkingStack tenured_;
+
+  size_t survivor_sizes_[Heap::kMaxTenuringThreshold + 1];
+
+  DISALLOW_COPY_AND_ASSIGN(ScavengerWorker);
+};
+
+class ScavengeTask : public ThreadPool::Task {
+ public:
+  ScavengeTask(ParallelScavenge* scavenge, ScavengerWorker* worker)
+      : scavenge_(scavenge), worker_(worker) {}
+
+  virtual void Run() {
+    worker_->ScavengeRememberedSet();
+    worker_->Drain();
+    scavenge_->HelperDone();
+  }
+
+ private:
+  ParallelScavenge* scavenge_;
+  ScavengerWorker* worker_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScavengeTask);
+};
+
+ParallelScavenge::ParallelScavenge(Heap* heap, intptr_t num_workers)
+    : heap_(heap),
+      num_workers_(num_workers),
+      workers_(new ScavengerWorker[num_workers]),
+      old_space_mutex_(),
+      monitor_(),
+      ranges_(nullptr),
+      ranges_size_(0),
+      ranges_capacity_(0),
+      active_workers_(1),
+      idle_workers_(0),
+      running_helpers_(0),
+      remembered_set_blocks_(nullptr),
+      remembered_set_cursor_(0),
+      remembered_set_size_(0) {
+  ranges_capacity_ = 64;
+  ranges_ = new Range[ranges_capacity_];
+  for (intptr_t i = 0; i < num_workers; i++) {
+    workers_[i].Init(this);
+  }
+}
+
+ParallelScavenge::~ParallelScavenge() {
+  ASSERT(running_helpers_ == 0);
+  ASSERT(ranges_size_ == 0);
+  ASSERT(remembered_set_blocks_ == nullptr);
+  delete[] workers_;
+  delete[] ranges_;
+}
+
+ScavengerWorker* ParallelScavenge::worker(intptr_t i) const {
+  ASSERT((i >= 0) && (i < num_workers_));
+  return &workers_[i];
+}
+
+void ParallelScavenge::StartHelpers(ThreadPool* pool) {
+  for (intptr_t i = 1; i < num_workers_; i++) {
+    {
+      MonitorLocker ml(&monitor_);
+      active_workers_++;
+      running_helpers_++;
+    }
+    ScavengeTask* task = new ScavengeTask(this, &workers_[i]);
+    if (!pool->Run(task)) {
+      // The pool is shutting down. The calling thread is still active, so
+      // termination cannot have been detected yet.
+      delete task;
+      MonitorLocker ml(&monitor_);
+      active_workers_--;
+      running_helpers_--;
+    }
+  }
+}
+
+void ParallelScavenge::HelperDone() {
+  MonitorLocker ml(&monitor_);
+  running_helpers_--;
+  ml.NotifyAll();
+}
+
+void ParallelScavenge::WaitForHelpers() {
+  MonitorLocker ml(&monitor_);
+  while (running_helpers_ > 0) {
+    ml.Wait();
+  }
+}
+
+void ParallelScavenge::TakeRememberedSet(StoreBuffer* remembered_set) {
+  remembered_set_size_ = remembered_set->blocks();
+  remembered_set_blocks_ = new StoreBuffer::Block*[remembered_set_size_];
+  StoreBuffer::Block* block = remembered_set->TakeBlocks();
+  for (intptr_t i = 0; i < remembered_set_size_; i++) {
+    remembered_set_blocks_[i] = block;
+    block = block->next;
+  }
+  ASSERT(block == nullptr);
+}
+
+void ParallelScavenge::ReleaseRememberedSet(StoreBuffer* remembered_set) {
+  for (intptr_t i = 0; i < remembered_set_size_; i++) {
+    remembered_set->Release(remembered_set_blocks_[i]);
+  }
+  delete[] remembered_set_blocks_;
+  remembered_set_blocks_ = nullptr;
+  remembered_set_size_ = 0;
+}
+
+StoreBuffer::Block* ParallelScavenge::ClaimRememberedSetBlock() {
+  intptr_t claimed =
+      AtomicOperations::FetchAndAddRelaxed(&remembered_set_cursor_,
+                                           static_cast<intptr_t>(1));
+  if (claimed >= remembered_set_size_) {
+    return nullptr;
+  }
+  return remembered_set_blocks_[claimed];
+}
+
+void ParallelScavenge::PushRange(uword start, uword end) {
+  ASSERT(start < end);
+  MonitorLocker ml(&monitor_);
+  if (ranges_size_ == ranges_capacity_) {
+    ranges_capacity_ += (ranges_capacity_ >> 1);
+    Range* old_ranges = ranges_;
+    ranges_ = new Range[ranges_capacity_];
+    for (intptr_t i = 0; i < ranges_size_; i++) {
+      ranges_[i] = old_ranges[i];
+    }
+    delete[] old_ranges;
+  }
+  ranges_[ranges_size_].start = start;
+  ranges_[ranges_size_].end = end;
+  ranges_size_++;
+  if (idle_workers_ > 0) {
+    ml.Notify();
+  }
+}
+
+bool ParallelScavenge::PopRange(uword* start, uword* end) {
+  MonitorLocker ml(&monitor_);
+  idle_workers_++;
+  while (ranges_size_ == 0) {
+    if (idle_workers_ == active_workers_) {
+      ml.NotifyAll();
+      return false;
+    }
+    ml.Wait();
+  }
+  idle_workers_--;
+  ranges_size_--;
+  *start = ranges_[ranges_size_].start;
+  *end = ranges_[ranges_size_].end;
+  return true;
+}
+
+ScavengerWorker::ScavengerWorker()
+    : scavenge_(nullptr),
+      heap_(nullptr),
+      copy_scan_(0),
+      copy_top_(0),
+      copy_end_(0),
+      tenure_scan_(0),
+      tenure_top_(0),
+      tenure_end_(0),
+      remembered_set_(),
+      weak_list_(nullptr),
+      ephemeron_list_(nullptr),
+      tenured_(),
+      survivor_sizes_() {}
+
+ScavengerWorker::~ScavengerWorker() {
+  ASSERT(remembered_set_.size() == 0);
+}
+
+void ScavengerWorker::Init(ParallelScavenge* scavenge) {
+  scavenge_ = scavenge;
+  heap_ = scavenge->heap();
+}
+
+void ScavengerWorker::ScavengeRoots() {
+  for (intptr_t i = 0; i < heap_->handles_size_; i++) {
+    ScavengePointer(heap_->handles_[i]);
+  }
+
+  Object* from;
+  Object* to;
+  heap_->interpreter_->RootPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    ScavengePointer(ptr);
+  }
+  for (intptr_t i = 0; heap_->interpreter_->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ScavengePointer(ptr);
+    }
+  }
+}
+
+void ScavengerWorker::ScavengeRememberedSet() {
+  StoreBuffer::Block* block;
+  while ((block = scavenge_->ClaimRememberedSetBlock()) != nullptr) {
+    for (intptr_t i = 0; i < block->size; i++) {
+      HeapObject obj = block->objects[i];
+      ASSERT(obj->IsOldObject());
+      ASSERT(obj->is_remembered());
+      obj->set_is_remembered(false);
+      ScavengeOldObject(obj);
+    }
+  }
+}
+
+void ScavengerWorker::Drain() {
+  for (;;) {
+    while ((copy_scan_ < copy_top_) || (tenure_scan_ < tenure_top_)) {
+      // Advance the scan pointer before visiting the object: visiting may
+      // retire this buffer, handing its unscanned remainder to another worker.
+      if (copy_scan_ < copy_top_) {
+        HeapObject obj = HeapObject::FromAddr(copy_scan_);
+        copy_scan_ += obj->HeapSize();
+        ScavengeNewObject(obj);
+      } else {
+        HeapObject obj = HeapObject::FromAddr(tenure_scan_);
+        tenure_scan_ += obj->HeapSize();
+        ScavengeTenuredObject(obj);
+      }
+    }
+
+    uword start, end;
+    if (!scavenge_->PopRange(&start, &end)) {
+      return;
+    }
+    ScanRange(start, end);
+  }
+}
+
+void ScavengerWorker::ScanRange(uword start, uword end) {
+  uword scan = start;
+  while (scan < end) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    scan += obj->HeapSize();
+    if (obj->IsNewObject()) {
+      ScavengeNewObject(obj);
+    } else {
+      ScavengeTenuredObject(obj);
+    }
+  }
+}
+
+bool ScavengerWorker::ScavengeEphemeronList() {
+  Ephemeron survivor = heap_->ephemeron_list_;
+  heap_->ephemeron_list_ = nullptr;
+  bool progress = false;
+
+  while (survivor != nullptr) {
+    ASSERT(survivor->IsEphemeron());
+    Ephemeron next = survivor->next();
+    survivor->set_next(nullptr);
+
+    Object key = survivor->key();
+    if (key->IsImmediateOrOldObject() ||
+        IsForwarded(static_cast<HeapObject>(key))) {
+      ScavengePointer(survivor->key_ptr());
+      ScavengePointer(survivor->value_ptr());
+      ScavengePointer(survivor->finalizer_ptr());
+
+      if (survivor->IsOldObject() &&
+          (survivor->key()->IsNewObject() ||
+           survivor->value()->IsNewObject() ||
+           survivor->finalizer()->IsNewObject()) &&
+          !survivor->is_remembered()) {
+        AddToRememberedSet(survivor);
+      }
+      progress = true;
+    } else {
+      // Fate of key is not yet known.
+      heap_->WaitForKey(survivor);
+    }
+
+    survivor = next;
+  }
+  return progress;
+}
+
+void ScavengerWorker::Finish() {
+  ASSERT(copy_scan_ == copy_top_);
+  ASSERT(tenure_scan_ == tenure_top_);
+
+  if (copy_end_ == heap_->top_) {
+    // Last buffer handed out: return the unused part.
+    heap_->top_ = copy_top_;
+  } else if (copy_top_ < copy_end_) {
+    // Keep new-space iterable.
+    FillWithFreeListElement(copy_top_, copy_end_ - copy_top_);
+  }
+  copy_scan_ = copy_top_ = copy_end_ = 0;
+
+  RetireTenureBuffer();
+
+  heap_->remembered_set_.Append(&remembered_set_);
+
+  for (intptr_t age = 0; age <= Heap::kMaxTenuringThreshold; age++) {
+    heap_->survivor_sizes_[age] += survivor_sizes_[age];
+    survivor_sizes_[age] = 0;
+  }
+
+  while (weak_list_ != nullptr) {
+    WeakArray next = weak_list_->next();
+    heap_->AddToWeakList(weak_list_);
+    weak_list_ = next;
+  }
+  while (ephemeron_list_ != nullptr) {
+    Ephemeron next = ephemeron_list_->next();
+    heap_->AddToEphemeronList(ephemeron_list_);
+    ephemeron_list_ = next;
+  }
+  while (!tenured_.IsEmpty()) {
+    heap_->marking_stack_.Push(tenured_.Pop());
+  }
+}
+
+HeapObject ScavengerWorker::Forward(HeapObject old_target) {
+  uword* header_addr = reinterpret_cast<uword*>(old_target->Addr());
+  uword header = AtomicOperations::LoadAcquire(header_addr);
+  for (;;) {
+    if (header == kClaimedHeader) {
+      // Another worker is copying the object.
+      header = AtomicOperations::LoadAcquire(header_addr);
+      continue;
+    }
+    if ((header & (1 << kMarkBit)) != 0) {
+      return static_cast<HeapObject>(header);
+    }
+    if (AtomicOperations::CompareAndSwap(header_addr, &header,
+                                         kClaimedHeader)) {
+      break;
+    }
+  }
+
+  // Target is now known to be reachable and is ours to move.
+  intptr_t size = old_target->HeapSize(header);
+  intptr_t age = HeapObject::AgeOf(header);
+  bool direct = false;
+  uword new_target_addr;
+  if (age >= heap_->tenuring_threshold_) {
+    new_target_addr = AllocateTenure(size, &direct);
+  } else {
+    new_target_addr = AllocateCopy(size, &direct);
+  }
+  ASSERT(new_target_addr != 0);
+  memcpy(reinterpret_cast<void*>(new_target_addr + sizeof(uword)),
+         reinterpret_cast<void*>(old_target->Addr() + sizeof(uword)),
+         size - sizeof(uword));
+  // Keys only wait during the serial phase, when this is the only worker.
+  bool waiting_key = (header & (1 << kWaitingKeyBit)) != 0;
+  *reinterpret_cast<uword*>(new_target_addr) =
+      header & ~(static_cast<uword>(1) << kWaitingKeyBit);
+  HeapObject new_target = HeapObject::FromAddr(new_target_addr);
+  if (new_target->IsNewObject()) {
+    new_target->set_age(age + 1);
+    survivor_sizes_[age + 1] += size;
+  } else {
+    new_target->set_age(0);
+  }
+  // Mark bit and tag bit are conveniently in the same place.
+  AtomicOperations::StoreRelease(header_addr,
+                                 static_cast<uword>(new_target));
+  if (waiting_key) {
+    heap_->WakeEphemerons(old_target->Addr());
+  }
+  if (direct) {
+    // Not part of a buffer this worker scans.
+    scavenge_->PushRange(new_target_addr, new_target_addr + size);
+  }
+  return new_target;
+}
+
+bool ScavengerWorker::ScavengePointer(Object* ptr) {
+  HeapObject old_target = static_cast<HeapObject>(*ptr);
+  if (old_target->IsImmediateOrOldObject()) {
+    return false;
+  }
+
+  DEBUG_ASSERT(heap_->InFromSpace(old_target));
+  HeapObject new_target = Forward(old_target);
+  DEBUG_ASSERT(new_target->IsOldObject() || heap_->InToSpace(new_target));
+
+  *ptr = new_target;
+  return new_target->IsNewObject();
+}
+
+bool ScavengerWorker::ScavengeClass(intptr_t cid) {
+  ASSERT(cid < heap_->class_table_size_);
+  // The class table itself is updated by MournClassTableScavenge.
+  HeapObject old_target = static_cast<HeapObject>(heap_->class_table_[cid]);
+  if (old_target->IsImmediateOrOldObject()) {
+    return false;
+  }
+
+  DEBUG_ASSERT(heap_->InFromSpace(old_target));
+  return Forward(old_target)->IsNewObject();
+}
+
+void ScavengerWorker::ScavengeNewObject(HeapObject obj) {
+  DEBUG_ASSERT(heap_->InToSpace(obj));
+  intptr_t cid = obj->cid();
+  if (cid == kWeakArrayCid) {
+    AddToWeakList(static_cast<WeakArray>(obj));
+  } else if (cid == kEphemeronCid) {
+    AddToEphemeronList(static_cast<Ephemeron>(obj));
+  } else {
+    ScavengeClass(cid);
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ScavengePointer(ptr);
+    }
+  }
+}
+
+void ScavengerWorker::ScavengeOldObject(HeapObject obj) {
+  ASSERT(obj->IsOldObject());
+  intptr_t cid = obj->cid();
+  if (cid == kWeakArrayCid) {
+    AddToWeakList(static_cast<WeakArray>(obj));
+  } else if (cid == kEphemeronCid) {
+    AddToEphemeronList(static_cast<Ephemeron>(obj));
+  } else {
+    bool has_new_target = false;
+    if (ScavengeClass(cid)) {
+      has_new_target = true;
+    }
+    if (obj->is_carded()) {
+      if (VisitDirtyCards(obj, [this](Object* ptr) {
+            return ScavengePointer(ptr);
+          })) {
+        has_new_target = true;
+      }
+    } else {
+      Object* from;
+      Object* to;
+      obj->Pointers(&from, &to);
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        if (ScavengePointer(ptr)) {
+          has_new_target = true;
+        }
+      }
+    }
+    if (has_new_target) {
+      AddToRememberedSet(obj);
+    }
+  }
+}
+
+void ScavengerWorker::ScavengeTenuredObject(HeapObject obj) {
+  if (heap_->marking_) {
+    // The copied slots never went through the marking barrier. The heap's
+    // marking stack is not shared, so the object is queued locally.
+    ASSERT(!obj->is_marked());
+    obj->set_is_marked(true);
+    tenured_.Push(obj);
+  }
+  ScavengeOldObject(obj);
+}
+
+uword ScavengerWorker::AllocateCopy(intptr_t size, bool* direct) {
+  uword result = copy_top_;
+  if (result + size <= copy_end_) {
+    copy_top_ = result + size;
+    return result;
+  }
+
+  intptr_t buffer_size;
+  if (size > kCopyBufferSize / 4) {
+    // Don't waste the rest of the buffer on a large object.
+    result = heap_->TryAllocateCopyBuffer(size, size, &buffer_size);
+    if (result != 0) {
+      *direct = true;
+      return result;
+    }
+  } else {
+    RetireCopyBuffer();
+    result = heap_->TryAllocateCopyBuffer(size, kCopyBufferSize,
+                                          &buffer_size);
+    if (result != 0) {
+      copy_scan_ = result;
+      copy_top_ = result + size;
+      copy_end_ = result + buffer_size;
+      return result;
+    }
+  }
+
+  // Buffer waste has exhausted to-space: promote instead.
+  return AllocateTenure(size, direct);
+}
+
+uword ScavengerWorker::AllocateTenure(intptr_t size, bool* direct) {
+  uword result = tenure_top_;
+  if (result + size <= tenure_end_) {
+    tenure_top_ = result + size;
+    return result;
+  }
+
+  if (size > kTenureBufferSize / 4) {
+    MutexLocker ml(scavenge_->old_space_mutex());
+    *direct = true;
+    return heap_->AllocateOldSmall(size, Heap::kForceGrowth, Heap::kNoSweep);
+  }
+
+  RetireTenureBuffer();
+  MutexLocker ml(scavenge_->old_space_mutex());
+  result = heap_->AllocateOldSmall(kTenureBufferSize, Heap::kForceGrowth,
+                                   Heap::kNoSweep);
+  tenure_scan_ = result;
+  tenure_top_ = result + size;
+  tenure_end_ = result + kTenureBufferSize;
+  return result;
+}
+
+void ScavengerWorker::RetireCopyBuffer() {
+  if (copy_scan_ < copy_top_) {
+    scavenge_->PushRange(copy_scan_, copy_top_);
+  }
+  if (copy_top_ < copy_end_) {
+    FillWithFreeListElement(copy_top_, copy_end_ - copy_top_);
+  }
+  copy_scan_ = copy_top_ = copy_end_ = 0;
+}
+
+void ScavengerWorker::RetireTenureBuffer() {
+  if (tenure_scan_ < tenure_top_) {
+    scavenge_->PushRange(tenure_scan_, tenure_top_);
+  }
+  intptr_t remaining = tenure_end_ - tenure_top_;
+  if (remaining > 0) {
+    MutexLocker ml(scavenge_->old_space_mutex());
+    heap_->freelist_.EnqueueRange(tenure_top_, remaining);
+    heap_->old_size_ -= remaining;
+  }
+  tenure_scan_ = tenure_top_ = tenure_end_ = 0;
+}
+
+void ScavengerWorker::AddToRememberedSet(HeapObject obj) {
+  ASSERT(obj->IsOldObject());
+  ASSERT(!obj->is_remembered());
+  remembered_set_.Add(obj);
+  obj->set_is_remembered(true);
+}
+
+void ScavengerWorker::AddToWeakList(WeakArray survivor) {
+  DEBUG_ASSERT(survivor->IsOldObject() || heap_->InToSpace(survivor));
+  survivor->set_next(weak_list_);
+  weak_list_ = survivor;
+}
+
+void ScavengerWorker::AddToEphemeronList(Ephemeron survivor) {
+  DEBUG_ASSERT(survivor->IsOldObject() || heap_->InToSpace(survivor));
+  survivor->set_next(ephemeron_list_);
+  ephemeron_list_ = survivor;
+}
+
+void Heap::ScavengeParallel() {
+  ASSERT(top_ == to_.object_start());
+  ASSERT(end_ == to_.limit());
+
+  ParallelScavenge scavenge(this, scavenger_workers_);
+
+  // The remembered set is rebuilt from the workers' buffers in Finish.
+  scavenge.TakeRememberedSet(&remembered_set_);
+
+  scavenge.StartHelpers(scavenger_pool_);
+  ScavengerWorker* main = scavenge.worker(0);
+  main->ScavengeRoots();
+  main->ScavengeRememberedSet();
+  main->Drain();
+  scavenge.WaitForHelpers();
+  scavenge.ReleaseRememberedSet(&remembered_set_);
+
+  for (intptr_t i = 0; i < scavenge.num_workers(); i++) {
+    scavenge.worker(i)->Finish();
+  }
+
+  // Ephemerons are rare enough to finish on one thread.
+  scavenge.BeginSerialPhase();
+  while (main->ScavengeEphemeronList()) {
+    main->Drain();
+    main->Finish();
+    scavenge.BeginSerialPhase();
+  }
+}
+
+NOINLINE
+void Heap::MarkSweep(Reason reason) {
+  PerfScope perf_scope(this, PerfCounters::kMarkSweep);
+  TraceScope trace_scope("mark-sweep", TraceIsolate(interpreter_));
+  int64_t start = OS::CurrentMonotonicNanos();
+  size_t size_before = Size();
+
+#if defined(DEBUG)
+  from_.ReadWrite();
+#endif
+
+  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
+  mark_stack->Init(from_.limit());
+
+  bool remark = marking_;
+  if (!remark) {
+    // Mark bits left by the previous cycle must be cleared first.
+    FinishSweeping();
+    // Remembered set will be re-built during marking.
+    remembered_set_.Clear();
+    old_marked_size_ = 0;
+  }
+
+  interpreter_->GCPrologue();
+
+  // Strong references.
+  if (remark) {
+    FinishIncrementalMarking();
+  }
+  MarkRoots();
+  bool parallel = ShouldMarkInParallel(size_before);
+  if (parallel) {
+    MarkParallel();
+  }
+  do {
+    while (!mark_stack->IsEmpty() || ephemeron_list_ != nullptr) {
+      ProcessMarkStack();
+      MarkEphemeronList();
+    }
+    MarkWaitingStacks();
+  } while (!mark_stack->IsEmpty());
+
+#if defined(DEBUG)
+  from_.NoAccess();
+#endif
+
+  // Known before the sweep, which is mostly deferred.
+  old_size_ = old_marked_size_;
+  ASSERT(old_size_ <= old_capacity_);
+
+  // Weak references.
+  MournWaitingStacks();
+  MournEphemeronList();
+  MournWeakListMarkSweep();
+  MournClassTableMarkSweep();
+  MournIdentityHashesMarkSweep();
+
+  if (remark) {
+    FilterRememberedSet();
+    marking_ = false;
+  }
+
+  // Become holds raw pointers to its arguments across this collection.
+  bool evacuate = (reason != kBecome) && ShouldEvacuate();
+  if (evacuate) {
+    EvacuateSparseRegions();  // Also sweeps.
+  }
+
+  interpreter_->GCEpilogue();
+
+  if (!evacuate) {
+    Sweep();
+  }
+
+  remembered_set_.Trim();
+
+  SetOldAllocationLimit();
+
+  if (PRETENURING) {
+    ResetPretenuring();
+  }
+
+  GCEvent event;
+  event.kind = GCEvent::kMarkSweep;
+  event.reason = reason;
+  event.flags = (parallel ? GCEvent::kParallel : 0) |
+                (remark ? GCEvent::kRemark : 0) |
+                (evacuate ? GCEvent::kEvacuate : 0);
+  event.start = start;
+  event.size_before = size_before;
+  event.size_after = Size();
+  event.tenured = 0;
+  RecordGCEvent(&event);
+
+  if (TRACE_GROWTH) {
+    freelist_.PrintStatistics();
+  }
+}
+
+void Heap::RecordGCEvent(GCEvent* event) {
+  event->sequence = gc_event_count_;
+  event->end = OS::CurrentMonotonicNanos();
+  event->remembered_set_size = remembered_set_.size();
+  event->class_table_size = class_table_size_;
+  event->tenuring_threshold = tenuring_threshold_;
+  gc_events_[gc_event_count_ % kGCEventCapacity] = *event;
+  gc_event_count_++;
+  if (event->kind == GCEvent::kScavenge) {
+    gc_totals_.scavenges++;
+    gc_totals_.scavenge_nanos += event->end - event->start;
+  } else {
+    gc_totals_.mark_sweeps++;
+    gc_totals_.mark_sweep_nanos += event->end - event->start;
+  }
+  if (gc_event_callback_ != nullptr) {
+    gc_event_callback_(*event);
+  }
+}
+
+intptr_t Heap::CopyGCEvents(int64_t since, GCEvent* events) const {
+  int64_t first = gc_event_count_ - kGCEventCapacity;
+  if (first < since) {
+    first = since;
+  }
+  if (first < 0) {
+    first = 0;
+  }
+  intptr_t count = 0;
+  for (int64_t i = first; i < gc_event_count_; i++) {
+    events[count++] = gc_events_[i % kGCEventCapacity];
+  }
+  return count;
+}
+
+void Heap::MarkRoots() {
+  for (intptr_t i = 0; i < handles_size_; i++) {
+    MarkObject(*handles_[i]);
+  }
+
+  Object* from;
+  Object* to;
+  interpreter_->RootPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    MarkObject(*ptr);
+  }
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    if (interpreter_->IsWaitingStack(i)) {
+      continue;  // See MarkWaitingStacks.
+    }
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      MarkObject(*ptr);
+    }
+  }
+}
+
+// A coroutine waiting to be resumed can run again only through its Coroutine,
+// which its own frames usually reference. So its stack is traced like the
+// value of an ephemeron keyed by the Coroutine: once that is marked.
+void Heap::MarkWaitingStacks() {
+  Object* from;
+  Object* to;
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    if (!interpreter_->IsWaitingStack(i)) {
+      continue;
+    }
+    HeapObject owner =
+        static_cast<HeapObject>(interpreter_->WaitingStackOwner(i));
+    if (owner->is_marked()) {
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        MarkObject(*ptr);
+      }
+    }
+  }
+}
+
+// Frees the stacks of the coroutines whose Coroutine was not reached.
+void Heap::MournWaitingStacks() {
+  Object* from;
+  Object* to;
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    if (!interpreter_->IsWaitingStack(i)) {
+      continue;
+    }
+    HeapObject owner =
+        static_cast<HeapObject>(interpreter_->WaitingStackOwner(i));
+    if (!owner->is_marked()) {
+      interpreter_->CloseCoroutine(i);
+    }
+  }
+}
+
+void Heap::MarkObject(Object obj) {
+  if (obj->IsImmediateObject()) return;
+
+  HeapObject heap_obj = static_cast<HeapObject>(obj);
+  if (heap_obj->is_marked()) return;
+
+  heap_obj->set_is_marked(true);
+  if (!marking_) {
+    heap_obj->set_is_remembered(false);
+  }
+  if (heap_obj->is_waiting_key()) {
+    heap_obj->set_is_waiting_key(false);
+    WakeEphemerons(heap_obj->Addr());
+  }
+  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
+  if (!mark_stack->TryPush(heap_obj)) {
+    mark_overflow_.Push(heap_obj);
+  }
+}
+
+void Heap::ProcessMarkStack() {
+  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
+  for (;;) {
+    if (mark_stack->IsEmpty()) {
+      if (mark_overflow_.IsEmpty()) {
+        break;
+      }
+      mark_stack->Push(mark_overflow_.Pop());
+    }
+    HeapObject obj = mark_stack->Pop();
+    ASSERT(obj->is_marked());
+    ASSERT(marking_ || !obj->is_remembered());
+
+    intptr_t cid = obj->cid();
+    ASSERT(cid != kIllegalCid);
+    ASSERT(cid != kForwardingCorpseCid);
+    ASSERT(cid != kFreeListElementCid);
+
+    if (obj->IsOldObject()) {
+      old_marked_size_ += obj->HeapSize();
+    }
+
+    MarkObject(ClassAt(cid));
+
+    if (cid == kWeakArrayCid) {
+      AddToWeakList(static_cast<WeakArray>(obj));
+    } else if (cid == kEphemeronCid) {
+      AddToEphemeronList(static_cast<Ephemeron>(obj));
+    } else {
+      Object* from;
+      Object* to;
+      obj->Pointers(&from, &to);
+      bool has_new_target = ClassAt(cid)->IsNewObject();
+      bool carded = obj->is_carded();
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        Object target = *ptr;
+        if (target->IsNewObject()) {
+          has_new_target = true;
+          if (carded) {
+            obj->RememberCard(ptr);
+          }
+        }
+        MarkObject(target);
+      }
+      if (has_new_target && obj->IsOldObject() && !obj->is_remembered()) {
+        AddToRememberedSet(obj);
+      }
+    }
+  }
+}
+
+bool Heap::ShouldMarkInParallel(size_t heap_size) const {
+  return (scavenger_workers_ > 1) && (heap_size >= kParallelMarkThreshold);
+}
+
+// A bounded deque of objects to visit, in a slice of from-space. Its owner
+// pushes and pops at the bottom, and other workers steal from the top.
+//
+// David Chase and Yossi Lev. "Dynamic Circular Work-Stealing Deque."
+// Symposium on Parallelism in Algorithms and Architectures. 2005.
+class MarkingDeque {
+ public:
+  MarkingDeque() : slots_(nullptr), mask_(0), top_(0), bottom_(0) {}
+
+  // |capacity| is a power of two.
+  void Init(uword base, intptr_t capacity) {
+    ASSERT(Utils::IsPowerOfTwo(capacity));
+    slots_ = reinterpret_cast<uword*>(base);
+    mask_ = capacity - 1;
+  }
+
+  intptr_t capacity() const { return mask_ + 1; }
+  intptr_t Size() const { return bottom_.load() - top_.load(); }
+  bool IsEmpty() const { return Size() <= 0; }
+
+  // Returns false if the deque is full.
+  bool TryPush(HeapObject obj) {
+    intptr_t bottom = bottom_.load(std::memory_order_relaxed);
+    intptr_t top = top_.load(std::memory_order_acquire);
+    if (bottom - top > mask_) {
+      return false;
+    }
+    AtomicOperations::StoreRelaxed(&slots_[bottom & mask_], obj.Addr());
+    bottom_.store(bottom + 1);
+    return true;
+  }
+
+  bool Pop(HeapObject* obj) {
+    intptr_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(bottom);
+    intptr_t top = top_.load();
+    if (top > bottom) {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+    *obj = HeapObject::FromAddr(
+        AtomicOperations::LoadRelaxed(&slots_[bottom & mask_]));
+    if (top < bottom) {
+      return true;
+    }
+    // The last object: race any thief for it.
+    bool won = top_.compare_exchange_strong(top, top + 1);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return won;
+  }
+
+  bool Steal(HeapObject* obj) {
+    intptr_t top = top_.load();
+    intptr_t bottom = bottom_.load();
+    if (top >= bottom) {
+      return false;
+    }
+    // Only used if the claim succeeds, in which case the owner cannot have
+    // reused the slot.
+    uword addr = AtomicOperations::LoadRelaxed(&slots_[top & mask_]);
+    if (!top_.compare_exchange_strong(top, top + 1)) {
+      return false;
+    }
+    *obj = HeapObject::FromAddr(addr);
+    return true;
+  }
+
+ private:
+  uword* slots_;
+  intptr_t mask_;
+  // Sequentially consistent where not marked otherwise, so an owner taking
+  // its last object and a thief cannot both take it, and a push cannot be
+  // missed by a worker going idle.
+  std::atomic<intptr_t> top_;
+  std::atomic<intptr_t> bottom_;
+
+  DISALLOW_COPY_AND_ASSIGN(MarkingDeque);
+};
+
+// The state shared by the threads marking in parallel. From-space is split
+// between their deques. Marking terminates when every worker is idle, which
+// they can only be once every deque is empty.
+class ParallelMark {
+ public:
+  // The deques are laid out in [|base|, |base| + |size|).
+  ParallelMark(Heap* heap, intptr_t num_workers, uword base, intptr_t size);
+  ~ParallelMark();
+
+  Heap* heap() const { return heap_; }
+  intptr_t num_workers() const { return num_workers_; }
+  MarkerWorker* worker(intptr_t i) const;
+
+  void StartHelpers(ThreadPool* pool);
+  void HelperDone();
+  void WaitForHelpers();
 
-  // Remembered set will be re-built during marking.
-  remembered_set_size_ = 0;
-  old_size_ = 0;
+  bool Steal(MarkerWorker* thief, HeapObject* obj);
+  // Wakes an idle worker to steal from a deque with objects to spare.
+  void NotifyWork();
+  // Blocks until another worker has objects to steal, answering false, or
+  // every worker is idle, answering true.
+  bool Terminate();
 
-  interpreter_->GCPrologue();
+ private:
+  bool HasWork() const;
 
-  // Strong references.
-  MarkRoots();
-  while (!mark_stack->IsEmpty()) {
-    ProcessMarkStack();
-    MarkEphemeronList();
+  Heap* const heap_;
+  const intptr_t num_workers_;
+  MarkerWorker* workers_;
+
+  Monitor monitor_;
+  // Sequentially consistent, see MarkingDeque.
+  std::atomic<intptr_t> idle_workers_;
+  intptr_t active_workers_;
+  intptr_t running_helpers_;
+  bool terminated_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelMark);
+};
+
+// One thread's part of a parallel mark. Workers race to mark an object with a
+// compare-and-swap on its header; the winner pushes it on its own deque, or
+// onto a private overflow stack when the deque is full. Weak arrays,
+// ephemerons and remembered objects found are collected per worker and
+// handed to the heap afterwards, so that weak processing stays serial.
+class MarkerWorker {
+ public:
+  MarkerWorker();
+  ~MarkerWorker();
+
+  void Init(ParallelMark* mark, uword base, intptr_t capacity);
+
+  void Push(HeapObject obj);
+  void Drain();
+  void Finish();
+
+  MarkingDeque* deque() { return &deque_; }
+
+ private:
+  bool Pop(HeapObject* obj);
+  void MarkObject(Object obj);
+  void VisitObject(HeapObject obj);
+  void AddToRememberedSet(HeapObject obj);
+
+  ParallelMark* mark_;
+  Heap* heap_;
+
+  MarkingDeque deque_;
+  MarkingStack overflow_;
+
+  StoreBuffer remembered_set_;
+
+  WeakArray weak_list_;
+  Ephemeron ephemeron_list_;
+  size_t marked_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MarkerWorker);
+};
+
+class MarkTask : public ThreadPool::Task {
+ public:
+  MarkTask(ParallelMark* mark, MarkerWorker* worker)
+      : mark_(mark), worker_(worker) {}
+
+  virtual void Run() {
+    worker_->Drain();
+    mark_->HelperDone();
   }
 
-#if defined(DEBUG)
-  from_.NoAccess();
-#endif
+ private:
+  ParallelMark* mark_;
+  MarkerWorker* worker_;
 
-  ASSERT(old_size_ <= old_capacity_);
+  DISALLOW_COPY_AND_ASSIGN(MarkTask);
+};
 
-  // Weak references.
-  MournEphemeronList();
-  MournWeakListMarkSweep();
-  MournClassTableMarkSweep();
+ParallelMark::ParallelMark(Heap* heap, intptr_t num_workers,
+                           uword base, intptr_t size)
+    : heap_(heap),
+      num_workers_(num_workers),
+      workers_(new MarkerWorker[num_workers]),
+      monitor_(),
+      idle_workers_(0),
+      active_workers_(1),
+      running_helpers_(0),
+      terminated_(false) {
+  intptr_t slice = size / num_workers;
+  intptr_t capacity = 1;
+  while (capacity * 2 * static_cast<intptr_t>(sizeof(uword)) <= slice) {
+    capacity *= 2;
+  }
+  for (intptr_t i = 0; i < num_workers; i++) {
+    workers_[i].Init(this, base + i * slice, capacity);
+  }
+}
 
-  interpreter_->GCEpilogue();
+ParallelMark::~ParallelMark() {
+  ASSERT(running_helpers_ == 0);
+  delete[] workers_;
+}
 
-  Sweep();
+MarkerWorker* ParallelMark::worker(intptr_t i) const {
+  ASSERT((i >= 0) && (i < num_workers_));
+  return &workers_[i];
+}
 
-  ShrinkRememberedSet();
+void ParallelMark::StartHelpers(ThreadPool* pool) {
+  for (intptr_t i = 1; i < num_workers_; i++) {
+    {
+      MonitorLocker ml(&monitor_);
+      active_workers_++;
+      running_helpers_++;
+    }
+    MarkTask* task = new MarkTask(this, &workers_[i]);
+    if (!pool->Run(task)) {
+      // The pool is shutting down. The helper's objects are left for the
+      // others to steal.
+      delete task;
+      MonitorLocker ml(&monitor_);
+      active_workers_--;
+      running_helpers_--;
+    }
+  }
+}
 
-  SetOldAllocationLimit();
+void ParallelMark::HelperDone() {
+  MonitorLocker ml(&monitor_);
+  running_helpers_--;
+  ml.NotifyAll();
+}
 
-#if REPORT_GC
-  size_t size_after = old_size_;
-  int64_t stop = OS::CurrentMonotonicNanos();
-  int64_t time = stop - start;
-  OS::PrintErr("Mark-sweep "
-               "(%s, %" Pd "kB old, %" Pd "kB freed, %" Pd64 " us)\n",
-               ReasonToCString(reason), size_after / KB,
-               (size_before - size_after) / KB,
-               time / kNanosecondsPerMicrosecond);
-#endif
+void ParallelMark::WaitForHelpers() {
+  MonitorLocker ml(&monitor_);
+  while (running_helpers_ > 0) {
+    ml.Wait();
+  }
 }
 
-void Heap::MarkRoots() {
-  for (intptr_t i = 0; i < handles_size_; i++) {
-    MarkObject(*handles_[i]);
+bool ParallelMark::Steal(MarkerWorker* thief, HeapObject* obj) {
+  intptr_t start = thief - workers_;
+  for (intptr_t i = 1; i < num_workers_; i++) {
+    MarkerWorker* victim = &workers_[(start + i) % num_workers_];
+    if (victim->deque()->Steal(obj)) {
+      return true;
+    }
   }
+  return false;
+}
 
-  Object* from;
-  Object* to;
-  interpreter_->RootPointers(&from, &to);
-  for (Object* ptr = from; ptr <= to; ptr++) {
-    MarkObject(*ptr);
+bool ParallelMark::HasWork() const {
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    if (!workers_[i].deque()->IsEmpty()) {
+      return true;
+    }
   }
-  interpreter_->StackPointers(&from, &to);
-  for (Object* ptr = from; ptr <= to; ptr++) {
-    MarkObject(*ptr);
+  return false;
+}
+
+void ParallelMark::NotifyWork() {
+  if (idle_workers_.load() > 0) {
+    MonitorLocker ml(&monitor_);
+    ml.Notify();
   }
 }
 
-void Heap::MarkObject(Object obj) {
+bool ParallelMark::Terminate() {
+  MonitorLocker ml(&monitor_);
+  idle_workers_++;
+  for (;;) {
+    if (terminated_) {
+      return true;
+    }
+    if (idle_workers_.load() == active_workers_) {
+      terminated_ = true;
+      ml.NotifyAll();
+      return true;
+    }
+    if (HasWork()) {
+      idle_workers_--;
+      return false;
+    }
+    ml.Wait();
+  }
+}
+
+MarkerWorker::MarkerWorker()
+    : mark_(nullptr),
+      heap_(nullptr),
+      deque_(),
+      overflow_(),
+      remembered_set_(),
+      weak_list_(nullptr),
+      ephemeron_list_(nullptr),
+      marked_size_(0) {}
+
+MarkerWorker::~MarkerWorker() {
+  ASSERT(remembered_set_.size() == 0);
+}
+
+void MarkerWorker::Init(ParallelMark* mark, uword base, intptr_t capacity) {
+  mark_ = mark;
+  heap_ = mark->heap();
+  deque_.Init(base, capacity);
+}
+
+void MarkerWorker::Push(HeapObject obj) {
+  if (!deque_.TryPush(obj)) {
+    overflow_.Push(obj);
+  }
+}
+
+bool MarkerWorker::Pop(HeapObject* obj) {
+  if (deque_.Pop(obj)) {
+    return true;
+  }
+  if (overflow_.IsEmpty()) {
+    return false;
+  }
+  // Refill the deque halfway so that other workers can steal the overflow.
+  intptr_t count = deque_.capacity() / 2;
+  while ((count-- > 0) && !overflow_.IsEmpty()) {
+    deque_.TryPush(overflow_.Pop());
+  }
+  mark_->NotifyWork();
+  return deque_.Pop(obj);
+}
+
+void MarkerWorker::Drain() {
+  for (;;) {
+    HeapObject obj;
+    while (Pop(&obj) || mark_->Steal(this, &obj)) {
+      VisitObject(obj);
+    }
+    if (mark_->Terminate()) {
+      return;
+    }
+  }
+}
+
+void MarkerWorker::MarkObject(Object obj) {
   if (obj->IsImmediateObject()) return;
 
   HeapObject heap_obj = static_cast<HeapObject>(obj);
-  if (heap_obj->is_marked()) return;
+  if (!heap_obj->TryMarkAtomic(!heap_->marking_)) return;
 
-  heap_obj->set_is_marked(true);
-  heap_obj->set_is_remembered(false);
-  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
-  mark_stack->Push(heap_obj);
+  // No ephemeron has waited for its key yet.
+  ASSERT(!heap_obj->is_waiting_key());
+  Push(heap_obj);
+  if (deque_.Size() > 1) {
+    mark_->NotifyWork();
+  }
 }
 
-void Heap::ProcessMarkStack() {
+// As Heap::ProcessMarkStack.
+void MarkerWorker::VisitObject(HeapObject obj) {
+  ASSERT(obj->is_marked());
+  ASSERT(heap_->marking_ || !obj->is_remembered());
+
+  intptr_t cid = obj->cid();
+  ASSERT(cid != kIllegalCid);
+  ASSERT(cid != kForwardingCorpseCid);
+  ASSERT(cid != kFreeListElementCid);
+
+  if (obj->IsOldObject()) {
+    marked_size_ += obj->HeapSize();
+  }
+
+  Behavior cls = heap_->ClassAt(cid);
+  MarkObject(cls);
+
+  if (cid == kWeakArrayCid) {
+    WeakArray survivor = static_cast<WeakArray>(obj);
+    survivor->set_next(weak_list_);
+    weak_list_ = survivor;
+  } else if (cid == kEphemeronCid) {
+    Ephemeron survivor = static_cast<Ephemeron>(obj);
+    survivor->set_next(ephemeron_list_);
+    ephemeron_list_ = survivor;
+  } else {
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    bool has_new_target = cls->IsNewObject();
+    bool carded = obj->is_carded();
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      Object target = *ptr;
+      if (target->IsNewObject()) {
+        has_new_target = true;
+        if (carded) {
+          obj->RememberCard(ptr);
+        }
+      }
+      MarkObject(target);
+    }
+    if (has_new_target && obj->IsOldObject() && !obj->is_remembered()) {
+      AddToRememberedSet(obj);
+    }
+  }
+}
+
+void MarkerWorker::AddToRememberedSet(HeapObject obj) {
+  ASSERT(obj->IsOldObject());
+  ASSERT(!obj->is_remembered());
+  remembered_set_.Add(obj);
+  obj->set_is_remembered(true);
+}
+
+void MarkerWorker::Finish() {
+  ASSERT(deque_.IsEmpty());
+  ASSERT(overflow_.IsEmpty());
+
+  heap_->remembered_set_.Append(&remembered_set_);
+
+  while (weak_list_ != nullptr) {
+    WeakArray next = weak_list_->next();
+    heap_->AddToWeakList(weak_list_);
+    weak_list_ = next;
+  }
+  while (ephemeron_list_ != nullptr) {
+    Ephemeron next = ephemeron_list_->next();
+    heap_->AddToEphemeronList(ephemeron_list_);
+    ephemeron_list_ = next;
+  }
+  heap_->old_marked_size_ += marked_size_;
+  marked_size_ = 0;
+}
+
+// Traces from the objects marked so far on several threads. Ephemerons and
+// weak arrays are only collected, to be processed on this thread afterwards,
+// so this runs before any ephemeron waits for its key.
+void Heap::MarkParallel() {
+  ASSERT(waiting_ephemerons_.size() == 0);
+
+  // The mark stack's from-space is about to be split between the deques.
   MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
   while (!mark_stack->IsEmpty()) {
-    HeapObject obj = mark_stack->Pop();
+    mark_overflow_.Push(mark_stack->Pop());
+  }
+
+  ParallelMark mark(this, scavenger_workers_, from_.base(), from_.size());
+  for (intptr_t i = 0; !mark_overflow_.IsEmpty(); i++) {
+    mark.worker(i % mark.num_workers())->Push(mark_overflow_.Pop());
+  }
+
+  mark.StartHelpers(scavenger_pool_);
+  mark.worker(0)->Drain();
+  mark.WaitForHelpers();
+
+  for (intptr_t i = 0; i < mark.num_workers(); i++) {
+    mark.worker(i)->Finish();
+  }
+
+  mark_stack->Init(from_.limit());
+}
+
+void Heap::StartIncrementalMarking() {
+  ASSERT(!marking_);
+  ASSERT(marking_stack_.IsEmpty());
+  ASSERT(marking_deferred_.IsEmpty());
+  FinishSweeping();
+  marking_ = true;
+  marking_old_size_ = old_size_;
+  old_marked_size_ = 0;
+
+  // Only old objects are marked until the remark pause, which also re-scans
+  // these roots.
+  for (intptr_t i = 0; i < handles_size_; i++) {
+    ShadeObject(*handles_[i]);
+  }
+
+  Object* from;
+  Object* to;
+  interpreter_->RootPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    ShadeObject(*ptr);
+  }
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    if (interpreter_->IsWaitingStack(i)) {
+      continue;  // Left to the remark pause; see MarkWaitingStacks.
+    }
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ShadeObject(*ptr);
+    }
+  }
+}
+
+void Heap::IncrementalMarkingStep(intptr_t budget) {
+  ASSERT(marking_);
+  while ((budget > 0) && !marking_stack_.IsEmpty()) {
+    HeapObject obj = marking_stack_.Pop();
+    ASSERT(obj->IsOldObject());
     ASSERT(obj->is_marked());
-    ASSERT(!obj->is_remembered());
 
     intptr_t cid = obj->cid();
     ASSERT(cid != kIllegalCid);
     ASSERT(cid != kForwardingCorpseCid);
     ASSERT(cid != kFreeListElementCid);
 
-    MarkObject(ClassAt(cid));
+    old_marked_size_ += obj->HeapSize();
+    ShadeObject(ClassAt(cid));
 
-    if (cid == kWeakArrayCid) {
-      AddToWeakList(static_cast<WeakArray>(obj));
-    } else if (cid == kEphemeronCid) {
-      AddToEphemeronList(static_cast<Ephemeron>(obj));
+    if ((cid == kWeakArrayCid) || (cid == kEphemeronCid)) {
+      marking_deferred_.Push(obj);
     } else {
       Object* from;
       Object* to;
       obj->Pointers(&from, &to);
-      bool has_new_target = ClassAt(cid)->IsNewObject();
       for (Object* ptr = from; ptr <= to; ptr++) {
-        Object target = *ptr;
-        has_new_target |= target->IsNewObject();
-        MarkObject(target);
-      }
-      if (has_new_target && obj->IsOldObject()) {
-        AddToRememberedSet(obj);
+        ShadeObject(*ptr);
       }
     }
+    budget -= obj->HeapSize();
+  }
+  marking_old_size_ = old_size_;
+}
+
+// The remark pause. Anything the incremental steps have not reached yet is
+// traced here: the remaining gray objects, new-space (through the roots and
+// the remembered set), and the contents of weak arrays and ephemerons.
+void Heap::FinishIncrementalMarking() {
+  ASSERT(marking_);
+  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
+  while (!marking_stack_.IsEmpty()) {
+    // One at a time, so the depth of the mark stack stays bounded as in a full
+    // mark-sweep.
+    mark_stack->Push(marking_stack_.Pop());
+    ProcessMarkStack();
+  }
+
+  for (intptr_t i = 0; i < marking_deferred_.size(); i++) {
+    HeapObject obj = marking_deferred_.At(i);
+    if (obj->cid() == kWeakArrayCid) {
+      AddToWeakList(static_cast<WeakArray>(obj));
+    } else {
+      ASSERT(obj->cid() == kEphemeronCid);
+      AddToEphemeronList(static_cast<Ephemeron>(obj));
+    }
   }
+  marking_deferred_.Reset();
+
+  // Objects marked by the incremental steps are not visited again, and the
+  // steps did not follow their references into new-space.
+  remembered_set_.VisitObjects([this](HeapObject obj) {
+    ASSERT(obj->is_remembered());
+    if (!obj->is_marked()) {
+      return;  // Visited normally if reachable.
+    }
+    intptr_t cid = obj->cid();
+    if ((cid == kWeakArrayCid) || (cid == kEphemeronCid)) {
+      return;  // Already on the weak or ephemeron list.
+    }
+    MarkObject(ClassAt(cid));
+    if (obj->is_carded()) {
+      // The new-space references are all in dirty cards.
+      VisitDirtyCards(obj, [this](Object* ptr) {
+        MarkObject(*ptr);
+        return (*ptr)->IsNewObject();
+      });
+      return;
+    }
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      MarkObject(*ptr);
+    }
+  });
+}
+
+// Whereas a full mark-sweep rebuilds the remembered set, the remark pause keeps
+// it and drops the entries that are about to be swept.
+void Heap::FilterRememberedSet() {
+  remembered_set_.Filter([](HeapObject obj) { return obj->is_marked(); });
 }
 
 void Heap::Sweep() {
   freelist_.Reset();
+  SweepNewSpace();
+
+  // Regions are swept when allocation runs out of free-list entries, or before
+  // anything needs the mark bits cleared.
+  ASSERT(unswept_regions_ == nullptr);
+  unswept_regions_ = regions_;
+  regions_ = nullptr;
+
+  SweepLargeRegions();
+}
+
+// Each large region holds a single object, so sweeping only tests its mark
+// bit, and the memory of a dead object is returned to the OS at once rather
+// than to the free list.
+void Heap::SweepLargeRegions() {
+  Region* region = large_regions_;
+  large_regions_ = nullptr;
+  while (region != nullptr) {
+    Region* next = region->next();
+    ASSERT(region->is_large());
+    HeapObject obj = HeapObject::FromAddr(region->object_start());
+    ASSERT(obj->Addr() + obj->HeapSize() == region->object_end());
+    if (obj->is_marked()) {
+      obj->set_is_marked(false);
+      region->set_next(large_regions_);
+      large_regions_ = region;
+    } else {
+      ReleaseRegion(region);
+    }
+    region = next;
+  }
+}
 
+void Heap::SweepNewSpace() {
   uword scan = to_.object_start();
   while (scan < top_) {
     HeapObject obj = HeapObject::FromAddr(scan);
@@ -762,25 +3051,44 @@ void Heap::Sweep() {
       scan = free_scan;
     }
   }
+}
 
-  Region* prev = nullptr;
-  Region* region = regions_;
-  while (region != nullptr) {
-    bool in_use = SweepRegion(region);
-    if (in_use) {
-      prev = region;
-      region = region->next();
-    } else {
-      Region* next = region->next();
-      if (prev == nullptr) {
-        regions_ = next;
-      } else {
-        prev->set_next(next);
-      }
-      old_capacity_ -= region->size();
-      region->Free();
-      region = next;
-    }
+bool Heap::SweepNextRegion() {
+  Region* region = unswept_regions_;
+  if (region == nullptr) {
+    return false;
+  }
+  unswept_regions_ = region->next();
+  SweepAndRelinkRegion(region);
+  return true;
+}
+
+void Heap::FinishSweeping() {
+  while (SweepNextRegion()) {
+  }
+}
+
+void Heap::SweepAndRelinkRegion(Region* region) {
+  bool in_use = SweepRegion(region);
+  if (in_use) {
+    region->set_next(regions_);
+    regions_ = region;
+  } else {
+    ReleaseRegion(region);
+  }
+}
+
+// Empty regions are kept for reuse up to the policy's retention budget, which
+// saves mapping them again when old-space grows back. The rest are unmapped.
+void Heap::ReleaseRegion(Region* region) {
+  old_capacity_ -= region->size();
+  if (!region->is_large() &&
+      (free_regions_size_ + region->size() <= policy_.retained_free_size)) {
+    region->set_next(free_regions_);
+    free_regions_ = region;
+    free_regions_size_ += region->size();
+  } else {
+    region->Free();
   }
 }
 
@@ -791,9 +3099,7 @@ bool Heap::SweepRegion(Region* region) {
     HeapObject obj = HeapObject::FromAddr(scan);
     if (obj->is_marked()) {
       obj->set_is_marked(false);
-      intptr_t size = obj->HeapSize();
-      old_size_ += size;
-      scan += size;
+      scan += obj->HeapSize();
     } else {
       uword free_scan = scan + obj->HeapSize();
       while (free_scan < end) {
@@ -802,30 +3108,152 @@ bool Heap::SweepRegion(Region* region) {
         free_scan += next->HeapSize();
       }
 
-      if ((scan == region->object_start()) && (free_scan == end)) {
-        // Note that Region::Of relies on us releasing large regions instead of
-        // adding them to the freelist.
-        return false;  // Not in use.
+      if ((scan == region->object_start()) && (free_scan == end)) {
+        return false;  // Not in use.
+      }
+
+      intptr_t size = free_scan - scan;
+      freelist_.EnqueueRange(scan, size);
+      if (size >= kMinDecommitSize) {
+        // Only the free-list element's header needs to stay resident.
+        intptr_t header_size = AllocationSize(sizeof(FreeListElement::Layout));
+        region->Decommit(scan + header_size, size - header_size);
+      }
+      scan = free_scan;
+    }
+  }
+  return true;  // In use.
+}
+
+bool Heap::ShouldEvacuate() const {
+  return (old_capacity_ >= kMinEvacuationCapacity) &&
+         (old_capacity_ > kEvacuationRatio * old_size_);
+}
+
+static intptr_t MarkedSize(Region* region) {
+  intptr_t size = 0;
+  uword scan = region->object_start();
+  uword end = region->object_end();
+  while (scan < end) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    intptr_t heap_size = obj->HeapSize();
+    if (obj->is_marked()) {
+      size += heap_size;
+    }
+    scan += heap_size;
+  }
+  return size;
+}
+
+// Copies the live objects out of sparse regions, leaving forwarding corpses
+// behind as become does, then forwards every reference and releases the
+// evacuated regions. The remaining regions are swept eagerly: the heap walk
+// cannot visit dead objects, whose classes may already have been mourned.
+void Heap::EvacuateSparseRegions() {
+  freelist_.Reset();
+  SweepNewSpace();
+
+  ASSERT(unswept_regions_ == nullptr);
+  Region* evacuees = nullptr;
+  Region* region = regions_;
+  regions_ = nullptr;
+  while (region != nullptr) {
+    Region* next = region->next();
+    if (MarkedSize(region) <= kEvacuationLiveLimit) {
+      region->set_next(evacuees);
+      evacuees = region;
+    } else {
+      SweepAndRelinkRegion(region);
+    }
+    region = next;
+  }
+  // Large objects are never moved.
+  SweepLargeRegions();
+
+  size_t evacuated = 0;
+  for (region = evacuees; region != nullptr; region = region->next()) {
+    uword scan = region->object_start();
+    uword end = region->object_end();
+    while (scan < end) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      intptr_t heap_size = obj->HeapSize();
+      if (obj->is_marked()) {
+        uword addr = AllocateOldSmall(heap_size, kForceGrowth);
+        memcpy(reinterpret_cast<void*>(addr),
+               reinterpret_cast<void*>(obj->Addr()),
+               heap_size);
+        HeapObject copy = HeapObject::FromAddr(addr);
+        copy->set_is_marked(false);
+
+        HeapObject::Initialize(obj->Addr(), kForwardingCorpseCid, heap_size);
+        ForwardingCorpse corpse = static_cast<ForwardingCorpse>(obj);
+        if (corpse->heap_size() == 0) {
+          corpse->set_overflow_size(heap_size);
+        }
+        corpse->set_target(copy);
+        evacuated += heap_size;
       }
-
-      freelist_.EnqueueRange(scan, free_scan - scan);
-      scan = free_scan;
+      scan += heap_size;
     }
   }
-  return true;  // In use.
+  // The copies were counted again by AllocateOldSmall.
+  old_size_ -= evacuated;
+
+  // Unlike become, evacuation keeps class identities, so class table entries
+  // are simply forwarded.
+  for (intptr_t cid = kFirstLegalCid; cid < class_table_size_; cid++) {
+    ForwardPointer(&class_table_[cid]);
+  }
+  ForwardRoots();
+  ForwardHeap();  // Rebuilds the remembered set.
+  MournIdentityHashesForwarded();
+
+  region = evacuees;
+  while (region != nullptr) {
+    Region* next = region->next();
+    ReleaseRegion(region);
+    region = next;
+  }
 }
 
 void Heap::SetOldAllocationLimit() {
-  old_limit_ = old_size_ + old_size_ / 2;
+  old_limit_ = old_size_ + old_size_ / 100 * policy_.old_growth_percent;
   if (old_limit_ < old_size_ + 2 * kRegionSize) {
     old_limit_ = old_size_ + 2 * kRegionSize;
   }
+  if ((policy_.max_size != 0) && (old_limit_ > policy_.max_size)) {
+    // Collect before the hard limit is reached, but not after every region
+    // once the heap is nearly full.
+    old_limit_ = policy_.max_size;
+    if (old_limit_ < old_size_ + kRegionSize) {
+      old_limit_ = old_size_ + kRegionSize;
+    }
+  }
+  old_marking_threshold_ = old_size_ + (old_limit_ - old_size_) / 2;
   if (TRACE_GROWTH) {
     OS::PrintErr("Old %" Pd "kB size, %" Pd "kB capacity, %" Pd "kB limit\n",
                  old_size_ / KB, old_capacity_ / KB, old_limit_ / KB);
   }
 }
 
+bool Heap::FitsUnderLimit(intptr_t length, intptr_t element_size) const {
+  ASSERT(length >= 0);
+  ASSERT(element_size > 0);
+  size_t size = Size();
+  if (size >= policy_.max_size) {
+    return false;
+  }
+  size_t available = policy_.max_size - size;
+  return static_cast<size_t>(length) <= available / element_size;
+}
+
+bool Heap::HasRoomForAfterCollection(intptr_t length, intptr_t element_size) {
+  // Empty new-space first so that Size counts only live objects.
+  Scavenge(kPrimitive);
+  MarkSweep(kPrimitive);
+  return FitsUnderLimit(length, element_size);
+}
+
 void Heap::AddToEphemeronList(Ephemeron survivor) {
   DEBUG_ASSERT(survivor->IsOldObject() || InToSpace(survivor));
   survivor->set_next(ephemeron_list_);
@@ -859,9 +3287,8 @@ void Heap::ScavengeEphemeronList() {
         AddToRememberedSet(survivor);
       }
     } else {
-      // Fate of key is not yet known, return the ephemeron to list.
-      survivor->set_next(ephemeron_list_);
-      ephemeron_list_ = survivor;
+      // Fate of key is not yet known.
+      WaitForKey(survivor);
     }
 
     survivor = next;
@@ -882,9 +3309,8 @@ void Heap::MarkEphemeronList() {
     survivor->set_next(nullptr);
 
     if (IsMarkSweepSurvivor(survivor->key())) {
-      // TODO(rmacnak): These scavenges potentially add to the ephemeron list
-      // that we are in the middle of traversing. Add tests for ephemerons
-      // only reachable from another ephemeron.
+      // Marking these may add to the ephemeron list, which is handled by the
+      // next call.
       MarkObject(survivor->key());
       MarkObject(survivor->value());
       MarkObject(survivor->finalizer());
@@ -897,16 +3323,61 @@ void Heap::MarkEphemeronList() {
         AddToRememberedSet(survivor);
       }
     } else {
-      // Fate of the key is not yet known; add the ephemeron back to the list.
-      survivor->set_next(ephemeron_list_);
-      ephemeron_list_ = survivor;
+      // Fate of the key is not yet known.
+      WaitForKey(survivor);
     }
 
     survivor = next;
   }
 }
 
+void Heap::WaitForKey(Ephemeron ephemeron) {
+  HeapObject key = static_cast<HeapObject>(ephemeron->key());
+  ASSERT(key->IsHeapObject());
+  intptr_t head = waiting_ephemerons_.Lookup(key->Addr());
+  ephemeron->set_next(head == 0
+      ? nullptr
+      : static_cast<Ephemeron>(HeapObject::FromAddr(head)));
+  waiting_ephemerons_.Insert(key->Addr(), ephemeron->Addr());
+  key->set_is_waiting_key(true);
+}
+
+// Called by the tracer when it reaches a key with kWaitingKeyBit set, after
+// clearing it.
+void Heap::WakeEphemerons(uword key_addr) {
+  intptr_t head = waiting_ephemerons_.Lookup(key_addr);
+  ASSERT(head != 0);
+  waiting_ephemerons_.Remove(key_addr);
+  Ephemeron waiting = static_cast<Ephemeron>(HeapObject::FromAddr(head));
+  while (waiting != nullptr) {
+    Ephemeron next = waiting->next();
+    waiting->set_next(ephemeron_list_);
+    ephemeron_list_ = waiting;
+    waiting = next;
+  }
+}
+
 void Heap::MournEphemeronList() {
+  // The keys still waiting were not reached.
+  ASSERT(ephemeron_list_ == nullptr);
+  intptr_t capacity;
+  IdentityHashTable::Entry* entries = waiting_ephemerons_.Release(&capacity);
+  for (intptr_t i = 0; i < capacity; i++) {
+    if (entries[i].addr == 0) {
+      continue;
+    }
+    HeapObject::FromAddr(entries[i].addr)->set_is_waiting_key(false);
+    Ephemeron waiting =
+        static_cast<Ephemeron>(HeapObject::FromAddr(entries[i].hash));
+    while (waiting != nullptr) {
+      Ephemeron next = waiting->next();
+      waiting->set_next(ephemeron_list_);
+      ephemeron_list_ = waiting;
+      waiting = next;
+    }
+  }
+  delete[] entries;
+
   Object nil = interpreter_->nil_obj();
   Ephemeron survivor = ephemeron_list_;
   ephemeron_list_ = nullptr;
@@ -938,16 +3409,25 @@ void Heap::MournWeakListScavenge() {
   while (survivor != nullptr) {
     ASSERT(survivor->IsWeakArray());
 
-    Object* from;
-    Object* to;
-    survivor->Pointers(&from, &to);
-    for (Object* ptr = from; ptr <= to; ptr++) {
-      MournWeakPointerScavenge(ptr);
-      if (survivor->IsOldObject() &&
-          (*ptr)->IsNewObject() &&
-          !survivor->is_remembered()) {
+    if (survivor->is_carded()) {
+      if (VisitDirtyCards(survivor, [this](Object* ptr) {
+            MournWeakPointerScavenge(ptr);
+            return (*ptr)->IsNewObject();
+          }) && !survivor->is_remembered()) {
         AddToRememberedSet(survivor);
       }
+    } else {
+      Object* from;
+      Object* to;
+      survivor->Pointers(&from, &to);
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        MournWeakPointerScavenge(ptr);
+        if (survivor->IsOldObject() &&
+            (*ptr)->IsNewObject() &&
+            !survivor->is_remembered()) {
+          AddToRememberedSet(survivor);
+        }
+      }
     }
 
     WeakArray next = survivor->next();
@@ -968,10 +3448,13 @@ void Heap::MournWeakListMarkSweep() {
     survivor->Pointers(&from, &to);
     for (Object* ptr = from; ptr <= to; ptr++) {
       MournWeakPointerMarkSweep(ptr);
-      if (survivor->IsOldObject() &&
-          (*ptr)->IsNewObject() &&
-          !survivor->is_remembered()) {
-        AddToRememberedSet(survivor);
+      if (survivor->IsOldObject() && (*ptr)->IsNewObject()) {
+        if (survivor->is_carded()) {
+          survivor->RememberCard(ptr);
+        }
+        if (!survivor->is_remembered()) {
+          AddToRememberedSet(survivor);
+        }
       }
     }
 
@@ -1016,35 +3499,51 @@ void Heap::MournWeakPointerMarkSweep(Object* ptr) {
   *ptr = interpreter_->nil_obj();
 }
 
+// Only the entries of classes in new-space can change, so a scavenge costs
+// the number of young classes rather than the size of the table.
 void Heap::MournClassTableScavenge() {
-  for (intptr_t i = kFirstLegalCid; i < class_table_size_; i++) {
+  intptr_t kept = 0;
+  for (intptr_t j = 0; j < new_class_ids_size_; j++) {
+    intptr_t i = new_class_ids_[j];
     Object* ptr = &class_table_[i];
 
     HeapObject old_target = static_cast<HeapObject>(*ptr);
-    if (old_target->IsImmediateOrOldObject()) {
-      continue;
-    }
-
+    ASSERT(!old_target->IsImmediateOrOldObject());
     DEBUG_ASSERT(InFromSpace(old_target));
 
     if (IsForwarded(old_target)) {
       HeapObject new_target = ForwardingTarget(old_target);
       DEBUG_ASSERT(new_target->IsOldObject() || InToSpace(new_target));
       *ptr = new_target;
+      if (new_target->IsNewObject()) {
+        new_class_ids_[kept++] = i;
+      }
     } else {
       *ptr = SmallInteger::New(class_table_free_);
       class_table_free_ = i;
     }
   }
+  new_class_ids_size_ = kept;
+
+#if defined(DEBUG)
+  for (intptr_t i = kFirstLegalCid; i < class_table_size_; i++) {
+    ASSERT(class_table_[i]->IsImmediateOrOldObject() ||
+           InToSpace(static_cast<HeapObject>(class_table_[i])));
+  }
+#endif
 }
 
 void Heap::MournClassTableMarkSweep() {
+  new_class_ids_size_ = 0;
   for (intptr_t i = kFirstLegalCid; i < class_table_size_; i++) {
     Object* ptr = &class_table_[i];
 
     Object target = *ptr;
 
     if (IsMarkSweepSurvivor(target)) {
+      if (target->IsNewObject()) {
+        AddNewClassId(i);
+      }
       continue;
     }
 
@@ -1053,10 +3552,15 @@ void Heap::MournClassTableMarkSweep() {
   }
 }
 
+// Become may have moved any entry, so this also rebuilds the new class ids.
 void Heap::MournClassTableForwarded() {
+  new_class_ids_size_ = 0;
   for (intptr_t i = kFirstLegalCid; i < class_table_size_; i++) {
     Behavior old_class = static_cast<Behavior>(class_table_[i]);
     if (!old_class->IsForwardingCorpse()) {
+      if (old_class->IsNewObject()) {
+        AddNewClassId(i);
+      }
       continue;
     }
 
@@ -1066,6 +3570,71 @@ void Heap::MournClassTableForwarded() {
   }
 }
 
+void Heap::AddNewClassId(intptr_t cid) {
+  if (new_class_ids_size_ == new_class_ids_capacity_) {
+    intptr_t new_capacity =
+        new_class_ids_capacity_ == 0 ? 64 : new_class_ids_capacity_ * 2;
+    intptr_t* new_ids = new intptr_t[new_capacity];
+    for (intptr_t i = 0; i < new_class_ids_size_; i++) {
+      new_ids[i] = new_class_ids_[i];
+    }
+    delete[] new_class_ids_;
+    new_class_ids_ = new_ids;
+    new_class_ids_capacity_ = new_capacity;
+  }
+  new_class_ids_[new_class_ids_size_++] = cid;
+}
+
+void Heap::MournIdentityHashesScavenge() {
+  intptr_t capacity;
+  IdentityHashTable::Entry* entries = new_identity_hashes_.Release(&capacity);
+  for (intptr_t i = 0; i < capacity; i++) {
+    if (entries[i].addr == 0) {
+      continue;
+    }
+    HeapObject old_obj = HeapObject::FromAddr(entries[i].addr);
+    DEBUG_ASSERT(InFromSpace(old_obj));
+    if (IsForwarded(old_obj)) {
+      HeapObject new_obj = ForwardingTarget(old_obj);
+      SetIdentityHash(new_obj, entries[i].hash);  // Maybe tenured.
+    }
+  }
+  delete[] entries;
+}
+
+void Heap::MournIdentityHashesMarkSweep() {
+  IdentityHashTable* tables[] = { &new_identity_hashes_,
+                                  &old_identity_hashes_ };
+  for (IdentityHashTable* table : tables) {
+    intptr_t capacity;
+    IdentityHashTable::Entry* entries = table->Release(&capacity);
+    for (intptr_t i = 0; i < capacity; i++) {
+      if ((entries[i].addr != 0) &&
+          HeapObject::FromAddr(entries[i].addr)->is_marked()) {
+        table->Insert(entries[i].addr, entries[i].hash);
+      }
+    }
+    delete[] entries;
+  }
+}
+
+void Heap::MournIdentityHashesForwarded() {
+  intptr_t capacity;
+  IdentityHashTable::Entry* entries = old_identity_hashes_.Release(&capacity);
+  for (intptr_t i = 0; i < capacity; i++) {
+    if (entries[i].addr == 0) {
+      continue;
+    }
+    HeapObject obj = HeapObject::FromAddr(entries[i].addr);
+    if (obj->IsForwardingCorpse()) {
+      obj = static_cast<HeapObject>(
+          static_cast<ForwardingCorpse>(obj)->target());
+    }
+    old_identity_hashes_.Insert(obj->Addr(), entries[i].hash);
+  }
+  delete[] entries;
+}
+
 bool Heap::BecomeForward(Array old, Array neu) {
   if (old->Size() != neu->Size()) {
     return false;
@@ -1076,6 +3645,7 @@ bool Heap::BecomeForward(Array old, Array neu) {
     OS::PrintErr("become(%" Pd ")\n", length);
   }
 
+  bool young = true;
   for (intptr_t i = 0; i < length; i++) {
     Object forwarder = old->element(i);
     Object forwardee = neu->element(i);
@@ -1083,8 +3653,26 @@ bool Heap::BecomeForward(Array old, Array neu) {
         forwardee->IsImmediateObject()) {
       return false;
     }
+    if (forwarder->IsOldObject()) {
+      young = false;
+    }
+  }
+
+  if (marking_) {
+    // Forwarders must not be left on the marking stack.
+    MarkSweep(kBecome);
+  }
+
+  if (!young) {
+    // The heap walk needs every region swept, before old forwarders lose their
+    // mark bits.
+    FinishSweeping();
   }
 
+  // Also before creating forwarders, while the old classes can still be read.
+  SelectorSet changed;
+  bool selective = FindChangedSelectors(old, neu, &changed);
+
   interpreter_->GCPrologue();  // Before creating forwarders!
 
   for (intptr_t i = 0; i < length; i++) {
@@ -1094,7 +3682,14 @@ bool Heap::BecomeForward(Array old, Array neu) {
     ASSERT(!forwarder->IsForwardingCorpse());
     ASSERT(!forwardee->IsForwardingCorpse());
 
-    forwardee->set_header_hash(forwarder->header_hash());
+    // The forwardee takes over the forwarder's identity, including its hash.
+    intptr_t hash = IdentityHash(forwarder);
+    IdentityHashesFor(forwarder)->Remove(forwarder->Addr());
+    if (hash == 0) {
+      IdentityHashesFor(forwardee)->Remove(forwardee->Addr());
+    } else {
+      SetIdentityHash(forwardee, hash);
+    }
 
     intptr_t heap_size = forwarder->HeapSize();
 
@@ -1109,16 +3704,149 @@ bool Heap::BecomeForward(Array old, Array neu) {
     corpse->set_target(forwardee);
   }
 
-  ForwardClassIds();
+  bool forwarded_classes = ForwardClassIds();
   ForwardRoots();
-  ForwardHeap();  // With forwarded class ids.
+  if (young && !forwarded_classes) {
+    // Only new-space and the remembered set can refer to new forwarders.
+    ForwardNewSpace();
+    ForwardRememberedSet();
+  } else {
+    if (young) {
+      FinishSweeping();
+    }
+    ForwardHeap();  // With forwarded class ids.
+  }
   MournClassTableForwarded();
 
-  interpreter_->GCEpilogue();
+  if (selective) {
+    interpreter_->BecomeEpilogue(changed);
+  } else {
+    interpreter_->GCEpilogue();
+  }
 
   return true;
 }
 
+// Lookups only read the classes of receivers and their enclosing objects, and
+// these classes' superclasses, so a become can only change them by forwarding
+// some of these classes. Installing methods forwards each class they change,
+// and the classes that inherit from it. Walks every class's superclass chain
+// as it will be after the become, alongside the chain it had, and adds the
+// selectors whose methods differ between the two to |changed|. Answers false
+// if a chain changed its shape, or doesNotUnderstand: changed, so that any
+// lookup may have changed.
+bool Heap::FindChangedSelectors(Array old, Array neu, SelectorSet* changed) {
+  // Open addressing from each forwarder to its forwardee.
+  struct Slot {
+    Object forwarder;  // nullptr when empty.
+    Object forwardee;
+    bool walked;
+  };
+  intptr_t length = old->Size();
+  intptr_t capacity = 4;
+  while (capacity < 2 * length) {
+    capacity <<= 1;
+  }
+  const uword mask = capacity - 1;
+  Slot* table = new Slot[capacity];
+  for (intptr_t i = 0; i < capacity; i++) {
+    table[i].forwarder = nullptr;
+  }
+  auto lookup = [&](Object forwarder) -> Slot* {
+    uword key = static_cast<uword>(forwarder);
+    uword index = (key ^ (key >> kObjectAlignmentLog2)) & mask;
+    while ((table[index].forwarder != nullptr) &&
+           (table[index].forwarder != forwarder)) {
+      index = (index + 1) & mask;
+    }
+    return &table[index];
+  };
+  for (intptr_t i = 0; i < length; i++) {
+    Slot* slot = lookup(old->element(i));
+    slot->forwarder = old->element(i);
+    slot->forwardee = neu->element(i);
+    slot->walked = false;
+  }
+  auto forward = [&](Object obj) -> Object {
+    Slot* slot = lookup(obj);
+    return slot->forwarder == nullptr ? obj : slot->forwardee;
+  };
+
+  auto diff = [&](Array old_methods, Array new_methods) {
+    if (old_methods == new_methods) {
+      return;
+    }
+    intptr_t old_length = old_methods->Size();
+    intptr_t new_length = new_methods->Size();
+    for (intptr_t i = 0; i < old_length; i++) {
+      Method method = static_cast<Method>(old_methods->element(i));
+      intptr_t j = 0;
+      while ((j < new_length) && (new_methods->element(j) != method)) {
+        j++;
+      }
+      if (j == new_length) {
+        changed->Add(method->selector());  // Removed or replaced.
+      }
+    }
+    for (intptr_t j = 0; j < new_length; j++) {
+      Method method = static_cast<Method>(new_methods->element(j));
+      intptr_t i = 0;
+      while ((i < old_length) && (old_methods->element(i) != method)) {
+        i++;
+      }
+      if (i == old_length) {
+        changed->Add(method->selector());  // Added or replacing.
+      }
+    }
+  };
+
+  Object nil = interpreter_->nil_obj();
+  bool same_shape = true;
+  for (intptr_t cid = kFirstLegalCid;
+       same_shape && (cid < class_table_size_);
+       cid++) {
+    if (class_table_[cid]->IsSmallInteger()) {
+      continue;  // Free.
+    }
+    Behavior before = static_cast<Behavior>(class_table_[cid]);
+    Behavior after = static_cast<Behavior>(forward(before));
+    while (before != nil) {
+      if ((after == nil) || (forward(before) != after)) {
+        same_shape = false;
+        break;
+      }
+      if (before != after) {
+        Slot* slot = lookup(before);
+        if (slot->walked) {
+          break;  // As is the rest of its chain.
+        }
+        slot->walked = true;
+        AbstractMixin before_mixin = before->mixin();
+        AbstractMixin after_mixin = after->mixin();
+        if ((forward(before_mixin) != forward(after_mixin)) ||
+            (forward(before->enclosing_object()) !=
+             forward(after->enclosing_object())) ||
+            ((before_mixin != after_mixin) &&
+             (forward(before_mixin->enclosing_mixin()) !=
+              forward(after_mixin->enclosing_mixin())))) {
+          same_shape = false;
+          break;
+        }
+        diff(before->methods(), after->methods());
+      }
+      before = before->superclass();
+      after = static_cast<Behavior>(forward(after->superclass()));
+    }
+    if (before == nil && after != nil) {
+      same_shape = false;
+    }
+  }
+  delete[] table;
+
+  ObjectStore os = interpreter_->object_store();
+  return same_shape && !changed->Contains(os->does_not_understand());
+}
+
 void Heap::ForwardRoots() {
   for (intptr_t i = 0; i < handles_size_; i++) {
     ForwardPointer(handles_[i]);
@@ -1130,13 +3858,22 @@ void Heap::ForwardRoots() {
   for (Object* ptr = from; ptr <= to; ptr++) {
     ForwardPointer(ptr);
   }
-  interpreter_->StackPointers(&from, &to);
-  for (Object* ptr = from; ptr <= to; ptr++) {
-    ForwardPointer(ptr);
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ForwardPointer(ptr);
+    }
   }
 }
 
 void Heap::ForwardHeap() {
+  ForwardNewSpace();
+
+  remembered_set_.Clear();
+  ForwardRegions(regions_);
+  ForwardRegions(large_regions_);
+}
+
+void Heap::ForwardNewSpace() {
   uword scan = to_.object_start();
   while (scan < top_) {
     HeapObject obj = HeapObject::FromAddr(scan);
@@ -1151,9 +3888,28 @@ void Heap::ForwardHeap() {
     }
     scan += obj->HeapSize();
   }
+}
 
-  remembered_set_size_ = 0;
-  for (Region* region = regions_; region != nullptr; region = region->next()) {
+// Entries whose new targets are all forwarded to old objects stay remembered
+// until the next scavenge drops them.
+void Heap::ForwardRememberedSet() {
+  remembered_set_.VisitObjects([](HeapObject obj) {
+    ASSERT(obj->is_remembered());
+    if (obj->is_carded()) {
+      VisitDirtyCards(obj, [](Object* ptr) { return ForwardPointer(ptr); });
+    } else {
+      Object* from;
+      Object* to;
+      obj->Pointers(&from, &to);
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        ForwardPointer(ptr);
+      }
+    }
+  });
+}
+
+void Heap::ForwardRegions(Region* regions) {
+  for (Region* region = regions; region != nullptr; region = region->next()) {
     uword scan = region->object_start();
     while (scan < region->object_end()) {
       HeapObject obj = HeapObject::FromAddr(scan);
@@ -1169,6 +3925,9 @@ void Heap::ForwardHeap() {
         for (Object* ptr = from; ptr <= to; ptr++) {
           if (ForwardPointer(ptr)) {
             has_new_target = true;
+            if (obj->is_carded()) {
+              obj->RememberCard(ptr);
+            }
           }
         }
         if (has_new_target) {
@@ -1180,13 +3939,15 @@ void Heap::ForwardHeap() {
   }
 }
 
-void Heap::ForwardClassIds() {
+// Returns whether any class was forwarded.
+bool Heap::ForwardClassIds() {
   // For forwarded classes, use the cid of the old class. For most classes, we
   // could use the cid of the new class or a newlly allocated cid (provided all
   // the instances are updated). But for the classes whose representation is
   // defined by the VM we need to keep the fixed cids (e.g., kSmallIntegerCid),
   // so we may as well treat them all the same way.
   Object nil = interpreter_->nil_obj();
+  bool forwarded = false;
   for (intptr_t old_cid = kFirstLegalCid;
        old_cid < class_table_size_;
        old_cid++) {
@@ -1207,11 +3968,14 @@ void Heap::ForwardClassIds() {
       // Arrange for instances with new_cid to be migrated to old_cid.
       intptr_t new_cid = new_class->id()->value();
       class_table_[new_cid] = old_class;
+      // Unmarked below. A corpse left marked would look forwarded to the
+      // pretenuring census.
+      old_class->set_is_marked(true);
     }
 
     new_class->set_id(SmallInteger::New(old_cid));
     class_table_[old_cid] = new_class;
-    old_class->set_is_marked(true);
+    forwarded = true;
   }
 
   for (intptr_t cid = kFirstLegalCid; cid < class_table_size_; cid++) {
@@ -1220,6 +3984,7 @@ void Heap::ForwardClassIds() {
       klass->set_is_marked(false);
     }
   }
+  return forwarded;
 }
 
 intptr_t Heap::AllocateClassId() {
@@ -1254,6 +4019,12 @@ intptr_t Heap::AllocateClassId() {
       }
 #endif
       delete[] old_class_table;
+      Pretenuring* old_pretenuring = pretenuring_;
+      pretenuring_ = new Pretenuring[class_table_capacity_]();
+      for (intptr_t i = 0; i < class_table_size_; i++) {
+        pretenuring_[i] = old_pretenuring[i];
+      }
+      delete[] old_pretenuring;
       cid = class_table_size_;
       class_table_size_++;
     }
@@ -1264,6 +4035,7 @@ intptr_t Heap::AllocateClassId() {
 #if defined(DEBUG)
   class_table_[cid] = static_cast<Object>(kUninitializedWord);
 #endif
+  pretenuring_[cid] = Pretenuring();
   return cid;
 }
 
@@ -1291,215 +4063,362 @@ void Heap::InitializeAfterSnapshot() {
   }
   top_ = to_.object_start();
   end_ = to_.limit();
+  UpdateAllocationLimit();
 
   SetOldAllocationLimit();
 }
 
-static void Truncate(Array array, intptr_t new_size) {
-  ASSERT(new_size >= 0);
-  ASSERT(new_size <= array->Size());
+// The objects found by one heap walk for several queries at once, grown as
+// they are found rather than counted by an earlier walk. They are not roots,
+// so nothing may be allocated in a way that collects garbage while they are
+// held.
+class QueryResults {
+ public:
+  explicit QueryResults(intptr_t num_queries)
+      : entries_(nullptr), size_(0), capacity_(0),
+        queries_(new Query[num_queries]()) {}
+  ~QueryResults() {
+    delete[] entries_;
+    delete[] queries_;
+  }
 
-  intptr_t old_heap_size = AllocationSize(array->Size() * sizeof(Object) +
-                                          sizeof(Array::Layout));
-  intptr_t new_heap_size = AllocationSize(new_size * sizeof(Object) +
-                                          sizeof(Array::Layout));
+  // Once for each object and query however often it matches, since a walk
+  // finds all of an object's matches together.
+  void Add(intptr_t query, HeapObject object) {
+    if (queries_[query].last == object->Addr()) {
+      return;
+    }
+    queries_[query].last = object->Addr();
+    if (size_ == capacity_) {
+      Grow();
+    }
+    entries_[size_].query = query;
+    entries_[size_].object = object;
+    size_++;
+    queries_[query].count++;
+  }
 
-  ASSERT(array->HeapSize() == old_heap_size);
-  ASSERT(array->HeapSizeFromClass() == old_heap_size);
-  array->set_size(SmallInteger::New(new_size));
-  array->set_heap_size(new_heap_size);
-  ASSERT(array->HeapSize() == new_heap_size);
-  ASSERT(array->HeapSizeFromClass() == new_heap_size);
+  intptr_t size() const { return size_; }
+  intptr_t query_at(intptr_t i) const { return entries_[i].query; }
+  HeapObject object_at(intptr_t i) const { return entries_[i].object; }
+  intptr_t count(intptr_t query) const { return queries_[query].count; }
 
-  intptr_t free_size = old_heap_size - new_heap_size;
-  if (free_size != 0) {
-    uword free_start = array->Addr() + new_heap_size;
-    HeapObject object =
-        HeapObject::Initialize(free_start, kFreeListElementCid, free_size);
-    FreeListElement element = static_cast<FreeListElement>(object);
-    if (element->heap_size() == 0) {
-      ASSERT(free_size > kObjectAlignment);
-      element->set_overflow_size(free_size);
+ private:
+  struct Entry {
+    intptr_t query;
+    HeapObject object;
+  };
+  struct Query {
+    intptr_t count;
+    uword last;  // The address of the latest object added.
+  };
+
+  void Grow() {
+    intptr_t new_capacity = capacity_ == 0 ? 256 : capacity_ * 2;
+    Entry* new_entries = new Entry[new_capacity];
+    for (intptr_t i = 0; i < size_; i++) {
+      new_entries[i] = entries_[i];
     }
-    ASSERT(object->HeapSize() == free_size);
-    ASSERT(element->HeapSize() == free_size);
+    delete[] entries_;
+    entries_ = new_entries;
+    capacity_ = new_capacity;
   }
+
+  Entry* entries_;
+  intptr_t size_;
+  intptr_t capacity_;
+  Query* queries_;
+
+  DISALLOW_COPY_AND_ASSIGN(QueryResults);
+};
+
+// Objects found by a heap walk do not move when stored into this, as neither
+// old-space allocation with forced growth nor a sweep already finished
+// collects garbage.
+Array Heap::AllocateArrayWithoutCollecting(intptr_t num_slots) {
+  const intptr_t heap_size =
+      AllocationSize(num_slots * sizeof(Object) + sizeof(Array::Layout));
+  uword addr = heap_size >= kLargeAllocation
+      ? AllocateOldLarge(heap_size, kForceGrowth)
+      : AllocateOldSmall(heap_size, kForceGrowth);
+  HeapObject obj = HeapObject::Initialize(addr, kArrayCid, heap_size);
+  Array result = static_cast<Array>(obj);
+  UseCardsIfLarge(result, heap_size);
+  result->set_size(SmallInteger::New(num_slots));
+  ASSERT(result->IsArray());
+  ASSERT(result->HeapSize() == heap_size);
+  return result;
 }
 
-static intptr_t CountInstancesOf(intptr_t count,
-                                 intptr_t cid,
-                                 uword start,
-                                 uword end) {
-  uword scan = start;
-  while (scan < end) {
-    HeapObject obj = HeapObject::FromAddr(scan);
-    if (obj->cid() == cid) {
-      count++;
+// A query repeated in the input shares the first one's result, and one
+// answered without a walk, marked by -1, gets an empty result.
+void Heap::MakeResults(const QueryResults& found, const intptr_t* query_of,
+                       intptr_t num_queries, Array* results) {
+  for (intptr_t i = 0; i < num_queries; i++) {
+    intptr_t query = query_of[i];
+    if (query == -1) {
+      results[i] = AllocateArrayWithoutCollecting(0);
+    } else if (query == i) {
+      results[i] = AllocateArrayWithoutCollecting(found.count(query));
+    } else {
+      results[i] = results[query];
     }
-    scan += obj->HeapSize();
   }
-  return count;
+  intptr_t* cursors = new intptr_t[num_queries]();
+  for (intptr_t i = 0; i < found.size(); i++) {
+    intptr_t query = found.query_at(i);
+    results[query]->set_element(cursors[query]++, found.object_at(i));
+  }
+  delete[] cursors;
 }
 
-static intptr_t CollectInstancesOf(intptr_t cursor,
-                                   Array result,
-                                   intptr_t cid,
-                                   uword start,
-                                   uword end) {
+template <typename Visitor>
+static void VisitRangeForQueries(uword start, uword end, Visitor visit) {
   uword scan = start;
   while (scan < end) {
     HeapObject obj = HeapObject::FromAddr(scan);
-    if (obj->cid() == cid) {
-      result->set_element(cursor++, obj);
+    if (obj->cid() >= kFirstLegalCid) {  // Not a free-list element.
+      visit(obj);
     }
     scan += obj->HeapSize();
   }
-  return cursor;
 }
 
-Array Heap::InstancesOf(Behavior cls) {
-  if (cls->id() == interpreter_->nil_obj()) {
-    // Class not yet registered: no instance has been allocated.
-    return AllocateArray(0);  // SAFEPOINT.
+void Heap::FindInstances(Object* classes, intptr_t num_classes,
+                         Array* results) {
+  intptr_t* query_for_cid = new intptr_t[class_table_size_];
+  for (intptr_t cid = 0; cid < class_table_size_; cid++) {
+    query_for_cid[cid] = -1;
+  }
+  intptr_t* query_of = new intptr_t[num_classes];
+  for (intptr_t i = 0; i < num_classes; i++) {
+    Behavior cls = static_cast<Behavior>(classes[i]);
+    cls->AssertCouldBeBehavior();
+    if (cls->id() == interpreter_->nil_obj()) {
+      // Class not yet registered: no instance has been allocated.
+      query_of[i] = -1;
+      continue;
+    }
+    ASSERT(cls->id()->IsSmallInteger());
+    intptr_t cid = cls->id()->value();
+    if (query_for_cid[cid] == -1) {
+      query_for_cid[cid] = i;
+    }
+    query_of[i] = query_for_cid[cid];
   }
-  ASSERT(cls->id()->IsSmallInteger());
-  intptr_t cid = cls->id()->value();
 
-  intptr_t count = CountInstancesOf(0, cid,
-                                    to_.object_start(), top_);
+  QueryResults found(num_classes);
+  auto visit = [&](HeapObject obj) {
+    intptr_t query = query_for_cid[obj->cid()];
+    if (query != -1) {
+      found.Add(query, obj);
+    }
+  };
+  FinishSweeping();
+  VisitRangeForQueries(to_.object_start(), top_, visit);
   for (Region* region = regions_; region != nullptr; region = region->next()) {
-    count = CountInstancesOf(count, cid,
-                             region->object_start(), region->object_end());
+    VisitRangeForQueries(region->object_start(), region->object_end(), visit);
   }
+  for (Region* region = large_regions_; region != nullptr;
+       region = region->next()) {
+    VisitRangeForQueries(region->object_start(), region->object_end(), visit);
+  }
+
+  MakeResults(found, query_of, num_classes, results);
+  delete[] query_of;
+  delete[] query_for_cid;
+}
 
-  if (cid == kArrayCid) {
-    count++;
+void Heap::FindReferences(Object* targets, intptr_t num_targets,
+                          Array* results) {
+  // Open addressing from each target to its first query.
+  struct Slot {
+    Object target;
+    intptr_t query;  // -1 when empty.
+  };
+  intptr_t capacity = 4;
+  while (capacity < 2 * num_targets) {
+    capacity <<= 1;
+  }
+  const uword mask = capacity - 1;
+  Slot* table = new Slot[capacity];
+  for (intptr_t i = 0; i < capacity; i++) {
+    table[i].query = -1;
   }
-  if (TEST_SLOW_PATH) {
-    count++;  // Ensure truncation is needed.
+  auto lookup = [&](Object target) -> Slot* {
+    uword key = static_cast<uword>(target);
+    uword index = (key ^ (key >> kObjectAlignmentLog2)) & mask;
+    while ((table[index].query != -1) && (table[index].target != target)) {
+      index = (index + 1) & mask;
+    }
+    return &table[index];
+  };
+  intptr_t* query_of = new intptr_t[num_targets];
+  for (intptr_t i = 0; i < num_targets; i++) {
+    Slot* slot = lookup(targets[i]);
+    if (slot->query == -1) {
+      slot->target = targets[i];
+      slot->query = i;
+    }
+    query_of[i] = slot->query;
   }
-  Array result = AllocateArray(count);  // SAFEPOINT
 
-  intptr_t cursor = CollectInstancesOf(0, result, cid,
-                                       to_.object_start(), top_);
+  // TODO(rmacnak): Consider reifying activations in case they refer to target.
+  QueryResults found(num_targets);
+  auto visit = [&](HeapObject obj) {
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      intptr_t query = lookup(*ptr)->query;
+      if (query != -1) {
+        found.Add(query, obj);
+      }
+    }
+  };
+  FinishSweeping();
+  VisitRangeForQueries(to_.object_start(), top_, visit);
   for (Region* region = regions_; region != nullptr; region = region->next()) {
-    cursor = CollectInstancesOf(cursor, result, cid,
-                                region->object_start(), region->object_end());
+    VisitRangeForQueries(region->object_start(), region->object_end(), visit);
+  }
+  for (Region* region = large_regions_; region != nullptr;
+       region = region->next()) {
+    VisitRangeForQueries(region->object_start(), region->object_end(), visit);
   }
 
-  // There may be fewer instances than we initially counted if allocating the
-  // result array triggered a GC.
-  Truncate(result, cursor);
+  MakeResults(found, query_of, num_targets, results);
+  delete[] query_of;
+  delete[] table;
+}
+
+Array Heap::InstancesOf(Behavior cls) {
+  Object classes[] = { cls };
+  Array result;
+  FindInstances(classes, 1, &result);
   return result;
 }
 
-static intptr_t CountReferencesTo(intptr_t count,
-                                  Object target,
-                                  uword start,
-                                  uword end) {
-  uword scan = start;
-  while (scan < end) {
-    HeapObject obj = HeapObject::FromAddr(scan);
-    if (obj->cid() >= kFirstLegalCid) {
-      Object* from;
-      Object* to;
-      obj->Pointers(&from, &to);
-      for (Object* ptr = from; ptr <= to; ptr++) {
-        if (*ptr == target) {
-          count++;
-          break;
-        }
-      }
-    }
-    scan += obj->HeapSize();
+Array Heap::ReferencesTo(Object target) {
+  Object targets[] = { target };
+  Array result;
+  FindReferences(targets, 1, &result);
+  return result;
+}
+
+// The queries are read in place, as nothing here collects garbage.
+Array Heap::InstancesOfAll(Array classes) {
+  intptr_t num_classes = classes->Size();
+  Array* results = new Array[num_classes];
+  FindInstances(classes->from(), num_classes, results);
+  Array result = AllocateArrayWithoutCollecting(num_classes);
+  for (intptr_t i = 0; i < num_classes; i++) {
+    result->set_element(i, results[i]);
   }
-  return count;
+  delete[] results;
+  return result;
+}
+
+Array Heap::ReferencesToAll(Array targets) {
+  intptr_t num_targets = targets->Size();
+  Array* results = new Array[num_targets];
+  FindReferences(targets->from(), num_targets, results);
+  Array result = AllocateArrayWithoutCollecting(num_targets);
+  for (intptr_t i = 0; i < num_targets; i++) {
+    result->set_element(i, results[i]);
+  }
+  delete[] results;
+  return result;
 }
 
-static intptr_t CollectReferencesTo(intptr_t cursor,
-                                    Array result,
-                                    Object target,
-                                    uword start,
-                                    uword end) {
+static void VisitRange(Heap::ObjectVisitor visitor, void* data,
+                       uword start, uword end) {
   uword scan = start;
   while (scan < end) {
     HeapObject obj = HeapObject::FromAddr(scan);
-    if (obj->cid() >= kFirstLegalCid) {
-      Object* from;
-      Object* to;
-      obj->Pointers(&from, &to);
-      for (Object* ptr = from; ptr <= to; ptr++) {
-        if (*ptr == target) {
-          result->set_element(cursor++, obj);
-          break;
-        }
-      }
+    if (obj->cid() >= kFirstLegalCid) {  // Not a free-list element.
+      visitor(obj, data);
     }
     scan += obj->HeapSize();
   }
-  return cursor;
 }
 
-Array Heap::ReferencesTo(Object target) {
-  // TODO(rmacnak): Consider reifying activations in case they refer to target.
-  intptr_t count = CountReferencesTo(0, target,
-                                     to_.object_start(), top_);
+void Heap::VisitObjects(ObjectVisitor visitor, void* data) {
+  // Unswept regions hold unmarked garbage that may refer to freed objects.
+  FinishSweeping();
+  VisitRange(visitor, data, to_.object_start(), top_);
   for (Region* region = regions_; region != nullptr; region = region->next()) {
-    count = CountReferencesTo(count, target,
-                              region->object_start(), region->object_end());
-  }
-
-  if (TEST_SLOW_PATH) {
-    count++;  // Ensure truncation is needed.
-  }
-  Array result;
-  {
-    HandleScope h1(this, &target);
-    result = AllocateArray(count);  // SAFEPOINT
+    VisitRange(visitor, data, region->object_start(), region->object_end());
   }
-
-  intptr_t cursor = CollectReferencesTo(0, result, target,
-                                        to_.object_start(), top_);
-  for (Region* region = regions_; region != nullptr; region = region->next()) {
-    cursor = CollectReferencesTo(cursor, result, target,
-                                 region->object_start(), region->object_end());
+  for (Region* region = large_regions_; region != nullptr;
+       region = region->next()) {
+    VisitRange(visitor, data, region->object_start(), region->object_end());
   }
-
-  // There may be fewer instances than we initially counted if allocating the
-  // result array triggered a GC.
-  Truncate(result, cursor);
-  return result;
 }
 
 uword FreeList::TryAllocate(intptr_t size) {
   intptr_t index = IndexForSize(size);
-  while (index < kSizeClasses) {
-    if (free_lists_[index] != nullptr) {
-      FreeListElement element = Dequeue(index);
-      SplitAndRequeue(element, size);
-      return element.Addr();
-    }
-    index++;
+
+  // Elements of an exact class fit; elements of a geometric class may not.
+  FreeListElement element = free_lists_[index];
+  if ((element != nullptr) && (element->HeapSize() >= size)) {
+    Dequeue(index);
+    SplitAndRequeue(element, size);
+    return element->Addr();
   }
 
+  // Every element of a larger class fits.
+  uint64_t larger = (index == kNumClasses - 1)
+      ? 0 : non_empty_ & (~static_cast<uint64_t>(0) << (index + 1));
+  if (larger != 0) {
+    element = Dequeue(Utils::CountTrailingZeros(larger));
+    SplitAndRequeue(element, size);
+    return element->Addr();
+  }
+
+  if (index != kNumClasses - 1) {
+    return 0;
+  }
+
+  // The last class is unbounded: first fit.
   FreeListElement prev = nullptr;
-  FreeListElement element = free_lists_[kSizeClasses];
+  element = free_lists_[index];
   while (element != nullptr) {
     if (element->HeapSize() >= size) {
       if (prev == nullptr) {
-        free_lists_[kSizeClasses] = element->next();
+        Dequeue(index);
       } else {
         prev->set_next(element->next());
+        free_counts_[index]--;
+        free_sizes_[index] -= element->HeapSize();
       }
       SplitAndRequeue(element, size);
       return element->Addr();
     }
+    prev = element;
     element = element->next();
   }
 
   return 0;
 }
 
+uword FreeList::TryAllocateChunk(intptr_t min_size, intptr_t* size) {
+  if (non_empty_ == 0) {
+    return 0;
+  }
+  // Bit 63 would read as a sign.
+  intptr_t index = kNumClasses - 1;
+  if ((non_empty_ & (static_cast<uint64_t>(1) << index)) == 0) {
+    index = Utils::HighestBit(static_cast<int64_t>(non_empty_));
+  }
+  FreeListElement element = free_lists_[index];
+  if (element->HeapSize() < min_size) {
+    return 0;
+  }
+  Dequeue(index);
+  *size = element->HeapSize();
+  return element->Addr();
+}
+
 void FreeList::SplitAndRequeue(FreeListElement element, intptr_t size) {
   ASSERT(size > 0);
   ASSERT((size & kObjectAlignmentMask) == 0);
@@ -1519,14 +4438,32 @@ FreeListElement FreeList::Dequeue(intptr_t index) {
   }
   ASSERT((element->next() == nullptr) || element->next()->IsFreeListElement());
   free_lists_[index] = element->next();
+  if (free_lists_[index] == nullptr) {
+    non_empty_ &= ~(static_cast<uint64_t>(1) << index);
+  }
+  free_counts_[index]--;
+  free_sizes_[index] -= element->HeapSize();
   return element;
 }
 
 void FreeList::Enqueue(FreeListElement element) {
   ASSERT(element->IsFreeListElement());
-  intptr_t index = IndexForSize(element->HeapSize());
+  intptr_t size = element->HeapSize();
+  intptr_t index = IndexForSize(size);
   element->set_next(free_lists_[index]);
   free_lists_[index] = element;
+  non_empty_ |= static_cast<uint64_t>(1) << index;
+  free_counts_[index]++;
+  free_sizes_[index] += size;
+}
+
+void FreeList::PrintStatistics() const {
+  for (intptr_t i = 0; i < kNumClasses; i++) {
+    if (free_counts_[i] != 0) {
+      OS::PrintErr("  free list class %" Pd ": %" Pd " elements, %" Pd "kB\n",
+                   i, free_counts_[i], free_sizes_[i] / KB);
+    }
+  }
 }
 
 void FreeList::EnqueueRange(uword addr, intptr_t size) {
@@ -14,8 +14,15 @@
 
 namespace psoup {
 
+class AllocationProfile;
 class Interpreter;
+class MarkerWorker;
+class PerfCounters;
+class QueryResults;
 class Region;
+class ScavengerWorker;
+class SelectorSet;
+class ThreadPool;
 
 // Note these values are never valid Object.
 #if defined(ARCH_IS_32_BIT)
@@ -32,14 +39,30 @@ static intptr_t AllocationSize(intptr_t size) {
   return Utils::RoundUp(size, kObjectAlignment);
 }
 
+// With HUGE_PAGES, mappings that are a whole number of huge pages ask for
+// them, so that scavenging a semispace or sweeping a region does not walk
+// through thousands of TLB entries. Bound to NUMA node |numa_node| unless it
+// is -1.
+static VirtualMemory AllocateHeapMemory(size_t size, intptr_t numa_node) {
+  VirtualMemory memory;
+  if (HUGE_PAGES && Utils::IsAligned(size, VirtualMemory::kHugePageSize)) {
+    memory = VirtualMemory::AllocateHuge(size, "primordialsoup-heap");
+  } else {
+    memory = VirtualMemory::Allocate(size, VirtualMemory::kReadWrite,
+                                     "primordialsoup-heap");
+  }
+  if (numa_node >= 0) {
+    memory.BindToNode(numa_node);
+  }
+  return memory;
+}
+
 class Semispace {
  private:
   friend class Heap;
 
-  void Allocate(size_t size) {
-    memory_ = VirtualMemory::Allocate(size,
-                                      VirtualMemory::kReadWrite,
-                                      "primordialsoup-heap");
+  void Allocate(size_t size, intptr_t numa_node) {
+    memory_ = AllocateHeapMemory(size, numa_node);
     ASSERT(Utils::IsAligned(memory_.base(), kObjectAlignment));
     ASSERT(memory_.size() == size);
 #if defined(DEBUG)
@@ -68,18 +91,38 @@ class Semispace {
   VirtualMemory memory_;
 };
 
+// Segregated fits: exact size classes for small sizes, then four classes per
+// power of two. A bitmap of the non-empty classes finds the smallest class
+// whose elements are all large enough without visiting the empty ones.
 class FreeList {
  private:
   friend class Heap;
+  friend class ScavengerWorker;
+
+  static constexpr intptr_t kNumExactClasses = 32;
+  static constexpr intptr_t kSubclassesLog2 = 2;
+  static constexpr intptr_t kNumClasses = 64;
+  static constexpr intptr_t kFirstGeometricLog2 = 5;  // log2(kNumExactClasses)
 
   FreeList() { Reset(); }
 
   uword TryAllocate(intptr_t size);
-
-  intptr_t IndexForSize(intptr_t size) {
-    intptr_t index = size >> kObjectAlignmentLog2;
-    if (index > kSizeClasses) {
-      return kSizeClasses;
+  // Takes a whole element of at least |min_size| from the largest class,
+  // setting |size| to its size, or answers 0.
+  uword TryAllocateChunk(intptr_t min_size, intptr_t* size);
+
+  static intptr_t IndexForSize(intptr_t size) {
+    intptr_t units = size >> kObjectAlignmentLog2;
+    if (units < kNumExactClasses) {
+      return units;
+    }
+    intptr_t log2 = Utils::HighestBit(units);
+    intptr_t subclass =
+        (units >> (log2 - kSubclassesLog2)) & ((1 << kSubclassesLog2) - 1);
+    intptr_t index = kNumExactClasses +
+        ((log2 - kFirstGeometricLog2) << kSubclassesLog2) + subclass;
+    if (index >= kNumClasses) {
+      return kNumClasses - 1;
     }
     return index;
   }
@@ -89,13 +132,249 @@ class FreeList {
   void Enqueue(FreeListElement element);
   void EnqueueRange(uword address, intptr_t size);
   void Reset() {
-    for (intptr_t i = 0; i <= kSizeClasses; i++) {
+    for (intptr_t i = 0; i < kNumClasses; i++) {
       free_lists_[i] = nullptr;
+      free_counts_[i] = 0;
+      free_sizes_[i] = 0;
+    }
+    non_empty_ = 0;
+  }
+  void PrintStatistics() const;
+
+  FreeListElement free_lists_[kNumClasses];
+  uint64_t non_empty_;  // Bit i is set when free_lists_[i] is not empty.
+
+  // Statistics.
+  intptr_t free_counts_[kNumClasses];
+  intptr_t free_sizes_[kNumClasses];
+};
+
+// Unlike MarkStack, which borrows from-space for the duration of a mark-sweep,
+// this lives outside new-space so it survives the scavenges that happen while
+// incremental marking is in progress.
+class MarkingStack {
+ private:
+  friend class Heap;
+  friend class MarkerWorker;
+  friend class ScavengerWorker;
+
+  MarkingStack() : objects_(nullptr), size_(0), capacity_(0) { }
+  ~MarkingStack() { delete[] objects_; }
+
+  bool IsEmpty() const { return size_ == 0; }
+  intptr_t size() const { return size_; }
+  HeapObject At(intptr_t index) const {
+    ASSERT(index >= 0 && index < size_);
+    return objects_[index];
+  }
+
+  void Push(HeapObject obj) {
+    if (size_ == capacity_) {
+      Grow();
+    }
+    objects_[size_++] = obj;
+  }
+  HeapObject Pop() {
+    ASSERT(size_ > 0);
+    return objects_[--size_];
+  }
+  void Reset() { size_ = 0; }
+
+  void Grow();
+
+  HeapObject* objects_;
+  intptr_t size_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(MarkingStack);
+};
+
+// The remembered set: the old objects that may refer to new-space. Each is
+// added once, as its remembered bit records, so the buffer never holds
+// duplicates. Large arrays are added whole like any other object, and their
+// card tables then narrow the slots a scavenge visits to the dirty cards.
+//
+// Entries go into fixed-size blocks rather than one growing array, so a burst
+// of old-to-new stores takes more blocks instead of copying all the entries so
+// far. Blocks emptied by a collection go to a pool to be reused, which is
+// trimmed after each mark-sweep.
+class StoreBuffer {
+ public:
+  // So that a block is 256 words.
+  static constexpr intptr_t kBlockSize = 254;
+
+  struct Block {
+    Block* next;
+    intptr_t size;
+    HeapObject objects[kBlockSize];
+  };
+
+  StoreBuffer();
+  ~StoreBuffer();
+
+  intptr_t size() const { return size_; }
+  intptr_t blocks() const { return blocks_; }
+  intptr_t pooled() const { return pooled_; }
+
+  void Add(HeapObject obj) {
+    if ((head_ == nullptr) || (head_->size == kBlockSize)) {
+      AddBlock();
     }
+    head_->objects[head_->size++] = obj;
+    size_++;
   }
 
-  static constexpr intptr_t kSizeClasses = 7;
-  FreeListElement free_lists_[kSizeClasses + 1];
+  // |visit| must not add entries.
+  template <typename Visitor>
+  void VisitObjects(Visitor visit) const {
+    for (Block* block = head_; block != nullptr; block = block->next) {
+      for (intptr_t i = 0; i < block->size; i++) {
+        visit(block->objects[i]);
+      }
+    }
+  }
+
+  // Drops the entries |keep| answers false for.
+  template <typename Predicate>
+  void Filter(Predicate keep) {
+    Block* block = TakeBlocks();
+    while (block != nullptr) {
+      Block* next = block->next;
+      for (intptr_t i = 0; i < block->size; i++) {
+        if (keep(block->objects[i])) {
+          Add(block->objects[i]);
+        }
+      }
+      Release(block);
+      block = next;
+    }
+  }
+
+  // Moves |other|'s entries into this buffer without copying them.
+  void Append(StoreBuffer* other);
+
+  // Empties the buffer, handing its blocks to the caller, who gives each back
+  // with Release once done with its entries. Entries may be added meanwhile.
+  Block* TakeBlocks();
+  void Release(Block* block);
+
+  // Empties the buffer, putting its blocks in the pool.
+  void Clear();
+  // Frees the pooled blocks beyond those the buffer is likely to need again.
+  void Trim();
+
+ private:
+  static constexpr intptr_t kMinPooled = 4;
+
+  void AddBlock();
+
+  Block* head_;  // The block being filled first.
+  intptr_t size_;
+  intptr_t blocks_;
+  Block* pool_;
+  intptr_t pooled_;
+
+  DISALLOW_COPY_AND_ASSIGN(StoreBuffer);
+};
+
+// Identity hashes of the objects for which one has been requested, keyed by
+// address. Open addressing with linear probing and backward-shift deletion.
+// Entries do not keep objects alive: the collector rebuilds the table with the
+// new addresses of survivors and drops the rest.
+class IdentityHashTable {
+ private:
+  friend class Heap;
+
+  struct Entry {
+    uword addr;  // 0 if empty.
+    intptr_t hash;
+  };
+
+  IdentityHashTable() : entries_(nullptr), size_(0), capacity_(0) { }
+  ~IdentityHashTable() { delete[] entries_; }
+
+  intptr_t size() const { return size_; }
+
+  // Returns 0 if the object has no hash.
+  intptr_t Lookup(uword addr) const;
+  void Insert(uword addr, intptr_t hash);
+  void Remove(uword addr);
+
+  // Empties the table, handing its old entries to the caller, who must
+  // delete[] them.
+  Entry* Release(intptr_t* capacity) {
+    Entry* entries = entries_;
+    *capacity = capacity_;
+    entries_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    return entries;
+  }
+
+  intptr_t IndexFor(uword addr) const;
+  void Grow();
+
+  Entry* entries_;
+  intptr_t size_;
+  intptr_t capacity_;  // 0 or a power of two.
+
+  DISALLOW_COPY_AND_ASSIGN(IdentityHashTable);
+};
+
+// A record of one collection. Every field is 64 bits wide so that the records
+// can be handed to Newspeak as raw bytes. Sizes are bytes held by objects.
+struct GCEvent {
+  enum Kind { kScavenge, kMarkSweep };
+  enum Flag { kParallel = 1 << 0, kRemark = 1 << 1, kEvacuate = 1 << 2 };
+
+  int64_t sequence;  // Counts the heap's collections from 0.
+  int64_t kind;
+  int64_t reason;  // A Heap::Reason.
+  int64_t flags;
+  int64_t start;  // Monotonic nanoseconds.
+  int64_t end;
+  int64_t size_before;
+  int64_t size_after;
+  int64_t tenured;
+  int64_t remembered_set_size;  // After the collection.
+  int64_t class_table_size;
+  int64_t tenuring_threshold;  // After the collection.
+};
+
+// How an isolate's heap grows. Zero fields take the defaults.
+struct HeapPolicy {
+  HeapPolicy() :
+      initial_semispace_capacity(0),
+      max_semispace_capacity(0),
+      old_growth_percent(0),
+      retained_free_size(0),
+      max_size(0),
+      max_stack_size(0),
+      idle_collection_delay(0),
+      numa_node(-1) { }
+
+  // Capacity of each new-space semispace at startup, and the most it may
+  // double to when many objects survive scavenges.
+  size_t initial_semispace_capacity;
+  size_t max_semispace_capacity;
+  // How far old-space may grow past its live size before the next mark-sweep,
+  // as a percentage of the live size.
+  intptr_t old_growth_percent;
+  // Bytes of empty old-space regions kept mapped for reuse after a
+  // collection. Beyond this, empty regions are unmapped.
+  size_t retained_free_size;
+  // Bytes of objects beyond which the allocation primitives fail, or 0 for no
+  // limit. The VM's own allocations are never refused and may go over.
+  size_t max_size;
+  // Bytes the interpreter's stack may double to on overflow before it moves
+  // frames to the heap instead. Read by the interpreter, not the heap.
+  size_t max_stack_size;
+  // Nanoseconds an isolate waits with nothing to do before its heap is
+  // collected and shrunk, or 0 for never. Read by the message loop.
+  int64_t idle_collection_delay;
+  // The NUMA node the heap's memory is bound to, or -1 to leave it wherever
+  // it is first touched. Set for spawned isolates; see Numa.
+  intptr_t numa_node;
 };
 
 // C. J. Cheney. "A nonrecursive list compacting algorithm." Communications of
@@ -108,20 +387,69 @@ class Heap {
   static constexpr intptr_t kLargeAllocation = 32 * KB;
   static constexpr size_t kInitialSemispaceCapacity = sizeof(uword) * MB / 8;
   static constexpr size_t kMaxSemispaceCapacity = 2 * sizeof(uword) * MB;
-  static constexpr size_t kRegionSize = 256 * KB;
+  // One huge page each when they are in use.
+  static constexpr size_t kRegionSize =
+      HUGE_PAGES ? VirtualMemory::kHugePageSize : 256 * KB;
+  static constexpr intptr_t kDefaultOldGrowthPercent = 50;
+  static constexpr size_t kDefaultRetainedFreeSize = 4 * kRegionSize;
+  // Free ranges found by the sweep have their pages returned to the OS from
+  // this size up; smaller ones are likely to be reused soon.
+  static constexpr intptr_t kMinDecommitSize =
+      HUGE_PAGES ? VirtualMemory::kHugePageSize : 64 * KB;
+  // Serial scavenges tenure by bumping through free chunks of at least this
+  // size, taken whole from the free list.
+  static constexpr intptr_t kTenureBufferSize = 16 * KB;
+  static constexpr intptr_t kMaxScavengerWorkers = 8;
+  // Below this much new-space allocation, waking helper threads costs more
+  // than it saves.
+  static constexpr size_t kParallelScavengeThreshold = 2 * MB;
+  // Likewise for a mark-sweep, by the size of the heap before it.
+  static constexpr size_t kParallelMarkThreshold = 8 * MB;
+  // Incremental marking traces at least this much per step, plus a multiple of
+  // the old-space growth since the previous step so that marking finishes
+  // before the allocation limit is reached.
+  static constexpr intptr_t kMinMarkingStep = 64 * KB;
+  static constexpr intptr_t kMarkingStepRatio = 4;
+  // Old-space is compacted once its regions hold this many times the live
+  // size, by evacuating the regions that are at most a quarter live.
+  static constexpr size_t kEvacuationRatio = 2;
+  static constexpr size_t kMinEvacuationCapacity = 8 * kRegionSize;
+  static constexpr intptr_t kEvacuationLiveLimit = kRegionSize / 4;
+  // Every this many scavenges, the objects allocated since the previous one
+  // are counted by class. A class allocating at least the minimum whose
+  // instances mostly survived has them allocated in old-space until the next
+  // mark-sweep, which measures it afresh.
+  static constexpr intptr_t kPretenureCensusInterval = 8;
+  static constexpr size_t kPretenureMinAllocation = 32 * KB;
+  static constexpr size_t kPretenureSurvivalPercent = 85;
+  // Survivors stay in new-space for up to this many scavenges, or fewer when
+  // those staying would fill more than the target share of a semispace, as
+  // in HotSpot's adaptive tenuring.
+  static constexpr intptr_t kMaxTenuringThreshold = (1 << kAgeFieldSize) - 1;
+  static constexpr size_t kTargetSurvivorPercent = 50;
 
  public:
-  enum Allocator { kNormal, kSnapshot };
+  // kPretenure skips new-space; it is only for objects whose initializing
+  // stores are all of immediates or old objects, as they are made without a
+  // barrier.
+  enum Allocator { kNormal, kSnapshot, kPretenure };
 
   enum GrowthPolicy { kControlGrowth, kForceGrowth };
 
+  // Lazy sweeping rewrites headers without synchronization, so only the
+  // mutator may do it; parallel scavenger workers allocate with kNoSweep.
+  enum SweepPolicy { kMaySweep, kNoSweep };
+
   enum Reason {
     kNewSpace,
     kTenure,
     kOldSpace,
     kClassTable,
     kPrimitive,
-    kSnapshotTest
+    kSnapshotTest,
+    kMarkingComplete,
+    kBecome,
+    kIdle
   };
 
   static const char* ReasonToCString(Reason reason) {
@@ -132,37 +460,99 @@ class Heap {
       case kClassTable: return "class-table";
       case kPrimitive: return "primitive";
       case kSnapshotTest: return "snapshot-test";
+      case kMarkingComplete: return "marking-complete";
+      case kBecome: return "become";
+      case kIdle: return "idle";
     }
     UNREACHABLE();
     return nullptr;
   }
 
-  Heap();
+  explicit Heap(const HeapPolicy& policy);
   ~Heap();
 
+  // The policy with its defaults filled in.
+  const HeapPolicy& policy() const { return policy_; }
+
+  // Called on the isolate's thread at the end of every collection, in every
+  // isolate. Set before any isolate runs.
+  typedef void (*GCEventCallback)(const GCEvent& event);
+  static void SetGCEventCallback(GCEventCallback callback) {
+    gc_event_callback_ = callback;
+  }
+
+  static constexpr intptr_t kGCEventCapacity = 256;
+
+  // Collections since the heap was made and the time paused for them, kept
+  // up as each ends so reading them costs nothing.
+  struct GCTotals {
+    int64_t scavenges;
+    int64_t scavenge_nanos;
+    int64_t mark_sweeps;
+    int64_t mark_sweep_nanos;
+  };
+  const GCTotals& gc_totals() const { return gc_totals_; }
+
+  // Copies the events numbered |since| or later that are still in the ring
+  // buffer into |events|, which has room for kGCEventCapacity, oldest first.
+  // Returns how many were copied.
+  intptr_t CopyGCEvents(int64_t since, GCEvent* events) const;
+
+  // Samples allocations into |profile| from now on, or stops sampling if it is
+  // null. Returns the previous profile, if any, which the caller deletes.
+  AllocationProfile* SetAllocationProfile(AllocationProfile* profile);
+
+  // Counts hardware events by phase from now on, or stops counting if
+  // |counters| is null. Returns the previous counters, if any, which the
+  // caller deletes.
+  PerfCounters* SetPerfCounters(PerfCounters* counters);
+  PerfCounters* perf_counters() const { return perf_counters_; }
+
   void AddToRememberedSet(HeapObject object) {
     ASSERT(object->IsOldObject());
     ASSERT(!object->is_remembered());
-    if (remembered_set_size_ == remembered_set_capacity_) {
-      GrowRememberedSet();
-    }
-    remembered_set_[remembered_set_size_++] = object;
+    remembered_set_.Add(object);
     object->set_is_remembered(true);
   }
 
+  // Incremental marking barrier: called for old objects stored into a marked
+  // old object. Outside of marking, only live objects in regions not yet swept
+  // are marked.
+  void ShadeObject(Object obj) {
+    if (!marking_) {
+      return;
+    }
+    if (!obj->IsOldObject()) {
+      return;  // New-space is traced during the remark pause.
+    }
+    HeapObject heap_obj = static_cast<HeapObject>(obj);
+    if (heap_obj->is_marked()) {
+      return;
+    }
+    heap_obj->set_is_marked(true);
+    marking_stack_.Push(heap_obj);
+  }
+
   RegularObject AllocateRegularObject(intptr_t cid, intptr_t num_slots,
                                       Allocator allocator = kNormal) {
     ASSERT(cid == kEphemeronCid || cid >= kFirstRegularObjectCid);
-    const intptr_t heap_size =
-        AllocationSize(num_slots * sizeof(Object) + sizeof(HeapObject::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    // An ephemeron's list link is not one of its class's slots.
+    ASSERT((cid != kEphemeronCid) ||
+           (sizeof(Ephemeron::Layout) ==
+            (num_slots + 1) * sizeof(Object) + sizeof(HeapObject::Layout)));
+    const intptr_t heap_size = cid == kEphemeronCid
+        ? AllocationSize(sizeof(Ephemeron::Layout))
+        : AllocationSize(num_slots * sizeof(Object) +
+                         sizeof(HeapObject::Layout));
+    uword addr = Allocate(heap_size, cid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, cid, heap_size);
     RegularObject result = static_cast<RegularObject>(obj);
+    UseCardsIfLarge(result, heap_size);
     ASSERT(result->IsRegularObject() || result->IsEphemeron());
     ASSERT(result->HeapSize() == heap_size);
 
     const intptr_t header_slots = sizeof(HeapObject::Layout) / sizeof(uword);
-    if (((header_slots + num_slots) & 1) == 1) {
+    if ((cid != kEphemeronCid) && (((header_slots + num_slots) & 1) == 1)) {
       // The leftover slot will be visited by the GC. Make it a valid oop.
       result->set_slot(num_slots, SmallInteger::New(0), kNoBarrier);
     }
@@ -174,7 +564,7 @@ class Heap {
                               Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_bytes * sizeof(uint8_t) + sizeof(ByteArray::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kByteArrayCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kByteArrayCid, heap_size);
     ByteArray result = static_cast<ByteArray>(obj);
     result->set_size(SmallInteger::New(num_bytes));
@@ -186,10 +576,11 @@ class Heap {
   String AllocateString(intptr_t num_bytes, Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_bytes * sizeof(uint8_t) + sizeof(String::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kStringCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kStringCid, heap_size);
     String result = static_cast<String>(obj);
     result->set_size(SmallInteger::New(num_bytes));
+    result->set_hash(0);
     ASSERT(result->IsString());
     ASSERT(result->HeapSize() == heap_size);
     return result;
@@ -198,9 +589,10 @@ class Heap {
   Array AllocateArray(intptr_t num_slots, Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_slots * sizeof(Object) + sizeof(Array::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kArrayCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kArrayCid, heap_size);
     Array result = static_cast<Array>(obj);
+    UseCardsIfLarge(result, heap_size);
     result->set_size(SmallInteger::New(num_slots));
     ASSERT(result->IsArray());
     ASSERT(result->HeapSize() == heap_size);
@@ -211,9 +603,10 @@ class Heap {
                               Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_slots * sizeof(Object) + sizeof(WeakArray::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kWeakArrayCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kWeakArrayCid, heap_size);
     WeakArray result = static_cast<WeakArray>(obj);
+    UseCardsIfLarge(result, heap_size);
     result->set_size(SmallInteger::New(num_slots));
     ASSERT(result->IsWeakArray());
     ASSERT(result->HeapSize() == heap_size);
@@ -223,7 +616,7 @@ class Heap {
   Closure AllocateClosure(intptr_t num_copied, Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_copied * sizeof(Object) + sizeof(Closure::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kClosureCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kClosureCid, heap_size);
     Closure result = static_cast<Closure>(obj);
     result->set_num_copied(SmallInteger::New(num_copied));
@@ -234,7 +627,7 @@ class Heap {
 
   Activation AllocateActivation(Allocator allocator = kNormal) {
     const intptr_t heap_size = AllocationSize(sizeof(Activation::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kActivationCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kActivationCid, heap_size);
     Activation result = static_cast<Activation>(obj);
     ASSERT(result->IsActivation());
@@ -244,7 +637,7 @@ class Heap {
 
   MediumInteger AllocateMediumInteger(Allocator allocator = kNormal) {
     const intptr_t heap_size = AllocationSize(sizeof(MediumInteger::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kMediumIntegerCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kMediumIntegerCid, heap_size);
     MediumInteger result = static_cast<MediumInteger>(obj);
     ASSERT(result->IsMediumInteger());
@@ -256,7 +649,7 @@ class Heap {
                                     Allocator allocator = kNormal) {
     const intptr_t heap_size = AllocationSize(capacity * sizeof(digit_t) +
                                               sizeof(LargeInteger::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kLargeIntegerCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kLargeIntegerCid, heap_size);
     LargeInteger result = static_cast<LargeInteger>(obj);
     result->set_capacity(capacity);
@@ -267,7 +660,7 @@ class Heap {
 
   Float AllocateFloat(Allocator allocator = kNormal) {
     const intptr_t heap_size = AllocationSize(sizeof(Float::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kFloatCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kFloatCid, heap_size);
     Float result = static_cast<Float>(obj);
     ASSERT(result->IsFloat());
@@ -275,29 +668,96 @@ class Heap {
     return result;
   }
 
+  // Makes the next |size| bytes of snapshot allocation come from one region,
+  // so the objects lie together and none of them takes the slow path.
+  void ReserveSnapshot(intptr_t size);
+
+  // Copies an object whole, header included, as it was recorded by a
+  // SnapshotImage. Its pointers are still to be fixed.
+  HeapObject AllocateSnapshotCopy(const uword* contents, intptr_t heap_size) {
+    uword addr = Allocate(heap_size, kIllegalCid, kSnapshot);
+    memcpy(reinterpret_cast<void*>(addr), contents, heap_size);
+    return HeapObject::FromAddr(addr);
+  }
+
   Message AllocateMessage();
 
   size_t Size() const {
     size_t new_size = top_ - to_.object_start();
     return new_size + old_size_;
   }
+  size_t old_size() const { return old_size_; }
+  size_t old_capacity() const { return old_capacity_; }
+  size_t semispace_capacity() const { return to_.size(); }
 
   void CollectAll(Reason reason) { MarkSweep(reason); }
+  // For an isolate with nothing to do: tenures every survivor so new-space
+  // can shrink back to its initial capacity, collects old-space, and unmaps
+  // the empty regions kept for reuse.
+  void CollectIdle();
+
+  // Whether |length| elements of |element_size| bytes fit under the policy's
+  // hard limit, collecting garbage first if they would not. SAFEPOINT
+  bool HasRoomFor(intptr_t length, intptr_t element_size) {
+    if ((policy_.max_size == 0) || FitsUnderLimit(length, element_size)) {
+      return true;
+    }
+    return HasRoomForAfterCollection(length, element_size);
+  }
 
+  // Each answers an Array found by one walk of the heap, in old-space.
   Array InstancesOf(Behavior cls);
   Array ReferencesTo(Object target);
+  // As InstancesOf or ReferencesTo for every element of |classes| or
+  // |targets|, answering an Array of their results from a single walk.
+  Array InstancesOfAll(Array classes);
+  Array ReferencesToAll(Array targets);
+
+  // Calls |visitor| with every object in new-space and old-space, after
+  // finishing any lazy sweep. |visitor| must not allocate.
+  typedef void (*ObjectVisitor)(HeapObject obj, void* data);
+  void VisitObjects(ObjectVisitor visitor, void* data);
 
   bool BecomeForward(Array old, Array neu);
 
+  // ByteArrays of at least kLargeAllocation bytes travel between isolates as
+  // large regions outside any heap, which the receiving heap adopts instead of
+  // copying. NewDetachedByteArray answers nullptr for smaller lengths, and
+  // leaves the bytes for the caller to fill.
+  static Region* NewDetachedByteArray(intptr_t length);
+  static ByteArray DetachedByteArray(Region* region);
+  static void FreeDetachedRegion(Region* region);
+  // Moves the pages of a large |bytes| out of this heap without copying them,
+  // leaving |bytes| empty. Answers nullptr if |bytes| is not a large object or
+  // the OS cannot move pages.
+  Region* DetachByteArray(ByteArray bytes);
+  ByteArray AdoptByteArray(Region* region);  // SAFEPOINT
+
+  // Returns 0 if no identity hash has been assigned to |obj|.
+  intptr_t IdentityHash(HeapObject obj) const {
+    return IdentityHashesFor(obj)->Lookup(obj->Addr());
+  }
+  void SetIdentityHash(HeapObject obj, intptr_t hash) {
+    IdentityHashesFor(obj)->Insert(obj->Addr(), hash);
+  }
+
   intptr_t AllocateClassId();
   void RegisterClass(intptr_t cid, Behavior cls) {
     ASSERT((class_table_[cid] == static_cast<Object>(kUninitializedWord)) ||
            (cid == kEphemeronCid));
     class_table_[cid] = cls;
+    if (cls->IsNewObject()) {
+      AddNewClassId(cid);
+    }
     cls->set_id(SmallInteger::New(cid));
     cls->AssertCouldBeBehavior();
     ASSERT(cls->cid() >= kFirstRegularObjectCid);
   }
+  // Whether instances of |cid| are currently allocated in old-space.
+  bool ShouldPretenure(intptr_t cid) const {
+    ASSERT(cid < class_table_size_);
+    return PRETENURING && pretenuring_[cid].pretenured;
+  }
   Behavior ClassAt(intptr_t cid) const {
     ASSERT(cid > kIllegalCid);
     ASSERT(cid < class_table_size_);
@@ -312,13 +772,14 @@ class Heap {
 
   Interpreter* interpreter() const { return interpreter_; }
 
+  // Allows scavenges, and the marking of mark-sweeps, to be split across up to
+  // |workers| threads, including the mutator, taking helpers from |pool|.
+  void ConfigureParallelScavenge(ThreadPool* pool, intptr_t workers);
+
   intptr_t handles() const { return handles_size_; }
   void set_handles(intptr_t value) { handles_size_ = value; }
 
  private:
-  void GrowRememberedSet();
-  void ShrinkRememberedSet();
-
   // Scavenging.
   void Scavenge(Reason reason);
   void FlipSpaces();
@@ -331,21 +792,58 @@ class Heap {
   bool ScavengePointer(Object* ptr);
   void ScavengeOldObject(HeapObject obj);
   bool ScavengeClass(intptr_t cid);
+  bool ShouldScavengeInParallel(size_t new_used) const;
+  void PretenureCensus(uword start, uword end);
+  void ResetPretenuring();
+  void CountSurvivor(HeapObject new_target, intptr_t age, intptr_t size);
+  void AdaptTenuringThreshold();
+  void ScavengeParallel();
+  uword TryAllocateCopyBuffer(intptr_t min_size,
+                              intptr_t preferred_size,
+                              intptr_t* size);
 
   // Mark-sweep.
   void MarkSweep(Reason reason);
   void MarkRoots();
+  void MarkWaitingStacks();
+  void MournWaitingStacks();
   void MarkObject(Object obj);
   void ProcessMarkStack();
+  bool ShouldMarkInParallel(size_t heap_size) const;
+  void MarkParallel();
   void Sweep();
+  void SweepNewSpace();
+  bool SweepNextRegion();
+  void FinishSweeping();
+  void SweepAndRelinkRegion(Region* region);
+  void SweepLargeRegions();
+  void ReleaseRegion(Region* region);
   bool SweepRegion(Region* region);
   void SetOldAllocationLimit();
+  void RecordGCEvent(GCEvent* event);
+  bool FitsUnderLimit(intptr_t length, intptr_t element_size) const;
+  bool HasRoomForAfterCollection(intptr_t length, intptr_t element_size);
+
+  // Compaction.
+  bool ShouldEvacuate() const;
+  void EvacuateSparseRegions();
+
+  // Incremental marking.
+  void StartIncrementalMarking();
+  void IncrementalMarkingStep(intptr_t budget);
+  bool IsIncrementalMarkingComplete() const {
+    return marking_ && marking_stack_.IsEmpty();
+  }
+  void FinishIncrementalMarking();
+  void FilterRememberedSet();
 
   // Ephemerons.
   void AddToEphemeronList(Ephemeron ephemeron_corpse);
   void ScavengeEphemeronList();
   void MarkEphemeronList();
   void MournEphemeronList();
+  void WaitForKey(Ephemeron ephemeron);
+  void WakeEphemerons(uword key_addr);
 
   // WeakArrays.
   void AddToWeakList(WeakArray survivor);
@@ -358,17 +856,33 @@ class Heap {
   void MournClassTableScavenge();
   void MournClassTableMarkSweep();
   void MournClassTableForwarded();
+  void AddNewClassId(intptr_t cid);
+
+  // Weak identity hash tables.
+  IdentityHashTable* IdentityHashesFor(HeapObject obj) {
+    return obj->IsNewObject() ? &new_identity_hashes_ : &old_identity_hashes_;
+  }
+  const IdentityHashTable* IdentityHashesFor(HeapObject obj) const {
+    return obj->IsNewObject() ? &new_identity_hashes_ : &old_identity_hashes_;
+  }
+  void MournIdentityHashesScavenge();
+  void MournIdentityHashesMarkSweep();
+  void MournIdentityHashesForwarded();
 
   // Become.
-  void ForwardClassIds();
+  bool FindChangedSelectors(Array old, Array neu, SelectorSet* changed);
+  bool ForwardClassIds();
   void ForwardRoots();
   void ForwardHeap();
+  void ForwardNewSpace();
+  void ForwardRememberedSet();
+  void ForwardRegions(Region* regions);
 
-  uword Allocate(intptr_t size, Allocator allocator) {
+  uword Allocate(intptr_t size, intptr_t cid, Allocator allocator) {
     ASSERT(Utils::IsAligned(size, kObjectAlignment));
-    if (size < kLargeAllocation) {
+    if ((size < kLargeAllocation) && (allocator != kPretenure)) {
       uword result = top_;
-      if (result + size <= end_) {
+      if (result + size <= limit_) {
         top_ = result + size;
 #if defined(DEBUG)
         memset(reinterpret_cast<void*>(result), kUninitializedByte, size);
@@ -376,19 +890,49 @@ class Heap {
         return result;
       }
     }
-    return allocator == kSnapshot
-        ? AllocateSnapshot(size)
-        : AllocateNormal(size);
+    if (allocator == kSnapshot) {
+      return AllocateSnapshot(size);
+    }
+    if (allocator == kPretenure) {
+      return AllocatePretenured(size, cid);
+    }
+    return AllocateNormal(size, cid);
   }
 
-  uword AllocateNormal(intptr_t size);
+  // Large objects are allocated right after a card table; see
+  // AllocateOldLarge. Only objects with many pointers use it.
+  static void UseCardsIfLarge(HeapObject obj, intptr_t heap_size) {
+    if (heap_size >= kLargeAllocation) {
+      obj->set_is_carded(true);
+    }
+  }
+
+  uword AllocateNormal(intptr_t size, intptr_t cid);
+  uword AllocatePretenured(intptr_t size, intptr_t cid);
+  void SampleAllocation(intptr_t size, intptr_t cid);
+  void ChargeAllocationCountdown();
+  void UpdateAllocationLimit();
   uword AllocateSnapshot(intptr_t size);
+  void StartSnapshotRegion(intptr_t region_size);
   uword AllocateCopy(intptr_t size);
   uword AllocateTenure(intptr_t size);
-  uword AllocateOldSmall(intptr_t size, GrowthPolicy growth);
+  uword RefillTenureBuffer(intptr_t size);
+  void RetireTenureBuffer();
+  uword AllocateOldSmall(intptr_t size,
+                         GrowthPolicy growth,
+                         SweepPolicy sweep = kMaySweep);
   uword AllocateOldLarge(intptr_t size, GrowthPolicy growth);
+  Array AllocateArrayWithoutCollecting(intptr_t num_slots);
 
-  Region* AllocateRegion(intptr_t region_size, GrowthPolicy growth);
+  // Heap walks answering several queries at once; see QueryResults.
+  void FindInstances(Object* classes, intptr_t num_classes, Array* results);
+  void FindReferences(Object* targets, intptr_t num_targets, Array* results);
+  void MakeResults(const QueryResults& found, const intptr_t* query_of,
+                   intptr_t num_queries, Array* results);
+
+  Region* AllocateRegion(intptr_t region_size,
+                         GrowthPolicy growth,
+                         intptr_t card_table_size = 0);
 
 #if defined(DEBUG)
   bool InFromSpace(HeapObject obj) {
@@ -399,9 +943,14 @@ class Heap {
   }
 #endif
 
+  HeapPolicy policy_;
+
   // New space.
   uword top_;
   uword end_;
+  // Where bump allocation falls into the slow path: end_, or earlier when an
+  // allocation sample falls due first.
+  uword limit_;
   uword survivor_end_;
   Semispace to_;
   Semispace from_;
@@ -409,21 +958,86 @@ class Heap {
 
   // Old space.
   Region* regions_;
+  Region* unswept_regions_;
+  // Large-object space: one mapping per object of kLargeAllocation or more,
+  // preceded by its card table.
+  Region* large_regions_;
+  Region* free_regions_;
+  size_t free_regions_size_;
   FreeList freelist_;
+  // Only used during serial scavenges.
+  uword tenure_top_;
+  uword tenure_end_;
   size_t old_size_;
   size_t old_capacity_;
   size_t old_limit_;
+  size_t old_marking_threshold_;
+  size_t old_marked_size_;
+
+  // Incremental marking.
+  bool marking_;
+  size_t marking_old_size_;
+  MarkingStack marking_stack_;
+  // Marked weak arrays and ephemerons, whose contents are only processed
+  // during the remark pause.
+  MarkingStack marking_deferred_;
+  // Takes the objects that do not fit in a mark-sweep's mark stack, which is
+  // bounded by the size of from-space.
+  MarkingStack mark_overflow_;
 
   // Remembered set.
-  HeapObject* remembered_set_;
-  intptr_t remembered_set_size_;
-  intptr_t remembered_set_capacity_;
+  StoreBuffer remembered_set_;
 
   // Class table.
   Object* class_table_;
   intptr_t class_table_size_;
   intptr_t class_table_capacity_;
-  intptr_t class_table_free_;
+  intptr_t class_table_free_;  // Chained through the free entries.
+  // The ids whose classes are in new-space, each once, so a scavenge mourns
+  // only their entries. Rebuilt by the walks of the whole table.
+  intptr_t* new_class_ids_;
+  intptr_t new_class_ids_size_;
+  intptr_t new_class_ids_capacity_;
+
+  // Pretenuring, indexed by class id like the class table. Bytes allocated and
+  // bytes surviving their first scavenge are only counted during a census.
+  struct Pretenuring {
+    size_t allocated;
+    size_t survived;
+    bool pretenured;
+  };
+  Pretenuring* pretenuring_;
+  intptr_t scavenges_until_census_;
+
+  // Adaptive tenuring. An object that has survived this many scavenges is
+  // tenured by the next. The bytes each scavenge keeps in new-space are
+  // counted by their age.
+  intptr_t tenuring_threshold_;
+  size_t survivor_sizes_[kMaxTenuringThreshold + 1];
+
+  // Identity hashes, split by age so a scavenge only rebuilds the new-space
+  // entries.
+  IdentityHashTable new_identity_hashes_;
+  IdentityHashTable old_identity_hashes_;
+
+  // The most recent collections, indexed by sequence modulo the capacity.
+  GCEvent gc_events_[kGCEventCapacity];
+  int64_t gc_event_count_;
+  GCTotals gc_totals_;
+  static GCEventCallback gc_event_callback_;
+
+  // Allocation sampling. The countdown is in bytes from allocation_top_.
+  AllocationProfile* allocation_profile_;
+  intptr_t allocation_countdown_;
+  uword allocation_top_;
+
+  PerfCounters* perf_counters_;
+
+  // Parallel scavenge and mark.
+  ThreadPool* scavenger_pool_;
+  intptr_t scavenger_workers_;
+  friend class MarkerWorker;
+  friend class ScavengerWorker;
 
   // Roots.
   Interpreter* interpreter_;
@@ -431,8 +1045,15 @@ class Heap {
   Object* handles_[kHandlesCapacity];
   intptr_t handles_size_;
   friend class HandleScope;
+  friend class HeapDump;
 
   Ephemeron ephemeron_list_;
+  // Ephemerons whose keys have not been reached yet in this collection, by
+  // key address. Each entry's hash is the address of the first ephemeron of a
+  // chain linked through their next fields, and each key has kWaitingKeyBit
+  // set, so an ephemeron is looked at once when found and once when its key
+  // is reached instead of on every pass over the ephemeron list.
+  IdentityHashTable waiting_ephemerons_;
   WeakArray weak_list_;
 
   DISALLOW_COPY_AND_ASSIGN(Heap);
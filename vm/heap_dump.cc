@@ -0,0 +1,135 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/heap_dump.h"
+
+#include <stdio.h>
+
+#include "vm/heap.h"
+#include "vm/interpreter.h"
+
+namespace psoup {
+
+namespace {
+
+class DumpWriter {
+ public:
+  explicit DumpWriter(FILE* file) : file_(file), failed_(false) {}
+
+  bool failed() const { return failed_; }
+
+  void WriteBytes(const uint8_t* bytes, intptr_t length) {
+    if (!failed_ && (length != 0)) {
+      failed_ = fwrite(bytes, 1, length, file_) != static_cast<size_t>(length);
+    }
+  }
+
+  void WriteUnsigned(uword value) {
+    uint8_t buffer[(sizeof(value) * 8 + 6) / 7];
+    intptr_t length = 0;
+    while (value >= 0x80) {
+      buffer[length++] = static_cast<uint8_t>(value | 0x80);
+      value >>= 7;
+    }
+    buffer[length++] = static_cast<uint8_t>(value);
+    WriteBytes(buffer, length);
+  }
+
+  void WriteRoots(Object* from, Object* to) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      if ((*ptr)->IsHeapObject()) {
+        WriteUnsigned(HeapDump::kRoot);
+        WriteUnsigned(static_cast<HeapObject>(*ptr)->Addr());
+      }
+    }
+  }
+
+  static void WriteObject(HeapObject obj, void* data) {
+    static_cast<DumpWriter*>(data)->WriteObject(obj);
+  }
+
+ private:
+  void WriteObject(HeapObject obj) {
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    uword count = 0;
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      if ((*ptr)->IsHeapObject()) {
+        count++;
+      }
+    }
+
+    WriteUnsigned(HeapDump::kObject);
+    WriteUnsigned(obj->Addr());
+    WriteUnsigned(obj->cid());
+    WriteUnsigned(obj->HeapSize());
+    WriteUnsigned(count);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      if ((*ptr)->IsHeapObject()) {
+        WriteUnsigned(static_cast<HeapObject>(*ptr)->Addr());
+      }
+    }
+
+    if (obj->IsString() && obj->is_canonical()) {
+      String symbol = static_cast<String>(obj);
+      WriteUnsigned(HeapDump::kSymbol);
+      WriteUnsigned(obj->Addr());
+      WriteUnsigned(symbol->Size());
+      WriteBytes(symbol->element_addr(0), symbol->Size());
+    }
+  }
+
+  FILE* file_;
+  bool failed_;
+};
+
+}  // namespace
+
+bool HeapDump::Write(Heap* heap, const char* filename) {
+  FILE* file = fopen(filename, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  DumpWriter writer(file);
+  static const uint8_t kMagic[] = {'P', 'S', 'H', 'D'};
+  writer.WriteBytes(kMagic, sizeof(kMagic));
+  writer.WriteUnsigned(kVersion);
+  writer.WriteUnsigned(sizeof(uword));
+
+  for (intptr_t cid = kFirstLegalCid; cid < heap->class_table_size_; cid++) {
+    Object cls = heap->class_table_[cid];
+    if (cls->IsHeapObject()) {  // Free entries are small integers.
+      writer.WriteUnsigned(kClass);
+      writer.WriteUnsigned(cid);
+      writer.WriteUnsigned(static_cast<HeapObject>(cls)->Addr());
+    }
+  }
+
+  Object* from;
+  Object* to;
+  heap->interpreter_->RootPointers(&from, &to);
+  writer.WriteRoots(from, to);
+  // Saved IPs are only valid object pointers while converted to BCIs.
+  heap->interpreter_->GCPrologue();
+  for (intptr_t i = 0; heap->interpreter_->StackPointers(i, &from, &to); i++) {
+    writer.WriteRoots(from, to);
+  }
+  heap->interpreter_->GCEpilogue();
+  for (intptr_t i = 0; i < heap->handles_size_; i++) {
+    writer.WriteRoots(heap->handles_[i], heap->handles_[i]);
+  }
+
+  heap->VisitObjects(DumpWriter::WriteObject, &writer);
+
+  writer.WriteUnsigned(kEnd);
+  bool failed = writer.failed();
+  if (fclose(file) != 0) {
+    failed = true;
+  }
+  return !failed;
+}
+
+}  // namespace psoup
@@ -0,0 +1,45 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_HEAP_DUMP_H_
+#define VM_HEAP_DUMP_H_
+
+#include "vm/allocation.h"
+#include "vm/globals.h"
+
+namespace psoup {
+
+class Heap;
+
+// Writes the whole object graph to a file in one pass over the heap, for
+// offline analysis. Nothing is allocated in the heap, so the graph written is
+// the one at the time of the call.
+//
+// The file is the bytes 'P' 'S' 'H' 'D', then a sequence of unsigned LEB128
+// numbers: the format version, the word size, and records that each start with
+// their tag:
+//
+//   kClass   cid address             One per class table entry.
+//   kRoot    address                 Interpreter roots, stack and handles.
+//   kObject  address cid heap-size reference-count address...
+//   kSymbol  address length byte...  Follows the kObject of each canonical
+//                                    string, so that the names of classes and
+//                                    methods can be recovered.
+//   kEnd
+//
+// Only references to heap objects are written; small integers are left out.
+// The references of a WeakArray and the key of an Ephemeron are weak.
+class HeapDump : public AllStatic {
+ public:
+  static constexpr intptr_t kVersion = 1;
+
+  enum Tag { kEnd = 0, kClass = 1, kRoot = 2, kObject = 3, kSymbol = 4 };
+
+  // Returns false if the file could not be written.
+  static bool Write(Heap* heap, const char* filename);
+};
+
+}  // namespace psoup
+
+#endif  // VM_HEAP_DUMP_H_
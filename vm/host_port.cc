@@ -0,0 +1,173 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/host_port.h"
+
+#include "vm/assert.h"
+#include "vm/isolate.h"
+#include "vm/lockers.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
+
+namespace psoup {
+
+Mutex* HostPort::mutex_ = nullptr;
+HostPort* HostPort::ports_ = nullptr;
+
+class HostPort::DeliverTask : public ThreadPool::Task {
+ public:
+  explicit DeliverTask(HostPort* port) : port_(port) {}
+
+  virtual void Run() { port_->Deliver(); }
+
+ private:
+  HostPort* port_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeliverTask);
+};
+
+void HostPort::Startup() {
+  mutex_ = new Mutex();
+}
+
+void HostPort::Shutdown() {
+  // The thread pool is gone, so nothing is delivering.
+  while (ports_ != nullptr) {
+    Close(ports_->port_);
+  }
+  delete mutex_;
+  mutex_ = nullptr;
+}
+
+HostPort::HostPort(Callback callback, void* data)
+    : MessageLoop(nullptr), callback_(callback), data_(data),
+      port_(ILLEGAL_PORT), next_(nullptr), head_(nullptr), tail_(nullptr),
+      delivering_(false), closed_(false) {}
+
+HostPort::~HostPort() {
+  while (head_ != nullptr) {
+    IsolateMessage* message = head_;
+    head_ = message->next();
+    delete message;
+  }
+}
+
+Port HostPort::Open(Callback callback, void* data) {
+  HostPort* host_port = new HostPort(callback, data);
+  // Not under mutex_; see Close.
+  host_port->port_ = PortMap::CreatePort(host_port);
+  MutexLocker locker(mutex_);
+  host_port->next_ = ports_;
+  ports_ = host_port;
+  return host_port->port_;
+}
+
+bool HostPort::Close(Port port) {
+  HostPort* host_port;
+  {
+    MutexLocker locker(mutex_);
+    HostPort** link = &ports_;
+    while ((*link != nullptr) && ((*link)->port_ != port)) {
+      link = &(*link)->next_;
+    }
+    host_port = *link;
+    if (host_port == nullptr) {
+      return false;
+    }
+    *link = host_port->next_;
+  }
+
+  // Not under mutex_, which posts take while holding the PortMap's locks.
+  // Once closed, the port has no post under way.
+  PortMap::ClosePort(port);
+
+  bool delivering;
+  {
+    MutexLocker locker(mutex_);
+    host_port->closed_ = true;
+    delivering = host_port->delivering_;
+  }
+  if (!delivering) {
+    delete host_port;
+  }
+  return true;
+}
+
+void HostPort::PostMessage(IsolateMessage* message) {
+  bool start;
+  {
+    MutexLocker locker(mutex_);
+    if (head_ == nullptr) {
+      head_ = message;
+    } else {
+      tail_->set_next(message);
+    }
+    tail_ = message;
+    start = !delivering_;
+    delivering_ = true;
+  }
+  if (start) {
+    Isolate::thread_pool()->Run(new DeliverTask(this));
+  }
+}
+
+void HostPort::Deliver() {
+  for (;;) {
+    IsolateMessage* message = nullptr;
+    bool closed;
+    {
+      MutexLocker locker(mutex_);
+      closed = closed_;
+      if (!closed && (head_ != nullptr)) {
+        message = head_;
+        head_ = message->next();
+        if (head_ == nullptr) {
+          tail_ = nullptr;
+        }
+        message->set_next(nullptr);
+      } else {
+        delivering_ = false;
+      }
+    }
+    if (message == nullptr) {
+      if (closed) {
+        delete this;
+      }
+      return;
+    }
+
+    PortMap::MessagesTaken(port_, 1);
+    callback_(data_, port_, message->bytes(), message->bytes_length(),
+              message->is_object() ? 1 : 0);
+    delete message;
+  }
+}
+
+intptr_t HostPort::AwaitSignal(intptr_t handle, intptr_t signals) {
+  UNREACHABLE();
+  return 0;
+}
+
+void HostPort::CancelSignalWait(intptr_t wait_id) {
+  UNREACHABLE();
+}
+
+void HostPort::MessageEpilogue(int64_t new_wakeup) {
+  UNREACHABLE();
+}
+
+void HostPort::Exit(intptr_t exit_code) {
+  UNREACHABLE();
+}
+
+intptr_t HostPort::Run() {
+  UNREACHABLE();
+  return 0;
+}
+
+void HostPort::Interrupt() {
+  UNREACHABLE();
+}
+
+}  // namespace psoup
@@ -0,0 +1,81 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_HOST_PORT_H_
+#define VM_HOST_PORT_H_
+
+#include "vm/globals.h"
+#include "vm/message_loop.h"
+#include "vm/port.h"
+
+namespace psoup {
+
+class Mutex;
+
+// A port whose messages go to a callback of the embedder's instead of to an
+// isolate, so that isolates can answer the program hosting them. It is named
+// by an ordinary port id, which the embedder passes to an isolate, such as in
+// its arguments.
+//
+// Senders only queue their messages: the callback is called on the thread
+// pool, one message at a time and in the order they were posted, so it never
+// runs under the PortMap's locks and may post in turn.
+class HostPort : public MessageLoop {
+ public:
+  // |bytes| are only valid during the call. They are serialized as a Port's
+  // handler receives them: by the Newspeak Serializer, or by the VM's
+  // MessageSerializer if |is_object| is nonzero. The same as
+  // PrimordialSoup_MessageCallback.
+  typedef void (*Callback)(void* data,
+                           Port port,
+                           const void* bytes,
+                           size_t length,
+                           int is_object);
+
+  static void Startup();
+  static void Shutdown();
+
+  static Port Open(Callback callback, void* data);
+  // Drops the messages not yet handed to the callback. A call under way may
+  // finish after this returns, but no other is made. Returns false if |port|
+  // is not an open host port.
+  static bool Close(Port port);
+
+  void PostMessage(IsolateMessage* message);
+  intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
+  void CancelSignalWait(intptr_t wait_id);
+  void MessageEpilogue(int64_t new_wakeup);
+  void Exit(intptr_t exit_code);
+  intptr_t Run();
+  void Interrupt();
+
+ private:
+  class DeliverTask;
+
+  HostPort(Callback callback, void* data);
+  ~HostPort();
+
+  // Hands queued messages to the callback until none are left, then deletes
+  // this if it was closed meanwhile.
+  void Deliver();
+
+  static Mutex* mutex_;
+  static HostPort* ports_;
+
+  const Callback callback_;
+  void* const data_;
+  Port port_;
+  HostPort* next_;
+  // Guarded by mutex_.
+  IsolateMessage* head_;
+  IsolateMessage* tail_;
+  bool delivering_;
+  bool closed_;
+
+  DISALLOW_COPY_AND_ASSIGN(HostPort);
+};
+
+}  // namespace psoup
+
+#endif  // VM_HOST_PORT_H_
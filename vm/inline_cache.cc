@@ -0,0 +1,63 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/inline_cache.h"
+
+#include "vm/heap.h"
+#include "vm/lookup_cache.h"
+
+namespace psoup {
+
+void InlineCache::Insert(const uint8_t* ip,
+                         String selector,
+                         intptr_t cid,
+                         Method target) {
+  Site* site = &sites_[Index(ip)];
+  if (site->ip != ip || site->selector != selector) {
+    // Empty, or another site that hashed here: take it over.
+    site->ip = ip;
+    site->selector = selector;
+    site->length = 0;
+  }
+
+  intptr_t length = site->length;
+  if (length == kMegamorphic) {
+    return;
+  }
+  if (length == kMaxEntries) {
+    site->length = kMegamorphic;
+    return;
+  }
+  site->cids[length] = cid;
+  site->targets[length] = target;
+  site->length = length + 1;
+}
+
+
+void InlineCache::Clear() {
+  for (intptr_t i = 0; i < kSize; i++) {
+    sites_[i].ip = nullptr;
+  }
+}
+
+
+void InlineCache::Invalidate(const SelectorSet& changed, Heap* heap) {
+  for (intptr_t i = 0; i < kSize; i++) {
+    Site* site = &sites_[i];
+    if (site->ip == nullptr) {
+      continue;
+    }
+    bool stale = changed.Contains(site->selector) ||
+                 site->selector->IsForwardingCorpse();
+    for (intptr_t j = 0; !stale && (j < site->length); j++) {
+      stale = site->targets[j]->IsForwardingCorpse() ||
+              heap->ClassAt(site->cids[j])->IsSmallInteger();
+    }
+    if (stale) {
+      site->ip = nullptr;
+    }
+  }
+}
+
+}  // namespace psoup
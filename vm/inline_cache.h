@@ -0,0 +1,83 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_INLINE_CACHE_H_
+#define VM_INLINE_CACHE_H_
+
+#include "vm/globals.h"
+#include "vm/object.h"
+
+namespace psoup {
+
+class Heap;
+class SelectorSet;
+
+// Polymorphic inline caches for ordinary sends. A send site is identified by
+// the IP just after its send bytecode, which is the only thing hashed, and its
+// selector, since methods that differ only in their literals may share a
+// bytecode array. The site's entry holds up to kMaxEntries (cid, target) pairs
+// that are compared in order. A site that sees more receiver classes than that
+// becomes megamorphic and is left to the LookupCache until the caches are
+// cleared.
+//
+// Bytecode and methods move during GC, so like the LookupCache the sites are
+// cleared after every GC. A become that changes only some selectors drops
+// only their sites.
+class InlineCache {
+ public:
+  InlineCache() {
+    Clear();
+  }
+
+  INLINE
+  bool Lookup(const uint8_t* ip,
+              String selector,
+              intptr_t cid,
+              Method* target) {
+    Site* site = &sites_[Index(ip)];
+    if (site->ip != ip || site->selector != selector) {
+      return false;
+    }
+    for (intptr_t i = 0; i < site->length; i++) {
+      if (site->cids[i] == cid) {
+        *target = site->targets[i];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Insert(const uint8_t* ip,
+              String selector,
+              intptr_t cid,
+              Method target);
+
+  void Clear();
+  void Invalidate(const SelectorSet& changed, Heap* heap);
+
+ private:
+  static constexpr intptr_t kMaxEntries = 4;
+  static constexpr intptr_t kMegamorphic = -1;
+
+  struct Site {
+    const uint8_t* ip;
+    String selector;
+    intptr_t length;  // Or kMegamorphic.
+    intptr_t cids[kMaxEntries];
+    Method targets[kMaxEntries];
+  };
+
+  static constexpr intptr_t kSize = 1024;
+  static constexpr intptr_t kMask = kSize - 1;
+
+  static intptr_t Index(const uint8_t* ip) {
+    return reinterpret_cast<uword>(ip) & kMask;
+  }
+
+  Site sites_[kSize];
+};
+
+}  // namespace psoup
+
+#endif  // VM_INLINE_CACHE_H_
@@ -4,11 +4,15 @@
 
 #include "vm/interpreter.h"
 
+#include "vm/atomic.h"
+#include "vm/cpu_profile.h"
+#include "vm/execution_counts.h"
 #include "vm/heap.h"
 #include "vm/isolate.h"
 #include "vm/math.h"
 #include "vm/os.h"
 #include "vm/primitives.h"
+#include "vm/snapshot.h"
 
 #define H heap_
 #define nil nil_
@@ -44,14 +48,29 @@ namespace psoup {
 // and after GC we swap back. This allows the GC to simply visit the whole
 // stack, and also accounts for bytecode arrays moving during GC.
 
+// Frames of unwind-protect and simulation root methods are marked in their
+// flags so a non-local return can look for them without loading each frame's
+// method.
+static bool IsUnwindMarker(intptr_t prim) {
+  return Primitives::IsUnwindProtect(prim) ||
+         Primitives::IsSimulationRoot(prim);
+}
+
 static intptr_t FlagsNumArgs(SmallInteger flags) {
-  return flags->value() >> 1;
+  return flags->value() >> 2;
 }
 static bool FlagsIsClosure(SmallInteger flags) {
   return (flags->value() & 1) != 0;
 }
-static SmallInteger MakeFlags(intptr_t num_args, bool is_closure) {
-  return SmallInteger::New((num_args << 1) | (is_closure ? 1 : 0));
+static bool FlagsIsUnwindMarker(SmallInteger flags) {
+  return (flags->value() & 2) != 0;
+}
+static SmallInteger MakeFlags(intptr_t num_args,
+                              bool is_closure,
+                              bool is_unwind_marker) {
+  return SmallInteger::New((num_args << 2) |
+                           (is_unwind_marker ? 2 : 0) |
+                           (is_closure ? 1 : 0));
 }
 
 static const uint8_t* FrameSavedIP(Object* fp) {
@@ -64,6 +83,9 @@ static const uint8_t** FrameSavedIPSlot(Object* fp) {
 static Object* FrameSavedFP(Object* fp) {
   return reinterpret_cast<Object*>(static_cast<uword>(fp[0]));
 }
+static void FrameSavedFPPut(Object* fp, Object* saved_fp) {
+  fp[0] = static_cast<SmallInteger>(reinterpret_cast<uword>(saved_fp));
+}
 
 static SmallInteger FrameFlags(Object* fp) {
   return static_cast<SmallInteger>(fp[-1]);
@@ -128,30 +150,58 @@ Interpreter::Interpreter(Heap* heap, Isolate* isolate) :
     fp_(nullptr),
     stack_base_(nullptr),
     stack_limit_(nullptr),
+    stack_slots_(kInitialStackSlots),
+    max_stack_slots_(kDefaultMaxStackSlots),
+    stacks_(nullptr),
+    stacks_capacity_(0),
+    current_stack_(kMainStack),
     nil_(nullptr),
     false_(nullptr),
     true_(nullptr),
     object_store_(nullptr),
     heap_(heap),
     isolate_(isolate),
-    environment_(nullptr) {
+    environment_(nullptr),
+    suspended_(false),
+    cpu_profile_(nullptr),
+    execution_counts_(nullptr) {
   heap->InitializeInterpreter(this);
 
-  stack_limit_ = reinterpret_cast<Object*>(malloc(kStackSize));
-  stack_base_ = stack_limit_ + kStackSlots;
+  size_t max_stack_size = heap->policy().max_stack_size;
+  if (max_stack_size != 0) {
+    max_stack_slots_ = max_stack_size / sizeof(Object);
+    if (max_stack_slots_ < kInitialStackSlots) {
+      max_stack_slots_ = kInitialStackSlots;
+    }
+  }
+
+  stack_limit_ = reinterpret_cast<Object*>(
+      malloc(stack_slots_ * sizeof(Object)));
+  stack_base_ = stack_limit_ + stack_slots_;
   sp_ = stack_base_;
-  checked_stack_limit_ =
-      stack_limit_ + (sizeof(Activation::Layout) / sizeof(Object));
+  checked_stack_limit_ = stack_limit_ + kStackHeadroom;
 
 #if defined(DEBUG)
-  for (intptr_t i = 0; i < kStackSlots; i++) {
+  for (intptr_t i = 0; i < stack_slots_; i++) {
     stack_limit_[i] = static_cast<Object>(kUninitializedWord);
   }
 #endif
+
+  stacks_capacity_ = 4;
+  stacks_ = new StackEntry[stacks_capacity_]();  // All free.
+  stacks_[kMainStack].state = kRunning;
 }
 
 Interpreter::~Interpreter() {
+  delete cpu_profile_;
+  delete execution_counts_;
   free(stack_limit_);
+  for (intptr_t i = 0; i < stacks_capacity_; i++) {
+    if ((i != current_stack_) && (stacks_[i].state != kFree)) {
+      free(stacks_[i].limit);
+    }
+  }
+  delete[] stacks_;
 }
 
 void Interpreter::PushIndirectLocal(intptr_t vector_offset, intptr_t offset) {
@@ -238,41 +288,44 @@ void Interpreter::Perform(Object message,
                           Object receiver,
                           String selector,
                           Array arguments) {
-  Behavior cls = receiver->Klass(H);
-  while (cls != nil) {
-    Method method = MethodAt(cls, selector);
-    if (method != nil) {
-      if (method->IsPublic()) {
-        intptr_t num_args = arguments->Size();
-        if (method->NumArgs() != num_args) goto DNU;
+  // The selector is not known at any send site, but the global cache still
+  // applies: a perform is looked up like an ordinary send.
+  Method target;
+  bool understood;
+#if LOOKUP_CACHE
+  Object absent_receiver;
+  if (lookup_cache_.LookupOrdinary(receiver->ClassId(), selector, &target)) {
+    understood = true;
+  } else if (lookup_cache_.LookupNS(receiver->ClassId(),
+                                    selector,
+                                    static_cast<Method>(nil),
+                                    kMNU,
+                                    &absent_receiver,
+                                    &target)) {
+    understood = false;
+  } else {
+    understood = OrdinaryLookup(receiver, selector, &target);
+  }
+#else
+  understood = OrdinaryLookup(receiver, selector, &target);
+#endif
 
-        Push(receiver);
-        for (intptr_t i = 0; i < num_args; i++) {
-          Push(arguments->element(i));
-        }
-        Activate(method, num_args);  // SAFEPOINT
-        return;
-      } else if (method->IsProtected()) {
-        goto DNU;
-      }
-    }
-    cls = cls->superclass();
+  intptr_t num_args = arguments->Size();
+  if (understood && (target->NumArgs() != num_args)) {
+    target = DNULookup(receiver->Klass(H));
+    understood = false;
   }
 
- DNU:
-  cls = receiver->Klass(H);
-  while (cls != nil) {
-    Method method = MethodAt(cls, object_store()->does_not_understand());
-    if (method != nil) {
-      Push(receiver);
-      Push(message);
-      Activate(method, 1);  // SAFEPOINT
-      return;
+  Push(receiver);
+  if (understood) {
+    for (intptr_t i = 0; i < num_args; i++) {
+      Push(arguments->element(i));
     }
-    cls = cls->superclass();
+    Activate(target, num_args);  // SAFEPOINT
+  } else {
+    Push(message);
+    Activate(target, 1);  // SAFEPOINT
   }
-
-  FATAL("Recursive #doesNotUnderstand:");
 }
 
 void Interpreter::CommonSend(intptr_t offset) {
@@ -316,10 +369,24 @@ void Interpreter::OrdinarySend(intptr_t selector_index,
 
 void Interpreter::OrdinarySend(String selector,
                                intptr_t num_args) {
-#if LOOKUP_CACHE
+#if INLINE_CACHE || LOOKUP_CACHE
   Object receiver = Stack(num_args);
+  intptr_t cid = receiver->ClassId();
   Method target;
-  if (lookup_cache_.LookupOrdinary(receiver->ClassId(), selector, &target)) {
+#endif
+
+#if INLINE_CACHE
+  if (inline_cache_.Lookup(ip_, selector, cid, &target)) {
+    Activate(target, num_args);  // SAFEPOINT
+    return;
+  }
+#endif
+
+#if LOOKUP_CACHE
+  if (lookup_cache_.LookupOrdinary(cid, selector, &target)) {
+#if INLINE_CACHE
+    inline_cache_.Insert(ip_, selector, cid, target);
+#endif
     Activate(target, num_args);  // SAFEPOINT
     return;
   }
@@ -330,7 +397,38 @@ void Interpreter::OrdinarySend(String selector,
 
 void Interpreter::OrdinarySendMiss(String selector,
                                    intptr_t num_args) {
+  CountSendMiss(selector);
   Object receiver = Stack(num_args);
+  Method target;
+  bool present_receiver = true;
+#if LOOKUP_CACHE
+  Object absent_receiver;
+  if (lookup_cache_.LookupNS(receiver->ClassId(),
+                             selector,
+                             static_cast<Method>(nil),
+                             kMNU,
+                             &absent_receiver,
+                             &target)) {
+    DNUSend(selector, num_args, receiver, target,
+            present_receiver);  // SAFEPOINT
+    return;
+  }
+#endif
+
+  if (OrdinaryLookup(receiver, selector, &target)) {
+#if INLINE_CACHE
+    inline_cache_.Insert(ip_, selector, receiver->ClassId(), target);
+#endif
+    Activate(target, num_args);  // SAFEPOINT
+    return;
+  }
+  DNUSend(selector, num_args, receiver, target,
+          present_receiver);  // SAFEPOINT
+}
+
+bool Interpreter::OrdinaryLookup(Object receiver,
+                                 String selector,
+                                 Method* target) {
   Behavior receiver_class = receiver->Klass(H);
   Behavior lookup_class = receiver_class;
   while (lookup_class != nil) {
@@ -340,20 +438,26 @@ void Interpreter::OrdinarySendMiss(String selector,
 #if LOOKUP_CACHE
         lookup_cache_.InsertOrdinary(receiver->ClassId(), selector, method);
 #endif
-        Activate(method, num_args);  // SAFEPOINT
-        return;
+        *target = method;
+        return true;
       } else if (method->IsProtected()) {
-        bool present_receiver = true;
-        DNUSend(selector, num_args, receiver,
-                receiver_class, present_receiver);  // SAFEPOINT
-        return;
+        break;
       }
     }
     lookup_class = lookup_class->superclass();
   }
-  bool present_receiver = true;
-  DNUSend(selector, num_args, receiver,
-          receiver_class, present_receiver);  // SAFEPOINT
+
+  // Cached too, so that repeated sends to a proxy skip both lookups.
+  *target = DNULookup(receiver_class);
+#if LOOKUP_CACHE
+  lookup_cache_.InsertNS(receiver->ClassId(),
+                         selector,
+                         static_cast<Method>(nil),
+                         kMNU,
+                         Object(),
+                         *target);
+#endif
+  return false;
 }
 
 Behavior Interpreter::FindApplicationOf(AbstractMixin mixin,
@@ -393,6 +497,7 @@ void Interpreter::SuperSend(intptr_t selector_index,
 
 void Interpreter::SuperSendMiss(String selector,
                                 intptr_t num_args) {
+  CountSendMiss(selector);
   Object receiver = FrameReceiver(fp_);
   AbstractMixin method_mixin = FrameMethod(fp_)->mixin();
   Behavior receiver_class = receiver->Klass(H);
@@ -432,6 +537,7 @@ void Interpreter::ImplicitReceiverSend(intptr_t selector_index,
 
 void Interpreter::ImplicitReceiverSendMiss(String selector,
                                            intptr_t num_args) {
+  CountSendMiss(selector);
   Object method_receiver = FrameReceiver(fp_);
 
   Object candidate_receiver = method_receiver;
@@ -487,6 +593,7 @@ void Interpreter::OuterSend(intptr_t selector_index,
 void Interpreter::OuterSendMiss(String selector,
                                 intptr_t num_args,
                                 intptr_t depth) {
+  CountSendMiss(selector);
   Object receiver = FrameReceiver(fp_);
   AbstractMixin target_mixin = FrameMethod(fp_)->mixin();
   intptr_t count = 0;
@@ -525,6 +632,7 @@ void Interpreter::SelfSend(intptr_t selector_index,
 
 void Interpreter::SelfSendMiss(String selector,
                                intptr_t num_args) {
+  CountSendMiss(selector);
   Object receiver = FrameReceiver(fp_);
   AbstractMixin method_mixin = FrameMethod(fp_)->mixin();
   LexicalSend(selector, num_args, receiver, method_mixin, kSelf);  // SAFEPOINT
@@ -579,14 +687,29 @@ void Interpreter::ProtectedSend(String selector,
     lookup_class = lookup_class->superclass();
   }
   bool present_receiver = false;
-  DNUSend(selector, num_args, receiver, mixin_application,
+  DNUSend(selector, num_args, receiver, DNULookup(mixin_application),
           present_receiver);  // SAFEPOINT
 }
 
+Method Interpreter::DNULookup(Behavior lookup_class) {
+  Behavior cls = lookup_class;
+  Method method;
+  do {
+    method = MethodAt(cls, object_store()->does_not_understand());
+    if (method != nil) {
+      return method;
+    }
+    cls = cls->superclass();
+  } while (cls != nil);
+
+  FATAL("Recursive #doesNotUnderstand:");
+  return method;
+}
+
 void Interpreter::DNUSend(String selector,
                           intptr_t num_args,
                           Object receiver,
-                          Behavior lookup_class,
+                          Method method,
                           bool present_receiver) {
   if (TRACE_DNU) {
     char* c1 = receiver->ToCString(H);
@@ -598,20 +721,6 @@ void Interpreter::DNUSend(String selector,
     free(c3);
   }
 
-  Behavior cls = lookup_class;
-  Method method;
-  do {
-    method = MethodAt(cls, object_store()->does_not_understand());
-    if (method != nil) {
-      break;
-    }
-    cls = cls->superclass();
-  } while (cls != nil);
-
-  if (method == nil) {
-    FATAL("Recursive #doesNotUnderstand:");
-  }
-
   Array arguments;
   {
     HandleScope h1(H, reinterpret_cast<Object*>(&selector));
@@ -793,6 +902,9 @@ void Interpreter::ActivateAbsent(Method method,
 
 void Interpreter::Activate(Method method, intptr_t num_args) {
   ASSERT(num_args == method->NumArgs());
+  if (execution_counts_ != nullptr) {
+    execution_counts_->CountActivation(method);
+  }
 
   intptr_t prim = method->Primitive();
   if (prim != 0) {
@@ -818,21 +930,64 @@ void Interpreter::Activate(Method method, intptr_t num_args) {
       static_cast<RegularObject>(receiver)->set_slot(offset, value);
       PopNAndPush(2, receiver);
       return;
-    } else {
-      HandleScope h1(H, reinterpret_cast<Object*>(&method));
-      if (Primitives::Invoke(prim, num_args, H, this)) {  // SAFEPOINT
-        ASSERT(StackDepth() >= 0);
+    }
+    // The hottest primitives, without the call through the primitive table.
+    // Neither allocates, so the method needs no handle.
+    switch (prim) {
+      case 135: {
+        // Object_identical
+        Object left = Stack(1);
+        Object right = Stack(0);
+        PopNAndPush(num_args + 1, left == right ? true_ : false_);
         return;
       }
+      case 156: case 157: case 158: case 159: {
+        // Closure_value0 .. Closure_value3
+        Closure closure = static_cast<Closure>(Stack(num_args));
+        ASSERT(closure->IsClosure());
+        if (closure->num_args() == SmallInteger::New(num_args)) {
+          ActivateClosure(num_args);  // SAFEPOINT
+          return;
+        }
+        break;
+      }
+      case 160: {
+        // Closure_valueArray, as the primitive does it.
+        Closure closure = static_cast<Closure>(Stack(1));
+        ASSERT(closure->IsClosure());
+        Array args = static_cast<Array>(Stack(0));
+        if (args->IsArray() && (args->size() == closure->num_args())) {
+          Pop();
+          intptr_t closure_args = args->Size();
+          for (intptr_t i = 0; i < closure_args; i++) {
+            Push(args->element(i));
+          }
+          ActivateClosure(closure_args);  // SAFEPOINT
+          return;
+        }
+        break;
+      }
+      default: {
+        HandleScope h1(H, reinterpret_cast<Object*>(&method));
+        if (Primitives::Invoke(prim, num_args, H, this)) {  // SAFEPOINT
+          ASSERT(StackDepth() >= 0);
+          return;
+        }
+      }
     }
   }
 
+  if (!method->HasBytecode()) {
+    HandleScope h1(H, reinterpret_cast<Object*>(&method));
+    LoadBytecode(method);  // SAFEPOINT
+  }
+
   // Create frame.
   Object receiver = Stack(num_args);
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(ip_)));
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(fp_)));
   fp_ = sp_;
-  Push(MakeFlags(num_args, false));
+  Push(MakeFlags(num_args, false, IsUnwindMarker(prim)));
   Push(method);
   Push(Object(static_cast<uword>(0)));  // Activation.
   Push(receiver);
@@ -854,12 +1009,16 @@ void Interpreter::ActivateClosure(intptr_t num_args) {
   ASSERT(closure->num_args() == SmallInteger::New(num_args));
 
   Activation home = closure->defining_activation();
+  // The home method has been activated, or its activation came from the
+  // snapshot and its bytecode was loaded with it.
+  ASSERT(home->method()->HasBytecode());
 
   // Create frame.
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(ip_)));
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(fp_)));
   fp_ = sp_;
-  Push(MakeFlags(num_args, true));
+  Push(MakeFlags(num_args, true,
+                IsUnwindMarker(home->method()->Primitive())));
   Push(home->method());
   Push(Object(static_cast<uword>(0)));  // Activation.
   Push(home->receiver());
@@ -878,9 +1037,20 @@ void Interpreter::ActivateClosure(intptr_t num_args) {
   }
 }
 
+void Interpreter::LoadBytecode(Method method) {
+  intptr_t length;
+  const uint8_t* bytes = Deserializer::LazyBytecode(
+      isolate_->snapshot(), method->BytecodePosition(), &length);
+  HandleScope h1(H, reinterpret_cast<Object*>(&method));
+  ByteArray bytecode = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(bytecode->element_addr(0), bytes, length);
+  method->set_bytecode(bytecode);
+}
+
 void Interpreter::CreateBaseFrame(Activation activation) {
   ASSERT(activation->IsActivation());
   ASSERT(activation->bci()->IsSmallInteger());
+  ASSERT(activation->method()->HasBytecode());
 
   ASSERT(ip_ == 0);
   ASSERT(sp_ == stack_base_);
@@ -909,7 +1079,8 @@ void Interpreter::CreateBaseFrame(Activation activation) {
   Push(activation->sender());           // Base sender.
   Push(Object(static_cast<uword>(0)));  // Saved FP.
   fp_ = sp_;
-  Push(MakeFlags(num_args, is_closure));
+  Push(MakeFlags(num_args, is_closure,
+                IsUnwindMarker(activation->method()->Primitive())));
   Push(activation->method());
   Push(activation);
   Push(activation->receiver());
@@ -918,8 +1089,12 @@ void Interpreter::CreateBaseFrame(Activation activation) {
   for (intptr_t i = num_args; i < num_temps; i++) {
     Push(activation->temp(i));
   }
-  // Drop temps. We don't update the activation as we store into the frame, so
-  // the stale references in the activation may create leaks.
+  // Drop temps, which live in the frame from now on. The arguments stay,
+  // though the activation is not updated as the frame stores into them. The
+  // array is kept for when the frame is next flushed.
+  if (num_temps > num_args) {
+    activation->temps()->FillElements(num_args, num_temps - num_args, nil);
+  }
   activation->set_stack_depth(SmallInteger::New(num_args));
 
   ip_ = activation->method()->IP(activation->bci());
@@ -933,17 +1108,179 @@ void Interpreter::CreateBaseFrame(Activation activation) {
 }
 
 void Interpreter::StackOverflow() {
+  Object* sample_requested = reinterpret_cast<Object*>(-2);
+  if (AtomicOperations::CompareAndSwap(
+          const_cast<Object**>(&checked_stack_limit_), &sample_requested,
+          stack_limit_ + kStackHeadroom)) {
+    RecordSample();
+    if (sp_ >= checked_stack_limit_) {
+      return;
+    }
+  }
+
+  Object* yield_requested = reinterpret_cast<Object*>(-3);
+  if (AtomicOperations::CompareAndSwap(
+          const_cast<Object**>(&checked_stack_limit_), &yield_requested,
+          stack_limit_ + kStackHeadroom)) {
+    if (sp_ >= checked_stack_limit_) {
+      // Every caller of a stack check returns straight to the dispatch loop,
+      // so the new frame is where Interpret picks up again. Outside Enter,
+      // while a message is being activated, the request is dropped.
+      if (environment_ != nullptr) {
+        suspended_ = true;
+        Exit();
+      }
+      return;
+    }
+  }
+
   if (checked_stack_limit_ == reinterpret_cast<Object*>(-1)) {
     // Interrupt.
     isolate_->PrintStack();
     Exit();
   }
 
-  // True overflow: reclaim stack space by moving all frames except the top
-  // frame to the heap.
+  // True overflow: first try a bigger stack, then reclaim stack space by
+  // moving all frames except the top frame to the heap.
+  if (GrowStack()) {
+    return;
+  }
   CreateBaseFrame(FlushAllFrames());  // SAFEPOINT
 }
 
+bool Interpreter::GrowStack() {
+  intptr_t new_slots = stack_slots_ * 2;
+  if (new_slots > max_stack_slots_) {
+    return false;
+  }
+  Object* new_limit = reinterpret_cast<Object*>(
+      malloc(new_slots * sizeof(Object)));
+  if (new_limit == nullptr) {
+    return false;
+  }
+  // A coroutine's Coroutine is kept at its base and moves with the frames.
+  intptr_t owner_slots = (current_stack_ == kMainStack) ? 0 : 1;
+  Object* new_base = new_limit + new_slots - owner_slots;
+
+  // Frames hold absolute saved FPs, and activations of living frames hold
+  // their FP, so the used part of the stack is copied and both are rebased.
+  // Saved IPs point into bytecode and stay as they are.
+  intptr_t used = stack_base_ - sp_;
+  memcpy(new_base - used, sp_, (used + owner_slots) * sizeof(Object));
+#if defined(DEBUG)
+  for (intptr_t i = 0; i < new_slots - used - owner_slots; i++) {
+    new_limit[i] = static_cast<Object>(kUninitializedWord);
+  }
+#endif
+  intptr_t delta = new_base - stack_base_;
+  sp_ += delta;
+  fp_ += delta;
+  for (Object* fp = fp_; fp != 0; fp = FrameSavedFP(fp)) {
+    Activation activation = FrameActivation(fp);
+    if (activation != nullptr) {
+      activation->set_sender_fp(fp);
+    }
+    Object* saved_fp = FrameSavedFP(fp);
+    if (saved_fp != 0) {
+      FrameSavedFPPut(fp, saved_fp + delta);
+    }
+  }
+
+  Object* old_checked_limit = stack_limit_ + kStackHeadroom;
+  free(stack_limit_);
+  stack_limit_ = new_limit;
+  stack_base_ = new_base;
+  stack_slots_ = new_slots;
+
+  // An interrupt may have been requested meanwhile; don't lose it.
+  Object* new_checked_limit = stack_limit_ + kStackHeadroom;
+  AtomicOperations::CompareAndSwap(
+      const_cast<Object**>(&checked_stack_limit_),
+      &old_checked_limit, new_checked_limit);
+  return true;
+}
+
+CpuProfile* Interpreter::SetCpuProfile(CpuProfile* profile) {
+  CpuProfile* previous = cpu_profile_;
+  cpu_profile_ = profile;
+  return previous;
+}
+
+ExecutionCounts* Interpreter::SetExecutionCounts(ExecutionCounts* counts) {
+  ExecutionCounts* previous = execution_counts_;
+  execution_counts_ = counts;
+  return previous;
+}
+
+void Interpreter::CountSendMiss(String selector) {
+  if ((execution_counts_ != nullptr) && (fp_ != 0)) {
+    execution_counts_->CountSendMiss(FrameMethod(fp_), ip_, selector);
+  }
+}
+
+void Interpreter::RequestSample() {
+  // Only replaces the normal limit, so a pending interrupt is not lost. If the
+  // stack grows meanwhile, this sample is skipped.
+  Object* limit = checked_stack_limit_;
+  if ((limit == reinterpret_cast<Object*>(-1)) ||
+      (limit == reinterpret_cast<Object*>(-2)) ||
+      (limit == reinterpret_cast<Object*>(-3))) {
+    return;
+  }
+  AtomicOperations::CompareAndSwap(
+      const_cast<Object**>(&checked_stack_limit_), &limit,
+      reinterpret_cast<Object*>(-2));
+}
+
+void Interpreter::RequestYield() {
+  // As RequestSample; a lost request is made again at the next tick.
+  Object* limit = checked_stack_limit_;
+  if ((limit == reinterpret_cast<Object*>(-1)) ||
+      (limit == reinterpret_cast<Object*>(-2)) ||
+      (limit == reinterpret_cast<Object*>(-3))) {
+    return;
+  }
+  AtomicOperations::CompareAndSwap(
+      const_cast<Object**>(&checked_stack_limit_), &limit,
+      reinterpret_cast<Object*>(-3));
+}
+
+void Interpreter::Resume() {
+  ASSERT(suspended_);
+  suspended_ = false;
+  Enter();
+}
+
+void Interpreter::RecordSample() {
+  if (cpu_profile_ == nullptr) {
+    return;  // Requested just before the profile was stopped.
+  }
+  cpu_profile_->BeginSample();
+  Object* fp = fp_;
+  for (;;) {
+    if (!cpu_profile_->AddFrame(FrameMethod(fp),
+                                FlagsIsClosure(FrameFlags(fp)))) {
+      cpu_profile_->EndSample();
+      return;
+    }
+    Object* saved_fp = FrameSavedFP(fp);
+    if (saved_fp == 0) {
+      break;
+    }
+    fp = saved_fp;
+  }
+  Object sender = FrameBaseSender(fp);
+  while (sender != nil_) {
+    Activation activation = static_cast<Activation>(sender);
+    if (!cpu_profile_->AddFrame(activation->method(),
+                                activation->closure() != nil_)) {
+      break;
+    }
+    sender = activation->sender();
+  }
+  cpu_profile_->EndSample();
+}
+
 String Interpreter::SelectorAt(intptr_t index) {
   Array literals = FrameMethod(fp_)->literals();
   ASSERT((index >= 0) && (index < literals->Size()));
@@ -967,6 +1304,12 @@ void Interpreter::LocalReturn(Object result) {
 }
 
 void Interpreter::LocalBaseReturn(Object result) {
+  if ((current_stack_ != kMainStack) && (FrameBaseSender(fp_) == nil)) {
+    // Returning from a coroutine's body.
+    FinishCoroutine(result);
+    return;
+  }
+
   // Returning from the base frame.
   Activation top;
   {
@@ -1017,12 +1360,24 @@ void Interpreter::NonLocalReturn(Object result) {
       return;
     }
 
-    intptr_t prim = FrameMethod(fp)->Primitive();
-    if (Primitives::IsUnwindProtect(prim)) {
+    if (FlagsIsUnwindMarker(FrameFlags(fp))) {
       break;
     }
-    if (Primitives::IsSimulationRoot(prim)) {
-      break;
+
+    if (FrameSavedFP(fp) == 0) {
+      // Neither the home nor anything that would block the return is on the
+      // stack. If they are not in the heap below it either, the home has
+      // returned, which doesn't need the frames flushed to report.
+      Activation sender = FrameBaseSender(fp);
+      while (sender->IsActivation() && (sender != home) &&
+             !IsUnwindMarker(sender->method()->Primitive())) {
+        sender = sender->sender();
+      }
+      if (!sender->IsActivation()) {
+        ASSERT(sender == nil);
+        SendCannotReturn(result);  // SAFEPOINT
+        return;
+      }
     }
   }
 
@@ -1136,7 +1491,377 @@ void Interpreter::PrintStack() {
   CreateBaseFrame(top);
 }
 
-void Interpreter::Interpret() {
+intptr_t Interpreter::NewCoroutine(Object coroutine, Closure body) {
+  ASSERT(body->num_args() == SmallInteger::New(1));
+  intptr_t stack = kMainStack + 1;
+  while ((stack < stacks_capacity_) && (stacks_[stack].state != kFree)) {
+    stack++;
+  }
+  if (stack == stacks_capacity_) {
+    intptr_t new_capacity = stacks_capacity_ * 2;
+    StackEntry* new_stacks = new StackEntry[new_capacity]();  // All free.
+    for (intptr_t i = 0; i < stacks_capacity_; i++) {
+      new_stacks[i] = stacks_[i];
+    }
+    delete[] stacks_;
+    stacks_ = new_stacks;
+    stacks_capacity_ = new_capacity;
+  }
+
+  Object* limit = reinterpret_cast<Object*>(
+      malloc(kInitialStackSlots * sizeof(Object)));
+  if (limit == nullptr) {
+    return 0;
+  }
+#if defined(DEBUG)
+  for (intptr_t i = 0; i < kInitialStackSlots; i++) {
+    limit[i] = static_cast<Object>(kUninitializedWord);
+  }
+#endif
+
+  StackEntry* entry = &stacks_[stack];
+  entry->limit = limit;
+  entry->slots = kInitialStackSlots;
+  entry->base = limit + kInitialStackSlots - 1;
+  *entry->base = coroutine;
+  // The body is rooted by its stack until it is activated.
+  entry->sp = entry->base - 1;
+  *entry->sp = body;
+  entry->fp = 0;
+  entry->ip = 0;
+  entry->state = kNew;
+  entry->flushed = false;
+  entry->resumer = kNoStack;
+  return stack;
+}
+
+bool Interpreter::CanResumeCoroutine(intptr_t handle) const {
+  if ((handle <= kMainStack) || (handle >= stacks_capacity_)) {
+    return false;
+  }
+  StackState state = stacks_[handle].state;
+  return (state == kNew) || (state == kSuspended);
+}
+
+void Interpreter::ResumeCoroutine(intptr_t handle, Object value) {
+  ASSERT(CanResumeCoroutine(handle));
+  intptr_t resumer = current_stack_;
+  stacks_[resumer].state = kResuming;
+  SwitchStack(handle);
+  StackState state = stacks_[handle].state;
+  stacks_[handle].state = kRunning;
+  stacks_[handle].resumer = resumer;
+
+  Push(value);
+  if (state == kNew) {
+    // The body's frame is the base frame, with nil as its sender.
+    ip_ = reinterpret_cast<const uint8_t*>(static_cast<uword>(nil_));
+    ActivateClosure(1);
+  }
+}
+
+void Interpreter::YieldCoroutine(Object value) {
+  ASSERT(InCoroutine());
+  intptr_t resumer = stacks_[current_stack_].resumer;
+  stacks_[current_stack_].state = kSuspended;
+  SwitchStack(resumer);
+  stacks_[resumer].state = kRunning;
+  Push(value);
+}
+
+bool Interpreter::CloseCoroutine(intptr_t handle) {
+  if (!CanResumeCoroutine(handle)) {
+    return false;
+  }
+  FreeStack(handle);
+  return true;
+}
+
+void Interpreter::FinishCoroutine(Object result) {
+  intptr_t finished = current_stack_;
+  intptr_t resumer = stacks_[finished].resumer;
+  SwitchStack(resumer);
+  FreeStack(finished);
+  stacks_[resumer].state = kRunning;
+  Push(result);
+}
+
+void Interpreter::FreeStack(intptr_t stack) {
+  ASSERT(stack != current_stack_);
+  // Activations of its frames are found to have returned.
+  free(stacks_[stack].limit);
+  stacks_[stack].state = kFree;
+}
+
+void Interpreter::SwitchStack(intptr_t stack) {
+  ASSERT(stack != current_stack_);
+  StackEntry* from = &stacks_[current_stack_];
+  from->ip = ip_;
+  from->sp = sp_;
+  from->fp = fp_;
+  from->base = stack_base_;
+  from->limit = stack_limit_;
+  from->slots = stack_slots_;
+
+  Object* old_checked_limit = stack_limit_ + kStackHeadroom;
+  StackEntry* to = &stacks_[stack];
+  ip_ = to->ip;
+  sp_ = to->sp;
+  fp_ = to->fp;
+  stack_base_ = to->base;
+  stack_limit_ = to->limit;
+  stack_slots_ = to->slots;
+  current_stack_ = stack;
+
+  // An interrupt may have been requested meanwhile; don't lose it.
+  Object* new_checked_limit = stack_limit_ + kStackHeadroom;
+  AtomicOperations::CompareAndSwap(
+      const_cast<Object**>(&checked_stack_limit_),
+      &old_checked_limit, new_checked_limit);
+
+  if (to->flushed) {
+    to->flushed = false;
+    Activation top = static_cast<Activation>(*sp_++);
+    CreateBaseFrame(top);
+  }
+}
+
+void Interpreter::PushTemp(Object value) {
+#if SUPERINSTRUCTIONS
+  // Fuses "push temp; push -1..2; send + or -", as in counting loops and
+  // recursion on n - 1.
+  uint8_t next = *ip_;
+  if ((next >= 160) && (next <= 163) && value->IsSmallInteger()) {
+    intptr_t constant = next - 161;
+    uint8_t send = ip_[1];
+    if ((send == 176) || (send == 177)) {
+      intptr_t raw_value = static_cast<SmallInteger>(value)->value();
+      intptr_t raw_result =
+          (send == 176) ? raw_value + constant : raw_value - constant;
+      if (SmallInteger::IsSmiValue(raw_result)) {
+        Push(SmallInteger::New(raw_result));
+        ip_ += 2;
+        return;
+      }
+    }
+  }
+#endif
+  Push(value);
+}
+
+#if SUPERINSTRUCTIONS
+static double FloatArithmetic(uint8_t bytecode, double left, double right) {
+  switch (bytecode) {
+    case 176: return left + right;
+    case 177: return left - right;
+    case 178: return left * right;
+  }
+  UNREACHABLE();
+  return 0.0;
+}
+#endif
+
+void Interpreter::PopNAndPushFloat(intptr_t n, double value) {
+#if SUPERINSTRUCTIONS
+  // Only box the last result of a chain of float arithmetic, as in a * b + c
+  // or a + (b * c). The intermediate results would have been consumed by the
+  // next send, so nothing else can observe that they were never allocated.
+  for (;;) {
+    uint8_t next = *ip_;
+    if ((next >= 176) && (next <= 178)) {
+      // The other operand is beneath this operation's inputs.
+      Object left = Stack(n);
+      if (!left->IsFloat()) break;
+      value = FloatArithmetic(next, static_cast<Float>(left)->value(), value);
+      n++;
+      ip_++;
+      continue;
+    }
+    if ((next >= 112) && (next <= 127) &&
+        (ip_[1] >= 176) && (ip_[1] <= 178)) {
+      // The other operand is a temp pushed just before the send.
+      Object right = (next < 120) ? FrameParameter(fp_, next & 7)
+                                  : FrameLocal(fp_, next & 7);
+      if (!right->IsFloat()) break;
+      value = FloatArithmetic(ip_[1], value,
+                              static_cast<Float>(right)->value());
+      ip_ += 2;
+      continue;
+    }
+    break;
+  }
+#endif
+  Float result = H->AllocateFloat();  // SAFEPOINT
+  result->set_value(value);
+  PopNAndPush(n, result);
+}
+
+bool Interpreter::MediumIntegerArithmetic(uint8_t bytecode,
+                                          Object left,
+                                          Object right) {
+  // What Number_add, Number_subtract and Number_multiply do for these
+  // operands, without the send: results that overflow a SmallInteger but not
+  // 64 bits are common in hashing and checksums.
+  int64_t raw_left;
+  if (left->IsSmallInteger()) {
+    raw_left = static_cast<SmallInteger>(left)->value();
+  } else if (left->IsMediumInteger()) {
+    raw_left = static_cast<MediumInteger>(left)->value();
+  } else {
+    return false;
+  }
+  int64_t raw_right;
+  if (right->IsSmallInteger()) {
+    raw_right = static_cast<SmallInteger>(right)->value();
+  } else if (right->IsMediumInteger()) {
+    raw_right = static_cast<MediumInteger>(right)->value();
+  } else {
+    return false;
+  }
+
+  int64_t raw_result;
+  bool overflow;
+  switch (bytecode) {
+    case 176:
+      overflow = Math::AddHasOverflow64(raw_left, raw_right, &raw_result);
+      break;
+    case 177:
+      overflow = Math::SubtractHasOverflow64(raw_left, raw_right, &raw_result);
+      break;
+    case 178:
+      overflow = Math::MultiplyHasOverflow64(raw_left, raw_right, &raw_result);
+      break;
+    default:
+      UNREACHABLE();
+      return false;
+  }
+  if (overflow) {
+    return false;  // A LargeInteger, left to the primitive.
+  }
+
+  if (SmallInteger::IsSmiValue(raw_result)) {
+    PopNAndPush(2, SmallInteger::New(raw_result));
+  } else {
+    MediumInteger result = H->AllocateMediumInteger();  // SAFEPOINT
+    result->set_value(raw_result);
+    PopNAndPush(2, result);
+  }
+  return true;
+}
+
+void Interpreter::PushComparison(bool result) {
+#if SUPERINSTRUCTIONS
+  // Comparisons are mostly followed by a conditional jump. Take the jump here
+  // instead of pushing a boolean for it to pop.
+  uint8_t next = *ip_;
+  if ((next >= 32) && (next <= 63)) {
+    bool jump_if = next < 48;
+    Drop(2);
+    ip_++;
+    if (result == jump_if) {
+      ip_ += (next & 15);
+    }
+    return;
+  }
+  if ((next == 242) || (next == 243)) {
+    bool jump_if = next == 242;
+    Drop(2);
+    intptr_t delta = (ip_[2] << 8) | ip_[1];
+    ip_ += 3;
+    if (result == jump_if) {
+      ip_ += delta;
+    }
+    return;
+  }
+#endif
+  PopNAndPush(2, result ? true_ : false_);
+}
+
+// Labels as values are an extension of GCC and Clang; MSVC keeps the switch.
+#if THREADED_DISPATCH && (defined(__GNUC__) || defined(__clang__))
+#define USE_THREADED_DISPATCH 1
+#if defined(__clang__)
+#define DISPATCH_ATTRIBUTE
+#else
+// GCC's global CSE otherwise merges the computed gotos back into one.
+#define DISPATCH_ATTRIBUTE __attribute__((optimize("no-gcse")))
+#endif
+#define BYTECODE(n) case n: Bytecode##n:
+#define DISPATCH()                                                            \
+  do {                                                                        \
+    ASSERT(ip_ != 0);                                                         \
+    ASSERT(sp_ != 0);                                                         \
+    ASSERT(fp_ != 0);                                                         \
+    byte1 = *ip_++;                                                           \
+    goto *kDispatchTable[byte1];                                              \
+  } while (false)
+#else
+#define BYTECODE(n) case n:
+#define DISPATCH() break
+#define DISPATCH_ATTRIBUTE
+#endif
+
+DISPATCH_ATTRIBUTE void Interpreter::Interpret() {
+#if defined(USE_THREADED_DISPATCH)
+  // Every bytecode has a label, and each handler jumps straight to the next
+  // one's, so each has its own indirect branch to predict. The switch is only
+  // used to enter the loop.
+  static void* const kDispatchTable[256] = {
+    &&Bytecode0, &&Bytecode1, &&Bytecode2, &&Bytecode3, &&Bytecode4,
+    &&Bytecode5, &&Bytecode6, &&Bytecode7, &&Bytecode8, &&Bytecode9,
+    &&Bytecode10, &&Bytecode11, &&Bytecode12, &&Bytecode13, &&Bytecode14,
+    &&Bytecode15, &&Bytecode16, &&Bytecode17, &&Bytecode18, &&Bytecode19,
+    &&Bytecode20, &&Bytecode21, &&Bytecode22, &&Bytecode23, &&Bytecode24,
+    &&Bytecode25, &&Bytecode26, &&Bytecode27, &&Bytecode28, &&Bytecode29,
+    &&Bytecode30, &&Bytecode31, &&Bytecode32, &&Bytecode33, &&Bytecode34,
+    &&Bytecode35, &&Bytecode36, &&Bytecode37, &&Bytecode38, &&Bytecode39,
+    &&Bytecode40, &&Bytecode41, &&Bytecode42, &&Bytecode43, &&Bytecode44,
+    &&Bytecode45, &&Bytecode46, &&Bytecode47, &&Bytecode48, &&Bytecode49,
+    &&Bytecode50, &&Bytecode51, &&Bytecode52, &&Bytecode53, &&Bytecode54,
+    &&Bytecode55, &&Bytecode56, &&Bytecode57, &&Bytecode58, &&Bytecode59,
+    &&Bytecode60, &&Bytecode61, &&Bytecode62, &&Bytecode63, &&Bytecode64,
+    &&Bytecode65, &&Bytecode66, &&Bytecode67, &&Bytecode68, &&Bytecode69,
+    &&Bytecode70, &&Bytecode71, &&Bytecode72, &&Bytecode73, &&Bytecode74,
+    &&Bytecode75, &&Bytecode76, &&Bytecode77, &&Bytecode78, &&Bytecode79,
+    &&Bytecode80, &&Bytecode81, &&Bytecode82, &&Bytecode83, &&Bytecode84,
+    &&Bytecode85, &&Bytecode86, &&Bytecode87, &&Bytecode88, &&Bytecode89,
+    &&Bytecode90, &&Bytecode91, &&Bytecode92, &&Bytecode93, &&Bytecode94,
+    &&Bytecode95, &&Bytecode96, &&Bytecode97, &&Bytecode98, &&Bytecode99,
+    &&Bytecode100, &&Bytecode101, &&Bytecode102, &&Bytecode103, &&Bytecode104,
+    &&Bytecode105, &&Bytecode106, &&Bytecode107, &&Bytecode108, &&Bytecode109,
+    &&Bytecode110, &&Bytecode111, &&Bytecode112, &&Bytecode113, &&Bytecode114,
+    &&Bytecode115, &&Bytecode116, &&Bytecode117, &&Bytecode118, &&Bytecode119,
+    &&Bytecode120, &&Bytecode121, &&Bytecode122, &&Bytecode123, &&Bytecode124,
+    &&Bytecode125, &&Bytecode126, &&Bytecode127, &&Bytecode128, &&Bytecode129,
+    &&Bytecode130, &&Bytecode131, &&Bytecode132, &&Bytecode133, &&Bytecode134,
+    &&Bytecode135, &&Bytecode136, &&Bytecode137, &&Bytecode138, &&Bytecode139,
+    &&Bytecode140, &&Bytecode141, &&Bytecode142, &&Bytecode143, &&Bytecode144,
+    &&Bytecode145, &&Bytecode146, &&Bytecode147, &&Bytecode148, &&Bytecode149,
+    &&Bytecode150, &&Bytecode151, &&Bytecode152, &&Bytecode153, &&Bytecode154,
+    &&Bytecode155, &&Bytecode156, &&Bytecode157, &&Bytecode158, &&Bytecode159,
+    &&Bytecode160, &&Bytecode161, &&Bytecode162, &&Bytecode163, &&Bytecode164,
+    &&Bytecode165, &&Bytecode166, &&Bytecode167, &&Bytecode168, &&Bytecode169,
+    &&Bytecode170, &&Bytecode171, &&Bytecode172, &&Bytecode173, &&Bytecode174,
+    &&Bytecode175, &&Bytecode176, &&Bytecode177, &&Bytecode178, &&Bytecode179,
+    &&Bytecode180, &&Bytecode181, &&Bytecode182, &&Bytecode183, &&Bytecode184,
+    &&Bytecode185, &&Bytecode186, &&Bytecode187, &&Bytecode188, &&Bytecode189,
+    &&Bytecode190, &&Bytecode191, &&Bytecode192, &&Bytecode193, &&Bytecode194,
+    &&Bytecode195, &&Bytecode196, &&Bytecode197, &&Bytecode198, &&Bytecode199,
+    &&Bytecode200, &&Bytecode201, &&Bytecode202, &&Bytecode203, &&Bytecode204,
+    &&Bytecode205, &&Bytecode206, &&Bytecode207, &&Bytecode208, &&Bytecode209,
+    &&Bytecode210, &&Bytecode211, &&Bytecode212, &&Bytecode213, &&Bytecode214,
+    &&Bytecode215, &&Bytecode216, &&Bytecode217, &&Bytecode218, &&Bytecode219,
+    &&Bytecode220, &&Bytecode221, &&Bytecode222, &&Bytecode223, &&Bytecode224,
+    &&Bytecode225, &&Bytecode226, &&Bytecode227, &&Bytecode228, &&Bytecode229,
+    &&Bytecode230, &&Bytecode231, &&Bytecode232, &&Bytecode233, &&Bytecode234,
+    &&Bytecode235, &&Bytecode236, &&Bytecode237, &&Bytecode238, &&Bytecode239,
+    &&Bytecode240, &&Bytecode241, &&Bytecode242, &&Bytecode243, &&Bytecode244,
+    &&Bytecode245, &&Bytecode246, &&Bytecode247, &&Bytecode248, &&Bytecode249,
+    &&Bytecode250, &&Bytecode251, &&Bytecode252, &&Bytecode253, &&Bytecode254,
+    &&Bytecode255
+  };
+#endif
+
   for (;;) {
     ASSERT(ip_ != 0);
     ASSERT(sp_ != 0);
@@ -1144,95 +1869,103 @@ void Interpreter::Interpret() {
 
     uint8_t byte1 = *ip_++;
     switch (byte1) {
-    case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
-    case 8: case 9: case 10: case 11: case 12: case 13: case 14: case 15:
+    BYTECODE(0) BYTECODE(1) BYTECODE(2) BYTECODE(3)
+    BYTECODE(4) BYTECODE(5) BYTECODE(6) BYTECODE(7)
+    BYTECODE(8) BYTECODE(9) BYTECODE(10) BYTECODE(11)
+    BYTECODE(12) BYTECODE(13) BYTECODE(14) BYTECODE(15)
       ip_ -= (byte1 & 15);
-      break;
-    case 16: case 17: case 18: case 19: case 20: case 21: case 22: case 23:
-    case 24: case 25: case 26: case 27: case 28: case 29: case 30: case 31:
+      DISPATCH();
+    BYTECODE(16) BYTECODE(17) BYTECODE(18) BYTECODE(19)
+    BYTECODE(20) BYTECODE(21) BYTECODE(22) BYTECODE(23)
+    BYTECODE(24) BYTECODE(25) BYTECODE(26) BYTECODE(27)
+    BYTECODE(28) BYTECODE(29) BYTECODE(30) BYTECODE(31)
       ip_ += (byte1 & 15);
-      break;
-    case 32: case 33: case 34: case 35: case 36: case 37: case 38: case 39:
-    case 40: case 41: case 42: case 43: case 44: case 45: case 46: case 47: {
+      DISPATCH();
+    BYTECODE(32) BYTECODE(33) BYTECODE(34) BYTECODE(35)
+    BYTECODE(36) BYTECODE(37) BYTECODE(38) BYTECODE(39)
+    BYTECODE(40) BYTECODE(41) BYTECODE(42) BYTECODE(43)
+    BYTECODE(44) BYTECODE(45) BYTECODE(46) BYTECODE(47) {
       Object top = Pop();
       if (top == true_) {
         ip_ += (byte1 & 15);
       } else if (top != false_) {
         SendNonBooleanReceiver(top);
       }
-      break;
+      DISPATCH();
     }
-    case 48: case 49: case 50: case 51: case 52: case 53: case 54: case 55:
-    case 56: case 57: case 58: case 59: case 60: case 61: case 62: case 63: {
+    BYTECODE(48) BYTECODE(49) BYTECODE(50) BYTECODE(51)
+    BYTECODE(52) BYTECODE(53) BYTECODE(54) BYTECODE(55)
+    BYTECODE(56) BYTECODE(57) BYTECODE(58) BYTECODE(59)
+    BYTECODE(60) BYTECODE(61) BYTECODE(62) BYTECODE(63) {
       Object top = Pop();
       if (top == false_) {
         ip_ += (byte1 & 15);
       } else if (top != true_) {
         SendNonBooleanReceiver(top);
       }
-      break;
+      DISPATCH();
     }
-    case 64: case 65: case 66: case 67:
-    case 68: case 69: case 70: case 71:
-    case 72: case 73: case 74: case 75:
-    case 76: case 77: case 78: case 79:
+    BYTECODE(64) BYTECODE(65) BYTECODE(66) BYTECODE(67)
+    BYTECODE(68) BYTECODE(69) BYTECODE(70) BYTECODE(71)
+    BYTECODE(72) BYTECODE(73) BYTECODE(74) BYTECODE(75)
+    BYTECODE(76) BYTECODE(77) BYTECODE(78) BYTECODE(79)
       OrdinarySend(byte1 & 7, (byte1 >> 3) & 1);
-      break;
-    case 80: case 81: case 82: case 83:
-    case 84: case 85: case 86: case 87:
-    case 88: case 89: case 90: case 91:
-    case 92: case 93: case 94: case 95:
+      DISPATCH();
+    BYTECODE(80) BYTECODE(81) BYTECODE(82) BYTECODE(83)
+    BYTECODE(84) BYTECODE(85) BYTECODE(86) BYTECODE(87)
+    BYTECODE(88) BYTECODE(89) BYTECODE(90) BYTECODE(91)
+    BYTECODE(92) BYTECODE(93) BYTECODE(94) BYTECODE(95)
       SelfSend(byte1 & 7, (byte1 >> 3) & 1);
-      break;
-    case 96: case 97: case 98: case 99:
-    case 100: case 101: case 102: case 103:
-    case 104: case 105: case 106: case 107:
-    case 108: case 109: case 110: case 111:
+      DISPATCH();
+    BYTECODE(96) BYTECODE(97) BYTECODE(98) BYTECODE(99)
+    BYTECODE(100) BYTECODE(101) BYTECODE(102) BYTECODE(103)
+    BYTECODE(104) BYTECODE(105) BYTECODE(106) BYTECODE(107)
+    BYTECODE(108) BYTECODE(109) BYTECODE(110) BYTECODE(111)
       ImplicitReceiverSend(byte1 & 7, (byte1 >> 3) & 1);
-      break;
-    case 112: case 113: case 114: case 115:
-    case 116: case 117: case 118: case 119:
-      Push(FrameParameter(fp_, byte1 & 7));
-      break;
-    case 120: case 121: case 122: case 123:
-    case 124: case 125: case 126: case 127:
-      Push(FrameLocal(fp_, byte1 & 7));
-      break;
-    case 128: case 129: case 130: case 131:
-    case 132: case 133: case 134: case 135:
+      DISPATCH();
+    BYTECODE(112) BYTECODE(113) BYTECODE(114) BYTECODE(115)
+    BYTECODE(116) BYTECODE(117) BYTECODE(118) BYTECODE(119)
+      PushTemp(FrameParameter(fp_, byte1 & 7));
+      DISPATCH();
+    BYTECODE(120) BYTECODE(121) BYTECODE(122) BYTECODE(123)
+    BYTECODE(124) BYTECODE(125) BYTECODE(126) BYTECODE(127)
+      PushTemp(FrameLocal(fp_, byte1 & 7));
+      DISPATCH();
+    BYTECODE(128) BYTECODE(129) BYTECODE(130) BYTECODE(131)
+    BYTECODE(132) BYTECODE(133) BYTECODE(134) BYTECODE(135)
       FrameLocalPut(fp_, byte1 & 7, Pop());
-      break;
-    case 136: case 137: case 138: case 139:
-    case 140: case 141: case 142: case 143:
+      DISPATCH();
+    BYTECODE(136) BYTECODE(137) BYTECODE(138) BYTECODE(139)
+    BYTECODE(140) BYTECODE(141) BYTECODE(142) BYTECODE(143)
       FrameLocalPut(fp_, byte1 & 7, Stack(0));
-      break;
-    case 144: case 145: case 146: case 147:
-    case 148: case 149: case 150: case 151:
+      DISPATCH();
+    BYTECODE(144) BYTECODE(145) BYTECODE(146) BYTECODE(147)
+    BYTECODE(148) BYTECODE(149) BYTECODE(150) BYTECODE(151)
       PushLiteral(byte1 & 7);
-      break;
-    case 152: Push(nil_); break;
-    case 153: Push(false_); break;
-    case 154: Push(true_); break;
-    case 155: Push(FrameReceiver(fp_)); break;
-    case 156: Push(FrameMethod(fp_)->mixin()); break;
-    case 158: Pop(); break;
-    case 159: Push(Stack(0)); break;
-    case 160: Push(SmallInteger::New(-1)); break;
-    case 161: Push(SmallInteger::New(0)); break;
-    case 162: Push(SmallInteger::New(1)); break;
-    case 163: Push(SmallInteger::New(2)); break;
-    case 166: LocalReturn(nil_); break;
-    case 167: LocalReturn(false_); break;
-    case 168: LocalReturn(true_); break;
-    case 169: LocalReturn(FrameReceiver(fp_)); break;
-    case 170: LocalReturn(Pop()); break;
-    case 171: NonLocalReturn(nil_); break;
-    case 172: NonLocalReturn(false_); break;
-    case 173: NonLocalReturn(true_); break;
-    case 174: NonLocalReturn(FrameReceiver(fp_)); break;
-    case 175: NonLocalReturn(Pop()); break;
+      DISPATCH();
+    BYTECODE(152) Push(nil_); DISPATCH();
+    BYTECODE(153) Push(false_); DISPATCH();
+    BYTECODE(154) Push(true_); DISPATCH();
+    BYTECODE(155) Push(FrameReceiver(fp_)); DISPATCH();
+    BYTECODE(156) Push(FrameMethod(fp_)->mixin()); DISPATCH();
+    BYTECODE(158) Pop(); DISPATCH();
+    BYTECODE(159) Push(Stack(0)); DISPATCH();
+    BYTECODE(160) Push(SmallInteger::New(-1)); DISPATCH();
+    BYTECODE(161) Push(SmallInteger::New(0)); DISPATCH();
+    BYTECODE(162) Push(SmallInteger::New(1)); DISPATCH();
+    BYTECODE(163) Push(SmallInteger::New(2)); DISPATCH();
+    BYTECODE(166) LocalReturn(nil_); DISPATCH();
+    BYTECODE(167) LocalReturn(false_); DISPATCH();
+    BYTECODE(168) LocalReturn(true_); DISPATCH();
+    BYTECODE(169) LocalReturn(FrameReceiver(fp_)); DISPATCH();
+    BYTECODE(170) LocalReturn(Pop()); DISPATCH();
+    BYTECODE(171) NonLocalReturn(nil_); DISPATCH();
+    BYTECODE(172) NonLocalReturn(false_); DISPATCH();
+    BYTECODE(173) NonLocalReturn(true_); DISPATCH();
+    BYTECODE(174) NonLocalReturn(FrameReceiver(fp_)); DISPATCH();
+    BYTECODE(175) NonLocalReturn(Pop()); DISPATCH();
 #if STATIC_PREDICTION_BYTECODES
-    case 176: {
+    BYTECODE(176) {
       // +
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1242,12 +1975,19 @@ void Interpreter::Interpret() {
         intptr_t raw_result = raw_left + raw_right;
         if (SmallInteger::IsSmiValue(raw_result)) {
           PopNAndPush(2, SmallInteger::New(raw_result));
-          break;
+          DISPATCH();
         }
+      } else if (left->IsFloat() && right->IsFloat()) {
+        PopNAndPushFloat(2, static_cast<Float>(left)->value() +
+                            static_cast<Float>(right)->value());
+        DISPATCH();
+      }
+      if (MediumIntegerArithmetic(176, left, right)) {  // SAFEPOINT
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 177: {
+    BYTECODE(177) {
       // -
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1257,20 +1997,59 @@ void Interpreter::Interpret() {
         intptr_t raw_result = raw_left - raw_right;
         if (SmallInteger::IsSmiValue(raw_result)) {
           PopNAndPush(2, SmallInteger::New(raw_result));
-          break;
+          DISPATCH();
         }
+      } else if (left->IsFloat() && right->IsFloat()) {
+        PopNAndPushFloat(2, static_cast<Float>(left)->value() -
+                            static_cast<Float>(right)->value());
+        DISPATCH();
+      }
+      if (MediumIntegerArithmetic(177, left, right)) {  // SAFEPOINT
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 178: {
+    BYTECODE(178) {
       // *
+      Object left = Stack(1);
+      Object right = Stack(0);
+      if (left->IsSmallInteger() && right->IsSmallInteger()) {
+        intptr_t raw_left = static_cast<SmallInteger>(left)->value();
+        intptr_t raw_right = static_cast<SmallInteger>(right)->value();
+        intptr_t raw_result;
+        if (!Math::MultiplyHasOverflow(raw_left, raw_right, &raw_result) &&
+            SmallInteger::IsSmiValue(raw_result)) {
+          PopNAndPush(2, SmallInteger::New(raw_result));
+          DISPATCH();
+        }
+      } else if (left->IsFloat() && right->IsFloat()) {
+        PopNAndPushFloat(2, static_cast<Float>(left)->value() *
+                            static_cast<Float>(right)->value());
+        DISPATCH();
+      }
+      if (MediumIntegerArithmetic(178, left, right)) {  // SAFEPOINT
+        DISPATCH();
+      }
       goto CommonSendDispatch;
     }
-    case 179: {
+    BYTECODE(179) {
       // //
+      Object left = Stack(1);
+      Object right = Stack(0);
+      if (left->IsSmallInteger() && right->IsSmallInteger()) {
+        intptr_t raw_left = static_cast<SmallInteger>(left)->value();
+        intptr_t raw_right = static_cast<SmallInteger>(right)->value();
+        if (raw_right != 0) {
+          intptr_t raw_result = Math::FloorDiv(raw_left, raw_right);
+          if (SmallInteger::IsSmiValue(raw_result)) {
+            PopNAndPush(2, SmallInteger::New(raw_result));
+            DISPATCH();
+          }
+        }
+      }
       goto CommonSendDispatch;
     }
-    case 180: {
+    BYTECODE(180) {
       /* \\ */
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1281,120 +2060,155 @@ void Interpreter::Interpret() {
           intptr_t raw_result = Math::FloorMod(raw_left, raw_right);
           ASSERT(SmallInteger::IsSmiValue(raw_result));
           PopNAndPush(2, SmallInteger::New(raw_result));
-          break;
+          DISPATCH();
         }
       }
       goto CommonSendDispatch;
     }
-    case 181: {
+    BYTECODE(181) {
       // <<
+      Object left = Stack(1);
+      Object right = Stack(0);
+      if (left->IsSmallInteger() && right->IsSmallInteger()) {
+        intptr_t raw_left = static_cast<SmallInteger>(left)->value();
+        intptr_t raw_right = static_cast<SmallInteger>(right)->value();
+        if ((raw_right >= 0) &&
+            (Utils::BitLength(raw_left) + raw_right < SmallInteger::kBits)) {
+          PopNAndPush(2, SmallInteger::New(Math::ShiftLeft(raw_left,
+                                                           raw_right)));
+          DISPATCH();
+        }
+      }
       goto CommonSendDispatch;
     }
-    case 182: {
+    BYTECODE(182) {
       // >>
+      Object left = Stack(1);
+      Object right = Stack(0);
+      if (left->IsSmallInteger() && right->IsSmallInteger()) {
+        intptr_t raw_left = static_cast<SmallInteger>(left)->value();
+        intptr_t raw_right = static_cast<SmallInteger>(right)->value();
+        if (raw_right >= 0) {
+          if (raw_right > SmallInteger::kBits) {
+            raw_right = SmallInteger::kBits;
+          }
+          PopNAndPush(2, SmallInteger::New(raw_left >> raw_right));
+          DISPATCH();
+        }
+      }
       goto CommonSendDispatch;
     }
-    case 183: {
+    BYTECODE(183) {
       // &
       Object left = Stack(1);
       Object right = Stack(0);
       if (left->IsSmallInteger() && right->IsSmallInteger()) {
         PopNAndPush(2, static_cast<SmallInteger>(
             static_cast<intptr_t>(left) & static_cast<intptr_t>(right)));
-        break;
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 184: {
+    BYTECODE(184) {
       // |
       Object left = Stack(1);
       Object right = Stack(0);
       if (left->IsSmallInteger() && right->IsSmallInteger()) {
         PopNAndPush(2, static_cast<SmallInteger>(
             static_cast<intptr_t>(left) | static_cast<intptr_t>(right)));
-        break;
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 185: {
+    BYTECODE(185) {
       // <
       Object left = Stack(1);
       Object right = Stack(0);
       if (left->IsSmallInteger() && right->IsSmallInteger()) {
-        if (static_cast<intptr_t>(left) < static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
-        } else {
-          PopNAndPush(2, false_);
-        }
-        break;
+        PushComparison(static_cast<intptr_t>(left) <
+                       static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      if (left->IsFloat() && right->IsFloat()) {
+        PushComparison(static_cast<Float>(left)->value() <
+                       static_cast<Float>(right)->value());
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 186: {
+    BYTECODE(186) {
       // >
       Object left = Stack(1);
       Object right = Stack(0);
       if (left->IsSmallInteger() && right->IsSmallInteger()) {
-        if (static_cast<intptr_t>(left) > static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
-        } else {
-          PopNAndPush(2, false_);
-        }
-        break;
+        PushComparison(static_cast<intptr_t>(left) >
+                       static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      if (left->IsFloat() && right->IsFloat()) {
+        PushComparison(static_cast<Float>(left)->value() >
+                       static_cast<Float>(right)->value());
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 187: {
+    BYTECODE(187) {
       // <=
       Object left = Stack(1);
       Object right = Stack(0);
       if (left->IsSmallInteger() && right->IsSmallInteger()) {
-        if (static_cast<intptr_t>(left) <= static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
-        } else {
-          PopNAndPush(2, false_);
-        }
-        break;
+        PushComparison(static_cast<intptr_t>(left) <=
+                       static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      if (left->IsFloat() && right->IsFloat()) {
+        PushComparison(static_cast<Float>(left)->value() <=
+                       static_cast<Float>(right)->value());
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 188: {
+    BYTECODE(188) {
       // >=
       Object left = Stack(1);
       Object right = Stack(0);
       if (left->IsSmallInteger() && right->IsSmallInteger()) {
-        if (static_cast<intptr_t>(left) >= static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
-        } else {
-          PopNAndPush(2, false_);
-        }
-        break;
+        PushComparison(static_cast<intptr_t>(left) >=
+                       static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      if (left->IsFloat() && right->IsFloat()) {
+        PushComparison(static_cast<Float>(left)->value() >=
+                       static_cast<Float>(right)->value());
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 189: {
+    BYTECODE(189) {
       // =
       Object left = Stack(1);
       Object right = Stack(0);
       if (left->IsSmallInteger() && right->IsSmallInteger()) {
-        if (static_cast<intptr_t>(left) == static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
-        } else {
-          PopNAndPush(2, false_);
-        }
-        break;
+        PushComparison(static_cast<intptr_t>(left) ==
+                       static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      if (left->IsFloat() && right->IsFloat()) {
+        PushComparison(static_cast<Float>(left)->value() ==
+                       static_cast<Float>(right)->value());
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 190: {
+    BYTECODE(190) {
       // new
       goto CommonSendDispatch;
     }
-    case 191: {
+    BYTECODE(191) {
       // new:
       goto CommonSendDispatch;
     }
-    case 192: {
+    BYTECODE(192) {
       // at:
       Object array = Stack(1);
       SmallInteger index = static_cast<SmallInteger>(Stack(0));
@@ -1405,20 +2219,20 @@ void Interpreter::Interpret() {
               (raw_index < static_cast<Array>(array)->Size())) {
             Object value = static_cast<Array>(array)->element(raw_index);
             PopNAndPush(2, value);
-            break;
+            DISPATCH();
           }
         } else if (array->IsBytes()) {
           if ((raw_index >= 0) &&
               (raw_index < static_cast<Bytes>(array)->Size())) {
             uint8_t raw_value = static_cast<Bytes>(array)->element(raw_index);
             PopNAndPush(2, SmallInteger::New(raw_value));
-            break;
+            DISPATCH();
           }
         }
       }
       goto CommonSendDispatch;
     }
-    case 193: {
+    BYTECODE(193) {
       // at:put:
       Object array = Stack(2);
       SmallInteger index = static_cast<SmallInteger>(Stack(1));
@@ -1430,7 +2244,7 @@ void Interpreter::Interpret() {
             Object value = Stack(0);
             static_cast<Array>(array)->set_element(raw_index, value);
             PopNAndPush(3, value);
-            break;
+            DISPATCH();
           }
         } else if (array->IsByteArray()) {
           SmallInteger value = static_cast<SmallInteger>(Stack(0));
@@ -1440,104 +2254,116 @@ void Interpreter::Interpret() {
             static_cast<ByteArray>(array)->set_element(raw_index,
                                                         value->value());
             PopNAndPush(3, value);
-            break;
+            DISPATCH();
           }
         }
       }
       goto CommonSendDispatch;
     }
-    case 194: {
+    BYTECODE(194) {
       // size
       Object array = Stack(0);
       if (array->IsArray()) {
         PopNAndPush(1, static_cast<Array>(array)->size());
-        break;
+        DISPATCH();
       } else if (array->IsBytes()) {
         PopNAndPush(1, static_cast<Bytes>(array)->size());
-        break;
+        DISPATCH();
+      }
+      goto CommonSendDispatch;
+    }
+    BYTECODE(195) BYTECODE(196) BYTECODE(197) {
+      // value value: value:value:
+      intptr_t num_args = byte1 - 195;
+      Object closure = Stack(num_args);
+      if (closure->IsClosure() &&
+          (static_cast<Closure>(closure)->num_args() ==
+           SmallInteger::New(num_args))) {
+        ActivateClosure(num_args);  // SAFEPOINT
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 195:
-    case 196: case 197: case 198: case 199:
-    case 200: case 201: case 202: case 203:
-    case 204: case 205: case 206: case 207:
+    BYTECODE(198)
+    BYTECODE(199) BYTECODE(200) BYTECODE(201) BYTECODE(202)
+    BYTECODE(203) BYTECODE(204) BYTECODE(205) BYTECODE(206)
+    BYTECODE(207)
       CommonSendDispatch:
       CommonSend(byte1 - 176);
-      break;
+      DISPATCH();
 #else  // !STATIC_PREDICTION_BYTECODES
-    case 176: case 177: case 178: case 179:
-    case 180: case 181: case 182: case 183:
-    case 184: case 185: case 186: case 187:
-    case 188: case 189: case 190: case 191:
-    case 192: case 193: case 194: case 195:
-    case 196: case 197: case 198: case 199:
-    case 200: case 201: case 202: case 203:
-    case 204: case 205: case 206: case 207:
+    BYTECODE(176) BYTECODE(177) BYTECODE(178) BYTECODE(179)
+    BYTECODE(180) BYTECODE(181) BYTECODE(182) BYTECODE(183)
+    BYTECODE(184) BYTECODE(185) BYTECODE(186) BYTECODE(187)
+    BYTECODE(188) BYTECODE(189) BYTECODE(190) BYTECODE(191)
+    BYTECODE(192) BYTECODE(193) BYTECODE(194) BYTECODE(195)
+    BYTECODE(196) BYTECODE(197) BYTECODE(198) BYTECODE(199)
+    BYTECODE(200) BYTECODE(201) BYTECODE(202) BYTECODE(203)
+    BYTECODE(204) BYTECODE(205) BYTECODE(206) BYTECODE(207)
       CommonSend(byte1 - 176);
-      break;
+      DISPATCH();
 #endif  // STATIC_PREDICTION_BYTECODES
-    case 222: {
+    BYTECODE(222) {
       uint8_t byte2 = *ip_++;
       PushNewArray(byte2);
-      break;
+      DISPATCH();
     }
-    case 223: {
+    BYTECODE(223) {
       uint8_t byte2 = *ip_++;
       PushNewArrayWithElements(byte2);
-      break;
+      DISPATCH();
     }
-    case 228: {
+    BYTECODE(228) {
       uint8_t byte2 = *ip_++;
       Push(FrameParameter(fp_, byte2));
-      break;
+      DISPATCH();
     }
-    case 229: {
+    BYTECODE(229) {
       uint8_t byte2 = *ip_++;
       ASSERT(byte2 < StackDepth());
       Push(FrameLocal(fp_, byte2));
-      break;
+      DISPATCH();
     }
-    case 230: {
+    BYTECODE(230) {
       uint8_t byte2 = *ip_++;
       ASSERT(byte2 < StackDepth());
       FrameLocalPut(fp_, byte2, Pop());
-      break;
+      DISPATCH();
     }
-    case 231: {
+    BYTECODE(231) {
       uint8_t byte2 = *ip_++;
       ASSERT(byte2 < StackDepth());
       FrameLocalPut(fp_, byte2, Stack(0));
-      break;
+      DISPATCH();
     }
-    case 233: {
+    BYTECODE(233) {
       uint8_t byte2 = *ip_++;
       PushEnclosingObject(byte2);
-      break;
+      DISPATCH();
     }
-    case 239: {
+    BYTECODE(239) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
       EventualSend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 240: {
+    BYTECODE(240) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t delta = (byte3 << 8) | byte2;
       ip_ -= delta;
-      break;
+      DISPATCH();
     }
-    case 241: {
+    BYTECODE(241) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t delta = (byte3 << 8) | byte2;
       ip_ += delta;
-      break;
+      DISPATCH();
     }
-    case 242: {
+    BYTECODE(242) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t delta = (byte3 << 8) | byte2;
@@ -1547,9 +2373,9 @@ void Interpreter::Interpret() {
       } else if (top != false_) {
         SendNonBooleanReceiver(top);
       }
-      break;
+      DISPATCH();
     }
-    case 243: {
+    BYTECODE(243) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t delta = (byte3 << 8) | byte2;
@@ -1559,71 +2385,71 @@ void Interpreter::Interpret() {
       } else if (top != true_) {
         SendNonBooleanReceiver(top);
       }
-      break;
+      DISPATCH();
     }
-    case 245: {
+    BYTECODE(245) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       PushIndirectLocal(byte3, byte2);
-      break;
+      DISPATCH();
     }
-    case 246: {
+    BYTECODE(246) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       PopIntoIndirectLocal(byte3, byte2);
-      break;
+      DISPATCH();
     }
-    case 247: {
+    BYTECODE(247) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       StoreIntoIndirectLocal(byte3, byte2);
-      break;
+      DISPATCH();
     }
-    case 248: {
+    BYTECODE(248) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       PushLiteral((byte3 << 8) | byte2);
-      break;
+      DISPATCH();
     }
-    case 249: {
+    BYTECODE(249) {
       uint8_t byte2 = *ip_++;
       uintptr_t byte3 = static_cast<intptr_t>(static_cast<int8_t>(*ip_++));
       Push(SmallInteger::New((byte3 << 8) | byte2));
-      break;
+      DISPATCH();
     }
-    case 250: {
+    BYTECODE(250) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
       OrdinarySend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 251: {
+    BYTECODE(251) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
       SelfSend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 252: {
+    BYTECODE(252) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
       SuperSend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 253: {
+    BYTECODE(253) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
       ImplicitReceiverSend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 254: {
+    BYTECODE(254) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       uint8_t byte4 = *ip_++;
@@ -1631,9 +2457,9 @@ void Interpreter::Interpret() {
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
       intptr_t depth = byte4;
       OuterSend(selector_index, num_args, depth);
-      break;
+      DISPATCH();
     }
-    case 255: {
+    BYTECODE(255) {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       uint8_t byte4 = *ip_++;
@@ -1641,14 +2467,26 @@ void Interpreter::Interpret() {
       intptr_t num_args = byte2 & 7;
       intptr_t block_size = byte3 | (byte4 << 8);
       PushClosure(num_copied, num_args, block_size);
-      break;
-    }
+      DISPATCH();
+    }
+    BYTECODE(157) BYTECODE(164) BYTECODE(165) BYTECODE(208)
+    BYTECODE(209) BYTECODE(210) BYTECODE(211) BYTECODE(212)
+    BYTECODE(213) BYTECODE(214) BYTECODE(215) BYTECODE(216)
+    BYTECODE(217) BYTECODE(218) BYTECODE(219) BYTECODE(220)
+    BYTECODE(221) BYTECODE(224) BYTECODE(225) BYTECODE(226)
+    BYTECODE(227) BYTECODE(232) BYTECODE(234) BYTECODE(235)
+    BYTECODE(236) BYTECODE(237) BYTECODE(238) BYTECODE(244)
     default:
       FATAL("Unused bytecode");
     }
   }
 }
 
+#undef USE_THREADED_DISPATCH
+#undef BYTECODE
+#undef DISPATCH
+#undef DISPATCH_ATTRIBUTE
+
 Activation Interpreter::EnsureActivation(Object* fp) {
   Activation activation = FrameActivation(fp);
   if (activation == nullptr) {
@@ -1669,12 +2507,36 @@ Activation Interpreter::EnsureActivation(Object* fp) {
     // activations, but for now it is slightly simpler to treat all locals
     // uniformly.
     activation->set_stack_depth(SmallInteger::New(0));
+    activation->set_temps(static_cast<Array>(nil), kNoBarrier);
 
     FrameActivationPut(fp, activation);
   }
   return activation;
 }
 
+Activation Interpreter::EnsureTempCapacity(Activation activation,
+                                           intptr_t size) {
+  intptr_t capacity = activation->TempCapacity();
+  if (capacity >= size) {
+    return activation;
+  }
+
+  Array temps;
+  {
+    HandleScope h1(H, reinterpret_cast<Object*>(&activation));
+    temps = H->AllocateArray(size);  // SAFEPOINT
+  }
+  intptr_t depth = activation->StackDepth();
+  for (intptr_t i = 0; i < depth; i++) {
+    temps->set_element(i, activation->temp(i));
+  }
+  for (intptr_t i = depth; i < size; i++) {
+    temps->set_element(i, nil, kNoBarrier);
+  }
+  activation->set_temps(temps);
+  return activation;
+}
+
 
 Activation Interpreter::FlushAllFrames() {
   Activation top = EnsureActivation(fp_);  // SAFEPOINT
@@ -1682,6 +2544,9 @@ Activation Interpreter::FlushAllFrames() {
 
   while (fp_ != 0) {
     EnsureActivation(fp_);  // SAFEPOINT
+    intptr_t num_args = FlagsNumArgs(FrameFlags(fp_));
+    intptr_t num_temps = num_args + FrameNumLocals(fp_, sp_);
+    EnsureTempCapacity(FrameActivation(fp_), num_temps);  // SAFEPOINT
 
     Object* saved_fp = FrameSavedFP(fp_);
     Activation sender;
@@ -1697,8 +2562,6 @@ Activation Interpreter::FlushAllFrames() {
     activation->set_sender(sender);
     activation->set_bci(activation->method()->BCI(ip_));
 
-    intptr_t num_args = FlagsNumArgs(FrameFlags(fp_));
-    intptr_t num_temps = num_args + FrameNumLocals(fp_, sp_);
     for (intptr_t i = 0; i < num_temps; i++) {
       activation->set_temp(i, FrameTemp(fp_, i));
     }
@@ -1713,41 +2576,86 @@ Activation Interpreter::FlushAllFrames() {
   ASSERT(sp_ == stack_base_);
   ASSERT(fp_ == 0);
 #if defined(DEBUG)
-  for (intptr_t i = 0; i < kStackSlots; i++) {
-    stack_limit_[i] = static_cast<Object>(kUninitializedWord);
+  // Up to the base: past it a coroutine's stack keeps its Coroutine.
+  for (Object* slot = stack_limit_; slot < stack_base_; slot++) {
+    *slot = static_cast<Object>(kUninitializedWord);
   }
 #endif
 
   return top;
 }
 
-bool Interpreter::HasLivingFrame(Activation activation) {
+intptr_t Interpreter::LivingFrameStack(Activation activation) {
   if (!activation->sender()->IsSmallInteger()) {
-    return false;
+    return kNoStack;
   }
 
   Object* activation_fp = activation->sender_fp();
-  Object* fp = fp_;
-  while (fp != 0) {
-    if (fp == activation_fp) {
-      if (FrameActivation(fp) == activation) {
-        return true;
+  for (intptr_t stack = 0; stack < stacks_capacity_; stack++) {
+    if (stacks_[stack].state == kFree) {
+      continue;
+    }
+    Object* fp;
+    Object* sp;
+    const uint8_t* ip;
+    StackTop(stack, &fp, &sp, &ip);
+    while (fp != 0) {
+      if (fp == activation_fp) {
+        if (FrameActivation(fp) == activation) {
+          return stack;
+        }
+        break;
       }
-      break;
+      fp = FrameSavedFP(fp);
     }
-    fp = FrameSavedFP(fp);
   }
 
   // Frame is gone.
   activation->set_sender(static_cast<Activation>(nil), kNoBarrier);
   activation->set_bci(static_cast<SmallInteger>(nil));
-  return false;
+  return kNoStack;
+}
+
+void Interpreter::StackTop(intptr_t stack,
+                           Object** fp, Object** sp,
+                           const uint8_t** ip) const {
+  if (stack == current_stack_) {
+    *fp = fp_;
+    *sp = sp_;
+    *ip = ip_;
+  } else {
+    // New and flushed stacks have no frames.
+    *fp = stacks_[stack].fp;
+    *sp = stacks_[stack].sp;
+    *ip = stacks_[stack].ip;
+  }
+}
+
+Activation Interpreter::FlushAllFramesOf(intptr_t stack) {
+  if (stack == current_stack_) {
+    return FlushAllFrames();  // SAFEPOINT
+  }
+
+  intptr_t current = current_stack_;
+  SwitchStack(stack);
+  Activation top = FlushAllFrames();  // SAFEPOINT
+  Push(top);
+  stacks_[stack].flushed = true;
+  SwitchStack(current);
+  return top;
 }
 
 Activation Interpreter::CurrentActivation() {
   return EnsureActivation(fp_);  // SAFEPOINT
 }
 
+Object Interpreter::CurrentMethod() {
+  if (fp_ == 0) {
+    return nil_;
+  }
+  return FrameMethod(fp_);
+}
+
 void Interpreter::SetCurrentActivation(Activation new_activation) {
   ASSERT(new_activation->IsActivation());
 
@@ -1776,38 +2684,34 @@ void Interpreter::ActivationSenderPut(Activation activation,
                                       Activation new_sender) {
   ASSERT(!new_sender->IsSmallInteger());
   ASSERT((new_sender == nil) || new_sender->IsActivation());
-  if (HasLivingFrame(activation)) {
+  intptr_t stack = LivingFrameStack(activation);
+  if (stack != kNoStack) {
     Activation top;
     {
       HandleScope h1(H, reinterpret_cast<Object*>(&activation));
       HandleScope h2(H, reinterpret_cast<Object*>(&new_sender));
-      top = FlushAllFrames();  // SAFEPOINT
+      top = FlushAllFramesOf(stack);  // SAFEPOINT
     }
     activation->set_sender(new_sender);
-    CreateBaseFrame(top);
+    CreateBaseFrameOf(stack, top);
   } else {
     activation->set_sender(new_sender);
   }
 }
 
 Object Interpreter::ActivationBCI(Activation activation) {
-  if (activation->sender()->IsSmallInteger()) {
+  intptr_t stack = LivingFrameStack(activation);
+  if (stack != kNoStack) {
     Object* activation_fp = activation->sender_fp();
-    Object* fp = fp_;
-    const uint8_t* ip = ip_;
-    while (fp != 0) {
-      if (fp == activation_fp) {
-        if (FrameActivation(fp) == activation) {
-          return FrameMethod(fp)->BCI(ip);
-        }
-        break;
-      }
+    Object* fp;
+    Object* sp;
+    const uint8_t* ip;
+    StackTop(stack, &fp, &sp, &ip);
+    while (fp != activation_fp) {
       ip = FrameSavedIP(fp);
       fp = FrameSavedFP(fp);
     }
-    // Frame is gone.
-    activation->set_sender(static_cast<Activation>(nil), kNoBarrier);
-    activation->set_bci(static_cast<SmallInteger>(nil));
+    return FrameMethod(fp)->BCI(ip);
   }
 
   return activation->bci();
@@ -1815,15 +2719,16 @@ Object Interpreter::ActivationBCI(Activation activation) {
 
 void Interpreter::ActivationBCIPut(Activation activation,
                                    SmallInteger new_bci) {
-  if (HasLivingFrame(activation)) {
+  intptr_t stack = LivingFrameStack(activation);
+  if (stack != kNoStack) {
     Activation top;
     {
       HandleScope h1(H, reinterpret_cast<Object*>(&activation));
       HandleScope h2(H, reinterpret_cast<Object*>(&new_bci));
-      top = FlushAllFrames();  // SAFEPOINT
+      top = FlushAllFramesOf(stack);  // SAFEPOINT
     }
     activation->set_bci(new_bci);
-    CreateBaseFrame(top);
+    CreateBaseFrameOf(stack, top);
   } else {
     return activation->set_bci(new_bci);
   }
@@ -1831,15 +2736,21 @@ void Interpreter::ActivationBCIPut(Activation activation,
 
 void Interpreter::ActivationMethodPut(Activation activation,
                                       Method new_method) {
-  if (HasLivingFrame(activation)) {
+  if ((new_method != nil) && !new_method->HasBytecode()) {
+    HandleScope h1(H, reinterpret_cast<Object*>(&activation));
+    HandleScope h2(H, reinterpret_cast<Object*>(&new_method));
+    LoadBytecode(new_method);  // SAFEPOINT
+  }
+  intptr_t stack = LivingFrameStack(activation);
+  if (stack != kNoStack) {
     Activation top;
     {
       HandleScope h1(H, reinterpret_cast<Object*>(&activation));
       HandleScope h2(H, reinterpret_cast<Object*>(&new_method));
-      top = FlushAllFrames();  // SAFEPOINT
+      top = FlushAllFramesOf(stack);  // SAFEPOINT
     }
     activation->set_method(new_method);
-    CreateBaseFrame(top);
+    CreateBaseFrameOf(stack, top);
   } else {
     activation->set_method(new_method);
   }
@@ -1847,15 +2758,16 @@ void Interpreter::ActivationMethodPut(Activation activation,
 
 void Interpreter::ActivationClosurePut(Activation activation,
                                        Closure new_closure) {
-  if (HasLivingFrame(activation)) {
+  intptr_t stack = LivingFrameStack(activation);
+  if (stack != kNoStack) {
     Activation top;
     {
       HandleScope h1(H, reinterpret_cast<Object*>(&activation));
       HandleScope h2(H, reinterpret_cast<Object*>(&new_closure));
-      top = FlushAllFrames();  // SAFEPOINT
+      top = FlushAllFramesOf(stack);  // SAFEPOINT
     }
     activation->set_closure(new_closure);
-    CreateBaseFrame(top);
+    CreateBaseFrameOf(stack, top);
   } else {
     activation->set_closure(new_closure);
   }
@@ -1864,15 +2776,16 @@ void Interpreter::ActivationClosurePut(Activation activation,
 
 void Interpreter::ActivationReceiverPut(Activation activation,
                                         Object new_receiver) {
-  if (HasLivingFrame(activation)) {
+  intptr_t stack = LivingFrameStack(activation);
+  if (stack != kNoStack) {
     Activation top;
     {
       HandleScope h1(H, reinterpret_cast<Object*>(&activation));
       HandleScope h2(H, reinterpret_cast<Object*>(&new_receiver));
-      top = FlushAllFrames();  // SAFEPOINT
+      top = FlushAllFramesOf(stack);  // SAFEPOINT
     }
     activation->set_receiver(new_receiver);
-    CreateBaseFrame(top);
+    CreateBaseFrameOf(stack, top);
   } else {
     activation->set_receiver(new_receiver);
   }
@@ -1899,24 +2812,18 @@ void Interpreter::ActivationTempAtPut(Activation activation,
 }
 
 intptr_t Interpreter::ActivationTempSize(Activation activation) {
-  if (activation->sender()->IsSmallInteger()) {
+  intptr_t stack = LivingFrameStack(activation);
+  if (stack != kNoStack) {
     Object* activation_fp = activation->sender_fp();
-    Object* sp = sp_;
-    Object* fp = fp_;
-    while (fp != 0) {
-      if (fp == activation_fp) {
-        if (FrameActivation(fp) == activation) {
-          return FlagsNumArgs(FrameFlags(fp)) + FrameNumLocals(fp, sp);
-        }
-        break;
-      }
+    Object* fp;
+    Object* sp;
+    const uint8_t* ip;
+    StackTop(stack, &fp, &sp, &ip);
+    while (fp != activation_fp) {
       sp = FrameSavedSP(fp);
       fp = FrameSavedFP(fp);
     }
-
-    // Frame is gone.
-    activation->set_sender(static_cast<Activation>(nil), kNoBarrier);
-    activation->set_bci(static_cast<SmallInteger>(nil));
+    return FlagsNumArgs(FrameFlags(fp)) + FrameNumLocals(fp, sp);
   }
 
   return activation->stack_depth()->value();
@@ -1924,62 +2831,110 @@ intptr_t Interpreter::ActivationTempSize(Activation activation) {
 
 void Interpreter::ActivationTempSizePut(Activation activation,
                                         intptr_t new_size) {
-  if (HasLivingFrame(activation)) {
+  intptr_t stack = LivingFrameStack(activation);
+  if (stack != kNoStack) {
     Activation top;
     {
       HandleScope h1(H, reinterpret_cast<Object*>(&activation));
-      HandleScope h2(H, reinterpret_cast<Object*>(&new_size));
-      top = FlushAllFrames();  // SAFEPOINT
+      top = FlushAllFramesOf(stack);  // SAFEPOINT
+      HandleScope h2(H, reinterpret_cast<Object*>(&top));
+      activation = EnsureTempCapacity(activation, new_size);  // SAFEPOINT
     }
-    intptr_t old_size = activation->StackDepth();
-    for (intptr_t i = old_size; i < new_size; i++) {
-      activation->set_temp(i, nil, kNoBarrier);
-    }
-    activation->set_stack_depth(SmallInteger::New(new_size));
-    CreateBaseFrame(top);
+    SetTempSize(activation, new_size);
+    CreateBaseFrameOf(stack, top);
   } else {
-    intptr_t old_size = activation->StackDepth();
-    for (intptr_t i = old_size; i < new_size; i++) {
-      activation->set_temp(i, nil, kNoBarrier);
-    }
-    activation->set_stack_depth(SmallInteger::New(new_size));
+    activation = EnsureTempCapacity(activation, new_size);  // SAFEPOINT
+    SetTempSize(activation, new_size);
   }
 }
 
+void Interpreter::SetTempSize(Activation activation, intptr_t new_size) {
+  // Temps grown into are nil, and dropped ones are cleared so they keep
+  // nothing alive.
+  intptr_t old_size = activation->StackDepth();
+  if (new_size > old_size) {
+    activation->temps()->FillElements(old_size, new_size - old_size, nil);
+  } else if (new_size < old_size) {
+    activation->temps()->FillElements(new_size, old_size - new_size, nil);
+  }
+  activation->set_stack_depth(SmallInteger::New(new_size));
+}
+
 void Interpreter::GCPrologue() {
+  if (execution_counts_ != nullptr) {
+    execution_counts_->Flush();  // Before methods move.
+  }
+
   // Convert IPs to BCIs. The makes every slot on the stack a valid object
   // pointer. Frame flags and saved FPs are valid as SmallIntegers.
 
-  Object* fp = fp_;
-  const uint8_t** ip_slot = &ip_;
+  for (intptr_t stack = 0; stack < stacks_capacity_; stack++) {
+    if (stacks_[stack].state == kFree) {
+      continue;
+    }
+    Object* fp = stack == current_stack_ ? fp_ : stacks_[stack].fp;
+    const uint8_t** ip_slot =
+        stack == current_stack_ ? &ip_ : &stacks_[stack].ip;
 
-  while (fp != 0) {
-    SmallInteger bci = FrameMethod(fp)->BCI(*ip_slot);
-    *ip_slot = reinterpret_cast<const uint8_t*>(static_cast<uword>(bci));
+    while (fp != 0) {
+      SmallInteger bci = FrameMethod(fp)->BCI(*ip_slot);
+      *ip_slot = reinterpret_cast<const uint8_t*>(static_cast<uword>(bci));
 
-    ip_slot = FrameSavedIPSlot(fp);
-    fp = FrameSavedFP(fp);
+      ip_slot = FrameSavedIPSlot(fp);
+      fp = FrameSavedFP(fp);
+    }
   }
 }
 
 void Interpreter::GCEpilogue() {
-  // Convert BCIs to IPs. Invalidate lookup caches.
-
-  Object* fp = fp_;
-  const uint8_t** ip_slot = &ip_;
+  RestoreIPs();
 
-  while (fp != 0) {
-    const SmallInteger bci =
-        static_cast<const SmallInteger>(reinterpret_cast<uword>(*ip_slot));
-    *ip_slot = FrameMethod(fp)->IP(bci);
+  // Objects may have moved, so no cached lookup can be trusted.
+#if LOOKUP_CACHE
+  lookup_cache_.Clear();
+#endif
+#if INLINE_CACHE
+  inline_cache_.Clear();
+#endif
+}
 
-    ip_slot = FrameSavedIPSlot(fp);
-    fp = FrameSavedFP(fp);
-  }
+void Interpreter::BecomeEpilogue(const SelectorSet& changed) {
+  RestoreIPs();
 
 #if LOOKUP_CACHE
-  lookup_cache_.Clear();
+  lookup_cache_.Invalidate(changed, H);
+#endif
+#if INLINE_CACHE
+  inline_cache_.Invalidate(changed, H);
 #endif
 }
 
+void Interpreter::RestoreIPs() {
+  // Convert BCIs to IPs.
+
+  for (intptr_t stack = 0; stack < stacks_capacity_; stack++) {
+    if (stacks_[stack].state == kFree) {
+      continue;
+    }
+    Object* fp = stack == current_stack_ ? fp_ : stacks_[stack].fp;
+    const uint8_t** ip_slot =
+        stack == current_stack_ ? &ip_ : &stacks_[stack].ip;
+
+    while (fp != 0) {
+      const SmallInteger bci =
+          static_cast<const SmallInteger>(reinterpret_cast<uword>(*ip_slot));
+      *ip_slot = FrameMethod(fp)->IP(bci);
+
+      ip_slot = FrameSavedIPSlot(fp);
+      fp = FrameSavedFP(fp);
+    }
+  }
+
+  if ((fp_ == 0) && (ip_ != 0)) {
+    // Between dispatches, ip_ holds nil as the sender of the next dispatch
+    // activation. It is not visited as a root, and old objects may move.
+    ip_ = reinterpret_cast<const uint8_t*>(static_cast<uword>(nil_));
+  }
+}
+
 }  // namespace psoup
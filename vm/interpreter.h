@@ -10,11 +10,14 @@
 #include "vm/globals.h"
 #include "vm/assert.h"
 #include "vm/flags.h"
+#include "vm/inline_cache.h"
 #include "vm/lookup_cache.h"
 #include "vm/object.h"
 
 namespace psoup {
 
+class CpuProfile;
+class ExecutionCounts;
 class Heap;
 class Isolate;
 class Object;
@@ -37,13 +40,42 @@ class Interpreter {
                Array arguments);
   Method MethodAt(Behavior cls, String selector);
   void ActivateClosure(intptr_t num_args);
+  // Reads the bytecode that |method| left in the snapshot.
+  void LoadBytecode(Method method);
 
   void Interrupt() { checked_stack_limit_ = reinterpret_cast<Object*>(-1); }
   void PrintStack();
 
+  // Samples into |profile| from now on, or stops sampling if it is null.
+  // Returns the previous profile, if any, which the caller deletes.
+  CpuProfile* SetCpuProfile(CpuProfile* profile);
+  // From the sampler thread: record a sample at the next stack check.
+  void RequestSample();
+  // From another thread: leave the current dispatch at the next stack check,
+  // keeping its frames, so something else can run on this thread. The
+  // dispatch is suspended until Resume continues it, on any thread.
+  void RequestYield();
+  bool suspended() const { return suspended_; }
+  void Resume();
+  // Counts into |counts| from now on, or stops counting if it is null.
+  // Returns the previous counts, if any, which the caller deletes.
+  ExecutionCounts* SetExecutionCounts(ExecutionCounts* counts);
+
   const uint8_t* IPForAssert() { return ip_; }
+  // All zero, sizes included, when LOOKUP_CACHE is off.
+  LookupCache::Statistics lookup_cache_statistics() const {
+#if LOOKUP_CACHE
+    return lookup_cache_.statistics();
+#else
+    LookupCache::Statistics disabled = {};
+    return disabled;
+#endif
+  }
 
   Activation CurrentActivation();
+  // The method of the innermost frame, or nil between frames. Does not
+  // allocate.
+  Object CurrentMethod();
   void SetCurrentActivation(Activation new_activation);
   Object ActivationSender(Activation activation);
   void ActivationSenderPut(Activation activation, Activation new_sender);
@@ -57,17 +89,74 @@ class Interpreter {
                            Object value);
   intptr_t ActivationTempSize(Activation activation);
   void ActivationTempSizePut(Activation activation, intptr_t new_size);
+  // Whether |activation|'s frame is still on a stack. Does not allocate.
+  bool ActivationHasFrame(Activation activation) {
+    return HasLivingFrame(activation);
+  }
+
+  // Coroutines each run on a stack of their own, so suspending and resuming
+  // one swaps the stack registers instead of moving frames to the heap. A
+  // coroutine is named by a small integer handle, and runs |body| with the
+  // value it is first resumed with. Answers 0 if no stack can be allocated.
+  // |coroutine| is kept in the slot at the stack's base: while it waits to
+  // be resumed, its stack is live only as long as |coroutine| is.
+  intptr_t NewCoroutine(Object coroutine, Closure body);
+  // Answers whether |handle| names a coroutine neither running nor waiting
+  // on another it resumed.
+  bool CanResumeCoroutine(intptr_t handle) const;
+  // Continues the coroutine with |value|, as the answer of its yield or as
+  // the argument of its body. It runs until it yields or its body returns,
+  // either of which pushes the result here.
+  void ResumeCoroutine(intptr_t handle, Object value);
+  bool InCoroutine() const { return current_stack_ != kMainStack; }
+  // Suspends the running coroutine, pushing |value| on its resumer's stack.
+  void YieldCoroutine(Object value);
+  // Frees the stack of a coroutine that could be resumed, dropping its
+  // frames without unwinding them. Answers false if it cannot be resumed.
+  bool CloseCoroutine(intptr_t handle);
 
   void GCPrologue();
   void RootPointers(Object** from, Object** to) {
     *from = &nil_;
     *to = reinterpret_cast<Object*>(&object_store_);
   }
-  void StackPointers(Object** from, Object** to) {
-    *from = sp_;
-    *to = stack_base_ - 1;
+  // The used part of the |index|th stack, which is empty unless it is in
+  // use. Answers false past the last stack.
+  bool StackPointers(intptr_t index, Object** from, Object** to) {
+    if (index >= stacks_capacity_) {
+      return false;
+    }
+    Object* base;
+    if (index == current_stack_) {
+      *from = sp_;
+      base = stack_base_;
+    } else if (stacks_[index].state == kFree) {
+      *from = sp_;
+      *to = sp_ - 1;
+      return true;
+    } else {
+      *from = stacks_[index].sp;
+      base = stacks_[index].base;
+    }
+    // A coroutine's stack includes the Coroutine at its base.
+    *to = (index == kMainStack) ? base - 1 : base;
+    return true;
+  }
+  // Whether the |index|th stack is that of a coroutine waiting to be resumed.
+  // A full collection traces it only once its owner is marked, and closes it
+  // if its owner is not, as for an ephemeron keyed by the owner.
+  bool IsWaitingStack(intptr_t index) const {
+    StackState state = stacks_[index].state;
+    return (state == kNew) || (state == kSuspended);
+  }
+  Object WaitingStackOwner(intptr_t index) const {
+    ASSERT(IsWaitingStack(index));
+    return *stacks_[index].base;
   }
   void GCEpilogue();
+  // Instead of GCEpilogue after a become that moved nothing, which changed
+  // only the lookups of |changed| selectors.
+  void BecomeEpilogue(const SelectorSet& changed);
 
   void Push(Object value) {
     ASSERT(sp_ <= stack_base_);
@@ -115,6 +204,8 @@ class Interpreter {
 
  private:
   void Interpret();
+  // Converts the BCIs saved by GCPrologue back to IPs.
+  void RestoreIPs();
 
   INLINE void PushIndirectLocal(intptr_t vector_offset, intptr_t offset);
   INLINE void PopIntoIndirectLocal(intptr_t vector_offset, intptr_t offset);
@@ -124,6 +215,12 @@ class Interpreter {
   INLINE void PushEnclosingObject(intptr_t depth);
   INLINE void PushNewArrayWithElements(intptr_t size);
   INLINE void PushNewArray(intptr_t size);
+  INLINE void PushTemp(Object value);
+  INLINE void PushComparison(bool result);
+  void PopNAndPushFloat(intptr_t n, double value);
+  // Answers false if the operands are not both SmallIntegers or
+  // MediumIntegers, or the result needs a LargeInteger.
+  bool MediumIntegerArithmetic(uint8_t bytecode, Object left, Object right);
   void PushClosure(intptr_t num_copied, intptr_t num_args, intptr_t block_size);
 
   INLINE void CommonSend(intptr_t offset);
@@ -155,10 +252,14 @@ class Interpreter {
                      Object receiver,
                      Behavior starting_at,
                      intptr_t rule);
+  // Answers whether |receiver| understands |selector| as an ordinary send,
+  // with the method to activate, or with its #doesNotUnderstand: method.
+  bool OrdinaryLookup(Object receiver, String selector, Method* target);
+  Method DNULookup(Behavior lookup_class);
   void DNUSend(String selector,
                intptr_t num_args,
                Object receiver,
-               Behavior lookup_class,
+               Method method,
                bool present_receiver);
 
   NOINLINE void SendCannotReturn(Object result);
@@ -171,6 +272,9 @@ class Interpreter {
                              intptr_t num_args);
   NOINLINE void Activate(Method method, intptr_t num_args);
   NOINLINE void StackOverflow();
+  bool GrowStack();
+  void RecordSample();
+  void CountSendMiss(String selector);
 
   INLINE void LocalReturn(Object result);
   NOINLINE void LocalBaseReturn(Object result);
@@ -178,18 +282,80 @@ class Interpreter {
 
   NOINLINE void CreateBaseFrame(Activation activation);
   NOINLINE Activation EnsureActivation(Object* fp);
+  // Makes room for |size| temps in |activation|, and answers it.
+  Activation EnsureTempCapacity(Activation activation, intptr_t size);
+  void SetTempSize(Activation activation, intptr_t new_size);
   NOINLINE Activation FlushAllFrames();
-  bool HasLivingFrame(Activation activation);
+  // Answers the stack holding |activation|'s frame, or kNoStack if it has no
+  // living frame. An activation whose frame has returned is marked dead.
+  intptr_t LivingFrameStack(Activation activation);
+  bool HasLivingFrame(Activation activation) {
+    return LivingFrameStack(activation) != kNoStack;
+  }
+  // The top frame's registers of |stack|, whether or not it is current.
+  void StackTop(intptr_t stack,
+                Object** fp, Object** sp, const uint8_t** ip) const;
+  // As FlushAllFrames, for the frames on |stack|. When it is not the current
+  // stack its top activation is left as its only slot, and its frames are
+  // recreated when it next runs.
+  Activation FlushAllFramesOf(intptr_t stack);
+  void CreateBaseFrameOf(intptr_t stack, Activation top) {
+    if (stack == current_stack_) {
+      CreateBaseFrame(top);
+    }
+  }
 
-  static constexpr intptr_t kStackSlots = 1024;
-  static constexpr intptr_t kStackSize = kStackSlots * sizeof(Object);
+  // Saves the registers to the current stack's entry and loads |stack|'s.
+  void SwitchStack(intptr_t stack);
+  void FinishCoroutine(Object result);
+  void FreeStack(intptr_t stack);
+
+  // The stack starts at kInitialStackSlots and doubles on overflow up to the
+  // policy's max_stack_size. Only beyond that are frames moved to the heap.
+  static constexpr intptr_t kInitialStackSlots = 1024;
+  static constexpr intptr_t kDefaultMaxStackSlots = 256 * KB;
+  // Kept free between the stack limit and the checked limit, enough for the
+  // largest frame.
+  static constexpr intptr_t kStackHeadroom =
+      sizeof(Activation::Layout) / sizeof(Object) + kMaxTemps;
 
   const uint8_t* ip_;
   Object* sp_;
   Object* fp_;
   Object* stack_base_;
   Object* stack_limit_;
+  // Normally stack_limit_ plus the size of an Activation. -1 requests an
+  // interrupt, -2 a CPU profile sample and -3 a yield: all fail every stack
+  // check.
   Object* volatile checked_stack_limit_;
+  intptr_t stack_slots_;
+  intptr_t max_stack_slots_;
+
+  // The main stack, and those of coroutines. The entry of the current stack
+  // is stale; its registers are those above.
+  enum StackState {
+    kFree,
+    kNew,        // Holds only the body.
+    kRunning,
+    kResuming,   // Waiting on the coroutine it resumed.
+    kSuspended,  // Yielded.
+  };
+  struct StackEntry {
+    const uint8_t* ip;
+    Object* sp;
+    Object* fp;
+    Object* base;  // A coroutine's holds its Coroutine, past its frames.
+    Object* limit;
+    intptr_t slots;
+    StackState state;
+    bool flushed;  // Frames moved to the heap, the top activation left.
+    intptr_t resumer;
+  };
+  static constexpr intptr_t kMainStack = 0;
+  static constexpr intptr_t kNoStack = -1;
+  StackEntry* stacks_;
+  intptr_t stacks_capacity_;
+  intptr_t current_stack_;
 
   Object nil_;
   Object false_;
@@ -199,7 +365,11 @@ class Interpreter {
   Heap* const heap_;
   Isolate* const isolate_;
   jmp_buf* environment_;
+  bool suspended_;
   LookupCache lookup_cache_;
+  InlineCache inline_cache_;
+  CpuProfile* cpu_profile_;
+  ExecutionCounts* execution_counts_;
 };
 
 }  // namespace psoup
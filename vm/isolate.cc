@@ -4,18 +4,23 @@
 
 #include "vm/isolate.h"
 
+#include "vm/atomic.h"
+#include "vm/compressed_snapshot.h"
 #include "vm/heap.h"
 #include "vm/interpreter.h"
 #include "vm/lockers.h"
 #include "vm/message_loop.h"
+#include "vm/numa.h"
 #include "vm/os.h"
+#include "vm/perf_counters.h"
 #include "vm/snapshot.h"
 #include "vm/thread.h"
 #include "vm/thread_pool.h"
+#include "vm/trace_events.h"
 
 namespace psoup {
 
-#if defined(OS_EMSCRIPTEN)
+#if defined(OS_EMSCRIPTEN) && !defined(EMSCRIPTEN_THREADS)
 Isolate* Isolate::current_ = NULL;
 #else
 thread_local Isolate* Isolate::current_ = NULL;
@@ -25,21 +30,222 @@ Isolate* Isolate::isolates_list_head_ = NULL;
 ThreadPool* Isolate::thread_pool_ = NULL;
 
 
+// Isolates made ahead of Spawn, which have loaded their snapshot but not yet
+// been given their initial message or run. Each pool holds isolates for one
+// snapshot and heap policy, and is refilled whenever one is taken.
+class IsolatePool {
+ public:
+  static void Startup() {
+    monitor_ = new Monitor();
+  }
+
+  // Waits for the isolates being made, then deletes all idle ones.
+  static void Shutdown() {
+    IsolatePool* pools;
+    {
+      MonitorLocker ml(monitor_);
+      shutting_down_ = true;
+      while (IsWarmingLocked()) {
+        ml.Wait();
+      }
+      pools = pools_;
+      pools_ = NULL;
+    }
+    while (pools != NULL) {
+      IsolatePool* next = pools->next_;
+      for (intptr_t i = 0; i < pools->num_idle_; i++) {
+        Isolate::SetCurrent(pools->idle_[i]);
+        delete pools->idle_[i];
+      }
+      delete pools;
+      pools = next;
+    }
+    delete monitor_;
+    monitor_ = NULL;
+    shutting_down_ = false;
+  }
+
+  static void SetSize(intptr_t size) { size_ = size; }
+
+  static void Fill(void* snapshot,
+                   size_t snapshot_length,
+                   const HeapPolicy& policy) {
+    if (size_ == 0) {
+      return;
+    }
+    MonitorLocker ml(monitor_);
+    IsolatePool* pool = LookupLocked(snapshot, snapshot_length, policy);
+    if (pool != NULL) {
+      pool->RefillLocked();
+    }
+  }
+
+  // Answers NULL if none is idle, in which case the caller makes its own.
+  static Isolate* Take(void* snapshot,
+                       size_t snapshot_length,
+                       const HeapPolicy& policy) {
+    if (size_ == 0) {
+      return NULL;
+    }
+    MonitorLocker ml(monitor_);
+    IsolatePool* pool = LookupLocked(snapshot, snapshot_length, policy);
+    if (pool == NULL) {
+      return NULL;
+    }
+    Isolate* isolate = NULL;
+    if (pool->num_idle_ > 0) {
+      isolate = pool->idle_[--pool->num_idle_];
+    }
+    pool->RefillLocked();
+    return isolate;
+  }
+
+ private:
+  class WarmTask : public ThreadPool::Task {
+   public:
+    explicit WarmTask(IsolatePool* pool) : pool_(pool) {}
+
+    virtual void Run() {
+      uint64_t seed = OS::CurrentMonotonicNanos();
+      Isolate* isolate = new Isolate(pool_->snapshot_,
+                                     pool_->snapshot_length_,
+                                     seed, pool_->policy_);
+      Isolate::SetCurrent(NULL);
+      pool_->Add(isolate);
+    }
+
+   private:
+    IsolatePool* pool_;
+
+    DISALLOW_COPY_AND_ASSIGN(WarmTask);
+  };
+
+  IsolatePool(void* snapshot,
+              size_t snapshot_length,
+              const HeapPolicy& policy,
+              IsolatePool* next) :
+      snapshot_(snapshot),
+      snapshot_length_(snapshot_length),
+      policy_(policy),
+      idle_(new Isolate*[size_]),
+      num_idle_(0),
+      num_warming_(0),
+      next_(next) {
+  }
+
+  ~IsolatePool() {
+    delete[] idle_;
+  }
+
+  static bool SamePolicy(const HeapPolicy& a, const HeapPolicy& b) {
+    return (a.initial_semispace_capacity == b.initial_semispace_capacity) &&
+           (a.max_semispace_capacity == b.max_semispace_capacity) &&
+           (a.old_growth_percent == b.old_growth_percent) &&
+           (a.retained_free_size == b.retained_free_size) &&
+           (a.max_size == b.max_size) &&
+           (a.max_stack_size == b.max_stack_size) &&
+           (a.idle_collection_delay == b.idle_collection_delay);
+  }
+
+  // Makes the pool if there is none yet, unless shutting down.
+  static IsolatePool* LookupLocked(void* snapshot,
+                                   size_t snapshot_length,
+                                   const HeapPolicy& policy) {
+    if (shutting_down_) {
+      return NULL;
+    }
+    for (IsolatePool* pool = pools_; pool != NULL; pool = pool->next_) {
+      if ((pool->snapshot_ == snapshot) && SamePolicy(pool->policy_, policy)) {
+        return pool;
+      }
+    }
+    pools_ = new IsolatePool(snapshot, snapshot_length, policy, pools_);
+    return pools_;
+  }
+
+  static bool IsWarmingLocked() {
+    for (IsolatePool* pool = pools_; pool != NULL; pool = pool->next_) {
+      if (pool->num_warming_ > 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void RefillLocked() {
+    while (num_idle_ + num_warming_ < size_) {
+      num_warming_++;
+      Isolate::thread_pool()->Run(new WarmTask(this));
+    }
+  }
+
+  void Add(Isolate* isolate) {
+    MonitorLocker ml(monitor_);
+    ASSERT(num_idle_ < size_);
+    idle_[num_idle_++] = isolate;
+    num_warming_--;
+    if (shutting_down_) {
+      ml.NotifyAll();
+    }
+  }
+
+  void* const snapshot_;
+  const size_t snapshot_length_;
+  const HeapPolicy policy_;
+  Isolate** const idle_;
+  intptr_t num_idle_;
+  intptr_t num_warming_;
+  IsolatePool* const next_;
+
+  static intptr_t size_;
+  static Monitor* monitor_;
+  static bool shutting_down_;
+  static IsolatePool* pools_;  // Protected by monitor_.
+
+  DISALLOW_COPY_AND_ASSIGN(IsolatePool);
+};
+
+intptr_t IsolatePool::size_ = 0;
+Monitor* IsolatePool::monitor_ = NULL;
+bool IsolatePool::shutting_down_ = false;
+IsolatePool* IsolatePool::pools_ = NULL;
+
+
 void Isolate::Startup() {
   isolates_list_monitor_ = new Monitor();
   thread_pool_ = new ThreadPool();
+  IsolatePool::Startup();
+  SnapshotImage::Startup();
+  CompressedSnapshot::Startup();
+  MessageLoop::Startup();
 }
 
 
 void Isolate::Shutdown() {
+  IsolatePool::Shutdown();
+  MessageLoop::Shutdown();
   delete thread_pool_;  // Waits for all tasks to complete.
   thread_pool_ = NULL;
+  SnapshotImage::Shutdown();
+  CompressedSnapshot::Shutdown();
   ASSERT(isolates_list_head_ == NULL);
   delete isolates_list_monitor_;
   isolates_list_monitor_ = NULL;
 }
 
 
+void Isolate::SetPoolSize(intptr_t size) {
+  ASSERT(size >= 0);
+  IsolatePool::SetSize(size);
+}
+
+
+void Isolate::WarmPool(Isolate* isolate) {
+  IsolatePool::Fill(isolate->snapshot_, isolate->snapshot_length_,
+                    isolate->heap_->policy());
+}
+
+
 void Isolate::AddIsolateToList(Isolate* isolate) {
   MonitorLocker ml(isolates_list_monitor_);
   ASSERT(isolate != NULL);
@@ -71,6 +277,47 @@ void Isolate::RemoveIsolateFromList(Isolate* isolate) {
 }
 
 
+void Isolate::GetMetrics(IsolateMetrics* metrics) const {
+  metrics->heap_size = heap_->Size();
+  metrics->old_size = heap_->old_size();
+  metrics->old_capacity = heap_->old_capacity();
+  metrics->semispace_capacity = heap_->semispace_capacity();
+  const Heap::GCTotals& gc = heap_->gc_totals();
+  metrics->scavenges = gc.scavenges;
+  metrics->scavenge_nanos = gc.scavenge_nanos;
+  metrics->mark_sweeps = gc.mark_sweeps;
+  metrics->mark_sweep_nanos = gc.mark_sweep_nanos;
+  metrics->messages_queued = loop_->queued();
+  metrics->messages_dispatched = loop_->dispatched();
+  const LookupCache::Statistics& lookups =
+      interpreter_->lookup_cache_statistics();
+  metrics->lookup_cache_hits = lookups.ordinary_hits + lookups.ns_hits;
+  metrics->lookup_cache_misses = lookups.ordinary_misses + lookups.ns_misses;
+  metrics->cpu_nanos =
+      AtomicOperations::LoadRelaxed(const_cast<int64_t*>(&cpu_nanos_));
+  for (intptr_t kind = 0; kind < kNumLatencyKinds; kind++) {
+    loop_->latency(static_cast<LatencyKind>(kind))
+        .Summarize(&metrics->latencies[kind]);
+  }
+}
+
+
+intptr_t Isolate::GetAllMetrics(IsolateMetrics* metrics, Isolate** isolates,
+                                intptr_t capacity) {
+  MonitorLocker ml(isolates_list_monitor_);
+  intptr_t count = 0;
+  for (Isolate* current = isolates_list_head_; current != NULL;
+       current = current->next_) {
+    if (count < capacity) {
+      current->GetMetrics(&metrics[count]);
+      isolates[count] = current;
+    }
+    count++;
+  }
+  return count;
+}
+
+
 void Isolate::InterruptAll() {
   MonitorLocker ml(isolates_list_monitor_);
   OS::PrintErr("Got SIGINT\n");
@@ -96,7 +343,10 @@ void Isolate::PrintStack() {
 }
 
 
-Isolate::Isolate(void* snapshot, size_t snapshot_length, uint64_t seed) :
+Isolate::Isolate(void* snapshot,
+                 size_t snapshot_length,
+                 uint64_t seed,
+                 const HeapPolicy& policy) :
     heap_(NULL),
     interpreter_(NULL),
     loop_(NULL),
@@ -104,11 +354,21 @@ Isolate::Isolate(void* snapshot, size_t snapshot_length, uint64_t seed) :
     snapshot_length_(snapshot_length),
     salt_(static_cast<uintptr_t>(seed)),
     random_(seed),
+    async_files_(this),
+    cpu_nanos_(0),
     next_(NULL) {
-  heap_ = new Heap();
+  heap_ = new Heap(policy);
+  if (PerfCounters::count_from_start()) {
+    heap_->SetPerfCounters(new PerfCounters());
+  }
+#if !defined(OS_EMSCRIPTEN)
+  heap_->ConfigureParallelScavenge(thread_pool_,
+                                   OS::NumberOfAvailableProcessors());
+#endif
   interpreter_ = new Interpreter(heap_, this);
-  loop_ = new PlatformMessageLoop(this);
+  loop_ = MessageLoop::New(this);
   {
+    TraceScope trace_scope("load isolate", this);
     Deserializer deserializer(heap_, snapshot, snapshot_length);
     deserializer.Deserialize();
   }
@@ -125,19 +385,81 @@ Isolate::~Isolate() {
   current_ = NULL;
 
   RemoveIsolateFromList(this);
+  if (TraceEvents::enabled()) {
+    TraceEvents::Record(TraceEvents::kInstant, "isolate exit", this);
+  }
+  if (PerfCounters::count_from_start() && (heap_->perf_counters() != NULL)) {
+    heap_->perf_counters()->Print("isolate");
+  }
   delete heap_;
   delete interpreter_;
   delete loop_;
 }
 
 
+void Isolate::AfterFork() {
+  ASSERT(!MessageLoop::HasScheduler());
+  ASSERT(isolates_list_head_ == this && next_ == NULL);
+  // The parent's workers exist only in the parent, so their pool is left as
+  // it is rather than waited for.
+  thread_pool_ = new ThreadPool();
+#if !defined(OS_EMSCRIPTEN)
+  heap_->ConfigureParallelScavenge(thread_pool_,
+                                   OS::NumberOfAvailableProcessors());
+#endif
+  delete loop_;
+  loop_ = MessageLoop::New(this);
+  // Otherwise every child would draw the same numbers.
+  random_ = Random(OS::CurrentMonotonicNanos());
+}
+
+
+bool Isolate::UseDrivenLoop() {
+  MessageLoop* loop = MessageLoop::NewDriven(this);
+  if (loop == NULL) {
+    return false;
+  }
+  delete loop_;
+  loop_ = loop;
+  return true;
+}
+
+
+ByteArray Isolate::TakeBytes(IsolateMessage* isolate_message) {
+  if (isolate_message->region() != NULL) {
+    // Adopted without copying.
+    return heap_->AdoptByteArray(isolate_message->TakeRegion());
+  }
+  intptr_t length = isolate_message->length();
+  ByteArray bytes = heap_->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(bytes->element_addr(0), isolate_message->data(), length);
+  return bytes;
+}
+
+
+Object Isolate::PortObject(Port port_id, Object* message) {
+  if (port_id == ILLEGAL_PORT) {
+    return interpreter_->nil_obj();
+  } else if (SmallInteger::IsSmiValue(port_id)) {
+    return SmallInteger::New(port_id);
+  }
+  HandleScope h1(heap_, message);
+  MediumInteger mint = heap_->AllocateMediumInteger();  // SAFEPOINT
+  mint->set_value(port_id);
+  return mint;
+}
+
+
 void Isolate::ActivateMessage(IsolateMessage* isolate_message) {
+  if (isolate_message->is_object() && CanActivateObjects()) {
+    ActivateObjects(isolate_message, 1);  // SAFEPOINT
+    return;
+  }
+
   Object message;
-  if (isolate_message->data() != NULL) {
-    intptr_t length = isolate_message->length();
-    ByteArray bytes = heap_->AllocateByteArray(length);  // SAFEPOINT
-    memcpy(bytes->element_addr(0), isolate_message->data(), length);
-    message = bytes;
+  if ((isolate_message->region() != NULL) ||
+      (isolate_message->data() != NULL)) {
+    message = TakeBytes(isolate_message);  // SAFEPOINT
   } else {
     int argc = isolate_message->argc();
     Array strings = heap_->AllocateArray(argc);  // SAFEPOINT
@@ -156,23 +478,72 @@ void Isolate::ActivateMessage(IsolateMessage* isolate_message) {
     message = strings;
   }
 
-  Port port_id = isolate_message->dest_port();
-  Object port;
-  if (port_id == ILLEGAL_PORT) {
-    port = interpreter_->nil_obj();
-  } else if (SmallInteger::IsSmiValue(port_id)) {
-    port = SmallInteger::New(port_id);
-  } else {
-    HandleScope h1(heap_, reinterpret_cast<Object*>(&message));
-    MediumInteger mint = heap_->AllocateMediumInteger();  // SAFEPOINT
-    mint->set_value(port_id);
-    port = mint;
+  Object port = PortObject(isolate_message->dest_port(), &message);
+  Activate(message, port);
+}
+
+
+void Isolate::ActivateMessages(IsolateMessage* first, intptr_t count) {
+  if (first->is_object() && CanActivateObjects()) {
+    ActivateObjects(first, count);  // SAFEPOINT
+    return;
+  }
+
+  Array messages = heap_->AllocateArray(count);  // SAFEPOINT
+  for (intptr_t i = 0; i < count; i++) {
+    messages->set_element(i, SmallInteger::New(0));
+  }
+
+  HandleScope h1(heap_, reinterpret_cast<Object*>(&messages));
+  IsolateMessage* isolate_message = first;
+  for (intptr_t i = 0; i < count; i++) {
+    ASSERT(isolate_message->dest_port() == first->dest_port());
+    ByteArray bytes = TakeBytes(isolate_message);  // SAFEPOINT
+    messages->set_element(i, bytes);
+    isolate_message = isolate_message->next();
   }
 
+  Object message = messages;
+  Object port = PortObject(first->dest_port(), &message);
   Activate(message, port);
 }
 
 
+bool Isolate::CanActivateObjects() {
+  ObjectStore object_store = interpreter_->object_store();
+  if (!object_store->HasMessageObjects()) {
+    return false;
+  }
+  Behavior cls = object_store->message_loop()->Klass(heap_);
+  Object method = interpreter_->MethodAt(cls, object_store->dispatch_objects());
+  return method != object_store->nil_obj();
+}
+
+
+void Isolate::ActivateObjects(IsolateMessage* first, intptr_t count) {
+  Array messages = heap_->AllocateArray(count);  // SAFEPOINT
+  for (intptr_t i = 0; i < count; i++) {
+    messages->set_element(i, SmallInteger::New(0));
+  }
+
+  HandleScope h1(heap_, reinterpret_cast<Object*>(&messages));
+  IsolateMessage* isolate_message = first;
+  for (intptr_t i = 0; i < count; i++) {
+    ASSERT(isolate_message->is_object());
+    ASSERT(isolate_message->dest_port() == first->dest_port());
+    MessageDeserializer deserializer(heap_, isolate_message->data(),
+                                     isolate_message->length());
+    Object root = deserializer.Deserialize();  // SAFEPOINT
+    messages->set_element(i, root);
+    isolate_message = isolate_message->next();
+  }
+
+  Object message = messages;
+  Object port = PortObject(first->dest_port(), &message);
+  Activate(interpreter_->object_store()->dispatch_objects(), message, port);
+}
+
+
 void Isolate::ActivateWakeup() {
   Object nil = interpreter_->nil_obj();
   Activate(nil, nil);
@@ -180,10 +551,14 @@ void Isolate::ActivateWakeup() {
 
 
 void Isolate::Activate(Object message, Object port) {
+  Activate(interpreter_->object_store()->dispatch_message(), message, port);
+}
+
+
+void Isolate::Activate(String selector, Object message, Object port) {
   Object message_loop = interpreter_->object_store()->message_loop();
 
   Behavior cls = message_loop->Klass(heap_);
-  String selector = interpreter_->object_store()->dispatch_message();
   Method method = interpreter_->MethodAt(cls, selector);
 
   interpreter_->Push(message_loop);
@@ -213,7 +588,34 @@ void Isolate::ActivateSignal(intptr_t handle,
 
 
 void Isolate::Interpret() {
+  PerfScope perf_scope(heap_, PerfCounters::kInterpret);
+  int64_t start = OS::CurrentThreadCPUNanos();
   interpreter_->Enter();
+  AddCPUTime(start);
+}
+
+
+bool Isolate::suspended() const {
+  return interpreter_->suspended();
+}
+
+
+void Isolate::Resume() {
+  PerfScope perf_scope(heap_, PerfCounters::kInterpret);
+  int64_t start = OS::CurrentThreadCPUNanos();
+  interpreter_->Resume();
+  AddCPUTime(start);
+}
+
+
+void Isolate::AddCPUTime(int64_t start) {
+  int64_t elapsed = OS::CurrentThreadCPUNanos() - start;
+  AtomicOperations::StoreRelaxed(&cpu_nanos_, cpu_nanos_ + elapsed);
+}
+
+
+void Isolate::RequestYield() {
+  interpreter_->RequestYield();
 }
 
 
@@ -221,36 +623,74 @@ class SpawnIsolateTask : public ThreadPool::Task {
  public:
   SpawnIsolateTask(void* snapshot,
                    size_t snapshot_length,
-                   IsolateMessage* initial_message) :
+                   const HeapPolicy& policy,
+                   IsolateMessage* initial_message,
+                   Isolate* pooled) :
     snapshot_(snapshot),
     snapshot_length_(snapshot_length),
-    initial_message_(initial_message) {
+    policy_(policy),
+    initial_message_(initial_message),
+    pooled_(pooled) {
   }
 
   virtual void Run() {
-    uint64_t seed = OS::CurrentMonotonicNanos();
-    Isolate* child_isolate = new Isolate(snapshot_, snapshot_length_, seed);
+    // Scheduled isolates move between the scheduler's threads, so only their
+    // heaps are placed.
+    NodeAffinityScope affinity(
+        MessageLoop::HasScheduler() ? -1 : policy_.numa_node);
+    Isolate* child_isolate = pooled_;
+    if (child_isolate == NULL) {
+      uint64_t seed = OS::CurrentMonotonicNanos();
+      child_isolate = new Isolate(snapshot_, snapshot_length_, seed, policy_);
+    } else {
+      Isolate::SetCurrent(child_isolate);
+      pooled_ = NULL;
+    }
     child_isolate->loop()->PostMessage(initial_message_);
     initial_message_ = NULL;
-    intptr_t exit_code = child_isolate->loop()->Run();
-    delete child_isolate;
-    if (exit_code != 0) {
-      OS::Exit(exit_code);
-    }
+    child_isolate->loop()->RunDetached(child_isolate);
   }
 
  private:
   void* snapshot_;
   size_t snapshot_length_;
+  HeapPolicy policy_;
   IsolateMessage* initial_message_;
+  Isolate* pooled_;  // Already loaded, or NULL.
 
   DISALLOW_COPY_AND_ASSIGN(SpawnIsolateTask);
 };
 
 
 void Isolate::Spawn(IsolateMessage* initial_message) {
-  thread_pool_->Run(new SpawnIsolateTask(snapshot_, snapshot_length_,
-                                         initial_message));
+  // The child's first message waits while it is loaded.
+  initial_message->set_posted(OS::CurrentMonotonicNanos());
+  if (TraceEvents::enabled()) {
+    TraceEvents::Record(TraceEvents::kInstant, "spawn", this);
+    initial_message->set_trace_id(TraceEvents::NextFlowId());
+    TraceEvents::Record(TraceEvents::kFlowStart, "message", this,
+                        initial_message->trace_id());
+  }
+  // Pooled isolates were loaded before a node was chosen for them, so placed
+  // children are always loaded anew.
+  HeapPolicy policy = heap_->policy();
+  policy.numa_node = Numa::NextNode();
+  Isolate* pooled = NULL;
+  if (policy.numa_node == -1) {
+    pooled = IsolatePool::Take(snapshot_, snapshot_length_, policy);
+  }
+  SpawnIsolateTask* task = new SpawnIsolateTask(
+      snapshot_, snapshot_length_, policy, initial_message, pooled);
+  if (!MessageLoop::HasScheduler()) {
+    thread_pool_->Run(task);
+    return;
+  }
+  // The child only takes a worker once it is handed to the scheduler, so it is
+  // made here, where it is counted before this isolate can exit.
+  current_ = NULL;
+  task->Run();
+  delete task;
+  current_ = this;
 }
 
 }  // namespace psoup
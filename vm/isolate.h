@@ -6,50 +6,138 @@
 #define VM_ISOLATE_H_
 
 #include "vm/allocation.h"
+#include "vm/async_files.h"
 #include "vm/globals.h"
+#include "vm/latency_histogram.h"
+#include "vm/mapped_files.h"
 #include "vm/port.h"
 #include "vm/random.h"
+#include "vm/ring_channel.h"
 
 namespace psoup {
 
+class ByteArray;
 class Heap;
+struct HeapPolicy;
 class Interpreter;
 class MessageLoop;
 class Monitor;
 class Object;
+class String;
 class ThreadPool;
 
+// An isolate's current sizes and running totals, all kept up as it runs so
+// that taking them scans neither its heap nor its ports.
+struct IsolateMetrics {
+  int64_t heap_size;
+  int64_t old_size;
+  int64_t old_capacity;
+  int64_t semispace_capacity;
+  int64_t scavenges;
+  int64_t scavenge_nanos;
+  int64_t mark_sweeps;
+  int64_t mark_sweep_nanos;
+  int64_t messages_queued;
+  int64_t messages_dispatched;
+  int64_t lookup_cache_hits;
+  int64_t lookup_cache_misses;
+  // Spent interpreting, including the collections it caused, counted as each
+  // dispatch finishes.
+  int64_t cpu_nanos;
+  LatencySummary latencies[kNumLatencyKinds];
+};
+
 class Isolate {
  public:
-  Isolate(void* snapshot, size_t snapshot_length, uint64_t seed);
+  Isolate(void* snapshot,
+          size_t snapshot_length,
+          uint64_t seed,
+          const HeapPolicy& policy);
   ~Isolate();
 
   Heap* heap() const { return heap_; }
   MessageLoop* loop() const { return loop_; }
+  // Stays mapped as long as the isolate; see Method::HasBytecode.
+  const void* snapshot() const { return snapshot_; }
   uintptr_t salt() const { return salt_; }
+  // Taken from an image, so the hashes of the strings it holds stay valid.
+  void set_salt(uintptr_t salt) { salt_ = salt; }
   Random& random() { return random_; }
+  MappedFiles* mapped_files() { return &mapped_files_; }
+  AsyncFiles* async_files() { return &async_files_; }
+  RingChannels* ring_channels() { return &ring_channels_; }
 
   void ActivateMessage(IsolateMessage* message);
+  // Delivers the payloads of |count| messages for the same port, linked
+  // through next_, as one Array.
+  void ActivateMessages(IsolateMessage* first, intptr_t count);
   void ActivateWakeup();
   void ActivateSignal(intptr_t handle,
                       intptr_t status,
                       intptr_t signals,
                       intptr_t count);
 
-  void Interpret();
+  // In a process forked while this was the only isolate and not running. The
+  // parent's other threads were not copied, and its loop's descriptors are
+  // still shared with the parent, so both are made anew.
+  void AfterFork();
+  // Before running, replaces the loop with one the embedder can run from its
+  // own event loop; see MessageLoop::RunUntilIdle. Answers false, keeping the
+  // loop, where there is none.
+  bool UseDrivenLoop();
 
+  void Interpret();
+  // Whether the last Interpret left its dispatch unfinished after a
+  // RequestYield. Nothing else may be activated until it is resumed.
+  bool suspended() const;
+  void Resume();
+  void RequestYield();
+
+  // The child's heap follows the same policy as this isolate's, except when
+  // spreading isolates over NUMA nodes, which gives it the next node; see
+  // Numa. It is taken from the pool for this snapshot and policy if one is
+  // waiting there and it has no node.
   void Spawn(IsolateMessage* initial_message);
 
   static Isolate* Current() { return current_; }
+  // For moving an isolate between threads; see ScheduledMessageLoop.
+  static void SetCurrent(Isolate* isolate) { current_ = isolate; }
+  static ThreadPool* thread_pool() { return thread_pool_; }
   static void Startup();
   static void Shutdown();
 
+  // How many idle isolates to keep loaded ahead of Spawn for each snapshot
+  // and policy, refilled on the thread pool. 0, the default, keeps none. Set
+  // before running any isolate.
+  static void SetPoolSize(intptr_t size);
+  // Starts filling the pool for the isolates |isolate| will spawn before the
+  // first Spawn needs it.
+  static void WarmPool(Isolate* isolate);
+
+  void GetMetrics(IsolateMetrics* metrics) const;
+  // Takes the metrics of up to |capacity| isolates, including idle ones in
+  // the pool, into |metrics| and |isolates|, and answers how many isolates
+  // there are. Isolates are not stopped, so the metrics of those running on
+  // other threads may be slightly out of date.
+  static intptr_t GetAllMetrics(IsolateMetrics* metrics, Isolate** isolates,
+                                intptr_t capacity);
+
   static void InterruptAll();
   void Interrupt();
   void PrintStack();
 
  private:
   void Activate(Object message, Object port);
+  void Activate(String selector, Object message, Object port);
+  // Whether the message loop takes the messages MessageSerializer wrote
+  // already read, as an Array of their roots; see MessageDeserializer.
+  bool CanActivateObjects();
+  void ActivateObjects(IsolateMessage* first, intptr_t count);
+  ByteArray TakeBytes(IsolateMessage* message);  // SAFEPOINT
+  // Counts the CPU time this thread has spent since |start|.
+  void AddCPUTime(int64_t start);
+  // |message| is kept alive if allocating the port's id collects garbage.
+  Object PortObject(Port port, Object* message);  // SAFEPOINT
 
   Heap* heap_;
   Interpreter* interpreter_;
@@ -58,12 +146,16 @@ class Isolate {
   size_t snapshot_length_;
   uintptr_t salt_;
   Random random_;
+  MappedFiles mapped_files_;
+  AsyncFiles async_files_;
+  RingChannels ring_channels_;
+  int64_t cpu_nanos_;
   Isolate* next_;
 
   void AddIsolateToList(Isolate* isolate);
   void RemoveIsolateFromList(Isolate* isolate);
 
-#if defined(OS_EMSCRIPTEN)
+#if defined(OS_EMSCRIPTEN) && !defined(EMSCRIPTEN_THREADS)
   static Isolate* current_;
 #else
   static thread_local Isolate* current_;
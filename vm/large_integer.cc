@@ -5,6 +5,7 @@
 // Henry S. Warren, Jr. "Hacker's Delight." (2nd Edition) Addison-Wesley. 2012.
 
 #include <math.h>
+#include <string.h>
 
 #include "vm/assert.h"
 #include "vm/heap.h"
@@ -15,6 +16,16 @@ namespace psoup {
 const intptr_t kMintDigits = sizeof(uint64_t) / sizeof(digit_t);
 
 
+// Shift a uint64_t by one digit, which with wide digits is its full width and
+// so not something the shift operators define.
+static uint64_t ShiftDownOneDigit(uint64_t value) {
+  return kDigitBits < 64 ? value >> (kDigitBits % 64) : 0;
+}
+static uint64_t ShiftUpOneDigit(uint64_t value) {
+  return kDigitBits < 64 ? value << (kDigitBits % 64) : 0;
+}
+
+
 LargeInteger LargeInteger::Expand(Object integer, Heap* H) {
   if (integer->IsLargeInteger()) {
     return static_cast<LargeInteger>(integer);
@@ -42,7 +53,7 @@ LargeInteger LargeInteger::Expand(Object integer, Heap* H) {
   intptr_t i = 0;
   while (absolute_value != 0) {
     result->set_digit(i, absolute_value & kDigitMask);
-    absolute_value = absolute_value >> kDigitShift;
+    absolute_value = ShiftDownOneDigit(absolute_value);
     i++;
   }
   result->set_size(i);
@@ -62,7 +73,7 @@ Object LargeInteger::Reduce(LargeInteger large, Heap* H) {
 
   uint64_t absolute_value = 0;
   for (intptr_t i = large->size() - 1; i >= 0; i--) {
-    absolute_value <<= kDigitShift;
+    absolute_value = ShiftUpOneDigit(absolute_value);
     absolute_value |= large->digit(i);
   }
 
@@ -267,6 +278,228 @@ static void AbsAddOneInPlace(LargeInteger result) {
 }
 
 
+// Operands whose shorter side has fewer digits than these are multiplied or
+// squared by the quadratic algorithms, which beat Karatsuba's extra additions
+// and temporaries there. Tuned with the LargeIntegerMultiply benchmark.
+#if defined(ARCH_IS_32_BIT)
+static const intptr_t kKaratsubaThreshold = 48;
+static const intptr_t kKaratsubaSquareThreshold = 64;
+#else
+static const intptr_t kKaratsubaThreshold = 32;
+static const intptr_t kKaratsubaSquareThreshold = 48;
+#endif
+
+
+// The digit routines below work on little-endian digit arrays that do not
+// alias their result.
+
+// r[0, na + nb) = a[0, na) * b[0, nb)
+static void SchoolbookMultiply(const digit_t* a, intptr_t na,
+                               const digit_t* b, intptr_t nb,
+                               digit_t* r) {
+  for (intptr_t i = 0; i < na; i++) {
+    r[i] = 0;
+  }
+  for (intptr_t i = 0; i < nb; i++) {
+    ddigit_t carry = 0;
+    ddigit_t b_digit = b[i];
+    for (intptr_t j = 0; j < na; j++) {
+      carry += static_cast<ddigit_t>(a[j]) * b_digit +
+          static_cast<ddigit_t>(r[i + j]);
+      r[i + j] = carry & kDigitMask;
+      carry >>= kDigitShift;
+    }
+    ASSERT((carry >> kDigitShift) == 0);
+    r[i + na] = carry;
+  }
+}
+
+
+// r[0, 2n) = a[0, n)^2, computing each cross product once.
+static void SchoolbookSquare(const digit_t* a, intptr_t n, digit_t* r) {
+  for (intptr_t i = 0; i < 2 * n; i++) {
+    r[i] = 0;
+  }
+  for (intptr_t i = 0; i < n; i++) {
+    ddigit_t carry = 0;
+    ddigit_t a_digit = a[i];
+    for (intptr_t j = i + 1; j < n; j++) {
+      carry += static_cast<ddigit_t>(a[j]) * a_digit +
+          static_cast<ddigit_t>(r[i + j]);
+      r[i + j] = carry & kDigitMask;
+      carry >>= kDigitShift;
+    }
+    r[i + n] = carry;
+  }
+
+  // Double the cross products, then add the squares on the diagonal.
+  digit_t high_bit = 0;
+  for (intptr_t i = 0; i < 2 * n; i++) {
+    digit_t digit = r[i];
+    r[i] = (digit << 1) | high_bit;
+    high_bit = digit >> (kDigitBits - 1);
+  }
+  ASSERT(high_bit == 0);
+  ddigit_t carry = 0;
+  for (intptr_t i = 0; i < n; i++) {
+    ddigit_t square = static_cast<ddigit_t>(a[i]) * a[i];
+    carry += (square & kDigitMask) + static_cast<ddigit_t>(r[2 * i]);
+    r[2 * i] = carry & kDigitMask;
+    carry >>= kDigitShift;
+    carry += (square >> kDigitShift) + static_cast<ddigit_t>(r[2 * i + 1]);
+    r[2 * i + 1] = carry & kDigitMask;
+    carry >>= kDigitShift;
+  }
+  ASSERT(carry == 0);
+}
+
+
+// r[0, max(na, nb) + 1) = a[0, na) + b[0, nb). Returns the used length.
+static intptr_t AddDigits(const digit_t* a, intptr_t na,
+                          const digit_t* b, intptr_t nb,
+                          digit_t* r) {
+  if (na < nb) {
+    return AddDigits(b, nb, a, na, r);
+  }
+  ddigit_t carry = 0;
+  for (intptr_t i = 0; i < nb; i++) {
+    carry += static_cast<ddigit_t>(a[i]) + static_cast<ddigit_t>(b[i]);
+    r[i] = carry & kDigitMask;
+    carry >>= kDigitShift;
+  }
+  for (intptr_t i = nb; i < na; i++) {
+    carry += static_cast<ddigit_t>(a[i]);
+    r[i] = carry & kDigitMask;
+    carry >>= kDigitShift;
+  }
+  r[na] = carry;
+  return na + 1;
+}
+
+
+// r[0, nr) += a[0, na), where the sum fits in nr digits.
+static void AddDigitsInPlace(digit_t* r, intptr_t nr,
+                             const digit_t* a, intptr_t na) {
+  ASSERT(nr >= na);
+  ddigit_t carry = 0;
+  intptr_t i = 0;
+  for (; i < na; i++) {
+    carry += static_cast<ddigit_t>(r[i]) + static_cast<ddigit_t>(a[i]);
+    r[i] = carry & kDigitMask;
+    carry >>= kDigitShift;
+  }
+  for (; (carry != 0) && (i < nr); i++) {
+    carry += static_cast<ddigit_t>(r[i]);
+    r[i] = carry & kDigitMask;
+    carry >>= kDigitShift;
+  }
+  ASSERT(carry == 0);
+}
+
+
+// r[0, nr) -= a[0, na), where the difference is not negative.
+static void SubtractDigitsInPlace(digit_t* r, intptr_t nr,
+                                  const digit_t* a, intptr_t na) {
+  ASSERT(nr >= na);
+  sddigit_t borrow = 0;
+  intptr_t i = 0;
+  for (; i < na; i++) {
+    borrow += static_cast<ddigit_t>(r[i]) - static_cast<ddigit_t>(a[i]);
+    r[i] = borrow & kDigitMask;
+    borrow >>= kDigitShift;
+  }
+  for (; (borrow != 0) && (i < nr); i++) {
+    borrow += static_cast<ddigit_t>(r[i]);
+    r[i] = borrow & kDigitMask;
+    borrow >>= kDigitShift;
+  }
+  ASSERT(borrow == 0);
+}
+
+
+static void SquareDigits(const digit_t* a, intptr_t n, digit_t* r);
+
+// r[0, na + nb) = a[0, na) * b[0, nb)
+static void MultiplyDigits(const digit_t* a, intptr_t na,
+                           const digit_t* b, intptr_t nb,
+                           digit_t* r) {
+  if (na < nb) {
+    MultiplyDigits(b, nb, a, na, r);
+    return;
+  }
+  if (nb < kKaratsubaThreshold) {
+    SchoolbookMultiply(a, na, b, nb, r);
+    return;
+  }
+
+  if (2 * nb <= na) {
+    // Unbalanced: multiply b by nb-digit slices of a.
+    for (intptr_t i = 0; i < na + nb; i++) {
+      r[i] = 0;
+    }
+    digit_t* product = new digit_t[2 * nb];
+    for (intptr_t start = 0; start < na; start += nb) {
+      intptr_t n = na - start < nb ? na - start : nb;
+      MultiplyDigits(a + start, n, b, nb, product);
+      AddDigitsInPlace(r + start, na + nb - start, product, n + nb);
+    }
+    delete[] product;
+    return;
+  }
+
+  // Karatsuba: with a = a1 B^m + a0 and b = b1 B^m + b0,
+  //   a b = a1 b1 B^2m + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B^m + a0 b0.
+  // Here na / 2 < nb <= na, so b1 is not empty.
+  intptr_t m = na / 2;
+  MultiplyDigits(a, m, b, m, r);
+  MultiplyDigits(a + m, na - m, b + m, nb - m, r + 2 * m);
+
+  digit_t* temp = new digit_t[4 * (na - m + 1)];
+  digit_t* a_sum = temp;
+  digit_t* b_sum = a_sum + (na - m + 1);
+  digit_t* middle = b_sum + (na - m + 1);
+  intptr_t na_sum = AddDigits(a, m, a + m, na - m, a_sum);
+  intptr_t nb_sum = AddDigits(b, m, b + m, nb - m, b_sum);
+  intptr_t n_middle = na_sum + nb_sum;
+  MultiplyDigits(a_sum, na_sum, b_sum, nb_sum, middle);
+  SubtractDigitsInPlace(middle, n_middle, r, 2 * m);
+  SubtractDigitsInPlace(middle, n_middle, r + 2 * m, na + nb - 2 * m);
+  while ((n_middle > 0) && (middle[n_middle - 1] == 0)) {
+    n_middle--;
+  }
+  AddDigitsInPlace(r + m, na + nb - m, middle, n_middle);
+  delete[] temp;
+}
+
+
+// r[0, 2n) = a[0, n)^2
+static void SquareDigits(const digit_t* a, intptr_t n, digit_t* r) {
+  if (n < kKaratsubaSquareThreshold) {
+    SchoolbookSquare(a, n, r);
+    return;
+  }
+
+  // As Karatsuba multiplication with b = a.
+  intptr_t m = n / 2;
+  SquareDigits(a, m, r);
+  SquareDigits(a + m, n - m, r + 2 * m);
+
+  digit_t* temp = new digit_t[3 * (n - m + 1)];
+  digit_t* sum = temp;
+  digit_t* middle = sum + (n - m + 1);
+  intptr_t n_sum = AddDigits(a, m, a + m, n - m, sum);
+  intptr_t n_middle = 2 * n_sum;
+  SquareDigits(sum, n_sum, middle);
+  SubtractDigitsInPlace(middle, n_middle, r, 2 * m);
+  SubtractDigitsInPlace(middle, n_middle, r + 2 * m, 2 * (n - m));
+  while ((n_middle > 0) && (middle[n_middle - 1] == 0)) {
+    n_middle--;
+  }
+  AddDigitsInPlace(r + m, 2 * n - m, middle, n_middle);
+  delete[] temp;
+}
+
+
 LargeInteger MultiplyAbsolutesWithSign(LargeInteger left,
                                         LargeInteger right,
                                         bool negative,
@@ -278,22 +511,12 @@ LargeInteger MultiplyAbsolutesWithSign(LargeInteger left,
   HandleScope h2(H, reinterpret_cast<Object*>(&right));
   LargeInteger result = H->AllocateLargeInteger(left->size() + right->size());
 
-  for (intptr_t i = 0; i < left->size(); i++) {
-    result->set_digit(i, 0);
-  }
-
-  for (intptr_t i = 0; i < right->size(); i++) {
-    ddigit_t carry = 0;
-    ddigit_t right_digit = right->digit(i);
-    for (intptr_t j = 0; j < left->size(); j++) {
-      ddigit_t left_digit = left->digit(j);
-      carry += left_digit * right_digit +
-          static_cast<ddigit_t>(result->digit(i + j));
-      result->set_digit(i + j, carry & kDigitMask);
-      carry >>= kDigitShift;
-    }
-    ASSERT((carry >> kDigitShift) == 0);
-    result->set_digit(i + left->size(), carry);
+  if (left == right) {
+    SquareDigits(left->digits(), left->size(), result->digits());
+  } else {
+    MultiplyDigits(left->digits(), left->size(),
+                   right->digits(), right->size(),
+                   result->digits());
   }
 
   result->set_negative(negative);
@@ -904,6 +1127,335 @@ ATTRIBUTE_UNUSED static intptr_t CountLeadingZeros(uint32_t x) {
 }
 
 
+ATTRIBUTE_UNUSED static intptr_t CountLeadingZeros(uint64_t x) {
+  uint32_t high = static_cast<uint32_t>(x >> 32);
+  if (high != 0) return CountLeadingZeros(high);
+  return 32 + CountLeadingZeros(static_cast<uint32_t>(x));
+}
+
+
+// Divisors and quotients with fewer digits than this are divided by Knuth's
+// algorithm; past it the recursion's multiplications reach Karatsuba sizes.
+// Tuned with the LargeIntegerDivide benchmark.
+#if defined(ARCH_IS_32_BIT)
+static const intptr_t kBurnikelZieglerThreshold = 96;
+#else
+static const intptr_t kBurnikelZieglerThreshold = 64;
+#endif
+
+
+// Compares a[0, na) and b[0, nb), ignoring leading zeros.
+static intptr_t CompareDigits(const digit_t* a, intptr_t na,
+                              const digit_t* b, intptr_t nb) {
+  for (; na > nb; na--) {
+    if (a[na - 1] != 0) return 1;
+  }
+  for (; nb > na; nb--) {
+    if (b[nb - 1] != 0) return -1;
+  }
+  for (intptr_t i = na - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+
+// a[0, n) -= 1, where a is not zero.
+static void DecrementDigits(digit_t* a, intptr_t n) {
+  for (intptr_t i = 0; i < n; i++) {
+    if (a[i]-- != 0) {
+      return;
+    }
+  }
+  UNREACHABLE();
+}
+
+
+// dst[0, nd) = src[0, ns) shifted left by |digits| digits and |bits| bits,
+// which must fit.
+static void ShiftDigitsLeft(const digit_t* src, intptr_t ns,
+                            intptr_t digits, intptr_t bits,
+                            digit_t* dst, intptr_t nd) {
+  ASSERT((bits >= 0) && (bits < static_cast<intptr_t>(kDigitBits)));
+  for (intptr_t i = 0; i < nd; i++) {
+    dst[i] = 0;
+  }
+  for (intptr_t i = 0; i < ns; i++) {
+    ddigit_t shifted = static_cast<ddigit_t>(src[i]) << bits;
+    ASSERT((i + digits < nd) || (shifted == 0));
+    if (i + digits < nd) {
+      dst[i + digits] |= shifted & kDigitMask;
+    }
+    if ((shifted >> kDigitShift) != 0) {
+      ASSERT(i + digits + 1 < nd);
+      dst[i + digits + 1] = shifted >> kDigitShift;
+    }
+  }
+}
+
+
+// dst[0, nd) = src[0, ns) shifted right by |digits| digits and |bits| bits.
+static void ShiftDigitsRight(const digit_t* src, intptr_t ns,
+                             intptr_t digits, intptr_t bits,
+                             digit_t* dst, intptr_t nd) {
+  ASSERT((bits >= 0) && (bits < static_cast<intptr_t>(kDigitBits)));
+  for (intptr_t i = 0; i < nd; i++) {
+    intptr_t j = i + digits;
+    ddigit_t pair = j < ns ? src[j] : 0;
+    if (j + 1 < ns) {
+      pair |= static_cast<ddigit_t>(src[j + 1]) << kDigitShift;
+    }
+    dst[i] = (pair >> bits) & kDigitMask;
+  }
+}
+
+
+// q[0, na) = a[0, na) / d. Answers a[0, na) % d.
+static digit_t DivideDigitsByDigit(const digit_t* a, intptr_t na, digit_t d,
+                                   digit_t* q) {
+  ASSERT(d != 0);
+  ddigit_t remainder = 0;
+  for (intptr_t j = na - 1; j >= 0; j--) {
+    ddigit_t dividend = (remainder << kDigitShift) | a[j];
+    q[j] = dividend / d;
+    remainder = dividend % d;
+  }
+  return remainder;
+}
+
+
+// q[0, na - nb + 1) = a / b and r[0, nb) = a % b, where na >= nb and
+// b[nb - 1] != 0. Knuth's Algorithm D.
+static void SchoolbookDivide(const digit_t* a, intptr_t na,
+                             const digit_t* b, intptr_t nb,
+                             digit_t* q, digit_t* r) {
+  ASSERT((na >= nb) && (nb > 0) && (b[nb - 1] != 0));
+  if (nb == 1) {
+    r[0] = DivideDigitsByDigit(a, na, b[0], q);
+    return;
+  }
+
+  intptr_t m = na;
+  intptr_t n = nb;
+  intptr_t normalize_shift = CountLeadingZeros(b[n - 1]);
+  intptr_t inv_normalize_shift = kDigitBits - normalize_shift;
+  digit_t* norm_div = new digit_t[n];
+  for (intptr_t i = n - 1; i > 0; i--) {
+    norm_div[i] = (b[i] << normalize_shift) |
+        (static_cast<ddigit_t>(b[i - 1]) >> inv_normalize_shift);
+  }
+  norm_div[0] = b[0] << normalize_shift;
+
+  digit_t* norm_rem = new digit_t[m + 1];
+  norm_rem[m] = static_cast<ddigit_t>(a[m - 1]) >> inv_normalize_shift;
+  for (intptr_t i = m - 1; i > 0; i--) {
+    norm_rem[i] = (a[i] << normalize_shift) |
+        (static_cast<ddigit_t>(a[i - 1]) >> inv_normalize_shift);
+  }
+  norm_rem[0] = a[0] << normalize_shift;
+
+  for (intptr_t j = m - n; j >= 0; j--) {
+    ddigit_t p = norm_rem[j+n] * kDigitBase + norm_rem[j+n-1];
+    ddigit_t q_est = p / norm_div[n-1];
+    ddigit_t r_est = p - (q_est * norm_div[n-1]);
+  again:
+    if ((q_est >= kDigitBase) ||
+        (q_est * norm_div[n-2]) > (kDigitBase * r_est + norm_rem[j+n-2])) {
+      q_est = q_est - 1;
+      r_est = r_est + norm_div[n-1];
+      if (r_est < kDigitBase) goto again;
+    }
+
+    sddigit_t k = 0;
+    sddigit_t t;
+    for (intptr_t i = 0; i < n; i++) {
+      ddigit_t p = q_est * norm_div[i];
+      t = norm_rem[i+j] - k - (p & kDigitMask);
+      norm_rem[i+j] = t;
+      k = (p >> kDigitBits) - (t >> kDigitBits);
+    }
+    t = norm_rem[j+n] - k;
+    norm_rem[j+n] = t;
+
+    q[j] = q_est;
+    if (t < 0) {
+      q[j] = q[j] - 1;
+      k = 0;
+      for (intptr_t i = 0; i < n; i++) {
+        t = static_cast<ddigit_t>(norm_rem[i+j]) + norm_div[i] + k;
+        norm_rem[i + j] = t;
+        k = t >> kDigitBits;
+      }
+      norm_rem[j+n] = norm_rem[j+n] + k;
+    }
+  }
+
+  for (intptr_t i = 0; i < n - 1; i++) {
+    r[i] = (norm_rem[i] >> normalize_shift) |
+        (static_cast<ddigit_t>(norm_rem[i + 1]) << inv_normalize_shift);
+  }
+  r[n - 1] = norm_rem[n - 1] >> normalize_shift;
+
+  delete[] norm_div;
+  delete[] norm_rem;
+}
+
+
+// Christoph Burnikel and Joachim Ziegler. "Fast Recursive Division." MPI
+// Research Report MPI-I-98-1-022. 1998.
+//
+// The divisor b below is normalized: its top digit has its top bit set.
+
+static void DivideThreeHalvesByTwo(const digit_t* a, const digit_t* b,
+                                   intptr_t h, digit_t* q, digit_t* r);
+
+// q[0, n) = a[0, 2n) / b[0, n) and r[0, n) = a % b, where a < b B^n.
+static void DivideTwoByOne(const digit_t* a, const digit_t* b, intptr_t n,
+                           digit_t* q, digit_t* r) {
+  if (((n & 1) != 0) || (n < kBurnikelZieglerThreshold)) {
+    digit_t* full_q = new digit_t[n + 1];
+    SchoolbookDivide(a, 2 * n, b, n, full_q, r);
+    ASSERT(full_q[n] == 0);
+    memcpy(q, full_q, n * sizeof(digit_t));
+    delete[] full_q;
+    return;
+  }
+
+  // Divide the top three halves of a, then the remainder followed by the
+  // last half.
+  intptr_t h = n / 2;
+  digit_t* t = new digit_t[3 * h];
+  DivideThreeHalvesByTwo(a + h, b, h, q + h, t + h);
+  memcpy(t, a, h * sizeof(digit_t));
+  DivideThreeHalvesByTwo(t, b, h, q, r);
+  delete[] t;
+}
+
+
+// q[0, h) = a[0, 3h) / b[0, 2h) and r[0, 2h) = a % b, where a < b B^h.
+static void DivideThreeHalvesByTwo(const digit_t* a, const digit_t* b,
+                                   intptr_t h, digit_t* q, digit_t* r) {
+  const digit_t* b_high = b + h;
+  const digit_t* b_low = b;
+
+  // Estimate q from the top two halves of a and the top half of b. The
+  // partial remainder x = (a_high rem b_high) B^h + a_low may need h + 1
+  // digits in its upper part.
+  digit_t* x = new digit_t[2 * h + 1];
+  intptr_t top = CompareDigits(a + 2 * h, h, b_high, h);
+  if (top < 0) {
+    DivideTwoByOne(a + h, b_high, h, q, x + h);
+    x[2 * h] = 0;
+  } else {
+    // The top half of a equals that of b, so q = B^h - 1 and the partial
+    // remainder is a's second half plus b_high.
+    ASSERT(top == 0);
+    for (intptr_t i = 0; i < h; i++) {
+      q[i] = kDigitMask;
+    }
+    AddDigits(a + h, h, b_high, h, x + h);
+  }
+  memcpy(x, a, h * sizeof(digit_t));
+
+  // Subtract q b_low, correcting q at most twice if that goes negative.
+  digit_t* d = new digit_t[2 * h];
+  MultiplyDigits(q, h, b_low, h, d);
+  if (CompareDigits(x, 2 * h + 1, d, 2 * h) >= 0) {
+    SubtractDigitsInPlace(x, 2 * h + 1, d, 2 * h);
+  } else {
+    // d - x is the deficit; add b until it is covered.
+    ASSERT(x[2 * h] == 0);
+    SubtractDigitsInPlace(d, 2 * h, x, 2 * h);
+    for (;;) {
+      DecrementDigits(q, h);
+      if (CompareDigits(b, 2 * h, d, 2 * h) >= 0) {
+        memcpy(x, b, 2 * h * sizeof(digit_t));
+        x[2 * h] = 0;
+        SubtractDigitsInPlace(x, 2 * h + 1, d, 2 * h);
+        break;
+      }
+      SubtractDigitsInPlace(d, 2 * h, b, 2 * h);
+    }
+  }
+  ASSERT(x[2 * h] == 0);
+  memcpy(r, x, 2 * h * sizeof(digit_t));
+  delete[] d;
+  delete[] x;
+}
+
+
+// As SchoolbookDivide.
+static void BurnikelZieglerDivide(const digit_t* a, intptr_t na,
+                                  const digit_t* b, intptr_t nb,
+                                  digit_t* q, digit_t* r) {
+  // Pick a block size n = j 2^k covering b, with j below the threshold, so
+  // DivideTwoByOne can halve it down to schoolbook division.
+  intptr_t m = 1;
+  while (m * kBurnikelZieglerThreshold <= nb) {
+    m <<= 1;
+  }
+  intptr_t j = (nb + m - 1) / m;
+  intptr_t n = j * m;
+
+  // Shift both so b fills exactly n digits and is normalized. The extra
+  // digit keeps the top block of a below b.
+  intptr_t digit_shift = n - nb;
+  intptr_t bit_shift = CountLeadingZeros(b[nb - 1]);
+  intptr_t norm_na = na + digit_shift + 1;
+  intptr_t t = (norm_na + n - 1) / n;
+  if (t < 2) {
+    t = 2;
+  }
+  digit_t* norm_b = new digit_t[n];
+  digit_t* norm_a = new digit_t[t * n];
+  ShiftDigitsLeft(b, nb, digit_shift, bit_shift, norm_b, n);
+  ShiftDigitsLeft(a, na, digit_shift, bit_shift, norm_a, t * n);
+
+  // Divide a block at a time from the top, carrying the remainder down.
+  digit_t* z = new digit_t[2 * n];
+  digit_t* rem = new digit_t[n];
+  digit_t* block_q = new digit_t[(t - 1) * n];
+  memcpy(z, norm_a + (t - 2) * n, 2 * n * sizeof(digit_t));
+  for (intptr_t i = t - 2; i >= 0; i--) {
+    DivideTwoByOne(z, norm_b, n, block_q + i * n, rem);
+    if (i > 0) {
+      memcpy(z, norm_a + (i - 1) * n, n * sizeof(digit_t));
+      memcpy(z + n, rem, n * sizeof(digit_t));
+    }
+  }
+
+  intptr_t nq = na - nb + 1;
+  ASSERT((t - 1) * n >= nq);
+  memcpy(q, block_q, nq * sizeof(digit_t));
+  for (intptr_t i = nq; i < (t - 1) * n; i++) {
+    ASSERT(block_q[i] == 0);
+  }
+  ShiftDigitsRight(rem, n, digit_shift, bit_shift, r, nb);
+
+  delete[] norm_b;
+  delete[] norm_a;
+  delete[] z;
+  delete[] rem;
+  delete[] block_q;
+}
+
+
+// q[0, na - nb + 1) = a / b and r[0, nb) = a % b, where na >= nb and
+// b[nb - 1] != 0.
+static void DivideDigits(const digit_t* a, intptr_t na,
+                         const digit_t* b, intptr_t nb,
+                         digit_t* q, digit_t* r) {
+  if ((nb < kBurnikelZieglerThreshold) ||
+      (na - nb < kBurnikelZieglerThreshold)) {
+    SchoolbookDivide(a, na, b, nb, q, r);
+  } else {
+    BurnikelZieglerDivide(a, na, b, nb, q, r);
+  }
+}
+
+
 LargeInteger LargeInteger::Divide(DivOperationType op_type,
                                    DivResultType result_type,
                                    LargeInteger dividend,
@@ -982,15 +1534,8 @@ LargeInteger LargeInteger::Divide(DivOperationType op_type,
     // Single-digit divisor.
 
     digit_t divisor_d = divisor->digit(0);
-    ddigit_t remainder_d = 0;
-    for (intptr_t j = m - 1; j >= 0; j--) {
-      digit_t dividend_d = dividend->digit(j);
-      digit_t quoitent_d = (remainder_d * kDigitBase + dividend_d) / divisor_d;
-      quoitent->set_digit(j, quoitent_d);
-      remainder_d = (remainder_d * kDigitBase + dividend_d) -
-          (static_cast<ddigit_t>(quoitent_d) *
-           static_cast<ddigit_t>(divisor_d));
-    }
+    ddigit_t remainder_d = DivideDigitsByDigit(dividend->digits(), m, divisor_d,
+                                               quoitent->digits());
     Clamp(quoitent);
     Verify(quoitent);
 
@@ -1069,76 +1614,23 @@ LargeInteger LargeInteger::Divide(DivOperationType op_type,
 
   // Multi-digit divisor.
 
-  intptr_t normalize_shift = CountLeadingZeros(divisor->digit(n - 1));
-  intptr_t inv_normalize_shift = kDigitBits - normalize_shift;
-  digit_t* norm_div = new digit_t[n];
-  for (intptr_t i = n - 1; i > 0; i--) {
-    norm_div[i] = (divisor->digit(i) << normalize_shift) |
-        (static_cast<ddigit_t>(divisor->digit(i - 1)) >>
-            inv_normalize_shift);
-  }
-  norm_div[0] = divisor->digit(0) << normalize_shift;
-
-  digit_t* norm_rem = new digit_t[m + 1];
-  norm_rem[m] = static_cast<ddigit_t>(dividend->digit(m-1)) >>
-      inv_normalize_shift;
-  for (intptr_t i = m - 1; i > 0; i--) {
-    norm_rem[i] = (dividend->digit(i) << normalize_shift) |
-        (static_cast<ddigit_t>(dividend->digit(i - 1)) >>
-            inv_normalize_shift);
-  }
-  norm_rem[0] = dividend->digit(0) << normalize_shift;
-
-  for (intptr_t j = m - n; j >= 0; j--) {
-    ddigit_t p = norm_rem[j+n] * kDigitBase + norm_rem[j+n-1];
-    ddigit_t q_est = p / norm_div[n-1];
-    ddigit_t r_est = p - (q_est * norm_div[n-1]);
-  again:
-    if ((q_est >= kDigitBase) ||
-        (q_est * norm_div[n-2]) > (kDigitBase * r_est + norm_rem[j+n-2])) {
-      q_est = q_est - 1;
-      r_est = r_est + norm_div[n-1];
-      if (r_est < kDigitBase) goto again;
-    }
-
-    sddigit_t k = 0;
-    sddigit_t t;
-    for (intptr_t i = 0; i < n; i++) {
-      ddigit_t p = q_est * norm_div[i];
-      t = norm_rem[i+j] - k - (p & kDigitMask);
-      norm_rem[i+j] = t;
-      k = (p >> kDigitBits) - (t >> kDigitBits);
-    }
-    t = norm_rem[j+n] - k;
-    norm_rem[j+n] = t;
-
-    quoitent->set_digit(j, q_est);
-    if (t < 0) {
-      quoitent->set_digit(j, quoitent->digit(j) - 1);
-      k = 0;
-      for (intptr_t i = 0; i < n; i++) {
-        t = static_cast<ddigit_t>(norm_rem[i+j]) + norm_div[i] + k;
-        norm_rem[i + j] = t;
-        k = t >> kDigitBits;
-      }
-      norm_rem[j+n] = norm_rem[j+n] + k;
-    }
-  }
+  digit_t* rem = new digit_t[n];
+  DivideDigits(dividend->digits(), m, divisor->digits(), n,
+               quoitent->digits(), rem);
 
   if (result_type == kQuoitent) {
     Clamp(quoitent);
     Verify(quoitent);
 
     bool remainder_is_zero = true;
-    for (intptr_t i = 0; i <= n; i++) {
-      if (norm_rem[i] != 0) {
+    for (intptr_t i = 0; i < n; i++) {
+      if (rem[i] != 0) {
         remainder_is_zero = false;
         break;
       }
     }
 
-    delete[] norm_div;
-    delete[] norm_rem;
+    delete[] rem;
 
     if (op_type == kTruncated) {
       return quoitent;
@@ -1167,18 +1659,11 @@ LargeInteger LargeInteger::Divide(DivOperationType op_type,
   if (result_type == kRemainder) {
     LargeInteger remainder = H->AllocateLargeInteger(n);
     remainder->set_negative(dividend->negative());
-    for (intptr_t i = 0; i < n - 1; i++) {
-      digit_t d = (norm_rem[i] >> normalize_shift) |
-          (static_cast<ddigit_t>(norm_rem[i + 1]) <<
-              inv_normalize_shift);
-      remainder->set_digit(i, d);
-    }
-    remainder->set_digit(n - 1, norm_rem[n - 1] >> normalize_shift);
+    memcpy(remainder->digits(), rem, n * sizeof(digit_t));
 
     Clamp(remainder);
     Verify(remainder);
-    delete[] norm_div;
-    delete[] norm_rem;
+    delete[] rem;
 
     if (op_type == kTruncated) {
       return remainder;
@@ -1198,68 +1683,129 @@ LargeInteger LargeInteger::Divide(DivOperationType op_type,
 }
 
 
-String LargeInteger::PrintString(LargeInteger large, Heap* H) {
 #if defined(ARCH_IS_32_BIT)
-  const ddigit_t kDivisor = 10000;
-  const intptr_t kDivisorLog10 = 4;
+static const ddigit_t kDecimalChunk = 10000;
+static const intptr_t kDecimalChunkLog10 = 4;
+#elif defined(USING_WIDE_DIGITS)
+static const ddigit_t kDecimalChunk = 10000000000000000000ULL;
+static const intptr_t kDecimalChunkLog10 = 19;
 #elif defined(ARCH_IS_64_BIT)
-  const ddigit_t kDivisor = 1000000000;
-  const intptr_t kDivisorLog10 = 9;
+static const ddigit_t kDecimalChunk = 1000000000;
+static const intptr_t kDecimalChunkLog10 = 9;
 #endif
-  ASSERT(kDivisor < kDigitBase);
-  // log10(2) = 0.30102999566398114
-  const intptr_t kLog2Dividend = 30103;
-  const intptr_t kLog2Divisor = 100000;
-  intptr_t binary_digits = large->size() * sizeof(digit_t) * kBitsPerByte;
-  intptr_t est_decimal_digits =
-      (binary_digits * kLog2Dividend / kLog2Divisor) + 1 + kDivisorLog10;
-  if (large->negative()) {
-    est_decimal_digits++;
-  }
+// Numbers with fewer digits than this are converted to decimal by repeated
+// division by kDecimalChunk, which is quadratic but has no setup. Tuned with
+// the LargeIntegerDivide benchmark.
+static const intptr_t kDecimalConversionThreshold = 48;
 
-  char* chars = new char[est_decimal_digits];
-  intptr_t pos = est_decimal_digits;
 
-  digit_t* scratch = new digit_t[large->size()];
-  for (intptr_t i = 0; i < large->size(); i++) {
-    scratch[i] = large->digit(i);
-  }
+// Writes a[0, n) as exactly |width| decimal characters, with leading zeros.
+static void SchoolbookPrintDecimal(const digit_t* a, intptr_t n,
+                                   char* chars, intptr_t width) {
+  ASSERT(kDecimalChunk < kDigitBase);
+  digit_t* scratch = new digit_t[n];
+  memcpy(scratch, a, n * sizeof(digit_t));
 
-  intptr_t used = large->size();
+  intptr_t pos = width;
+  intptr_t used = n;
+  while ((used > 0) && (scratch[used - 1] == 0)) {
+    used--;
+  }
   while (used > 0) {
-    digit_t remainder = 0;
-    for (intptr_t i = used - 1; i >= 0; i--) {
-      ddigit_t dividend =
-          (static_cast<ddigit_t>(remainder) << kDigitShift) + scratch[i];
-      digit_t quotient = dividend / kDivisor;
-      remainder = dividend - (static_cast<ddigit_t>(quotient) * kDivisor);
-      scratch[i] = quotient;
-    }
+    digit_t remainder = DivideDigitsByDigit(scratch, used, kDecimalChunk,
+                                            scratch);
     while ((used > 0) && (scratch[used - 1] == 0)) {
       used--;
     }
-    for (intptr_t i = 0; i < kDivisorLog10; i++) {
+    for (intptr_t i = 0; i < kDecimalChunkLog10; i++) {
+      ASSERT(pos > 0);
       chars[--pos] = '0' + (remainder % 10);
       remainder /= 10;
     }
     ASSERT(remainder == 0);
   }
+  while (pos > 0) {
+    chars[--pos] = '0';
+  }
+
+  delete[] scratch;
+}
+
+
+// Writes a[0, n) < powers[level + 1] as exactly |width| decimal characters,
+// with leading zeros, by splitting it at powers[level] and converting both
+// halves. powers[i] is kDecimalChunk^(2^i) and has sizes[i] digits.
+static void PrintDecimal(const digit_t* a, intptr_t n, intptr_t level,
+                         digit_t** powers, const intptr_t* sizes,
+                         char* chars, intptr_t width) {
+  while ((n > 0) && (a[n - 1] == 0)) {
+    n--;
+  }
+  if ((level < 0) || (n < kDecimalConversionThreshold)) {
+    SchoolbookPrintDecimal(a, n, chars, width);
+    return;
+  }
+
+  intptr_t half = width / 2;
+  const digit_t* power = powers[level];
+  intptr_t np = sizes[level];
+  if (n < np) {
+    memset(chars, '0', half);
+    PrintDecimal(a, n, level - 1, powers, sizes, chars + half, half);
+    return;
+  }
+  digit_t* q = new digit_t[n - np + 1];
+  digit_t* r = new digit_t[np];
+  DivideDigits(a, n, power, np, q, r);
+  PrintDecimal(q, n - np + 1, level - 1, powers, sizes, chars, half);
+  PrintDecimal(r, np, level - 1, powers, sizes, chars + half, half);
+  delete[] q;
+  delete[] r;
+}
+
+
+String LargeInteger::PrintString(LargeInteger large, Heap* H) {
+  // Square kDecimalChunk until it exceeds the number.
+  const intptr_t kMaxLevels = kBitsPerWord;
+  digit_t* powers[kMaxLevels];
+  intptr_t sizes[kMaxLevels];
+  intptr_t levels = 0;
+  powers[0] = new digit_t[1];
+  powers[0][0] = kDecimalChunk;
+  sizes[0] = 1;
+  while (sizes[levels] <= large->size()) {
+    ASSERT(levels + 1 < kMaxLevels);
+    intptr_t n = sizes[levels];
+    digit_t* square = new digit_t[2 * n];
+    SquareDigits(powers[levels], n, square);
+    n = 2 * n;
+    while (square[n - 1] == 0) {
+      n--;
+    }
+    levels++;
+    powers[levels] = square;
+    sizes[levels] = n;
+  }
+
+  intptr_t width = kDecimalChunkLog10 << levels;
+  char* chars = new char[width + 1];
+  PrintDecimal(large->digits(), large->size(), levels - 1, powers, sizes,
+               chars + 1, width);
+  for (intptr_t i = 0; i <= levels; i++) {
+    delete[] powers[i];
+  }
 
-  ASSERT((0 <= pos) && (pos < est_decimal_digits));
   // Remove leading zeros.
-  while ((pos < est_decimal_digits) && (chars[pos] == '0')) {
+  intptr_t pos = 1;
+  while ((pos < width) && (chars[pos] == '0')) {
     pos++;
   }
-  ASSERT((0 <= pos) && (pos < est_decimal_digits));
   if (large->negative()) {
     chars[--pos] = '-';
   }
-  ASSERT((0 <= pos) && (pos < est_decimal_digits));
-
-  delete[] scratch;
 
-  intptr_t nchars = est_decimal_digits - pos;
-  String result = H->AllocateString(nchars);
+  intptr_t nchars = width + 1 - pos;
+  String result = H->AllocateString(nchars);  // SAFEPOINT
   memcpy(result->element_addr(0), &chars[pos], nchars);
 
   delete[] chars;
@@ -1271,7 +1817,6 @@ String LargeInteger::PrintString(LargeInteger large, Heap* H) {
 double LargeInteger::AsDouble(LargeInteger integer) {
   intptr_t used = integer->size();
   ASSERT(used >= kMintDigits);
-  ASSERT(used >= 2);
   const intptr_t kBitsPerDigit = kDigitBits;
 
   static const int kPhysicalSignificandSize = 52;
@@ -1313,37 +1858,34 @@ double LargeInteger::AsDouble(LargeInteger integer) {
     return integer->negative() ? -infinity : infinity;
   }
 
-  intptr_t digit_index = used - 1;
   // In order to round correctly we need to look at half-way cases. Therefore we
   // get kSignificandSize + 1 bits. If the last bit is 1 then we have to look
-  // at the remaining bits to know if we have to round up.
-  int needed_bits = kSignificandSize + 1;
-  // ASSERT((kBitsPerDigit < needed_bits) &&
-  //        (2 * kBitsPerDigit >= needed_bits));
-  bool discarded_bits_were_zero = true;
-
-  const digit_t firstDigit = integer->digit(digit_index--);
-  ASSERT(firstDigit > 0);
-  uint64_t twice_significand_floor = firstDigit;
-  intptr_t twice_significant_exponent = (digit_index + 1) * kBitsPerDigit;
-  needed_bits -= Utils::HighestBit(firstDigit) + 1;
-
-  while (needed_bits >= kBitsPerDigit) {
-    twice_significand_floor <<= kBitsPerDigit;
-    twice_significand_floor |= integer->digit(digit_index--);
-    twice_significant_exponent -= kBitsPerDigit;
-    needed_bits -= kBitsPerDigit;
-  }
-  if (needed_bits > 0) {
-    ASSERT(needed_bits <= kBitsPerDigit);
-    uint32_t digit = integer->digit(digit_index--);
-    int discarded_bits_count = kBitsPerDigit - needed_bits;
-    twice_significand_floor <<= needed_bits;
-    twice_significand_floor |= digit >> discarded_bits_count;
-    twice_significant_exponent -= needed_bits;
-    uint64_t discarded_bits_mask = (kOne64 << discarded_bits_count) - 1;
-    discarded_bits_were_zero = ((digit & discarded_bits_mask) == 0);
-  }
+  // at the remaining bits to know if we have to round up. These bits start at
+  // bit |low|, which need not be at a digit boundary, and may span digits.
+  const int needed_bits = kSignificandSize + 1;
+  const digit_t first_digit = integer->digit(used - 1);
+  ASSERT(first_digit > 0);
+  intptr_t bit_length =
+      used * kBitsPerDigit - CountLeadingZeros(first_digit);
+  ASSERT(bit_length > needed_bits);
+  intptr_t low = bit_length - needed_bits;
+  intptr_t digit_index = low / kBitsPerDigit;
+  intptr_t bit_index = low % kBitsPerDigit;
+
+  digit_t low_digit = integer->digit(digit_index);
+  uint64_t twice_significand_floor = low_digit >> bit_index;
+  intptr_t have_bits = kBitsPerDigit - bit_index;
+  for (intptr_t i = digit_index + 1; have_bits < needed_bits; i++) {
+    twice_significand_floor |=
+        static_cast<uint64_t>(integer->digit(i)) << have_bits;
+    have_bits += kBitsPerDigit;
+  }
+  twice_significand_floor &= (kOne64 << needed_bits) - 1;
+  intptr_t twice_significant_exponent = low;
+  uint64_t discarded_bits_mask = (kOne64 << bit_index) - 1;
+  bool discarded_bits_were_zero = ((low_digit & discarded_bits_mask) == 0);
+  // The digits wholly below the needed bits.
+  digit_index--;
   ASSERT((twice_significand_floor >> kSignificandSize) == 1);
 
   // We might need to round up the significand later.
@@ -1595,7 +2137,7 @@ bool LargeInteger::AsUint64(Object integer, uint64_t* result) {
     }
     uint64_t value = 0;
     for (intptr_t i = large->size() - 1; i >= 0; i--) {
-      value <<= kDigitShift;
+      value = ShiftUpOneDigit(value);
       value |= large->digit(i);
     }
     *result = value;
@@ -1617,7 +2159,7 @@ Object LargeInteger::FromUint64(uint64_t raw_value, Heap* H) {
     LargeInteger large = H->AllocateLargeInteger(kDigits);
     for (intptr_t i = 0; i < kDigits; i++) {
       large->set_digit(i, raw_value & kDigitMask);
-      raw_value = raw_value >> kDigitShift;
+      raw_value = ShiftDownOneDigit(raw_value);
     }
     large->set_negative(false);
     large->set_size(kDigits);
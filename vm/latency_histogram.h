@@ -0,0 +1,137 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_LATENCY_HISTOGRAM_H_
+#define VM_LATENCY_HISTOGRAM_H_
+
+#include "vm/atomic.h"
+#include "vm/globals.h"
+#include "vm/utils.h"
+
+namespace psoup {
+
+// What an isolate's histograms time: how long each kind of event waited
+// before it was dispatched, and how long its handler then ran.
+enum LatencyKind {
+  kMessageWait,
+  kMessageRun,
+  kWakeupWait,
+  kWakeupRun,
+  kSignalWait,
+  kSignalRun,
+  kNumLatencyKinds
+};
+
+// A histogram's count, total and percentiles, in nanoseconds. Each
+// percentile is the highest value its bucket holds, so it overstates by at
+// most 1/16.
+struct LatencySummary {
+  int64_t count;
+  int64_t total;
+  int64_t p50;
+  int64_t p90;
+  int64_t p99;
+  int64_t p999;
+  int64_t max;
+};
+
+// Durations in nanoseconds counted in log-linear buckets, in the manner of
+// HdrHistogram: exact below 16, and then 16 buckets per power of two, up to
+// about 73 minutes. Recorded by one thread, but may be summarized by others
+// meanwhile.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : total_(0), max_(0) {
+    for (intptr_t i = 0; i < kNumBuckets; i++) {
+      counts_[i] = 0;
+    }
+  }
+
+  void Record(int64_t nanos) {
+    if (nanos < 0) {
+      nanos = 0;  // The clock is monotonic, but stamps may cross threads.
+    }
+    intptr_t bucket = BucketFor(nanos);
+    AtomicOperations::StoreRelaxed(&counts_[bucket], counts_[bucket] + 1);
+    AtomicOperations::StoreRelaxed(&total_, total_ + nanos);
+    if (nanos > max_) {
+      AtomicOperations::StoreRelaxed(&max_, nanos);
+    }
+  }
+
+  void Summarize(LatencySummary* summary) const {
+    int64_t counts[kNumBuckets];
+    int64_t count = 0;
+    for (intptr_t i = 0; i < kNumBuckets; i++) {
+      counts[i] =
+          AtomicOperations::LoadRelaxed(const_cast<int64_t*>(&counts_[i]));
+      count += counts[i];
+    }
+    summary->count = count;
+    summary->total =
+        AtomicOperations::LoadRelaxed(const_cast<int64_t*>(&total_));
+    summary->max = AtomicOperations::LoadRelaxed(const_cast<int64_t*>(&max_));
+    summary->p50 = Percentile(counts, count, 500, summary->max);
+    summary->p90 = Percentile(counts, count, 900, summary->max);
+    summary->p99 = Percentile(counts, count, 990, summary->max);
+    summary->p999 = Percentile(counts, count, 999, summary->max);
+  }
+
+ private:
+  static constexpr intptr_t kSubBucketBits = 4;
+  static constexpr intptr_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr intptr_t kMaxBit = 42;
+  static constexpr intptr_t kNumBuckets =
+      (kMaxBit - kSubBucketBits + 2) * kSubBuckets;
+
+  static intptr_t BucketFor(int64_t nanos) {
+    if (nanos < kSubBuckets) {
+      return nanos;
+    }
+    intptr_t bit = Utils::HighestBit(nanos);
+    if (bit > kMaxBit) {
+      return kNumBuckets - 1;
+    }
+    intptr_t shift = bit - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((nanos >> shift) - kSubBuckets);
+  }
+
+  static int64_t HighestIn(intptr_t bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    intptr_t shift = bucket / kSubBuckets - 1;
+    int64_t lowest = static_cast<int64_t>(kSubBuckets + bucket % kSubBuckets)
+                     << shift;
+    return lowest + (static_cast<int64_t>(1) << shift) - 1;
+  }
+
+  // |permille| of the |count| values are at most the answer.
+  static int64_t Percentile(const int64_t* counts, int64_t count,
+                            int64_t permille, int64_t max) {
+    if (count == 0) {
+      return 0;
+    }
+    int64_t rank = (count * permille + 999) / 1000;
+    int64_t seen = 0;
+    for (intptr_t i = 0; i < kNumBuckets; i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        int64_t highest = HighestIn(i);
+        return highest < max ? highest : max;
+      }
+    }
+    return max;
+  }
+
+  int64_t counts_[kNumBuckets];
+  int64_t total_;
+  int64_t max_;
+
+  DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+}  // namespace psoup
+
+#endif  // VM_LATENCY_HISTOGRAM_H_
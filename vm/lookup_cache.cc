@@ -4,23 +4,103 @@
 
 #include "vm/lookup_cache.h"
 
+#include <stdlib.h>
+
+#include "vm/heap.h"
+
 namespace psoup {
 
+SelectorSet::SelectorSet() : entries_(nullptr), mask_(0), size_(0) {
+  const intptr_t capacity = 16;
+  entries_ = new String[capacity];
+  for (intptr_t i = 0; i < capacity; i++) {
+    entries_[i] = nullptr;
+  }
+  mask_ = capacity - 1;
+}
+
+
+SelectorSet::~SelectorSet() {
+  delete[] entries_;
+}
+
+
+void SelectorSet::Add(String selector) {
+  if (Contains(selector)) {
+    return;
+  }
+  intptr_t capacity = mask_ + 1;
+  if (2 * (size_ + 1) > capacity) {
+    String* old_entries = entries_;
+    intptr_t new_capacity = capacity * 2;
+    entries_ = new String[new_capacity];
+    for (intptr_t i = 0; i < new_capacity; i++) {
+      entries_[i] = nullptr;
+    }
+    mask_ = new_capacity - 1;
+    size_ = 0;
+    for (intptr_t i = 0; i < capacity; i++) {
+      if (old_entries[i] != nullptr) {
+        Add(old_entries[i]);
+      }
+    }
+    delete[] old_entries;
+  }
+  uword index = Hash(selector) & mask_;
+  while (entries_[index] != nullptr) {
+    index = (index + 1) & mask_;
+  }
+  entries_[index] = selector;
+  size_++;
+}
+
+
+LookupCache::LookupCache() :
+    ordinary_(nullptr),
+    ordinary_mask_(0),
+    ns_(nullptr),
+    ns_mask_(0),
+    stats_(),
+    ordinary_evictions_at_clear_(0),
+    ns_evictions_at_clear_(0) {
+  ordinary_ = reinterpret_cast<OrdinaryEntry*>(
+      malloc(kInitialSize * sizeof(OrdinaryEntry)));
+  ordinary_mask_ = kInitialSize - 1;
+  stats_.ordinary_size = kInitialSize;
+  ns_ = reinterpret_cast<NSEntry*>(malloc(kInitialSize * sizeof(NSEntry)));
+  ns_mask_ = kInitialSize - 1;
+  stats_.ns_size = kInitialSize;
+  Clear();
+}
+
+
+LookupCache::~LookupCache() {
+  free(ordinary_);
+  free(ns_);
+}
+
+
 void LookupCache::InsertOrdinary(intptr_t cid,
                                  String selector,
                                  Method target) {
   intptr_t hash = cid
       ^ (static_cast<intptr_t>(selector) >> kObjectAlignmentLog2);
 
-  intptr_t probe1 = hash & kMask;
-  entries_[probe1].ordinary_cid = cid;
-  entries_[probe1].ordinary_selector = selector;
-  entries_[probe1].ordinary_target = target;
+  intptr_t probe1 = hash & ordinary_mask_;
+  if (ordinary_[probe1].cid != kIllegalCid) {
+    stats_.ordinary_evictions++;
+  }
+  ordinary_[probe1].cid = cid;
+  ordinary_[probe1].selector = selector;
+  ordinary_[probe1].target = target;
 
-  intptr_t probe2 = (hash >> 3) & kMask;
-  entries_[probe2].ordinary_cid = cid;
-  entries_[probe2].ordinary_selector = selector;
-  entries_[probe2].ordinary_target = target;
+  intptr_t probe2 = (hash >> 3) & ordinary_mask_;
+  if (probe2 != probe1 && ordinary_[probe2].cid != kIllegalCid) {
+    stats_.ordinary_evictions++;
+  }
+  ordinary_[probe2].cid = cid;
+  ordinary_[probe2].selector = selector;
+  ordinary_[probe2].target = target;
 }
 
 
@@ -35,26 +115,96 @@ void LookupCache::InsertNS(intptr_t cid,
       ^ (static_cast<intptr_t>(caller) >> kObjectAlignmentLog2);
   intptr_t cid_and_rule = (cid << 16) | rule;
 
-  intptr_t probe1 = hash & kMask;
-  entries_[probe1].ns_cid_and_rule = cid_and_rule;
-  entries_[probe1].ns_selector = selector;
-  entries_[probe1].ns_caller = caller;
-  entries_[probe1].ns_target = target;
-  entries_[probe1].ns_absent_receiver = absent_receiver;
+  intptr_t probe1 = hash & ns_mask_;
+  if (ns_[probe1].cid_and_rule != (kIllegalCid << 16)) {
+    stats_.ns_evictions++;
+  }
+  ns_[probe1].cid_and_rule = cid_and_rule;
+  ns_[probe1].selector = selector;
+  ns_[probe1].caller = caller;
+  ns_[probe1].target = target;
+  ns_[probe1].absent_receiver = absent_receiver;
 
-  intptr_t probe2 = (hash >> 3) & kMask;
-  entries_[probe2].ns_cid_and_rule = cid_and_rule;
-  entries_[probe2].ns_selector = selector;
-  entries_[probe2].ns_caller = caller;
-  entries_[probe2].ns_target = target;
-  entries_[probe2].ns_absent_receiver = absent_receiver;
+  intptr_t probe2 = (hash >> 3) & ns_mask_;
+  if (probe2 != probe1 && ns_[probe2].cid_and_rule != (kIllegalCid << 16)) {
+    stats_.ns_evictions++;
+  }
+  ns_[probe2].cid_and_rule = cid_and_rule;
+  ns_[probe2].selector = selector;
+  ns_[probe2].caller = caller;
+  ns_[probe2].target = target;
+  ns_[probe2].absent_receiver = absent_receiver;
 }
 
 
 void LookupCache::Clear() {
-  for (intptr_t i = 0; i < kSize; i++) {
-    entries_[i].ordinary_cid = kIllegalCid;
-    entries_[i].ns_cid_and_rule = kIllegalCid << 16;
+  intptr_t ordinary_size = ordinary_mask_ + 1;
+  if ((stats_.ordinary_evictions - ordinary_evictions_at_clear_ >
+       ordinary_size) && (ordinary_size < kMaxSize)) {
+    ordinary_size *= 2;
+    free(ordinary_);
+    ordinary_ = reinterpret_cast<OrdinaryEntry*>(
+        malloc(ordinary_size * sizeof(OrdinaryEntry)));
+    ordinary_mask_ = ordinary_size - 1;
+    stats_.ordinary_size = ordinary_size;
+  }
+  ordinary_evictions_at_clear_ = stats_.ordinary_evictions;
+  for (intptr_t i = 0; i < ordinary_size; i++) {
+    ordinary_[i].cid = kIllegalCid;
+  }
+
+  intptr_t ns_size = ns_mask_ + 1;
+  if ((stats_.ns_evictions - ns_evictions_at_clear_ > ns_size) &&
+      (ns_size < kMaxSize)) {
+    ns_size *= 2;
+    free(ns_);
+    ns_ = reinterpret_cast<NSEntry*>(malloc(ns_size * sizeof(NSEntry)));
+    ns_mask_ = ns_size - 1;
+    stats_.ns_size = ns_size;
+  }
+  ns_evictions_at_clear_ = stats_.ns_evictions;
+  for (intptr_t i = 0; i < ns_size; i++) {
+    ns_[i].cid_and_rule = kIllegalCid << 16;
+  }
+}
+
+
+// Forwarders are left only by a become, and the class ids of the new classes
+// it swapped out are freed by the time this runs.
+static bool IsStale(intptr_t cid, Heap* heap) {
+  return heap->ClassAt(cid)->IsSmallInteger();
+}
+
+
+void LookupCache::Invalidate(const SelectorSet& changed, Heap* heap) {
+  intptr_t ordinary_size = ordinary_mask_ + 1;
+  for (intptr_t i = 0; i < ordinary_size; i++) {
+    OrdinaryEntry* entry = &ordinary_[i];
+    if (entry->cid == kIllegalCid) {
+      continue;
+    }
+    if (changed.Contains(entry->selector) ||
+        entry->selector->IsForwardingCorpse() ||
+        entry->target->IsForwardingCorpse() ||
+        IsStale(entry->cid, heap)) {
+      entry->cid = kIllegalCid;
+    }
+  }
+
+  intptr_t ns_size = ns_mask_ + 1;
+  for (intptr_t i = 0; i < ns_size; i++) {
+    NSEntry* entry = &ns_[i];
+    if (entry->cid_and_rule == (kIllegalCid << 16)) {
+      continue;
+    }
+    if (changed.Contains(entry->selector) ||
+        entry->selector->IsForwardingCorpse() ||
+        entry->caller->IsForwardingCorpse() ||
+        entry->absent_receiver->IsForwardingCorpse() ||
+        entry->target->IsForwardingCorpse() ||
+        IsStale(entry->cid_and_rule >> 16, heap)) {
+      entry->cid_and_rule = kIllegalCid << 16;
+    }
   }
 }
 
@@ -10,6 +10,8 @@
 
 namespace psoup {
 
+class Heap;
+
 enum LookupRule {
   kSelf = 0,
   kSuper = 256,
@@ -17,12 +19,63 @@ enum LookupRule {
   kMNU = 258,
 };
 
-class LookupCache {
+// The selectors whose lookups a become may have changed, so the caches need
+// drop only their entries rather than be cleared. Selectors are canonical and
+// do not move during a become, so the set hashes their addresses.
+class SelectorSet {
  public:
-  LookupCache() {
-    Clear();
+  SelectorSet();
+  ~SelectorSet();
+
+  void Add(String selector);
+  bool Contains(String selector) const {
+    uword index = Hash(selector) & mask_;
+    while (entries_[index] != nullptr) {
+      if (entries_[index] == selector) {
+        return true;
+      }
+      index = (index + 1) & mask_;
+    }
+    return false;
+  }
+
+  intptr_t size() const { return size_; }
+
+ private:
+  static uword Hash(String selector) {
+    uword key = static_cast<uword>(selector);
+    return key ^ (key >> kObjectAlignmentLog2);
   }
 
+  String* entries_;
+  uword mask_;
+  intptr_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(SelectorSet);
+};
+
+// Ordinary and NS lookups have separate tables so they do not evict each
+// other. Each table starts at kInitialSize entries and doubles, up to
+// kMaxSize, when it is cleared after having evicted more entries than it holds
+// since the last clear. Clearing happens after every GC anyway, so growing
+// never needs to rehash.
+class LookupCache {
+ public:
+  // Cumulative over the life of the cache, except for the current sizes.
+  struct Statistics {
+    int64_t ordinary_size;
+    int64_t ordinary_hits;
+    int64_t ordinary_misses;
+    int64_t ordinary_evictions;
+    int64_t ns_size;
+    int64_t ns_hits;
+    int64_t ns_misses;
+    int64_t ns_evictions;
+  };
+
+  LookupCache();
+  ~LookupCache();
+
   INLINE
   bool LookupOrdinary(intptr_t cid,
                       String selector,
@@ -30,20 +83,23 @@ class LookupCache {
     intptr_t hash = cid
         ^ (static_cast<intptr_t>(selector) >> kObjectAlignmentLog2);
 
-    intptr_t probe1 = hash & kMask;
-    if (entries_[probe1].ordinary_cid == cid &&
-        entries_[probe1].ordinary_selector == selector) {
-      *target = entries_[probe1].ordinary_target;
+    intptr_t probe1 = hash & ordinary_mask_;
+    if (ordinary_[probe1].cid == cid &&
+        ordinary_[probe1].selector == selector) {
+      *target = ordinary_[probe1].target;
+      stats_.ordinary_hits++;
       return true;
     }
 
-    intptr_t probe2 = (hash >> 3) & kMask;
-    if (entries_[probe2].ordinary_cid == cid &&
-        entries_[probe2].ordinary_selector == selector) {
-      *target = entries_[probe2].ordinary_target;
+    intptr_t probe2 = (hash >> 3) & ordinary_mask_;
+    if (ordinary_[probe2].cid == cid &&
+        ordinary_[probe2].selector == selector) {
+      *target = ordinary_[probe2].target;
+      stats_.ordinary_hits++;
       return true;
     }
 
+    stats_.ordinary_misses++;
     return false;
   }
 
@@ -63,24 +119,27 @@ class LookupCache {
         ^ (static_cast<intptr_t>(caller) >> kObjectAlignmentLog2);
     intptr_t cid_and_rule = (cid << 16) | rule;
 
-    intptr_t probe1 = hash & kMask;
-    if (entries_[probe1].ns_cid_and_rule == cid_and_rule &&
-        entries_[probe1].ns_selector == selector &&
-        entries_[probe1].ns_caller == caller) {
-      *absent_receiver = entries_[probe1].ns_absent_receiver;
-      *target = entries_[probe1].ns_target;
+    intptr_t probe1 = hash & ns_mask_;
+    if (ns_[probe1].cid_and_rule == cid_and_rule &&
+        ns_[probe1].selector == selector &&
+        ns_[probe1].caller == caller) {
+      *absent_receiver = ns_[probe1].absent_receiver;
+      *target = ns_[probe1].target;
+      stats_.ns_hits++;
       return true;
     }
 
-    intptr_t probe2 = (hash >> 3) & kMask;
-    if (entries_[probe2].ns_cid_and_rule == cid_and_rule &&
-        entries_[probe2].ns_selector == selector &&
-        entries_[probe2].ns_caller == caller) {
-      *absent_receiver = entries_[probe2].ns_absent_receiver;
-      *target = entries_[probe2].ns_target;
+    intptr_t probe2 = (hash >> 3) & ns_mask_;
+    if (ns_[probe2].cid_and_rule == cid_and_rule &&
+        ns_[probe2].selector == selector &&
+        ns_[probe2].caller == caller) {
+      *absent_receiver = ns_[probe2].absent_receiver;
+      *target = ns_[probe2].target;
+      stats_.ns_hits++;
       return true;
     }
 
+    stats_.ns_misses++;
     return false;
   }
 
@@ -92,24 +151,39 @@ class LookupCache {
                 Method target);
 
   void Clear();
+  // Drops the entries for |changed| selectors, and those that refer to
+  // forwarders or to class ids the become freed.
+  void Invalidate(const SelectorSet& changed, Heap* heap);
+
+  const Statistics& statistics() const { return stats_; }
 
  private:
-  struct Entry {
-    intptr_t ordinary_cid;
-    String ordinary_selector;
-    Method ordinary_target;
-
-    intptr_t ns_cid_and_rule;
-    String ns_selector;
-    Method ns_caller;
-    Object ns_absent_receiver;
-    Method ns_target;
+  struct OrdinaryEntry {
+    intptr_t cid;
+    String selector;
+    Method target;
   };
 
-  static constexpr intptr_t kSize = 512;
-  static constexpr intptr_t kMask = kSize - 1;
+  struct NSEntry {
+    intptr_t cid_and_rule;
+    String selector;
+    Method caller;
+    Object absent_receiver;
+    Method target;
+  };
+
+  static constexpr intptr_t kInitialSize = 512;
+  static constexpr intptr_t kMaxSize = 8 * KB;
+
+  OrdinaryEntry* ordinary_;
+  intptr_t ordinary_mask_;
+  NSEntry* ns_;
+  intptr_t ns_mask_;
 
-  Entry entries_[kSize];
+  Statistics stats_;
+  // Evictions when each table was last cleared.
+  int64_t ordinary_evictions_at_clear_;
+  int64_t ns_evictions_at_clear_;
 };
 
 }  // namespace psoup
@@ -6,6 +6,15 @@
 #if !defined(OS_EMSCRIPTEN)
 
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define HAS_ZYGOTE 1
+#endif
 
 #include "vm/os.h"
 #include "vm/primordial_soup.h"
@@ -15,21 +24,311 @@ static void SIGINT_handler(int sig) {
   PrimordialSoup_InterruptAll();
 }
 
+static void ReportGC(void* isolate, const PrimordialSoup_GCEvent* event) {
+  psoup::OS::PrintErr(
+      "%s (%s, %" Pd64 "kB before, %" Pd64 "kB after, %" Pd64 "kB tenured, "
+      "tenuring at %" Pd64 ", %" Pd64 " us%s%s%s)\n",
+      event->kind, event->reason, event->size_before / KB,
+      event->size_after / KB, event->tenured / KB, event->tenuring_threshold,
+      (event->end_nanos - event->start_nanos) /
+          kNanosecondsPerMicrosecond,
+      event->parallel ? ", parallel" : "",
+      event->remark ? ", remark" : "",
+      event->evacuate ? ", evacuate" : "");
+}
+
+// Parses a count of bytes with an optional k, m or g suffix.
+static bool ParseSize(const char* value, size_t* result) {
+  char* end;
+  long long size = strtoll(value, &end, 10);  // NOLINT
+  if ((end == value) || (size < 0)) {
+    return false;
+  }
+  switch (*end) {
+    case 'k': case 'K': size <<= 10; end++; break;
+    case 'm': case 'M': size <<= 20; end++; break;
+    case 'g': case 'G': size <<= 30; end++; break;
+  }
+  if (*end != '\0') {
+    return false;
+  }
+  *result = static_cast<size_t>(size);
+  return true;
+}
+
+#if defined(HAS_ZYGOTE)
+// Runs the loaded isolate in a child forked for |connection|, from which it
+// reads the program's arguments, each ended by a NUL, up to the client's
+// shutting down its side for writing. The connection is then the child's
+// standard input, output and error.
+static intptr_t RunZygoteChild(int connection, void* isolate) {
+  size_t capacity = 256;
+  size_t length = 0;
+  char* request = reinterpret_cast<char*>(malloc(capacity));
+  for (;;) {
+    if (length == capacity) {
+      capacity *= 2;
+      request = reinterpret_cast<char*>(realloc(request, capacity));
+    }
+    ssize_t red = read(connection, request + length, capacity - length);
+    if (red == 0) {
+      break;
+    }
+    if (red < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      psoup::OS::PrintErr("Failed to read zygote request\n");
+      return -1;
+    }
+    length += red;
+  }
+
+  int argc = 0;
+  const char** argv =
+      reinterpret_cast<const char**>(malloc((length + 1) * sizeof(char*)));
+  size_t start = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (request[i] == '\0') {
+      argv[argc++] = request + start;
+      start = i + 1;
+    }
+  }
+  argv[argc] = NULL;
+
+  dup2(connection, STDIN_FILENO);
+  dup2(connection, STDOUT_FILENO);
+  dup2(connection, STDERR_FILENO);
+  close(connection);
+
+  intptr_t exit_code = PrimordialSoup_RunForkedIsolate(isolate, argc, argv);
+  free(argv);
+  free(request);
+  return exit_code;
+}
+
+// Reads the snapshot once, then forks a child to run it for each connection
+// to a Unix socket at |path|. Returns only in a child, or if the socket fails.
+static intptr_t RunZygote(const char* path, void* snapshot, size_t length,
+                          const PrimordialSoup_HeapPolicy* policy) {
+  void* isolate = PrimordialSoup_LoadIsolate(snapshot, length, policy);
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    psoup::OS::PrintErr("Zygote socket path too long: %s\n", path);
+    return -1;
+  }
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((listener == -1) ||
+      (bind(listener, reinterpret_cast<struct sockaddr*>(&address),
+            sizeof(address)) == -1) ||
+      (listen(listener, SOMAXCONN) == -1)) {
+    psoup::OS::PrintErr("Failed to listen on %s: %s\n", path,
+                        strerror(errno));
+    return -1;
+  }
+
+  // Children are not waited for.
+  void (*defaultSIGCHLD)(int) = signal(SIGCHLD, SIG_IGN);
+  for (;;) {
+    int connection = accept(listener, NULL, NULL);
+    if (connection == -1) {
+      if ((errno == EINTR) || (errno == ECONNABORTED)) {
+        continue;
+      }
+      psoup::OS::PrintErr("Failed to accept on %s: %s\n", path,
+                          strerror(errno));
+      return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      signal(SIGCHLD, defaultSIGCHLD);
+      close(listener);
+      return RunZygoteChild(connection, isolate);
+    }
+    if (pid == -1) {
+      psoup::OS::PrintErr("Failed to fork: %s\n", strerror(errno));
+    }
+    close(connection);
+  }
+}
+#endif  // defined(HAS_ZYGOTE)
+
+static bool ParseOption(const char* arg,
+                        PrimordialSoup_HeapPolicy* policy,
+                        size_t* isolate_pool_size,
+                        const char** zygote,
+                        bool* report_gc,
+                        bool* perf_counters,
+                        bool* numa_placement,
+                        const char** listen,
+                        const char** trace) {
+  if (strcmp(arg, "--report-gc") == 0) {
+    *report_gc = true;
+    return true;
+  }
+  if (strcmp(arg, "--perf-counters") == 0) {
+    *perf_counters = true;
+    return true;
+  }
+  if (strcmp(arg, "--numa-placement") == 0) {
+    *numa_placement = true;
+    return true;
+  }
+
+  static const char kInitialNewSpace[] = "--initial-new-space-size=";
+  static const char kMaxNewSpace[] = "--max-new-space-size=";
+  static const char kOldSpaceGrowth[] = "--old-space-growth-percent=";
+  static const char kRetainedFreeSpace[] = "--retained-free-space-size=";
+  static const char kMaxHeap[] = "--max-heap-size=";
+  static const char kMaxStack[] = "--max-stack-size=";
+  static const char kIdleCollection[] = "--idle-collection-delay=";
+  static const char kIsolatePool[] = "--isolate-pool-size=";
+  static const char kZygote[] = "--zygote=";
+  static const char kTrace[] = "--trace=";
+  static const char kListen[] = "--listen=";
+#define MATCHES(option) (strncmp(arg, option, sizeof(option) - 1) == 0)
+#define VALUE(option) (arg + sizeof(option) - 1)
+  if (MATCHES(kInitialNewSpace)) {
+    return ParseSize(VALUE(kInitialNewSpace), &policy->initial_new_space_size);
+  }
+  if (MATCHES(kMaxNewSpace)) {
+    return ParseSize(VALUE(kMaxNewSpace), &policy->max_new_space_size);
+  }
+  if (MATCHES(kOldSpaceGrowth)) {
+    size_t percent;
+    if (!ParseSize(VALUE(kOldSpaceGrowth), &percent) || (percent == 0)) {
+      return false;
+    }
+    policy->old_space_growth_percent = static_cast<intptr_t>(percent);
+    return true;
+  }
+  if (MATCHES(kRetainedFreeSpace)) {
+    return ParseSize(VALUE(kRetainedFreeSpace),
+                     &policy->retained_free_space_size);
+  }
+  if (MATCHES(kMaxHeap)) {
+    return ParseSize(VALUE(kMaxHeap), &policy->max_heap_size);
+  }
+  if (MATCHES(kMaxStack)) {
+    return ParseSize(VALUE(kMaxStack), &policy->max_stack_size);
+  }
+  if (MATCHES(kIdleCollection)) {
+    size_t millis;
+    if (!ParseSize(VALUE(kIdleCollection), &millis)) {
+      return false;
+    }
+    policy->idle_collection_millis = static_cast<int64_t>(millis);
+    return true;
+  }
+  if (MATCHES(kIsolatePool)) {
+    return ParseSize(VALUE(kIsolatePool), isolate_pool_size);
+  }
+  if (MATCHES(kTrace)) {
+    *trace = VALUE(kTrace);
+    return (*trace)[0] != '\0';
+  }
+  if (MATCHES(kListen)) {
+    *listen = VALUE(kListen);
+    return (*listen)[0] != '\0';
+  }
+#if defined(HAS_ZYGOTE)
+  if (MATCHES(kZygote)) {
+    *zygote = VALUE(kZygote);
+    return (*zygote)[0] != '\0';
+  }
+#endif
+#undef MATCHES
+#undef VALUE
+  return false;
+}
+
 int main(int argc, const char** argv) {
-  if (argc < 2) {
-    psoup::OS::PrintErr("Usage: %s <program.vfuel>\n", argv[0]);
+  PrimordialSoup_HeapPolicy policy;
+  memset(&policy, 0, sizeof(policy));
+  size_t isolate_pool_size = 0;
+  const char* zygote = NULL;
+  bool report_gc = false;
+  bool perf_counters = false;
+  bool numa_placement = false;
+  const char* listen = NULL;
+  const char* trace = NULL;
+  int first = 1;
+  while ((first < argc) && (strncmp(argv[first], "--", 2) == 0)) {
+    if (!ParseOption(argv[first], &policy, &isolate_pool_size, &zygote,
+                     &report_gc, &perf_counters, &numa_placement, &listen,
+                     &trace)) {
+      psoup::OS::PrintErr("Bad option: %s\n", argv[first]);
+      return -1;
+    }
+    first++;
+  }
+
+  // A zygote's program arguments come with each request instead.
+  if ((first >= argc) || ((zygote != NULL) && (first + 1 != argc))) {
+    psoup::OS::PrintErr(
+        "Usage: %s [--report-gc] [--perf-counters] [--numa-placement] "
+        "[--initial-new-space-size=<size>] "
+        "[--max-new-space-size=<size>] [--old-space-growth-percent=<n>] "
+        "[--retained-free-space-size=<size>] [--max-heap-size=<size>] "
+        "[--max-stack-size=<size>] [--idle-collection-delay=<ms>] "
+        "[--isolate-pool-size=<n>] "
+        "[--zygote=<socket>] [--listen=<address>] [--trace=<file>] "
+        "<program.vfuel>\n", argv[0]);
     return -1;
   }
 
-  psoup::VirtualMemory snapshot = psoup::VirtualMemory::MapReadOnly(argv[1]);
+  // Each forked child would write its trace over the others'.
+  if ((zygote != NULL) && (trace != NULL)) {
+    psoup::OS::PrintErr("--trace cannot be used with --zygote\n");
+    return -1;
+  }
+  // Forked children would not have the transport's thread.
+  if ((zygote != NULL) && (listen != NULL)) {
+    psoup::OS::PrintErr("--listen cannot be used with --zygote\n");
+    return -1;
+  }
+
+  psoup::VirtualMemory snapshot =
+      psoup::VirtualMemory::MapReadOnly(argv[first]);
   PrimordialSoup_Startup();
-  void (*defaultSIGINT)(int) = signal(SIGINT, SIGINT_handler);
+  if (report_gc) {
+    PrimordialSoup_SetGCEventCallback(ReportGC);
+  }
+  PrimordialSoup_SetIsolatePoolSize(static_cast<intptr_t>(isolate_pool_size));
+  PrimordialSoup_SetPerfCounting(perf_counters ? 1 : 0);
+  if (numa_placement && (PrimordialSoup_SetNumaPlacement(1) == 0)) {
+    psoup::OS::PrintErr("NUMA nodes unknown; isolates left unplaced\n");
+  }
+  if ((listen != NULL) && (PrimordialSoup_Listen(listen) == 0)) {
+    psoup::OS::PrintErr("Failed to listen at %s\n", listen);
+    return -1;
+  }
+  if (trace != NULL) {
+    PrimordialSoup_StartTracing(trace);
+  }
 
-  intptr_t exit_code =
-      PrimordialSoup_RunIsolate(reinterpret_cast<void*>(snapshot.base()),
-                                snapshot.size(), argc - 2, &argv[2]);
+  intptr_t exit_code = -1;
+  if (zygote != NULL) {
+#if defined(HAS_ZYGOTE)
+    // SIGINT is left to its default, which ends the zygote.
+    exit_code = RunZygote(zygote, reinterpret_cast<void*>(snapshot.base()),
+                          snapshot.size(), &policy);
+#endif
+  } else {
+    void (*defaultSIGINT)(int) = signal(SIGINT, SIGINT_handler);
+    exit_code = PrimordialSoup_RunIsolateWithPolicy(
+        reinterpret_cast<void*>(snapshot.base()), snapshot.size(),
+        argc - first - 1, &argv[first + 1], &policy);
+    signal(SIGINT, defaultSIGINT);
+  }
 
-  signal(SIGINT, defaultSIGINT);
+  if ((trace != NULL) && (PrimordialSoup_StopTracing() == 0)) {
+    psoup::OS::PrintErr("Failed to write trace to %s\n", trace);
+  }
   PrimordialSoup_Shutdown();
 
   // TODO(rmacnak): File and anonymous mappings are freed differently on
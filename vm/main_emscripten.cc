@@ -7,6 +7,7 @@
 
 #include <emscripten.h>
 
+#include "vm/heap.h"
 #include "vm/isolate.h"
 #include "vm/message_loop.h"
 #include "vm/os.h"
@@ -29,7 +30,8 @@ extern "C" void load_snapshot(void* snapshot, size_t snapshot_length) {
   _JS_initializeAliens();
 
   uint64_t seed = psoup::OS::CurrentMonotonicNanos();
-  isolate = new psoup::Isolate(snapshot, snapshot_length, seed);
+  isolate = new psoup::Isolate(snapshot, snapshot_length, seed,
+                               psoup::HeapPolicy());
   int argc = 0;
   const char** argv = NULL;
   isolate->loop()->PostMessage(new psoup::IsolateMessage(ILLEGAL_PORT,
@@ -0,0 +1,76 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/mapped_files.h"
+
+#include <sys/stat.h>
+
+namespace psoup {
+
+MappedFiles::MappedFiles() : entries_(nullptr), capacity_(0) {}
+
+MappedFiles::~MappedFiles() {
+  for (intptr_t i = 0; i < capacity_; i++) {
+    if (entries_[i].in_use) {
+      Free(&entries_[i].memory);
+    }
+  }
+  delete[] entries_;
+}
+
+intptr_t MappedFiles::Map(const char* filename) {
+  // MapReadOnly fails fatally, so check first that it will succeed.
+  struct stat st;
+  if ((stat(filename, &st) != 0) || ((st.st_mode & S_IFMT) != S_IFREG)) {
+    return -1;
+  }
+
+  intptr_t handle = 0;
+  while ((handle < capacity_) && entries_[handle].in_use) {
+    handle++;
+  }
+  if (handle == capacity_) {
+    intptr_t new_capacity = capacity_ == 0 ? 4 : capacity_ * 2;
+    Entry* new_entries = new Entry[new_capacity];
+    for (intptr_t i = 0; i < new_capacity; i++) {
+      new_entries[i].in_use = false;
+    }
+    for (intptr_t i = 0; i < capacity_; i++) {
+      new_entries[i] = entries_[i];
+    }
+    delete[] entries_;
+    entries_ = new_entries;
+    capacity_ = new_capacity;
+  }
+
+  // Empty files cannot be mapped.
+  entries_[handle].memory = st.st_size == 0
+      ? VirtualMemory()
+      : VirtualMemory::MapReadOnly(filename);
+  entries_[handle].in_use = true;
+  return handle;
+}
+
+bool MappedFiles::Unmap(intptr_t handle) {
+  if (Lookup(handle) == nullptr) {
+    return false;
+  }
+  Free(&entries_[handle].memory);
+  entries_[handle].in_use = false;
+  return true;
+}
+
+// static
+void MappedFiles::Free(VirtualMemory* memory) {
+  // VirtualMemory::Free only releases anonymous mappings on Windows, so file
+  // mappings are kept there until exit, as main.cc does for the snapshot.
+#if !defined(OS_WINDOWS)
+  if (memory->size() != 0) {
+    memory->Free();
+  }
+#endif
+  *memory = VirtualMemory();
+}
+
+}  // namespace psoup
@@ -0,0 +1,52 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_MAPPED_FILES_H_
+#define VM_MAPPED_FILES_H_
+
+#include "vm/globals.h"
+#include "vm/virtual_memory.h"
+
+namespace psoup {
+
+// One isolate's read-only file mappings, named by small integer handles. The
+// bytes live outside the heap, so the GC never scans or copies them, and a
+// file is read by copying out only the ranges wanted.
+class MappedFiles {
+ public:
+  MappedFiles();
+  // Unmaps any files left open.
+  ~MappedFiles();
+
+  // Returns -1 if |filename| is not a regular file that can be read.
+  intptr_t Map(const char* filename);
+
+  // Returns nullptr if |handle| is not open.
+  const VirtualMemory* Lookup(intptr_t handle) const {
+    if ((handle < 0) || (handle >= capacity_) || !entries_[handle].in_use) {
+      return nullptr;
+    }
+    return &entries_[handle].memory;
+  }
+
+  // Returns false if |handle| is not open.
+  bool Unmap(intptr_t handle);
+
+ private:
+  struct Entry {
+    VirtualMemory memory;
+    bool in_use;
+  };
+
+  static void Free(VirtualMemory* memory);
+
+  Entry* entries_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedFiles);
+};
+
+}  // namespace psoup
+
+#endif  // VM_MAPPED_FILES_H_
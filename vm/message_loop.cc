@@ -5,17 +5,177 @@
 #include "vm/message_loop.h"
 
 #include "vm/flags.h"
+#include "vm/heap.h"
 #include "vm/isolate.h"
 #include "vm/os.h"
+#include "vm/trace_events.h"
 
 namespace psoup {
 
+IsolateMessage::~IsolateMessage() {
+  free(data_);
+  if (region_ != NULL) {
+    Heap::FreeDetachedRegion(region_);
+  }
+}
+
+// static
+IsolateMessage* IsolateMessage::NewBytes(Port dest, const uint8_t* data,
+                                         intptr_t length) {
+  IsolateMessage* message = NewUninitializedBytes(dest, length);
+  memcpy(message->bytes(), data, length);
+  return message;
+}
+
+// static
+IsolateMessage* IsolateMessage::NewUninitializedBytes(Port dest,
+                                                      intptr_t length) {
+  Region* region = Heap::NewDetachedByteArray(length);
+  if (region != NULL) {
+    return new IsolateMessage(dest, region);
+  }
+  uint8_t* data = reinterpret_cast<uint8_t*>(malloc(length));
+  return new IsolateMessage(dest, data, length);
+}
+
+uint8_t* IsolateMessage::bytes() const {
+  if (region_ != NULL) {
+    return Heap::DetachedByteArray(region_)->element_addr(0);
+  }
+  return data_;
+}
+
+intptr_t IsolateMessage::bytes_length() const {
+  if (region_ != NULL) {
+    return Heap::DetachedByteArray(region_)->Size();
+  }
+  return length_;
+}
+
 MessageLoop::MessageLoop(Isolate* isolate)
-    : isolate_(isolate), open_ports_(0), open_waits_(0), exit_code_(0) {}
+    : isolate_(isolate), open_ports_(0), open_waits_(0), exit_code_(0),
+      queued_(0), last_signal_id_(0), dispatched_(0), requested_wakeup_(0),
+      idle_collection_due_(0) {}
 
 MessageLoop::~MessageLoop() {}
 
+// static
+void MessageLoop::Startup() {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  if (SCHEDULED_ISOLATES) {
+    ScheduledMessageLoop::Startup();
+    return;
+  }
+#endif
+#if defined(OS_LINUX)
+  IOUringMessageLoop::Startup();
+#endif
+}
+
+// static
+void MessageLoop::Shutdown() {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  if (SCHEDULED_ISOLATES) {
+    ScheduledMessageLoop::Shutdown();
+  }
+#endif
+}
+
+// static
+bool MessageLoop::HasScheduler() {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  return SCHEDULED_ISOLATES;
+#else
+  return false;
+#endif
+}
+
+// static
+MessageLoop* MessageLoop::New(Isolate* isolate) {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  if (SCHEDULED_ISOLATES) {
+    return new ScheduledMessageLoop(isolate);
+  }
+#endif
+#if defined(OS_LINUX)
+  if (IOUringMessageLoop::IsSupported()) {
+    return new IOUringMessageLoop(isolate);
+  }
+#endif
+  return new PlatformMessageLoop(isolate);
+}
+
+MessageLoop* MessageLoop::NewDriven(Isolate* isolate) {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  return new EPollMessageLoop(isolate);
+#elif defined(OS_MACOS)
+  return new KQueueMessageLoop(isolate);
+#else
+  return NULL;
+#endif
+}
+
+bool MessageLoop::RunUntilIdle(int64_t* timeout) {
+  UNREACHABLE();
+  return false;
+}
+
+void MessageLoop::RunDetached(Isolate* isolate) {
+  intptr_t exit_code = Run();
+  delete isolate;
+  if (exit_code != 0) {
+    OS::Exit(exit_code);
+  }
+}
+
+void MessageLoop::PostMessages(IsolateMessage* first, IsolateMessage* last) {
+  IsolateMessage* message = first;
+  for (;;) {
+    IsolateMessage* next = message->next_;
+    message->next_ = NULL;
+    PostMessage(message);
+    if (message == last) {
+      break;
+    }
+    message = next;
+  }
+}
+
+// Ends the flow from |message|'s post in the slice just begun.
+static void TraceDispatch(IsolateMessage* message, Isolate* isolate) {
+  if (message->trace_id() != 0) {
+    TraceEvents::Record(TraceEvents::kFlowEnd, "message", isolate,
+                        message->trace_id());
+  }
+}
+
 void MessageLoop::DispatchMessage(IsolateMessage* message) {
+  TraceScope trace_scope("dispatch message", isolate_);
+  if (TraceEvents::enabled()) {
+    TraceDispatch(message, isolate_);
+  }
+  CountDispatched(1);
+  int64_t start = OS::CurrentMonotonicNanos();
+  RecordWait(message->is_signal() ? kSignalWait : kMessageWait, message,
+             start);
+
+  // Only messages posted through the PortMap are for a port.
+  if (message->dest_port() != ILLEGAL_PORT) {
+    PortMap::MessagesTaken(message->dest_port(), 1);
+  }
+
+  if (message->is_signal()) {
+    // The port only kept the isolate alive until the work was done.
+    ClosePort(message->dest_port());
+    if (isolate_ != NULL) {
+      isolate_->async_files()->Complete(message);
+    }
+    DispatchSignal(message->handle(), message->status(), message->signals(),
+                   message->count());
+    delete message;
+    return;
+  }
+
   if (isolate_ == NULL) {
     delete message;
     return;
@@ -24,6 +184,68 @@ void MessageLoop::DispatchMessage(IsolateMessage* message) {
   isolate_->ActivateMessage(message);
   delete message;
   isolate_->Interpret();
+  latencies_[kMessageRun].Record(OS::CurrentMonotonicNanos() - start);
+}
+
+// Whether |message| carries bytes for a port, which can share an activation
+// with others for the same port written by the same serializer.
+static bool IsBatchable(IsolateMessage* message) {
+  return !message->is_signal() && (message->dest_port() != ILLEGAL_PORT) &&
+         ((message->data() != NULL) || (message->region() != NULL));
+}
+
+IsolateMessage* MessageLoop::DispatchMessages(IsolateMessage* messages) {
+  while (messages != NULL) {
+    if ((isolate_ != NULL) && isolate_->suspended()) {
+      return messages;
+    }
+    IsolateMessage* first = messages;
+    intptr_t count = 1;
+    IsolateMessage* next = first->next_;
+    if (IsBatchable(first)) {
+      while ((next != NULL) && IsBatchable(next) &&
+             (next->dest_port() == first->dest_port()) &&
+             (next->is_object() == first->is_object())) {
+        count++;
+        next = next->next_;
+      }
+    }
+    messages = next;
+
+    if ((count == 1) || (isolate_ == NULL)) {
+      while (first != next) {
+        IsolateMessage* following = first->next_;
+        DispatchMessage(first);
+        first = following;
+      }
+      continue;
+    }
+
+    TraceScope trace_scope("dispatch messages", isolate_);
+    if (TraceEvents::enabled()) {
+      for (IsolateMessage* message = first; message != next;
+           message = message->next_) {
+        TraceDispatch(message, isolate_);
+      }
+    }
+    CountDispatched(count);
+    // The messages wait separately but are handled in one run.
+    int64_t start = OS::CurrentMonotonicNanos();
+    for (IsolateMessage* message = first; message != next;
+         message = message->next_) {
+      RecordWait(kMessageWait, message, start);
+    }
+    PortMap::MessagesTaken(first->dest_port(), count);
+    isolate_->ActivateMessages(first, count);
+    while (first != next) {
+      IsolateMessage* following = first->next_;
+      delete first;
+      first = following;
+    }
+    isolate_->Interpret();
+    latencies_[kMessageRun].Record(OS::CurrentMonotonicNanos() - start);
+  }
+  return NULL;
 }
 
 void MessageLoop::DispatchWakeup() {
@@ -31,8 +253,24 @@ void MessageLoop::DispatchWakeup() {
     return;
   }
 
+  if (idle_collection_due_ != 0) {
+    // Nothing else was due, so the isolate does not run.
+    TraceScope trace_scope("idle collection", isolate_);
+    idle_collection_due_ = 0;
+    isolate_->heap()->CollectIdle();
+    MessageEpilogue(requested_wakeup_);
+    return;
+  }
+
+  TraceScope trace_scope("dispatch wakeup", isolate_);
+  // A wakeup waits from when it was due until its timer is noticed.
+  int64_t start = OS::CurrentMonotonicNanos();
+  if (requested_wakeup_ != 0) {
+    latencies_[kWakeupWait].Record(start - requested_wakeup_);
+  }
   isolate_->ActivateWakeup();
   isolate_->Interpret();
+  latencies_[kWakeupRun].Record(OS::CurrentMonotonicNanos() - start);
 }
 
 void MessageLoop::DispatchSignal(intptr_t handle,
@@ -48,8 +286,31 @@ void MessageLoop::DispatchSignal(intptr_t handle,
     return;
   }
 
+  TraceScope trace_scope("dispatch signal", isolate_);
+  int64_t start = OS::CurrentMonotonicNanos();
   isolate_->ActivateSignal(handle, status, signals, count);
   isolate_->Interpret();
+  latencies_[kSignalRun].Record(OS::CurrentMonotonicNanos() - start);
+}
+
+// Once per wait, so an isolate left waiting is collected only once. Not while
+// the loop would otherwise exit, which the collection would delay.
+int64_t MessageLoop::ScheduleIdleCollection(int64_t wakeup) {
+  idle_collection_due_ = 0;
+  if (isolate_ == NULL) {
+    return wakeup;
+  }
+  int64_t delay = isolate_->heap()->policy().idle_collection_delay;
+  if ((delay == 0) ||
+      ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup == 0))) {
+    return wakeup;
+  }
+  int64_t due = OS::CurrentMonotonicNanos() + delay;
+  if ((wakeup != 0) && (wakeup <= due)) {
+    return wakeup;
+  }
+  idle_collection_due_ = due;
+  return due;
 }
 
 Port MessageLoop::OpenPort() {
@@ -63,4 +324,10 @@ void MessageLoop::ClosePort(Port port) {
   }
 }
 
+intptr_t MessageLoop::NewSignalId() {
+  last_signal_id_ = last_signal_id_ == SmallInteger::kMinValue
+      ? -1 : last_signal_id_ - 1;
+  return last_signal_id_;
+}
+
 }  // namespace psoup
@@ -5,30 +5,106 @@
 #ifndef VM_MESSAGE_LOOP_H_
 #define VM_MESSAGE_LOOP_H_
 
+#include "vm/atomic.h"
+#include "vm/latency_histogram.h"
 #include "vm/port.h"
+#include "vm/timer_wheel.h"
 
 namespace psoup {
 
 class Isolate;
+class Region;
 
 class IsolateMessage {
  public:
   IsolateMessage(Port dest, uint8_t* data, intptr_t length)
       : next_(NULL), dest_(dest),
         data_(data), length_(length),
-        argv_(NULL), argc_(0) {}
+        argv_(NULL), argc_(0),
+        region_(NULL), is_object_(false),
+        is_signal_(false), handle_(0), status_(0), signals_(0), count_(0),
+        trace_id_(0), posted_(0) {}
+  // A large ByteArray in a region outside any heap; see
+  // Heap::NewDetachedByteArray.
+  IsolateMessage(Port dest, Region* region)
+      : next_(NULL), dest_(dest),
+        data_(NULL), length_(0),
+        argv_(NULL), argc_(0),
+        region_(region), is_object_(false),
+        is_signal_(false), handle_(0), status_(0), signals_(0), count_(0),
+        trace_id_(0), posted_(0) {}
   IsolateMessage(Port dest, int argc, const char** argv)
       : next_(NULL), dest_(dest),
         data_(NULL), length_(0),
-        argv_(argv), argc_(argc) {}
+        argv_(argv), argc_(argc),
+        region_(NULL), is_object_(false),
+        is_signal_(false), handle_(0), status_(0), signals_(0), count_(0),
+        trace_id_(0), posted_(0) {}
+  // The completion of work done off the isolate's thread, dispatched as a
+  // signal for |handle| once it reaches |dest|, a port opened just for it.
+  IsolateMessage(Port dest, intptr_t handle, intptr_t status,
+                 intptr_t signals, intptr_t count,
+                 uint8_t* data, intptr_t length)
+      : next_(NULL), dest_(dest),
+        data_(data), length_(length),
+        argv_(NULL), argc_(0),
+        region_(NULL), is_object_(false),
+        is_signal_(true), handle_(handle), status_(status),
+        signals_(signals), count_(count), trace_id_(0),
+        posted_(0) {}
 
-  ~IsolateMessage() { free(data_); }
+  ~IsolateMessage();
 
+  // A ByteArray's contents, in a detached region if large enough to be
+  // adopted by the receiver; see Heap::NewDetachedByteArray.
+  static IsolateMessage* NewBytes(Port dest, const uint8_t* data,
+                                  intptr_t length);
+  // As NewBytes, but leaves the contents at bytes() for the caller to fill.
+  static IsolateMessage* NewUninitializedBytes(Port dest, intptr_t length);
+
+  // The contents of a message of bytes, wherever they are held.
+  uint8_t* bytes() const;
+  intptr_t bytes_length() const;
+
+  IsolateMessage* next() const { return next_; }
+  void set_next(IsolateMessage* next) { next_ = next; }
   Port dest_port() const { return dest_; }
   uint8_t* data() const { return data_; }
   intptr_t length() const { return length_; }
   int argc() const { return argc_; }
   const char** argv() const { return argv_; }
+  Region* region() const { return region_; }
+  // Written by MessageSerializer, so the receiver can read it without the
+  // Newspeak Deserializer; see Isolate::ActivateObjects.
+  bool is_object() const { return is_object_; }
+  void set_is_object(bool value) { is_object_ = value; }
+
+  bool is_signal() const { return is_signal_; }
+  intptr_t handle() const { return handle_; }
+  intptr_t status() const { return status_; }
+  intptr_t signals() const { return signals_; }
+  intptr_t count() const { return count_; }
+
+  // Joins the message's post to its dispatch in a trace, or 0 if its post
+  // was not recorded; see TraceEvents.
+  uint64_t trace_id() const { return trace_id_; }
+  void set_trace_id(uint64_t id) { trace_id_ = id; }
+
+  // When the message was posted, in monotonic nanoseconds, or 0 if it did not
+  // go through the PortMap.
+  int64_t posted() const { return posted_; }
+  void set_posted(int64_t nanos) { posted_ = nanos; }
+
+  uint8_t* TakeData() {
+    uint8_t* data = data_;
+    data_ = NULL;
+    return data;
+  }
+  Region* TakeRegion() {
+    Region* region = region_;
+    region_ = NULL;
+    return region;
+  }
 
  private:
   friend class MessageLoop;
@@ -36,7 +112,9 @@ class IsolateMessage {
   friend class EmscriptenMessageLoop;
   friend class FuchsiaMessageLoop;
   friend class IOCPMessageLoop;
+  friend class IOUringMessageLoop;
   friend class KQueueMessageLoop;
+  friend class ScheduledMessageLoop;
 
   IsolateMessage* next_;
   Port dest_;
@@ -44,6 +122,15 @@ class IsolateMessage {
   intptr_t length_;
   const char** argv_;  // Not owned by message.
   int argc_;
+  Region* region_;  // Owned by message.
+  bool is_object_;
+  bool is_signal_;
+  intptr_t handle_;
+  intptr_t status_;
+  intptr_t signals_;
+  intptr_t count_;
+  uint64_t trace_id_;
+  int64_t posted_;
 
   DISALLOW_COPY_AND_ASSIGN(IsolateMessage);
 };
@@ -60,20 +147,90 @@ class MessageLoop {
   explicit MessageLoop(Isolate* isolate);
   virtual ~MessageLoop();
 
+  // Chooses the backend for loops made by New. Called once per process.
+  static void Startup();
+  // Waits for isolates left to a scheduler to exit.
+  static void Shutdown();
+  static MessageLoop* New(Isolate* isolate);
+  // A loop that can also be run by RunUntilIdle, or NULL where none can.
+  static MessageLoop* NewDriven(Isolate* isolate);
+  // Whether loops share a scheduler's threads instead of each having one.
+  static bool HasScheduler();
+
   virtual void PostMessage(IsolateMessage* message) = 0;
+  // Appends |first| through |last|, linked by next_, as one step. By default
+  // they are posted one at a time.
+  virtual void PostMessages(IsolateMessage* first, IsolateMessage* last);
   virtual intptr_t AwaitSignal(intptr_t handle, intptr_t signals) = 0;
   virtual void CancelSignalWait(intptr_t wait_id) = 0;
+  // Ends the dispatch of a message, with the time of the next wakeup, or 0
+  // for none. The loop also wakes when its timers next need to turn, and
+  // stays alive while any are pending, and when its heap's policy asks for an
+  // idle collection.
+  void Finish(int64_t new_wakeup) {
+    int64_t timers_due = timers_.NextDue();
+    if ((timers_due != 0) &&
+        ((new_wakeup == 0) || (timers_due < new_wakeup))) {
+      new_wakeup = timers_due;
+    }
+    requested_wakeup_ = new_wakeup;
+    MessageEpilogue(ScheduleIdleCollection(new_wakeup));
+  }
   virtual void MessageEpilogue(int64_t new_wakeup) = 0;
   virtual void Exit(intptr_t exit_code) = 0;
 
+  // Runs the isolate until it exits and answers its exit code.
   virtual intptr_t Run() = 0;
+  // As Run, but returns at once if the isolate can be run without holding
+  // this thread. The isolate is then deleted when it exits, and a nonzero
+  // exit code exits the process.
+  virtual void RunDetached(Isolate* isolate);
+  // For an embedder that runs the isolate from its own event loop instead of
+  // giving it a thread: dispatches what is ready, without waiting. Answers
+  // true with |*timeout| set to the nanoseconds the embedder may wait for
+  // WaitHandle to become readable before calling again, or -1 for as long as
+  // it is not. Answers false once the isolate has exited, having closed its
+  // ports; see exit_code. Only for loops made by NewDriven.
+  virtual bool RunUntilIdle(int64_t* timeout);
+  // A descriptor readable whenever RunUntilIdle has something to dispatch, or
+  // -1 if the loop cannot be run that way.
+  virtual intptr_t WaitHandle() { return -1; }
   virtual void Interrupt() = 0;
+  bool exited() const { return isolate_ == NULL; }
+  intptr_t exit_code() const { return exit_code_; }
 
   Port OpenPort();
   void ClosePort(Port p);
+  // An id for the signal completing work done off the loop's thread. Ids are
+  // negative so they never collide with descriptors and other handles.
+  intptr_t NewSignalId();
+
+  // Messages posted to this loop's ports and not yet taken, kept by the
+  // PortMap as it reserves and releases room in the ports' queues.
+  void AddQueued(intptr_t count) {
+    AtomicOperations::FetchAndAddRelaxed(&queued_, count);
+  }
+  intptr_t queued() const {
+    return AtomicOperations::LoadRelaxed(const_cast<intptr_t*>(&queued_));
+  }
+  // Messages dispatched so far. Only counted on the loop's own thread, but
+  // may be read from others.
+  int64_t dispatched() const {
+    return AtomicOperations::LoadRelaxed(const_cast<int64_t*>(&dispatched_));
+  }
+  const LatencyHistogram& latency(LatencyKind kind) const {
+    return latencies_[kind];
+  }
+  // Only used on the loop's own thread. The isolate takes the timers that
+  // fired at the end of each dispatch, all at once.
+  TimerWheel* timers() { return &timers_; }
 
  protected:
   void DispatchMessage(IsolateMessage* message);
+  // Dispatches a chain of messages, each run of payloads for the same port in
+  // one activation. If the isolate is suspended, stops and answers the
+  // messages not yet dispatched.
+  IsolateMessage* DispatchMessages(IsolateMessage* messages);
   void DispatchWakeup();
   void DispatchSignal(intptr_t handle,
                       intptr_t status,
@@ -86,6 +243,27 @@ class MessageLoop {
   intptr_t exit_code_;
 
  private:
+  void CountDispatched(intptr_t count) {
+    AtomicOperations::StoreRelaxed(&dispatched_, dispatched_ + count);
+  }
+
+  // Answers |wakeup|, or earlier if the isolate should be collected first.
+  int64_t ScheduleIdleCollection(int64_t wakeup);
+
+  void RecordWait(LatencyKind kind, IsolateMessage* message, int64_t now) {
+    if (message->posted() != 0) {
+      latencies_[kind].Record(now - message->posted());
+    }
+  }
+
+  intptr_t queued_;
+  intptr_t last_signal_id_;
+  int64_t dispatched_;
+  int64_t requested_wakeup_;
+  int64_t idle_collection_due_;  // 0 unless the next wakeup is for it.
+  TimerWheel timers_;
+  LatencyHistogram latencies_[kNumLatencyKinds];
+
   DISALLOW_COPY_AND_ASSIGN(MessageLoop);
 };
 
@@ -93,12 +271,15 @@ class MessageLoop {
 
 #if defined(OS_ANDROID)
 #include "vm/message_loop_epoll.h"
+#include "vm/message_loop_scheduled.h"
 #elif defined(OS_EMSCRIPTEN)
 #include "vm/message_loop_emscripten.h"
 #elif defined(OS_FUCHSIA)
 #include "vm/message_loop_fuchsia.h"
 #elif defined(OS_LINUX)
 #include "vm/message_loop_epoll.h"
+#include "vm/message_loop_io_uring.h"
+#include "vm/message_loop_scheduled.h"
 #elif defined(OS_MACOS)
 #include "vm/message_loop_kqueue.h"
 #elif defined(OS_WINDOWS)
@@ -8,16 +8,26 @@
 #include "vm/message_loop.h"
 
 #include <emscripten.h>
+#if defined(EMSCRIPTEN_THREADS)
+#include <emscripten/threading.h>
+#endif
 
+#include "vm/lockers.h"
 #include "vm/os.h"
 
 namespace psoup {
 
 EmscriptenMessageLoop::EmscriptenMessageLoop(Isolate* isolate)
     : MessageLoop(isolate),
+      monitor_(),
       head_(NULL),
       tail_(NULL),
-      wakeup_(0) {}
+      wakeup_(0),
+#if defined(EMSCRIPTEN_THREADS)
+      driven_by_page_(emscripten_is_main_browser_thread()) {}
+#else
+      driven_by_page_(true) {}
+#endif
 
 EmscriptenMessageLoop::~EmscriptenMessageLoop() {}
 
@@ -33,6 +43,12 @@ void EmscriptenMessageLoop::CancelSignalWait(intptr_t wait_id) {
 
 void EmscriptenMessageLoop::MessageEpilogue(int64_t new_wakeup) {
   wakeup_ = new_wakeup;
+
+  // The page's isolate lives as long as the page.
+  if (!driven_by_page_ &&
+      (open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
+    Exit(0);
+  }
 }
 
 void EmscriptenMessageLoop::Exit(intptr_t exit_code) {
@@ -43,41 +59,97 @@ void EmscriptenMessageLoop::Exit(intptr_t exit_code) {
     PortMap::CloseAllPorts(this);
   }
 
+  MonitorLocker locker(&monitor_);
   while (head_ != NULL) {
     IsolateMessage* message = head_;
     head_ = message->next_;
     delete message;
   }
+  tail_ = NULL;
 }
 
 void EmscriptenMessageLoop::PostMessage(IsolateMessage* message) {
-  if (head_ == NULL) {
-    head_ = tail_ = message;
-  } else {
-    tail_->next_ = message;
-    tail_ = message;
+  PostMessages(message, message);
+}
+
+void EmscriptenMessageLoop::PostMessages(IsolateMessage* first,
+                                         IsolateMessage* last) {
+  bool was_empty;
+  {
+    MonitorLocker locker(&monitor_);
+    was_empty = (head_ == NULL);
+    if (was_empty) {
+      head_ = first;
+      tail_ = last;
+      locker.Notify();
+    } else {
+      tail_->next_ = first;
+      tail_ = last;
+    }
   }
+
+#if defined(EMSCRIPTEN_THREADS)
+  if (was_empty && driven_by_page_ && !emscripten_is_main_browser_thread()) {
+    // The page stops taking turns once its queue is empty, so it is asked for
+    // another from its own thread.
+    MAIN_THREAD_ASYNC_EM_ASM({ Module.scheduleTurn(0); });
+  }
+#endif
 }
 
 intptr_t EmscriptenMessageLoop::Run() {
+#if defined(EMSCRIPTEN_THREADS)
+  ASSERT(!driven_by_page_);
+  while (isolate_ != NULL) {
+    IsolateMessage* messages;
+    bool wakeup = false;
+    {
+      MonitorLocker locker(&monitor_);
+      while (head_ == NULL) {
+        if (wakeup_ == 0) {
+          locker.Wait();
+        } else if (locker.WaitUntilNanos(wakeup_) == Monitor::kTimedOut) {
+          wakeup = true;
+          break;
+        }
+      }
+      messages = head_;
+      head_ = tail_ = NULL;
+    }
+
+    if (wakeup) {
+      DispatchWakeup();
+    }
+    DispatchMessages(messages);
+  }
+  return exit_code_;
+#else
   UNREACHABLE();
   return -1;
+#endif
 }
 
-int EmscriptenMessageLoop::HandleMessage() {
+IsolateMessage* EmscriptenMessageLoop::TakeMessage() {
+  MonitorLocker locker(&monitor_);
   IsolateMessage* message = head_;
-  if (head_ != NULL) {
+  if (message != NULL) {
     head_ = message->next_;
     if (head_ == NULL) {
       tail_ = NULL;
     }
   }
+  return message;
+}
 
-  if (message == NULL) {
-    DispatchWakeup();
-  } else {
+int EmscriptenMessageLoop::HandleMessage() {
+  IsolateMessage* message = TakeMessage();
+  if (message != NULL) {
     DispatchMessage(message);
+  } else if ((wakeup_ != 0) && (wakeup_ <= OS::CurrentMonotonicNanos())) {
+    DispatchWakeup();
   }
+  // Otherwise the turn was asked for by a worker whose message an earlier
+  // turn already took.
 
   return ComputeTimeout();
 }
@@ -91,7 +163,10 @@ int EmscriptenMessageLoop::HandleSignal(int handle,
 }
 
 int EmscriptenMessageLoop::ComputeTimeout() {
-  if (head_ != NULL) return 0;
+  {
+    MonitorLocker locker(&monitor_);
+    if (head_ != NULL) return 0;
+  }
 
   if (wakeup_ == 0) return -1;
 
@@ -100,7 +175,9 @@ int EmscriptenMessageLoop::ComputeTimeout() {
     return 0;
   }
 
-  return (wakeup_ - now) / kNanosecondsPerMillisecond;
+  // Rounded up, so the turn is not taken before the wakeup is due.
+  return (wakeup_ - now + kNanosecondsPerMillisecond - 1) /
+      kNanosecondsPerMillisecond;
 }
 
 void EmscriptenMessageLoop::Interrupt() {
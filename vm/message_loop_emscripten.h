@@ -11,17 +11,23 @@
 #endif
 
 #include "vm/message_loop.h"
+#include "vm/thread.h"
 
 namespace psoup {
 
 #define PlatformMessageLoop EmscriptenMessageLoop
 
+// The page's isolate is driven by the page, which calls HandleMessage and
+// HandleSignal from its event loop for as long as they answer a timeout of 0
+// or more. With EMSCRIPTEN_THREADS, the isolates it spawns run on Web Workers,
+// where Run blocks until their messages arrive, as on other platforms.
 class EmscriptenMessageLoop : public MessageLoop {
  public:
   explicit EmscriptenMessageLoop(Isolate* isolate);
   ~EmscriptenMessageLoop();
 
   void PostMessage(IsolateMessage* message);
+  void PostMessages(IsolateMessage* first, IsolateMessage* last);
   intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
   void CancelSignalWait(intptr_t wait_id);
   void MessageEpilogue(int64_t new_wakeup);
@@ -35,12 +41,14 @@ class EmscriptenMessageLoop : public MessageLoop {
 
  private:
   int ComputeTimeout();
+  IsolateMessage* TakeMessage();
 
-  IsolateMessage* WaitMessage();
-
+  Monitor monitor_;
   IsolateMessage* head_;
   IsolateMessage* tail_;
   int64_t wakeup_;
+  // Whether this loop belongs to the page's isolate rather than a worker's.
+  bool driven_by_page_;
 
   DISALLOW_COPY_AND_ASSIGN(EmscriptenMessageLoop);
 };
@@ -8,9 +8,9 @@
 #include "vm/message_loop.h"
 
 #include <errno.h>
-#include <fcntl.h>
 #include <signal.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
 
@@ -19,33 +19,16 @@
 
 namespace psoup {
 
-static bool SetBlockingHelper(intptr_t fd, bool blocking) {
-  intptr_t status;
-  status = fcntl(fd, F_GETFL);
-  if (status < 0) {
-    perror("fcntl(F_GETFL) failed");
-    return false;
-  }
-  status = blocking ? (status & ~O_NONBLOCK) : (status | O_NONBLOCK);
-  if (fcntl(fd, F_SETFL, status) < 0) {
-    perror("fcntl(F_SETFL, O_NONBLOCK) failed");
-    return false;
-  }
-  return true;
-}
-
 EPollMessageLoop::EPollMessageLoop(Isolate* isolate)
     : MessageLoop(isolate),
       mutex_(),
       head_(NULL),
       tail_(NULL),
-      wakeup_(0) {
-  int result = pipe(interrupt_fds_);
-  if (result != 0) {
-    FATAL("Failed to create pipe");
-  }
-  if (!SetBlockingHelper(interrupt_fds_[0], false)) {
-    FATAL("Failed to set pipe fd non-blocking\n");
+      wakeup_(0),
+      timer_fired_(true) {
+  interrupt_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (interrupt_fd_ == -1) {
+    FATAL("Failed to create eventfd");
   }
 
   timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
@@ -60,10 +43,10 @@ EPollMessageLoop::EPollMessageLoop(Isolate* isolate)
 
   struct epoll_event event;
   event.events = EPOLLIN;
-  event.data.fd = interrupt_fds_[0];
-  int status = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, interrupt_fds_[0], &event);
+  event.data.fd = interrupt_fd_;
+  int status = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, interrupt_fd_, &event);
   if (status == -1) {
-    FATAL("Failed to add pipe to epoll");
+    FATAL("Failed to add eventfd to epoll");
   }
 
   event.events = EPOLLIN;
@@ -77,8 +60,7 @@ EPollMessageLoop::EPollMessageLoop(Isolate* isolate)
 EPollMessageLoop::~EPollMessageLoop() {
   close(epoll_fd_);
   close(timer_fd_);
-  close(interrupt_fds_[0]);
-  close(interrupt_fds_[1]);
+  close(interrupt_fd_);
 }
 
 intptr_t EPollMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
@@ -103,19 +85,23 @@ intptr_t EPollMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
 
 void EPollMessageLoop::CancelSignalWait(intptr_t wait_id) {
   open_waits_--;
-  UNIMPLEMENTED();
+  // Fails harmlessly if the descriptor was already closed.
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, wait_id, NULL);
 }
 
 void EPollMessageLoop::MessageEpilogue(int64_t new_wakeup) {
-  wakeup_ = new_wakeup;
-
-  struct itimerspec it;
-  memset(&it, 0, sizeof(it));
-  if (new_wakeup != 0) {
-    it.it_value.tv_sec = new_wakeup / kNanosecondsPerSecond;
-    it.it_value.tv_nsec = new_wakeup % kNanosecondsPerSecond;
+  // Most messages leave the wakeup alone, so skip resetting an armed timer.
+  if ((new_wakeup != wakeup_) || ((new_wakeup != 0) && timer_fired_)) {
+    struct itimerspec it;
+    memset(&it, 0, sizeof(it));
+    if (new_wakeup != 0) {
+      it.it_value.tv_sec = new_wakeup / kNanosecondsPerSecond;
+      it.it_value.tv_nsec = new_wakeup % kNanosecondsPerSecond;
+    }
+    timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &it, NULL);
+    timer_fired_ = false;
   }
-  timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &it, NULL);
+  wakeup_ = new_wakeup;
 
   if ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
     Exit(0);
@@ -128,21 +114,27 @@ void EPollMessageLoop::Exit(intptr_t exit_code) {
 }
 
 void EPollMessageLoop::PostMessage(IsolateMessage* message) {
+  PostMessages(message, message);
+}
+
+void EPollMessageLoop::PostMessages(IsolateMessage* first,
+                                    IsolateMessage* last) {
   MutexLocker locker(&mutex_);
   if (head_ == NULL) {
-    head_ = tail_ = message;
+    head_ = first;
+    tail_ = last;
     Notify();
   } else {
-    tail_->next_ = message;
-    tail_ = message;
+    tail_->next_ = first;
+    tail_ = last;
   }
 }
 
 void EPollMessageLoop::Notify() {
-  uword message = 0;
-  ssize_t written = write(interrupt_fds_[1], &message, sizeof(message));
-  if (written != sizeof(message)) {
-    FATAL("Failed to atomically write notify message");
+  uint64_t value = 1;
+  ssize_t written = write(interrupt_fd_, &value, sizeof(value));
+  if (written != sizeof(value)) {
+    FATAL("Failed to write eventfd");
   }
 }
 
@@ -153,74 +145,96 @@ IsolateMessage* EPollMessageLoop::TakeMessages() {
   return message;
 }
 
-intptr_t EPollMessageLoop::Run() {
-  while (isolate_ != NULL) {
-    static const intptr_t kMaxEvents = 16;
-    struct epoll_event events[kMaxEvents];
+bool EPollMessageLoop::Poll(int timeout_millis) {
+  // Enough that a busy loop drains everything ready in one call.
+  static const intptr_t kMaxEvents = 256;
+  struct epoll_event events[kMaxEvents];
 
-    int result = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
-    if (result <= 0) {
-      if ((errno != EWOULDBLOCK) && (errno != EINTR)) {
-        FATAL("epoll_wait failed");
-      }
-    } else {
-      for (int i = 0; i < result; i++) {
-        if (events[i].data.fd == interrupt_fds_[0]) {
-          // Interrupt fd.
-          uword message = 0;
-          ssize_t red = read(interrupt_fds_[0], &message, sizeof(message));
-          if (red != sizeof(message)) {
-            FATAL("Failed to atomically read notify message");
-          }
-        } else if (events[i].data.fd == timer_fd_) {
-          int64_t value;
-          ssize_t ignore = read(timer_fd_, &value, sizeof(value));
-          (void)ignore;
-          DispatchWakeup();
-        } else {
-          intptr_t fd = events[i].data.fd;
-          intptr_t pending = 0;
-          if (events[i].events & EPOLLERR) {
-            pending |= kErrorEvent;
-          }
-          if (events[i].events & EPOLLIN) {
-            pending |= kReadEvent;
-          }
-          if (events[i].events & EPOLLOUT) {
-            pending |= kWriteEvent;
-          }
-          if (events[i].events & EPOLLHUP) {
-            pending |= kCloseEvent;
-          }
-          if (events[i].events & EPOLLRDHUP) {
-            pending |= kCloseEvent;
-          }
-          DispatchSignal(fd, 0, pending, 0);
+  int result = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_millis);
+  if (result <= 0) {
+    if ((result < 0) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+      FATAL("epoll_wait failed");
+    }
+  } else {
+    for (int i = 0; i < result; i++) {
+      if (events[i].data.fd == interrupt_fd_) {
+        // Resets the counter however many notifications were coalesced.
+        uint64_t value;
+        ssize_t red = read(interrupt_fd_, &value, sizeof(value));
+        if ((red != sizeof(value)) && (errno != EAGAIN)) {
+          FATAL("Failed to read eventfd");
+        }
+      } else if (events[i].data.fd == timer_fd_) {
+        int64_t value;
+        ssize_t ignore = read(timer_fd_, &value, sizeof(value));
+        (void)ignore;
+        timer_fired_ = true;
+        DispatchWakeup();
+      } else {
+        intptr_t fd = events[i].data.fd;
+        intptr_t pending = 0;
+        if (events[i].events & EPOLLERR) {
+          pending |= kErrorEvent;
+        }
+        if (events[i].events & EPOLLIN) {
+          pending |= kReadEvent;
         }
+        if (events[i].events & EPOLLOUT) {
+          pending |= kWriteEvent;
+        }
+        if (events[i].events & EPOLLHUP) {
+          pending |= kCloseEvent;
+        }
+        if (events[i].events & EPOLLRDHUP) {
+          pending |= kCloseEvent;
+        }
+        DispatchSignal(fd, 0, pending, 0);
       }
     }
-
-    IsolateMessage* message = TakeMessages();
-    while (message != NULL) {
-      IsolateMessage* next = message->next_;
-      DispatchMessage(message);
-      message = next;
-    }
   }
 
+  DispatchMessages(TakeMessages());
+  return result > 0;
+}
+
+void EPollMessageLoop::ReleaseAll() {
   if (open_ports_ > 0) {
     PortMap::CloseAllPorts(this);
   }
 
+  MutexLocker locker(&mutex_);
   while (head_ != NULL) {
     IsolateMessage* message = head_;
     head_ = message->next_;
     delete message;
   }
+  tail_ = NULL;
+}
 
+intptr_t EPollMessageLoop::Run() {
+  while (isolate_ != NULL) {
+    Poll(-1);
+  }
+  ReleaseAll();
   return exit_code_;
 }
 
+bool EPollMessageLoop::RunUntilIdle(int64_t* timeout) {
+  while ((isolate_ != NULL) && Poll(0)) {
+  }
+  if (isolate_ == NULL) {
+    ReleaseAll();
+    return false;
+  }
+  // The timer is among the descriptors polled.
+  *timeout = -1;
+  return true;
+}
+
+intptr_t EPollMessageLoop::WaitHandle() {
+  return epoll_fd_;
+}
+
 void EPollMessageLoop::Interrupt() {
   Exit(SIGINT);
   Notify();
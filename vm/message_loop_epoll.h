@@ -23,24 +23,33 @@ class EPollMessageLoop : public MessageLoop {
   ~EPollMessageLoop();
 
   void PostMessage(IsolateMessage* message);
+  void PostMessages(IsolateMessage* first, IsolateMessage* last);
   intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
   void CancelSignalWait(intptr_t wait_id);
   void MessageEpilogue(int64_t new_wakeup);
   void Exit(intptr_t exit_code);
 
   intptr_t Run();
+  bool RunUntilIdle(int64_t* timeout);
+  intptr_t WaitHandle();
   void Interrupt();
 
  private:
   IsolateMessage* TakeMessages();
   void Notify();
+  // Dispatches what was ready within |timeout_millis|, or -1 for as long as
+  // it takes. Answers whether anything was.
+  bool Poll(int timeout_millis);
+  // Closes the ports of an isolate that has exited and drops its messages.
+  void ReleaseAll();
 
   Mutex mutex_;
   IsolateMessage* head_;
   IsolateMessage* tail_;
   int64_t wakeup_;
-  int interrupt_fds_[2];
+  int interrupt_fd_;  // An eventfd.
   int timer_fd_;
+  bool timer_fired_;  // Since the timer was last set.
   int epoll_fd_;
 
   DISALLOW_COPY_AND_ASSIGN(EPollMessageLoop);
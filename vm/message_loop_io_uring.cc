@@ -0,0 +1,394 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/globals.h"  // NOLINT
+#if defined(OS_LINUX)
+
+#include "vm/message_loop.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "vm/flags.h"
+#include "vm/lockers.h"
+#include "vm/os.h"
+
+namespace psoup {
+
+static constexpr unsigned kRingEntries = 64;
+static constexpr intptr_t kSignalBits = 4;
+
+bool IOUringMessageLoop::supported_ = false;
+
+static int IOUringSetup(unsigned entries, struct io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int IOUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                        unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 NULL, 0);
+}
+
+static int IOUringRegister(int fd, unsigned opcode, void* arg,
+                           unsigned num_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, num_args);
+}
+
+template <typename T>
+static T* At(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(ring) + offset);
+}
+
+// static
+void IOUringMessageLoop::Startup() {
+  supported_ = false;
+  if (!IO_URING) {
+    return;
+  }
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = IOUringSetup(2, &params);
+  if (fd < 0) {
+    return;  // Too old, or disabled by policy.
+  }
+  static constexpr intptr_t kProbeOps = 256;
+  size_t probe_size = sizeof(struct io_uring_probe) +
+                      kProbeOps * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe* probe =
+      reinterpret_cast<struct io_uring_probe*>(malloc(probe_size));
+  memset(probe, 0, probe_size);
+  if (IOUringRegister(fd, IORING_REGISTER_PROBE, probe, kProbeOps) == 0) {
+    const uint8_t kNeeded[] = {
+      IORING_OP_READ, IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE,
+      IORING_OP_TIMEOUT, IORING_OP_TIMEOUT_REMOVE,
+    };
+    supported_ = true;
+    for (uint8_t op : kNeeded) {
+      if ((op > probe->last_op) ||
+          ((probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)) {
+        supported_ = false;
+      }
+    }
+  }
+  free(probe);
+  close(fd);
+}
+
+IOUringMessageLoop::IOUringMessageLoop(Isolate* isolate)
+    : MessageLoop(isolate),
+      mutex_(),
+      head_(NULL),
+      tail_(NULL),
+      wakeup_(0),
+      interrupt_value_(0),
+      unsubmitted_(0),
+      timer_generation_(0),
+      timer_armed_(false),
+      waits_(NULL),
+      num_waits_(0),
+      waits_capacity_(0) {
+  ASSERT(supported_);
+
+  interrupt_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (interrupt_fd_ == -1) {
+    FATAL("Failed to create eventfd");
+  }
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = IOUringSetup(kRingEntries, &params);
+  if (ring_fd_ < 0) {
+    FATAL("Failed to create io_uring");
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  cq_ring_size_ = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+  cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if ((sq_ring_ == MAP_FAILED) || (cq_ring_ == MAP_FAILED) ||
+      (sqes == MAP_FAILED)) {
+    FATAL("Failed to map io_uring");
+  }
+  sqes_ = reinterpret_cast<struct io_uring_sqe*>(sqes);
+
+  sq_head_ = At<uint32_t>(sq_ring_, params.sq_off.head);
+  sq_tail_ = At<uint32_t>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = *At<uint32_t>(sq_ring_, params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sq_array_ = At<uint32_t>(sq_ring_, params.sq_off.array);
+  cq_head_ = At<uint32_t>(cq_ring_, params.cq_off.head);
+  cq_tail_ = At<uint32_t>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = *At<uint32_t>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = At<struct io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+
+  ArmInterrupt();
+}
+
+IOUringMessageLoop::~IOUringMessageLoop() {
+  munmap(sqes_, sqes_size_);
+  munmap(cq_ring_, cq_ring_size_);
+  munmap(sq_ring_, sq_ring_size_);
+  close(ring_fd_);  // Cancels whatever is still pending.
+  close(interrupt_fd_);
+  free(waits_);
+}
+
+struct io_uring_sqe* IOUringMessageLoop::NextSubmission() {
+  uint32_t tail = *sq_tail_;
+  if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+    Enter(0);  // Full: submit without waiting.
+  }
+  uint32_t index = tail & sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  unsubmitted_++;
+  return sqe;
+}
+
+void IOUringMessageLoop::Enter(unsigned min_complete) {
+  unsigned flags = min_complete != 0 ? IORING_ENTER_GETEVENTS : 0;
+  int result = IOUringEnter(ring_fd_, unsubmitted_, min_complete, flags);
+  if (result < 0) {
+    if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+      FATAL("io_uring_enter failed");
+    }
+    return;
+  }
+  unsubmitted_ -= result;
+}
+
+void IOUringMessageLoop::ArmInterrupt() {
+  struct io_uring_sqe* sqe = NextSubmission();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = interrupt_fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&interrupt_value_);
+  sqe->len = sizeof(interrupt_value_);
+  sqe->user_data = kInterruptTag;
+}
+
+void IOUringMessageLoop::ArmPoll(intptr_t wait_id) {
+  intptr_t fd = wait_id >> kSignalBits;
+  intptr_t signals = wait_id & ((1 << kSignalBits) - 1);
+  uint32_t events = POLLRDHUP;
+  if (signals & kReadEvent) {
+    events |= POLLIN;
+  }
+  if (signals & kWriteEvent) {
+    events |= POLLOUT;
+  }
+  struct io_uring_sqe* sqe = NextSubmission();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->user_data = (static_cast<uint64_t>(wait_id) << kTagBits) | kPollTag;
+}
+
+bool IOUringMessageLoop::IsWaiting(intptr_t wait_id) const {
+  for (intptr_t i = 0; i < num_waits_; i++) {
+    if (waits_[i] == wait_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+intptr_t IOUringMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
+  open_waits_++;
+
+  intptr_t wait_id = (fd << kSignalBits) | signals;
+  if (num_waits_ == waits_capacity_) {
+    waits_capacity_ = waits_capacity_ == 0 ? 8 : waits_capacity_ * 2;
+    waits_ = reinterpret_cast<intptr_t*>(
+        realloc(waits_, waits_capacity_ * sizeof(intptr_t)));
+  }
+  waits_[num_waits_++] = wait_id;
+  ArmPoll(wait_id);
+  return wait_id;
+}
+
+void IOUringMessageLoop::CancelSignalWait(intptr_t wait_id) {
+  for (intptr_t i = 0; i < num_waits_; i++) {
+    if (waits_[i] == wait_id) {
+      waits_[i] = waits_[--num_waits_];
+      open_waits_--;
+      struct io_uring_sqe* sqe = NextSubmission();
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = (static_cast<uint64_t>(wait_id) << kTagBits) | kPollTag;
+      sqe->user_data = kIgnoredTag;
+      return;
+    }
+  }
+}
+
+void IOUringMessageLoop::MessageEpilogue(int64_t new_wakeup) {
+  // Unlike a timerfd, which is reset after every message, the ring is only
+  // told about changes.
+  if ((new_wakeup != wakeup_) || ((new_wakeup != 0) && !timer_armed_)) {
+    if (timer_armed_) {
+      struct io_uring_sqe* sqe = NextSubmission();
+      sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = (timer_generation_ << kTagBits) | kTimerTag;
+      sqe->user_data = kIgnoredTag;
+      timer_armed_ = false;
+    }
+    timer_generation_++;
+    if (new_wakeup != 0) {
+      timer_time_.tv_sec = new_wakeup / kNanosecondsPerSecond;
+      timer_time_.tv_nsec = new_wakeup % kNanosecondsPerSecond;
+      struct io_uring_sqe* sqe = NextSubmission();
+      sqe->opcode = IORING_OP_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = reinterpret_cast<uint64_t>(&timer_time_);
+      sqe->len = 1;
+      sqe->timeout_flags = IORING_TIMEOUT_ABS;
+      sqe->user_data = (timer_generation_ << kTagBits) | kTimerTag;
+      timer_armed_ = true;
+    }
+  }
+  wakeup_ = new_wakeup;
+
+  if ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
+    Exit(0);
+  }
+}
+
+void IOUringMessageLoop::Exit(intptr_t exit_code) {
+  exit_code_ = exit_code;
+  isolate_ = NULL;
+}
+
+void IOUringMessageLoop::PostMessage(IsolateMessage* message) {
+  PostMessages(message, message);
+}
+
+void IOUringMessageLoop::PostMessages(IsolateMessage* first,
+                                      IsolateMessage* last) {
+  MutexLocker locker(&mutex_);
+  if (head_ == NULL) {
+    head_ = first;
+    tail_ = last;
+    Notify();
+  } else {
+    tail_->next_ = first;
+    tail_ = last;
+  }
+}
+
+void IOUringMessageLoop::Notify() {
+  uint64_t value = 1;
+  ssize_t written = write(interrupt_fd_, &value, sizeof(value));
+  if (written != sizeof(value)) {
+    FATAL("Failed to write eventfd");
+  }
+}
+
+IsolateMessage* IOUringMessageLoop::TakeMessages() {
+  MutexLocker locker(&mutex_);
+  IsolateMessage* message = head_;
+  head_ = tail_ = NULL;
+  return message;
+}
+
+void IOUringMessageLoop::HandleCompletion(uint64_t user_data,
+                                          int32_t result) {
+  switch (user_data & ((1 << kTagBits) - 1)) {
+    case kInterruptTag:
+      // Messages are taken below.
+      ArmInterrupt();
+      break;
+    case kTimerTag:
+      if ((result == -ETIME) && timer_armed_ &&
+          ((user_data >> kTagBits) == timer_generation_)) {
+        timer_armed_ = false;
+        DispatchWakeup();
+      }
+      break;
+    case kPollTag: {
+      intptr_t wait_id = static_cast<intptr_t>(user_data >> kTagBits);
+      if (!IsWaiting(wait_id) || (result == -ECANCELED)) {
+        // Cancelled, though the same wait may have been awaited again since,
+        // and armed anew.
+        break;
+      }
+      ArmPoll(wait_id);
+      if (result < 0) {
+        break;
+      }
+      intptr_t pending = 0;
+      if (result & POLLERR) {
+        pending |= kErrorEvent;
+      }
+      if (result & POLLIN) {
+        pending |= kReadEvent;
+      }
+      if (result & POLLOUT) {
+        pending |= kWriteEvent;
+      }
+      if (result & (POLLHUP | POLLRDHUP)) {
+        pending |= kCloseEvent;
+      }
+      DispatchSignal(wait_id >> kSignalBits, 0, pending, 0);
+      break;
+    }
+    case kIgnoredTag:
+      break;
+  }
+}
+
+intptr_t IOUringMessageLoop::Run() {
+  while (isolate_ != NULL) {
+    Enter(1);
+
+    uint32_t head = *cq_head_;
+    while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+      uint64_t user_data = cqe->user_data;
+      int32_t result = cqe->res;
+      head++;
+      // Release the entry before dispatching, which may submit more.
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      HandleCompletion(user_data, result);
+    }
+
+    DispatchMessages(TakeMessages());
+  }
+
+  if (open_ports_ > 0) {
+    PortMap::CloseAllPorts(this);
+  }
+
+  while (head_ != NULL) {
+    IsolateMessage* message = head_;
+    head_ = message->next_;
+    delete message;
+  }
+
+  return exit_code_;
+}
+
+void IOUringMessageLoop::Interrupt() {
+  Exit(SIGINT);
+  Notify();
+}
+
+}  // namespace psoup
+
+#endif  // defined(OS_LINUX)
@@ -0,0 +1,105 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_MESSAGE_LOOP_IO_URING_H_
+#define VM_MESSAGE_LOOP_IO_URING_H_
+
+#if !defined(VM_MESSAGE_LOOP_H_)
+#error Do not include message_loop_io_uring.h directly; use message_loop.h \
+  instead.
+#endif
+
+#include <linux/io_uring.h>
+
+#include "vm/message_loop.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+// An alternative to EPollMessageLoop that queues its signal waits, timer
+// changes and interrupt reads in a ring shared with the kernel, so one
+// io_uring_enter both submits everything queued since the last wait and
+// waits again. Chosen by MessageLoop::New when the kernel supports it.
+class IOUringMessageLoop : public MessageLoop {
+ public:
+  explicit IOUringMessageLoop(Isolate* isolate);
+  ~IOUringMessageLoop();
+
+  // Probes whether the kernel has the ring operations this loop uses.
+  static void Startup();
+  static bool IsSupported() { return supported_; }
+
+  void PostMessage(IsolateMessage* message);
+  void PostMessages(IsolateMessage* first, IsolateMessage* last);
+  intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
+  void CancelSignalWait(intptr_t wait_id);
+  void MessageEpilogue(int64_t new_wakeup);
+  void Exit(intptr_t exit_code);
+
+  intptr_t Run();
+  void Interrupt();
+
+ private:
+  // The low bits of a submission's user_data say what it was for.
+  enum {
+    kInterruptTag = 0,
+    kTimerTag = 1,
+    kPollTag = 2,
+    kIgnoredTag = 3,
+    kTagBits = 2,
+  };
+
+  struct io_uring_sqe* NextSubmission();
+  void Enter(unsigned min_complete);
+  void ArmInterrupt();
+  void ArmPoll(intptr_t wait_id);
+  void HandleCompletion(uint64_t user_data, int32_t result);
+  bool IsWaiting(intptr_t wait_id) const;
+  IsolateMessage* TakeMessages();
+  void Notify();
+
+  static bool supported_;
+
+  Mutex mutex_;
+  IsolateMessage* head_;
+  IsolateMessage* tail_;
+  int64_t wakeup_;
+  int interrupt_fd_;  // An eventfd.
+  uint64_t interrupt_value_;
+
+  int ring_fd_;
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  uint32_t* sq_head_;
+  uint32_t* sq_tail_;
+  uint32_t sq_mask_;
+  uint32_t sq_entries_;
+  uint32_t* sq_array_;
+  uint32_t* cq_head_;
+  uint32_t* cq_tail_;
+  uint32_t cq_mask_;
+  struct io_uring_cqe* cqes_;
+  uint32_t unsubmitted_;
+
+  // A timeout's time must stay put until the kernel reads it at submission.
+  struct __kernel_timespec timer_time_;
+  uint64_t timer_generation_;
+  bool timer_armed_;
+
+  // Polls are one-shot, so each is re-armed after it fires while its wait is
+  // still wanted. A wait id holds the fd and the signals.
+  intptr_t* waits_;
+  intptr_t num_waits_;
+  intptr_t waits_capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOUringMessageLoop);
+};
+
+}  // namespace psoup
+
+#endif  // VM_MESSAGE_LOOP_IO_URING_H_
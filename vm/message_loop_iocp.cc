@@ -56,13 +56,19 @@ void IOCPMessageLoop::Exit(intptr_t exit_code) {
 }
 
 void IOCPMessageLoop::PostMessage(IsolateMessage* message) {
+  PostMessages(message, message);
+}
+
+void IOCPMessageLoop::PostMessages(IsolateMessage* first,
+                                   IsolateMessage* last) {
   MutexLocker locker(&mutex_);
   if (head_ == NULL) {
-    head_ = tail_ = message;
+    head_ = first;
+    tail_ = last;
     Notify();
   } else {
-    tail_->next_ = message;
-    tail_ = message;
+    tail_->next_ = first;
+    tail_ = last;
   }
 }
 
@@ -99,28 +105,36 @@ intptr_t IOCPMessageLoop::Run() {
       timeout = static_cast<DWORD>(timeout64);
     }
 
-    DWORD bytes;
-    ULONG_PTR key;
-    OVERLAPPED* overlapped;
-    BOOL ok = GetQueuedCompletionStatus(completion_port_, &bytes,
-                                        &key, &overlapped, timeout);
-    if (!ok && (overlapped == NULL)) {
-      // Timeout.
-      if ((wakeup_ != 0) && (OS::CurrentMonotonicNanos() >= wakeup_)) {
-        DispatchWakeup();
+    // Enough that a busy loop drains everything ready in one call, as the
+    // other backends do.
+    static const ULONG kMaxEntries = 256;
+    OVERLAPPED_ENTRY entries[kMaxEntries];
+    ULONG count = 0;
+    BOOL ok = GetQueuedCompletionStatusEx(completion_port_, entries,
+                                          kMaxEntries, &count, timeout,
+                                          FALSE);
+    if (!ok) {
+      if (GetLastError() != WAIT_TIMEOUT) {
+        FATAL("GetQueuedCompletionStatusEx failed");
+      }
+      count = 0;
+    }
+    for (ULONG i = 0; i < count; i++) {
+      if (entries[i].lpCompletionKey == reinterpret_cast<ULONG_PTR>(this)) {
+        // Notify or Interrupt: the messages are taken below, however many
+        // notifications were coalesced.
+      } else {
+        UNIMPLEMENTED();
       }
-    } else if (key == reinterpret_cast<ULONG_PTR>(this)) {
-      // Interrupt: will check messages below.
-    } else {
-      UNIMPLEMENTED();
     }
 
-    IsolateMessage* message = TakeMessages();
-    while (message != NULL) {
-      IsolateMessage* next = message->next_;
-      DispatchMessage(message);
-      message = next;
+    // Checked after every wait, so a steady stream of messages does not
+    // hold back a due timer.
+    if ((wakeup_ != 0) && (OS::CurrentMonotonicNanos() >= wakeup_)) {
+      DispatchWakeup();
     }
+
+    DispatchMessages(TakeMessages());
   }
 
   if (open_ports_ > 0) {
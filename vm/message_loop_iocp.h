@@ -23,6 +23,7 @@ class IOCPMessageLoop : public MessageLoop {
   ~IOCPMessageLoop();
 
   void PostMessage(IsolateMessage* message);
+  void PostMessages(IsolateMessage* first, IsolateMessage* last);
   intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
   void CancelSignalWait(intptr_t wait_id);
   void MessageEpilogue(int64_t new_wakeup);
@@ -96,7 +96,13 @@ intptr_t KQueueMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
 
 void KQueueMessageLoop::CancelSignalWait(intptr_t wait_id) {
   open_waits_--;
-  UNIMPLEMENTED();
+  // One filter at a time, since either may not have been added. Fails
+  // harmlessly if the descriptor was already closed.
+  struct kevent change;
+  EV_SET(&change, wait_id, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  kevent(kqueue_fd_, &change, 1, NULL, 0, NULL);
+  EV_SET(&change, wait_id, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+  kevent(kqueue_fd_, &change, 1, NULL, 0, NULL);
 }
 
 void KQueueMessageLoop::MessageEpilogue(int64_t new_wakeup) {
@@ -113,13 +119,19 @@ void KQueueMessageLoop::Exit(intptr_t exit_code) {
 }
 
 void KQueueMessageLoop::PostMessage(IsolateMessage* message) {
+  PostMessages(message, message);
+}
+
+void KQueueMessageLoop::PostMessages(IsolateMessage* first,
+                                     IsolateMessage* last) {
   MutexLocker locker(&mutex_);
   if (head_ == NULL) {
-    head_ = tail_ = message;
+    head_ = first;
+    tail_ = last;
     Notify();
   } else {
-    tail_->next_ = message;
-    tail_ = message;
+    tail_->next_ = first;
+    tail_ = last;
   }
 }
 
@@ -138,94 +150,124 @@ IsolateMessage* KQueueMessageLoop::TakeMessages() {
   return message;
 }
 
-intptr_t KQueueMessageLoop::Run() {
-  while (isolate_ != NULL) {
-    struct timespec* timeout = NULL;
-    struct timespec ts;
-    if (wakeup_ == 0) {
-      // NULL pointer timespec for infinite timeout.
-    } else {
-      int64_t nanos = wakeup_ - OS::CurrentMonotonicNanos();
-      if (nanos < 0) {
-        nanos = 0;
-      }
-      ts.tv_sec = nanos / kNanosecondsPerSecond;
-      ts.tv_nsec = nanos % kNanosecondsPerSecond;
-      timeout = &ts;
+bool KQueueMessageLoop::Poll(bool block) {
+  struct timespec* timeout = NULL;
+  struct timespec ts;
+  if (!block) {
+    ts.tv_sec = 0;
+    ts.tv_nsec = 0;
+    timeout = &ts;
+  } else if (wakeup_ == 0) {
+    // NULL pointer timespec for infinite timeout.
+  } else {
+    int64_t nanos = wakeup_ - OS::CurrentMonotonicNanos();
+    if (nanos < 0) {
+      nanos = 0;
     }
+    ts.tv_sec = nanos / kNanosecondsPerSecond;
+    ts.tv_nsec = nanos % kNanosecondsPerSecond;
+    timeout = &ts;
+  }
 
-    static const intptr_t kMaxEvents = 16;
-    struct kevent events[kMaxEvents];
-    int result = kevent(kqueue_fd_, NULL, 0, events, kMaxEvents, timeout);
-    if ((result == -1) && (errno != EINTR)) {
-      FATAL("kevent failed");
-    }
+  static const intptr_t kMaxEvents = 16;
+  struct kevent events[kMaxEvents];
+  int result = kevent(kqueue_fd_, NULL, 0, events, kMaxEvents, timeout);
+  if ((result == -1) && (errno != EINTR)) {
+    FATAL("kevent failed");
+  }
 
-    if ((wakeup_ != 0) && (OS::CurrentMonotonicNanos() >= wakeup_)) {
-      DispatchWakeup();
-    }
+  if ((wakeup_ != 0) && (OS::CurrentMonotonicNanos() >= wakeup_)) {
+    DispatchWakeup();
+  }
 
-    for (int i = 0; i < result; i++) {
-      if ((events[i].flags & EV_ERROR) != 0) {
-        FATAL("kevent failed\n");
+  for (int i = 0; i < result; i++) {
+    if ((events[i].flags & EV_ERROR) != 0) {
+      FATAL("kevent failed\n");
+    }
+    if (events[i].udata == NULL) {
+      // Interrupt fd.
+      uword message = 0;
+      ssize_t red = read(interrupt_fds_[0], &message, sizeof(message));
+      if (red != sizeof(message)) {
+        FATAL("Failed to atomically read notify message");
       }
-      if (events[i].udata == NULL) {
-        // Interrupt fd.
-        uword message = 0;
-        ssize_t red = read(interrupt_fds_[0], &message, sizeof(message));
-        if (red != sizeof(message)) {
-          FATAL("Failed to atomically read notify message");
-        }
-      } else {
-        intptr_t fd = events[i].ident;
-        intptr_t pending = 0;
-        intptr_t status = 0;
-        if (events[i].filter == EVFILT_READ) {
-          pending |= kReadEvent;
-          if ((events[i].flags & EV_EOF) != 0) {
-            if (events[i].fflags != 0) {
-              pending = kErrorEvent;
-              status = events[i].fflags;
-            } else {
-              pending |= kCloseEvent;
-            }
+    } else {
+      intptr_t fd = events[i].ident;
+      intptr_t pending = 0;
+      intptr_t status = 0;
+      if (events[i].filter == EVFILT_READ) {
+        pending |= kReadEvent;
+        if ((events[i].flags & EV_EOF) != 0) {
+          if (events[i].fflags != 0) {
+            pending = kErrorEvent;
+            status = events[i].fflags;
+          } else {
+            pending |= kCloseEvent;
           }
-        } else if (events[i].filter == EVFILT_WRITE) {
-          pending |= kWriteEvent;
-          if ((events[i].flags & EV_EOF) != 0) {
-            if (events[i].fflags != 0) {
-              pending = kErrorEvent;
-              status = events[i].fflags;
-            }
+        }
+      } else if (events[i].filter == EVFILT_WRITE) {
+        pending |= kWriteEvent;
+        if ((events[i].flags & EV_EOF) != 0) {
+          if (events[i].fflags != 0) {
+            pending = kErrorEvent;
+            status = events[i].fflags;
           }
-        } else {
-          UNREACHABLE();
         }
-        DispatchSignal(fd, status, pending, 0);
+      } else {
+        UNREACHABLE();
       }
-    }
-
-    IsolateMessage* message = TakeMessages();
-    while (message != NULL) {
-      IsolateMessage* next = message->next_;
-      DispatchMessage(message);
-      message = next;
+      DispatchSignal(fd, status, pending, 0);
     }
   }
 
+  DispatchMessages(TakeMessages());
+  return result > 0;
+}
+
+void KQueueMessageLoop::ReleaseAll() {
   if (open_ports_ > 0) {
     PortMap::CloseAllPorts(this);
   }
 
+  MutexLocker locker(&mutex_);
   while (head_ != NULL) {
     IsolateMessage* message = head_;
     head_ = message->next_;
     delete message;
   }
+  tail_ = NULL;
+}
 
+intptr_t KQueueMessageLoop::Run() {
+  while (isolate_ != NULL) {
+    Poll(true);
+  }
+  ReleaseAll();
   return exit_code_;
 }
 
+bool KQueueMessageLoop::RunUntilIdle(int64_t* timeout) {
+  while ((isolate_ != NULL) && Poll(false)) {
+  }
+  if (isolate_ == NULL) {
+    ReleaseAll();
+    return false;
+  }
+  // Wakeups are kept by kevent's timeout rather than by a filter, so the
+  // embedder waits for them.
+  if (wakeup_ == 0) {
+    *timeout = -1;
+  } else {
+    int64_t nanos = wakeup_ - OS::CurrentMonotonicNanos();
+    *timeout = nanos < 0 ? 0 : nanos;
+  }
+  return true;
+}
+
+intptr_t KQueueMessageLoop::WaitHandle() {
+  return kqueue_fd_;
+}
+
 void KQueueMessageLoop::Interrupt() {
   Exit(SIGINT);
   Notify();
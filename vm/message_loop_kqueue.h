@@ -23,17 +23,25 @@ class KQueueMessageLoop : public MessageLoop {
   ~KQueueMessageLoop();
 
   void PostMessage(IsolateMessage* message);
+  void PostMessages(IsolateMessage* first, IsolateMessage* last);
   intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
   void CancelSignalWait(intptr_t wait_id);
   void MessageEpilogue(int64_t new_wakeup);
   void Exit(intptr_t exit_code);
 
   intptr_t Run();
+  bool RunUntilIdle(int64_t* timeout);
+  intptr_t WaitHandle();
   void Interrupt();
 
  private:
   IsolateMessage* TakeMessages();
   void Notify();
+  // Dispatches what was ready, waiting for something if |block|. Answers
+  // whether anything was.
+  bool Poll(bool block);
+  // Closes the ports of an isolate that has exited and drops its messages.
+  void ReleaseAll();
 
   Mutex mutex_;
   IsolateMessage* head_;
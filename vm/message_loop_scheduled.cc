@@ -0,0 +1,862 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/globals.h"  // NOLINT
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+
+#include "vm/message_loop.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "vm/isolate.h"
+#include "vm/lockers.h"
+#include "vm/os.h"
+
+namespace psoup {
+
+// How long an isolate may keep a worker while others wait for one.
+static constexpr int64_t kTimeSlice = 10 * kNanosecondsPerMillisecond;
+
+class IsolateScheduler {
+ public:
+  IsolateScheduler();
+  ~IsolateScheduler();
+
+  void Start();
+  // Waits for the detached isolates to exit, then stops the threads.
+  void Stop();
+
+  void Enqueue(ScheduledMessageLoop* loop) {
+    MonitorLocker ml(&monitor_);
+    EnqueueLocked(&ml, loop);
+  }
+  // A |wakeup| of 0 cancels the loop's wakeup.
+  void SetWakeup(ScheduledMessageLoop* loop, int64_t wakeup);
+  void AddWait(ScheduledMessageLoop* loop, intptr_t fd, intptr_t signals);
+  void RemoveWait(ScheduledMessageLoop* loop, intptr_t fd);
+  // Forgets the loop's wakeup and waits, once it can get no more work.
+  void Unregister(ScheduledMessageLoop* loop);
+
+  void Detached();
+  void DetachedExited();
+  void Done(ScheduledMessageLoop* loop);
+  void WaitDone(ScheduledMessageLoop* loop);
+
+ private:
+  struct Worker {
+    IsolateScheduler* scheduler;
+    ScheduledMessageLoop* running;
+    int64_t slice_end;
+    ThreadJoinId join_id;
+  };
+
+  static void WorkerMain(uword parameter);
+  void RunWorker(Worker* worker);
+  static void PollerMain(uword parameter);
+  void RunPoller();
+  void ThreadExited();
+
+  void EnqueueLocked(MonitorLocker* ml, ScheduledMessageLoop* loop);
+  void WakePoller();
+  void ArmTimer(int64_t deadline);
+  void AddSignal(MonitorLocker* ml, intptr_t fd, uint32_t events);
+  void FireTimers(MonitorLocker* ml, int64_t now);
+  // Asks isolates past their slice to yield. Returns when to check again, or
+  // 0 if nothing is waiting for a worker.
+  int64_t CheckSlices(int64_t now);
+
+  void TimerInsert(ScheduledMessageLoop* loop);
+  void TimerRemove(ScheduledMessageLoop* loop);
+  void TimerSet(intptr_t index, ScheduledMessageLoop* loop) {
+    timers_[index] = loop;
+    loop->timer_index_ = index;
+  }
+  void SiftUp(intptr_t index);
+  void SiftDown(intptr_t index);
+
+  // Protects the run queue, the workers' state, the timers and the waits.
+  Monitor monitor_;
+  ScheduledMessageLoop* run_head_;
+  ScheduledMessageLoop* run_tail_;
+  Worker* workers_;
+  intptr_t num_workers_;
+  intptr_t num_idle_;
+  bool ticking_;  // The poller will check the slices again.
+  bool stopping_;
+
+  ScheduledMessageLoop** timers_;  // Binary heap by deadline.
+  intptr_t num_timers_;
+  intptr_t timers_capacity_;
+  int64_t armed_deadline_;
+  ScheduledMessageLoop** waiters_;  // By file descriptor.
+  intptr_t waiters_capacity_;
+
+  int epoll_fd_;
+  int interrupt_fd_;  // An eventfd.
+  int timer_fd_;
+  ThreadJoinId poller_join_id_;
+
+  Monitor exit_monitor_;
+  intptr_t num_detached_;
+  intptr_t num_exited_;  // Threads.
+
+  DISALLOW_COPY_AND_ASSIGN(IsolateScheduler);
+};
+
+IsolateScheduler::IsolateScheduler()
+    : run_head_(NULL),
+      run_tail_(NULL),
+      workers_(NULL),
+      num_workers_(0),
+      num_idle_(0),
+      ticking_(false),
+      stopping_(false),
+      timers_(NULL),
+      num_timers_(0),
+      timers_capacity_(0),
+      armed_deadline_(0),
+      waiters_(NULL),
+      waiters_capacity_(0),
+      epoll_fd_(-1),
+      interrupt_fd_(-1),
+      timer_fd_(-1),
+      poller_join_id_(Thread::kInvalidThreadJoinId),
+      num_detached_(0),
+      num_exited_(0) {}
+
+IsolateScheduler::~IsolateScheduler() {
+  delete[] workers_;
+  delete[] timers_;
+  delete[] waiters_;
+  close(epoll_fd_);
+  close(timer_fd_);
+  close(interrupt_fd_);
+}
+
+void IsolateScheduler::Start() {
+  interrupt_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (interrupt_fd_ == -1) {
+    FATAL("Failed to create eventfd");
+  }
+
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (timer_fd_ == -1) {
+    FATAL("Failed to create timer_fd");
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1) {
+    FATAL("Failed to create epoll");
+  }
+
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = interrupt_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, interrupt_fd_, &event) == -1) {
+    FATAL("Failed to add eventfd to epoll");
+  }
+  event.events = EPOLLIN;
+  event.data.fd = timer_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event) == -1) {
+    FATAL("Failed to add timer_fd to epoll");
+  }
+
+  num_workers_ = OS::NumberOfAvailableProcessors();
+  if (num_workers_ < 1) {
+    num_workers_ = 1;
+  }
+  workers_ = new Worker[num_workers_];
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    workers_[i].scheduler = this;
+    workers_[i].running = NULL;
+    workers_[i].slice_end = 0;
+    workers_[i].join_id = Thread::kInvalidThreadJoinId;
+    if (Thread::Start("PSoup Isolate Worker", &IsolateScheduler::WorkerMain,
+                      reinterpret_cast<uword>(&workers_[i])) != 0) {
+      FATAL("Failed to start isolate worker");
+    }
+  }
+  if (Thread::Start("PSoup Isolate Poller", &IsolateScheduler::PollerMain,
+                    reinterpret_cast<uword>(this)) != 0) {
+    FATAL("Failed to start isolate poller");
+  }
+}
+
+void IsolateScheduler::Stop() {
+  {
+    MonitorLocker ml(&exit_monitor_);
+    while (num_detached_ > 0) {
+      ml.Wait();
+    }
+  }
+  {
+    MonitorLocker ml(&monitor_);
+    stopping_ = true;
+    ml.NotifyAll();
+  }
+  WakePoller();
+  {
+    MonitorLocker ml(&exit_monitor_);
+    while (num_exited_ < num_workers_ + 1) {
+      ml.Wait();
+    }
+  }
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    Thread::Join(workers_[i].join_id);
+  }
+  Thread::Join(poller_join_id_);
+}
+
+void IsolateScheduler::ThreadExited() {
+  MonitorLocker ml(&exit_monitor_);
+  num_exited_++;
+  ml.NotifyAll();
+}
+
+void IsolateScheduler::Detached() {
+  MonitorLocker ml(&exit_monitor_);
+  num_detached_++;
+}
+
+void IsolateScheduler::DetachedExited() {
+  MonitorLocker ml(&exit_monitor_);
+  num_detached_--;
+  ml.NotifyAll();
+}
+
+void IsolateScheduler::Done(ScheduledMessageLoop* loop) {
+  MonitorLocker ml(&exit_monitor_);
+  loop->done_ = true;
+  ml.NotifyAll();
+}
+
+void IsolateScheduler::WaitDone(ScheduledMessageLoop* loop) {
+  MonitorLocker ml(&exit_monitor_);
+  while (!loop->done_) {
+    ml.Wait();
+  }
+}
+
+void IsolateScheduler::EnqueueLocked(MonitorLocker* ml,
+                                     ScheduledMessageLoop* loop) {
+  ASSERT(loop->run_next_ == NULL);
+  if (run_tail_ == NULL) {
+    run_head_ = run_tail_ = loop;
+  } else {
+    run_tail_->run_next_ = loop;
+    run_tail_ = loop;
+  }
+  if (num_idle_ > 0) {
+    ml->Notify();
+  } else if (!ticking_) {
+    // Every worker is busy, so their slices start to matter.
+    ticking_ = true;
+    WakePoller();
+  }
+}
+
+void IsolateScheduler::WakePoller() {
+  uint64_t value = 1;
+  ssize_t written = write(interrupt_fd_, &value, sizeof(value));
+  if (written != sizeof(value)) {
+    FATAL("Failed to write eventfd");
+  }
+}
+
+void IsolateScheduler::ArmTimer(int64_t deadline) {
+  struct itimerspec it;
+  memset(&it, 0, sizeof(it));
+  if (deadline != 0) {
+    it.it_value.tv_sec = deadline / kNanosecondsPerSecond;
+    it.it_value.tv_nsec = deadline % kNanosecondsPerSecond;
+  }
+  timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &it, NULL);
+  armed_deadline_ = deadline;
+}
+
+void IsolateScheduler::SetWakeup(ScheduledMessageLoop* loop, int64_t wakeup) {
+  MonitorLocker ml(&monitor_);
+  if (loop->timer_index_ >= 0) {
+    TimerRemove(loop);
+  }
+  if (wakeup == 0) {
+    return;
+  }
+  loop->timer_deadline_ = wakeup;
+  TimerInsert(loop);
+  // A later deadline is left for the poller, which wakes early at worst.
+  if ((armed_deadline_ == 0) || (wakeup < armed_deadline_)) {
+    ArmTimer(wakeup);
+  }
+}
+
+void IsolateScheduler::AddWait(ScheduledMessageLoop* loop,
+                               intptr_t fd,
+                               intptr_t signals) {
+  MonitorLocker ml(&monitor_);
+  if (fd >= waiters_capacity_) {
+    intptr_t new_capacity = waiters_capacity_ == 0 ? 64 : waiters_capacity_;
+    while (new_capacity <= fd) {
+      new_capacity *= 2;
+    }
+    ScheduledMessageLoop** new_waiters =
+        new ScheduledMessageLoop*[new_capacity];
+    memset(new_waiters, 0, new_capacity * sizeof(ScheduledMessageLoop*));
+    if (waiters_ != NULL) {
+      memcpy(new_waiters, waiters_,
+             waiters_capacity_ * sizeof(ScheduledMessageLoop*));
+    }
+    delete[] waiters_;
+    waiters_ = new_waiters;
+    waiters_capacity_ = new_capacity;
+  }
+  ASSERT(waiters_[fd] == NULL);
+  waiters_[fd] = loop;
+
+  struct epoll_event event;
+  event.events = EPOLLRDHUP | EPOLLET;
+  if (signals & kReadEvent) {
+    event.events |= EPOLLIN;
+  }
+  if (signals & kWriteEvent) {
+    event.events |= EPOLLOUT;
+  }
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == -1) {
+    FATAL("Failed to add to epoll");
+  }
+}
+
+void IsolateScheduler::RemoveWait(ScheduledMessageLoop* loop, intptr_t fd) {
+  MonitorLocker ml(&monitor_);
+  if ((fd < waiters_capacity_) && (waiters_[fd] == loop)) {
+    waiters_[fd] = NULL;
+    // Fails harmlessly if the descriptor was already closed.
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+  }
+}
+
+void IsolateScheduler::Unregister(ScheduledMessageLoop* loop) {
+  MonitorLocker ml(&monitor_);
+  ASSERT(loop->run_next_ == NULL);
+  if (loop->timer_index_ >= 0) {
+    TimerRemove(loop);
+  }
+  for (intptr_t fd = 0; fd < waiters_capacity_; fd++) {
+    if (waiters_[fd] == loop) {
+      waiters_[fd] = NULL;
+      // Fails harmlessly if the descriptor was already closed.
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+    }
+  }
+}
+
+void IsolateScheduler::TimerInsert(ScheduledMessageLoop* loop) {
+  if (num_timers_ == timers_capacity_) {
+    intptr_t new_capacity = timers_capacity_ == 0 ? 64 : timers_capacity_ * 2;
+    ScheduledMessageLoop** new_timers = new ScheduledMessageLoop*[new_capacity];
+    if (timers_ != NULL) {
+      memcpy(new_timers, timers_, num_timers_ * sizeof(ScheduledMessageLoop*));
+    }
+    delete[] timers_;
+    timers_ = new_timers;
+    timers_capacity_ = new_capacity;
+  }
+  TimerSet(num_timers_, loop);
+  num_timers_++;
+  SiftUp(num_timers_ - 1);
+}
+
+void IsolateScheduler::TimerRemove(ScheduledMessageLoop* loop) {
+  intptr_t index = loop->timer_index_;
+  ASSERT((index >= 0) && (index < num_timers_) && (timers_[index] == loop));
+  loop->timer_index_ = -1;
+  num_timers_--;
+  if (index == num_timers_) {
+    return;
+  }
+  TimerSet(index, timers_[num_timers_]);
+  SiftUp(index);
+  SiftDown(timers_[index]->timer_index_);
+}
+
+void IsolateScheduler::SiftUp(intptr_t index) {
+  ScheduledMessageLoop* loop = timers_[index];
+  while (index > 0) {
+    intptr_t parent = (index - 1) / 2;
+    if (timers_[parent]->timer_deadline_ <= loop->timer_deadline_) {
+      break;
+    }
+    TimerSet(index, timers_[parent]);
+    index = parent;
+  }
+  TimerSet(index, loop);
+}
+
+void IsolateScheduler::SiftDown(intptr_t index) {
+  ScheduledMessageLoop* loop = timers_[index];
+  for (;;) {
+    intptr_t child = 2 * index + 1;
+    if (child >= num_timers_) {
+      break;
+    }
+    if ((child + 1 < num_timers_) &&
+        (timers_[child + 1]->timer_deadline_ <
+         timers_[child]->timer_deadline_)) {
+      child++;
+    }
+    if (loop->timer_deadline_ <= timers_[child]->timer_deadline_) {
+      break;
+    }
+    TimerSet(index, timers_[child]);
+    index = child;
+  }
+  TimerSet(index, loop);
+}
+
+// static
+void IsolateScheduler::WorkerMain(uword parameter) {
+  Worker* worker = reinterpret_cast<Worker*>(parameter);
+  worker->scheduler->RunWorker(worker);
+}
+
+void IsolateScheduler::RunWorker(Worker* worker) {
+  worker->join_id = Thread::GetCurrentThreadJoinId();
+  {
+    MonitorLocker ml(&monitor_);
+    for (;;) {
+      while ((run_head_ == NULL) && !stopping_) {
+        num_idle_++;
+        ml.Wait();
+        num_idle_--;
+      }
+      if (run_head_ == NULL) {
+        break;
+      }
+
+      ScheduledMessageLoop* loop = run_head_;
+      run_head_ = loop->run_next_;
+      if (run_head_ == NULL) {
+        run_tail_ = NULL;
+      } else if (!ticking_) {
+        ticking_ = true;
+        WakePoller();
+      }
+      loop->run_next_ = NULL;
+      worker->running = loop;
+      worker->slice_end = OS::CurrentMonotonicNanos() + kTimeSlice;
+      int64_t deadline = worker->slice_end;
+
+      ml.Exit();
+      bool exited = loop->RunSlice(deadline);
+      ml.Enter();
+      // From here the poller no longer touches the isolate.
+      worker->running = NULL;
+      if (exited) {
+        ml.Exit();
+        loop->Finish();
+        ml.Enter();
+      }
+    }
+  }
+  ThreadExited();
+}
+
+// static
+void IsolateScheduler::PollerMain(uword parameter) {
+  reinterpret_cast<IsolateScheduler*>(parameter)->RunPoller();
+}
+
+void IsolateScheduler::RunPoller() {
+  poller_join_id_ = Thread::GetCurrentThreadJoinId();
+  for (;;) {
+    static const intptr_t kMaxEvents = 256;
+    struct epoll_event events[kMaxEvents];
+
+    int result = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if ((result < 0) && (errno != EINTR)) {
+      FATAL("epoll_wait failed");
+    }
+
+    MonitorLocker ml(&monitor_);
+    if (stopping_) {
+      break;
+    }
+    for (int i = 0; i < result; i++) {
+      if (events[i].data.fd == interrupt_fd_) {
+        uint64_t value;
+        ssize_t red = read(interrupt_fd_, &value, sizeof(value));
+        if ((red != sizeof(value)) && (errno != EAGAIN)) {
+          FATAL("Failed to read eventfd");
+        }
+      } else if (events[i].data.fd == timer_fd_) {
+        uint64_t value;
+        ssize_t ignore = read(timer_fd_, &value, sizeof(value));
+        (void)ignore;
+      } else {
+        AddSignal(&ml, events[i].data.fd, events[i].events);
+      }
+    }
+
+    int64_t now = OS::CurrentMonotonicNanos();
+    FireTimers(&ml, now);
+    int64_t next = num_timers_ > 0 ? timers_[0]->timer_deadline_ : 0;
+    int64_t slice_check = CheckSlices(now);
+    if ((slice_check != 0) && ((next == 0) || (slice_check < next))) {
+      next = slice_check;
+    }
+    ArmTimer(next);
+  }
+  ThreadExited();
+}
+
+void IsolateScheduler::AddSignal(MonitorLocker* ml,
+                                 intptr_t fd,
+                                 uint32_t events) {
+  if ((fd >= waiters_capacity_) || (waiters_[fd] == NULL)) {
+    return;  // Its isolate exited after the event was read.
+  }
+  ScheduledMessageLoop* loop = waiters_[fd];
+
+  intptr_t pending = 0;
+  if (events & EPOLLERR) {
+    pending |= kErrorEvent;
+  }
+  if (events & EPOLLIN) {
+    pending |= kReadEvent;
+  }
+  if (events & EPOLLOUT) {
+    pending |= kWriteEvent;
+  }
+  if (events & (EPOLLHUP | EPOLLRDHUP)) {
+    pending |= kCloseEvent;
+  }
+
+  ScheduledMessageLoop::Signal* signal = new ScheduledMessageLoop::Signal;
+  signal->fd = fd;
+  signal->signals = pending;
+  signal->next = NULL;
+  bool enqueue;
+  {
+    MutexLocker locker(&loop->mutex_);
+    if (loop->signals_tail_ == NULL) {
+      loop->signals_ = signal;
+    } else {
+      loop->signals_tail_->next = signal;
+    }
+    loop->signals_tail_ = signal;
+    enqueue = loop->MakeReadyLocked();
+  }
+  if (enqueue) {
+    EnqueueLocked(ml, loop);
+  }
+}
+
+void IsolateScheduler::FireTimers(MonitorLocker* ml, int64_t now) {
+  while ((num_timers_ > 0) && (timers_[0]->timer_deadline_ <= now)) {
+    ScheduledMessageLoop* loop = timers_[0];
+    TimerRemove(loop);
+    bool enqueue;
+    {
+      MutexLocker locker(&loop->mutex_);
+      loop->timer_fired_ = true;
+      loop->wakeup_due_ = true;
+      enqueue = loop->MakeReadyLocked();
+    }
+    if (enqueue) {
+      EnqueueLocked(ml, loop);
+    }
+  }
+}
+
+int64_t IsolateScheduler::CheckSlices(int64_t now) {
+  ticking_ = false;
+  if (run_head_ == NULL) {
+    return 0;
+  }
+  int64_t next = 0;
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    Worker* worker = &workers_[i];
+    if (worker->running == NULL) {
+      continue;
+    }
+    if (worker->slice_end <= now) {
+      worker->running->owner_->RequestYield();
+      // Asked again if it is still running then, e.g., in a long primitive.
+      worker->slice_end = now + kTimeSlice;
+    }
+    if ((next == 0) || (worker->slice_end < next)) {
+      next = worker->slice_end;
+    }
+  }
+  ticking_ = next != 0;
+  return next;
+}
+
+IsolateScheduler* ScheduledMessageLoop::scheduler_ = NULL;
+
+// static
+void ScheduledMessageLoop::Startup() {
+  ASSERT(scheduler_ == NULL);
+  scheduler_ = new IsolateScheduler();
+  scheduler_->Start();
+}
+
+// static
+void ScheduledMessageLoop::Shutdown() {
+  if (scheduler_ == NULL) {
+    return;
+  }
+  scheduler_->Stop();
+  delete scheduler_;
+  scheduler_ = NULL;
+}
+
+ScheduledMessageLoop::ScheduledMessageLoop(Isolate* isolate)
+    : MessageLoop(isolate),
+      owner_(isolate),
+      mutex_(),
+      head_(NULL),
+      tail_(NULL),
+      signals_(NULL),
+      signals_tail_(NULL),
+      wakeup_due_(false),
+      timer_fired_(true),
+      state_(kStarting),
+      rerun_(false),
+      wakeup_(0),
+      detached_(false),
+      done_(false),
+      run_next_(NULL),
+      timer_index_(-1),
+      timer_deadline_(0) {}
+
+ScheduledMessageLoop::~ScheduledMessageLoop() {
+  while (head_ != NULL) {
+    IsolateMessage* message = head_;
+    head_ = message->next_;
+    delete message;
+  }
+  while (signals_ != NULL) {
+    Signal* signal = signals_;
+    signals_ = signal->next;
+    delete signal;
+  }
+}
+
+bool ScheduledMessageLoop::MakeReadyLocked() {
+  if (state_ == kIdle) {
+    state_ = kQueued;
+    return true;
+  }
+  if (state_ == kRunning) {
+    rerun_ = true;
+  }
+  return false;
+}
+
+void ScheduledMessageLoop::PostMessage(IsolateMessage* message) {
+  PostMessages(message, message);
+}
+
+void ScheduledMessageLoop::PostMessages(IsolateMessage* first,
+                                        IsolateMessage* last) {
+  bool enqueue;
+  {
+    MutexLocker locker(&mutex_);
+    if (head_ == NULL) {
+      head_ = first;
+    } else {
+      tail_->next_ = first;
+    }
+    tail_ = last;
+    enqueue = MakeReadyLocked();
+  }
+  if (enqueue) {
+    scheduler_->Enqueue(this);
+  }
+}
+
+intptr_t ScheduledMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
+  open_waits_++;
+  scheduler_->AddWait(this, fd, signals);
+  return fd;
+}
+
+void ScheduledMessageLoop::CancelSignalWait(intptr_t wait_id) {
+  open_waits_--;
+  scheduler_->RemoveWait(this, wait_id);
+}
+
+void ScheduledMessageLoop::MessageEpilogue(int64_t new_wakeup) {
+  bool reset;
+  {
+    MutexLocker locker(&mutex_);
+    reset = (new_wakeup != wakeup_) || ((new_wakeup != 0) && timer_fired_);
+    if (reset) {
+      timer_fired_ = false;
+    }
+  }
+  if (reset) {
+    scheduler_->SetWakeup(this, new_wakeup);
+  }
+  wakeup_ = new_wakeup;
+
+  if ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
+    Exit(0);
+  }
+}
+
+void ScheduledMessageLoop::Exit(intptr_t exit_code) {
+  exit_code_ = exit_code;
+  isolate_ = NULL;
+}
+
+void ScheduledMessageLoop::Start(bool detached) {
+  detached_ = detached;
+  if (detached) {
+    scheduler_->Detached();
+  }
+  {
+    MutexLocker locker(&mutex_);
+    ASSERT(state_ == kStarting);
+    state_ = kQueued;
+  }
+  scheduler_->Enqueue(this);
+}
+
+intptr_t ScheduledMessageLoop::Run() {
+  // Workers make the isolate current while they run it.
+  Isolate::SetCurrent(NULL);
+  Start(false);
+  scheduler_->WaitDone(this);
+  Isolate::SetCurrent(owner_);
+  return exit_code_;
+}
+
+void ScheduledMessageLoop::RunDetached(Isolate* isolate) {
+  ASSERT(isolate == owner_);
+  Isolate::SetCurrent(NULL);
+  Start(true);
+}
+
+bool ScheduledMessageLoop::RunSlice(int64_t deadline) {
+  {
+    MutexLocker locker(&mutex_);
+    ASSERT(state_ == kQueued);
+    state_ = kRunning;
+    rerun_ = false;
+  }
+  Isolate::SetCurrent(owner_);
+
+  if ((isolate_ != NULL) && isolate_->suspended()) {
+    isolate_->Resume();
+  }
+  while ((isolate_ != NULL) && !isolate_->suspended() &&
+         (OS::CurrentMonotonicNanos() < deadline)) {
+    bool wakeup;
+    Signal* signal = NULL;
+    IsolateMessage* messages = NULL;
+    {
+      MutexLocker locker(&mutex_);
+      wakeup = wakeup_due_;
+      wakeup_due_ = false;
+      if (!wakeup) {
+        signal = signals_;
+        if (signal != NULL) {
+          signals_ = signal->next;
+          if (signals_ == NULL) {
+            signals_tail_ = NULL;
+          }
+        } else {
+          messages = head_;
+          head_ = tail_ = NULL;
+        }
+      }
+    }
+
+    if (wakeup) {
+      DispatchWakeup();
+    } else if (signal != NULL) {
+      DispatchSignal(signal->fd, 0, signal->signals, 0);
+      delete signal;
+    } else if (messages != NULL) {
+      IsolateMessage* rest = DispatchMessages(messages);
+      if (rest != NULL) {
+        // Suspended: they go back in front of anything posted meanwhile.
+        IsolateMessage* last = rest;
+        while (last->next_ != NULL) {
+          last = last->next_;
+        }
+        MutexLocker locker(&mutex_);
+        last->next_ = head_;
+        head_ = rest;
+        if (tail_ == NULL) {
+          tail_ = last;
+        }
+      }
+    } else {
+      break;
+    }
+  }
+
+  Isolate::SetCurrent(NULL);
+  if (isolate_ == NULL) {
+    // Stays running, so nothing enqueues it again.
+    return true;
+  }
+
+  bool requeue;
+  {
+    MutexLocker locker(&mutex_);
+    requeue = rerun_ || HasWorkLocked() || isolate_->suspended();
+    state_ = requeue ? kQueued : kIdle;
+  }
+  if (requeue) {
+    scheduler_->Enqueue(this);
+  }
+  return false;
+}
+
+void ScheduledMessageLoop::Finish() {
+  if (open_ports_ > 0) {
+    PortMap::CloseAllPorts(this);
+  }
+  scheduler_->Unregister(this);
+
+  if (detached_) {
+    intptr_t exit_code = exit_code_;
+    Isolate::SetCurrent(owner_);
+    delete owner_;  // And this loop.
+    Isolate::SetCurrent(NULL);
+    scheduler_->DetachedExited();
+    if (exit_code != 0) {
+      OS::Exit(exit_code);
+    }
+  } else {
+    scheduler_->Done(this);
+  }
+}
+
+void ScheduledMessageLoop::Interrupt() {
+  Exit(SIGINT);
+  bool enqueue;
+  {
+    MutexLocker locker(&mutex_);
+    enqueue = MakeReadyLocked();
+  }
+  if (enqueue) {
+    scheduler_->Enqueue(this);
+  }
+}
+
+}  // namespace psoup
+
+#endif  // defined(OS_ANDROID) || defined(OS_LINUX)
@@ -0,0 +1,101 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_MESSAGE_LOOP_SCHEDULED_H_
+#define VM_MESSAGE_LOOP_SCHEDULED_H_
+
+#if !defined(VM_MESSAGE_LOOP_H_)
+#error Do not include message_loop_scheduled.h directly; use message_loop.h \
+  instead.
+#endif
+
+#include "vm/message_loop.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+class IsolateScheduler;
+
+// A loop that holds no thread of its own. Its isolate is run by one of a
+// fixed set of workers, one per processor, only while it has messages,
+// signals or a due wakeup, and a single poller thread waits on the timers and
+// file descriptors of all isolates. An isolate that keeps its worker past a
+// time slice while others wait is asked to yield at its next stack check and
+// goes to the back of the run queue.
+class ScheduledMessageLoop : public MessageLoop {
+ public:
+  explicit ScheduledMessageLoop(Isolate* isolate);
+  ~ScheduledMessageLoop();
+
+  static void Startup();
+  // Waits for the detached isolates to exit, then stops the threads.
+  static void Shutdown();
+
+  void PostMessage(IsolateMessage* message);
+  void PostMessages(IsolateMessage* first, IsolateMessage* last);
+  intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
+  void CancelSignalWait(intptr_t wait_id);
+  void MessageEpilogue(int64_t new_wakeup);
+  void Exit(intptr_t exit_code);
+
+  intptr_t Run();
+  void RunDetached(Isolate* isolate);
+  void Interrupt();
+
+ private:
+  friend class IsolateScheduler;
+
+  enum State {
+    kStarting,  // Not yet given to the scheduler.
+    kIdle,
+    kQueued,
+    kRunning,
+  };
+
+  struct Signal {
+    intptr_t fd;
+    intptr_t signals;
+    Signal* next;
+  };
+
+  void Start(bool detached);
+  // Called with mutex_ held after adding work. Returns true if the loop must
+  // be put on the run queue.
+  bool MakeReadyLocked();
+  bool HasWorkLocked() const {
+    return (head_ != NULL) || (signals_ != NULL) || wakeup_due_;
+  }
+  // On a worker. Dispatches until there is no work left, |deadline| passes
+  // or the isolate yields, and requeues the loop if it has more to do.
+  // Returns true if the isolate exited, leaving the loop to Finish.
+  bool RunSlice(int64_t deadline);
+  void Finish();
+
+  static IsolateScheduler* scheduler_;
+
+  Isolate* const owner_;
+  Mutex mutex_;
+  IsolateMessage* head_;
+  IsolateMessage* tail_;
+  Signal* signals_;
+  Signal* signals_tail_;
+  bool wakeup_due_;
+  bool timer_fired_;  // Since the wakeup was last set.
+  State state_;
+  bool rerun_;  // Work arrived while running.
+  int64_t wakeup_;
+  bool detached_;
+  bool done_;  // Protected by the scheduler's exit monitor.
+
+  // Protected by the scheduler's monitor.
+  ScheduledMessageLoop* run_next_;
+  intptr_t timer_index_;  // In the scheduler's timer heap, or -1.
+  int64_t timer_deadline_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScheduledMessageLoop);
+};
+
+}  // namespace psoup
+
+#endif  // VM_MESSAGE_LOOP_SCHEDULED_H_
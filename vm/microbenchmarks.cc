@@ -0,0 +1,593 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+// Times the VM's hot paths in isolation: allocation, scavenges at several
+// survival rates, old-space allocation from the free lists, the lookup cache,
+// large integer arithmetic, posting to ports from several threads, and
+// converting doubles. Heap benchmarks run in an isolate started from the
+// snapshot given, which is never run.
+//
+// Each benchmark is run with a count of operations doubled until one run takes
+// long enough to time, then run again for each sample. Each result is printed
+// as one line of JSON with nanoseconds per operation, and, where the OS allows
+// reading them, cycles and instructions per operation.
+
+#include "vm/globals.h"
+#if !defined(OS_EMSCRIPTEN)
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "vm/compressed_snapshot.h"
+#include "vm/double_conversion.h"
+#include "vm/heap.h"
+#include "vm/isolate.h"
+#include "vm/lockers.h"
+#include "vm/lookup_cache.h"
+#include "vm/message_loop.h"
+#include "vm/os.h"
+#include "vm/port.h"
+#include "vm/primordial_soup.h"
+#include "vm/random.h"
+#include "vm/thread.h"
+#include "vm/virtual_memory.h"
+
+namespace psoup {
+
+// Runs |n| operations. |arg| distinguishes the variants of one benchmark.
+typedef void (*BenchmarkFunction)(Isolate* isolate, intptr_t arg, intptr_t n);
+
+struct Benchmark {
+  const char* name;
+  BenchmarkFunction function;
+  intptr_t arg;
+};
+
+static int64_t gc_count = 0;
+static int64_t gc_nanos = 0;
+
+static void RecordGCEvent(const GCEvent& event) {
+  gc_count++;
+  gc_nanos += event.end - event.start;
+}
+
+
+static void AllocateArray(Isolate* isolate, intptr_t slots, intptr_t n) {
+  Heap* heap = isolate->heap();
+  for (intptr_t i = 0; i < n; i++) {
+    heap->AllocateArray(slots);
+  }
+}
+
+
+// Objects are allocated in old-space with random sizes up to |max_bytes|, and
+// dropped at once, so allocation takes from the free lists that each
+// mark-sweep rebuilds.
+static void AllocateOld(Isolate* isolate, intptr_t max_bytes, intptr_t n) {
+  Heap* heap = isolate->heap();
+  Random random(max_bytes);
+  for (intptr_t i = 0; i < n; i++) {
+    intptr_t size = random.NextUInt64() % max_bytes;
+    heap->AllocateByteArray(size, Heap::kPretenure);
+  }
+}
+
+
+// Every object allocated is kept until its slot in a ring comes around again
+// with probability |percent|. The ring holds more than a semispace's worth of
+// the objects kept, so that nearly that fraction survives each scavenge.
+static void Scavenge(Isolate* isolate, intptr_t percent, intptr_t n) {
+  static constexpr intptr_t kRingSize = 64 * KB;
+  Heap* heap = isolate->heap();
+  Array ring = heap->AllocateArray(kRingSize);
+  for (intptr_t i = 0; i < kRingSize; i++) {
+    ring->set_element(i, SmallInteger::New(0), kNoBarrier);
+  }
+  HandleScope h1(heap, reinterpret_cast<Object*>(&ring));
+  intptr_t next = 0;
+  for (intptr_t i = 0; i < n; i++) {
+    Array object = heap->AllocateArray(2);  // SAFEPOINT
+    object->set_element(0, SmallInteger::New(i), kNoBarrier);
+    object->set_element(1, SmallInteger::New(0), kNoBarrier);
+    // A stride prime to 100 spreads the survivors evenly.
+    if (((i * 37) % 100) < percent) {
+      ring->set_element(next, object);
+      next = (next + 1) % kRingSize;
+    }
+  }
+}
+
+
+static constexpr intptr_t kNumSelectors = 64;
+
+// The selectors are Strings in the isolate's heap, and stay put since nothing
+// allocates while they are looked up.
+static void NewSelectors(Heap* heap, String* selectors) {
+  Array array = heap->AllocateArray(kNumSelectors);
+  for (intptr_t i = 0; i < kNumSelectors; i++) {
+    array->set_element(i, SmallInteger::New(0), kNoBarrier);
+  }
+  HandleScope h1(heap, reinterpret_cast<Object*>(&array));
+  for (intptr_t i = 0; i < kNumSelectors; i++) {
+    String selector = heap->AllocateString(8);  // SAFEPOINT
+    memset(selector->element_addr(0), 'a' + (i % 26), 8);
+    array->set_element(i, selector);
+  }
+  for (intptr_t i = 0; i < kNumSelectors; i++) {
+    selectors[i] = static_cast<String>(array->element(i));
+  }
+}
+
+
+// arg 0 looks up what was inserted, most of which is still cached, 1 what
+// was not, and 2 inserts.
+static void LookupOrdinary(Isolate* isolate, intptr_t arg, intptr_t n) {
+  String selectors[kNumSelectors];
+  NewSelectors(isolate->heap(), selectors);
+  LookupCache cache;
+  const intptr_t cid = kFirstRegularObjectCid;
+  for (intptr_t i = 0; i < kNumSelectors; i++) {
+    cache.InsertOrdinary(cid, selectors[i], static_cast<Method>(selectors[i]));
+  }
+  Method target;
+  for (intptr_t i = 0; i < n; i++) {
+    String selector = selectors[i & (kNumSelectors - 1)];
+    if (arg == 2) {
+      cache.InsertOrdinary(cid + (i & 1023), selector,
+                           static_cast<Method>(selector));
+    } else {
+      cache.LookupOrdinary(cid + arg, selector, &target);
+    }
+  }
+}
+
+
+static LargeInteger NewLargeInteger(Heap* heap, Random* random,
+                                    intptr_t digits) {
+  LargeInteger result = heap->AllocateLargeInteger(digits);
+  for (intptr_t i = 0; i < digits; i++) {
+    result->set_digit(i, static_cast<digit_t>(random->NextUInt64()));
+  }
+  if (result->digit(digits - 1) == 0) {
+    result->set_digit(digits - 1, 1);
+  }
+  result->set_size(digits);
+  result->set_negative(false);
+  return result;
+}
+
+
+enum LargeIntegerOperation { kAdd, kMultiply, kDivide, kPrint };
+
+// Operands of |digits| digits, except that the dividend has twice as many.
+static void LargeIntegerKernel(Isolate* isolate,
+                               intptr_t operation,
+                               intptr_t digits,
+                               intptr_t n) {
+  Heap* heap = isolate->heap();
+  Random random(digits);
+  LargeInteger left =
+      NewLargeInteger(heap, &random,
+                      operation == kDivide ? 2 * digits : digits);
+  HandleScope h1(heap, reinterpret_cast<Object*>(&left));
+  LargeInteger right = NewLargeInteger(heap, &random, digits);
+  HandleScope h2(heap, reinterpret_cast<Object*>(&right));
+  for (intptr_t i = 0; i < n; i++) {
+    switch (operation) {
+      case kAdd:
+        LargeInteger::Add(left, right, heap);
+        break;
+      case kMultiply:
+        LargeInteger::Multiply(left, right, heap);
+        break;
+      case kDivide:
+        LargeInteger::Divide(LargeInteger::kTruncated,
+                             LargeInteger::kQuoitent, left, right, heap);
+        break;
+      case kPrint:
+        LargeInteger::PrintString(right, heap);
+        break;
+    }
+  }
+}
+
+#define LARGE_INTEGER_BENCHMARK(name, operation)                               \
+  static void name(Isolate* isolate, intptr_t digits, intptr_t n) {            \
+    LargeIntegerKernel(isolate, operation, digits, n);                         \
+  }
+LARGE_INTEGER_BENCHMARK(LargeIntegerAdd, kAdd)
+LARGE_INTEGER_BENCHMARK(LargeIntegerMultiply, kMultiply)
+LARGE_INTEGER_BENCHMARK(LargeIntegerDivide, kDivide)
+LARGE_INTEGER_BENCHMARK(LargeIntegerPrint, kPrint)
+#undef LARGE_INTEGER_BENCHMARK
+
+
+// Drops every message posted to it, so that only the port map's side of
+// posting is measured.
+class DiscardingMessageLoop : public MessageLoop {
+ public:
+  DiscardingMessageLoop() : MessageLoop(NULL) {}
+
+  void PostMessage(IsolateMessage* message) { delete message; }
+  intptr_t AwaitSignal(intptr_t handle, intptr_t signals) { return 0; }
+  void CancelSignalWait(intptr_t wait_id) {}
+  void MessageEpilogue(int64_t new_wakeup) {}
+  void Exit(intptr_t exit_code) {}
+  intptr_t Run() { return 0; }
+  void Interrupt() {}
+};
+
+struct PortPoster {
+  Port* ports;
+  intptr_t num_ports;
+  intptr_t index;
+  intptr_t n;
+  Monitor* monitor;
+  intptr_t* running;
+};
+
+static void PostMessages(uword parameter) {
+  PortPoster* poster = reinterpret_cast<PortPoster*>(parameter);
+  Port port = poster->ports[poster->index % poster->num_ports];
+  for (intptr_t i = 0; i < poster->n; i++) {
+    PortMap::PostMessage(
+        new IsolateMessage(port, static_cast<uint8_t*>(NULL), 0));
+  }
+  MonitorLocker ml(poster->monitor);
+  (*poster->running)--;
+  ml.Notify();
+}
+
+static void PostFromThreads(intptr_t threads,
+                            intptr_t num_ports,
+                            intptr_t n) {
+  static constexpr intptr_t kMaxThreads = 16;
+  ASSERT(threads <= kMaxThreads);
+  DiscardingMessageLoop loop;
+  Port ports[kMaxThreads];
+  for (intptr_t i = 0; i < num_ports; i++) {
+    ports[i] = loop.OpenPort();
+  }
+  Monitor monitor;
+  intptr_t running = threads;
+  PortPoster posters[kMaxThreads];
+  for (intptr_t i = 0; i < threads; i++) {
+    posters[i].ports = ports;
+    posters[i].num_ports = num_ports;
+    posters[i].index = i;
+    posters[i].n = (n + threads - 1) / threads;
+    posters[i].monitor = &monitor;
+    posters[i].running = &running;
+    int result = Thread::Start("poster", PostMessages,
+                               reinterpret_cast<uword>(&posters[i]));
+    if (result != 0) {
+      FATAL("Failed to start thread");
+    }
+  }
+  {
+    MonitorLocker ml(&monitor);
+    while (running > 0) {
+      ml.Wait();
+    }
+  }
+  for (intptr_t i = 0; i < num_ports; i++) {
+    loop.ClosePort(ports[i]);
+  }
+}
+
+// All threads post to one port, and so contend for its shard's lock.
+static void PostToOnePort(Isolate* isolate, intptr_t threads, intptr_t n) {
+  PostFromThreads(threads, 1, n);
+}
+
+// Each thread posts to its own port.
+static void PostToOwnPorts(Isolate* isolate, intptr_t threads, intptr_t n) {
+  PostFromThreads(threads, threads, n);
+}
+
+
+static constexpr intptr_t kNumDoubles = 1024;
+
+static void NewDoubles(double* doubles) {
+  Random random(kNumDoubles);
+  for (intptr_t i = 0; i < kNumDoubles; i++) {
+    // Mostly short decimals, as programs print them, and some of every
+    // magnitude.
+    uint64_t bits = random.NextUInt64();
+    if ((i & 3) == 0) {
+      memcpy(&doubles[i], &bits, sizeof(bits));
+      if (doubles[i] != doubles[i]) {
+        doubles[i] = 0.0;  // NaN
+      }
+    } else {
+      doubles[i] = static_cast<double>(bits % 1000000) / 1000.0;
+    }
+  }
+}
+
+static void DoubleToString(Isolate* isolate, intptr_t arg, intptr_t n) {
+  double doubles[kNumDoubles];
+  NewDoubles(doubles);
+  char buffer[64];
+  for (intptr_t i = 0; i < n; i++) {
+    DoubleToCStringAsShortest(doubles[i & (kNumDoubles - 1)], buffer,
+                              sizeof(buffer));
+  }
+}
+
+static void StringToDouble(Isolate* isolate, intptr_t arg, intptr_t n) {
+  double doubles[kNumDoubles];
+  NewDoubles(doubles);
+  char strings[kNumDoubles][32];
+  int lengths[kNumDoubles];
+  for (intptr_t i = 0; i < kNumDoubles; i++) {
+    lengths[i] = DoubleToCStringAsShortest(doubles[i], strings[i],
+                                           sizeof(strings[i]));
+  }
+  double result;
+  for (intptr_t i = 0; i < n; i++) {
+    intptr_t index = i & (kNumDoubles - 1);
+    if (!CStringToDouble(strings[index], lengths[index], &result)) {
+      FATAL("Failed to parse double");
+    }
+  }
+}
+
+
+static const Benchmark kBenchmarks[] = {
+  {"allocate-array/0", AllocateArray, 0},
+  {"allocate-array/8", AllocateArray, 8},
+  {"allocate-array/64", AllocateArray, 64},
+  {"allocate-old/256", AllocateOld, 256},
+  {"allocate-old/4096", AllocateOld, 4096},
+  {"scavenge/0", Scavenge, 0},
+  {"scavenge/10", Scavenge, 10},
+  {"scavenge/50", Scavenge, 50},
+  {"scavenge/90", Scavenge, 90},
+  {"lookup-cache/hit", LookupOrdinary, 0},
+  {"lookup-cache/miss", LookupOrdinary, 1},
+  {"lookup-cache/insert", LookupOrdinary, 2},
+  {"large-integer-add/4", LargeIntegerAdd, 4},
+  {"large-integer-add/256", LargeIntegerAdd, 256},
+  {"large-integer-multiply/4", LargeIntegerMultiply, 4},
+  {"large-integer-multiply/256", LargeIntegerMultiply, 256},
+  {"large-integer-multiply/4096", LargeIntegerMultiply, 4096},
+  {"large-integer-divide/4", LargeIntegerDivide, 4},
+  {"large-integer-divide/256", LargeIntegerDivide, 256},
+  {"large-integer-print/256", LargeIntegerPrint, 256},
+  {"port-post/1", PostToOnePort, 1},
+  {"port-post/4", PostToOnePort, 4},
+  {"port-post/16", PostToOnePort, 16},
+  {"port-post-own/4", PostToOwnPorts, 4},
+  {"port-post-own/16", PostToOwnPorts, 16},
+  {"double-to-string", DoubleToString, 0},
+  {"string-to-double", StringToDouble, 0},
+};
+
+
+// Hardware counters for this thread and the threads it starts while they are
+// open, where the OS has them and allows reading them.
+class PerfCounters {
+ public:
+  enum Counter { kCycles, kInstructions, kNumCounters };
+
+  PerfCounters() {
+    for (intptr_t i = 0; i < kNumCounters; i++) {
+      fds_[i] = -1;
+    }
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+    static const uint64_t kConfigs[kNumCounters] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    };
+    for (intptr_t i = 0; i < kNumCounters; i++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = kConfigs[i];
+      attr.disabled = 1;
+      attr.inherit = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      if (fds_[i] < 0) {
+        Close();
+        return;
+      }
+    }
+#endif
+  }
+  ~PerfCounters() { Close(); }
+
+  bool available() const { return fds_[0] >= 0; }
+
+  void Start() {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+    for (intptr_t i = 0; available() && (i < kNumCounters); i++) {
+      ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  // Answers false if the counts could not be read.
+  bool Stop(int64_t* counts) {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+    for (intptr_t i = 0; available() && (i < kNumCounters); i++) {
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fds_[i], &counts[i], sizeof(counts[i])) != sizeof(counts[i])) {
+        return false;
+      }
+    }
+#endif
+    return available();
+  }
+
+ private:
+  void Close() {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+    for (intptr_t i = 0; i < kNumCounters; i++) {
+      if (fds_[i] >= 0) {
+        close(fds_[i]);
+        fds_[i] = -1;
+      }
+    }
+#endif
+  }
+
+  int fds_[kNumCounters];
+};
+
+
+static bool PinToCPU(intptr_t cpu) {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+
+static int CompareSamples(const void* a, const void* b) {
+  double x = *reinterpret_cast<const double*>(a);
+  double y = *reinterpret_cast<const double*>(b);
+  return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static void Measure(Isolate* isolate,
+                    const Benchmark& benchmark,
+                    PerfCounters* counters,
+                    intptr_t num_samples,
+                    int64_t sample_nanos) {
+  // Also warms up caches and the heap.
+  intptr_t n = 1;
+  for (;;) {
+    int64_t start = OS::CurrentMonotonicNanos();
+    benchmark.function(isolate, benchmark.arg, n);
+    if (OS::CurrentMonotonicNanos() - start >= sample_nanos) {
+      break;
+    }
+    n *= 2;
+  }
+
+  double* samples = new double[num_samples];
+  int64_t totals[PerfCounters::kNumCounters] = {0, 0};
+  bool counted = counters->available();
+  int64_t gc_count_before = gc_count;
+  int64_t gc_nanos_before = gc_nanos;
+  for (intptr_t i = 0; i < num_samples; i++) {
+    int64_t counts[PerfCounters::kNumCounters];
+    counters->Start();
+    int64_t start = OS::CurrentMonotonicNanos();
+    benchmark.function(isolate, benchmark.arg, n);
+    int64_t stop = OS::CurrentMonotonicNanos();
+    if (counters->Stop(counts)) {
+      for (intptr_t j = 0; j < PerfCounters::kNumCounters; j++) {
+        totals[j] += counts[j];
+      }
+    } else {
+      counted = false;
+    }
+    samples[i] = static_cast<double>(stop - start) / n;
+  }
+  qsort(samples, num_samples, sizeof(double), CompareSamples);
+
+  double ops = static_cast<double>(n) * num_samples;
+  OS::Print("{\"benchmark\": \"%s\", \"operations\": %" Pd
+            ", \"samples\": %" Pd ", \"min\": %.2f, \"median\": %.2f"
+            ", \"max\": %.2f, \"collections\": %" Pd64 ", \"gc\": %.2f",
+            benchmark.name, n, num_samples, samples[0],
+            samples[num_samples / 2], samples[num_samples - 1],
+            gc_count - gc_count_before, (gc_nanos - gc_nanos_before) / ops);
+  if (counted) {
+    OS::Print(", \"cycles\": %.2f, \"instructions\": %.2f",
+              totals[PerfCounters::kCycles] / ops,
+              totals[PerfCounters::kInstructions] / ops);
+  }
+  OS::Print("}\n");
+  delete[] samples;
+}
+
+}  // namespace psoup
+
+int main(int argc, const char** argv) {
+  intptr_t num_samples = 10;
+  intptr_t sample_milliseconds = 10;
+  intptr_t cpu = -1;
+  const char* filter = nullptr;
+  int first = 1;
+  static const char kSamples[] = "--samples=";
+  static const char kSampleMilliseconds[] = "--sample-ms=";
+  static const char kCPU[] = "--cpu=";
+  static const char kFilter[] = "--filter=";
+  for (; first < argc; first++) {
+    const char* arg = argv[first];
+    if (strncmp(arg, kSamples, sizeof(kSamples) - 1) == 0) {
+      num_samples = atoi(arg + sizeof(kSamples) - 1);
+    } else if (strncmp(arg, kSampleMilliseconds,
+                       sizeof(kSampleMilliseconds) - 1) == 0) {
+      sample_milliseconds = atoi(arg + sizeof(kSampleMilliseconds) - 1);
+    } else if (strncmp(arg, kCPU, sizeof(kCPU) - 1) == 0) {
+      cpu = atoi(arg + sizeof(kCPU) - 1);
+    } else if (strncmp(arg, kFilter, sizeof(kFilter) - 1) == 0) {
+      filter = arg + sizeof(kFilter) - 1;
+    } else {
+      break;
+    }
+  }
+  if ((first != argc - 1) || (num_samples < 1) || (sample_milliseconds < 1)) {
+    psoup::OS::PrintErr("Usage: %s [--samples=<n>] [--sample-ms=<ms>] "
+                        "[--cpu=<n>] [--filter=<substring>] "
+                        "<snapshot.vfuel>\n", argv[0]);
+    return -1;
+  }
+
+  PrimordialSoup_Startup();
+  // Threads started later, such as the scavenger's helpers and the posters,
+  // run on the same CPU.
+  if ((cpu >= 0) && !psoup::PinToCPU(cpu)) {
+    psoup::OS::PrintErr("Cannot pin to CPU %" Pd "\n", cpu);
+  }
+  psoup::PerfCounters counters;
+  if (!counters.available()) {
+    psoup::OS::PrintErr("Hardware counters are not available\n");
+  }
+  psoup::Heap::SetGCEventCallback(psoup::RecordGCEvent);
+
+  psoup::VirtualMemory file = psoup::VirtualMemory::MapReadOnly(argv[first]);
+  void* snapshot = reinterpret_cast<void*>(file.base());
+  size_t snapshot_length = file.size();
+  if (psoup::CompressedSnapshot::IsCompressed(snapshot, snapshot_length)) {
+    snapshot = psoup::CompressedSnapshot::Decompress(
+        snapshot, snapshot_length, &snapshot_length);
+  }
+  psoup::HeapPolicy policy;
+  psoup::Isolate* isolate =
+      new psoup::Isolate(snapshot, snapshot_length, 0, policy);
+  for (const psoup::Benchmark& benchmark : psoup::kBenchmarks) {
+    if ((filter == nullptr) || (strstr(benchmark.name, filter) != nullptr)) {
+      psoup::Measure(isolate, benchmark, &counters, num_samples,
+                     sample_milliseconds * 1000000);
+    }
+  }
+  delete isolate;
+
+  psoup::Heap::SetGCEventCallback(nullptr);
+  PrimordialSoup_Shutdown();
+  return 0;
+}
+
+#endif  // !defined(OS_EMSCRIPTEN)
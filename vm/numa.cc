@@ -0,0 +1,164 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/numa.h"
+
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+#include "vm/assert.h"
+#include "vm/atomic.h"
+
+namespace psoup {
+
+bool Numa::spread_isolates_ = false;
+uint64_t Numa::next_node_ = 0;
+
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+
+static intptr_t num_nodes_ = 0;
+static intptr_t node_ids_[Numa::kMaxNodes];
+static cpu_set_t node_cpus_[Numa::kMaxNodes];
+
+// Calls |visit| with each number in a sysfs list such as "0-3,8-11", and
+// answers false if |path| cannot be read or parsed.
+template <typename Visitor>
+static bool ReadList(const char* path, Visitor visit) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  char buffer[4096];
+  bool ok = fgets(buffer, sizeof(buffer), file) != nullptr;
+  fclose(file);
+  const char* cursor = buffer;
+  while (ok && (*cursor >= '0') && (*cursor <= '9')) {
+    char* end;
+    long first = strtol(cursor, &end, 10);  // NOLINT
+    long last = first;  // NOLINT
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    for (long i = first; ok && (i <= last); i++) {  // NOLINT
+      ok = visit(i);
+    }
+    cursor = (*end == ',') ? end + 1 : end;
+  }
+  return ok;
+}
+
+static bool ReadNodes() {
+  num_nodes_ = 0;
+  bool ok = ReadList("/sys/devices/system/node/online", [](intptr_t node) {
+    if ((num_nodes_ == Numa::kMaxNodes) || (node >= Numa::kMaxNodes)) {
+      return false;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%" Pd
+             "/cpulist", node);
+    cpu_set_t* cpus = &node_cpus_[num_nodes_];
+    CPU_ZERO(cpus);
+    bool any = false;
+    if (!ReadList(path, [cpus, &any](intptr_t cpu) {
+          if (cpu >= CPU_SETSIZE) {
+            return false;
+          }
+          CPU_SET(cpu, cpus);
+          any = true;
+          return true;
+        })) {
+      return false;
+    }
+    // Nodes of memory alone have no CPUs to run an isolate on.
+    if (any) {
+      node_ids_[num_nodes_++] = node;
+    }
+    return true;
+  });
+  if (!ok) {
+    num_nodes_ = 0;
+  }
+  return num_nodes_ > 0;
+}
+
+bool Numa::SetSpreadIsolates(bool value) {
+  if (value && (num_nodes_ == 0) && !ReadNodes()) {
+    spread_isolates_ = false;
+    return false;
+  }
+  spread_isolates_ = value;
+  return true;
+}
+
+intptr_t Numa::NodeCount() {
+  if (num_nodes_ == 0) {
+    ReadNodes();
+  }
+  return num_nodes_ == 0 ? 1 : num_nodes_;
+}
+
+intptr_t Numa::NextNode() {
+  if (!spread_isolates_) {
+    return -1;
+  }
+  uint64_t turn =
+      AtomicOperations::FetchAndAddRelaxed(&next_node_,
+                                           static_cast<uint64_t>(1));
+  return node_ids_[turn % num_nodes_];
+}
+
+static intptr_t IndexOfNode(intptr_t node) {
+  for (intptr_t i = 0; i < num_nodes_; i++) {
+    if (node_ids_[i] == node) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+NodeAffinityScope::NodeAffinityScope(intptr_t node) : pinned_(false) {
+  static_assert(sizeof(saved_) >= sizeof(cpu_set_t), "Too small for CPU set");
+  intptr_t index = node < 0 ? -1 : IndexOfNode(node);
+  if (index < 0) {
+    return;
+  }
+  cpu_set_t* saved = reinterpret_cast<cpu_set_t*>(saved_);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), saved) != 0) {
+    return;
+  }
+  pinned_ = sched_setaffinity(0, sizeof(cpu_set_t), &node_cpus_[index]) == 0;
+}
+
+NodeAffinityScope::~NodeAffinityScope() {
+  if (pinned_) {
+    sched_setaffinity(0, sizeof(cpu_set_t),
+                      reinterpret_cast<cpu_set_t*>(saved_));
+  }
+}
+
+#else
+
+bool Numa::SetSpreadIsolates(bool value) {
+  spread_isolates_ = false;
+  return !value;
+}
+
+intptr_t Numa::NodeCount() {
+  return 1;
+}
+
+intptr_t Numa::NextNode() {
+  return -1;
+}
+
+NodeAffinityScope::NodeAffinityScope(intptr_t node) : pinned_(false) {}
+
+NodeAffinityScope::~NodeAffinityScope() {}
+
+#endif
+
+}  // namespace psoup
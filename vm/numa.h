@@ -0,0 +1,59 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_NUMA_H_
+#define VM_NUMA_H_
+
+#include "vm/allocation.h"
+#include "vm/globals.h"
+
+namespace psoup {
+
+// Placement of spawned isolates on the NUMA nodes of a multi-socket machine.
+// When spreading, each spawned isolate is given the next node in turn: the
+// worker running it is pinned to that node's CPUs while it does, and its
+// heap's memory is bound to that node (see HeapPolicy::numa_node), so neither
+// the interpreter nor the collector reaches across the interconnect.
+//
+// Nodes are read from sysfs on Linux and Android. Elsewhere there is one node
+// and nothing is placed.
+class Numa : public AllStatic {
+ public:
+  static constexpr intptr_t kMaxNodes = 64;
+
+  // Set before running any isolate. Answers false, leaving isolates
+  // unplaced, if the machine's nodes are unknown.
+  static bool SetSpreadIsolates(bool value);
+  static bool spread_isolates() { return spread_isolates_; }
+
+  static intptr_t NodeCount();
+
+  // The node for the next spawned isolate, or -1 if not spreading.
+  static intptr_t NextNode();
+
+ private:
+  static bool spread_isolates_;
+  static uint64_t next_node_;
+};
+
+// Pins the current thread to |node|'s CPUs for the rest of the enclosing
+// scope, then puts back its previous affinity, so a pool worker is not left
+// pinned for the next task it runs. Does nothing if |node| is -1.
+class NodeAffinityScope {
+ public:
+  explicit NodeAffinityScope(intptr_t node);
+  ~NodeAffinityScope();
+
+ private:
+  bool pinned_;
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  uint64_t saved_[16];  // The previous affinity, as a cpu_set_t.
+#endif
+
+  DISALLOW_COPY_AND_ASSIGN(NodeAffinityScope);
+};
+
+}  // namespace psoup
+
+#endif  // VM_NUMA_H_
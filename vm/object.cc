@@ -4,6 +4,8 @@
 
 #include "vm/object.h"
 
+#include <string.h>
+
 #include "vm/heap.h"
 #include "vm/interpreter.h"
 #include "vm/isolate.h"
@@ -16,10 +18,10 @@ Behavior Object::Klass(Heap* heap) const {
 }
 
 
-intptr_t HeapObject::HeapSizeFromClass() const {
+intptr_t HeapObject::HeapSizeFromClass(intptr_t cid) const {
   ASSERT(IsHeapObject());
 
-  switch (cid()) {
+  switch (cid) {
   case kIllegalCid:
     UNREACHABLE();
   case kForwardingCorpseCid:
@@ -89,8 +91,8 @@ void HeapObject::Pointers(Object** from, Object** to) {
     *to = WeakArray::Cast(*this)->to();
     return;
   case kEphemeronCid:
-    *from = RegularObject::Cast(*this)->from();
-    *to = RegularObject::Cast(*this)->to();
+    *from = Ephemeron::Cast(*this)->from();
+    *to = Ephemeron::Cast(*this)->to();
     return;
   case kActivationCid:
     *from = Activation::Cast(*this)->from();
@@ -115,6 +117,89 @@ void HeapObject::AddToRememberedSet() const {
 }
 
 
+void HeapObject::ShadeForIncrementalMarking(Object value) const {
+  Isolate* isolate = Isolate::Current();
+  ASSERT(isolate != NULL);
+  isolate->heap()->ShadeObject(value);
+}
+
+
+void Array::FillElements(intptr_t start, intptr_t count, Object value) {
+  ASSERT((start >= 0) && (count >= 0) && (start + count <= Size()));
+  Object* slots = &ptr()->elements_[start];
+  for (intptr_t i = 0; i < count; i++) {
+    slots[i] = value;
+  }
+  if ((count == 0) || !IsOldObject()) {
+    return;
+  }
+  if (value->IsNewObject()) {
+    if (is_carded()) {
+      RememberCards(start, count);
+    }
+    if (!is_remembered()) {
+      AddToRememberedSet();
+    }
+  } else if (is_marked() && value->IsOldObject()) {
+    ShadeForIncrementalMarking(value);
+  }
+}
+
+
+void Array::CopyElements(intptr_t start, Array source, intptr_t source_start,
+                         intptr_t count) {
+  ASSERT((start >= 0) && (count >= 0) && (start + count <= Size()));
+  ASSERT((source_start >= 0) && (source_start + count <= source->Size()));
+  memmove(&ptr()->elements_[start], &source->ptr()->elements_[source_start],
+          count * sizeof(Object));
+  RememberElements(start, count);
+}
+
+
+void Array::CopyElements(intptr_t start, const Object* source,
+                         intptr_t count) {
+  ASSERT((start >= 0) && (count >= 0) && (start + count <= Size()));
+  memcpy(&ptr()->elements_[start], source, count * sizeof(Object));
+  RememberElements(start, count);
+}
+
+
+// The write barrier for elements just stored in bulk.
+void Array::RememberElements(intptr_t start, intptr_t count) {
+  if (!IsOldObject()) {
+    return;
+  }
+  Object* slots = &ptr()->elements_[start];
+  bool has_new = false;
+  bool marked = is_marked();
+  for (intptr_t i = 0; i < count; i++) {
+    Object value = slots[i];
+    if (value->IsNewObject()) {
+      has_new = true;
+      if (is_carded()) {
+        RememberCard(&slots[i]);
+      } else if (!marked) {
+        break;
+      }
+    } else if (marked && value->IsOldObject()) {
+      ShadeForIncrementalMarking(value);
+    }
+  }
+  if (has_new && !is_remembered()) {
+    AddToRememberedSet();
+  }
+}
+
+
+void Array::RememberCards(intptr_t start, intptr_t count) const {
+  intptr_t first = CardIndexOf(&ptr()->elements_[start]);
+  intptr_t last = CardIndexOf(&ptr()->elements_[start + count - 1]);
+  for (intptr_t i = first; i <= last; i++) {
+    *CardAt(i) = 1;
+  }
+}
+
+
 char* Object::ToCString(Heap* heap) const {
   switch (ClassId()) {
   case kIllegalCid:
@@ -248,24 +333,52 @@ static uintptr_t kFNVPrime = 16777619;
 static uintptr_t kFNVPrime = 1099511628211;
 #endif
 
+// The finalizers of MurmurHash3. Word-at-a-time FNV mixes each word into the
+// high bits well but into the low bits poorly.
+static uintptr_t FinalizeHash(uintptr_t h) {
+#if defined(ARCH_IS_32_BIT)
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+#elif defined(ARCH_IS_64_BIT)
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53;
+  h ^= h >> 33;
+#endif
+  return h;
+}
+
 
 SmallInteger String::EnsureHash(Isolate* isolate) {
-  if (header_hash() == 0) {
-    // FNV-1a hash
+  if (hash() == 0) {
+    // FNV-1a hash, a word at a time.
     intptr_t length = Size();
+    const uint8_t* bytes = element_addr(0);
     uintptr_t h = length + 1;
-    for (intptr_t i = 0; i < length; i++) {
-      h = h ^ element(i);
+    intptr_t i = 0;
+    for (; i + kWordSize <= length; i += kWordSize) {
+      uintptr_t word;
+      memcpy(&word, &bytes[i], kWordSize);
+      h = h ^ word;
+      h = h * kFNVPrime;
+    }
+    for (; i < length; i++) {
+      h = h ^ bytes[i];
       h = h * kFNVPrime;
     }
     h = h ^ isolate->salt();
+    h = FinalizeHash(h);
     h = h & SmallInteger::kMaxValue;
     if (h == 0) {
       h = 1;
     }
-    set_header_hash(h);
+    set_hash(h);
   }
-  return SmallInteger::New(header_hash());
+  return SmallInteger::New(hash());
 }
 
 }  // namespace psoup
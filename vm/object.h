@@ -6,8 +6,10 @@
 #define VM_OBJECT_H_
 
 #include "vm/assert.h"
+#include "vm/atomic.h"
 #include "vm/globals.h"
 #include "vm/bitfield.h"
+#include "vm/flags.h"
 #include "vm/utils.h"
 
 namespace psoup {
@@ -33,6 +35,12 @@ enum ObjectAlignment {
   kOldObjectBits = kOldObjectAlignmentOffset | kHeapObjectTag,
 };
 
+enum CardSize {
+  // The granularity at which stores into carded objects are remembered.
+  kCardSizeLog2 = 9,
+  kCardSize = 1 << kCardSizeLog2,
+};
+
 enum HeaderBits {
   // New object: Already copied to to-space (is forwarding pointer).
   // Old object: Already seen by the marker (is gray or black).
@@ -44,6 +52,17 @@ enum HeaderBits {
   // For symbols.
   kCanonicalBit = 2,
 
+  // Preceded by a card table: large old pointer objects only.
+  kCardedBit = 3,
+
+  // Key of an ephemeron waiting for it to be reached: during a collection
+  // only.
+  kWaitingKeyBit = 4,
+
+  // Scavenges survived: new objects only.
+  kAgeFieldOffset = 5,
+  kAgeFieldSize = 3,
+
 #if defined(ARCH_IS_32_BIT)
   kSizeFieldOffset = 8,
   kSizeFieldSize = 8,
@@ -218,12 +237,20 @@ class HeapObject : public Object {
   inline void set_is_remembered(bool value);
   inline bool is_canonical() const;
   inline void set_is_canonical(bool value);
+  inline bool is_carded() const;
+  inline void set_is_carded(bool value);
+  inline bool is_waiting_key() const;
+  inline void set_is_waiting_key(bool value);
+  // Sets the mark bit, and clears the remembered bit in the same update if
+  // |forget|, unless another thread marking in parallel set it first. Answers
+  // whether this thread did.
+  inline bool TryMarkAtomic(bool forget);
+  inline intptr_t age() const;
+  inline void set_age(intptr_t value);
   inline intptr_t heap_size() const;
   inline void set_heap_size(intptr_t value);
   inline intptr_t cid() const;
   inline void set_cid(intptr_t value);
-  inline intptr_t header_hash() const;
-  inline void set_header_hash(intptr_t value);
 
   uword Addr() const {
     return tagged_pointer_ - kHeapObjectTag;
@@ -232,6 +259,19 @@ class HeapObject : public Object {
     return HeapObject(addr + kHeapObjectTag);
   }
 
+  // A carded object's card table is stored just below the object, one byte
+  // per card in reverse order, so it can be found without the object's size.
+  uint8_t* CardAt(intptr_t index) const {
+    ASSERT(is_carded());
+    return reinterpret_cast<uint8_t*>(Addr()) - 1 - index;
+  }
+  intptr_t CardIndexOf(const void* slot) const {
+    return (reinterpret_cast<uword>(slot) - Addr()) >> kCardSizeLog2;
+  }
+  void RememberCard(const void* slot) const {
+    *CardAt(CardIndexOf(slot)) = 1;
+  }
+
   inline static HeapObject Initialize(uword addr,
                                       intptr_t cid,
                                       intptr_t heap_size);
@@ -244,7 +284,20 @@ class HeapObject : public Object {
     }
     return HeapSizeFromClass();
   }
-  intptr_t HeapSizeFromClass() const;
+  // As HeapSize, but decoding a header word that was read before another
+  // thread replaced it with a forwarding pointer.
+  intptr_t HeapSize(uword header) const {
+    ASSERT(IsHeapObject());
+    intptr_t heap_size_from_tag =
+        SizeField::decode(header) << kObjectAlignmentLog2;
+    if (heap_size_from_tag != 0) {
+      return heap_size_from_tag;
+    }
+    return HeapSizeFromClass(ClassIdField::decode(header));
+  }
+  static intptr_t AgeOf(uword header) { return AgeField::decode(header); }
+  intptr_t HeapSizeFromClass() const { return HeapSizeFromClass(cid()); }
+  intptr_t HeapSizeFromClass(intptr_t cid) const;
   void Pointers(Object** from, Object** to);
 
  protected:
@@ -259,19 +312,35 @@ class HeapObject : public Object {
     if (barrier == kNoBarrier) {
       ASSERT(value->IsImmediateOrOldObject());
     } else {
-      // Generational write barrier:
-      if (IsOldObject() && value->IsNewObject() && !is_remembered()) {
-        AddToRememberedSet();
+      if (IsOldObject()) {
+        if (value->IsNewObject()) {
+          // Generational write barrier:
+          if (is_carded()) {
+            RememberCard(addr);
+          }
+          if (!is_remembered()) {
+            AddToRememberedSet();
+          }
+        } else if (is_marked() && value->IsOldObject()) {
+          // Incremental marking barrier: old objects are only marked while
+          // marking is in progress, so this costs a header test otherwise.
+          ShadeForIncrementalMarking(value);
+        }
       }
     }
   }
 
- private:
   void AddToRememberedSet() const;
+  void ShadeForIncrementalMarking(Object value) const;
+
+ private:
 
   class MarkBit : public BitField<bool, kMarkBit, 1> {};
   class RememberedBit : public BitField<bool, kRememberedBit, 1> {};
   class CanonicalBit : public BitField<bool, kCanonicalBit, 1> {};
+  class CardedBit : public BitField<bool, kCardedBit, 1> {};
+  class WaitingKeyBit : public BitField<bool, kWaitingKeyBit, 1> {};
+  class AgeField : public BitField<intptr_t, kAgeFieldOffset, kAgeFieldSize> {};
   class SizeField :
       public BitField<intptr_t, kSizeFieldOffset, kSizeFieldSize> {};
   class ClassIdField :
@@ -351,10 +420,19 @@ class MediumInteger : public HeapObject {
   inline void set_value(int64_t value);
 };
 
+// Digits are half a word, so a product of two fits in a word, unless
+// WIDE_DIGITS asks for word-sized digits and the compiler has 128-bit
+// integers to hold their products. Snapshots store large integers as bytes,
+// so either choice reads the same snapshots.
 #if defined(ARCH_IS_32_BIT)
 typedef uint16_t digit_t;
 typedef uint32_t ddigit_t;
 typedef int32_t sddigit_t;
+#elif defined(ARCH_IS_64_BIT) && WIDE_DIGITS && defined(__SIZEOF_INT128__)
+#define USING_WIDE_DIGITS
+typedef uint64_t digit_t;
+typedef unsigned __int128 ddigit_t;
+typedef __int128 sddigit_t;
 #elif defined(ARCH_IS_64_BIT)
 typedef uint32_t digit_t;
 typedef uint64_t ddigit_t;
@@ -424,6 +502,9 @@ class LargeInteger : public HeapObject {
   inline void set_capacity(intptr_t value);
   inline digit_t digit(intptr_t index) const;
   inline void set_digit(intptr_t index, digit_t value);
+  // Only valid until the next allocation.
+  inline const digit_t* digits() const;
+  inline digit_t* digits();
 };
 
 class RegularObject : public HeapObject {
@@ -450,8 +531,19 @@ class Array : public HeapObject {
   inline void set_element(intptr_t index, Object value,
                           Barrier barrier = kBarrier);
 
+  // Bulk stores that apply the write barrier once for the whole range instead
+  // of once per element. |source| may be this array.
+  void FillElements(intptr_t start, intptr_t count, Object value);
+  void CopyElements(intptr_t start, Array source, intptr_t source_start,
+                    intptr_t count);
+  void CopyElements(intptr_t start, const Object* source, intptr_t count);
+
   inline Object* from();
   inline Object* to();
+
+ private:
+  void RememberCards(intptr_t start, intptr_t count) const;
+  void RememberElements(intptr_t start, intptr_t count);
 };
 
 class WeakArray : public HeapObject {
@@ -516,6 +608,8 @@ class String : public Bytes {
   HEAP_OBJECT_IMPLEMENTATION(String, Bytes)
 
  public:
+  inline intptr_t hash() const;
+  inline void set_hash(intptr_t value);
   SmallInteger EnsureHash(Isolate* isolate);
 };
 
@@ -556,19 +650,17 @@ class Activation : public HeapObject {
   inline void set_stack_depth(SmallInteger d);
   intptr_t StackDepth() const { return stack_depth()->value(); }
 
+  // Temps are kept out of line, and only once they are stored here rather
+  // than in a frame, so an activation paired with a living frame is small.
+  // Elements of the array past the stack depth hold no references.
+  inline Array temps() const;
+  inline void set_temps(Array t, Barrier barrier = kBarrier);
+  intptr_t TempCapacity() const {
+    return temps()->IsArray() ? temps()->Size() : 0;
+  }
   inline Object temp(intptr_t index) const;
   inline void set_temp(intptr_t index, Object o, Barrier barrier = kBarrier);
 
-  void PopNAndPush(intptr_t drop_count, Object value) {
-    ASSERT(drop_count >= 0);
-    ASSERT(drop_count <= StackDepth());
-    set_stack_depth(SmallInteger::New(StackDepth() - drop_count + 1));
-    set_temp(StackDepth() - 1, value);
-  }
-  void Push(Object value) {
-    PopNAndPush(0, value);
-  }
-
   void PrintStack(Heap* heap);
 
   inline Object* from();
@@ -582,6 +674,7 @@ class Method : public HeapObject {
   inline SmallInteger header() const;
   inline Array literals() const;
   inline ByteArray bytecode() const;
+  inline void set_bytecode(ByteArray bytecode);
   inline AbstractMixin mixin() const;
   inline String selector() const;
   inline Object source() const;
@@ -611,6 +704,18 @@ class Method : public HeapObject {
     return (header()->value() >> 10) & 255;
   }
 
+  // A method read from a revision 3 snapshot may have its bytecode left in
+  // the snapshot until it is first activated. Its bytecode slot then holds
+  // the position of the bytecode in the snapshot.
+  bool HasBytecode() const {
+    return !bytecode()->IsSmallInteger();
+  }
+  SmallInteger BytecodePosition() const {
+    ASSERT(!HasBytecode());
+    Object position = bytecode();
+    return static_cast<SmallInteger>(position);
+  }
+
   const uint8_t* IP(const SmallInteger bci) {
     return bytecode()->element_addr(bci->value() - 1);
   }
@@ -726,21 +831,32 @@ class ObjectStore : public HeapObject {
   inline Behavior WeakArray() const;
   inline Behavior Activation() const;
   inline Behavior Method() const;
+
+  // Snapshots whose message loop can take messages the VM decoded end with
+  // its selector for them and the objects messages refer to by index; see
+  // MessageSerializer.
+  bool HasMessageObjects() const { return size()->value() > kNumFixedEntries; }
+  inline class String dispatch_objects() const;
+  inline class Array message_shared_objects() const;
+
+ private:
+  static constexpr intptr_t kNumFixedEntries = 25;
 };
 
 class HeapObject::Layout {
  public:
   uword header_;
-  uword header_hash_;
 };
 
 class ForwardingCorpse::Layout : public HeapObject::Layout {
  public:
+  uword target_;
   intptr_t overflow_size_;
 };
 
 class FreeListElement::Layout : public HeapObject::Layout {
  public:
+  uword next_;
   intptr_t overflow_size_;
 };
 
@@ -786,6 +902,7 @@ class Ephemeron::Layout : public HeapObject::Layout {
 class Bytes::Layout : public HeapObject::Layout {
  public:
   SmallInteger size_;
+  intptr_t hash_;  // Only used by String; keeps elements at the same offset.
 };
 
 class String::Layout : public Bytes::Layout {};
@@ -810,7 +927,7 @@ class Activation::Layout : public HeapObject::Layout {
   Closure closure_;
   Object receiver_;
   SmallInteger stack_depth_;
-  Object temps_[kMaxTemps];
+  Array temps_;
 };
 
 class Float::Layout : public HeapObject::Layout {
@@ -889,6 +1006,8 @@ class ObjectStore::Layout : public HeapObject::Layout {
   Behavior WeakArray_;
   Behavior Activation_;
   Behavior Method_;
+  class String dispatch_objects_;
+  class Array message_shared_objects_;
 };
 
 bool HeapObject::is_marked() const {
@@ -909,6 +1028,40 @@ bool HeapObject::is_canonical() const {
 void HeapObject::set_is_canonical(bool value) {
   ptr()->header_ = CanonicalBit::update(value, ptr()->header_);
 }
+bool HeapObject::is_carded() const {
+  return CardedBit::decode(ptr()->header_);
+}
+void HeapObject::set_is_carded(bool value) {
+  ptr()->header_ = CardedBit::update(value, ptr()->header_);
+}
+bool HeapObject::is_waiting_key() const {
+  return WaitingKeyBit::decode(ptr()->header_);
+}
+void HeapObject::set_is_waiting_key(bool value) {
+  ptr()->header_ = WaitingKeyBit::update(value, ptr()->header_);
+}
+intptr_t HeapObject::age() const {
+  return AgeField::decode(ptr()->header_);
+}
+void HeapObject::set_age(intptr_t value) {
+  ptr()->header_ = AgeField::update(value, ptr()->header_);
+}
+bool HeapObject::TryMarkAtomic(bool forget) {
+  uword* header = &ptr()->header_;
+  uword old_header = AtomicOperations::LoadRelaxed(header);
+  for (;;) {
+    if (MarkBit::decode(old_header)) {
+      return false;
+    }
+    uword new_header = MarkBit::update(true, old_header);
+    if (forget) {
+      new_header = RememberedBit::update(false, new_header);
+    }
+    if (AtomicOperations::CompareAndSwap(header, &old_header, new_header)) {
+      return true;
+    }
+  }
+}
 intptr_t HeapObject::heap_size() const {
   return SizeField::decode(ptr()->header_) << kObjectAlignmentLog2;
 }
@@ -925,12 +1078,6 @@ intptr_t HeapObject::cid() const {
 void HeapObject::set_cid(intptr_t value) {
   ptr()->header_ = ClassIdField::update(value, ptr()->header_);
 }
-intptr_t HeapObject::header_hash() const {
-  return ptr()->header_hash_;
-}
-void HeapObject::set_header_hash(intptr_t value) {
-  ptr()->header_hash_ = value;
-}
 
 HeapObject HeapObject::Initialize(uword addr,
                                 intptr_t cid,
@@ -948,17 +1095,16 @@ HeapObject HeapObject::Initialize(uword addr,
   header = ClassIdField::update(cid, header);
   HeapObject obj = FromAddr(addr);
   obj.ptr()->header_ = header;
-  obj.ptr()->header_hash_ = 0;
   ASSERT(obj.cid() == cid);
   ASSERT(!obj.is_marked());
   return obj;
 }
 
 Object ForwardingCorpse::target() const {
-  return static_cast<Object>(ptr()->header_hash_);
+  return static_cast<Object>(ptr()->target_);
 }
 void ForwardingCorpse::set_target(Object value) {
-  ptr()->header_hash_ = static_cast<uword>(value);
+  ptr()->target_ = static_cast<uword>(value);
 }
 intptr_t ForwardingCorpse::overflow_size() const {
   return ptr()->overflow_size_;
@@ -968,11 +1114,11 @@ void ForwardingCorpse::set_overflow_size(intptr_t value) {
 }
 
 FreeListElement FreeListElement::next() const {
-  return static_cast<FreeListElement>(ptr()->header_hash_);
+  return static_cast<FreeListElement>(ptr()->next_);
 }
 void FreeListElement::set_next(FreeListElement value) {
   ASSERT((value == nullptr) || value->IsHeapObject());  // Tagged.
-  ptr()->header_hash_ = static_cast<uword>(value);
+  ptr()->next_ = static_cast<uword>(value);
 }
 intptr_t FreeListElement::overflow_size() const {
   return ptr()->overflow_size_;
@@ -1008,6 +1154,12 @@ digit_t LargeInteger::digit(intptr_t index) const {
 void LargeInteger::set_digit(intptr_t index, digit_t value) {
   ptr()->digits_[index] = value;
 }
+const digit_t* LargeInteger::digits() const {
+  return &ptr()->digits_[0];
+}
+digit_t* LargeInteger::digits() {
+  return &ptr()->digits_[0];
+}
 
 Object RegularObject::slot(intptr_t index) const {
   return Load(&ptr()->slots_[index]);
@@ -1098,9 +1250,15 @@ const uint8_t* Bytes::element_addr(intptr_t index) const {
   return &elements[index];
 }
 
+intptr_t String::hash() const { return ptr()->hash_; }
+void String::set_hash(intptr_t value) { ptr()->hash_ = value; }
+
 SmallInteger Method::header() const { return Load(&ptr()->header_); }
 Array Method::literals() const { return Load(&ptr()->literals_); }
 ByteArray Method::bytecode() const { return Load(&ptr()->bytecode_); }
+void Method::set_bytecode(ByteArray bytecode) {
+  Store(&ptr()->bytecode_, bytecode, kBarrier);
+}
 AbstractMixin Method::mixin() const { return Load(&ptr()->mixin_); }
 String Method::selector() const { return Load(&ptr()->selector_); }
 Object Method::source() const { return Load(&ptr()->source_); }
@@ -1129,17 +1287,23 @@ SmallInteger Activation::stack_depth() const {
 void Activation::set_stack_depth(SmallInteger d) {
   Store(&ptr()->stack_depth_, d, kNoBarrier);
 }
+Array Activation::temps() const { return Load(&ptr()->temps_); }
+void Activation::set_temps(Array t, Barrier barrier) {
+  Store(&ptr()->temps_, t, barrier);
+}
 Object Activation::temp(intptr_t index) const {
-  return Load(&ptr()->temps_[index]);
+  ASSERT(index < TempCapacity());
+  return temps()->element(index);
 }
 void Activation::set_temp(intptr_t index, Object o, Barrier barrier) {
-  Store(&ptr()->temps_[index], o, barrier);
+  ASSERT(index < TempCapacity());
+  temps()->set_element(index, o, barrier);
 }
 Object* Activation::from() {
   return reinterpret_cast<Object*>(&ptr()->sender_);
 }
 Object* Activation::to() {
-  return reinterpret_cast<Object*>(&ptr()->stack_depth_) + StackDepth();
+  return reinterpret_cast<Object*>(&ptr()->temps_);
 }
 
 double Float::value() const { return ptr()->value_; }
@@ -1256,6 +1420,14 @@ Behavior ObjectStore::SmallInteger() const { return ptr()->SmallInteger_; }
 Behavior ObjectStore::WeakArray() const { return ptr()->WeakArray_; }
 Behavior ObjectStore::Activation() const { return ptr()->Activation_; }
 Behavior ObjectStore::Method() const { return ptr()->Method_; }
+class String ObjectStore::dispatch_objects() const {
+  ASSERT(HasMessageObjects());
+  return ptr()->dispatch_objects_;
+}
+class Array ObjectStore::message_shared_objects() const {
+  ASSERT(HasMessageObjects());
+  return ptr()->message_shared_objects_;
+}
 
 }  // namespace psoup
 
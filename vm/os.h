@@ -16,6 +16,8 @@ class OS {
 
   static int64_t CurrentMonotonicNanos();
   static int64_t CurrentRealtimeNanos();
+  // Time the calling thread has spent running.
+  static int64_t CurrentThreadCPUNanos();
 
   static intptr_t GetEntropy(void* buffer, size_t size);
 
@@ -37,6 +37,18 @@ int64_t OS::CurrentMonotonicNanos() {
   return result;
 }
 
+int64_t OS::CurrentThreadCPUNanos() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    UNREACHABLE();
+    return 0;
+  }
+  int64_t result = ts.tv_sec;
+  result *= kNanosecondsPerSecond;
+  result += ts.tv_nsec;
+  return result;
+}
+
 
 int64_t OS::CurrentRealtimeNanos() {
   struct timespec ts;
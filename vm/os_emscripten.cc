@@ -8,6 +8,9 @@
 #include "vm/os.h"
 
 #include <emscripten.h>
+#if defined(EMSCRIPTEN_THREADS)
+#include <emscripten/threading.h>
+#endif
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,6 +46,13 @@ int64_t OS::CurrentRealtimeNanos() {
 }
 
 
+int64_t OS::CurrentThreadCPUNanos() {
+  // Browsers have no CPU clock, so a thread is counted as running whenever
+  // time passes.
+  return CurrentMonotonicNanos();
+}
+
+
 intptr_t OS::GetEntropy(void* buffer, size_t size) {
   return getentropy(buffer, size);
 }
@@ -52,7 +62,11 @@ const char* OS::Name() { return "emscripten"; }
 
 
 intptr_t OS::NumberOfAvailableProcessors() {
+#if defined(EMSCRIPTEN_THREADS)
+  return emscripten_num_logical_cores();
+#else
   return 1;
+#endif
 }
 
 
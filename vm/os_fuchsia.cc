@@ -35,6 +35,15 @@ int64_t OS::CurrentRealtimeNanos() {
 }
 
 
+int64_t OS::CurrentThreadCPUNanos() {
+  zx_info_thread_stats_t info;
+  zx_status_t status = zx_object_get_info(zx_thread_self(),
+                                          ZX_INFO_THREAD_STATS, &info,
+                                          sizeof(info), nullptr, nullptr);
+  return status == ZX_OK ? info.total_runtime : 0;
+}
+
+
 intptr_t OS::GetEntropy(void* buffer, size_t size) {
   zx_cprng_draw(buffer, size);
   return ZX_OK;
@@ -36,6 +36,11 @@ int64_t OS::CurrentRealtimeNanos() {
 }
 
 
+int64_t OS::CurrentThreadCPUNanos() {
+  return clock_gettime_nsec_np(CLOCK_THREAD_CPUTIME_ID);
+}
+
+
 intptr_t OS::GetEntropy(void* buffer, size_t size) {
   if (getentropy(buffer, size) == -1) {
     return errno;
@@ -84,6 +84,22 @@ int64_t OS::CurrentRealtimeNanos() {
 }
 
 
+int64_t OS::CurrentThreadCPUNanos() {
+  static const int64_t kTimeScaler = 100;  // 100 ns to ns.
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    return 0;
+  }
+  ULARGE_INTEGER kernel_time, user_time;
+  kernel_time.LowPart = kernel.dwLowDateTime;
+  kernel_time.HighPart = kernel.dwHighDateTime;
+  user_time.LowPart = user.dwLowDateTime;
+  user_time.HighPart = user.dwHighDateTime;
+  return static_cast<int64_t>(kernel_time.QuadPart + user_time.QuadPart) *
+         kTimeScaler;
+}
+
+
 const char* OS::Name() { return "windows"; }
 
 
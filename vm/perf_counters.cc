@@ -0,0 +1,226 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/perf_counters.h"
+
+#include <string.h>
+
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "vm/heap.h"
+#include "vm/os.h"
+
+namespace psoup {
+
+bool PerfCounters::count_from_start_ = false;
+
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+
+// One group per thread, opened on first use and always running, so a reading
+// is a single read of the group. Closed when the thread exits.
+class ThreadCounters {
+ public:
+  ThreadCounters() : leader_(-1) {
+    static const uint64_t kConfigs[PerfCounters::kNumCounters] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_BRANCH_MISSES,
+      PERF_COUNT_HW_CACHE_MISSES,
+    };
+    for (intptr_t i = 0; i < PerfCounters::kNumCounters; i++) {
+      fds_[i] = -1;
+    }
+    for (intptr_t i = 0; i < PerfCounters::kNumCounters; i++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = kConfigs[i];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, leader_, 0);
+      if (fds_[i] < 0) {
+        Close();
+        return;
+      }
+      if (i == 0) {
+        leader_ = fds_[0];
+      }
+    }
+  }
+
+  ~ThreadCounters() { Close(); }
+
+  bool IsOpen() const { return leader_ >= 0; }
+
+  bool Read(int64_t* counts) {
+    uint64_t buffer[1 + PerfCounters::kNumCounters];
+    if (read(leader_, buffer, sizeof(buffer)) != sizeof(buffer)) {
+      return false;
+    }
+    ASSERT(buffer[0] == PerfCounters::kNumCounters);
+    for (intptr_t i = 0; i < PerfCounters::kNumCounters; i++) {
+      counts[i] = buffer[1 + i];
+    }
+    return true;
+  }
+
+ private:
+  void Close() {
+    for (intptr_t i = PerfCounters::kNumCounters - 1; i >= 0; i--) {
+      if (fds_[i] >= 0) {
+        close(fds_[i]);
+        fds_[i] = -1;
+      }
+    }
+    leader_ = -1;
+  }
+
+  int leader_;
+  int fds_[PerfCounters::kNumCounters];
+
+  DISALLOW_COPY_AND_ASSIGN(ThreadCounters);
+};
+
+static ThreadCounters* CurrentThreadCounters() {
+  static thread_local ThreadCounters counters;
+  return &counters;
+}
+
+bool PerfCounters::IsAvailable() {
+  return CurrentThreadCounters()->IsOpen();
+}
+
+bool PerfCounters::Read(Reading* reading) {
+  reading->nanos = OS::CurrentMonotonicNanos();
+  ThreadCounters* counters = CurrentThreadCounters();
+  return counters->IsOpen() && counters->Read(reading->counts);
+}
+
+#else
+
+bool PerfCounters::IsAvailable() {
+  return false;
+}
+
+bool PerfCounters::Read(Reading* reading) {
+  reading->nanos = OS::CurrentMonotonicNanos();
+  return false;
+}
+
+#endif
+
+
+PerfCounters::PerfCounters() {
+  memset(entered_, 0, sizeof(entered_));
+  memset(start_, 0, sizeof(start_));
+  memset(totals_, 0, sizeof(totals_));
+}
+
+
+void PerfCounters::Enter(Phase phase) {
+  if (entered_[phase]) {
+    return;
+  }
+  // A phase whose counters cannot be read still counts its time.
+  if (!Read(&start_[phase])) {
+    memset(start_[phase].counts, 0, sizeof(start_[phase].counts));
+  }
+  entered_[phase] = true;
+}
+
+
+void PerfCounters::Exit(Phase phase) {
+  if (!entered_[phase]) {
+    return;
+  }
+  entered_[phase] = false;
+  Reading stop;
+  bool counted = Read(&stop);
+  Totals* totals = &totals_[phase];
+  totals->entries++;
+  totals->nanos += stop.nanos - start_[phase].nanos;
+  if (counted) {
+    for (intptr_t i = 0; i < kNumCounters; i++) {
+      totals->counts[i] += stop.counts[i] - start_[phase].counts[i];
+    }
+  }
+}
+
+
+const char* PerfCounters::PhaseName(Phase phase) {
+  switch (phase) {
+    case kInterpret: return "interpret";
+    case kScavenge: return "scavenge";
+    case kMarkSweep: return "mark-sweep";
+    case kDeserialize: return "deserialize";
+    default: break;
+  }
+  UNREACHABLE();
+  return nullptr;
+}
+
+
+void PerfCounters::Encode(uint8_t* bytes) const {
+  int64_t* values = reinterpret_cast<int64_t*>(bytes);
+  *values++ = IsAvailable() ? 1 : 0;
+  for (intptr_t phase = 0; phase < kNumPhases; phase++) {
+    *values++ = totals_[phase].entries;
+    *values++ = totals_[phase].nanos;
+    for (intptr_t i = 0; i < kNumCounters; i++) {
+      *values++ = totals_[phase].counts[i];
+    }
+  }
+}
+
+
+void PerfCounters::Print(const char* label) const {
+  bool available = IsAvailable();
+  for (intptr_t phase = 0; phase < kNumPhases; phase++) {
+    const Totals& totals = totals_[phase];
+    if (totals.entries == 0) {
+      continue;
+    }
+    const char* name = PhaseName(static_cast<Phase>(phase));
+    if (!available) {
+      OS::PrintErr("%s %s: %" Pd64 " entries, %" Pd64 " ns\n",
+                   label, name, totals.entries, totals.nanos);
+      continue;
+    }
+    int64_t cycles = totals.counts[kCycles];
+    OS::PrintErr("%s %s: %" Pd64 " entries, %" Pd64 " ns, %" Pd64
+                 " cycles, %" Pd64 " instructions (%.2f IPC), %" Pd64
+                 " branch misses, %" Pd64 " cache misses\n",
+                 label, name, totals.entries, totals.nanos, cycles,
+                 totals.counts[kInstructions],
+                 cycles == 0 ? 0.0
+                     : static_cast<double>(totals.counts[kInstructions]) /
+                           cycles,
+                 totals.counts[kBranchMisses], totals.counts[kCacheMisses]);
+  }
+}
+
+
+PerfScope::PerfScope(Heap* heap, PerfCounters::Phase phase)
+    : heap_(heap), phase_(phase) {
+  PerfCounters* counters = heap_->perf_counters();
+  if (counters != nullptr) {
+    counters->Enter(phase_);
+  }
+}
+
+
+PerfScope::~PerfScope() {
+  PerfCounters* counters = heap_->perf_counters();
+  if (counters != nullptr) {
+    counters->Exit(phase_);
+  }
+}
+
+}  // namespace psoup
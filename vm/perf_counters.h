@@ -0,0 +1,110 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_PERF_COUNTERS_H_
+#define VM_PERF_COUNTERS_H_
+
+#include "vm/globals.h"
+
+namespace psoup {
+
+class Heap;
+
+// Hardware counters totalled by the phase of an isolate's work they were read
+// around. Each phase reads the counters of the thread it runs on as it is
+// entered and exited, so an isolate is counted on whichever thread it runs.
+// The helpers of a parallel scavenge are not counted. Phases nest: the
+// interpreter's totals include the collections it caused.
+//
+// Counters are read with perf_event_open on Linux and Android. Elsewhere none
+// are available; macOS has them only through the private kperf framework,
+// which needs root.
+class PerfCounters {
+ public:
+  enum Counter {
+    kCycles,
+    kInstructions,
+    kBranchMisses,
+    kCacheMisses,
+    kNumCounters
+  };
+
+  enum Phase {
+    kInterpret,
+    kScavenge,
+    kMarkSweep,
+    kDeserialize,
+    kNumPhases
+  };
+
+  struct Totals {
+    int64_t entries;
+    int64_t nanos;
+    int64_t counts[kNumCounters];
+  };
+
+  // Whether the current thread can read the counters. They are opened on the
+  // first call from each thread.
+  static bool IsAvailable();
+
+  // Whether isolates count from their start, including reading the snapshot.
+  // Set before any isolate starts.
+  static void SetCountFromStart(bool value) { count_from_start_ = value; }
+  static bool count_from_start() { return count_from_start_; }
+
+  PerfCounters();
+
+  // Entering a phase already entered, or exiting one not entered, does
+  // nothing, so counting may start or stop partway through a phase.
+  void Enter(Phase phase);
+  void Exit(Phase phase);
+
+  const Totals& totals(Phase phase) const { return totals_[phase]; }
+
+  static const char* PhaseName(Phase phase);
+
+  // The totals as int64s: 1 if the current thread reads hardware counters,
+  // and then phase by phase in the order of Phase, entries, nanos and the
+  // counts in the order of Counter.
+  static constexpr intptr_t kEncodedSize =
+      (1 + kNumPhases * (2 + kNumCounters)) * sizeof(int64_t);
+  void Encode(uint8_t* bytes) const;
+
+  void Print(const char* label) const;
+
+ private:
+  struct Reading {
+    int64_t nanos;
+    int64_t counts[kNumCounters];
+  };
+
+  static bool Read(Reading* reading);
+
+  bool entered_[kNumPhases];
+  Reading start_[kNumPhases];
+  Totals totals_[kNumPhases];
+
+  static bool count_from_start_;
+
+  DISALLOW_COPY_AND_ASSIGN(PerfCounters);
+};
+
+// Counts the rest of the enclosing scope as |phase| if |heap|'s isolate is
+// counting. The counters are looked up again on exit, as counting may have
+// started or stopped in between.
+class PerfScope {
+ public:
+  PerfScope(Heap* heap, PerfCounters::Phase phase);
+  ~PerfScope();
+
+ private:
+  Heap* heap_;
+  PerfCounters::Phase phase_;
+
+  DISALLOW_COPY_AND_ASSIGN(PerfScope);
+};
+
+}  // namespace psoup
+
+#endif  // VM_PERF_COUNTERS_H_
@@ -5,25 +5,24 @@
 #include "vm/port.h"
 
 #include "vm/flags.h"
+#include "vm/isolate.h"
 #include "vm/lockers.h"
 #include "vm/message_loop.h"
 #include "vm/os.h"
 #include "vm/random.h"
 #include "vm/thread.h"
+#include "vm/trace_events.h"
 #include "vm/utils.h"
 
 namespace psoup {
 
-Mutex* PortMap::mutex_ = NULL;
-PortMap::Entry* PortMap::map_ = NULL;
 MessageLoop* PortMap::deleted_entry_ = reinterpret_cast<MessageLoop*>(1);
-intptr_t PortMap::capacity_ = 0;
-intptr_t PortMap::used_ = 0;
-intptr_t PortMap::deleted_ = 0;
+PortMap::Shard PortMap::shards_[kNumShards];
+Mutex* PortMap::prng_mutex_ = NULL;
 Random* PortMap::prng_ = NULL;
 
 
-intptr_t PortMap::FindPort(Port port) {
+intptr_t PortMap::Shard::FindPort(Port port) {
   // ILLEGAL_PORT (0) is used as a sentinel value in Entry.port. The loop below
   // could return the index to a deleted port when we are searching for
   // port id ILLEGAL_PORT. Return -1 immediately to indicate the port
@@ -48,7 +47,7 @@ intptr_t PortMap::FindPort(Port port) {
 }
 
 
-void PortMap::Rehash(intptr_t new_capacity) {
+void PortMap::Shard::Rehash(intptr_t new_capacity) {
   Entry* new_ports = new Entry[new_capacity];
   memset(new_ports, 0, new_capacity * sizeof(Entry));
 
@@ -70,21 +69,7 @@ void PortMap::Rehash(intptr_t new_capacity) {
 }
 
 
-Port PortMap::AllocatePort() {
-  // Keep getting new values while we have an illegal port number or the port
-  // number is already in use.
-  Port result;
-  do {
-    result = prng_->NextUInt64();
-  } while ((result == ILLEGAL_PORT) || (FindPort(result) >= 0));
-
-  ASSERT(result != 0);
-  ASSERT(FindPort(result) < 0);
-  return result;
-}
-
-
-void PortMap::MaintainInvariants() {
+void PortMap::Shard::MaintainInvariants() {
   intptr_t empty = capacity_ - used_ - deleted_;
   if (used_ > ((capacity_ / 4) * 3)) {
     // Grow the port map.
@@ -97,18 +82,7 @@ void PortMap::MaintainInvariants() {
 }
 
 
-Port PortMap::CreatePort(MessageLoop* loop) {
-  ASSERT(loop != NULL);
-  MutexLocker ml(mutex_);
-#if defined(DEBUG)
-  /// queue->CheckAccess();
-#endif
-
-  Entry entry;
-  entry.port = AllocatePort();
-  entry.loop = loop;
-  /// entry.state = kNewPort;
-
+void PortMap::Shard::Insert(Entry entry) {
   // Search for the first unused slot. Make use of the knowledge that here is
   // currently no port with this id in the port map.
   ASSERT(FindPort(entry.port) < 0);
@@ -135,54 +109,31 @@ Port PortMap::CreatePort(MessageLoop* loop) {
   // Increment number of used slots and grow if necessary.
   used_++;
   MaintainInvariants();
-
-  return entry.port;
-}
-
-
-bool PortMap::PostMessage(IsolateMessage* message) {
-  MutexLocker ml(mutex_);
-  intptr_t index = FindPort(message->dest_port());
-  if (index < 0) {
-    delete message;
-    return false;
-  }
-  ASSERT(index >= 0);
-  ASSERT(index < capacity_);
-  MessageLoop* loop = map_[index].loop;
-  ASSERT(map_[index].port != 0);
-  ASSERT((loop != NULL) && (loop != deleted_entry_));
-  loop->PostMessage(message);
-  return true;
 }
 
 
-bool PortMap::ClosePort(Port port) {
-  MutexLocker ml(mutex_);
-  intptr_t index = FindPort(port);
-  if (index < 0) {
-    return false;
-  }
+void PortMap::Shard::Remove(intptr_t index) {
   ASSERT(index < capacity_);
   ASSERT(map_[index].port != 0);
   ASSERT(map_[index].loop != deleted_entry_);
   ASSERT(map_[index].loop != NULL);
 
+  // Messages still queued for the port will never be taken.
+  map_[index].loop->AddQueued(-map_[index].depth);
   map_[index].port = 0;
   map_[index].loop = deleted_entry_;
 
   used_--;
   deleted_++;
   MaintainInvariants();
-  return true;
 }
 
 
-void PortMap::CloseAllPorts(MessageLoop* loop) {
-  MutexLocker ml(mutex_);
+void PortMap::Shard::RemoveAll(MessageLoop* loop) {
   for (intptr_t index = 0; index < capacity_; index++) {
     if (map_[index].loop == loop) {
       ASSERT(map_[index].port != 0);
+      loop->AddQueued(-map_[index].depth);
       map_[index].port = 0;
       map_[index].loop = deleted_entry_;
       used_--;
@@ -193,9 +144,8 @@ void PortMap::CloseAllPorts(MessageLoop* loop) {
 }
 
 
-void PortMap::Startup() {
+void PortMap::Shard::Startup() {
   mutex_ = new Mutex();
-  prng_ = new Random(OS::CurrentMonotonicNanos());
 
   static const intptr_t kInitialCapacity = 8;
   // TODO(iposva): Verify whether we want to keep exponentially growing.
@@ -208,13 +158,226 @@ void PortMap::Startup() {
 }
 
 
-void PortMap::Shutdown() {
+void PortMap::Shard::Shutdown() {
   delete mutex_;
   mutex_ = NULL;
-  delete prng_;
-  prng_ = NULL;
   delete[] map_;
   map_ = NULL;
 }
 
+
+Port PortMap::AllocatePort() {
+  MutexLocker ml(prng_mutex_);
+  // Keep getting new values while we have an illegal port number.
+  Port result;
+  do {
+    // Non-negative, so it can be reduced to an index in the map.
+    result = prng_->NextUInt64() & kMaxInt64;
+  } while (result == ILLEGAL_PORT);
+  return result;
+}
+
+
+Port PortMap::CreatePort(MessageLoop* loop) {
+  ASSERT(loop != NULL);
+  for (;;) {
+    Entry entry;
+    entry.port = AllocatePort();
+    entry.loop = loop;
+    entry.depth = 0;
+    entry.max_depth = 0;
+    entry.capacity = 0;
+    entry.rejected = 0;
+
+    Shard* shard = ShardFor(entry.port);
+    MutexLocker ml(shard->mutex());
+    // Try again if the port number is already in use.
+    if (shard->FindPort(entry.port) < 0) {
+      shard->Insert(entry);
+      return entry.port;
+    }
+  }
+}
+
+
+PortMap::PostResult PortMap::Reserve(Entry* entry, intptr_t count) {
+  intptr_t depth = entry->depth + count;
+  if ((entry->capacity != 0) && (depth > entry->capacity)) {
+    entry->rejected += count;
+    return kFull;
+  }
+  entry->depth = depth;
+  if (depth > entry->max_depth) {
+    entry->max_depth = depth;
+  }
+  entry->loop->AddQueued(count);
+  return kPosted;
+}
+
+
+// Joins |message|'s post to its dispatch, before the receiver can take it.
+static void TracePost(IsolateMessage* message) {
+  message->set_trace_id(TraceEvents::NextFlowId());
+  TraceEvents::Record(TraceEvents::kFlowStart, "message", Isolate::Current(),
+                      message->trace_id());
+}
+
+
+PortMap::PostResult PortMap::PostMessage(IsolateMessage* message) {
+  Shard* shard = ShardFor(message->dest_port());
+  // Held while posting, so the loop cannot close the port and go away.
+  MutexLocker ml(shard->mutex());
+  intptr_t index = shard->FindPort(message->dest_port());
+  if (index < 0) {
+    delete message;
+    return kClosed;
+  }
+  ASSERT(index >= 0);
+  Entry* entry = shard->at(index);
+  ASSERT((entry->loop != NULL) && (entry->loop != deleted_entry_));
+  PostResult result = Reserve(entry, 1);
+  if (result != kPosted) {
+    delete message;
+    return result;
+  }
+  if (TraceEvents::enabled()) {
+    TraceEvents::Record(TraceEvents::kInstant, "post message",
+                        Isolate::Current());
+    TracePost(message);
+  }
+  message->set_posted(OS::CurrentMonotonicNanos());
+  entry->loop->PostMessage(message);
+  return kPosted;
+}
+
+
+PortMap::PostResult PortMap::PostMessages(Port port,
+                                          IsolateMessage* first,
+                                          IsolateMessage* last) {
+  Shard* shard = ShardFor(port);
+  MutexLocker ml(shard->mutex());
+  intptr_t index = shard->FindPort(port);
+  PostResult result = kClosed;
+  if (index >= 0) {
+    intptr_t count = 1;
+    for (IsolateMessage* message = first; message != last;
+         message = message->next()) {
+      count++;
+    }
+    result = Reserve(shard->at(index), count);
+  }
+  if (result != kPosted) {
+    IsolateMessage* message = first;
+    while (message != NULL) {
+      IsolateMessage* next = message == last ? NULL : message->next();
+      delete message;
+      message = next;
+    }
+    return result;
+  }
+  MessageLoop* loop = shard->at(index)->loop;
+  ASSERT((loop != NULL) && (loop != deleted_entry_));
+  if (TraceEvents::enabled()) {
+    TraceEvents::Record(TraceEvents::kInstant, "post messages",
+                        Isolate::Current());
+    for (IsolateMessage* message = first; ; message = message->next()) {
+      TracePost(message);
+      if (message == last) {
+        break;
+      }
+    }
+  }
+  int64_t now = OS::CurrentMonotonicNanos();
+  for (IsolateMessage* message = first; ; message = message->next()) {
+    message->set_posted(now);
+    if (message == last) {
+      break;
+    }
+  }
+  loop->PostMessages(first, last);
+  return kPosted;
+}
+
+
+void PortMap::MessagesTaken(Port port, intptr_t count) {
+  Shard* shard = ShardFor(port);
+  MutexLocker ml(shard->mutex());
+  intptr_t index = shard->FindPort(port);
+  if (index >= 0) {
+    Entry* entry = shard->at(index);
+    ASSERT(entry->depth >= count);
+    entry->depth -= count;
+    entry->loop->AddQueued(-count);
+  }
+}
+
+
+bool PortMap::SetCapacity(Port port, intptr_t capacity) {
+  ASSERT(capacity >= 0);
+  Shard* shard = ShardFor(port);
+  MutexLocker ml(shard->mutex());
+  intptr_t index = shard->FindPort(port);
+  if (index < 0) {
+    return false;
+  }
+  shard->at(index)->capacity = capacity;
+  return true;
+}
+
+
+bool PortMap::GetStatistics(Port port, Statistics* statistics) {
+  Shard* shard = ShardFor(port);
+  MutexLocker ml(shard->mutex());
+  intptr_t index = shard->FindPort(port);
+  if (index < 0) {
+    return false;
+  }
+  Entry* entry = shard->at(index);
+  statistics->depth = entry->depth;
+  statistics->max_depth = entry->max_depth;
+  statistics->capacity = entry->capacity;
+  statistics->rejected = entry->rejected;
+  return true;
+}
+
+
+bool PortMap::ClosePort(Port port) {
+  Shard* shard = ShardFor(port);
+  MutexLocker ml(shard->mutex());
+  intptr_t index = shard->FindPort(port);
+  if (index < 0) {
+    return false;
+  }
+  shard->Remove(index);
+  return true;
+}
+
+
+void PortMap::CloseAllPorts(MessageLoop* loop) {
+  for (intptr_t i = 0; i < kNumShards; i++) {
+    MutexLocker ml(shards_[i].mutex());
+    shards_[i].RemoveAll(loop);
+  }
+}
+
+
+void PortMap::Startup() {
+  prng_mutex_ = new Mutex();
+  prng_ = new Random(OS::CurrentMonotonicNanos());
+  for (intptr_t i = 0; i < kNumShards; i++) {
+    shards_[i].Startup();
+  }
+}
+
+
+void PortMap::Shutdown() {
+  for (intptr_t i = 0; i < kNumShards; i++) {
+    shards_[i].Shutdown();
+  }
+  delete prng_mutex_;
+  prng_mutex_ = NULL;
+  delete prng_;
+  prng_ = NULL;
+}
+
 }  // namespace psoup
@@ -20,8 +20,37 @@ class Random;
 
 class PortMap : public AllStatic {
  public:
+  enum PostResult {
+    kPosted = 0,
+    kClosed = 1,
+    // Taking the message would put more than the port's capacity in its
+    // receiver's queue.
+    kFull = 2,
+  };
+
+  // Messages posted to a port and not yet taken by its receiver.
+  struct Statistics {
+    int64_t depth;
+    int64_t max_depth;
+    int64_t capacity;  // 0 if unbounded.
+    int64_t rejected;  // Messages refused because the port was full.
+  };
+
   static Port CreatePort(MessageLoop* loop);
-  static bool PostMessage(IsolateMessage* message);
+  // Unless the message is posted, it is deleted.
+  static PostResult PostMessage(IsolateMessage* message);
+  // Posts |first| through |last|, linked by next_ and all for |port|, as one
+  // step. Either all are posted or all are deleted.
+  static PostResult PostMessages(Port port,
+                                 IsolateMessage* first,
+                                 IsolateMessage* last);
+  // Called by the receiver as it takes |count| messages for |port| from its
+  // queue, before handling them.
+  static void MessagesTaken(Port port, intptr_t count);
+  // Bounds how many messages may wait for |port|; 0 for no bound. Messages
+  // already queued are kept. Returns false if the port is closed.
+  static bool SetCapacity(Port port, intptr_t capacity);
+  static bool GetStatistics(Port port, Statistics* statistics);
   static bool ClosePort(Port port);
   static void CloseAllPorts(MessageLoop* loop);
 
@@ -29,27 +58,60 @@ class PortMap : public AllStatic {
   static void Shutdown();
 
  private:
-  // Allocate a new unique port.
-  static Port AllocatePort();
-
-  static intptr_t FindPort(Port port);
-  static void Rehash(intptr_t new_capacity);
-
-  static void MaintainInvariants();
-
   typedef struct {
     Port port;
     MessageLoop* loop;
+    intptr_t depth;
+    intptr_t max_depth;
+    intptr_t capacity;
+    int64_t rejected;
   } Entry;
 
-  static Mutex* mutex_;
+  // An open-addressed table of the ports whose ids fall to it, with its own
+  // lock, so that posting to one isolate rarely waits on traffic to another.
+  class Shard {
+   public:
+    void Startup();
+    void Shutdown();
+
+    intptr_t FindPort(Port port);
+    void Insert(Entry entry);
+    void Remove(intptr_t index);
+    void RemoveAll(MessageLoop* loop);
+
+    Mutex* mutex() const { return mutex_; }
+    Entry* at(intptr_t index) const { return &map_[index]; }
+
+   private:
+    void Rehash(intptr_t new_capacity);
+    void MaintainInvariants();
+
+    Mutex* mutex_;
+    Entry* map_;
+    intptr_t capacity_;
+    intptr_t used_;
+    intptr_t deleted_;
+  };
+
+  static constexpr intptr_t kNumShards = 64;
+
+  // Ids are random, so their high bits spread ports evenly over the shards
+  // while the low bits index within one.
+  static Shard* ShardFor(Port port) {
+    return &shards_[(port >> 48) & (kNumShards - 1)];
+  }
+
+  // Allocate a new port id, which may already be in use.
+  static Port AllocatePort();
+
+  // Counts |count| messages into the port's queue unless that would exceed
+  // its capacity.
+  static PostResult Reserve(Entry* entry, intptr_t count);
 
-  static Entry* map_;
   static MessageLoop* deleted_entry_;
-  static intptr_t capacity_;
-  static intptr_t used_;
-  static intptr_t deleted_;
+  static Shard shards_[kNumShards];
 
+  static Mutex* prng_mutex_;
   static Random* prng_;
 };
 
@@ -0,0 +1,168 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_PPROF_H_
+#define VM_PPROF_H_
+
+#include <string.h>
+
+#include "vm/globals.h"
+#include "vm/object.h"
+
+// Helpers shared by the profiles that are encoded for pprof.
+
+namespace psoup {
+
+class NameBuffer {
+ public:
+  NameBuffer() : length_(0) { chars_[0] = 0; }
+
+  const char* chars() const { return chars_; }
+
+  void Add(const char* chars, intptr_t length) {
+    if (length > kCapacity - 1 - length_) {
+      length = kCapacity - 1 - length_;
+    }
+    memcpy(&chars_[length_], chars, length);
+    length_ += length;
+    chars_[length_] = 0;
+  }
+  void Add(const char* cstr) { Add(cstr, strlen(cstr)); }
+  void Add(String string) {
+    Add(reinterpret_cast<const char*>(string->element_addr(0)),
+        string->Size());
+  }
+
+  // A metaclass's mixin is named by its class's mixin; see
+  // Activation::PrintStack.
+  void AddMixin(AbstractMixin mixin) {
+    Object name = mixin->name();
+    if (name->IsString()) {
+      Add(static_cast<String>(name));
+      return;
+    }
+    if (name->IsHeapObject()) {
+      name = static_cast<AbstractMixin>(name)->name();
+      if (name->IsString()) {
+        Add(static_cast<String>(name));
+        Add(" class");
+        return;
+      }
+    }
+    Add("?");
+  }
+
+  void AddMethod(Method method) {
+    AddMixin(method->mixin());
+    Add(">>");
+    Add(method->selector());
+  }
+
+ private:
+  static constexpr intptr_t kCapacity = 256;
+
+  char chars_[kCapacity];
+  intptr_t length_;
+};
+
+// Protocol buffer wire format, enough for profile.proto and Perfetto's
+// trace.proto.
+class ProtoBuffer {
+ public:
+  ProtoBuffer() : data_(nullptr), length_(0), capacity_(0) {}
+  ~ProtoBuffer() { delete[] data_; }
+
+  uint8_t* Take(intptr_t* length) {
+    uint8_t* result = data_;
+    *length = length_;
+    data_ = nullptr;
+    length_ = capacity_ = 0;
+    return result;
+  }
+
+  void AddVarint(uint64_t value) {
+    while (value >= 0x80) {
+      AddByte(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    AddByte(static_cast<uint8_t>(value));
+  }
+  void AddIntField(intptr_t field, int64_t value) {
+    AddVarint(field << 3 | kVarint);
+    AddVarint(static_cast<uint64_t>(value));
+  }
+  void AddFixed64Field(intptr_t field, uint64_t value) {
+    AddVarint(field << 3 | kFixed64);
+    for (intptr_t i = 0; i < 8; i++) {
+      AddByte(static_cast<uint8_t>(value >> (i * 8)));
+    }
+  }
+  void AddBytesField(intptr_t field, const uint8_t* bytes, intptr_t length) {
+    AddVarint(field << 3 | kLengthDelimited);
+    AddVarint(length);
+    for (intptr_t i = 0; i < length; i++) {
+      AddByte(bytes[i]);
+    }
+  }
+  void AddStringField(intptr_t field, const char* cstr) {
+    AddBytesField(field, reinterpret_cast<const uint8_t*>(cstr), strlen(cstr));
+  }
+  void AddMessageField(intptr_t field, const ProtoBuffer& message) {
+    AddBytesField(field, message.data_, message.length_);
+  }
+  // Fields already encoded in |fields|.
+  void Add(const ProtoBuffer& fields) {
+    for (intptr_t i = 0; i < fields.length_; i++) {
+      AddByte(fields.data_[i]);
+    }
+  }
+
+ private:
+  enum WireType { kVarint = 0, kFixed64 = 1, kLengthDelimited = 2 };
+
+  void AddByte(uint8_t value) {
+    if (length_ == capacity_) {
+      intptr_t new_capacity = capacity_ == 0 ? 64 : capacity_ * 2;
+      uint8_t* new_data = new uint8_t[new_capacity];
+      if (length_ != 0) {
+        memcpy(new_data, data_, length_);
+      }
+      delete[] data_;
+      data_ = new_data;
+      capacity_ = new_capacity;
+    }
+    data_[length_++] = value;
+  }
+
+  uint8_t* data_;
+  intptr_t length_;
+  intptr_t capacity_;
+};
+
+inline char* CopyCString(const char* cstr) {
+  intptr_t length = strlen(cstr);
+  char* result = new char[length + 1];
+  memcpy(result, cstr, length + 1);
+  return result;
+}
+
+#if defined(ARCH_IS_32_BIT)
+constexpr uword kFNVOffsetBasis = 2166136261u;
+constexpr uword kFNVPrime = 16777619;
+#elif defined(ARCH_IS_64_BIT)
+constexpr uword kFNVOffsetBasis = 14695981039346656037u;
+constexpr uword kFNVPrime = 1099511628211;
+#endif
+
+inline uword HashCString(uword hash, const char* cstr) {
+  for (; *cstr != 0; cstr++) {
+    hash = (hash ^ static_cast<uint8_t>(*cstr)) * kFNVPrime;
+  }
+  return hash;
+}
+
+
+}  // namespace psoup
+
+#endif  // VM_PPROF_H_
@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <math.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <time.h>
 
@@ -18,15 +19,29 @@
 #include <stringapiset.h>
 #endif
 
+#include "vm/allocation_profile.h"
 #include "vm/assert.h"
+#include "vm/async_files.h"
+#include "vm/compressed_snapshot.h"
+#include "vm/cpu_profile.h"
 #include "vm/double_conversion.h"
+#include "vm/execution_counts.h"
 #include "vm/heap.h"
+#include "vm/heap_dump.h"
 #include "vm/interpreter.h"
 #include "vm/isolate.h"
 #include "vm/math.h"
 #include "vm/message_loop.h"
 #include "vm/object.h"
 #include "vm/os.h"
+#include "vm/perf_counters.h"
+#include "vm/random.h"
+#include "vm/ring_channel.h"
+#include "vm/snapshot.h"
+#include "vm/sockets.h"
+#include "vm/trace_events.h"
+#include "vm/transport.h"
+#include "vm/utf8.h"
 
 #define nil I->nil_obj()
 
@@ -159,8 +174,8 @@ const bool kFailure = false;
   V(121, String_concat)                                                        \
   V(122, String_class_with)                                                    \
   V(123, String_class_withAll)                                                 \
-  /* V(124, String_?) */                                                       \
-  /* V(125, String_?) */                                                       \
+  V(124, Bytes_compare)                                                        \
+  V(125, String_intern)                                                        \
   V(126, Object_yourself)                                                      \
   V(127, Object_class)                                                         \
   V(128, Object_isCanonical)                                                   \
@@ -173,12 +188,12 @@ const bool kFailure = false;
   V(135, Object_identical)                                                     \
   V(136, Object_identityHash)                                                  \
   V(137, Object_heapSize)                                                      \
-  /* V(138, Object_?) */                                                       \
+  V(138, Object_referencesToAll)                                               \
   /* V(139, Object_?) */                                                       \
   V(140, Behavior_basicNew)                                                    \
   V(141, Behavior_allInstances)                                                \
   V(142, Behavior_adoptInstance)                                               \
-  /* V(143, Behavior_?) */                                                     \
+  V(143, Behavior_allInstancesOfAll)                                           \
   /* V(144, Behavior_?) */                                                     \
   V(145, Closure_class_new)                                                    \
   V(146, Closure_class_withNumCopied)                                          \
@@ -220,8 +235,8 @@ const bool kFailure = false;
   V(182, Interpreter_flushCache)                                               \
   V(183, Heap_becomeForward)                                                   \
   V(184, Heap_collectGarbage)                                                  \
-  /* V(185, Heap_allocationTable) */                                           \
-  /* V(186, Heap_summary) */                                                   \
+  V(185, Heap_allocationProfile)                                               \
+  V(186, Heap_gcEvents)                                                        \
   V(187, panic)                                                                \
   V(188, MessageLoop_finish)                                                   \
   V(189, MessageLoop_exit)                                                     \
@@ -234,12 +249,79 @@ const bool kFailure = false;
   /* V(196, killtree) */                                                       \
   /* V(197, sendoob) */                                                        \
   /* V(198, mailboxpeek) */                                                    \
+  V(199, Heap_writeDump)                                                       \
+  V(200, Interpreter_lookupCacheStatistics)                                    \
+  V(201, Interpreter_cpuProfile)                                               \
+  V(202, Interpreter_executionCounts)                                          \
+  V(203, Array_fillWith)                                                       \
+  V(204, Array_identityIndexOf)                                                \
+  V(205, Array_grow)                                                           \
+  V(206, ByteArray_fillWith)                                                   \
+  V(207, Array_formatNumbers)                                                  \
+  V(208, AsyncFile_open)                                                       \
+  V(209, AsyncFile_read)                                                       \
+  V(210, AsyncFile_write)                                                      \
+  V(211, AsyncFile_takeResult)                                                 \
+  V(212, AsyncFile_close)                                                      \
+  V(213, transfer)                                                             \
+  V(214, sendAll)                                                              \
+  V(215, sendToAll)                                                            \
+  V(216, Port_setCapacity)                                                     \
+  V(217, Port_statistics)                                                      \
+  V(218, Method_bytecode)                                                      \
+  V(219, postObject)                                                           \
+  V(220, Heap_perfCounters)                                                    \
+  V(221, Isolate_metrics)                                                      \
+  V(222, MessageLoop_scheduleTimer)                                            \
+  V(223, MessageLoop_cancelTimer)                                              \
+  V(224, MessageLoop_takeFiredTimers)                                          \
+  V(225, RingChannel_new)                                                      \
+  V(226, RingChannel_openConsumer)                                             \
+  V(227, RingChannel_id)                                                       \
+  V(228, RingChannel_reserve)                                                  \
+  V(229, RingChannel_commit)                                                   \
+  V(230, RingChannel_consume)                                                  \
+  V(231, RingChannel_await)                                                    \
+  V(232, RingChannel_close)                                                    \
+  V(233, Transport_listen)                                                     \
+  V(234, Transport_address)                                                    \
+  V(235, Transport_send)                                                       \
+  V(236, Coroutine_new)                                                        \
+  V(237, Coroutine_resume)                                                     \
+  V(238, Coroutine_yield)                                                      \
+  V(239, Coroutine_close)                                                      \
+  V(240, Socket_connect)                                                       \
+  V(241, Socket_listen)                                                        \
+  V(242, Socket_accept)                                                        \
+  V(243, Socket_read)                                                          \
+  V(244, Socket_write)                                                         \
+  V(245, Socket_pendingError)                                                  \
+  V(246, Socket_localPort)                                                     \
+  V(247, Socket_close)                                                         \
+  V(248, Array_scanForKey)                                                     \
+  V(249, Array_scanForIdentity)                                                \
+  V(250, Array_rehashInto)                                                     \
+  V(251, Bytes_formatNumberAt)                                                 \
+  V(252, Bytes_isValidUTF8)                                                    \
+  V(253, Bytes_codePointCount)                                                 \
+  V(254, Bytes_codePointIndex)                                                 \
+  V(255, Bytes_asUTF16)                                                        \
   V(256, Platform_numberOfProcessors)                                          \
   V(257, Platform_operatingSystem)                                             \
+  V(258, String_class_fromUTF16)                                               \
+  V(259, Bytes_scanJSON)                                                       \
+  V(260, Bytes_parseNumbers)                                                   \
+  V(261, Array_sortFromTo)                                                     \
+  V(262, Array_sortByKeys)                                                     \
+  V(263, Random_nextBytes)                                                     \
   V(264, Time_monotonicNanos)                                                  \
   V(265, Time_realtimeNanos)                                                   \
   V(266, Time_localtime)                                                       \
   V(267, Random_getEntropy)                                                    \
+  V(268, MappedFile_open)                                                      \
+  V(269, MappedFile_size)                                                      \
+  V(270, MappedFile_copyInto)                                                  \
+  V(271, MappedFile_close)                                                     \
   V(272, ZXStatus_getString)                                                   \
   V(273, ZXHandle_close)                                                       \
   V(274, ZXChannel_create)                                                     \
@@ -250,6 +332,9 @@ const bool kFailure = false;
   V(279, ZXVmo_setSize)                                                        \
   V(280, ZXVmo_read)                                                           \
   V(281, ZXVmo_write)                                                          \
+  V(282, Random_nextFloats)                                                    \
+  V(283, Random_nextIntegers)                                                  \
+  V(284, writeImage)                                                           \
   V(320, JS_pushValue)                                                         \
   V(321, JS_pushAlien)                                                         \
   V(322, JS_pushExpat)                                                         \
@@ -263,6 +348,7 @@ const bool kFailure = false;
   V(330, JS_performNew)                                                        \
   V(331, JS_performInstanceOf)                                                 \
   V(332, JS_performHas)                                                        \
+  V(508, compressSnapshot)                                                     \
   V(509, print)                                                                \
   V(510, readFileAsBytes)                                                      \
   V(511, writeBytesToFile)                                                     \
@@ -1243,8 +1329,12 @@ DEFINE_PRIMITIVE(Behavior_basicNew) {
   ASSERT(num_slots >= 0);
   ASSERT(num_slots < 255);
 
+  // The slots are only ever initialized to nil, so the instance may be old.
+  Heap::Allocator allocator =
+      H->ShouldPretenure(id->value()) ? Heap::kPretenure : Heap::kNormal;
   RegularObject new_instance = H->AllocateRegularObject(id->value(),
-                                                         num_slots);
+                                                         num_slots,
+                                                         allocator);
   for (intptr_t i = 0; i < num_slots; i++) {
     new_instance->set_slot(i, nil, kNoBarrier);
   }
@@ -1262,6 +1352,14 @@ DEFINE_PRIMITIVE(Object_instVarAt) {
   if ((index <= 0) || (index > object->Klass(H)->format()->value())) {
     return kFailure;
   }
+  if ((index == 3) && (object->Klass(H) == I->object_store()->Method())) {
+    // Mirrors see a method's bytecode, not its position in the snapshot.
+    Method method = static_cast<Method>(static_cast<Object>(object));
+    if (!method->HasBytecode()) {
+      I->LoadBytecode(method);  // SAFEPOINT
+      object = static_cast<RegularObject>(I->Stack(1));
+    }
+  }
   RETURN(object->slot(index - 1));
 }
 
@@ -1291,6 +1389,9 @@ DEFINE_PRIMITIVE(Array_class_new) {
   if (length < 0) {
     return kFailure;
   }
+  if (!H->HasRoomFor(length, sizeof(Object))) {  // SAFEPOINT
+    return kFailure;
+  }
   Array result = H->AllocateArray(length);  // SAFEPOINT
   for (intptr_t i = 0; i < length; i++) {
     result->set_element(i, nil, kNoBarrier);
@@ -1341,6 +1442,9 @@ DEFINE_PRIMITIVE(WeakArray_class_new) {
   if (length < 0) {
     return kFailure;
   }
+  if (!H->HasRoomFor(length, sizeof(Object))) {  // SAFEPOINT
+    return kFailure;
+  }
   WeakArray result = H->AllocateWeakArray(length);  // SAFEPOINT
   for (intptr_t i = 0; i < length; i++) {
     result->set_element(i, nil, kNoBarrier);
@@ -1391,6 +1495,9 @@ DEFINE_PRIMITIVE(ByteArray_class_new) {
   if (length < 0) {
     return kFailure;
   }
+  if (!H->HasRoomFor(length, sizeof(uint8_t))) {  // SAFEPOINT
+    return kFailure;
+  }
   ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
   memset(result->element_addr(0), 0, length);
   RETURN(result);
@@ -1606,6 +1713,19 @@ DEFINE_PRIMITIVE(ByteArray_replaceFromToWithStartingAt) {
 }
 
 
+DEFINE_PRIMITIVE(ByteArray_fillWith) {
+  ASSERT(num_args == 1);
+  ByteArray array = static_cast<ByteArray>(I->Stack(1));
+  ASSERT(array->IsByteArray());
+  SMI_ARGUMENT(value, 0);
+  if ((value < 0) || (value > 255)) {
+    return kFailure;
+  }
+  memset(array->element_addr(0), value, array->Size());
+  RETURN_SELF();
+}
+
+
 DEFINE_PRIMITIVE(Array_replaceFromToWithStartingAt) {
   ASSERT(num_args == 4);
   Array receiver = static_cast<Array>(I->Stack(4));
@@ -1641,18 +1761,7 @@ DEFINE_PRIMITIVE(Array_replaceFromToWithStartingAt) {
   }
 
   // Note replacement may be receiver.
-  if (replacementStart < start) {
-    for (intptr_t i = count - 1; i >= 0; i--) {
-      receiver->set_element(start - 1 + i,
-                            replacement->element(replacementStart - 1 + i));
-    }
-  } else {
-    for (intptr_t i = 0; i < count; i++) {
-      receiver->set_element(start - 1 + i,
-                            replacement->element(replacementStart - 1 + i));
-    }
-  }
-
+  receiver->CopyElements(start - 1, replacement, replacementStart - 1, count);
   RETURN_SELF();
 }
 
@@ -1677,9 +1786,50 @@ DEFINE_PRIMITIVE(Array_copyFromTo) {
 
   Array result = H->AllocateArray(subsize);  // SAFEPOINT
   array = static_cast<Array>(I->Stack(2));
-  for (intptr_t i = 0; i < subsize; i++) {
-    result->set_element(i, array->element(i + start - 1));
+  result->CopyElements(0, array, start - 1, subsize);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Array_fillWith) {
+  ASSERT(num_args == 1);
+  Array array = static_cast<Array>(I->Stack(1));
+  ASSERT(array->IsArray());
+  array->FillElements(0, array->Size(), I->Stack(0));
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(Array_identityIndexOf) {
+  ASSERT(num_args == 1);
+  Array array = static_cast<Array>(I->Stack(1));
+  ASSERT(array->IsArray());
+  Object element = I->Stack(0);
+  intptr_t size = array->Size();
+  for (intptr_t i = 0; i < size; i++) {
+    if (array->element(i) == element) {
+      RETURN_SMI(i + 1);
+    }
+  }
+  RETURN_SMI(0);
+}
+
+
+DEFINE_PRIMITIVE(Array_grow) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(new_size, 0);
+  if (new_size < 0) {
+    return kFailure;
+  }
+  if (!H->HasRoomFor(new_size, sizeof(Object))) {  // SAFEPOINT
+    return kFailure;
   }
+  Array result = H->AllocateArray(new_size);  // SAFEPOINT
+  Array array = static_cast<Array>(I->Stack(1));
+  ASSERT(array->IsArray());
+  intptr_t overlap = array->Size() < new_size ? array->Size() : new_size;
+  result->CopyElements(0, array, 0, overlap);
+  result->FillElements(overlap, new_size - overlap, nil);
   RETURN(result);
 }
 
@@ -1714,6 +1864,57 @@ DEFINE_PRIMITIVE(String_hash) {
 }
 
 
+// Probes the kernel's symbol table, an open-addressed WeakArray whose empty
+// slots hold the table itself and whose slots mourned by the GC hold nil. Finds
+// an existing symbol, or reuses a mourned slot for a new one. Fails when a new
+// symbol needs an empty slot, so the kernel can count it and grow the table.
+DEFINE_PRIMITIVE(String_intern) {
+  ASSERT(num_args == 2);
+  String string = static_cast<String>(I->Stack(1));
+  WeakArray table = static_cast<WeakArray>(I->Stack(0));
+  if (!string->IsString() || !table->IsWeakArray()) {
+    return kFailure;
+  }
+  intptr_t capacity = table->Size();
+  if (capacity == 0) {
+    return kFailure;
+  }
+  intptr_t hash = string->EnsureHash(I->isolate())->value();
+  intptr_t length = string->Size();
+  intptr_t index = hash % capacity;
+  intptr_t reuse_index = -1;
+  for (intptr_t probes = 0; probes < capacity; probes++) {
+    Object element = table->element(index);
+    if (element == table) {
+      break;
+    }
+    if (element == nil) {
+      if (reuse_index == -1) {
+        reuse_index = index;
+      }
+    } else if (element->IsString()) {
+      String symbol = static_cast<String>(element);
+      if (((symbol->hash() == hash) || (symbol->hash() == 0)) &&
+          (symbol->Size() == length) &&
+          (memcmp(symbol->element_addr(0), string->element_addr(0),
+                  length) == 0)) {
+        RETURN(symbol);
+      }
+    }
+    index++;
+    if (index == capacity) {
+      index = 0;
+    }
+  }
+  if (reuse_index == -1) {
+    return kFailure;
+  }
+  string->set_is_canonical(true);
+  table->set_element(reuse_index, string);
+  RETURN(string);
+}
+
+
 DEFINE_PRIMITIVE(Activation_sender) {
   ASSERT(num_args == 0);
   Activation activation = static_cast<Activation>(I->Stack(0));
@@ -1875,10 +2076,23 @@ DEFINE_PRIMITIVE(Activation_class_new) {
   result->set_closure(static_cast<Closure>(nil), kNoBarrier);
   result->set_receiver(nil, kNoBarrier);
   result->set_stack_depth(SmallInteger::New(0));
+  result->set_temps(static_cast<Array>(nil), kNoBarrier);
   RETURN(result);
 }
 
 
+DEFINE_PRIMITIVE(Method_bytecode) {
+  ASSERT(num_args == 0);
+  Method method = static_cast<Method>(I->Stack(0));
+  ASSERT(method->IsRegularObject());
+  if (!method->HasBytecode()) {
+    I->LoadBytecode(method);  // SAFEPOINT
+    method = static_cast<Method>(I->Stack(0));
+  }
+  RETURN(method->bytecode());
+}
+
+
 DEFINE_PRIMITIVE(Closure_class_new) {
   ASSERT(num_args == 4);
   Activation defining_activation = static_cast<Activation>(I->Stack(3));
@@ -2080,9 +2294,7 @@ DEFINE_PRIMITIVE(Object_identical) {
 }
 
 
-DEFINE_PRIMITIVE(Object_identityHash) {
-  ASSERT(num_args == 0 || num_args == 1);
-  Object receiver = I->Stack(0);
+static intptr_t IdentityHashOf(Object receiver, Heap* H, Interpreter* I) {
   intptr_t hash;
   if (receiver->IsSmallInteger()) {
     hash = static_cast<SmallInteger>(receiver)->value();
@@ -2096,19 +2308,467 @@ DEFINE_PRIMITIVE(Object_identityHash) {
       hash = 1;
     }
   } else if (receiver->IsString()) {
-    static_cast<String>(receiver)->EnsureHash(I->isolate());
-    hash = static_cast<String>(receiver)->header_hash();
+    hash = static_cast<String>(receiver)->EnsureHash(I->isolate())->value();
   } else {
-    hash = static_cast<HeapObject>(receiver)->header_hash();
+    hash = H->IdentityHash(static_cast<HeapObject>(receiver));
     if (hash == 0) {
       hash = I->isolate()->random().NextUInt64() & SmallInteger::kMaxValue;
       if (hash == 0) {
         hash = 1;
       }
-      static_cast<HeapObject>(receiver)->set_header_hash(hash);
+      H->SetIdentityHash(static_cast<HeapObject>(receiver), hash);
+    }
+  }
+  return hash;
+}
+
+
+DEFINE_PRIMITIVE(Object_identityHash) {
+  ASSERT(num_args == 0 || num_args == 1);
+  RETURN_SMI(IdentityHashOf(I->Stack(0), H, I));
+}
+
+
+// The hash tables of Collections and the kernel's IdentityMap are flat Arrays
+// of |stride| slots per entry, a key followed by its values. An empty entry's
+// key is the Array itself. A key with hash h starts probing at the entry
+// h \\ (size / stride) and moves to the next entry, wrapping around.
+
+// Answers the hash of |key| for tables compared by #=, if the VM knows what
+// #hash and #= answer for it without a send.
+static bool KeyHashOf(Object key, Interpreter* I, intptr_t* hash) {
+  if (key->IsSmallInteger()) {
+    *hash = static_cast<SmallInteger>(key)->value();  // Integer>>hash
+    return true;
+  }
+  if (key->IsString()) {
+    *hash = static_cast<String>(key)->EnsureHash(I->isolate())->value();
+    return true;
+  }
+  return false;
+}
+
+static bool CheckTable(Array table, SmallInteger stride) {
+  if (!table->IsArray() || !stride->IsSmallInteger()) {
+    return false;
+  }
+  intptr_t s = stride->value();
+  return (s > 0) && (table->Size() > 0) && ((table->Size() % s) == 0);
+}
+
+static intptr_t ProbeStart(intptr_t hash, intptr_t size, intptr_t stride) {
+  intptr_t entries = size / stride;
+  intptr_t entry = hash % entries;
+  if (entry < 0) {
+    entry += entries;
+  }
+  return entry * stride;
+}
+
+// Answers the 1-based index of the key #= to |key| or of the empty entry
+// where it would go. Fails for keys whose #= or #hash would need a send, when
+// an element's answer to #= would, or when the table is full.
+DEFINE_PRIMITIVE(Array_scanForKey) {
+  ASSERT(num_args == 3);
+  Object key = I->Stack(2);
+  Array table = static_cast<Array>(I->Stack(1));
+  SmallInteger stride = static_cast<SmallInteger>(I->Stack(0));
+  if (!CheckTable(table, stride)) {
+    return kFailure;
+  }
+  intptr_t hash = 0;
+  if (!KeyHashOf(key, I, &hash)) {
+    return kFailure;
+  }
+  intptr_t size = table->Size();
+  intptr_t step = stride->value();
+  intptr_t start = ProbeStart(hash, size, step);
+  intptr_t index = start;
+  if (key->IsSmallInteger()) {
+    do {
+      Object element = table->element(index);
+      if ((element == table) || (element == key)) {
+        RETURN_SMI(index + 1);
+      }
+      if (element->IsFloat()) {
+        return kFailure;  // Might be equal.
+      }
+      index += step;
+      if (index == size) {
+        index = 0;
+      }
+    } while (index != start);
+  } else {
+    String string = static_cast<String>(key);
+    intptr_t length = string->Size();
+    do {
+      Object element = table->element(index);
+      if ((element == table) || (element == key)) {
+        RETURN_SMI(index + 1);
+      }
+      if (element->IsString()) {
+        String other = static_cast<String>(element);
+        if ((other->Size() == length) &&
+            ((other->hash() == 0) || (other->hash() == hash)) &&
+            (memcmp(other->element_addr(0), string->element_addr(0),
+                    length) == 0)) {
+          RETURN_SMI(index + 1);
+        }
+      }
+      index += step;
+      if (index == size) {
+        index = 0;
+      }
+    } while (index != start);
+  }
+  return kFailure;
+}
+
+
+// Answers the 1-based index of |key| or of the empty entry where it would go,
+// hashing by Object>>identityHash. Fails when the table is full.
+DEFINE_PRIMITIVE(Array_scanForIdentity) {
+  ASSERT(num_args == 3);
+  Object key = I->Stack(2);
+  Array table = static_cast<Array>(I->Stack(1));
+  SmallInteger stride = static_cast<SmallInteger>(I->Stack(0));
+  if (!CheckTable(table, stride)) {
+    return kFailure;
+  }
+  intptr_t size = table->Size();
+  intptr_t step = stride->value();
+  intptr_t start = ProbeStart(IdentityHashOf(key, H, I), size, step);
+  intptr_t index = start;
+  do {
+    Object element = table->element(index);
+    if ((element == table) || (element == key)) {
+      RETURN_SMI(index + 1);
+    }
+    index += step;
+    if (index == size) {
+      index = 0;
+    }
+  } while (index != start);
+  return kFailure;
+}
+
+
+// Moves the entries of |old_table| into the empty |new_table|. Fails without
+// moving any if some key's hash would need a send or they do not fit.
+DEFINE_PRIMITIVE(Array_rehashInto) {
+  ASSERT(num_args == 4);
+  Array old_table = static_cast<Array>(I->Stack(3));
+  Array new_table = static_cast<Array>(I->Stack(2));
+  SmallInteger stride = static_cast<SmallInteger>(I->Stack(1));
+  Object by_identity = I->Stack(0);
+  if (!CheckTable(old_table, stride) || !CheckTable(new_table, stride)) {
+    return kFailure;
+  }
+  if ((by_identity != I->true_obj()) && (by_identity != I->false_obj())) {
+    return kFailure;
+  }
+  intptr_t step = stride->value();
+  intptr_t old_size = old_table->Size();
+  intptr_t new_size = new_table->Size();
+  intptr_t live = 0;
+  for (intptr_t i = 0; i < old_size; i += step) {
+    Object key = old_table->element(i);
+    if (key == old_table) {
+      continue;
+    }
+    live++;
+    intptr_t hash = 0;
+    if ((by_identity == I->false_obj()) && !KeyHashOf(key, I, &hash)) {
+      return kFailure;
+    }
+  }
+  for (intptr_t i = 0; i < new_size; i += step) {
+    if (new_table->element(i) != new_table) {
+      return kFailure;
+    }
+  }
+  if (live > (new_size / step)) {
+    return kFailure;
+  }
+
+  for (intptr_t i = 0; i < old_size; i += step) {
+    Object key = old_table->element(i);
+    if (key == old_table) {
+      continue;
+    }
+    intptr_t hash = 0;
+    if (by_identity == I->true_obj()) {
+      hash = IdentityHashOf(key, H, I);
+    } else {
+      KeyHashOf(key, I, &hash);
+    }
+    intptr_t index = ProbeStart(hash, new_size, step);
+    while (new_table->element(index) != new_table) {
+      index += step;
+      if (index == new_size) {
+        index = 0;
+      }
+    }
+    for (intptr_t j = 0; j < step; j++) {
+      new_table->set_element(index + j, old_table->element(i + j));
+    }
+  }
+  RETURN(new_table);
+}
+
+
+// Sorting without calling back into Newspeak. Numbers are radix sorted on a
+// key whose unsigned order is their order, and Strings are merge sorted
+// comparing their bytes as String>>compare: does. Both are stable, as the
+// Newspeak merge sort is, so the fallback gives the same answer.
+struct NumberSortEntry {
+  uint64_t key;
+  intptr_t index;
+};
+
+struct StringSortEntry {
+  const uint8_t* bytes;
+  intptr_t length;
+  intptr_t index;
+};
+
+static constexpr intptr_t kInsertionSortThreshold = 16;
+static const uint64_t kSortKeySignBit = static_cast<uint64_t>(1) << 63;
+
+static inline uint64_t SmallIntegerSortKey(SmallInteger element) {
+  return static_cast<uint64_t>(static_cast<int64_t>(element->value())) ^
+      kSortKeySignBit;
+}
+
+// Fails on NaN, which is unordered.
+static inline bool FloatSortKey(Float element, uint64_t* key) {
+  double value = element->value();
+  if (isnan(value)) {
+    return false;
+  }
+  if (value == 0.0) {
+    value = 0.0;  // -0.0 = 0.0, so they must keep their order.
+  }
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  *key = (bits & kSortKeySignBit) != 0 ? ~bits : (bits | kSortKeySignBit);
+  return true;
+}
+
+static void RadixSort(NumberSortEntry* entries, NumberSortEntry* scratch,
+                      intptr_t count) {
+  if (count <= kInsertionSortThreshold) {
+    for (intptr_t i = 1; i < count; i++) {
+      NumberSortEntry entry = entries[i];
+      intptr_t j = i;
+      while ((j > 0) && (entries[j - 1].key > entry.key)) {
+        entries[j] = entries[j - 1];
+        j--;
+      }
+      entries[j] = entry;
+    }
+    return;
+  }
+
+  intptr_t counts[8][256];
+  memset(counts, 0, sizeof(counts));
+  for (intptr_t i = 0; i < count; i++) {
+    uint64_t key = entries[i].key;
+    for (intptr_t digit = 0; digit < 8; digit++) {
+      counts[digit][(key >> (8 * digit)) & 0xFF]++;
+    }
+  }
+  NumberSortEntry* source = entries;
+  NumberSortEntry* destination = scratch;
+  for (intptr_t digit = 0; digit < 8; digit++) {
+    intptr_t shift = 8 * digit;
+    // Skip digits that are the same in every key, such as the high bytes of
+    // small integers.
+    if (counts[digit][(source[0].key >> shift) & 0xFF] == count) {
+      continue;
+    }
+    intptr_t offsets[256];
+    intptr_t offset = 0;
+    for (intptr_t bucket = 0; bucket < 256; bucket++) {
+      offsets[bucket] = offset;
+      offset += counts[digit][bucket];
+    }
+    for (intptr_t i = 0; i < count; i++) {
+      destination[offsets[(source[i].key >> shift) & 0xFF]++] = source[i];
+    }
+    NumberSortEntry* swap = source;
+    source = destination;
+    destination = swap;
+  }
+  if (source != entries) {
+    memcpy(entries, source, count * sizeof(NumberSortEntry));
+  }
+}
+
+static inline bool StringLessOrEqual(const StringSortEntry& left,
+                                     const StringSortEntry& right) {
+  intptr_t length = left.length < right.length ? left.length : right.length;
+  int comparison = memcmp(left.bytes, right.bytes, length);
+  if (comparison != 0) {
+    return comparison < 0;
+  }
+  return left.length <= right.length;
+}
+
+static void MergeSort(StringSortEntry* entries, StringSortEntry* scratch,
+                      intptr_t count) {
+  if (count <= kInsertionSortThreshold) {
+    for (intptr_t i = 1; i < count; i++) {
+      StringSortEntry entry = entries[i];
+      intptr_t j = i;
+      while ((j > 0) && !StringLessOrEqual(entries[j - 1], entry)) {
+        entries[j] = entries[j - 1];
+        j--;
+      }
+      entries[j] = entry;
+    }
+    return;
+  }
+
+  intptr_t mid = count / 2;
+  MergeSort(entries, scratch, mid);
+  MergeSort(&entries[mid], scratch, count - mid);
+  if (StringLessOrEqual(entries[mid - 1], entries[mid])) {
+    return;  // Already in order.
+  }
+  memcpy(scratch, entries, mid * sizeof(StringSortEntry));
+  intptr_t left = 0;
+  intptr_t right = mid;
+  intptr_t cursor = 0;
+  while ((left < mid) && (right < count)) {
+    if (StringLessOrEqual(scratch[left], entries[right])) {
+      entries[cursor++] = scratch[left++];
+    } else {
+      entries[cursor++] = entries[right++];
+    }
+  }
+  while (left < mid) {
+    entries[cursor++] = scratch[left++];
+  }
+}
+
+// Fills |order| with the indices of the |count| keys from |start| in
+// ascending order, keeping equal keys in their order, without moving them.
+// Fails unless the keys are all SmallIntegers, all Floats other than NaN or
+// all Strings.
+static bool SortOrder(Array keys, intptr_t start, intptr_t count,
+                      intptr_t* order) {
+  ASSERT(count > 0);
+  Object first = keys->element(start);
+  if (first->IsSmallInteger() || first->IsFloat()) {
+    NumberSortEntry* entries = reinterpret_cast<NumberSortEntry*>(
+        malloc(2 * count * sizeof(NumberSortEntry)));
+    for (intptr_t i = 0; i < count; i++) {
+      Object key = keys->element(start + i);
+      entries[i].index = i;
+      if (first->IsSmallInteger() && key->IsSmallInteger()) {
+        entries[i].key = SmallIntegerSortKey(static_cast<SmallInteger>(key));
+      } else if (!first->IsFloat() || !key->IsFloat() ||
+                 !FloatSortKey(static_cast<Float>(key), &entries[i].key)) {
+        free(entries);
+        return false;
+      }
+    }
+    RadixSort(entries, &entries[count], count);
+    for (intptr_t i = 0; i < count; i++) {
+      order[i] = entries[i].index;
+    }
+    free(entries);
+    return true;
+  }
+
+  if (first->IsString()) {
+    StringSortEntry* entries = reinterpret_cast<StringSortEntry*>(
+        malloc(2 * count * sizeof(StringSortEntry)));
+    for (intptr_t i = 0; i < count; i++) {
+      String key = static_cast<String>(keys->element(start + i));
+      if (!key->IsString()) {
+        free(entries);
+        return false;
+      }
+      entries[i].bytes = key->element_addr(0);
+      entries[i].length = key->Size();
+      entries[i].index = i;
+    }
+    MergeSort(entries, &entries[count], count);
+    for (intptr_t i = 0; i < count; i++) {
+      order[i] = entries[i].index;
     }
+    free(entries);
+    return true;
+  }
+
+  return false;
+}
+
+
+DEFINE_PRIMITIVE(Array_sortFromTo) {
+  ASSERT(num_args == 2);
+  Array array = static_cast<Array>(I->Stack(2));
+  ASSERT(array->IsArray());
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  if ((start < 1) || (stop > array->Size()) || (start > stop + 1)) {
+    return kFailure;
+  }
+  intptr_t count = stop - start + 1;
+  if (count == 0) {
+    RETURN_SELF();
+  }
+
+  intptr_t* order = reinterpret_cast<intptr_t*>(
+      malloc(count * sizeof(intptr_t)));
+  if (!SortOrder(array, start - 1, count, order)) {
+    free(order);
+    return kFailure;
+  }
+  Object* sorted = reinterpret_cast<Object*>(malloc(count * sizeof(Object)));
+  for (intptr_t i = 0; i < count; i++) {
+    sorted[i] = array->element(start - 1 + order[i]);
+  }
+  array->CopyElements(start - 1, sorted, count);
+  free(sorted);
+  free(order);
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(Array_sortByKeys) {
+  ASSERT(num_args == 1);
+  Array array = static_cast<Array>(I->Stack(1));
+  ASSERT(array->IsArray());
+  Array keys = static_cast<Array>(I->Stack(0));
+  if (!keys->IsArray() || (keys->Size() != array->Size())) {
+    return kFailure;
+  }
+  intptr_t count = array->Size();
+  if (count == 0) {
+    RETURN_SELF();
   }
-  RETURN_SMI(hash);
+
+  intptr_t* order = reinterpret_cast<intptr_t*>(
+      malloc(count * sizeof(intptr_t)));
+  if (!SortOrder(keys, 0, count, order)) {
+    free(order);
+    return kFailure;
+  }
+  // Both are gathered before either is stored, in case keys is the receiver.
+  Object* sorted = reinterpret_cast<Object*>(
+      malloc(2 * count * sizeof(Object)));
+  for (intptr_t i = 0; i < count; i++) {
+    sorted[i] = array->element(order[i]);
+    sorted[count + i] = keys->element(order[i]);
+  }
+  array->CopyElements(0, sorted, count);
+  keys->CopyElements(0, &sorted[count], count);
+  free(sorted);
+  free(order);
+  RETURN_SELF();
 }
 
 
@@ -2230,6 +2890,26 @@ DEFINE_PRIMITIVE(Object_referencesTo) {
   RETURN(result);
 }
 
+DEFINE_PRIMITIVE(Behavior_allInstancesOfAll) {
+  ASSERT(num_args == 1);
+  Array classes = static_cast<Array>(I->Stack(0));
+  if (!classes->IsArray()) {
+    return kFailure;
+  }
+  Array result = H->InstancesOfAll(classes);
+  RETURN(result);
+}
+
+DEFINE_PRIMITIVE(Object_referencesToAll) {
+  ASSERT(num_args == 1);
+  Array targets = static_cast<Array>(I->Stack(0));
+  if (!targets->IsArray()) {
+    return kFailure;
+  }
+  Array result = H->ReferencesToAll(targets);
+  RETURN(result);
+}
+
 DEFINE_PRIMITIVE(Object_heapSize) {
   ASSERT(num_args == 1);
   Object target = I->Stack(0);
@@ -2340,16 +3020,295 @@ DEFINE_PRIMITIVE(Random_getEntropy) {
 }
 
 
-DEFINE_PRIMITIVE(print) {
-  ASSERT(num_args == 1);
-  ASSERT(I->StackDepth() >= 2);
+// A Newspeak Random keeps state0 and state1 of its xorshift128+ in a 16-byte
+// ByteArray, so these draw the same values as its fallbacks. They spare the
+// fallbacks' LargeInteger arithmetic and a send for each value.
+static bool LoadRandomState(Object state, Random* random) {
+  ByteArray bytes = static_cast<ByteArray>(state);
+  if (!bytes->IsByteArray() || (bytes->Size() != 2 * sizeof(uint64_t))) {
+    return false;
+  }
+  uint64_t words[2];
+  memcpy(words, bytes->element_addr(0), sizeof(words));
+  *random = Random(words[0], words[1]);
+  return true;
+}
 
-  Object message = I->Stack(0);
-  if (message->IsString()) {
-    String string = static_cast<String>(message);
-    const char* cstr =
-        reinterpret_cast<const char*>(string->element_addr(0));
-    OS::Print("%.*s\n", static_cast<int>(string->Size()), cstr);
+static void StoreRandomState(ByteArray bytes, const Random& random) {
+  uint64_t words[2] = { random.state0(), random.state1() };
+  memcpy(bytes->element_addr(0), words, sizeof(words));
+}
+
+
+DEFINE_PRIMITIVE(Random_nextBytes) {
+  ASSERT(num_args == 2);
+  ByteArray bytes = static_cast<ByteArray>(I->Stack(1));
+  Random random(0);
+  if (!bytes->IsByteArray() || !LoadRandomState(I->Stack(0), &random)) {
+    return kFailure;
+  }
+  uint8_t* cursor = bytes->element_addr(0);
+  intptr_t remaining = bytes->Size();
+  while (remaining > 0) {
+    uint64_t value = random.NextUInt64();
+    intptr_t length = remaining < 8 ? remaining : 8;
+    for (intptr_t i = 0; i < length; i++) {
+      cursor[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+    cursor += length;
+    remaining -= length;
+  }
+  StoreRandomState(static_cast<ByteArray>(I->Stack(0)), random);
+  RETURN(bytes);
+}
+
+
+DEFINE_PRIMITIVE(Random_nextFloats) {
+  ASSERT(num_args == 2);
+  Array array = static_cast<Array>(I->Stack(1));
+  Random random(0);
+  if (!array->IsArray() || !LoadRandomState(I->Stack(0), &random)) {
+    return kFailure;
+  }
+  intptr_t count = array->Size();
+  double* values = reinterpret_cast<double*>(malloc(count * sizeof(double)));
+  for (intptr_t i = 0; i < count; i++) {
+    // The top 53 bits, which a double holds exactly, scaled into [0, 1).
+    values[i] = static_cast<double>(random.NextUInt64() >> 11) *
+        (1.0 / 9007199254740992.0);
+  }
+  StoreRandomState(static_cast<ByteArray>(I->Stack(0)), random);
+
+  HandleScope h1(H, reinterpret_cast<Object*>(&array));
+  for (intptr_t i = 0; i < count; i++) {
+    Float value = H->AllocateFloat();  // SAFEPOINT
+    value->set_value(values[i]);
+    array->set_element(i, value);
+  }
+  free(values);
+  RETURN(array);
+}
+
+
+DEFINE_PRIMITIVE(Random_nextIntegers) {
+  ASSERT(num_args == 3);
+  Array array = static_cast<Array>(I->Stack(2));
+  SMI_ARGUMENT(max, 1);
+  Random random(0);
+  if (!array->IsArray() || !LoadRandomState(I->Stack(0), &random)) {
+    return kFailure;
+  }
+  const uint64_t kRange = 0xFFFFFFFF;
+  if ((max <= 0) || (static_cast<uint64_t>(max) >= kRange)) {
+    return kFailure;
+  }
+  // Rejects the values that would bias the modulus, as nextInteger: does.
+  uint64_t limit = kRange - (kRange % max);
+  intptr_t count = array->Size();
+  for (intptr_t i = 0; i < count; i++) {
+    uint64_t value;
+    do {
+      value = random.NextUInt64() & kRange;
+    } while (value >= limit);
+    array->set_element(i, SmallInteger::New(value % max), kNoBarrier);
+  }
+  StoreRandomState(static_cast<ByteArray>(I->Stack(0)), random);
+  RETURN(array);
+}
+
+
+DEFINE_PRIMITIVE(MappedFile_open) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  String filename = static_cast<String>(I->Stack(0));
+  if (!filename->IsString()) {
+    return kFailure;
+  }
+  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
+  memcpy(raw_filename, filename->element_addr(0), filename->Size());
+  raw_filename[filename->Size()] = 0;
+  intptr_t handle = I->isolate()->mapped_files()->Map(raw_filename);
+  free(raw_filename);
+  if (handle < 0) {
+    return kFailure;
+  }
+  RETURN_SMI(handle);
+#endif
+}
+
+
+DEFINE_PRIMITIVE(MappedFile_size) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(handle, 0);
+  const VirtualMemory* memory = I->isolate()->mapped_files()->Lookup(handle);
+  if (memory == nullptr) {
+    return kFailure;
+  }
+  int64_t size = memory->size();
+  RETURN_MINT(size);
+}
+
+
+// Copies count bytes from the file at position into the buffer at start, both
+// counting from 1.
+DEFINE_PRIMITIVE(MappedFile_copyInto) {
+  ASSERT(num_args == 5);
+  SMI_ARGUMENT(handle, 4);
+  MINT_ARGUMENT(position, 3);
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(count, 0);
+  const VirtualMemory* memory = I->isolate()->mapped_files()->Lookup(handle);
+  if ((memory == nullptr) || !buffer->IsByteArray()) {
+    return kFailure;
+  }
+  int64_t file_size = memory->size();
+  if ((count < 0) ||
+      (position < 1) || (position - 1 > file_size - count) ||
+      (start < 1) || (start - 1 > buffer->Size() - count)) {
+    return kFailure;
+  }
+  if (count > 0) {  // An empty file has no mapping.
+    memcpy(buffer->element_addr(start - 1),
+           reinterpret_cast<const uint8_t*>(memory->base()) + (position - 1),
+           count);
+  }
+  RETURN_SELF();
+}
+
+
+// Answers a file descriptor, or the errno value negated.
+DEFINE_PRIMITIVE(AsyncFile_open) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 2);
+  String filename = static_cast<String>(I->Stack(1));
+  if (!filename->IsString()) {
+    return kFailure;
+  }
+  Object for_writing = I->Stack(0);
+  if ((for_writing != I->true_obj()) && (for_writing != I->false_obj())) {
+    return kFailure;
+  }
+  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
+  memcpy(raw_filename, filename->element_addr(0), filename->Size());
+  raw_filename[filename->Size()] = 0;
+  intptr_t fd = for_writing == I->true_obj()
+      ? AsyncFiles::OpenForWriting(raw_filename)
+      : AsyncFiles::OpenForReading(raw_filename);
+  intptr_t error = errno;
+  free(raw_filename);
+  RETURN_SMI(fd < 0 ? -error : fd);
+#endif
+}
+
+
+// Positions in the file count from 1. Answers the id of the operation, whose
+// completion is signalled for it.
+DEFINE_PRIMITIVE(AsyncFile_read) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 3);
+  SMI_ARGUMENT(fd, 2);
+  MINT_ARGUMENT(position, 1);
+  SMI_ARGUMENT(count, 0);
+  if ((fd < 0) || (position < 1) || (count < 0)) {
+    return kFailure;
+  }
+  intptr_t id =
+      I->isolate()->async_files()->StartRead(fd, position - 1, count);
+  if (id == 0) {
+    return kFailure;
+  }
+  RETURN_SMI(id);
+#endif
+}
+
+
+// Copies the bytes from start to stop of the buffer before answering, so the
+// buffer may be reused at once.
+DEFINE_PRIMITIVE(AsyncFile_write) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 5);
+  SMI_ARGUMENT(fd, 4);
+  MINT_ARGUMENT(position, 3);
+  Bytes buffer = static_cast<Bytes>(I->Stack(2));
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  if ((fd < 0) || (position < 1) || !buffer->IsBytes() ||
+      (start < 1) || (stop < start - 1) || (stop > buffer->Size())) {
+    return kFailure;
+  }
+  intptr_t length = stop - start + 1;
+  uint8_t* data = reinterpret_cast<uint8_t*>(malloc(length + 1));
+  if (data == nullptr) {
+    return kFailure;
+  }
+  memcpy(data, buffer->element_addr(start - 1), length);
+  intptr_t id =
+      I->isolate()->async_files()->StartWrite(fd, position - 1, data, length);
+  RETURN_SMI(id);
+#endif
+}
+
+
+DEFINE_PRIMITIVE(AsyncFile_takeResult) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(id, 0);
+  intptr_t length;
+  uint8_t* data = I->isolate()->async_files()->TakeResult(id, &length);
+  if (data == nullptr) {
+    return kFailure;
+  }
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), data, length);
+  free(data);
+  RETURN(result);
+}
+
+
+// Answers 0 or an errno value.
+DEFINE_PRIMITIVE(AsyncFile_close) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(fd, 0);
+  if (fd < 0) {
+    return kFailure;
+  }
+  intptr_t status = AsyncFiles::Close(fd) == 0 ? 0 : errno;
+  RETURN_SMI(status);
+#endif
+}
+
+
+DEFINE_PRIMITIVE(MappedFile_close) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(handle, 0);
+  if (!I->isolate()->mapped_files()->Unmap(handle)) {
+    return kFailure;
+  }
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(print) {
+  ASSERT(num_args == 1);
+  ASSERT(I->StackDepth() >= 2);
+
+  Object message = I->Stack(0);
+  if (message->IsString()) {
+    String string = static_cast<String>(message);
+    const char* cstr =
+        reinterpret_cast<const char*>(string->element_addr(0));
+    OS::Print("%.*s\n", static_cast<int>(string->Size()), cstr);
   } else {
     char* cstr = message->ToCString(H);
     OS::Print("[print] %s\n", cstr);
@@ -2382,6 +3341,167 @@ DEFINE_PRIMITIVE(Heap_collectGarbage) {
 }
 
 
+DEFINE_PRIMITIVE(Heap_gcEvents) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(since, 0);
+  if (since < 0) {
+    return kFailure;
+  }
+  // Copied out first: allocating the result may add an event.
+  GCEvent* events = new GCEvent[Heap::kGCEventCapacity];
+  intptr_t length = H->CopyGCEvents(since, events) * sizeof(GCEvent);
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), events, length);
+  delete[] events;
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Heap_allocationProfile) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(interval, 0);
+  if ((interval < 0) || (interval > (1 << 30))) {
+    return kFailure;
+  }
+  AllocationProfile* profile = nullptr;
+  if (interval != 0) {
+    profile = new AllocationProfile(interval,
+                                    I->isolate()->random().NextUInt64());
+  }
+  profile = H->SetAllocationProfile(profile);
+  if (profile == nullptr) {
+    RETURN(I->nil_obj());
+  }
+  intptr_t length;
+  uint8_t* bytes = profile->Encode(&length);
+  delete profile;
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), bytes, length);
+  delete[] bytes;
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Heap_writeDump) {
+  ASSERT(num_args == 1);
+  String filename = static_cast<String>(I->Stack(0));
+  if (!filename->IsString()) {
+    return kFailure;
+  }
+
+  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
+  memcpy(raw_filename, filename->element_addr(0), filename->Size());
+  raw_filename[filename->Size()] = 0;
+  bool written = HeapDump::Write(H, raw_filename);
+  free(raw_filename);
+  if (!written) {
+    return kFailure;
+  }
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(Interpreter_lookupCacheStatistics) {
+  ASSERT(num_args == 0);
+  LookupCache::Statistics stats = I->lookup_cache_statistics();
+  intptr_t length = sizeof(stats);
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), &stats, length);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Interpreter_cpuProfile) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(period, 0);  // Microseconds.
+  if ((period < 0) || (period > (1 << 30))) {
+    return kFailure;
+  }
+  CpuProfile* profile = nullptr;
+  if (period != 0) {
+    profile = new CpuProfile(I, static_cast<int64_t>(period) *
+                                    kNanosecondsPerMicrosecond);
+    if (!profile->StartSampler()) {
+      delete profile;
+      return kFailure;
+    }
+  }
+  profile = I->SetCpuProfile(profile);
+  if (profile == nullptr) {
+    RETURN(I->nil_obj());
+  }
+  intptr_t length;
+  uint8_t* bytes = profile->Encode(&length);
+  delete profile;
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), bytes, length);
+  delete[] bytes;
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Interpreter_executionCounts) {
+  ASSERT(num_args == 1);
+  Object enable = I->Stack(0);
+  ExecutionCounts* counts;
+  if (enable == I->true_obj()) {
+    counts = new ExecutionCounts();
+  } else if (enable == I->false_obj()) {
+    counts = nullptr;
+  } else {
+    return kFailure;
+  }
+  counts = I->SetExecutionCounts(counts);
+  if (counts == nullptr) {
+    RETURN(I->nil_obj());
+  }
+  intptr_t length;
+  char* report = counts->Report(&length);
+  delete counts;
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), report, length);
+  free(report);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Isolate_metrics) {
+  ASSERT(num_args == 0);
+  IsolateMetrics metrics;
+  I->isolate()->GetMetrics(&metrics);
+  intptr_t length = sizeof(metrics);
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), &metrics, length);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Heap_perfCounters) {
+  ASSERT(num_args == 1);
+  Object enable = I->Stack(0);
+  PerfCounters* counters;
+  if (enable == I->true_obj()) {
+    counters = new PerfCounters();
+    // Counting starts partway through this slice of interpreting.
+    counters->Enter(PerfCounters::kInterpret);
+  } else if (enable == I->false_obj()) {
+    counters = nullptr;
+  } else {
+    return kFailure;
+  }
+  counters = H->SetPerfCounters(counters);
+  if (counters == nullptr) {
+    RETURN(I->nil_obj());
+  }
+  counters->Exit(PerfCounters::kInterpret);
+  intptr_t length = PerfCounters::kEncodedSize;
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  counters->Encode(result->element_addr(0));
+  delete counters;
+  RETURN(result);
+}
+
+
 DEFINE_PRIMITIVE(MessageLoop_exit) {
   ASSERT(num_args == 1);
   SmallInteger exit_code = static_cast<SmallInteger>(I->Stack(0));
@@ -2453,6 +3573,48 @@ DEFINE_PRIMITIVE(Double_asStringPrecision) {
   RETURN(result);
 }
 
+static const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static constexpr intptr_t kMaxIntegerLength = 20;  // "-9223372036854775808"
+
+// Writes value in decimal, two digits per division, to buffer, which must
+// hold kMaxIntegerLength characters. Answers the number written.
+static intptr_t FormatInteger(int64_t value, char* buffer) {
+  char digits[kMaxIntegerLength];
+  intptr_t start = kMaxIntegerLength;
+  uint64_t magnitude = value < 0 ? -static_cast<uint64_t>(value)
+                                 : static_cast<uint64_t>(value);
+  while (magnitude >= 100) {
+    intptr_t pair = static_cast<intptr_t>(magnitude % 100) * 2;
+    magnitude /= 100;
+    digits[--start] = kDigitPairs[pair + 1];
+    digits[--start] = kDigitPairs[pair];
+  }
+  if (magnitude >= 10) {
+    intptr_t pair = static_cast<intptr_t>(magnitude) * 2;
+    digits[--start] = kDigitPairs[pair + 1];
+    digits[--start] = kDigitPairs[pair];
+  } else {
+    digits[--start] = static_cast<char>('0' + magnitude);
+  }
+  intptr_t length = 0;
+  if (value < 0) {
+    buffer[length++] = '-';
+  }
+  memcpy(&buffer[length], &digits[start], kMaxIntegerLength - start);
+  return length + kMaxIntegerLength - start;
+}
+
 DEFINE_PRIMITIVE(Number_asString) {
   ASSERT(num_args == 0);
   Object receiver = I->Stack(0);
@@ -2461,10 +3623,10 @@ DEFINE_PRIMITIVE(Number_asString) {
   intptr_t length = -1;
   if (receiver->IsSmallInteger()) {
     intptr_t value = static_cast<SmallInteger>(receiver)->value();
-    length = snprintf(buffer, sizeof(buffer), "%" Pd "", value);
+    length = FormatInteger(value, buffer);
   } else if (receiver->IsMediumInteger()) {
     int64_t value = static_cast<MediumInteger>(receiver)->value();
-    length = snprintf(buffer, sizeof(buffer), "%" Pd64 "", value);
+    length = FormatInteger(value, buffer);
   } else if (receiver->IsFloat()) {
     double value = static_cast<Float>(receiver)->value();
     length = DoubleToCStringAsShortest(value, buffer, sizeof(buffer));
@@ -2484,37 +3646,119 @@ DEFINE_PRIMITIVE(Number_asString) {
 }
 
 
-DEFINE_PRIMITIVE(Closure_ensure) {
-  // This is a marker primitive checked on non-local return.
-  return kFailure;
-}
-
-
-DEFINE_PRIMITIVE(String_equals) {
+// Formats into one buffer, so no String is made per element. Fails if any
+// element is not a SmallInteger, MediumInteger or Float.
+DEFINE_PRIMITIVE(Array_formatNumbers) {
   ASSERT(num_args == 1);
-
-  String left = static_cast<String>(I->Stack(1));
-  String right = static_cast<String>(I->Stack(0));
-  if (left == right) {
-    RETURN_BOOL(true);
-    return kSuccess;
+  Array array = static_cast<Array>(I->Stack(1));
+  ASSERT(array->IsArray());
+  Bytes separator = static_cast<Bytes>(I->Stack(0));
+  if (!separator->IsBytes()) {
+    return kFailure;
   }
-  if (!left->IsString() || !right->IsString()) {
-    RETURN_BOOL(false);
+  intptr_t size = array->Size();
+  intptr_t separator_size = separator->Size();
+  // Room for any integer, and for any shortest double and its terminator.
+  const intptr_t kMaxElementLength = 32;
+  intptr_t capacity = size * (kMaxElementLength + separator_size);
+  char* buffer = reinterpret_cast<char*>(malloc(capacity + 1));
+  intptr_t length = 0;
+  for (intptr_t i = 0; i < size; i++) {
+    if (i != 0) {
+      memcpy(&buffer[length], separator->element_addr(0), separator_size);
+      length += separator_size;
+    }
+    Object element = array->element(i);
+    if (element->IsSmallInteger()) {
+      intptr_t value = static_cast<SmallInteger>(element)->value();
+      length += FormatInteger(value, &buffer[length]);
+    } else if (element->IsMediumInteger()) {
+      int64_t value = static_cast<MediumInteger>(element)->value();
+      length += FormatInteger(value, &buffer[length]);
+    } else if (element->IsFloat()) {
+      double value = static_cast<Float>(element)->value();
+      length += DoubleToCStringAsShortest(value, &buffer[length],
+                                          kMaxElementLength);
+    } else {
+      free(buffer);
+      return kFailure;
+    }
   }
-  if (left->size() != right->size()) {
+  ASSERT(length <= capacity);
+
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), buffer, length);
+  free(buffer);
+  RETURN(result);
+}
+
+
+// Writes the decimal form of a number into |bytes| at |index|, for a builder
+// to append without making a String. Answers the index of the last byte
+// written. Fails if the number is not a SmallInteger, MediumInteger or Float,
+// or if there is no room for it.
+DEFINE_PRIMITIVE(Bytes_formatNumberAt) {
+  ASSERT(num_args == 3);
+  Object number = I->Stack(2);
+  ByteArray bytes = static_cast<ByteArray>(I->Stack(1));
+  SmallInteger index = static_cast<SmallInteger>(I->Stack(0));
+  if (!bytes->IsByteArray() || !index->IsSmallInteger()) {
+    return kFailure;
+  }
+  intptr_t start = index->value() - 1;
+  if ((start < 0) || (start > bytes->Size())) {
+    return kFailure;
+  }
+
+  char buffer[64];
+  intptr_t length;
+  if (number->IsSmallInteger()) {
+    length = FormatInteger(static_cast<SmallInteger>(number)->value(), buffer);
+  } else if (number->IsMediumInteger()) {
+    length = FormatInteger(static_cast<MediumInteger>(number)->value(), buffer);
+  } else if (number->IsFloat()) {
+    length = DoubleToCStringAsShortest(static_cast<Float>(number)->value(),
+                                       buffer, sizeof(buffer));
+  } else {
+    return kFailure;
+  }
+  ASSERT(length < 64);
+  if (length > bytes->Size() - start) {
+    return kFailure;
+  }
+  memcpy(bytes->element_addr(start), buffer, length);
+  RETURN_SMI(start + length);
+}
+
+
+DEFINE_PRIMITIVE(Closure_ensure) {
+  // This is a marker primitive checked on non-local return.
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(String_equals) {
+  ASSERT(num_args == 1);
+
+  String left = static_cast<String>(I->Stack(1));
+  String right = static_cast<String>(I->Stack(0));
+  if (left == right) {
+    RETURN_BOOL(true);
+    return kSuccess;
+  }
+  if (!left->IsString() || !right->IsString()) {
     RETURN_BOOL(false);
   }
-  if (left->EnsureHash(I->isolate()) != right->EnsureHash(I->isolate())) {
+  if (left->size() != right->size()) {
     RETURN_BOOL(false);
   }
-  intptr_t length = left->Size();
-  for (intptr_t i = 0; i < length; i++) {
-    if (left->element(i) != right->element(i)) {
-      RETURN_BOOL(false);
-    }
+  // Computing a missing hash would cost as much as the comparison.
+  if ((left->hash() != 0) && (right->hash() != 0) &&
+      (left->hash() != right->hash())) {
+    RETURN_BOOL(false);
   }
-  RETURN_BOOL(true);
+  RETURN_BOOL(memcmp(left->element_addr(0), right->element_addr(0),
+                     left->Size()) == 0);
 }
 
 
@@ -2537,12 +3781,273 @@ DEFINE_PRIMITIVE(String_concat) {
 }
 
 
+DEFINE_PRIMITIVE(Bytes_isValidUTF8) {
+  ASSERT(num_args == 0);
+  Bytes bytes = static_cast<Bytes>(I->Stack(0));
+  ASSERT(bytes->IsBytes());
+  RETURN_BOOL(UTF8::IsValid(bytes->element_addr(0), bytes->Size()));
+}
+
+
+DEFINE_PRIMITIVE(Bytes_codePointCount) {
+  ASSERT(num_args == 0);
+  Bytes bytes = static_cast<Bytes>(I->Stack(0));
+  ASSERT(bytes->IsBytes());
+  RETURN_SMI(UTF8::CodePointCount(bytes->element_addr(0), bytes->Size()));
+}
+
+
+// Answers the 1-based byte index where the code point at a 1-based index
+// starts, or 0 if there are fewer code points.
+DEFINE_PRIMITIVE(Bytes_codePointIndex) {
+  ASSERT(num_args == 1);
+  Bytes bytes = static_cast<Bytes>(I->Stack(1));
+  ASSERT(bytes->IsBytes());
+  SMI_ARGUMENT(index, 0);
+  if (index <= 0) {
+    return kFailure;
+  }
+  intptr_t offset =
+      UTF8::CodePointOffset(bytes->element_addr(0), bytes->Size(), index - 1);
+  RETURN_SMI(offset + 1);
+}
+
+
+// Answers a ByteArray of little-endian UTF-16 code units, as JavaScript
+// strings hold. Fails if the receiver is not valid UTF-8.
+DEFINE_PRIMITIVE(Bytes_asUTF16) {
+  ASSERT(num_args == 0);
+  Bytes bytes = static_cast<Bytes>(I->Stack(0));
+  ASSERT(bytes->IsBytes());
+  if (!UTF8::IsValid(bytes->element_addr(0), bytes->Size())) {
+    return kFailure;
+  }
+  intptr_t count = UTF8::UTF16Length(bytes->element_addr(0), bytes->Size());
+  ByteArray result = H->AllocateByteArray(2 * count);  // SAFEPOINT
+  bytes = static_cast<Bytes>(I->Stack(0));
+  UTF8::DecodeToUTF16(bytes->element_addr(0), bytes->Size(),
+                      result->element_addr(0));
+  RETURN(result);
+}
+
+
+// The inverse of Bytes_asUTF16, replacing unpaired surrogates with U+FFFD.
+DEFINE_PRIMITIVE(String_class_fromUTF16) {
+  ASSERT(num_args == 1);
+  Bytes units = static_cast<Bytes>(I->Stack(0));
+  if (!units->IsBytes() || ((units->Size() & 1) != 0)) {
+    return kFailure;
+  }
+  intptr_t count = units->Size() >> 1;
+  intptr_t length = UTF8::LengthOfUTF16(units->element_addr(0), count);
+  String result = H->AllocateString(length);  // SAFEPOINT
+  units = static_cast<Bytes>(I->Stack(0));
+  UTF8::EncodeUTF16(units->element_addr(0), count, result->element_addr(0));
+  RETURN(result);
+}
+
+
+// A JSON token is a structural character, a string including its quotes, or a
+// run of other bytes up to whitespace or one of those, which the decoder parses
+// as a number, true, false or null. The decoder reads the tokens instead of
+// looking at every byte. Each token is a native-endian uint32 pair: the
+// 1-based indices of its first and last bytes, with kJSONSlowString set in the
+// latter if a string has escapes or no closing quote.
+static const uint32_t kJSONSlowString = 0x80000000;
+
+static inline bool IsJSONWhitespace(uint8_t byte) {
+  return (byte == ' ') || (byte == '\n') || (byte == '\r') || (byte == '\t');
+}
+
+static inline bool IsJSONDelimiter(uint8_t byte) {
+  return (byte == '{') || (byte == '}') || (byte == '[') || (byte == ']') ||
+         (byte == ':') || (byte == ',') || (byte == '"');
+}
+
+// Answers the number of tokens, and writes them to |tokens| unless it is null.
+static intptr_t ScanJSON(const uint8_t* bytes, intptr_t length,
+                         uint32_t* tokens) {
+  intptr_t count = 0;
+  intptr_t i = 0;
+  while (i < length) {
+    uint8_t byte = bytes[i];
+    if (IsJSONWhitespace(byte)) {
+      i++;
+      continue;
+    }
+    intptr_t start = i;
+    uint32_t slow = 0;
+    if (byte == '"') {
+      // memchr is vectorized by libc, so most strings take two calls.
+      i++;
+      for (;;) {
+        const uint8_t* quote = reinterpret_cast<const uint8_t*>(
+            memchr(&bytes[i], '"', length - i));
+        intptr_t end = (quote == nullptr) ? length : quote - bytes;
+        const uint8_t* escape = reinterpret_cast<const uint8_t*>(
+            memchr(&bytes[i], '\\', end - i));
+        if (escape == nullptr) {
+          if (quote == nullptr) {
+            slow = kJSONSlowString;
+            i = length - 1;
+          } else {
+            i = end;
+          }
+          break;
+        }
+        slow = kJSONSlowString;
+        i = (escape - bytes) + 2;  // Skip the escaped byte.
+        if (i >= length) {
+          i = length - 1;
+          break;
+        }
+      }
+    } else if (!IsJSONDelimiter(byte)) {
+      while ((i + 1 < length) && !IsJSONWhitespace(bytes[i + 1]) &&
+             !IsJSONDelimiter(bytes[i + 1])) {
+        i++;
+      }
+    }
+    if (tokens != nullptr) {
+      tokens[2 * count] = static_cast<uint32_t>(start + 1);
+      tokens[2 * count + 1] = static_cast<uint32_t>(i + 1) | slow;
+    }
+    count++;
+    i++;
+  }
+  return count;
+}
+
+
+DEFINE_PRIMITIVE(Bytes_scanJSON) {
+  ASSERT(num_args == 1);
+  Bytes bytes = static_cast<Bytes>(I->Stack(0));
+  if (!bytes->IsBytes() || (bytes->Size() >= kJSONSlowString)) {
+    return kFailure;
+  }
+  intptr_t count = ScanJSON(bytes->element_addr(0), bytes->Size(), nullptr);
+  ByteArray result =
+      H->AllocateByteArray(count * 2 * sizeof(uint32_t));  // SAFEPOINT
+  bytes = static_cast<Bytes>(I->Stack(0));
+  uint32_t* tokens = reinterpret_cast<uint32_t*>(result->element_addr(0));
+  ScanJSON(bytes->element_addr(0), bytes->Size(), tokens);
+  RETURN(result);
+}
+
+
 DEFINE_PRIMITIVE(Closure_onDo) {
   // This is a marker primitive for the in-image exception handling machinary.
   return kFailure;
 }
 
 
+// Needles at least this long are searched for with Horspool's algorithm, which
+// skips ahead by up to the needle's length on a mismatch. Shorter needles are
+// found by scanning for their first byte with memchr, which libc vectorizes,
+// and comparing the rest with memcmp.
+static constexpr intptr_t kHorspoolThreshold = 8;
+
+// Answers the least index i >= start at which needle occurs in haystack, or -1.
+static intptr_t BytesSearchForward(const uint8_t* haystack,
+                                   intptr_t haystack_length,
+                                   const uint8_t* needle,
+                                   intptr_t needle_length,
+                                   intptr_t start) {
+  intptr_t limit = haystack_length - needle_length;
+  if (start > limit) {
+    return -1;
+  }
+  if (needle_length == 0) {
+    return start;
+  }
+
+  if (needle_length < kHorspoolThreshold) {
+    uint8_t first = needle[0];
+    intptr_t i = start;
+    while (i <= limit) {
+      const uint8_t* match = reinterpret_cast<const uint8_t*>(
+          memchr(&haystack[i], first, limit - i + 1));
+      if (match == nullptr) {
+        return -1;
+      }
+      i = match - haystack;
+      if (memcmp(&haystack[i + 1], &needle[1], needle_length - 1) == 0) {
+        return i;
+      }
+      i++;
+    }
+    return -1;
+  }
+
+  intptr_t skip[256];
+  for (intptr_t c = 0; c < 256; c++) {
+    skip[c] = needle_length;
+  }
+  for (intptr_t j = 0; j < needle_length - 1; j++) {
+    skip[needle[j]] = needle_length - 1 - j;
+  }
+  uint8_t last = needle[needle_length - 1];
+  for (intptr_t i = start; i <= limit;) {
+    uint8_t c = haystack[i + needle_length - 1];
+    if ((c == last) &&
+        (memcmp(&haystack[i], needle, needle_length - 1) == 0)) {
+      return i;
+    }
+    i += skip[c];
+  }
+  return -1;
+}
+
+// Answers the greatest index i <= start at which needle occurs in haystack, or
+// -1.
+static intptr_t BytesSearchBackward(const uint8_t* haystack,
+                                    intptr_t haystack_length,
+                                    const uint8_t* needle,
+                                    intptr_t needle_length,
+                                    intptr_t start) {
+  if (start > haystack_length - needle_length) {
+    start = haystack_length - needle_length;
+  }
+  if (start < 0) {
+    return -1;
+  }
+  if (needle_length == 0) {
+    return start;
+  }
+
+  if (needle_length < kHorspoolThreshold) {
+    uint8_t first = needle[0];
+    for (intptr_t i = start; i >= 0; i--) {
+      if ((haystack[i] == first) &&
+          (memcmp(&haystack[i + 1], &needle[1], needle_length - 1) == 0)) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  // Mirror image of the forward search, keyed on the byte under the needle's
+  // first position.
+  intptr_t skip[256];
+  for (intptr_t c = 0; c < 256; c++) {
+    skip[c] = needle_length;
+  }
+  for (intptr_t j = needle_length - 1; j > 0; j--) {
+    skip[needle[j]] = j;
+  }
+  uint8_t first = needle[0];
+  for (intptr_t i = start; i >= 0;) {
+    uint8_t c = haystack[i];
+    if ((c == first) &&
+        (memcmp(&haystack[i + 1], &needle[1], needle_length - 1) == 0)) {
+      return i;
+    }
+    i -= skip[c];
+  }
+  return -1;
+}
+
+
 DEFINE_PRIMITIVE(Bytes_startsWith) {
   ASSERT(num_args == 1);
   Bytes string = static_cast<Bytes>(I->Stack(1));
@@ -2556,12 +4061,8 @@ DEFINE_PRIMITIVE(Bytes_startsWith) {
   if (prefix_length > string_length) {
     RETURN_BOOL(false);
   }
-  for (intptr_t i = 0; i < prefix_length; i++) {
-    if (string->element(i) != prefix->element(i)) {
-      RETURN_BOOL(false);
-    }
-  }
-  RETURN_BOOL(true);
+  RETURN_BOOL(memcmp(string->element_addr(0), prefix->element_addr(0),
+                     prefix_length) == 0);
 }
 
 
@@ -2579,13 +4080,32 @@ DEFINE_PRIMITIVE(Bytes_endsWith) {
     RETURN_BOOL(false);
   }
   intptr_t offset = string_length - suffix_length;
-  for (intptr_t i = 0; i < suffix_length; i++) {
-    if (string->element(offset + i) != suffix->element(i)) {
-      RETURN_BOOL(false);
-    }
+  RETURN_BOOL(memcmp(string->element_addr(offset), suffix->element_addr(0),
+                     suffix_length) == 0);
+}
+
+
+DEFINE_PRIMITIVE(Bytes_compare) {
+  ASSERT(num_args == 1);
+  Bytes left = static_cast<Bytes>(I->Stack(1));
+  Bytes right = static_cast<Bytes>(I->Stack(0));
+  if (!left->IsBytes() || !right->IsBytes()) {
+    return kFailure;
   }
 
-  RETURN_BOOL(true);
+  intptr_t left_length = left->Size();
+  intptr_t right_length = right->Size();
+  intptr_t length = left_length < right_length ? left_length : right_length;
+  int result = memcmp(left->element_addr(0), right->element_addr(0), length);
+  intptr_t order;
+  if (result != 0) {
+    order = result < 0 ? -1 : 1;
+  } else if (left_length != right_length) {
+    order = left_length < right_length ? -1 : 1;
+  } else {
+    order = 0;
+  }
+  RETURN_SMI(order);
 }
 
 
@@ -2615,24 +4135,10 @@ DEFINE_PRIMITIVE(Bytes_indexOf) {
     return kFailure;
   }
 
-  if (substring_length > string_length) {
-    RETURN_SMI(static_cast<intptr_t>(0));
-  }
-
-  intptr_t limit = string_length - substring_length;
-  for (intptr_t start = start_index; start <= limit; start++) {
-    bool found = true;
-    for (intptr_t i = 0; i < substring_length; i++) {
-      if (string->element(start + i) != substring->element(i)) {
-        found = false;
-        break;
-      }
-    }
-    if (found) {
-      RETURN_SMI(start + 1);
-    }
-  }
-  RETURN_SMI(static_cast<intptr_t>(0));
+  intptr_t index = BytesSearchForward(string->element_addr(0), string_length,
+                                      substring->element_addr(0),
+                                      substring_length, start_index);
+  RETURN_SMI(index + 1);
 }
 
 
@@ -2662,26 +4168,190 @@ DEFINE_PRIMITIVE(Bytes_lastIndexOf) {
   if (start_index > string_length) {
     return kFailure;
   }
-  if (substring_length > string_length) {
-    RETURN_SMI(static_cast<intptr_t>(0));
+  intptr_t index = BytesSearchBackward(string->element_addr(0), string_length,
+                                       substring->element_addr(0),
+                                       substring_length, start_index);
+  RETURN_SMI(index + 1);
+}
+
+
+// A number as ParseDecimal reads it, before it is boxed.
+struct ParsedNumber {
+  bool is_float;
+  int64_t integer;
+  double value;
+};
+
+static inline bool IsDecimalDigit(uint8_t byte) {
+  return (byte >= '0') && (byte <= '9');
+}
+
+// Reads all of [cursor, end) as an optional '-' and decimal digits, followed
+// for a Float by a '.' and more digits, an exponent or both. Fails on anything
+// else, and on integers outside int64_t, leaving them to the fallback.
+static bool ParseDecimal(const uint8_t* cursor, const uint8_t* end,
+                         ParsedNumber* number) {
+  // Strtod only looks at this many significant digits anyway.
+  static constexpr intptr_t kMaxDigits = 780;
+  static constexpr intptr_t kMaxExponent = 100000;
+  char digits[kMaxDigits];
+  intptr_t length = 0;
+  intptr_t exponent = 0;
+  bool negative = false;
+  bool is_float = false;
+
+  if ((cursor < end) && (*cursor == '-')) {
+    negative = true;
+    cursor++;
+  }
+  const uint8_t* start = cursor;
+  while ((cursor < end) && IsDecimalDigit(*cursor)) {
+    if ((length != 0) || (*cursor != '0')) {
+      if (length == kMaxDigits) return false;
+      digits[length++] = *cursor;
+    }
+    cursor++;
+  }
+  if (cursor == start) return false;
+
+  if ((cursor < end) && (*cursor == '.')) {
+    is_float = true;
+    cursor++;
+    start = cursor;
+    while ((cursor < end) && IsDecimalDigit(*cursor)) {
+      if ((length != 0) || (*cursor != '0')) {
+        if (length == kMaxDigits) return false;
+        digits[length++] = *cursor;
+      }
+      exponent--;
+      cursor++;
+    }
+    if (cursor == start) return false;
+  }
+
+  if ((cursor < end) && ((*cursor == 'e') || (*cursor == 'E'))) {
+    is_float = true;
+    cursor++;
+    bool negative_exponent = false;
+    if ((cursor < end) && ((*cursor == '+') || (*cursor == '-'))) {
+      negative_exponent = *cursor == '-';
+      cursor++;
+    }
+    start = cursor;
+    intptr_t written_exponent = 0;
+    while ((cursor < end) && IsDecimalDigit(*cursor)) {
+      if (written_exponent > kMaxExponent) return false;
+      written_exponent = written_exponent * 10 + (*cursor - '0');
+      cursor++;
+    }
+    if (cursor == start) return false;
+    exponent += negative_exponent ? -written_exponent : written_exponent;
+  }
+  if (cursor != end) return false;
+
+  number->is_float = is_float;
+  if (is_float) {
+    if ((exponent < -kMaxExponent) || (exponent > kMaxExponent)) {
+      return false;
+    }
+    double value = DecimalDigitsToDouble(digits, length, exponent);
+    number->value = negative ? -value : value;
+    return true;
   }
 
-  intptr_t limit = string_length - substring_length;
-  if (limit > start_index) {
-    limit = start_index;
+  // 19 digits fit in a uint64_t.
+  if (length > 19) return false;
+  uint64_t magnitude = 0;
+  for (intptr_t i = 0; i < length; i++) {
+    magnitude = magnitude * 10 + (digits[i] - '0');
   }
-  for (intptr_t start = limit; start >= 0; start--) {
-    bool found = true;
-    for (intptr_t i = 0; i < substring_length; i++) {
-      if (string->element(start + i) != substring->element(i)) {
-        found = false;
-      }
+  const uint64_t kMinInt64Magnitude = static_cast<uint64_t>(1) << 63;
+  if (magnitude > (negative ? kMinInt64Magnitude : kMinInt64Magnitude - 1)) {
+    return false;
+  }
+  number->integer = static_cast<int64_t>(negative ? 0 - magnitude : magnitude);
+  return true;
+}
+
+
+// Parses the decimal integers and doubles separated by a separator in a range
+// of bytes into an Array, without a String and a primitive call for each
+// number. Fails if any of them is malformed or a LargeInteger, so the fallback
+// can signal or parse it.
+DEFINE_PRIMITIVE(Bytes_parseNumbers) {
+  ASSERT(num_args == 3);
+  Bytes bytes = static_cast<Bytes>(I->Stack(3));
+  SmallInteger start = static_cast<SmallInteger>(I->Stack(2));
+  SmallInteger stop = static_cast<SmallInteger>(I->Stack(1));
+  Bytes separator = static_cast<Bytes>(I->Stack(0));
+  if (!bytes->IsBytes() || !start->IsSmallInteger() ||
+      !stop->IsSmallInteger() || !separator->IsBytes()) {
+    return kFailure;
+  }
+  intptr_t from = start->value() - 1;
+  intptr_t to = stop->value();
+  intptr_t separator_length = separator->Size();
+  if ((from < 0) || (to > bytes->Size()) || (from > to) ||
+      (separator_length == 0)) {
+    return kFailure;
+  }
+
+  const uint8_t* base = bytes->element_addr(0);
+  const uint8_t* needle = separator->element_addr(0);
+  intptr_t count = 0;
+  if (from != to) {
+    count = 1;
+    intptr_t i = from;
+    while ((i = BytesSearchForward(base, to, needle, separator_length, i)) !=
+           -1) {
+      count++;
+      i += separator_length;
+    }
+  }
+
+  ParsedNumber* numbers =
+      reinterpret_cast<ParsedNumber*>(malloc(count * sizeof(ParsedNumber)));
+  intptr_t field_start = from;
+  for (intptr_t n = 0; n < count; n++) {
+    intptr_t field_end = BytesSearchForward(base, to, needle, separator_length,
+                                            field_start);
+    if (field_end == -1) {
+      field_end = to;
+    }
+    if (!ParseDecimal(&base[field_start], &base[field_end], &numbers[n])) {
+      free(numbers);
+      return kFailure;
     }
-    if (found) {
-      RETURN_SMI(start + 1);
+    field_start = field_end + separator_length;
+  }
+
+  Array result = H->AllocateArray(count);  // SAFEPOINT
+  bool boxed = false;
+  for (intptr_t n = 0; n < count; n++) {
+    if (!numbers[n].is_float && SmallInteger::IsSmiValue(numbers[n].integer)) {
+      result->set_element(n, SmallInteger::New(numbers[n].integer),
+                          kNoBarrier);
+    } else {
+      result->set_element(n, nil, kNoBarrier);
+      boxed = true;
+    }
+  }
+  if (boxed) {
+    HandleScope h1(H, reinterpret_cast<Object*>(&result));
+    for (intptr_t n = 0; n < count; n++) {
+      if (numbers[n].is_float) {
+        Float box = H->AllocateFloat();  // SAFEPOINT
+        box->set_value(numbers[n].value);
+        result->set_element(n, box);
+      } else if (!SmallInteger::IsSmiValue(numbers[n].integer)) {
+        MediumInteger box = H->AllocateMediumInteger();  // SAFEPOINT
+        box->set_value(numbers[n].integer);
+        result->set_element(n, box);
+      }
     }
   }
-  RETURN_SMI(static_cast<intptr_t>(0));
+  free(numbers);
+  RETURN(result);
 }
 
 
@@ -2767,256 +4437,829 @@ DEFINE_PRIMITIVE(String_class_withAll) {
 }
 
 
-DEFINE_PRIMITIVE(ByteArray_class_withAll) {
+DEFINE_PRIMITIVE(ByteArray_class_withAll) {
+  ASSERT(num_args == 1);
+
+  if (I->Stack(0)->IsBytes()) {
+    intptr_t length = static_cast<Bytes>(I->Stack(0))->Size();
+    String result = H->AllocateString(length);  // SAFEPOINT
+    Bytes bytes = static_cast<Bytes>(I->Stack(0));
+    memcpy(result->element_addr(0), bytes->element_addr(0), length);
+    RETURN(result);
+  } else if (I->Stack(0)->IsArray()) {
+    Array bytes = static_cast<Array>(I->Stack(0));
+    if (!bytes->IsArray()) {
+      return kFailure;
+    }
+
+    intptr_t length = bytes->Size();
+    for (intptr_t i = 0; i < length; i++) {
+      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
+      if (!byte->IsSmallInteger()) {
+        return kFailure;
+      }
+      intptr_t raw_byte = byte->value();
+      if ((raw_byte < 0) || (raw_byte > 255)) {
+        return kFailure;
+      }
+    }
+
+    String result = H->AllocateString(length);  // SAFEPOINT
+    bytes = static_cast<Array>(I->Stack(0));
+
+    for (intptr_t i = 0; i < length; i++) {
+      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
+      intptr_t raw_byte = byte->value();
+      result->set_element(i, raw_byte);
+    }
+
+    RETURN(result);
+  }
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(Object_isCanonical) {
+  ASSERT(num_args == 1);
+  Object object = I->Stack(0);
+  if (object->IsHeapObject()) {
+    RETURN_BOOL(static_cast<HeapObject>(object)->is_canonical());
+  } else {
+    RETURN_BOOL(true);
+  }
+}
+
+
+DEFINE_PRIMITIVE(Object_markCanonical) {
+  ASSERT(num_args == 1);
+  Object object = I->Stack(0);
+  if (object->IsHeapObject()) {
+    static_cast<HeapObject>(object)->set_is_canonical(true);
+  } else {
+    // Nop.
+  }
+  RETURN(object);
+}
+
+
+DEFINE_PRIMITIVE(compressSnapshot) {
+  ASSERT(num_args == 1);
+  ByteArray snapshot = static_cast<ByteArray>(I->Stack(0));
+  if (!snapshot->IsByteArray()) {
+    return kFailure;
+  }
+
+  size_t length;
+  uint8_t* compressed = CompressedSnapshot::Compress(
+      snapshot->element_addr(0), snapshot->Size(), &length);
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), compressed, length);
+  free(compressed);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(writeBytesToFile) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 2);
+  ByteArray content = static_cast<ByteArray>(I->Stack(1));
+  String filename = static_cast<String>(I->Stack(0));
+  if (!content->IsByteArray() || !filename->IsString()) {
+    return kFailure;
+  }
+
+  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
+  memcpy(raw_filename, filename->element_addr(0), filename->Size());
+  raw_filename[filename->Size()] = 0;
+  FILE* f = fopen(raw_filename, "wb");
+  if (f == NULL) {
+    FATAL("Cannot open %s\n", raw_filename);
+  }
+
+  size_t length = content->Size();
+  size_t start = 0;
+  while (start != length) {
+    size_t written = fwrite(content->element_addr(start), 1, length - start, f);
+    if (written == 0) {
+      FATAL("Failed to write '%s'\n", raw_filename);
+    }
+    start += written;
+  }
+  fflush(f);
+  fclose(f);
+
+  free(raw_filename);
+
+  RETURN_SELF();
+#endif
+}
+
+
+DEFINE_PRIMITIVE(readFileAsBytes) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  String filename = static_cast<String>(I->Stack(0));
+  if (!filename->IsString()) {
+    return kFailure;
+  }
+
+  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
+  memcpy(raw_filename, filename->element_addr(0), filename->Size());
+  raw_filename[filename->Size()] = 0;
+  FILE* f = fopen(raw_filename, "rb");
+  if (f == NULL) {
+    FATAL("Failed to stat '%s'\n", raw_filename);
+  }
+  struct stat st;
+  if (fstat(fileno(f), &st) != 0) {
+    FATAL("Failed to stat '%s'\n", raw_filename);
+  }
+  size_t length = st.st_size;
+
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  size_t start = 0;
+  size_t remaining = length;
+  while (remaining > 0) {
+    size_t bytes_read = fread(result->element_addr(start), 1, remaining, f);
+    if (bytes_read == 0) {
+      FATAL("Failed to read '%s'\n", raw_filename);
+    }
+    start += bytes_read;
+    remaining -= bytes_read;
+  }
+
+  fclose(f);
+  free(raw_filename);
+
+  RETURN(result);
+#endif
+}
+
+
+DEFINE_PRIMITIVE(Double_class_parse) {
+  ASSERT(num_args == 1);
+  String string = static_cast<String>(I->Stack(0));
+  if (!string->IsString()) {
+    return kFailure;
+  }
+  double raw_result;
+  const char* cstr = reinterpret_cast<const char*>(string->element_addr(0));
+  intptr_t length = string->Size();
+  if (CStringToDouble(cstr, length, &raw_result)) {
+    RETURN_FLOAT(raw_result);
+  }
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(currentActivation) {
+  ASSERT(num_args == 0);
+  RETURN(I->CurrentActivation());  // SAFEPOINT
+}
+
+
+DEFINE_PRIMITIVE(Behavior_adoptInstance) {
+  ASSERT(num_args == 2);
+  Behavior new_cls = static_cast<Behavior>(I->Stack(1));
+  HeapObject instance = static_cast<HeapObject>(I->Stack(0));
+  Behavior old_cls = instance->Klass(H);
+
+  ASSERT(old_cls->cid() >= kFirstRegularObjectCid);
+  ASSERT(old_cls->format() == new_cls->format());
+
+  SmallInteger id = new_cls->id();
+  if (id == nil) {
+    id = SmallInteger::New(H->AllocateClassId());  // SAFEPOINT
+    new_cls = static_cast<Behavior>(I->Stack(1));
+    instance = static_cast<HeapObject>(I->Stack(0));
+    new_cls->set_id(id);
+    H->RegisterClass(id->value(), new_cls);
+  }
+  ASSERT(id->IsSmallInteger());
+  instance->set_cid(id->value());
+
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(openPort) {
+  ASSERT(num_args == 0);
+  Port new_port = I->isolate()->loop()->OpenPort();
+  RETURN_MINT(new_port);
+}
+
+
+DEFINE_PRIMITIVE(closePort) {
+  ASSERT(num_args == 1);
+  MINT_ARGUMENT(port, 0);
+  I->isolate()->loop()->ClosePort(port);
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(spawn) {
+  ASSERT(num_args == 1);
+  ByteArray message = static_cast<ByteArray>(I->Stack(0));
+  if (message->IsByteArray()) {
+    I->isolate()->Spawn(IsolateMessage::NewBytes(ILLEGAL_PORT,
+                                                 message->element_addr(0),
+                                                 message->Size()));
+    RETURN_SELF();
+  }
+
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(send) {
+  ASSERT(num_args == 2);
+  MINT_ARGUMENT(port, 1);
+  ByteArray data = static_cast<ByteArray>(I->Stack(0));
+  if (!data->IsByteArray()) {
+    return kFailure;
+  }
+
+  IsolateMessage* message =
+      IsolateMessage::NewBytes(port, data->element_addr(0), data->Size());
+  PortMap::PostResult result = PortMap::PostMessage(message);
+
+  RETURN_SMI(result);
+}
+
+
+// As send, but the sender gives up the ByteArray, whose contents are then
+// unspecified. A large one moves its pages to the receiver without being
+// copied at all, and is left empty.
+DEFINE_PRIMITIVE(transfer) {
+  ASSERT(num_args == 2);
+  MINT_ARGUMENT(port, 1);
+  ByteArray data = static_cast<ByteArray>(I->Stack(0));
+  if (!data->IsByteArray()) {
+    return kFailure;
+  }
+
+  IsolateMessage* message;
+  Region* region = H->DetachByteArray(data);
+  if (region != nullptr) {
+    message = new IsolateMessage(port, region);
+  } else {
+    message =
+        IsolateMessage::NewBytes(port, data->element_addr(0), data->Size());
+  }
+  PortMap::PostResult result = PortMap::PostMessage(message);
+
+  RETURN_SMI(result);
+}
+
+
+// As transfer, but writes the message itself into the message's buffer
+// instead of taking a ByteArray the Newspeak Serializer wrote. Fails if the
+// message is not only data; see MessageSerializer.
+DEFINE_PRIMITIVE(postObject) {
+  ASSERT(num_args == 2);
+  MINT_ARGUMENT(port, 1);
+  MessageSerializer serializer(H);
+  if (!serializer.Serialize(I->Stack(0))) {
+    return kFailure;
+  }
+
+  intptr_t length;
+  uint8_t* data = serializer.TakeData(&length);
+  IsolateMessage* message = new IsolateMessage(port, data, length);
+  message->set_is_object(true);
+  PortMap::PostResult result = PortMap::PostMessage(message);
+
+  RETURN_SMI(result);
+}
+
+
+// Answers a snapshot of everything reachable from the object store given, to
+// start an isolate from instead of the snapshot this one started from. Fails
+// if an object cannot be written; see ImageSerializer.
+DEFINE_PRIMITIVE(writeImage) {
+  ASSERT(num_args == 1);
+  if (!I->Stack(0)->IsArray()) {
+    return kFailure;
+  }
+
+  // The image outlives this isolate's snapshot, so its methods carry their
+  // bytecode instead of positions in that snapshot.
+  Array methods = H->InstancesOf(I->object_store()->Method());  // SAFEPOINT
+  {
+    HandleScope h1(H, reinterpret_cast<Object*>(&methods));
+    for (intptr_t i = 0; i < methods->Size(); i++) {
+      Method method = static_cast<Method>(methods->element(i));
+      if (!method->HasBytecode()) {
+        I->LoadBytecode(method);  // SAFEPOINT
+      }
+    }
+  }
+
+  intptr_t length;
+  uint8_t* data;
+  {
+    ImageSerializer serializer(H);
+    if (!serializer.Serialize(I->Stack(0))) {
+      return kFailure;
+    }
+    data = serializer.TakeData(&length);
+  }
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), data, length);
+  free(data);
+  RETURN(result);
+}
+
+
+// Several ByteArrays for one port, posted in one step and delivered
+// together.
+DEFINE_PRIMITIVE(sendAll) {
+  ASSERT(num_args == 2);
+  MINT_ARGUMENT(port, 1);
+  Array data = static_cast<Array>(I->Stack(0));
+  if (!data->IsArray()) {
+    return kFailure;
+  }
+  intptr_t length = data->Size();
+  for (intptr_t i = 0; i < length; i++) {
+    if (!data->element(i)->IsByteArray()) {
+      return kFailure;
+    }
+  }
+  if (length == 0) {
+    RETURN_SMI(PortMap::kPosted);
+  }
+
+  IsolateMessage* first = NULL;
+  IsolateMessage* last = NULL;
+  for (intptr_t i = 0; i < length; i++) {
+    ByteArray bytes = static_cast<ByteArray>(data->element(i));
+    IsolateMessage* message =
+        IsolateMessage::NewBytes(port, bytes->element_addr(0), bytes->Size());
+    if (first == NULL) {
+      first = message;
+    } else {
+      last->set_next(message);
+    }
+    last = message;
+  }
+  PortMap::PostResult result = PortMap::PostMessages(port, first, last);
+
+  RETURN_SMI(result);
+}
+
+
+// One ByteArray to each of several ports. Answers how many took it.
+DEFINE_PRIMITIVE(sendToAll) {
+  ASSERT(num_args == 2);
+  Array ports = static_cast<Array>(I->Stack(1));
+  ByteArray data = static_cast<ByteArray>(I->Stack(0));
+  if (!ports->IsArray() || !data->IsByteArray()) {
+    return kFailure;
+  }
+  intptr_t num_ports = ports->Size();
+  for (intptr_t i = 0; i < num_ports; i++) {
+    Object port = ports->element(i);
+    if (!port->IsSmallInteger() && !port->IsMediumInteger()) {
+      return kFailure;
+    }
+  }
+
+  intptr_t delivered = 0;
+  for (intptr_t i = 0; i < num_ports; i++) {
+    Object element = ports->element(i);
+    Port port = element->IsSmallInteger()
+        ? static_cast<SmallInteger>(element)->value()
+        : static_cast<MediumInteger>(element)->value();
+    IsolateMessage* message =
+        IsolateMessage::NewBytes(port, data->element_addr(0), data->Size());
+    if (PortMap::PostMessage(message) == PortMap::kPosted) {
+      delivered++;
+    }
+  }
+
+  RETURN_SMI(delivered);
+}
+
+
+DEFINE_PRIMITIVE(Port_setCapacity) {
+  ASSERT(num_args == 2);
+  MINT_ARGUMENT(port, 1);
+  SMI_ARGUMENT(capacity, 0);
+  if (capacity < 0) {
+    return kFailure;
+  }
+  RETURN_BOOL(PortMap::SetCapacity(port, capacity));
+}
+
+
+DEFINE_PRIMITIVE(Port_statistics) {
+  ASSERT(num_args == 1);
+  MINT_ARGUMENT(port, 0);
+  PortMap::Statistics stats;
+  if (!PortMap::GetStatistics(port, &stats)) {
+    RETURN(I->nil_obj());
+  }
+  intptr_t length = sizeof(stats);
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), &stats, length);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(MessageLoop_finish) {
+  ASSERT(num_args == 1);
+  MINT_ARGUMENT(new_wakeup, 0);
+  I->isolate()->loop()->Finish(new_wakeup);
+  I->ReturnFromDispatch();
+  I->Exit();
+  UNREACHABLE();
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(MessageLoop_scheduleTimer) {
   ASSERT(num_args == 1);
+  MINT_ARGUMENT(due, 0);
+  if (due < 0) {
+    return kFailure;
+  }
+  intptr_t id = I->isolate()->loop()->timers()->Schedule(
+      due, OS::CurrentMonotonicNanos());
+  if (id == 0) {
+    return kFailure;
+  }
+  RETURN_SMI(id);
+}
 
-  if (I->Stack(0)->IsBytes()) {
-    intptr_t length = static_cast<Bytes>(I->Stack(0))->Size();
-    String result = H->AllocateString(length);  // SAFEPOINT
-    Bytes bytes = static_cast<Bytes>(I->Stack(0));
-    memcpy(result->element_addr(0), bytes->element_addr(0), length);
-    RETURN(result);
-  } else if (I->Stack(0)->IsArray()) {
-    Array bytes = static_cast<Array>(I->Stack(0));
-    if (!bytes->IsArray()) {
-      return kFailure;
-    }
-
-    intptr_t length = bytes->Size();
-    for (intptr_t i = 0; i < length; i++) {
-      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
-      if (!byte->IsSmallInteger()) {
-        return kFailure;
-      }
-      intptr_t raw_byte = byte->value();
-      if ((raw_byte < 0) || (raw_byte > 255)) {
-        return kFailure;
-      }
-    }
 
-    String result = H->AllocateString(length);  // SAFEPOINT
-    bytes = static_cast<Array>(I->Stack(0));
+DEFINE_PRIMITIVE(MessageLoop_cancelTimer) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(id, 0);
+  RETURN_BOOL(I->isolate()->loop()->timers()->Cancel(id));
+}
 
-    for (intptr_t i = 0; i < length; i++) {
-      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
-      intptr_t raw_byte = byte->value();
-      result->set_element(i, raw_byte);
-    }
 
-    RETURN(result);
+DEFINE_PRIMITIVE(MessageLoop_takeFiredTimers) {
+  ASSERT(num_args == 0);
+  TimerWheel* timers = I->isolate()->loop()->timers();
+  intptr_t count = timers->Expire(OS::CurrentMonotonicNanos());
+  if (count == 0) {
+    RETURN(I->nil_obj());
   }
-  return kFailure;
+  Array result = H->AllocateArray(count);  // SAFEPOINT
+  for (intptr_t i = 0; i < count; i++) {
+    result->set_element(i, SmallInteger::New(timers->fired_id(i)));
+  }
+  timers->ClearFired();
+  RETURN(result);
 }
 
 
-DEFINE_PRIMITIVE(Object_isCanonical) {
+DEFINE_PRIMITIVE(RingChannel_new) {
   ASSERT(num_args == 1);
-  Object object = I->Stack(0);
-  if (object->IsHeapObject()) {
-    RETURN_BOOL(static_cast<HeapObject>(object)->is_canonical());
-  } else {
-    RETURN_BOOL(true);
+  SMI_ARGUMENT(capacity, 0);
+  RingChannel* channel = RingChannel::New(capacity);
+  if (channel == nullptr) {
+    return kFailure;
   }
+  intptr_t handle =
+      I->isolate()->ring_channels()->Add(channel, RingChannel::kProducer);
+  RETURN_SMI(handle);
 }
 
 
-DEFINE_PRIMITIVE(Object_markCanonical) {
+DEFINE_PRIMITIVE(RingChannel_openConsumer) {
   ASSERT(num_args == 1);
-  Object object = I->Stack(0);
-  if (object->IsHeapObject()) {
-    static_cast<HeapObject>(object)->set_is_canonical(true);
-  } else {
-    // Nop.
+  MINT_ARGUMENT(id, 0);
+  RingChannel* channel = RingChannel::OpenConsumer(id);
+  if (channel == nullptr) {
+    return kFailure;
   }
-  RETURN(object);
+  intptr_t handle =
+      I->isolate()->ring_channels()->Add(channel, RingChannel::kConsumer);
+  RETURN_SMI(handle);
 }
 
 
-DEFINE_PRIMITIVE(writeBytesToFile) {
-#if defined(OS_EMSCRIPTEN)
-  return kFailure;
-#else
-  ASSERT(num_args == 2);
-  ByteArray content = static_cast<ByteArray>(I->Stack(1));
-  String filename = static_cast<String>(I->Stack(0));
-  if (!content->IsByteArray() || !filename->IsString()) {
+DEFINE_PRIMITIVE(RingChannel_id) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(handle, 0);
+  RingChannel* channel =
+      I->isolate()->ring_channels()->Lookup(handle, RingChannel::kProducer);
+  if (channel == nullptr) {
     return kFailure;
   }
+  RETURN_MINT(channel->id());
+}
 
-  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
-  memcpy(raw_filename, filename->element_addr(0), filename->Size());
-  raw_filename[filename->Size()] = 0;
-  FILE* f = fopen(raw_filename, "wb");
-  if (f == NULL) {
-    FATAL("Cannot open %s\n", raw_filename);
+
+// Copies the bytes from start to stop, counting from 1, into the ring after
+// those reserved, if they fit, and answers whether they did.
+DEFINE_PRIMITIVE(RingChannel_reserve) {
+  ASSERT(num_args == 4);
+  SMI_ARGUMENT(handle, 3);
+  Bytes bytes = static_cast<Bytes>(I->Stack(2));
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  RingChannel* channel =
+      I->isolate()->ring_channels()->Lookup(handle, RingChannel::kProducer);
+  if ((channel == nullptr) || !bytes->IsBytes() ||
+      (start < 1) || (stop < start - 1) || (stop > bytes->Size())) {
+    return kFailure;
   }
+  RETURN_BOOL(channel->Reserve(bytes->element_addr(start - 1),
+                               stop - start + 1));
+}
 
-  size_t length = content->Size();
-  size_t start = 0;
-  while (start != length) {
-    size_t written = fwrite(content->element_addr(start), 1, length - start, f);
-    if (written == 0) {
-      FATAL("Failed to write '%s'\n", raw_filename);
-    }
-    start += written;
+
+DEFINE_PRIMITIVE(RingChannel_commit) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(handle, 0);
+  RingChannel* channel =
+      I->isolate()->ring_channels()->Lookup(handle, RingChannel::kProducer);
+  if (channel == nullptr) {
+    return kFailure;
   }
-  fflush(f);
-  fclose(f);
+  intptr_t count = channel->Commit();
+  RETURN_SMI(count);
+}
 
-  free(raw_filename);
 
-  RETURN_SELF();
-#endif
+// Copies committed bytes into the buffer from start up to stop, counting from
+// 1, and answers how many.
+DEFINE_PRIMITIVE(RingChannel_consume) {
+  ASSERT(num_args == 4);
+  SMI_ARGUMENT(handle, 3);
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  RingChannel* channel =
+      I->isolate()->ring_channels()->Lookup(handle, RingChannel::kConsumer);
+  if ((channel == nullptr) || !buffer->IsByteArray() ||
+      (start < 1) || (stop < start - 1) || (stop > buffer->Size())) {
+    return kFailure;
+  }
+  intptr_t count = channel->Consume(buffer->element_addr(start - 1),
+                                    stop - start + 1);
+  RETURN_SMI(count);
 }
 
 
-DEFINE_PRIMITIVE(readFileAsBytes) {
-#if defined(OS_EMSCRIPTEN)
-  return kFailure;
-#else
+DEFINE_PRIMITIVE(RingChannel_await) {
   ASSERT(num_args == 1);
-  String filename = static_cast<String>(I->Stack(0));
-  if (!filename->IsString()) {
+  SMI_ARGUMENT(handle, 0);
+  RingChannel* channel =
+      I->isolate()->ring_channels()->Lookup(handle, RingChannel::kConsumer);
+  if (channel == nullptr) {
     return kFailure;
   }
-
-  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
-  memcpy(raw_filename, filename->element_addr(0), filename->Size());
-  raw_filename[filename->Size()] = 0;
-  FILE* f = fopen(raw_filename, "rb");
-  if (f == NULL) {
-    FATAL("Failed to stat '%s'\n", raw_filename);
+  intptr_t id = channel->Await(I->isolate()->loop());
+  if (id == 0) {
+    return kFailure;
   }
-  struct stat st;
-  if (fstat(fileno(f), &st) != 0) {
-    FATAL("Failed to stat '%s'\n", raw_filename);
+  RETURN_SMI(id);
+}
+
+
+DEFINE_PRIMITIVE(RingChannel_close) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(handle, 0);
+  if (!I->isolate()->ring_channels()->Close(handle, I->isolate())) {
+    return kFailure;
   }
-  size_t length = st.st_size;
+  RETURN_SELF();
+}
 
-  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
-  size_t start = 0;
-  size_t remaining = length;
-  while (remaining > 0) {
-    size_t bytes_read = fread(result->element_addr(start), 1, remaining, f);
-    if (bytes_read == 0) {
-      FATAL("Failed to read '%s'\n", raw_filename);
-    }
-    start += bytes_read;
-    remaining -= bytes_read;
+
+DEFINE_PRIMITIVE(Transport_listen) {
+  ASSERT(num_args == 1);
+  String address = static_cast<String>(I->Stack(0));
+  if (!address->IsString()) {
+    return kFailure;
   }
+  char* raw_address = reinterpret_cast<char*>(malloc(address->Size() + 1));
+  memcpy(raw_address, address->element_addr(0), address->Size());
+  raw_address[address->Size()] = 0;
+  bool listening = Transport::Listen(raw_address);
+  free(raw_address);
+  RETURN_BOOL(listening);
+}
 
-  fclose(f);
-  free(raw_filename);
 
+DEFINE_PRIMITIVE(Transport_address) {
+  ASSERT(num_args == 0);
+  const char* address = Transport::address();
+  if (address == nullptr) {
+    RETURN(nil);
+  }
+  intptr_t length = strlen(address);
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), address, length);
   RETURN(result);
-#endif
 }
 
 
-DEFINE_PRIMITIVE(Double_class_parse) {
+// Answers 0 if the message was queued for the port at the address, as
+// transfer answers PortMap::kPosted, or 1 if it could not be.
+DEFINE_PRIMITIVE(Transport_send) {
+  ASSERT(num_args == 3);
+  String address = static_cast<String>(I->Stack(2));
+  MINT_ARGUMENT(port, 1);
+  ByteArray data = static_cast<ByteArray>(I->Stack(0));
+  if (!address->IsString() || !data->IsByteArray()) {
+    return kFailure;
+  }
+  char* raw_address = reinterpret_cast<char*>(malloc(address->Size() + 1));
+  memcpy(raw_address, address->element_addr(0), address->Size());
+  raw_address[address->Size()] = 0;
+  bool sent = Transport::Send(raw_address, port,
+                              data->element_addr(0), data->Size());
+  free(raw_address);
+  RETURN_SMI(sent ? PortMap::kPosted : PortMap::kClosed);
+}
+
+DEFINE_PRIMITIVE(Coroutine_new) {
   ASSERT(num_args == 1);
-  String string = static_cast<String>(I->Stack(0));
-  if (!string->IsString()) {
+  Closure body = static_cast<Closure>(I->Stack(0));
+  if (!body->IsClosure() || (body->num_args() != SmallInteger::New(1))) {
     return kFailure;
   }
-  double raw_result;
-  const char* cstr = reinterpret_cast<const char*>(string->element_addr(0));
-  intptr_t length = string->Size();
-  if (CStringToDouble(cstr, length, &raw_result)) {
-    RETURN_FLOAT(raw_result);
+  intptr_t handle = I->NewCoroutine(I->Stack(1), body);
+  if (handle == 0) {
+    return kFailure;
   }
-  return kFailure;
+  RETURN_SMI(handle);
 }
 
 
-DEFINE_PRIMITIVE(currentActivation) {
-  ASSERT(num_args == 0);
-  RETURN(I->CurrentActivation());  // SAFEPOINT
+DEFINE_PRIMITIVE(Coroutine_resume) {
+  ASSERT(num_args == 2);
+  SMI_ARGUMENT(handle, 1);
+  Object value = I->Stack(0);
+  if (!I->CanResumeCoroutine(handle)) {
+    return kFailure;
+  }
+  I->Drop(num_args + 1);
+  I->ResumeCoroutine(handle, value);
+  return kSuccess;
 }
 
 
-DEFINE_PRIMITIVE(Behavior_adoptInstance) {
-  ASSERT(num_args == 2);
-  Behavior new_cls = static_cast<Behavior>(I->Stack(1));
-  HeapObject instance = static_cast<HeapObject>(I->Stack(0));
-  Behavior old_cls = instance->Klass(H);
+DEFINE_PRIMITIVE(Coroutine_yield) {
+  ASSERT(num_args == 1);
+  Object value = I->Stack(0);
+  if (!I->InCoroutine()) {
+    return kFailure;
+  }
+  I->Drop(num_args + 1);
+  I->YieldCoroutine(value);
+  return kSuccess;
+}
 
-  ASSERT(old_cls->cid() >= kFirstRegularObjectCid);
-  ASSERT(old_cls->format() == new_cls->format());
 
-  SmallInteger id = new_cls->id();
-  if (id == nil) {
-    id = SmallInteger::New(H->AllocateClassId());  // SAFEPOINT
-    new_cls = static_cast<Behavior>(I->Stack(1));
-    instance = static_cast<HeapObject>(I->Stack(0));
-    new_cls->set_id(id);
-    H->RegisterClass(id->value(), new_cls);
+DEFINE_PRIMITIVE(Coroutine_close) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(handle, 0);
+  if (!I->CloseCoroutine(handle)) {
+    return kFailure;
   }
-  ASSERT(id->IsSmallInteger());
-  instance->set_cid(id->value());
-
   RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(openPort) {
-  ASSERT(num_args == 0);
-  Port new_port = I->isolate()->loop()->OpenPort();
-  RETURN_MINT(new_port);
+// Answers a socket's descriptor, or the errno value negated. The descriptor is
+// awaited with MessageLoop_awaitSignal.
+DEFINE_PRIMITIVE(Socket_connect) {
+  ASSERT(num_args == 1);
+  String address = static_cast<String>(I->Stack(0));
+  if (!address->IsString()) {
+    return kFailure;
+  }
+  char* raw_address = reinterpret_cast<char*>(malloc(address->Size() + 1));
+  memcpy(raw_address, address->element_addr(0), address->Size());
+  raw_address[address->Size()] = 0;
+  intptr_t fd = Sockets::Connect(raw_address);
+  intptr_t error = errno;
+  free(raw_address);
+  RETURN_SMI(fd < 0 ? -error : fd);
 }
 
 
-DEFINE_PRIMITIVE(closePort) {
-  ASSERT(num_args == 1);
-  MINT_ARGUMENT(port, 0);
-  I->isolate()->loop()->ClosePort(port);
-  RETURN_SELF();
+// Answers as Socket_connect.
+DEFINE_PRIMITIVE(Socket_listen) {
+  ASSERT(num_args == 2);
+  String address = static_cast<String>(I->Stack(1));
+  SMI_ARGUMENT(backlog, 0);
+  if (!address->IsString() || (backlog < 1)) {
+    return kFailure;
+  }
+  char* raw_address = reinterpret_cast<char*>(malloc(address->Size() + 1));
+  memcpy(raw_address, address->element_addr(0), address->Size());
+  raw_address[address->Size()] = 0;
+  intptr_t fd = Sockets::Listen(raw_address, backlog);
+  intptr_t error = errno;
+  free(raw_address);
+  RETURN_SMI(fd < 0 ? -error : fd);
 }
 
 
-DEFINE_PRIMITIVE(spawn) {
+// Answers as Socket_connect, or nil if no connection is waiting.
+DEFINE_PRIMITIVE(Socket_accept) {
   ASSERT(num_args == 1);
-  ByteArray message = static_cast<ByteArray>(I->Stack(0));
-  if (message->IsByteArray()) {
-    intptr_t length = message->Size();
-    uint8_t* data = reinterpret_cast<uint8_t*>(malloc(length));
-    memcpy(data, message->element_addr(0), length);
+  SMI_ARGUMENT(fd, 0);
+  if (fd < 0) {
+    return kFailure;
+  }
+  intptr_t result = Sockets::Accept(fd);
+  if ((result < 0) && (errno == EAGAIN)) {
+    RETURN(nil);
+  }
+  RETURN_SMI(result < 0 ? -errno : result);
+}
 
-    I->isolate()->Spawn(new IsolateMessage(ILLEGAL_PORT, data, length));
 
-    RETURN_SELF();
+// Reads into the buffer from start up to stop, counting from 1, and answers
+// how many bytes were read, 0 at the end of a stream, the errno value
+// negated, or nil if none are ready. Nothing is allocated, so one buffer
+// serves every read.
+DEFINE_PRIMITIVE(Socket_read) {
+  ASSERT(num_args == 4);
+  SMI_ARGUMENT(fd, 3);
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  if ((fd < 0) || !buffer->IsByteArray() ||
+      (start < 1) || (stop < start - 1) || (stop > buffer->Size())) {
+    return kFailure;
   }
+  intptr_t count = Sockets::Read(fd, buffer->element_addr(start - 1),
+                                 stop - start + 1);
+  if ((count < 0) && (errno == EAGAIN)) {
+    RETURN(nil);
+  }
+  RETURN_SMI(count < 0 ? -errno : count);
+}
 
-  return kFailure;
+
+// Writes from the bytes from start to stop, and answers how many were
+// written, the errno value negated, or nil if the socket has no room.
+DEFINE_PRIMITIVE(Socket_write) {
+  ASSERT(num_args == 4);
+  SMI_ARGUMENT(fd, 3);
+  Bytes bytes = static_cast<Bytes>(I->Stack(2));
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  if ((fd < 0) || !bytes->IsBytes() ||
+      (start < 1) || (stop < start - 1) || (stop > bytes->Size())) {
+    return kFailure;
+  }
+  intptr_t count = Sockets::Write(fd, bytes->element_addr(start - 1),
+                                  stop - start + 1);
+  if ((count < 0) && (errno == EAGAIN)) {
+    RETURN(nil);
+  }
+  RETURN_SMI(count < 0 ? -errno : count);
 }
 
 
-DEFINE_PRIMITIVE(send) {
-  ASSERT(num_args == 2);
-  MINT_ARGUMENT(port, 1);
-  ByteArray data = static_cast<ByteArray>(I->Stack(0));
-  if (!data->IsByteArray()) {
+// Answers 0 or an errno value.
+DEFINE_PRIMITIVE(Socket_pendingError) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(fd, 0);
+  if (fd < 0) {
     return kFailure;
   }
+  RETURN_SMI(Sockets::PendingError(fd));
+}
 
-  intptr_t length = data->Size();
-  uint8_t* raw_data = reinterpret_cast<uint8_t*>(malloc(length));
-  memcpy(raw_data, data->element_addr(0), length);
-  IsolateMessage* message = new IsolateMessage(port, raw_data, length);
-  bool result = PortMap::PostMessage(message);
 
-  RETURN_BOOL(result);
+// Answers the port, or the errno value negated.
+DEFINE_PRIMITIVE(Socket_localPort) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(fd, 0);
+  if (fd < 0) {
+    return kFailure;
+  }
+  intptr_t port = Sockets::LocalPort(fd);
+  RETURN_SMI(port < 0 ? -errno : port);
 }
 
 
-DEFINE_PRIMITIVE(MessageLoop_finish) {
+// Answers 0 or an errno value. A wait on the descriptor must be cancelled
+// first.
+DEFINE_PRIMITIVE(Socket_close) {
   ASSERT(num_args == 1);
-  MINT_ARGUMENT(new_wakeup, 0);
-  I->isolate()->loop()->MessageEpilogue(new_wakeup);
-  I->ReturnFromDispatch();
-  I->Exit();
-  UNREACHABLE();
-  return kFailure;
+  SMI_ARGUMENT(fd, 0);
+  if (fd < 0) {
+    return kFailure;
+  }
+  intptr_t status = Sockets::Close(fd) == 0 ? 0 : errno;
+  RETURN_SMI(status);
 }
 
 
@@ -3113,6 +5356,9 @@ DEFINE_PRIMITIVE(MessageLoop_awaitSignal) {
   ASSERT(num_args == 2);
   SMI_ARGUMENT(handle, 1);
   SMI_ARGUMENT(signals, 0);
+  if (TraceEvents::enabled()) {
+    TraceEvents::Record(TraceEvents::kInstant, "await signal", I->isolate());
+  }
   intptr_t wait_id = I->isolate()->loop()->AwaitSignal(handle, signals);
   RETURN_SMI(wait_id);
 }
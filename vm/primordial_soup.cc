@@ -4,26 +4,65 @@
 
 #include "vm/primordial_soup.h"
 
+#include "vm/compressed_snapshot.h"
 #include "vm/flags.h"
 #include "vm/globals.h"
+#include "vm/heap.h"
+#include "vm/heap_dump.h"
+#include "vm/host_port.h"
 #include "vm/isolate.h"
 #include "vm/message_loop.h"
+#include "vm/numa.h"
 #include "vm/os.h"
+#include "vm/perf_counters.h"
 #include "vm/port.h"
 #include "vm/primitives.h"
+#include "vm/ring_channel.h"
 #include "vm/snapshot.h"
 #include "vm/thread.h"
+#include "vm/trace_events.h"
+#include "vm/transport.h"
+
+static PrimordialSoup_GCEventCallback gc_event_callback = NULL;
+
+static void DispatchGCEvent(const psoup::GCEvent& event) {
+  PrimordialSoup_GCEvent c_event;
+  c_event.sequence = event.sequence;
+  c_event.kind = event.kind == psoup::GCEvent::kScavenge
+      ? "scavenge" : "mark-sweep";
+  c_event.reason = psoup::Heap::ReasonToCString(
+      static_cast<psoup::Heap::Reason>(event.reason));
+  c_event.parallel = (event.flags & psoup::GCEvent::kParallel) != 0;
+  c_event.remark = (event.flags & psoup::GCEvent::kRemark) != 0;
+  c_event.evacuate = (event.flags & psoup::GCEvent::kEvacuate) != 0;
+  c_event.start_nanos = event.start;
+  c_event.end_nanos = event.end;
+  c_event.size_before = event.size_before;
+  c_event.size_after = event.size_after;
+  c_event.tenured = event.tenured;
+  c_event.remembered_set_size = event.remembered_set_size;
+  c_event.class_table_size = event.class_table_size;
+  c_event.tenuring_threshold = event.tenuring_threshold;
+  gc_event_callback(psoup::Isolate::Current(), &c_event);
+}
+
 
 PSOUP_EXTERN_C void PrimordialSoup_Startup() {
   psoup::OS::Startup();
   psoup::Primitives::Startup();
   psoup::PortMap::Startup();
+  psoup::RingChannel::Startup();
+  psoup::Transport::Startup();
   psoup::Isolate::Startup();
+  psoup::HostPort::Startup();
 }
 
 
 PSOUP_EXTERN_C void PrimordialSoup_Shutdown() {
+  psoup::Transport::Shutdown();
   psoup::Isolate::Shutdown();
+  psoup::HostPort::Shutdown();
+  psoup::RingChannel::Shutdown();
   psoup::PortMap::Shutdown();
   psoup::Primitives::Shutdown();
   psoup::OS::Shutdown();
@@ -34,16 +73,326 @@ PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolate(void* snapshot,
                                                   size_t snapshot_length,
                                                   int argc,
                                                   const char** argv) {
+  return PrimordialSoup_RunIsolateWithPolicy(snapshot, snapshot_length,
+                                             argc, argv, NULL);
+}
+
+
+static psoup::Isolate* NewIsolate(void* snapshot, size_t snapshot_length,
+                                  const PrimordialSoup_HeapPolicy* policy) {
+  psoup::HeapPolicy heap_policy;
+  if (policy != NULL) {
+    heap_policy.initial_semispace_capacity = policy->initial_new_space_size;
+    heap_policy.max_semispace_capacity = policy->max_new_space_size;
+    heap_policy.old_growth_percent = policy->old_space_growth_percent;
+    heap_policy.retained_free_size = policy->retained_free_space_size;
+    heap_policy.max_size = policy->max_heap_size;
+    heap_policy.max_stack_size = policy->max_stack_size;
+    heap_policy.idle_collection_delay =
+        policy->idle_collection_millis * kNanosecondsPerMillisecond;
+  }
+  if (psoup::CompressedSnapshot::IsCompressed(snapshot, snapshot_length)) {
+    snapshot = psoup::CompressedSnapshot::Decompress(snapshot, snapshot_length,
+                                                     &snapshot_length);
+  }
   uint64_t seed = psoup::OS::CurrentMonotonicNanos();
-  psoup::Isolate* isolate = new psoup::Isolate(snapshot, snapshot_length, seed);
+  return new psoup::Isolate(snapshot, snapshot_length, seed, heap_policy);
+}
+
+
+static intptr_t RunIsolate(psoup::Isolate* isolate,
+                           int argc, const char** argv) {
   isolate->loop()->PostMessage(new psoup::IsolateMessage(ILLEGAL_PORT,
                                                          argc, argv));
-  intptr_t exit_code = isolate->loop()->Run();
+  return isolate->loop()->Run();
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolateWithPolicy(
+    void* snapshot, size_t snapshot_length, int argc, const char** argv,
+    const PrimordialSoup_HeapPolicy* policy) {
+  psoup::Isolate* isolate = NewIsolate(snapshot, snapshot_length, policy);
+  psoup::Isolate::WarmPool(isolate);
+  intptr_t exit_code = RunIsolate(isolate, argc, argv);
   delete isolate;
   return exit_code;
 }
 
 
+PSOUP_EXTERN_C void* PrimordialSoup_LoadIsolate(
+    void* snapshot, size_t snapshot_length,
+    const PrimordialSoup_HeapPolicy* policy) {
+  if (psoup::MessageLoop::HasScheduler()) {
+    FATAL("Cannot fork scheduled isolates");
+  }
+  return NewIsolate(snapshot, snapshot_length, policy);
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunForkedIsolate(void* isolate,
+                                                        int argc,
+                                                        const char** argv) {
+  psoup::Isolate* forked = reinterpret_cast<psoup::Isolate*>(isolate);
+  forked->AfterFork();
+  intptr_t exit_code = RunIsolate(forked, argc, argv);
+  delete forked;
+  return exit_code;
+}
+
+
+PSOUP_EXTERN_C void* PrimordialSoup_StartIsolate(
+    void* snapshot, size_t snapshot_length, int argc, const char** argv,
+    const PrimordialSoup_HeapPolicy* policy) {
+  psoup::Isolate* isolate = NewIsolate(snapshot, snapshot_length, policy);
+  if (!isolate->UseDrivenLoop()) {
+    delete isolate;
+    return NULL;
+  }
+  isolate->loop()->PostMessage(new psoup::IsolateMessage(ILLEGAL_PORT,
+                                                         argc, argv));
+  // The isolate is only current while it runs, so the host may run others
+  // on the same thread.
+  psoup::Isolate::SetCurrent(NULL);
+  return isolate;
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_IsolateDescriptor(void* isolate) {
+  return reinterpret_cast<psoup::Isolate*>(isolate)->loop()->WaitHandle();
+}
+
+
+PSOUP_EXTERN_C int PrimordialSoup_RunUntilIdle(void* isolate,
+                                               int64_t* timeout_millis) {
+  psoup::Isolate* driven = reinterpret_cast<psoup::Isolate*>(isolate);
+  psoup::Isolate* previous = psoup::Isolate::Current();
+  psoup::Isolate::SetCurrent(driven);
+  int64_t timeout;
+  bool running = driven->loop()->RunUntilIdle(&timeout);
+  psoup::Isolate::SetCurrent(previous);
+  if (!running) {
+    return 0;
+  }
+  // Rounded up, so the host does not call again before a wakeup is due.
+  *timeout_millis = timeout < 0 ? -1 :
+      (timeout + kNanosecondsPerMillisecond - 1) / kNanosecondsPerMillisecond;
+  return 1;
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_DeleteIsolate(void* isolate) {
+  psoup::Isolate* driven = reinterpret_cast<psoup::Isolate*>(isolate);
+  psoup::Isolate* previous = psoup::Isolate::Current();
+  psoup::Isolate::SetCurrent(driven);
+  psoup::MessageLoop* loop = driven->loop();
+  if (!loop->exited()) {
+    loop->Exit(0);
+  }
+  int64_t timeout;
+  loop->RunUntilIdle(&timeout);  // Only closes its ports.
+  intptr_t exit_code = loop->exit_code();
+  delete driven;
+  psoup::Isolate::SetCurrent(previous);
+  return exit_code;
+}
+
+
 PSOUP_EXTERN_C void PrimordialSoup_InterruptAll() {
   psoup::Isolate::InterruptAll();
 }
+
+
+PSOUP_EXTERN_C void PrimordialSoup_SetIsolatePoolSize(intptr_t size) {
+  psoup::Isolate::SetPoolSize(size);
+}
+
+
+PSOUP_EXTERN_C void PrimordialSoup_SetPerfCounting(int enable) {
+  psoup::PerfCounters::SetCountFromStart(enable != 0);
+}
+
+
+PSOUP_EXTERN_C int PrimordialSoup_SetNumaPlacement(int enable) {
+  return psoup::Numa::SetSpreadIsolates(enable != 0) ? 1 : 0;
+}
+
+
+PSOUP_EXTERN_C int PrimordialSoup_Listen(const char* address) {
+  return psoup::Transport::Listen(address) ? 1 : 0;
+}
+
+
+static void CopyLatency(const psoup::LatencySummary& from,
+                        PrimordialSoup_LatencySummary* to) {
+  to->count = from.count;
+  to->total = from.total;
+  to->p50 = from.p50;
+  to->p90 = from.p90;
+  to->p99 = from.p99;
+  to->p999 = from.p999;
+  to->max = from.max;
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_GetIsolateMetrics(
+    PrimordialSoup_IsolateMetrics* metrics, intptr_t capacity) {
+  if (capacity < 0) {
+    capacity = 0;
+  }
+  psoup::IsolateMetrics* taken = new psoup::IsolateMetrics[capacity];
+  psoup::Isolate** isolates = new psoup::Isolate*[capacity];
+  intptr_t count = psoup::Isolate::GetAllMetrics(taken, isolates, capacity);
+  for (intptr_t i = 0; (i < count) && (i < capacity); i++) {
+    metrics[i].isolate = isolates[i];
+    metrics[i].heap_size = taken[i].heap_size;
+    metrics[i].old_size = taken[i].old_size;
+    metrics[i].old_capacity = taken[i].old_capacity;
+    metrics[i].semispace_capacity = taken[i].semispace_capacity;
+    metrics[i].scavenges = taken[i].scavenges;
+    metrics[i].scavenge_nanos = taken[i].scavenge_nanos;
+    metrics[i].mark_sweeps = taken[i].mark_sweeps;
+    metrics[i].mark_sweep_nanos = taken[i].mark_sweep_nanos;
+    metrics[i].messages_queued = taken[i].messages_queued;
+    metrics[i].messages_dispatched = taken[i].messages_dispatched;
+    metrics[i].lookup_cache_hits = taken[i].lookup_cache_hits;
+    metrics[i].lookup_cache_misses = taken[i].lookup_cache_misses;
+    metrics[i].cpu_nanos = taken[i].cpu_nanos;
+    CopyLatency(taken[i].latencies[psoup::kMessageWait],
+                &metrics[i].message_wait);
+    CopyLatency(taken[i].latencies[psoup::kMessageRun],
+                &metrics[i].message_run);
+    CopyLatency(taken[i].latencies[psoup::kWakeupWait],
+                &metrics[i].wakeup_wait);
+    CopyLatency(taken[i].latencies[psoup::kWakeupRun],
+                &metrics[i].wakeup_run);
+    CopyLatency(taken[i].latencies[psoup::kSignalWait],
+                &metrics[i].signal_wait);
+    CopyLatency(taken[i].latencies[psoup::kSignalRun],
+                &metrics[i].signal_run);
+  }
+  delete[] taken;
+  delete[] isolates;
+  return count;
+}
+
+
+PSOUP_EXTERN_C void PrimordialSoup_StartTracing(const char* filename) {
+  psoup::TraceEvents::Start(filename);
+}
+
+
+PSOUP_EXTERN_C int PrimordialSoup_StopTracing() {
+  return psoup::TraceEvents::Stop() ? 1 : 0;
+}
+
+
+PSOUP_EXTERN_C void PrimordialSoup_SetGCEventCallback(
+    PrimordialSoup_GCEventCallback callback) {
+  gc_event_callback = callback;
+  psoup::Heap::SetGCEventCallback(callback == NULL ? NULL : DispatchGCEvent);
+}
+
+
+PSOUP_EXTERN_C int PrimordialSoup_WriteHeapDump(void* isolate,
+                                                const char* filename) {
+  psoup::Isolate* current = psoup::Isolate::Current();
+  if ((current == NULL) || (current != isolate)) {
+    return 0;
+  }
+  return psoup::HeapDump::Write(current->heap(), filename) ? 1 : 0;
+}
+
+
+PSOUP_EXTERN_C int PrimordialSoup_PostMessages(int64_t port,
+                                               const void* const* messages,
+                                               const size_t* lengths,
+                                               intptr_t count) {
+  if (count == 0) {
+    return 1;
+  }
+  psoup::IsolateMessage* first = NULL;
+  psoup::IsolateMessage* last = NULL;
+  for (intptr_t i = 0; i < count; i++) {
+    psoup::IsolateMessage* message = psoup::IsolateMessage::NewBytes(
+        port, reinterpret_cast<const uint8_t*>(messages[i]), lengths[i]);
+    if (first == NULL) {
+      first = message;
+    } else {
+      last->set_next(message);
+    }
+    last = message;
+  }
+  switch (psoup::PortMap::PostMessages(port, first, last)) {
+    case psoup::PortMap::kPosted:
+      return 1;
+    case psoup::PortMap::kClosed:
+      return 0;
+    case psoup::PortMap::kFull:
+      return -1;
+  }
+  UNREACHABLE();
+  return 0;
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_PostMessageToAll(const int64_t* ports,
+                                                        intptr_t num_ports,
+                                                        const void* message,
+                                                        size_t length) {
+  intptr_t delivered = 0;
+  for (intptr_t i = 0; i < num_ports; i++) {
+    psoup::IsolateMessage* isolate_message = psoup::IsolateMessage::NewBytes(
+        ports[i], reinterpret_cast<const uint8_t*>(message), length);
+    if (psoup::PortMap::PostMessage(isolate_message) ==
+        psoup::PortMap::kPosted) {
+      delivered++;
+    }
+  }
+  return delivered;
+}
+
+
+PSOUP_EXTERN_C PrimordialSoup_Message* PrimordialSoup_NewMessage(
+    int64_t port, size_t length) {
+  return reinterpret_cast<PrimordialSoup_Message*>(
+      psoup::IsolateMessage::NewUninitializedBytes(port, length));
+}
+
+
+PSOUP_EXTERN_C void* PrimordialSoup_MessageData(
+    PrimordialSoup_Message* message) {
+  return reinterpret_cast<psoup::IsolateMessage*>(message)->bytes();
+}
+
+
+PSOUP_EXTERN_C int PrimordialSoup_PostMessage(
+    PrimordialSoup_Message* message) {
+  switch (psoup::PortMap::PostMessage(
+              reinterpret_cast<psoup::IsolateMessage*>(message))) {
+    case psoup::PortMap::kPosted:
+      return 1;
+    case psoup::PortMap::kClosed:
+      return 0;
+    case psoup::PortMap::kFull:
+      return -1;
+  }
+  UNREACHABLE();
+  return 0;
+}
+
+
+PSOUP_EXTERN_C void PrimordialSoup_DeleteMessage(
+    PrimordialSoup_Message* message) {
+  delete reinterpret_cast<psoup::IsolateMessage*>(message);
+}
+
+
+PSOUP_EXTERN_C int64_t PrimordialSoup_OpenHostPort(
+    PrimordialSoup_MessageCallback callback, void* context) {
+  return psoup::HostPort::Open(callback, context);
+}
+
+
+PSOUP_EXTERN_C int PrimordialSoup_CloseHostPort(int64_t port) {
+  return psoup::HostPort::Close(port) ? 1 : 0;
+}
@@ -16,11 +16,220 @@
 #define PSOUP_EXTERN_C
 #endif
 
+/* How an isolate's heap grows. Zero fields take the defaults. Isolates
+ * spawned by the program inherit the policy. */
+typedef struct {
+  /* Capacity of each new-space semispace at startup and at most. */
+  size_t initial_new_space_size;
+  size_t max_new_space_size;
+  /* How far old-space may grow past its live size before the next full
+   * collection, as a percentage of the live size. */
+  intptr_t old_space_growth_percent;
+  /* Bytes of empty old-space kept mapped for reuse after a collection. */
+  size_t retained_free_space_size;
+  /* Bytes of objects beyond which allocations signal OutOfMemory, or 0 for no
+   * limit. */
+  size_t max_heap_size;
+  /* Bytes the interpreter's stack may grow to before deep recursion moves
+   * frames to the heap. */
+  size_t max_stack_size;
+  /* Milliseconds an isolate waits for messages before its heap is collected
+   * and shrunk, or 0 for never. */
+  int64_t idle_collection_millis;
+} PrimordialSoup_HeapPolicy;
+
+/* A record of one garbage collection. Sizes are bytes held by objects, and
+ * times are monotonic nanoseconds. */
+typedef struct {
+  int64_t sequence; /* Counts the isolate's collections from 0. */
+  const char* kind; /* "scavenge" or "mark-sweep". */
+  const char* reason;
+  int parallel;
+  int remark;
+  int evacuate;
+  int64_t start_nanos;
+  int64_t end_nanos;
+  int64_t size_before;
+  int64_t size_after;
+  int64_t tenured;
+  int64_t remembered_set_size;
+  int64_t class_table_size;
+  /* Scavenges a new object survives before the next tenures it. */
+  int64_t tenuring_threshold;
+} PrimordialSoup_GCEvent;
+
+/* Called on the isolate's thread at the end of every collection pause. */
+typedef void (*PrimordialSoup_GCEventCallback)(
+    void* isolate, const PrimordialSoup_GCEvent* event);
+
 PSOUP_EXTERN_C void PrimordialSoup_Startup();
 PSOUP_EXTERN_C void PrimordialSoup_Shutdown();
+/* The snapshot may be compressed, in which case it is decompressed first and
+   kept until shutdown. */
 PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolate(void* snapshot,
                                                   size_t snapshot_length,
                                                   int argc, const char** argv);
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolateWithPolicy(
+    void* snapshot, size_t snapshot_length, int argc, const char** argv,
+    const PrimordialSoup_HeapPolicy* policy);
+/* For a process that reads a snapshot once and then forks a child for each
+ * run of it, each child sharing the loaded heap copy-on-write. Answers an
+ * isolate that has read the snapshot but not yet run. Not with scheduled
+ * isolates. */
+PSOUP_EXTERN_C void* PrimordialSoup_LoadIsolate(
+    void* snapshot, size_t snapshot_length,
+    const PrimordialSoup_HeapPolicy* policy);
+/* In a child forked from the process that loaded |isolate|, while no other
+ * isolate ran there. Runs it on |argc| and |argv| until it exits, then
+ * deletes it and answers its exit code. */
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunForkedIsolate(void* isolate,
+                                                        int argc,
+                                                        const char** argv);
+/* For a host that runs an isolate from its own event loop instead of giving
+ * it a thread. Answers an isolate that has read the snapshot and been posted
+ * |argc| and |argv|, which must stay valid until its first run, but that only
+ * runs in PrimordialSoup_RunUntilIdle. Answers NULL where the message loop
+ * cannot be run this way; it can on Linux, Android and macOS. */
+PSOUP_EXTERN_C void* PrimordialSoup_StartIsolate(
+    void* snapshot, size_t snapshot_length, int argc, const char** argv,
+    const PrimordialSoup_HeapPolicy* policy);
+/* For the host to poll for reading along with its own descriptors. It is
+ * readable whenever the isolate has something to run. */
+PSOUP_EXTERN_C intptr_t PrimordialSoup_IsolateDescriptor(void* isolate);
+/* Runs everything the isolate has ready on the calling thread, without
+ * waiting, from one thread at a time. Returns 1 while the isolate runs, with
+ * |*timeout_millis| set to how long the host may wait for the descriptor
+ * before calling again, or -1 for as long as it is not readable. Returns 0
+ * once the isolate has exited. */
+PSOUP_EXTERN_C int PrimordialSoup_RunUntilIdle(void* isolate,
+                                               int64_t* timeout_millis);
+/* Ends an isolate from PrimordialSoup_StartIsolate if it has not exited,
+ * deletes it and returns its exit code. */
+PSOUP_EXTERN_C intptr_t PrimordialSoup_DeleteIsolate(void* isolate);
 PSOUP_EXTERN_C void PrimordialSoup_InterruptAll();
+/* How many idle isolates to keep loaded ahead of spawns, for each snapshot and
+ * heap policy, so a spawn does not wait for its snapshot to be read. 0, the
+ * default, keeps none. Set after startup and before running any isolate. */
+PSOUP_EXTERN_C void PrimordialSoup_SetIsolatePoolSize(intptr_t size);
+/* Whether every isolate counts hardware events by phase from its start, and
+ * prints the totals to stderr when it exits. See vm/perf_counters.h. Set
+ * after startup and before running any isolate. */
+PSOUP_EXTERN_C void PrimordialSoup_SetPerfCounting(int enable);
+/* Whether spawned isolates are spread over the machine's NUMA nodes in turn,
+ * each running pinned to its node's CPUs with its heap on that node's memory.
+ * See vm/numa.h. Set after startup and before running any isolate. Returns 0
+ * if the nodes are unknown, leaving isolates unplaced. */
+PSOUP_EXTERN_C int PrimordialSoup_SetNumaPlacement(int enable);
+/* Accepts messages from other processes for this process's ports at
+ * |address|, "tcp:<host>:<port>" or "unix:<path>". See vm/transport.h. Call
+ * after startup. Returns 0 if the address cannot be listened at. */
+PSOUP_EXTERN_C int PrimordialSoup_Listen(const char* address);
+/* Records isolates starting and exiting, messages being posted and dispatched,
+ * waits for signals and GC pauses on every thread, for writing to |filename|
+ * when stopped: as Chrome trace event JSON if it ends in ".json", otherwise as
+ * a Perfetto trace. See vm/trace_events.h. Start after startup and before
+ * running any isolate. Stopping returns 0 if the trace could not be
+ * written. */
+PSOUP_EXTERN_C void PrimordialSoup_StartTracing(const char* filename);
+PSOUP_EXTERN_C int PrimordialSoup_StopTracing();
+/* Nanoseconds. Percentiles overstate by at most 1/16. */
+typedef struct {
+  int64_t count;
+  int64_t total;
+  int64_t p50;
+  int64_t p90;
+  int64_t p99;
+  int64_t p999;
+  int64_t max;
+} PrimordialSoup_LatencySummary;
+typedef struct {
+  void* isolate;
+  int64_t heap_size;
+  int64_t old_size;
+  int64_t old_capacity;
+  int64_t semispace_capacity;
+  int64_t scavenges;
+  int64_t scavenge_nanos;
+  int64_t mark_sweeps;
+  int64_t mark_sweep_nanos;
+  int64_t messages_queued;
+  int64_t messages_dispatched;
+  int64_t lookup_cache_hits;
+  int64_t lookup_cache_misses;
+  int64_t cpu_nanos;  /* Spent in finished dispatches, including GC. */
+  /* How long messages, wakeups and signals waited to be dispatched, from
+   * being posted or falling due, and how long their handlers ran. */
+  PrimordialSoup_LatencySummary message_wait;
+  PrimordialSoup_LatencySummary message_run;
+  PrimordialSoup_LatencySummary wakeup_wait;
+  PrimordialSoup_LatencySummary wakeup_run;
+  PrimordialSoup_LatencySummary signal_wait;
+  PrimordialSoup_LatencySummary signal_run;
+} PrimordialSoup_IsolateMetrics;
+/* Fills in |metrics| for up to |capacity| of the isolates loaded, including
+ * idle ones in the pool, and returns how many there are. The metrics are kept
+ * up as the isolates run, so taking them is cheap, and may be called from any
+ * thread; those of isolates running meanwhile may be slightly out of date. */
+PSOUP_EXTERN_C intptr_t PrimordialSoup_GetIsolateMetrics(
+    PrimordialSoup_IsolateMetrics* metrics, intptr_t capacity);
+/* Applies to every isolate. Set before running any, or NULL to remove. */
+PSOUP_EXTERN_C void PrimordialSoup_SetGCEventCallback(
+    PrimordialSoup_GCEventCallback callback);
+/* Writes the isolate's whole object graph to |filename| in the format described
+ * in vm/heap_dump.h. Only on the isolate's own thread, such as from a GC event
+ * callback. Returns 0 on failure. */
+PSOUP_EXTERN_C int PrimordialSoup_WriteHeapDump(void* isolate,
+                                                const char* filename);
+
+/* Posts |count| messages of |lengths[i]| bytes from |messages[i]| to |port| in
+ * one step, to be delivered in order. Each message is a serialized object, as
+ * a Port's handler receives it. Returns 1 if they were posted, 0 if the port
+ * is closed, or -1 if they would exceed the port's capacity, in which case
+ * none were posted. */
+PSOUP_EXTERN_C int PrimordialSoup_PostMessages(int64_t port,
+                                               const void* const* messages,
+                                               const size_t* lengths,
+                                               intptr_t count);
+/* Posts one message to each of |num_ports| ports. Returns how many of them
+ * were open and not full. */
+PSOUP_EXTERN_C intptr_t PrimordialSoup_PostMessageToAll(const int64_t* ports,
+                                                        intptr_t num_ports,
+                                                        const void* message,
+                                                        size_t length);
+
+/* A message the host fills in place instead of having it copied: large
+ * messages are laid out as the ByteArray the receiving isolate adopts, so
+ * their bytes are never copied at all. The |length| bytes at
+ * PrimordialSoup_MessageData are a serialized object, as for
+ * PrimordialSoup_PostMessages. */
+typedef struct PrimordialSoup_Message PrimordialSoup_Message;
+PSOUP_EXTERN_C PrimordialSoup_Message* PrimordialSoup_NewMessage(int64_t port,
+                                                                 size_t length);
+PSOUP_EXTERN_C void* PrimordialSoup_MessageData(
+    PrimordialSoup_Message* message);
+/* Takes |message|, posted or not. Returns as PrimordialSoup_PostMessages. */
+PSOUP_EXTERN_C int PrimordialSoup_PostMessage(PrimordialSoup_Message* message);
+/* For a message the host decides not to post. */
+PSOUP_EXTERN_C void PrimordialSoup_DeleteMessage(
+    PrimordialSoup_Message* message);
+
+/* Called with each message sent to a host port, on a thread of the VM's, one
+ * at a time and in the order they were posted. |data| is only valid during
+ * the call. It is serialized by the Newspeak Serializer, or if |is_object|,
+ * by the VM's MessageSerializer; see vm/snapshot.h. */
+typedef void (*PrimordialSoup_MessageCallback)(void* context,
+                                               int64_t port,
+                                               const void* data,
+                                               size_t length,
+                                               int is_object);
+/* Opens a port whose messages go to |callback| instead of an isolate, and
+ * returns its id, for the host to pass to an isolate, such as in its
+ * arguments. Call after startup. */
+PSOUP_EXTERN_C int64_t PrimordialSoup_OpenHostPort(
+    PrimordialSoup_MessageCallback callback, void* context);
+/* Drops the messages not yet handed to the callback. A call under way may
+ * finish after this returns, but no other is made. Returns 0 if |port| is not
+ * an open host port. */
+PSOUP_EXTERN_C int PrimordialSoup_CloseHostPort(int64_t port);
 
 #endif /* VM_PRIMORDIAL_SOUP_H_ */
@@ -15,6 +15,10 @@ class Random {
     state0_ = seed;
     state1_ = 0;
   }
+  Random(uint64_t state0, uint64_t state1) {
+    state0_ = state0;
+    state1_ = state1;
+  }
 
   uint64_t NextUInt64() {
     uint64_t s1 = state0_;
@@ -26,6 +30,9 @@ class Random {
     return result;
   }
 
+  uint64_t state0() const { return state0_; }
+  uint64_t state1() const { return state1_; }
+
  private:
   uint64_t state0_;
   uint64_t state1_;
@@ -0,0 +1,256 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/ring_channel.h"
+
+#include <new>
+#include <string.h>
+
+#include "vm/assert.h"
+#include "vm/isolate.h"
+#include "vm/lockers.h"
+#include "vm/message_loop.h"
+#include "vm/thread.h"
+#include "vm/utils.h"
+
+namespace psoup {
+
+static constexpr intptr_t kMaxCapacity = 1 * GB;
+
+Mutex* RingChannel::mutex_ = nullptr;
+RingChannel* RingChannel::channels_ = nullptr;
+int64_t RingChannel::last_id_ = 0;
+
+void RingChannel::Startup() {
+  mutex_ = new Mutex();
+}
+
+void RingChannel::Shutdown() {
+  delete mutex_;
+  mutex_ = nullptr;
+}
+
+RingChannel::RingChannel(int64_t id, const VirtualMemory& memory,
+                         intptr_t capacity)
+    : id_(id), memory_(memory),
+      shared_(new (reinterpret_cast<void*>(memory.base())) Shared()),
+      ring_(reinterpret_cast<uint8_t*>(memory.limit() - capacity)),
+      mask_(capacity - 1), reserved_(0), next_(nullptr),
+      consumer_opened_(false), producer_closed_(false),
+      consumer_closed_(false) {
+  shared_->tail.store(0);
+  shared_->head.store(0);
+  shared_->waiting.store(ILLEGAL_PORT);
+  shared_->wait_id.store(0);
+  shared_->finished.store(false);
+}
+
+RingChannel::~RingChannel() {
+  shared_->~Shared();
+  memory_.Free();
+}
+
+// static
+RingChannel* RingChannel::New(intptr_t capacity) {
+  if ((capacity <= 0) || (capacity > kMaxCapacity)) {
+    return nullptr;
+  }
+  intptr_t rounded = 1;
+  while (rounded < capacity) {
+    rounded <<= 1;
+  }
+  // The ring starts on a page of its own after the positions.
+  intptr_t header = Utils::RoundUp(static_cast<intptr_t>(sizeof(Shared)),
+                                   VirtualMemory::PageSize());
+  VirtualMemory memory = VirtualMemory::Allocate(
+      header + rounded, VirtualMemory::kReadWrite, "ring-channel");
+
+  MutexLocker locker(mutex_);
+  RingChannel* channel = new RingChannel(++last_id_, memory, rounded);
+  channel->next_ = channels_;
+  channels_ = channel;
+  return channel;
+}
+
+// static
+RingChannel* RingChannel::OpenConsumer(int64_t id) {
+  MutexLocker locker(mutex_);
+  for (RingChannel* channel = channels_;
+       channel != nullptr;
+       channel = channel->next_) {
+    if (channel->id_ == id) {
+      if (channel->consumer_opened_) {
+        return nullptr;
+      }
+      channel->consumer_opened_ = true;
+      return channel;
+    }
+  }
+  return nullptr;
+}
+
+void RingChannel::Close(End end) {
+  MutexLocker locker(mutex_);
+  if (end == kProducer) {
+    ASSERT(!producer_closed_);
+    producer_closed_ = true;
+    shared_->finished.store(true);
+    Wake();
+  } else {
+    ASSERT(consumer_opened_ && !consumer_closed_);
+    consumer_closed_ = true;
+  }
+  if (!producer_closed_ || (consumer_opened_ && !consumer_closed_)) {
+    return;
+  }
+  for (RingChannel** link = &channels_; *link != nullptr;
+       link = &(*link)->next_) {
+    if (*link == this) {
+      *link = next_;
+      break;
+    }
+  }
+  delete this;
+}
+
+bool RingChannel::Reserve(const uint8_t* data, intptr_t length) {
+  uint64_t head = shared_->head.load(std::memory_order_acquire);
+  if (static_cast<uint64_t>(length) > capacity() - (reserved_ - head)) {
+    return false;
+  }
+  // The bytes may wrap around the end of the ring.
+  intptr_t start = reserved_ & mask_;
+  intptr_t first = capacity() - start;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(&ring_[start], data, first);
+  memcpy(&ring_[0], data + first, length - first);
+  reserved_ += length;
+  return true;
+}
+
+intptr_t RingChannel::Commit() {
+  uint64_t tail = shared_->tail.load(std::memory_order_relaxed);
+  if (reserved_ == tail) {
+    return 0;
+  }
+  shared_->tail.store(reserved_);
+  // Only a ring that was empty may have a consumer waiting on it.
+  if (shared_->head.load() == tail) {
+    Wake();
+  }
+  return reserved_ - tail;
+}
+
+intptr_t RingChannel::Consume(uint8_t* data, intptr_t length) {
+  uint64_t tail = shared_->tail.load(std::memory_order_acquire);
+  uint64_t head = shared_->head.load(std::memory_order_relaxed);
+  if (static_cast<uint64_t>(length) > tail - head) {
+    length = tail - head;
+  }
+  intptr_t start = head & mask_;
+  intptr_t first = capacity() - start;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(data, &ring_[start], first);
+  memcpy(data + first, &ring_[0], length - first);
+  shared_->head.store(head + length);
+  return length;
+}
+
+intptr_t RingChannel::Await(MessageLoop* loop) {
+  // Only the consumer sets the port, so it cannot have been set meanwhile.
+  if (shared_->waiting.load() != ILLEGAL_PORT) {
+    return 0;
+  }
+  intptr_t id = loop->NewSignalId();
+  shared_->wait_id.store(id);
+  shared_->waiting.store(loop->OpenPort());
+  if (Readable()) {
+    Wake();
+  }
+  return id;
+}
+
+Port RingChannel::CancelAwait() {
+  return shared_->waiting.exchange(ILLEGAL_PORT);
+}
+
+bool RingChannel::Readable() const {
+  return (shared_->tail.load() != shared_->head.load()) ||
+         shared_->finished.load();
+}
+
+void RingChannel::Wake() {
+  // Whichever end takes the port posts the signal.
+  Port port = shared_->waiting.exchange(ILLEGAL_PORT);
+  if (port == ILLEGAL_PORT) {
+    return;
+  }
+  intptr_t available = shared_->tail.load() - shared_->head.load();
+  intptr_t signals = available == 0 ? 0 : kReadEvent;
+  if (shared_->finished.load()) {
+    signals |= kCloseEvent;
+  }
+  // Dropped if the consumer's isolate has already exited.
+  PortMap::PostMessage(new IsolateMessage(port, shared_->wait_id.load(), 0,
+                                          signals, available, nullptr, 0));
+}
+
+RingChannels::RingChannels() : entries_(nullptr), capacity_(0) {}
+
+RingChannels::~RingChannels() {
+  for (intptr_t i = 0; i < capacity_; i++) {
+    if (entries_[i].channel != nullptr) {
+      // The loop closes its ports itself.
+      entries_[i].channel->CancelAwait();
+      entries_[i].channel->Close(entries_[i].end);
+    }
+  }
+  delete[] entries_;
+}
+
+intptr_t RingChannels::Add(RingChannel* channel, RingChannel::End end) {
+  intptr_t handle = 0;
+  while ((handle < capacity_) && (entries_[handle].channel != nullptr)) {
+    handle++;
+  }
+  if (handle == capacity_) {
+    intptr_t new_capacity = capacity_ == 0 ? 4 : capacity_ * 2;
+    Entry* new_entries = new Entry[new_capacity];
+    for (intptr_t i = 0; i < new_capacity; i++) {
+      new_entries[i].channel = nullptr;
+    }
+    for (intptr_t i = 0; i < capacity_; i++) {
+      new_entries[i] = entries_[i];
+    }
+    delete[] entries_;
+    entries_ = new_entries;
+    capacity_ = new_capacity;
+  }
+  entries_[handle].channel = channel;
+  entries_[handle].end = end;
+  return handle;
+}
+
+bool RingChannels::Close(intptr_t handle, Isolate* isolate) {
+  if ((handle < 0) || (handle >= capacity_) ||
+      (entries_[handle].channel == nullptr)) {
+    return false;
+  }
+  RingChannel* channel = entries_[handle].channel;
+  if (entries_[handle].end == RingChannel::kConsumer) {
+    Port port = channel->CancelAwait();
+    if (port != ILLEGAL_PORT) {
+      isolate->loop()->ClosePort(port);
+    }
+  }
+  channel->Close(entries_[handle].end);
+  entries_[handle].channel = nullptr;
+  return true;
+}
+
+}  // namespace psoup
@@ -0,0 +1,155 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_RING_CHANNEL_H_
+#define VM_RING_CHANNEL_H_
+
+#include <atomic>
+
+#include "vm/globals.h"
+#include "vm/port.h"
+#include "vm/virtual_memory.h"
+
+namespace psoup {
+
+class Isolate;
+class MessageLoop;
+class Mutex;
+
+// A ring of bytes outside any heap, written by one isolate and read by
+// another without passing through the PortMap, for steady streams between
+// two isolates such as a parser feeding a worker. The producer copies bytes
+// into space it reserves past those already committed, then commits them all
+// at once; the consumer copies out the committed bytes and so frees their
+// space. Neither takes a lock.
+//
+// A consumer with nothing to read may await a signal. The producer only
+// posts one when a commit finds the ring empty, or when it closes, so while
+// the consumer keeps up with a busy stream no messages are sent at all.
+//
+// Channels are named across isolates by ids, which are sent as integers: the
+// isolate that creates a channel holds the producer's end, and one other
+// isolate may open the consumer's by the channel's id. A channel is freed
+// once each end opened has been closed.
+class RingChannel {
+ public:
+  enum End { kProducer, kConsumer };
+
+  static void Startup();
+  static void Shutdown();
+
+  // Holds |capacity| bytes, rounded up to a power of two. Answers nullptr if
+  // |capacity| is not positive or too large.
+  static RingChannel* New(intptr_t capacity);
+  // Answers nullptr if there is no channel |id| or its consumer is taken.
+  static RingChannel* OpenConsumer(int64_t id);
+  // After which the channel may be freed. Closing the producer drops any
+  // bytes it has not committed, and wakes a waiting consumer, so it sees the
+  // end of the stream.
+  void Close(End end);
+
+  int64_t id() const { return id_; }
+  intptr_t capacity() const { return mask_ + 1; }
+
+  // Only used by the producer. Reserve copies |length| bytes in after those
+  // already reserved, or answers false if they do not fit. Commit makes the
+  // reserved bytes readable and answers how many there were.
+  bool Reserve(const uint8_t* data, intptr_t length);
+  intptr_t Commit();
+
+  // Only used by the consumer. Consume copies out up to |length| committed
+  // bytes and answers how many.
+  intptr_t Consume(uint8_t* data, intptr_t length);
+  // Answers the id of a signal |loop| is posted once bytes are readable or
+  // the producer has closed, at once if they already are, or 0 if one is
+  // already awaited. The signal's count is the bytes readable, and it has
+  // kCloseEvent if the producer has closed. Holds a port open on |loop|
+  // meanwhile, so the consumer's isolate does not exit while it waits.
+  intptr_t Await(MessageLoop* loop);
+  // Answers the port of a signal awaited but not yet posted, or
+  // ILLEGAL_PORT.
+  Port CancelAwait();
+
+ private:
+  static constexpr intptr_t kCacheLineSize = 64;
+
+  // Each end's position on its own cache line, so the two ends do not
+  // contend for one, at the start of the mapping. Sequentially consistent,
+  // so a commit that finds the ring not yet emptied and a consumer awaiting
+  // after emptying it cannot miss each other. Positions count the bytes ever
+  // committed or consumed; their remainders modulo the capacity index the
+  // ring.
+  struct Shared {
+    std::atomic<uint64_t> tail;  // Committed by the producer.
+    uint8_t padding1[kCacheLineSize - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> head;  // Consumed.
+    uint8_t padding2[kCacheLineSize - sizeof(std::atomic<uint64_t>)];
+    std::atomic<Port> waiting;  // ILLEGAL_PORT unless awaited.
+    std::atomic<intptr_t> wait_id;
+    std::atomic<bool> finished;  // The producer has closed.
+  };
+
+  RingChannel(int64_t id, const VirtualMemory& memory, intptr_t capacity);
+  ~RingChannel();
+
+  bool Readable() const;
+  // Posts the awaited signal, unless already posted.
+  void Wake();
+
+  static Mutex* mutex_;
+  static RingChannel* channels_;
+  static int64_t last_id_;
+
+  const int64_t id_;
+  VirtualMemory memory_;
+  Shared* const shared_;
+  uint8_t* const ring_;
+  const intptr_t mask_;
+  uint64_t reserved_;  // Only used by the producer.
+  RingChannel* next_;
+  // Guarded by mutex_.
+  bool consumer_opened_;
+  bool producer_closed_;
+  bool consumer_closed_;
+
+  DISALLOW_COPY_AND_ASSIGN(RingChannel);
+};
+
+// One isolate's ends of channels, named by small integer handles. Ends left
+// open are closed with the isolate.
+class RingChannels {
+ public:
+  RingChannels();
+  ~RingChannels();
+
+  intptr_t Add(RingChannel* channel, RingChannel::End end);
+
+  // Answers nullptr if |handle| is not open as |end|.
+  RingChannel* Lookup(intptr_t handle, RingChannel::End end) const {
+    if ((handle < 0) || (handle >= capacity_) ||
+        (entries_[handle].end != end)) {
+      return nullptr;
+    }
+    return entries_[handle].channel;
+  }
+
+  // Answers false if |handle| is not open. A consumer's pending await is
+  // cancelled, and its port closed on |isolate|'s loop.
+  bool Close(intptr_t handle, Isolate* isolate);
+
+ private:
+  struct Entry {
+    RingChannel* channel;  // nullptr when free.
+    RingChannel::End end;
+  };
+
+  Entry* entries_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(RingChannels);
+};
+
+}  // namespace psoup
+
+#endif  // VM_RING_CHANNEL_H_
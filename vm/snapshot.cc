@@ -8,8 +8,13 @@
 
 #include "vm/heap.h"
 #include "vm/interpreter.h"
+#include "vm/isolate.h"
+#include "vm/lockers.h"
 #include "vm/object.h"
 #include "vm/os.h"
+#include "vm/perf_counters.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
 
 namespace psoup {
 
@@ -20,7 +25,12 @@ class Cluster {
   virtual ~Cluster() {}
 
   virtual void ReadNodes(Deserializer* d, Heap* h) = 0;
+  // May run concurrently with the other clusters' ReadEdges.
   virtual void ReadEdges(Deserializer* d, Heap* h) = 0;
+  // Called in order after all edges have been read.
+  virtual void RegisterClass(Deserializer* d) {}
+  // Called in order after all edges of a revision 3 snapshot have been read.
+  virtual void LoadBytecode(Deserializer* d, Object nil) {}
 
  protected:
   intptr_t ref_start_;
@@ -30,7 +40,7 @@ class Cluster {
 class RegularObjectCluster : public Cluster {
  public:
   explicit RegularObjectCluster(intptr_t format, intptr_t cid = kIllegalCid)
-    : format_(format), cid_(cid) {}
+    : format_(format), cid_(cid), cls_() {}
   ~RegularObjectCluster() {}
 
   void ReadNodes(Deserializer* d, Heap* h) {
@@ -48,8 +58,7 @@ class RegularObjectCluster : public Cluster {
   }
 
   void ReadEdges(Deserializer* d, Heap* h) {
-    Object cls = d->ReadRef();
-    h->RegisterClass(cid_, static_cast<Behavior>(cls));
+    cls_ = static_cast<Behavior>(d->ReadRef());
 
     for (intptr_t i = ref_start_; i < ref_stop_; i++) {
       RegularObject object = static_cast<RegularObject>(d->Ref(i));
@@ -59,9 +68,14 @@ class RegularObjectCluster : public Cluster {
     }
   }
 
+  void RegisterClass(Deserializer* d) {
+    d->RegisterClass(cid_, cls_);
+  }
+
  private:
   intptr_t format_;
   intptr_t cid_;
+  Behavior cls_;
 };
 
 class ByteArrayCluster : public Cluster {
@@ -88,6 +102,29 @@ class ByteArrayCluster : public Cluster {
   void ReadEdges(Deserializer* d, Heap* h) {}
 };
 
+// Method bytecode that is read when the method is first activated. Its refs
+// are the positions of the bytecode in the snapshot.
+class LazyBytecodeCluster : public Cluster {
+ public:
+  LazyBytecodeCluster() {}
+  ~LazyBytecodeCluster() {}
+
+  void ReadNodes(Deserializer* d, Heap* h) {
+    intptr_t num_objects = d->ReadLEB128();
+    ref_start_ = d->next_ref();
+    ref_stop_ = ref_start_ + num_objects;
+    for (intptr_t i = 0; i < num_objects; i++) {
+      SmallInteger position = SmallInteger::New(d->position());
+      intptr_t size = d->ReadLEB128();
+      d->Skip(size);
+      d->RegisterRef(position);
+    }
+    ASSERT(d->next_ref() == ref_stop_);
+  }
+
+  void ReadEdges(Deserializer* d, Heap* h) {}
+};
+
 class StringCluster : public Cluster {
  public:
   StringCluster() {}
@@ -220,9 +257,19 @@ class ActivationCluster : public Cluster {
     ref_stop_ = ref_start_ + num_objects;
     for (intptr_t i = 0; i < num_objects; i++) {
       Activation object = h->AllocateActivation(Heap::kSnapshot);
+      // Edges may be read concurrently, so the temps are allocated here,
+      // before their number is known.
+      Array temps = h->AllocateArray(kMaxTemps, Heap::kSnapshot);
+      for (intptr_t j = 0; j < kMaxTemps; j++) {
+        temps->set_element(j, SmallInteger::New(0), kNoBarrier);
+      }
+      object->set_temps(temps, kNoBarrier);
       d->RegisterRef(object);
     }
     ASSERT(d->next_ref() == ref_stop_);
+    if (num_objects != 0) {
+      d->NotRecordable();
+    }
   }
 
   void ReadEdges(Deserializer* d, Heap* h) {
@@ -242,8 +289,16 @@ class ActivationCluster : public Cluster {
       for (intptr_t j = 0; j < size; j++) {
         object->set_temp(j, d->ReadRef(), kNoBarrier);
       }
-      for (intptr_t j = size; j < kMaxTemps; j++) {
-        object->set_temp(j, SmallInteger::New(0), kNoBarrier);
+    }
+  }
+
+  // Activations are resumed without being activated, so the bytecode of
+  // their methods must be present.
+  void LoadBytecode(Deserializer* d, Object nil) {
+    for (intptr_t i = ref_start_; i < ref_stop_; i++) {
+      Method method = Activation::Cast(d->Ref(i))->method();
+      if ((method != nil) && !method->HasBytecode()) {
+        d->LoadBytecode(method);
       }
     }
   }
@@ -300,7 +355,8 @@ class LargeIntegerCluster : public Cluster {
         for (intptr_t shift = 0;
              shift < static_cast<intptr_t>(kDigitBits);
              shift += 8) {
-          digit = digit | (d->Read<uint8_t>() << shift);
+          digit_t byte = d->Read<uint8_t>();
+          digit = digit | (byte << shift);
         }
         object->set_digit(j, digit);
       }
@@ -312,7 +368,8 @@ class LargeIntegerCluster : public Cluster {
         for (intptr_t shift = 0;
              shift < (leftover_bytes * 8);
              shift += 8) {
-          digit = digit | (d->Read<uint8_t>() << shift);
+          digit_t byte = d->Read<uint8_t>();
+          digit = digit | (byte << shift);
         }
         object->set_digit(digits - 1, digit);
       }
@@ -346,14 +403,46 @@ class FloatCluster : public Cluster {
   void ReadEdges(Deserializer* d, Heap* h) {}
 };
 
+Deserializer::EventCallback Deserializer::event_callback_ = nullptr;
+
+
 Deserializer::Deserializer(Heap* heap, void* snapshot, size_t snapshot_length) :
   snapshot_(reinterpret_cast<const uint8_t*>(snapshot)),
   snapshot_length_(snapshot_length),
   cursor_(snapshot_),
+  owns_refs_(true),
   heap_(heap),
+  num_clusters_(0),
   clusters_(NULL),
   refs_(NULL),
-  next_ref_(0) {
+  next_ref_(0),
+  edge_offsets_(NULL),
+  identity_hashes_offset_(0),
+  class_cids_(NULL),
+  class_objects_(NULL),
+  num_classes_(0),
+  recordable_(true) {
+  memset(&event_, 0, sizeof(event_));
+}
+
+
+Deserializer::Deserializer(const Deserializer* parent, intptr_t offset) :
+  snapshot_(parent->snapshot_),
+  snapshot_length_(parent->snapshot_length_),
+  cursor_(snapshot_ + offset),
+  owns_refs_(false),
+  heap_(parent->heap_),
+  num_clusters_(0),
+  clusters_(NULL),
+  refs_(parent->refs_),
+  next_ref_(parent->next_ref_),
+  edge_offsets_(NULL),
+  identity_hashes_offset_(0),
+  class_cids_(NULL),
+  class_objects_(NULL),
+  num_classes_(0),
+  recordable_(true) {
+  memset(&event_, 0, sizeof(event_));
 }
 
 
@@ -363,13 +452,94 @@ Deserializer::~Deserializer() {
   }
 
   delete[] clusters_;
-  delete[] refs_;
+  if (owns_refs_) {
+    delete[] refs_;
+  }
+  delete[] edge_offsets_;
+  delete[] class_cids_;
+  delete[] class_objects_;
+}
+
+
+void Deserializer::RegisterClass(intptr_t cid, Behavior cls) {
+  heap_->RegisterClass(cid, cls);
+  if (class_cids_ != NULL) {
+    class_cids_[num_classes_] = cid;
+    class_objects_[num_classes_] = cls;
+    num_classes_++;
+  }
 }
 
 
 void Deserializer::Deserialize() {
+  PerfScope perf_scope(heap_, PerfCounters::kDeserialize);
   int64_t start = OS::CurrentMonotonicNanos();
 
+  bool record = false;
+  const SnapshotImage* image =
+      SnapshotImage::Lookup(snapshot_, snapshot_length_, &record);
+  ObjectStore os;
+  intptr_t num_objects;
+  if (image != NULL) {
+    os = static_cast<ObjectStore>(image->Instantiate(heap_));
+    num_objects = image->num_objects();
+    event_.image = OS::CurrentMonotonicNanos() - start;
+  } else {
+    os = static_cast<ObjectStore>(ReadObjects(record));
+    num_objects = next_ref_ - 1;
+  }
+  int64_t initialize_start = OS::CurrentMonotonicNanos();
+
+  heap_->RegisterClass(kSmallIntegerCid, os->SmallInteger());
+  heap_->RegisterClass(kMediumIntegerCid, os->MediumInteger());
+  heap_->RegisterClass(kLargeIntegerCid, os->LargeInteger());
+  heap_->RegisterClass(kFloatCid, os->Float());
+  heap_->RegisterClass(kByteArrayCid, os->ByteArray());
+  heap_->RegisterClass(kStringCid, os->String());
+  heap_->RegisterClass(kArrayCid, os->Array());
+  heap_->RegisterClass(kWeakArrayCid, os->WeakArray());
+  heap_->RegisterClass(kEphemeronCid, os->Ephemeron());
+  heap_->RegisterClass(kActivationCid, os->Activation());
+  heap_->RegisterClass(kClosureCid, os->Closure());
+
+  heap_->interpreter()->InitializeRoot(os);
+  heap_->InitializeAfterSnapshot();
+
+  int64_t stop = OS::CurrentMonotonicNanos();
+  intptr_t time = stop - start;
+  if (event_callback_ != nullptr) {
+    event_.snapshot_length = snapshot_length_;
+    event_.num_objects = num_objects;
+    event_.from_image = image != NULL ? 1 : 0;
+    event_.initialize = stop - initialize_start;
+    event_.total = time;
+    event_callback_(event_);
+  }
+  if (TRACE_GROWTH) {
+    OS::PrintErr("%s %" Pd "kB snapshot "
+                 "into %" Pd "kB heap "
+                 "with %" Pd " objects "
+                 "in %" Pd " us\n",
+                 image != NULL ? "Copied image of" : "Deserialized",
+                 snapshot_length_ / KB,
+                 heap_->Size() / KB,
+                 num_objects,
+                 time / kNanosecondsPerMicrosecond);
+  }
+
+#if defined(DEBUG)
+  size_t before = heap_->Size();
+  heap_->CollectAll(Heap::kSnapshotTest);
+  size_t after = heap_->Size();
+  ASSERT(before == after);  // Snapshots should not contain garbage.
+#endif
+}
+
+
+Object Deserializer::ReadObjects(bool record) {
+  // The header and trailer count toward the first cluster's description.
+  int64_t time = OS::CurrentMonotonicNanos();
+
   // Skip interpreter directive, if any.
   if ((cursor_[0] == static_cast<uint8_t>('#')) &&
       (cursor_[1] == static_cast<uint8_t>('!'))) {
@@ -377,77 +547,267 @@ void Deserializer::Deserialize() {
     while (*cursor_++ != static_cast<uint8_t>('\n')) {}
   }
 
+  const uint8_t* base = cursor_;
   uint16_t magic = Read<uint16_t>();
   if (magic != 0x1984) {
     FATAL("Wrong magic value");
   }
   uint16_t version = ReadLEB128();
-  if (version != 0) {
+  if (version > 4) {
     FATAL("Wrong version (%d)", version);
   }
 
   num_clusters_ = ReadLEB128();
   clusters_ = new Cluster*[num_clusters_];
+  if (record) {
+    class_cids_ = new intptr_t[num_clusters_];
+    class_objects_ = new Object[num_clusters_];
+  }
 
   intptr_t num_nodes = ReadLEB128();
   refs_ = new Object[num_nodes + 1];  // Refs are 1-origin.
   next_ref_ = 1;
 
+  if (version >= 1) {
+    ReadTrailer(base, version, num_nodes);
+  }
+
   for (intptr_t i = 0; i < num_clusters_; i++) {
     Cluster* c = ReadCluster();
     clusters_[i] = c;
+    int64_t read = OS::CurrentMonotonicNanos();
     c->ReadNodes(this, heap_);
+    int64_t nodes = OS::CurrentMonotonicNanos();
+    event_.clusters += read - time;
+    event_.nodes += nodes - read;
+    time = nodes;
   }
   ASSERT((next_ref_ - 1) == num_nodes);
+  if (identity_hashes_offset_ != 0) {
+    ReadIdentityHashes();
+  }
+  if ((edge_offsets_ == NULL) || !ReadEdgesInParallel()) {
+    ReadEdges(this, 0, num_clusters_);
+  }
+  int64_t edges = OS::CurrentMonotonicNanos();
+  event_.edges = edges - time;
   for (intptr_t i = 0; i < num_clusters_; i++) {
-    clusters_[i]->ReadEdges(this, heap_);
+    clusters_[i]->RegisterClass(this);
   }
 
-  ObjectStore os = static_cast<ObjectStore>(ReadRef());
+  Object os = ReadRef();
+  if (version >= 3) {
+    Object nil = static_cast<ObjectStore>(os)->nil_obj();
+    for (intptr_t i = 0; i < num_clusters_; i++) {
+      clusters_[i]->LoadBytecode(this, nil);
+    }
+  }
+  int64_t classes = OS::CurrentMonotonicNanos();
+  event_.classes = classes - edges;
+  if (record && recordable_) {
+    SnapshotImage::Add(snapshot_, snapshot_length_,
+                       new SnapshotImage(refs_, next_ref_, class_cids_,
+                                         class_objects_, num_classes_, os));
+    event_.image = OS::CurrentMonotonicNanos() - classes;
+  }
+  return os;
+}
 
-  heap_->RegisterClass(kSmallIntegerCid, os->SmallInteger());
-  heap_->RegisterClass(kMediumIntegerCid, os->MediumInteger());
-  heap_->RegisterClass(kLargeIntegerCid, os->LargeInteger());
-  heap_->RegisterClass(kFloatCid, os->Float());
-  heap_->RegisterClass(kByteArrayCid, os->ByteArray());
-  heap_->RegisterClass(kStringCid, os->String());
-  heap_->RegisterClass(kArrayCid, os->Array());
-  heap_->RegisterClass(kWeakArrayCid, os->WeakArray());
-  heap_->RegisterClass(kEphemeronCid, os->Ephemeron());
-  heap_->RegisterClass(kActivationCid, os->Activation());
-  heap_->RegisterClass(kClosureCid, os->Closure());
+class EdgesTask : public ThreadPool::Task {
+ public:
+  EdgesTask(Deserializer* d, intptr_t first, intptr_t last, intptr_t offset,
+            Monitor* monitor, intptr_t* running)
+      : d_(d), first_(first), last_(last), offset_(offset),
+        monitor_(monitor), running_(running) {}
+
+  virtual void Run() {
+    {
+      Deserializer reader(d_, offset_);
+      d_->ReadEdges(&reader, first_, last_);
+    }
+    MonitorLocker ml(monitor_);
+    (*running_)--;
+    ml.NotifyAll();
+  }
 
-  heap_->interpreter()->InitializeRoot(os);
-  heap_->InitializeAfterSnapshot();
+ private:
+  Deserializer* d_;
+  intptr_t first_;
+  intptr_t last_;
+  intptr_t offset_;
+  Monitor* monitor_;
+  intptr_t* running_;
+
+  DISALLOW_COPY_AND_ASSIGN(EdgesTask);
+};
 
-  int64_t stop = OS::CurrentMonotonicNanos();
-  intptr_t time = stop - start;
-  if (TRACE_GROWTH) {
-    OS::PrintErr("Deserialized %" Pd "kB snapshot "
-                 "into %" Pd "kB heap "
-                 "with %" Pd " objects "
-                 "in %" Pd " us\n",
-                 snapshot_length_ / KB,
-                 heap_->Size() / KB,
-                 next_ref_ - 1,
-                 time / kNanosecondsPerMicrosecond);
+// static
+const uint8_t* Deserializer::LazyBytecode(const void* snapshot,
+                                          SmallInteger position,
+                                          intptr_t* length) {
+  const uint8_t* cursor =
+      reinterpret_cast<const uint8_t*>(snapshot) + position->value();
+  intptr_t size = 0;
+  intptr_t shift = 0;
+  uint8_t byte;
+  do {
+    byte = *cursor++;
+    size |= static_cast<intptr_t>(byte & 0x7F) << shift;
+    shift += 7;
+  } while ((byte & 0x80) != 0);
+  *length = size;
+  return cursor;
+}
+
+void Deserializer::LoadBytecode(Method method) {
+  intptr_t length;
+  const uint8_t* bytes =
+      LazyBytecode(snapshot_, method->BytecodePosition(), &length);
+  ByteArray bytecode = heap_->AllocateByteArray(length, Heap::kSnapshot);
+  memcpy(bytecode->element_addr(0), bytes, length);
+  method->set_bytecode(bytecode);
+}
+
+void Deserializer::ReadTrailer(const uint8_t* base,
+                               intptr_t version,
+                               intptr_t num_nodes) {
+  // The last four bytes locate a table of the offsets of each cluster's edges
+  // and of the root ref, followed in revision 2 by the number of slots and of
+  // bytes the objects hold, and in revision 4 by the hash salt and identity
+  // hashes of the isolate that wrote it.
+  uint32_t table;
+  memcpy(&table, snapshot_ + snapshot_length_ - sizeof(table), sizeof(table));
+  Deserializer reader(this, (base - snapshot_) + table);
+  edge_offsets_ = new intptr_t[num_clusters_ + 1];
+  for (intptr_t i = 0; i <= num_clusters_; i++) {
+    edge_offsets_[i] = (base - snapshot_) + reader.ReadLEB128();
+  }
+  if (version < 2) {
+    return;
   }
 
-#if defined(DEBUG)
-  size_t before = heap_->Size();
-  heap_->CollectAll(Heap::kSnapshotTest);
-  size_t after = heap_->Size();
-  ASSERT(before == after);  // Snapshots should not contain garbage.
+  // Reserve room for all the objects at once so they are allocated together
+  // without taking the slow path. No object has more than four words besides
+  // its slots or bytes. The counts are a hint: anything beyond them is still
+  // allocated by the slow path.
+  intptr_t num_slots = reader.ReadLEB128();
+  intptr_t num_bytes = reader.ReadLEB128();
+  intptr_t size = num_nodes * (4 * kWordSize + kObjectAlignment) +
+                  num_slots * kWordSize + num_bytes;
+  heap_->ReserveSnapshot(Utils::RoundUp(size, kObjectAlignment));
+  if (version < 4) {
+    return;
+  }
+
+  // An image's hashed collections are laid out by the hashes it was written
+  // with. A SnapshotImage would lose the identity hashes.
+  heap_->interpreter()->isolate()->set_salt(reader.ReadLEB128());
+  identity_hashes_offset_ = reader.position();
+  recordable_ = false;
+}
+
+void Deserializer::ReadIdentityHashes() {
+  Deserializer reader(this, identity_hashes_offset_);
+  intptr_t count = reader.ReadLEB128();
+  for (intptr_t i = 0; i < count; i++) {
+    HeapObject object = static_cast<HeapObject>(reader.ReadRef());
+    intptr_t hash = reader.ReadLEB128();
+    heap_->SetIdentityHash(object, hash);
+  }
+}
+
+bool Deserializer::ReadEdgesInParallel() {
+  intptr_t* offsets = edge_offsets_;
+  ASSERT(offsets[0] == position());
+
+  int64_t edges = offsets[num_clusters_] - offsets[0];
+  ThreadPool* pool = Isolate::thread_pool();
+  intptr_t num_readers = edges / kMinEdgesPerReader;
+  if (num_readers > OS::NumberOfAvailableProcessors()) {
+    num_readers = OS::NumberOfAvailableProcessors();
+  }
+  if (num_readers > kMaxEdgeReaders) {
+    num_readers = kMaxEdgeReaders;
+  }
+#if defined(OS_EMSCRIPTEN)
+  num_readers = 1;
 #endif
+  if ((pool == NULL) || (num_readers <= 1)) {
+    return false;
+  }
+
+  // Split the clusters into runs with about as many bytes of edges each. This
+  // thread reads the first run.
+  Monitor monitor;
+  intptr_t running = 0;
+  intptr_t own_last = 0;
+  intptr_t first = 0;
+  for (intptr_t i = 0; i < num_readers; i++) {
+    intptr_t last = first;
+    if (i == num_readers - 1) {
+      last = num_clusters_;
+    } else {
+      int64_t target = offsets[0] + edges * (i + 1) / num_readers;
+      while ((last < num_clusters_) && (offsets[last] < target)) {
+        last++;
+      }
+    }
+    if (i == 0) {
+      own_last = last;
+    } else if (last > first) {
+      {
+        MonitorLocker ml(&monitor);
+        running++;
+      }
+      EdgesTask* task =
+          new EdgesTask(this, first, last, offsets[first], &monitor, &running);
+      if (!pool->Run(task)) {
+        // The pool is shutting down.
+        task->Run();
+        delete task;
+      }
+    }
+    first = last;
+  }
+  ReadEdges(this, 0, own_last);
+  {
+    MonitorLocker ml(&monitor);
+    while (running > 0) {
+      ml.Wait();
+    }
+  }
+
+  cursor_ = snapshot_ + offsets[num_clusters_];
+  return true;
+}
+
+void Deserializer::ReadEdges(Deserializer* reader,
+                             intptr_t first,
+                             intptr_t last) {
+  for (intptr_t i = first; i < last; i++) {
+    clusters_[i]->ReadEdges(reader, heap_);
+  }
 }
 
 template <typename T>
 T Deserializer::ReadLEB128() {
   COMPILE_ASSERT(std::is_unsigned<T>());
   const int8_t* cursor = reinterpret_cast<const int8_t*>(cursor_);
-  T result = 0;
-  uintptr_t shift = 0;
-  intptr_t byte;
+  // Nearly all values are refs or sizes of one or two bytes.
+  intptr_t byte = cursor[0];
+  if (byte >= 0) {
+    cursor_ += 1;
+    return static_cast<T>(byte);
+  }
+  T result = static_cast<T>(byte & 0x7F);
+  byte = cursor[1];
+  if (byte >= 0) {
+    cursor_ += 2;
+    return result | (static_cast<T>(byte) << 7);
+  }
+  result |= static_cast<T>(byte & 0x7F) << 7;
+  cursor += 2;
+  uintptr_t shift = 14;
   do {
     byte = *cursor++;
     result |= static_cast<T>(byte & 0x7F) << shift;
@@ -462,9 +822,14 @@ T Deserializer::ReadSLEB128() {
   COMPILE_ASSERT(std::is_signed<T>());
   typedef typename std::make_unsigned<T>::type Unsigned;
   const int8_t* cursor = reinterpret_cast<const int8_t*>(cursor_);
+  intptr_t byte = cursor[0];
+  if (byte >= 0) {
+    cursor_ += 1;
+    // Sign extend from bit 6.
+    return static_cast<T>((byte ^ 0x40) - 0x40);
+  }
   T result = 0;
   uintptr_t shift = 0;
-  intptr_t byte;
   do {
     byte = *cursor++;
     result |= static_cast<Unsigned>(byte & 0x7F) << shift;
@@ -488,6 +853,7 @@ enum {
   kClosureCluster = -8,
   kActivationCluster = -9,
   kEphemeronCluster = -10,
+  kLazyBytecodeCluster = -11,
 };
 
 Cluster* Deserializer::ReadCluster() {
@@ -507,10 +873,1485 @@ Cluster* Deserializer::ReadCluster() {
       case kIntegerCluster: return new IntegerCluster();
       case kLargeIntegerCluster: return new LargeIntegerCluster();
       case kFloatCluster: return new FloatCluster();
+      case kLazyBytecodeCluster: return new LazyBytecodeCluster();
     }
     FATAL("Unknown cluster format %" Pd "\n", format);
     return NULL;
   }
 }
 
+class SnapshotWriter::List {
+ public:
+  List() : objects_(NULL), size_(0), capacity_(0) {}
+  ~List() { delete[] objects_; }
+
+  intptr_t size() const { return size_; }
+  bool IsEmpty() const { return size_ == 0; }
+  Object At(intptr_t index) const {
+    ASSERT((index >= 0) && (index < size_));
+    return objects_[index];
+  }
+
+  void Add(Object object) {
+    if (size_ == capacity_) {
+      intptr_t new_capacity = capacity_ == 0 ? 16 : capacity_ * 2;
+      Object* new_objects = new Object[new_capacity];
+      for (intptr_t i = 0; i < size_; i++) {
+        new_objects[i] = objects_[i];
+      }
+      delete[] objects_;
+      objects_ = new_objects;
+      capacity_ = new_capacity;
+    }
+    objects_[size_++] = object;
+  }
+  Object RemoveLast() {
+    ASSERT(size_ > 0);
+    return objects_[--size_];
+  }
+
+ private:
+  Object* objects_;
+  intptr_t size_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(List);
+};
+
+// The instances of one class, and which of their slots are written: as in
+// the Newspeak Serializer, transient slots are written as nil.
+class SnapshotWriter::RegularCluster {
+ public:
+  RegularCluster(Behavior cls, intptr_t num_slots)
+      : cls_(cls), num_slots_(num_slots), filter_(new bool[num_slots]) {}
+  ~RegularCluster() { delete[] filter_; }
+
+  // Returns false if the slot declarations of |cls_|'s mixins do not account
+  // for its slots.
+  bool ComputeFilter(Heap* heap, Object nil) {
+    intptr_t cursor = num_slots_;
+    for (Behavior cls = cls_;
+         static_cast<Object>(cls) != nil;
+         cls = cls->superclass()) {
+      RegularObject mixin = static_cast<RegularObject>(cls->mixin());
+      if (!mixin->IsRegularObject()) {
+        return false;
+      }
+      if (mixin->Klass(heap)->format()->value() <= kMixinSlotsIndex) {
+        continue;  // A ClassMixin, which declares no slots.
+      }
+      Array slots = static_cast<Array>(mixin->slot(kMixinSlotsIndex));
+      if (!slots->IsArray() || (slots->Size() > cursor)) {
+        return false;
+      }
+      for (intptr_t i = slots->Size() - 1; i >= 0; i--) {
+        RegularObject slot = static_cast<RegularObject>(slots->element(i));
+        if (!slot->IsRegularObject() || !slot->slot(0)->IsSmallInteger()) {
+          return false;
+        }
+        intptr_t header = static_cast<SmallInteger>(slot->slot(0))->value();
+        filter_[--cursor] = ((header >> kTransientBit) & 1) == 0;
+      }
+    }
+    return cursor == 0;
+  }
+
+  // A behavior's class id is its heap's, so it is written as nil.
+  void ExcludeBehaviorId() { filter_[kBehaviorIdIndex] = false; }
+
+  Behavior cls() const { return cls_; }
+  intptr_t num_slots() const { return num_slots_; }
+  bool IsWritten(intptr_t slot) const { return filter_[slot]; }
+  List* objects() { return &objects_; }
+
+ private:
+  // InstanceMixin>>_slots and SlotDeclaration>>isTransient.
+  static constexpr intptr_t kMixinSlotsIndex = 3;
+  static constexpr intptr_t kTransientBit = 3;
+  static constexpr intptr_t kBehaviorIdIndex = 4;
+
+  Behavior cls_;
+  intptr_t num_slots_;
+  bool* filter_;
+  List objects_;
+
+  DISALLOW_COPY_AND_ASSIGN(RegularCluster);
+};
+
+struct SnapshotWriter::Entry {
+  uword key;
+  intptr_t ref;  // kUnreached if the entry is unused.
+};
+
+static constexpr intptr_t kUnreached = -1;
+
+SnapshotWriter::SnapshotWriter(Heap* heap)
+    : heap_(heap),
+      nil_(),
+      entries_(NULL),
+      num_entries_(0),
+      capacity_(0),
+      next_ref_(1),
+      stack_(new List()),
+      data_(NULL),
+      length_(0),
+      capacity_bytes_(0) {
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  delete stack_;
+  delete[] entries_;
+  free(data_);
+}
+
+MessageSerializer::MessageSerializer(Heap* heap)
+    : SnapshotWriter(heap),
+      metaclass_(),
+      method_(),
+      num_shared_(0),
+      integers_(new List()),
+      large_integers_(new List()),
+      floats_(new List()),
+      byte_arrays_(new List()),
+      strings_(new List()),
+      arrays_(new List()),
+      weak_arrays_(new List()),
+      ephemerons_(new List()),
+      regular_clusters_(NULL),
+      num_regular_clusters_(0) {
+}
+
+MessageSerializer::~MessageSerializer() {
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    delete regular_clusters_[i];
+  }
+  delete[] regular_clusters_;
+  delete integers_;
+  delete large_integers_;
+  delete floats_;
+  delete byte_arrays_;
+  delete strings_;
+  delete arrays_;
+  delete weak_arrays_;
+  delete ephemerons_;
+}
+
+uint8_t* SnapshotWriter::TakeData(intptr_t* length) {
+  uint8_t* result = data_;
+  *length = length_;
+  data_ = NULL;
+  length_ = capacity_bytes_ = 0;
+  return result;
+}
+
+SnapshotWriter::Entry* SnapshotWriter::Lookup(Object object) {
+  uword key = static_cast<uword>(object);
+  intptr_t mask = capacity_ - 1;
+  intptr_t probe = ((key >> kObjectAlignmentLog2) ^ key) & mask;
+  while ((entries_[probe].ref != kUnreached) && (entries_[probe].key != key)) {
+    probe = (probe + 1) & mask;
+  }
+  return &entries_[probe];
+}
+
+SnapshotWriter::Entry* SnapshotWriter::Insert(Object object) {
+  if ((num_entries_ + 1) * 2 > capacity_) {
+    Entry* old_entries = entries_;
+    intptr_t old_capacity = capacity_;
+    capacity_ = capacity_ == 0 ? 256 : capacity_ * 2;
+    entries_ = new Entry[capacity_];
+    for (intptr_t i = 0; i < capacity_; i++) {
+      entries_[i].ref = kUnreached;
+    }
+    for (intptr_t i = 0; i < old_capacity; i++) {
+      if (old_entries[i].ref != kUnreached) {
+        *Lookup(static_cast<Object>(old_entries[i].key)) = old_entries[i];
+      }
+    }
+    delete[] old_entries;
+  }
+  return Lookup(object);
+}
+
+void SnapshotWriter::Enqueue(Object object) {
+  Entry* entry = Insert(object);
+  if (entry->ref == kUnreached) {
+    entry->key = static_cast<uword>(object);
+    entry->ref = 0;
+    num_entries_++;
+    stack_->Add(object);
+  }
+}
+
+bool MessageSerializer::Serialize(Object root) {
+  ObjectStore os = heap_->interpreter()->object_store();
+  if (!os->HasMessageObjects()) {
+    return false;
+  }
+  nil_ = os->nil_obj();
+  method_ = os->Method();
+
+  // As the Newspeak Serializer's sharedObjects, whose Metaclass is the 15th.
+  Array shared = os->message_shared_objects();
+  num_shared_ = shared->Size();
+  for (intptr_t i = 0; i < num_shared_; i++) {
+    Entry* entry = Insert(shared->element(i));
+    ASSERT(entry->ref == kUnreached);
+    entry->key = static_cast<uword>(shared->element(i));
+    entry->ref = next_ref_++;
+    num_entries_++;
+  }
+  metaclass_ = static_cast<Behavior>(shared->element(14));
+
+  Enqueue(root);
+  do {
+    while (!stack_->IsEmpty()) {
+      if (!Analyze(stack_->RemoveLast())) {
+        return false;
+      }
+    }
+  } while (Retrace());
+
+  intptr_t num_clusters = num_regular_clusters_;
+  List* special[] = { integers_, large_integers_, floats_, byte_arrays_,
+                      strings_, arrays_, weak_arrays_, ephemerons_ };
+  for (List* list : special) {
+    if (!list->IsEmpty()) {
+      num_clusters++;
+    }
+  }
+
+  Write<uint16_t>(0x1984);
+  WriteLEB128(0);  // The Newspeak Deserializer's version.
+  WriteLEB128(num_clusters);
+  WriteLEB128(num_entries_);
+  WriteNodes();
+  WriteEdges();
+  WriteRef(root);
+  return true;
+}
+
+// An ephemeron's value is written only if its key is written.
+bool MessageSerializer::Retrace() {
+  bool found = false;
+  for (intptr_t i = 0; i < ephemerons_->size(); i++) {
+    Ephemeron ephemeron = static_cast<Ephemeron>(ephemerons_->At(i));
+    if (Lookup(ephemeron->key())->ref != kUnreached) {
+      Object value = ephemeron->value();
+      if (Lookup(value)->ref == kUnreached) {
+        Enqueue(value);
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+bool MessageSerializer::Analyze(Object object) {
+  if (object->IsSmallInteger()) {
+    integers_->Add(object);
+    return true;
+  }
+
+  switch (object->ClassId()) {
+    case kMediumIntegerCid:
+      integers_->Add(object);
+      return true;
+    case kLargeIntegerCid:
+      large_integers_->Add(object);
+      return true;
+    case kFloatCid:
+      floats_->Add(object);
+      return true;
+    case kByteArrayCid:
+      byte_arrays_->Add(object);
+      return true;
+    case kStringCid:
+      if (static_cast<String>(object)->is_canonical()) {
+        return false;  // Interned by the receiver's kernel.
+      }
+      strings_->Add(object);
+      return true;
+    case kArrayCid: {
+      arrays_->Add(object);
+      Array array = static_cast<Array>(object);
+      intptr_t size = array->Size();
+      for (intptr_t i = 0; i < size; i++) {
+        Enqueue(array->element(i));
+      }
+      return true;
+    }
+    case kWeakArrayCid:
+      weak_arrays_->Add(object);  // Not traced.
+      return true;
+    case kEphemeronCid:
+      ephemerons_->Add(object);
+      Enqueue(static_cast<Ephemeron>(object)->finalizer());
+      return true;
+    case kActivationCid:
+    case kClosureCid:
+      return false;
+  }
+
+  if (!object->IsRegularObject()) {
+    return false;
+  }
+  RegularCluster* cluster = ClusterFor(object->Klass(heap_));
+  if (cluster == NULL) {
+    return false;
+  }
+  cluster->objects()->Add(object);
+  RegularObject regular = static_cast<RegularObject>(object);
+  for (intptr_t i = 0; i < cluster->num_slots(); i++) {
+    if (cluster->IsWritten(i)) {
+      Enqueue(regular->slot(i));
+    }
+  }
+  return true;
+}
+
+MessageSerializer::RegularCluster* MessageSerializer::ClusterFor(
+    Behavior cls) {
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    if (regular_clusters_[i]->cls() == cls) {
+      return regular_clusters_[i];
+    }
+  }
+
+  // Classes other than the shared ones are written with the class's mixin,
+  // methods and their symbols, which only the Newspeak Serializer does.
+  Entry* entry = Lookup(cls);
+  if ((entry->ref == kUnreached) || (entry->ref > num_shared_)) {
+    return NULL;
+  }
+  if ((cls == metaclass_) || (cls->Klass(heap_) == metaclass_) ||
+      (cls == method_)) {
+    return NULL;
+  }
+  RegularCluster* cluster =
+      new RegularCluster(cls, cls->format()->value());
+  if (!cluster->ComputeFilter(heap_, nil_)) {
+    delete cluster;
+    return NULL;
+  }
+
+  RegularCluster** clusters = new RegularCluster*[num_regular_clusters_ + 1];
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    clusters[i] = regular_clusters_[i];
+  }
+  delete[] regular_clusters_;
+  regular_clusters_ = clusters;
+  regular_clusters_[num_regular_clusters_++] = cluster;
+  return cluster;
+}
+
+void SnapshotWriter::Register(Object object) {
+  Entry* entry = Lookup(object);
+  ASSERT(entry->ref == 0);
+  entry->ref = next_ref_++;
+}
+
+void SnapshotWriter::WriteRef(Object object) {
+  Entry* entry = Lookup(object);
+  ASSERT(entry->ref > 0);
+  WriteLEB128(entry->ref);
+}
+
+void SnapshotWriter::WriteWeakRef(Object object) {
+  Entry* entry = Lookup(object);
+  WriteLEB128(entry->ref == kUnreached ? Lookup(nil_)->ref : entry->ref);
+}
+
+void MessageSerializer::WriteNodes() {
+  WriteIntegerNodes(integers_);
+  WriteLargeIntegerNodes(large_integers_);
+  WriteFloatNodes(floats_);
+  WriteByteArrayNodes(byte_arrays_);
+  if (!strings_->IsEmpty()) {
+    WriteStringNodes(strings_, NULL);  // No symbols.
+  }
+  WriteArrayNodes(kArrayCluster, arrays_);
+  WriteArrayNodes(kWeakArrayCluster, weak_arrays_);
+  WriteEphemeronNodes(ephemerons_);
+
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    WriteRegularNodes(regular_clusters_[i]);
+  }
+}
+
+void SnapshotWriter::WriteIntegerNodes(List* integers) {
+  if (integers->IsEmpty()) {
+    return;
+  }
+  WriteSLEB128(kIntegerCluster);
+  WriteLEB128(integers->size());
+  for (intptr_t i = 0; i < integers->size(); i++) {
+    Object object = integers->At(i);
+    Register(object);
+    WriteSLEB128(object->IsSmallInteger()
+                 ? static_cast<SmallInteger>(object)->value()
+                 : static_cast<MediumInteger>(object)->value());
+  }
+}
+
+void SnapshotWriter::WriteLargeIntegerNodes(List* large_integers) {
+  if (large_integers->IsEmpty()) {
+    return;
+  }
+  WriteSLEB128(kLargeIntegerCluster);
+  WriteLEB128(large_integers->size());
+  for (intptr_t i = 0; i < large_integers->size(); i++) {
+    LargeInteger object = static_cast<LargeInteger>(large_integers->At(i));
+    Register(object);
+    Write<uint8_t>(object->negative() ? 1 : 0);
+    intptr_t digits = object->size();
+    while ((digits > 0) && (object->digit(digits - 1) == 0)) {
+      digits--;
+    }
+    intptr_t bytes = digits * sizeof(digit_t);
+    if (digits > 0) {
+      digit_t top = object->digit(digits - 1);
+      while ((top >> ((sizeof(digit_t) - 1) * 8)) == 0) {
+        bytes--;
+        top <<= 8;
+      }
+    }
+    WriteLEB128(bytes);
+    for (intptr_t j = 0; j < bytes; j++) {
+      digit_t digit = object->digit(j / sizeof(digit_t));
+      Write<uint8_t>(digit >> ((j % sizeof(digit_t)) * 8));
+    }
+  }
+}
+
+void SnapshotWriter::WriteFloatNodes(List* floats) {
+  if (floats->IsEmpty()) {
+    return;
+  }
+  WriteSLEB128(kFloatCluster);
+  WriteLEB128(floats->size());
+  for (intptr_t i = 0; i < floats->size(); i++) {
+    Float object = static_cast<Float>(floats->At(i));
+    Register(object);
+    Write<double>(object->value());
+  }
+}
+
+void SnapshotWriter::WriteByteArrayNodes(List* byte_arrays) {
+  if (byte_arrays->IsEmpty()) {
+    return;
+  }
+  WriteSLEB128(kByteArrayCluster);
+  WriteLEB128(byte_arrays->size());
+  for (intptr_t i = 0; i < byte_arrays->size(); i++) {
+    ByteArray object = static_cast<ByteArray>(byte_arrays->At(i));
+    Register(object);
+    WriteLEB128(object->Size());
+    WriteBytes(object->element_addr(0), object->Size());
+  }
+}
+
+void SnapshotWriter::WriteStringNodes(List* strings, List* symbols) {
+  WriteSLEB128(kStringCluster);
+  List* lists[] = { strings, symbols };
+  for (List* list : lists) {
+    if (list == NULL) {
+      WriteLEB128(0);
+      continue;
+    }
+    WriteLEB128(list->size());
+    for (intptr_t i = 0; i < list->size(); i++) {
+      String object = static_cast<String>(list->At(i));
+      Register(object);
+      WriteLEB128(object->Size());
+      WriteBytes(object->element_addr(0), object->Size());
+    }
+  }
+}
+
+void SnapshotWriter::WriteArrayNodes(intptr_t format, List* arrays) {
+  if (arrays->IsEmpty()) {
+    return;
+  }
+  ASSERT((format == kArrayCluster) || (format == kWeakArrayCluster));
+  WriteSLEB128(format);
+  WriteLEB128(arrays->size());
+  for (intptr_t i = 0; i < arrays->size(); i++) {
+    Object object = arrays->At(i);
+    Register(object);
+    WriteLEB128(format == kArrayCluster
+                ? static_cast<Array>(object)->Size()
+                : static_cast<WeakArray>(object)->Size());
+  }
+}
+
+void SnapshotWriter::WriteEphemeronNodes(List* ephemerons) {
+  if (ephemerons->IsEmpty()) {
+    return;
+  }
+  WriteSLEB128(kEphemeronCluster);
+  WriteLEB128(ephemerons->size());
+  for (intptr_t i = 0; i < ephemerons->size(); i++) {
+    Register(ephemerons->At(i));
+  }
+}
+
+void MessageSerializer::WriteEdges() {
+  WriteArrayEdges(arrays_);
+  WriteWeakArrayEdges(weak_arrays_);
+  WriteEphemeronEdges(ephemerons_);
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    WriteRegularEdges(regular_clusters_[i]);
+  }
+}
+
+void SnapshotWriter::WriteRegularNodes(RegularCluster* cluster) {
+  WriteSLEB128(cluster->num_slots());
+  WriteLEB128(cluster->objects()->size());
+  for (intptr_t i = 0; i < cluster->objects()->size(); i++) {
+    Register(cluster->objects()->At(i));
+  }
+}
+
+void SnapshotWriter::WriteArrayEdges(List* arrays) {
+  for (intptr_t i = 0; i < arrays->size(); i++) {
+    Array object = static_cast<Array>(arrays->At(i));
+    for (intptr_t j = 0; j < object->Size(); j++) {
+      WriteRef(object->element(j));
+    }
+  }
+}
+
+void SnapshotWriter::WriteWeakArrayEdges(List* weak_arrays) {
+  for (intptr_t i = 0; i < weak_arrays->size(); i++) {
+    WeakArray object = static_cast<WeakArray>(weak_arrays->At(i));
+    for (intptr_t j = 0; j < object->Size(); j++) {
+      WriteWeakRef(object->element(j));
+    }
+  }
+}
+
+void SnapshotWriter::WriteEphemeronEdges(List* ephemerons) {
+  if (ephemerons->IsEmpty()) {
+    return;
+  }
+  WriteRef(heap_->interpreter()->object_store()->Ephemeron());
+  for (intptr_t i = 0; i < ephemerons->size(); i++) {
+    Ephemeron object = static_cast<Ephemeron>(ephemerons->At(i));
+    WriteWeakRef(object->key());
+    WriteWeakRef(object->value());
+    WriteRef(object->finalizer());
+  }
+}
+
+void SnapshotWriter::WriteRegularEdges(RegularCluster* cluster) {
+  WriteRef(cluster->cls());
+  for (intptr_t i = 0; i < cluster->objects()->size(); i++) {
+    RegularObject object =
+        static_cast<RegularObject>(cluster->objects()->At(i));
+    for (intptr_t j = 0; j < cluster->num_slots(); j++) {
+      WriteRef(cluster->IsWritten(j) ? object->slot(j) : nil_);
+    }
+  }
+}
+
+void SnapshotWriter::WriteLEB128(uintptr_t value) {
+  while (value >= 0x80) {
+    Write<uint8_t>(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  Write<uint8_t>(static_cast<uint8_t>(value));
+}
+
+void SnapshotWriter::WriteSLEB128(int64_t value) {
+  for (;;) {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    if (((value == 0) && ((byte & 0x40) == 0)) ||
+        ((value == -1) && ((byte & 0x40) != 0))) {
+      Write<uint8_t>(byte);
+      return;
+    }
+    Write<uint8_t>(byte | 0x80);
+  }
+}
+
+void SnapshotWriter::Reserve(intptr_t bytes) {
+  if (length_ + bytes <= capacity_bytes_) {
+    return;
+  }
+  intptr_t new_capacity = capacity_bytes_ == 0 ? 256 : capacity_bytes_ * 2;
+  while (new_capacity < length_ + bytes) {
+    new_capacity *= 2;
+  }
+  data_ = reinterpret_cast<uint8_t*>(realloc(data_, new_capacity));
+  capacity_bytes_ = new_capacity;
+}
+
+ImageSerializer::ImageSerializer(Heap* heap)
+    : SnapshotWriter(heap),
+      interpreter_(heap->interpreter()),
+      metaclass_(),
+      integers_(new List()),
+      large_integers_(new List()),
+      floats_(new List()),
+      byte_arrays_(new List()),
+      strings_(new List()),
+      symbols_(new List()),
+      arrays_(new List()),
+      weak_arrays_(new List()),
+      ephemerons_(new List()),
+      closures_(new List()),
+      activations_(new List()),
+      clusters_by_cid_(NULL),
+      clusters_by_cid_capacity_(0),
+      regular_clusters_(NULL),
+      num_regular_clusters_(0),
+      num_slots_(0),
+      num_bytes_(0) {
+}
+
+ImageSerializer::~ImageSerializer() {
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    delete regular_clusters_[i];
+  }
+  delete[] regular_clusters_;
+  delete[] clusters_by_cid_;
+  delete integers_;
+  delete large_integers_;
+  delete floats_;
+  delete byte_arrays_;
+  delete strings_;
+  delete symbols_;
+  delete arrays_;
+  delete weak_arrays_;
+  delete ephemerons_;
+  delete closures_;
+  delete activations_;
+}
+
+bool ImageSerializer::Serialize(Object object_store) {
+  ObjectStore os = static_cast<ObjectStore>(object_store);
+  nil_ = os->nil_obj();
+  // The class of a class's class.
+  metaclass_ = os->Array()->Klass(heap_)->Klass(heap_);
+
+  Enqueue(os);
+  do {
+    while (!stack_->IsEmpty()) {
+      if (!Analyze(stack_->RemoveLast())) {
+        return false;
+      }
+    }
+  } while (Retrace());
+
+  // In the order of WriteNodes, which leaves out empty clusters.
+  List* leaves[] = { integers_, large_integers_, floats_, byte_arrays_ };
+  List* branches[] = { arrays_, weak_arrays_, ephemerons_, closures_,
+                       activations_ };
+  bool has_strings = !strings_->IsEmpty() || !symbols_->IsEmpty();
+  intptr_t num_clusters = num_regular_clusters_ + (has_strings ? 1 : 0);
+  for (List* list : leaves) {
+    if (!list->IsEmpty()) {
+      num_clusters++;
+    }
+  }
+  for (List* list : branches) {
+    if (!list->IsEmpty()) {
+      num_clusters++;
+    }
+  }
+
+  Write<uint16_t>(0x1984);
+  WriteLEB128(kImageVersion);
+  WriteLEB128(num_clusters);
+  WriteLEB128(num_entries_);
+  WriteNodes();
+
+  intptr_t* edge_offsets = new intptr_t[num_clusters + 1];
+  intptr_t cluster = 0;
+  for (List* list : leaves) {
+    if (!list->IsEmpty()) {
+      edge_offsets[cluster++] = length_;
+    }
+  }
+  if (has_strings) {
+    edge_offsets[cluster++] = length_;
+  }
+  for (List* list : branches) {
+    if (list->IsEmpty()) {
+      continue;
+    }
+    edge_offsets[cluster++] = length_;
+    if (list == arrays_) {
+      WriteArrayEdges(arrays_);
+    } else if (list == weak_arrays_) {
+      WriteWeakArrayEdges(weak_arrays_);
+    } else if (list == ephemerons_) {
+      WriteEphemeronEdges(ephemerons_);
+    } else if (list == closures_) {
+      WriteClosureEdges();
+    } else {
+      WriteActivationEdges();
+    }
+  }
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    edge_offsets[cluster++] = length_;
+    WriteRegularEdges(regular_clusters_[i]);
+  }
+  ASSERT(cluster == num_clusters);
+  edge_offsets[cluster] = length_;
+  WriteRef(os);
+
+  WriteTrailer(edge_offsets, num_clusters);
+  delete[] edge_offsets;
+  return true;
+}
+
+// An ephemeron's value is written only if its key is written.
+bool ImageSerializer::Retrace() {
+  bool found = false;
+  for (intptr_t i = 0; i < ephemerons_->size(); i++) {
+    Ephemeron ephemeron = static_cast<Ephemeron>(ephemerons_->At(i));
+    if (Lookup(ephemeron->key())->ref != kUnreached) {
+      Object value = ephemeron->value();
+      if (Lookup(value)->ref == kUnreached) {
+        Enqueue(value);
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+bool ImageSerializer::Analyze(Object object) {
+  if (object->IsSmallInteger()) {
+    integers_->Add(object);
+    num_bytes_ += 8;
+    return true;
+  }
+
+  switch (object->ClassId()) {
+    case kMediumIntegerCid:
+      integers_->Add(object);
+      num_bytes_ += 8;
+      return true;
+    case kLargeIntegerCid:
+      large_integers_->Add(object);
+      num_bytes_ += static_cast<LargeInteger>(object)->size() *
+                    sizeof(digit_t);
+      return true;
+    case kFloatCid:
+      floats_->Add(object);
+      num_bytes_ += 8;
+      return true;
+    case kByteArrayCid:
+      byte_arrays_->Add(object);
+      num_bytes_ += static_cast<ByteArray>(object)->Size();
+      return true;
+    case kStringCid: {
+      String string = static_cast<String>(object);
+      if (string->is_canonical()) {
+        symbols_->Add(object);
+      } else {
+        strings_->Add(object);
+      }
+      num_bytes_ += string->Size();
+      return true;
+    }
+    case kArrayCid: {
+      arrays_->Add(object);
+      Array array = static_cast<Array>(object);
+      intptr_t size = array->Size();
+      for (intptr_t i = 0; i < size; i++) {
+        Enqueue(array->element(i));
+      }
+      num_slots_ += size;
+      return true;
+    }
+    case kWeakArrayCid:
+      weak_arrays_->Add(object);  // Not traced.
+      num_slots_ += static_cast<WeakArray>(object)->Size();
+      return true;
+    case kEphemeronCid:
+      ephemerons_->Add(object);
+      Enqueue(static_cast<Ephemeron>(object)->finalizer());
+      num_slots_ += 3;
+      return true;
+    case kClosureCid: {
+      closures_->Add(object);
+      Closure closure = static_cast<Closure>(object);
+      Enqueue(closure->defining_activation());
+      Enqueue(closure->initial_bci());
+      Enqueue(closure->num_args());
+      intptr_t size = closure->NumCopied();
+      for (intptr_t i = 0; i < size; i++) {
+        Enqueue(closure->copied(i));
+      }
+      num_slots_ += 3 + size;
+      return true;
+    }
+    case kActivationCid: {
+      Activation activation = static_cast<Activation>(object);
+      intptr_t size = interpreter_->ActivationTempSize(activation);
+      if (size >= kMaxTemps) {
+        return false;  // See ActivationCluster::ReadEdges.
+      }
+      activations_->Add(object);
+      if (!interpreter_->ActivationHasFrame(activation)) {
+        Enqueue(activation->sender());
+        Enqueue(activation->bci());
+      }
+      Enqueue(activation->method());
+      Enqueue(activation->closure());
+      Enqueue(activation->receiver());
+      for (intptr_t i = 0; i < size; i++) {
+        Enqueue(interpreter_->ActivationTempAt(activation, i));
+      }
+      num_slots_ += 6 + size;
+      return true;
+    }
+  }
+
+  if (!object->IsRegularObject()) {
+    return false;
+  }
+  RegularCluster* cluster = ClusterFor(object);
+  if (cluster == NULL) {
+    return false;
+  }
+  cluster->objects()->Add(object);
+  RegularObject regular = static_cast<RegularObject>(object);
+  for (intptr_t i = 0; i < cluster->num_slots(); i++) {
+    if (cluster->IsWritten(i)) {
+      Enqueue(regular->slot(i));
+    }
+  }
+  num_slots_ += cluster->num_slots();
+  return true;
+}
+
+ImageSerializer::RegularCluster* ImageSerializer::ClusterFor(Object object) {
+  intptr_t cid = object->ClassId();
+  if (cid >= clusters_by_cid_capacity_) {
+    intptr_t new_capacity = clusters_by_cid_capacity_ == 0
+        ? 1024 : clusters_by_cid_capacity_;
+    while (new_capacity <= cid) {
+      new_capacity *= 2;
+    }
+    RegularCluster** clusters = new RegularCluster*[new_capacity];
+    for (intptr_t i = 0; i < new_capacity; i++) {
+      clusters[i] = i < clusters_by_cid_capacity_ ? clusters_by_cid_[i] : NULL;
+    }
+    delete[] clusters_by_cid_;
+    clusters_by_cid_ = clusters;
+    clusters_by_cid_capacity_ = new_capacity;
+  }
+  if (clusters_by_cid_[cid] != NULL) {
+    return clusters_by_cid_[cid];
+  }
+
+  Behavior cls = object->Klass(heap_);
+  RegularCluster* cluster = new RegularCluster(cls, cls->format()->value());
+  if (!cluster->ComputeFilter(heap_, nil_)) {
+    delete cluster;
+    return NULL;
+  }
+  if ((cls == metaclass_) || (cls->Klass(heap_) == metaclass_)) {
+    cluster->ExcludeBehaviorId();
+  }
+
+  RegularCluster** clusters = new RegularCluster*[num_regular_clusters_ + 1];
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    clusters[i] = regular_clusters_[i];
+  }
+  delete[] regular_clusters_;
+  regular_clusters_ = clusters;
+  regular_clusters_[num_regular_clusters_++] = cluster;
+  clusters_by_cid_[cid] = cluster;
+  Enqueue(cls);
+  return cluster;
+}
+
+void ImageSerializer::WriteNodes() {
+  WriteIntegerNodes(integers_);
+  WriteLargeIntegerNodes(large_integers_);
+  WriteFloatNodes(floats_);
+  WriteByteArrayNodes(byte_arrays_);
+  if (!strings_->IsEmpty() || !symbols_->IsEmpty()) {
+    WriteStringNodes(strings_, symbols_);
+  }
+  WriteArrayNodes(kArrayCluster, arrays_);
+  WriteArrayNodes(kWeakArrayCluster, weak_arrays_);
+  WriteEphemeronNodes(ephemerons_);
+
+  if (!closures_->IsEmpty()) {
+    WriteSLEB128(kClosureCluster);
+    WriteLEB128(closures_->size());
+    for (intptr_t i = 0; i < closures_->size(); i++) {
+      Closure object = static_cast<Closure>(closures_->At(i));
+      Register(object);
+      WriteLEB128(object->NumCopied());
+    }
+  }
+
+  if (!activations_->IsEmpty()) {
+    WriteSLEB128(kActivationCluster);
+    WriteLEB128(activations_->size());
+    for (intptr_t i = 0; i < activations_->size(); i++) {
+      Register(activations_->At(i));
+    }
+  }
+
+  for (intptr_t i = 0; i < num_regular_clusters_; i++) {
+    WriteRegularNodes(regular_clusters_[i]);
+  }
+}
+
+void ImageSerializer::WriteClosureEdges() {
+  for (intptr_t i = 0; i < closures_->size(); i++) {
+    Closure object = static_cast<Closure>(closures_->At(i));
+    WriteRef(object->defining_activation());
+    WriteRef(object->initial_bci());
+    WriteRef(object->num_args());
+    for (intptr_t j = 0; j < object->NumCopied(); j++) {
+      WriteRef(object->copied(j));
+    }
+  }
+}
+
+void ImageSerializer::WriteActivationEdges() {
+  for (intptr_t i = 0; i < activations_->size(); i++) {
+    Activation object = static_cast<Activation>(activations_->At(i));
+    if (interpreter_->ActivationHasFrame(object)) {
+      // As if its frame had returned; see LivingFrameStack.
+      WriteRef(nil_);
+      WriteRef(nil_);
+    } else {
+      WriteRef(object->sender());
+      WriteRef(object->bci());
+    }
+    WriteRef(object->method());
+    WriteRef(object->closure());
+    WriteRef(object->receiver());
+    intptr_t size = interpreter_->ActivationTempSize(object);
+    WriteLEB128(size);
+    for (intptr_t j = 0; j < size; j++) {
+      WriteRef(interpreter_->ActivationTempAt(object, j));
+    }
+  }
+}
+
+void ImageSerializer::WriteTrailer(intptr_t* edge_offsets,
+                                   intptr_t num_clusters) {
+  uint32_t table = length_;
+  for (intptr_t i = 0; i <= num_clusters; i++) {
+    WriteLEB128(edge_offsets[i]);
+  }
+  WriteLEB128(num_slots_);
+  WriteLEB128(num_bytes_);
+
+  WriteLEB128(interpreter_->isolate()->salt());
+  // A string's identity hash is its hash, which the salt recreates.
+  intptr_t num_hashed = 0;
+  for (intptr_t pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      WriteLEB128(num_hashed);
+    }
+    for (intptr_t i = 0; i < capacity_; i++) {
+      Object object = static_cast<Object>(entries_[i].key);
+      if ((entries_[i].ref == kUnreached) || !object->IsHeapObject() ||
+          object->IsString()) {
+        continue;
+      }
+      intptr_t hash = heap_->IdentityHash(static_cast<HeapObject>(object));
+      if (hash == 0) {
+        continue;
+      }
+      if (pass == 0) {
+        num_hashed++;
+      } else {
+        WriteLEB128(entries_[i].ref);
+        WriteLEB128(hash);
+      }
+    }
+  }
+
+  Write<uint32_t>(table);
+}
+
+struct MessageDeserializer::ClusterInfo {
+  intptr_t format;
+  intptr_t ref_start;
+  intptr_t ref_stop;
+  intptr_t class_ref;  // For regular objects.
+};
+
+MessageDeserializer::MessageDeserializer(Heap* heap,
+                                         const uint8_t* data,
+                                         intptr_t length)
+    : heap_(heap),
+      reader_(heap, const_cast<uint8_t*>(data), length),
+      next_ref_(1) {
+}
+
+Object MessageDeserializer::Deserialize() {
+  if (reader_.Read<uint16_t>() != 0x1984) {
+    FATAL("Wrong magic value");
+  }
+  if (reader_.ReadLEB128() != 0) {
+    FATAL("Wrong message version");
+  }
+  intptr_t num_clusters = reader_.ReadLEB128();
+  intptr_t num_refs = reader_.ReadLEB128();
+
+  // The objects read so far, in a handle because reading allocates.
+  Array refs = heap_->AllocateArray(num_refs + 1);  // SAFEPOINT
+  ObjectStore os = heap_->interpreter()->object_store();
+  Object nil = os->nil_obj();
+  for (intptr_t i = 0; i <= num_refs; i++) {
+    refs->set_element(i, nil, kNoBarrier);
+  }
+  HandleScope h1(heap_, reinterpret_cast<Object*>(&refs));
+
+  Array shared = os->message_shared_objects();
+  for (intptr_t i = 0; i < shared->Size(); i++) {
+    refs->set_element(next_ref_++, shared->element(i));
+  }
+
+  ClusterInfo* clusters = new ClusterInfo[num_clusters];
+  for (intptr_t i = 0; i < num_clusters; i++) {
+    clusters[i].format = reader_.ReadSLEB128();
+    ReadNodes(&clusters[i], &refs);  // SAFEPOINT
+  }
+  ASSERT(next_ref_ == num_refs + 1);
+  for (intptr_t i = 0; i < num_clusters; i++) {
+    ReadEdges(&clusters[i], refs);
+  }
+  intptr_t root = reader_.ReadLEB128();
+  for (intptr_t i = 0; i < num_clusters; i++) {
+    AdoptInstances(&clusters[i], &refs);  // SAFEPOINT
+  }
+  delete[] clusters;
+
+  return refs->element(root);
+}
+
+void MessageDeserializer::ReadNodes(ClusterInfo* cluster, Array* refs) {
+  intptr_t num_objects = reader_.ReadLEB128();
+  if (cluster->format == kStringCluster) {
+    // Non-canonical strings, then symbols, which MessageSerializer leaves to
+    // the Newspeak Serializer.
+    cluster->ref_start = next_ref_;
+    for (intptr_t i = 0; i < num_objects; i++) {
+      intptr_t size = reader_.ReadLEB128();
+      String object = heap_->AllocateString(size);  // SAFEPOINT
+      memcpy(object->element_addr(0), reader_.cursor(), size);
+      reader_.Skip(size);
+      (*refs)->set_element(next_ref_++, object);
+    }
+    if (reader_.ReadLEB128() != 0) {
+      FATAL("Symbol in message");
+    }
+    cluster->ref_stop = next_ref_;
+    return;
+  }
+
+  cluster->ref_start = next_ref_;
+  for (intptr_t i = 0; i < num_objects; i++) {
+    Object object;
+    switch (cluster->format) {
+      case kIntegerCluster: {
+        int64_t value = reader_.ReadSLEB128<int64_t>();
+        if (SmallInteger::IsSmiValue(value)) {
+          object = SmallInteger::New(value);
+        } else {
+          MediumInteger mint = heap_->AllocateMediumInteger();  // SAFEPOINT
+          mint->set_value(value);
+          object = mint;
+        }
+        break;
+      }
+      case kLargeIntegerCluster: {
+        bool negative = reader_.Read<uint8_t>();
+        intptr_t bytes = reader_.ReadLEB128();
+        intptr_t digits = (bytes + (sizeof(digit_t) - 1)) / sizeof(digit_t);
+        LargeInteger large =
+            heap_->AllocateLargeInteger(digits);  // SAFEPOINT
+        large->set_negative(negative);
+        large->set_size(digits);
+        for (intptr_t j = 0; j < digits; j++) {
+          large->set_digit(j, 0);
+        }
+        for (intptr_t j = 0; j < bytes; j++) {
+          digit_t byte = reader_.Read<uint8_t>();
+          intptr_t index = j / sizeof(digit_t);
+          large->set_digit(index, large->digit(index) |
+                           (byte << ((j % sizeof(digit_t)) * 8)));
+        }
+        object = large;
+        break;
+      }
+      case kFloatCluster: {
+        double value = reader_.Read<double>();
+        Float number = heap_->AllocateFloat();  // SAFEPOINT
+        number->set_value(value);
+        object = number;
+        break;
+      }
+      case kByteArrayCluster: {
+        intptr_t size = reader_.ReadLEB128();
+        ByteArray bytes = heap_->AllocateByteArray(size);  // SAFEPOINT
+        memcpy(bytes->element_addr(0), reader_.cursor(), size);
+        reader_.Skip(size);
+        object = bytes;
+        break;
+      }
+      case kArrayCluster: {
+        intptr_t size = reader_.ReadLEB128();
+        Array array = heap_->AllocateArray(size);  // SAFEPOINT
+        Object nil = heap_->interpreter()->nil_obj();
+        for (intptr_t j = 0; j < size; j++) {
+          array->set_element(j, nil, kNoBarrier);
+        }
+        object = array;
+        break;
+      }
+      case kWeakArrayCluster: {
+        intptr_t size = reader_.ReadLEB128();
+        WeakArray array = heap_->AllocateWeakArray(size);  // SAFEPOINT
+        Object nil = heap_->interpreter()->nil_obj();
+        for (intptr_t j = 0; j < size; j++) {
+          array->set_element(j, nil, kNoBarrier);
+        }
+        object = array;
+        break;
+      }
+      case kEphemeronCluster: {
+        RegularObject ephemeron =
+            heap_->AllocateRegularObject(kEphemeronCid, 3);  // SAFEPOINT
+        Object nil = heap_->interpreter()->nil_obj();
+        for (intptr_t j = 0; j < 3; j++) {
+          ephemeron->set_slot(j, nil, kNoBarrier);
+        }
+        object = ephemeron;
+        break;
+      }
+      default: {
+        if (cluster->format < 0) {
+          FATAL("Unexpected cluster format %" Pd " in message",
+                cluster->format);
+        }
+        // Allocated as instances of the message loop's class, which is alive
+        // for the collector, until the cluster's class is read with the
+        // edges; see AdoptInstances.
+        intptr_t cid = heap_->interpreter()->object_store()->
+            message_loop()->ClassId();
+        RegularObject regular =
+            heap_->AllocateRegularObject(cid, cluster->format);  // SAFEPOINT
+        Object nil = heap_->interpreter()->nil_obj();
+        for (intptr_t j = 0; j < cluster->format; j++) {
+          regular->set_slot(j, nil, kNoBarrier);
+        }
+        object = regular;
+        break;
+      }
+    }
+    (*refs)->set_element(next_ref_++, object);
+  }
+  cluster->ref_stop = next_ref_;
+}
+
+void MessageDeserializer::ReadEdges(ClusterInfo* cluster, Array refs) {
+  switch (cluster->format) {
+    case kArrayCluster:
+      for (intptr_t i = cluster->ref_start; i < cluster->ref_stop; i++) {
+        Array object = static_cast<Array>(refs->element(i));
+        for (intptr_t j = 0; j < object->Size(); j++) {
+          object->set_element(j, refs->element(reader_.ReadLEB128()));
+        }
+      }
+      return;
+    case kWeakArrayCluster:
+      for (intptr_t i = cluster->ref_start; i < cluster->ref_stop; i++) {
+        WeakArray object = static_cast<WeakArray>(refs->element(i));
+        for (intptr_t j = 0; j < object->Size(); j++) {
+          object->set_element(j, refs->element(reader_.ReadLEB128()));
+        }
+      }
+      return;
+    case kEphemeronCluster:
+      reader_.ReadLEB128();  // Ephemeron.
+      for (intptr_t i = cluster->ref_start; i < cluster->ref_stop; i++) {
+        Ephemeron object = static_cast<Ephemeron>(refs->element(i));
+        object->set_key(refs->element(reader_.ReadLEB128()));
+        object->set_value(refs->element(reader_.ReadLEB128()));
+        object->set_finalizer(refs->element(reader_.ReadLEB128()));
+      }
+      return;
+  }
+  if (cluster->format < 0) {
+    return;  // No edges.
+  }
+
+  cluster->class_ref = reader_.ReadLEB128();
+  for (intptr_t i = cluster->ref_start; i < cluster->ref_stop; i++) {
+    RegularObject object = static_cast<RegularObject>(refs->element(i));
+    for (intptr_t j = 0; j < cluster->format; j++) {
+      object->set_slot(j, refs->element(reader_.ReadLEB128()));
+    }
+  }
+}
+
+void MessageDeserializer::AdoptInstances(ClusterInfo* cluster, Array* refs) {
+  if (cluster->format < 0) {
+    return;
+  }
+
+  Behavior cls = static_cast<Behavior>((*refs)->element(cluster->class_ref));
+  ASSERT(cls->format()->value() == cluster->format);
+  SmallInteger id = cls->id();
+  if (id == heap_->interpreter()->nil_obj()) {
+    id = SmallInteger::New(heap_->AllocateClassId());  // SAFEPOINT
+    cls = static_cast<Behavior>((*refs)->element(cluster->class_ref));
+    cls->set_id(id);
+    heap_->RegisterClass(id->value(), cls);
+  }
+  for (intptr_t i = cluster->ref_start; i < cluster->ref_stop; i++) {
+    static_cast<HeapObject>((*refs)->element(i))->set_cid(id->value());
+  }
+}
+
+struct SnapshotImage::Entry {
+  const void* snapshot;
+  size_t snapshot_length;
+  intptr_t reads;
+  SnapshotImage* image;
+  Entry* next;
+};
+
+Mutex* SnapshotImage::mutex_ = NULL;
+SnapshotImage::Entry* SnapshotImage::entries_ = NULL;
+
+// static
+void SnapshotImage::Startup() {
+  mutex_ = new Mutex();
+}
+
+// static
+void SnapshotImage::Shutdown() {
+  while (entries_ != NULL) {
+    Entry* entry = entries_;
+    entries_ = entry->next;
+    delete entry->image;
+    delete entry;
+  }
+  delete mutex_;
+  mutex_ = NULL;
+}
+
+// static
+const SnapshotImage* SnapshotImage::Lookup(const void* snapshot,
+                                           size_t snapshot_length,
+                                           bool* record) {
+  MutexLocker ml(mutex_);
+  Entry* entry = entries_;
+  while ((entry != NULL) && ((entry->snapshot != snapshot) ||
+                             (entry->snapshot_length != snapshot_length))) {
+    entry = entry->next;
+  }
+  if (entry == NULL) {
+    entry = new Entry;
+    entry->snapshot = snapshot;
+    entry->snapshot_length = snapshot_length;
+    entry->reads = 0;
+    entry->image = NULL;
+    entry->next = entries_;
+    entries_ = entry;
+  }
+  if (entry->image != NULL) {
+    return entry->image;
+  }
+  // A snapshot only ever read once, by the first isolate, costs no image.
+  entry->reads++;
+  *record = entry->reads > 1;
+  return NULL;
+}
+
+// static
+void SnapshotImage::Add(const void* snapshot,
+                        size_t snapshot_length,
+                        SnapshotImage* image) {
+  MutexLocker ml(mutex_);
+  for (Entry* entry = entries_; entry != NULL; entry = entry->next) {
+    if ((entry->snapshot == snapshot) &&
+        (entry->snapshot_length == snapshot_length)) {
+      if (entry->image == NULL) {
+        entry->image = image;
+        return;
+      }
+      break;
+    }
+  }
+  delete image;  // Another isolate recorded it first.
+}
+
+// Pointers between the recorded objects are stored as heap objects whose
+// address is their index in the image shifted by the object alignment.
+static Object EncodeIndex(intptr_t index) {
+  return HeapObject::FromAddr(static_cast<uword>(index)
+                              << kObjectAlignmentLog2);
+}
+
+static intptr_t DecodeIndex(Object encoded) {
+  return static_cast<HeapObject>(encoded)->Addr() >> kObjectAlignmentLog2;
+}
+
+static intptr_t IndexOf(Object object,
+                        const uword* addresses,
+                        const intptr_t* indices,
+                        intptr_t mask) {
+  uword addr = static_cast<HeapObject>(object)->Addr();
+  intptr_t probe = (addr >> kObjectAlignmentLog2) & mask;
+  while (addresses[probe] != addr) {
+    ASSERT(addresses[probe] != 0);  // Snapshots are closed.
+    probe = (probe + 1) & mask;
+  }
+  return indices[probe];
+}
+
+SnapshotImage::SnapshotImage(const Object* refs,
+                             intptr_t num_refs,
+                             const intptr_t* class_cids,
+                             const Object* class_objects,
+                             intptr_t num_classes,
+                             Object object_store)
+    : num_objects_(0),
+      offsets_(NULL),
+      data_(NULL),
+      classes_(NULL),
+      num_classes_(num_classes),
+      object_store_(0) {
+  intptr_t num_words = 0;
+  for (intptr_t i = 1; i < num_refs; i++) {
+    if (refs[i].IsHeapObject()) {
+      num_objects_++;
+      num_words += static_cast<HeapObject>(refs[i])->HeapSize() / kWordSize;
+    }
+  }
+
+  // Object addresses to indices, by open addressing.
+  intptr_t capacity = 16;
+  while (capacity < 2 * num_objects_) {
+    capacity *= 2;
+  }
+  const intptr_t mask = capacity - 1;
+  uword* addresses = new uword[capacity];
+  intptr_t* indices = new intptr_t[capacity];
+  memset(addresses, 0, capacity * sizeof(uword));
+
+  offsets_ = new intptr_t[num_objects_ + 1];
+  data_ = new uword[num_words];
+  HeapObject* objects = new HeapObject[num_objects_];
+  intptr_t index = 0;
+  intptr_t offset = 0;
+  for (intptr_t i = 1; i < num_refs; i++) {
+    if (!refs[i].IsHeapObject()) {
+      continue;
+    }
+    HeapObject object = static_cast<HeapObject>(refs[i]);
+    intptr_t heap_size = object->HeapSize();
+    objects[index] = object;
+    offsets_[index] = offset;
+    memcpy(&data_[offset], reinterpret_cast<void*>(object->Addr()), heap_size);
+    offset += heap_size / kWordSize;
+
+    intptr_t probe = (object->Addr() >> kObjectAlignmentLog2) & mask;
+    while (addresses[probe] != 0) {
+      probe = (probe + 1) & mask;
+    }
+    addresses[probe] = object->Addr();
+    indices[probe] = index;
+    index++;
+  }
+  ASSERT(index == num_objects_);
+  ASSERT(offset == num_words);
+  offsets_[num_objects_] = offset;
+
+  for (intptr_t i = 0; i < num_objects_; i++) {
+    HeapObject object = objects[i];
+    Object* copy = reinterpret_cast<Object*>(&data_[offsets_[i]]);
+    Object* base = reinterpret_cast<Object*>(object->Addr());
+    Object* from;
+    Object* to;
+    object->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      if (ptr->IsHeapObject()) {
+        copy[ptr - base] = EncodeIndex(
+            IndexOf(*ptr, addresses, indices, mask));
+      }
+    }
+  }
+
+  classes_ = new intptr_t[2 * num_classes_];
+  for (intptr_t i = 0; i < num_classes_; i++) {
+    classes_[2 * i] = class_cids[i];
+    classes_[2 * i + 1] =
+        IndexOf(class_objects[i], addresses, indices, mask);
+  }
+  object_store_ = IndexOf(object_store, addresses, indices, mask);
+
+  delete[] objects;
+  delete[] indices;
+  delete[] addresses;
+}
+
+SnapshotImage::~SnapshotImage() {
+  delete[] offsets_;
+  delete[] data_;
+  delete[] classes_;
+}
+
+Object SnapshotImage::Instantiate(Heap* heap) const {
+  // Class ids are handed out in the same order as when the snapshot was read.
+  for (intptr_t i = 0; i < num_classes_; i++) {
+    intptr_t cid = classes_[2 * i];
+    if (cid >= kFirstRegularObjectCid) {
+      intptr_t allocated = heap->AllocateClassId();
+      if (allocated != cid) {
+        FATAL("Snapshot image class id mismatch");
+      }
+    }
+  }
+
+  heap->ReserveSnapshot(offsets_[num_objects_] * kWordSize);
+  HeapObject* objects = new HeapObject[num_objects_];
+  for (intptr_t i = 0; i < num_objects_; i++) {
+    objects[i] = heap->AllocateSnapshotCopy(
+        &data_[offsets_[i]], (offsets_[i + 1] - offsets_[i]) * kWordSize);
+  }
+  for (intptr_t i = 0; i < num_objects_; i++) {
+    Object* from;
+    Object* to;
+    objects[i]->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      if (ptr->IsHeapObject()) {
+        *ptr = objects[DecodeIndex(*ptr)];
+      }
+    }
+  }
+
+  for (intptr_t i = 0; i < num_classes_; i++) {
+    Behavior cls = static_cast<Behavior>(objects[classes_[2 * i + 1]]);
+    // Registering sets the id, which the snapshot may since have replaced.
+    SmallInteger id = cls->id();
+    heap->RegisterClass(classes_[2 * i], cls);
+    cls->set_id(id);
+  }
+
+  Object object_store = objects[object_store_];
+  delete[] objects;
+  return object_store;
+}
+
 }  // namespace psoup
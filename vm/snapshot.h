@@ -12,8 +12,28 @@
 namespace psoup {
 
 class Cluster;
+class EdgesTask;
 class Heap;
+class Interpreter;
+class Mutex;
 class Object;
+class SnapshotImage;
+
+// A record of one Deserialize. Times are in monotonic nanoseconds, and a
+// snapshot copied from its SnapshotImage spends nothing in the read phases.
+struct DeserializeEvent {
+  int64_t snapshot_length;
+  int64_t num_objects;
+  int64_t from_image;
+  int64_t clusters;  // The header, trailer and each cluster's description.
+  int64_t nodes;
+  int64_t edges;
+  int64_t classes;  // Registering classes and loading eager bytecode.
+  int64_t image;  // Copying from or recording a SnapshotImage.
+  int64_t initialize;  // Interpreter::InitializeRoot and
+                       // Heap::InitializeAfterSnapshot.
+  int64_t total;
+};
 
 // Reads a variant of VictoryFuel.
 class Deserializer : public ValueObject {
@@ -21,6 +41,13 @@ class Deserializer : public ValueObject {
   Deserializer(Heap* heap, void* snapshot, size_t snapshot_length);
   ~Deserializer();
 
+  // Called on the reading thread at the end of every Deserialize, such as by
+  // the snapshot benchmark.
+  typedef void (*EventCallback)(const DeserializeEvent& event);
+  static void SetEventCallback(EventCallback callback) {
+    event_callback_ = callback;
+  }
+
   intptr_t position() { return cursor_ - snapshot_; }
   template <typename T>
   T Read() {
@@ -29,6 +56,8 @@ class Deserializer : public ValueObject {
     cursor_ += sizeof(T);
     return result;
   }
+  void Skip(intptr_t bytes) { cursor_ += bytes; }
+  const uint8_t* cursor() const { return cursor_; }
   template <typename T = uintptr_t>
   T ReadLEB128();
   template <typename T = intptr_t>
@@ -36,10 +65,26 @@ class Deserializer : public ValueObject {
 
   void Deserialize();
 
+  // Revision 3 snapshots may leave method bytecode in the snapshot; see
+  // Method::HasBytecode. Returns the bytecode at |position| in |snapshot| and
+  // sets |length| to its size.
+  static const uint8_t* LazyBytecode(const void* snapshot,
+                                     SmallInteger position,
+                                     intptr_t* length);
+  // Loads a method's bytecode while the snapshot is being read.
+  void LoadBytecode(Method method);
+
   Cluster* ReadCluster();
 
+  // For the classes of regular object clusters.
+  void RegisterClass(intptr_t cid, Behavior cls);
+
   intptr_t next_ref() const { return next_ref_; }
 
+  // For snapshots with objects besides those in the refs, such as the temps
+  // of activations, which a SnapshotImage would not copy.
+  void NotRecordable() { recordable_ = false; }
+
   void RegisterRef(Object object) {
     refs_[next_ref_++] = object;
   }
@@ -53,9 +98,34 @@ class Deserializer : public ValueObject {
   }
 
  private:
+  friend class EdgesTask;
+
+  // Bytes of edges below which another reader is not worth starting.
+  static constexpr intptr_t kMinEdgesPerReader = 64 * KB;
+  static constexpr intptr_t kMaxEdgeReaders = 8;
+
+  // A reader of the edges at |offset| that shares |parent|'s refs.
+  Deserializer(const Deserializer* parent, intptr_t offset);
+
+  // Returns the object store.
+  Object ReadObjects(bool record);
+  // Revision 1 snapshots end with the offsets of each cluster's edges, which
+  // lets runs of clusters be read on the thread pool, and revision 2 adds the
+  // size of the objects, which lets their space be reserved up front.
+  // Revision 3 may add a cluster of bytecode that is read lazily. Revision 4,
+  // written by ImageSerializer, adds the hash salt and the identity hashes.
+  void ReadTrailer(const uint8_t* base, intptr_t version, intptr_t num_nodes);
+  // Gives the objects just read the identity hashes of a revision 4 trailer.
+  void ReadIdentityHashes();
+  // Returns false if the edges should be read here in order.
+  bool ReadEdgesInParallel();
+  // Reads the edges of clusters [first, last) with |reader|'s cursor.
+  void ReadEdges(Deserializer* reader, intptr_t first, intptr_t last);
+
   const uint8_t* const snapshot_;
   const intptr_t snapshot_length_;
   const uint8_t* cursor_;
+  const bool owns_refs_;
 
   Heap* const heap_;
 
@@ -64,6 +134,268 @@ class Deserializer : public ValueObject {
 
   Object* refs_;
   intptr_t next_ref_;
+
+  // From the trailer, relative to the snapshot, with the root ref's last.
+  intptr_t* edge_offsets_;
+  // Of the identity hashes in a revision 4 trailer, or 0.
+  intptr_t identity_hashes_offset_;
+
+  // Kept only while recording a SnapshotImage.
+  intptr_t* class_cids_;
+  Object* class_objects_;
+  intptr_t num_classes_;
+  bool recordable_;
+
+  DeserializeEvent event_;
+
+  static EventCallback event_callback_;
+};
+
+// What MessageSerializer and ImageSerializer share: the refs of the objects
+// reached, by tagged value, and the bytes written so far.
+class SnapshotWriter : public ValueObject {
+ public:
+  // The bytes written, allocated with malloc as IsolateMessage expects.
+  uint8_t* TakeData(intptr_t* length);
+
+ protected:
+  class List;
+  class RegularCluster;
+  struct Entry;
+
+  explicit SnapshotWriter(Heap* heap);
+  ~SnapshotWriter();
+
+  void Enqueue(Object object);
+  Entry* Insert(Object object);
+  Entry* Lookup(Object object);
+  void Register(Object object);
+  void WriteRef(Object object);
+  void WriteWeakRef(Object object);
+
+  // The nodes of a cluster, if the objects make one.
+  void WriteIntegerNodes(List* integers);
+  void WriteLargeIntegerNodes(List* large_integers);
+  void WriteFloatNodes(List* floats);
+  void WriteByteArrayNodes(List* byte_arrays);
+  // Always makes a cluster. |symbols| may be NULL.
+  void WriteStringNodes(List* strings, List* symbols);
+  void WriteArrayNodes(intptr_t format, List* arrays);
+  void WriteEphemeronNodes(List* ephemerons);
+  void WriteRegularNodes(RegularCluster* cluster);
+
+  void WriteArrayEdges(List* arrays);
+  void WriteWeakArrayEdges(List* weak_arrays);
+  void WriteEphemeronEdges(List* ephemerons);
+  void WriteRegularEdges(RegularCluster* cluster);
+
+  template <typename T>
+  void Write(T value) {
+    Reserve(sizeof(T));
+    memcpy(data_ + length_, &value, sizeof(T));
+    length_ += sizeof(T);
+  }
+  void WriteBytes(const uint8_t* bytes, intptr_t length) {
+    Reserve(length);
+    memcpy(data_ + length_, bytes, length);
+    length_ += length;
+  }
+  void WriteLEB128(uintptr_t value);
+  void WriteSLEB128(int64_t value);
+  void Reserve(intptr_t bytes);
+
+  Heap* const heap_;
+  Object nil_;
+
+  // Refs by tagged value, by open addressing. A ref of 0 is an object that
+  // has been reached but not yet written.
+  Entry* entries_;
+  intptr_t num_entries_;
+  intptr_t capacity_;
+  intptr_t next_ref_;
+
+  List* stack_;
+
+  uint8_t* data_;
+  intptr_t length_;
+  intptr_t capacity_bytes_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SnapshotWriter);
+};
+
+// Writes a message between isolates as the Newspeak Serializer does, with
+// the objects of the object store's message_shared_objects written by index,
+// so either side may be Newspeak. Only graphs of data are written here: a
+// graph that reaches a symbol, activation, closure, method or an instance of
+// a class not among the shared objects is left to the Newspeak Serializer,
+// which also writes the classes and interns the symbols.
+class MessageSerializer : public SnapshotWriter {
+ public:
+  explicit MessageSerializer(Heap* heap);
+  ~MessageSerializer();
+
+  // Returns false if |root| must be written by the Newspeak Serializer. Does
+  // not allocate.
+  bool Serialize(Object root);
+
+ private:
+  bool Analyze(Object object);
+  bool Retrace();
+  RegularCluster* ClusterFor(Behavior cls);
+
+  void WriteNodes();
+  void WriteEdges();
+
+  Behavior metaclass_;
+  Behavior method_;
+  intptr_t num_shared_;
+
+  List* integers_;
+  List* large_integers_;
+  List* floats_;
+  List* byte_arrays_;
+  List* strings_;
+  List* arrays_;
+  List* weak_arrays_;
+  List* ephemerons_;
+  RegularCluster** regular_clusters_;
+  intptr_t num_regular_clusters_;
+
+  DISALLOW_COPY_AND_ASSIGN(MessageSerializer);
+};
+
+// Writes everything reachable from an object store as a snapshot to start an
+// isolate from, so a program can be restarted with what it had built up
+// instead of building it again. Unlike a message, the classes, methods,
+// symbols, closures and activations are written too. An activation whose
+// frame is still on a stack is written as if it had returned, with the temps
+// it has now. The snapshot also keeps the isolate's hash salt and the
+// identity hashes of the objects, so hashed collections remain valid in the
+// isolates started from it. Every method must have its bytecode; see
+// Method::HasBytecode.
+class ImageSerializer : public SnapshotWriter {
+ public:
+  explicit ImageSerializer(Heap* heap);
+  ~ImageSerializer();
+
+  // Returns false if an object cannot be written, such as an activation with
+  // more temps than a snapshot holds. Does not allocate.
+  bool Serialize(Object object_store);
+
+ private:
+  // See Deserializer::ReadTrailer.
+  static constexpr intptr_t kImageVersion = 4;
+
+  bool Analyze(Object object);
+  bool Retrace();
+  RegularCluster* ClusterFor(Object object);
+
+  void WriteNodes();
+  void WriteClosureEdges();
+  void WriteActivationEdges();
+  void WriteTrailer(intptr_t* edge_offsets, intptr_t num_clusters);
+
+  Interpreter* const interpreter_;
+  Behavior metaclass_;
+
+  List* integers_;
+  List* large_integers_;
+  List* floats_;
+  List* byte_arrays_;
+  List* strings_;
+  List* symbols_;
+  List* arrays_;
+  List* weak_arrays_;
+  List* ephemerons_;
+  List* closures_;
+  List* activations_;
+  // By class id, and in the order they were made.
+  RegularCluster** clusters_by_cid_;
+  intptr_t clusters_by_cid_capacity_;
+  RegularCluster** regular_clusters_;
+  intptr_t num_regular_clusters_;
+
+  // The slots and bytes held by the objects written, excluding headers.
+  intptr_t num_slots_;
+  intptr_t num_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ImageSerializer);
+};
+
+// Reads a message written by MessageSerializer into a running isolate's heap,
+// straight from the message's buffer.
+class MessageDeserializer : public ValueObject {
+ public:
+  MessageDeserializer(Heap* heap, const uint8_t* data, intptr_t length);
+
+  Object Deserialize();  // SAFEPOINT
+
+ private:
+  struct ClusterInfo;
+
+  void ReadNodes(ClusterInfo* cluster, Array* refs);  // SAFEPOINT
+  void ReadEdges(ClusterInfo* cluster, Array refs);
+  void AdoptInstances(ClusterInfo* cluster, Array* refs);  // SAFEPOINT
+
+  Heap* const heap_;
+  Deserializer reader_;
+  intptr_t next_ref_;
+
+  DISALLOW_COPY_AND_ASSIGN(MessageDeserializer);
+};
+
+// The objects of a snapshot as they are right after it is read, copied out of
+// the heap they were read into with their pointers replaced by indices. A
+// snapshot read a second time, as when an isolate is spawned from the one it
+// was started with, is recorded as an image, and every later isolate made
+// from it copies the image into its heap instead of decoding the snapshot
+// again. Images are shared by all isolates and kept until Shutdown.
+class SnapshotImage {
+ public:
+  static void Startup();
+  static void Shutdown();
+
+  // Returns the image of the snapshot, or NULL with *record set if this
+  // reading of it should be recorded.
+  static const SnapshotImage* Lookup(const void* snapshot,
+                                     size_t snapshot_length,
+                                     bool* record);
+  // Keeps the first image recorded for the snapshot and deletes the others.
+  static void Add(const void* snapshot,
+                  size_t snapshot_length,
+                  SnapshotImage* image);
+
+  // |refs| are the objects of a snapshot just read, before any collection.
+  SnapshotImage(const Object* refs,
+                intptr_t num_refs,
+                const intptr_t* class_cids,
+                const Object* class_objects,
+                intptr_t num_classes,
+                Object object_store);
+  ~SnapshotImage();
+
+  // Copies the objects into |heap|, which must be fresh, and registers their
+  // classes as the snapshot would have. Returns the object store.
+  Object Instantiate(Heap* heap) const;
+
+  intptr_t num_objects() const { return num_objects_; }
+
+ private:
+  struct Entry;
+
+  static Mutex* mutex_;
+  static Entry* entries_;
+
+  intptr_t num_objects_;
+  intptr_t* offsets_;  // Into data_, in words, with one more at the end.
+  uword* data_;
+  // Pairs of class id and class index.
+  intptr_t* classes_;
+  intptr_t num_classes_;
+  intptr_t object_store_;
+
+  DISALLOW_COPY_AND_ASSIGN(SnapshotImage);
 };
 
 }  // namespace psoup
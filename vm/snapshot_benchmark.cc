@@ -0,0 +1,179 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+// Starts isolates from each snapshot given, over and over, and reports how
+// long each phase of reading the snapshot took. Each snapshot is measured
+// both read afresh and copied from its SnapshotImage, and each measurement
+// is printed as one line of JSON with percentiles in nanoseconds, so that
+// runs can be compared by scripts.
+
+#include "vm/globals.h"
+#if !defined(OS_EMSCRIPTEN)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/compressed_snapshot.h"
+#include "vm/heap.h"
+#include "vm/isolate.h"
+#include "vm/os.h"
+#include "vm/primordial_soup.h"
+#include "vm/snapshot.h"
+#include "vm/virtual_memory.h"
+
+namespace psoup {
+
+enum Phase {
+  kClusters,
+  kNodes,
+  kEdges,
+  kClasses,
+  kImage,
+  kInitialize,
+  kTotal,
+  kIsolate,  // The whole Isolate constructor, including the message loop.
+  kNumPhases,
+};
+
+static const char* const kPhaseNames[kNumPhases] = {
+  "clusters", "nodes", "edges", "classes", "image", "initialize", "total",
+  "isolate",
+};
+
+static DeserializeEvent last_event;
+
+static void RecordEvent(const DeserializeEvent& event) {
+  last_event = event;
+}
+
+static int CompareSamples(const void* a, const void* b) {
+  int64_t x = *reinterpret_cast<const int64_t*>(a);
+  int64_t y = *reinterpret_cast<const int64_t*>(b);
+  return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+// Nearest rank.
+static int64_t Percentile(const int64_t* sorted, intptr_t n, intptr_t p) {
+  intptr_t rank = (p * n + 99) / 100;
+  if (rank < 1) {
+    rank = 1;
+  }
+  return sorted[rank - 1];
+}
+
+static void PrintJSONString(const char* string) {
+  OS::Print("\"");
+  for (const char* c = string; *c != '\0'; c++) {
+    if ((*c == '"') || (*c == '\\')) {
+      OS::Print("\\%c", *c);
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      OS::Print("\\u%04x", *c);
+    } else {
+      OS::Print("%c", *c);
+    }
+  }
+  OS::Print("\"");
+}
+
+// With |from_image|, the snapshot is first read twice so that its image is
+// recorded, and every measured start copies it. Otherwise images are
+// dropped before every start, so each one reads the snapshot.
+static void Measure(const char* filename,
+                    void* snapshot,
+                    size_t snapshot_length,
+                    bool from_image,
+                    intptr_t iterations) {
+  SnapshotImage::Shutdown();
+  SnapshotImage::Startup();
+  HeapPolicy policy;
+  if (from_image) {
+    for (intptr_t i = 0; i < 2; i++) {
+      delete new Isolate(snapshot, snapshot_length, i, policy);
+    }
+  }
+
+  int64_t* samples[kNumPhases];
+  for (intptr_t phase = 0; phase < kNumPhases; phase++) {
+    samples[phase] = new int64_t[iterations];
+  }
+  for (intptr_t i = 0; i < iterations; i++) {
+    if (!from_image) {
+      SnapshotImage::Shutdown();
+      SnapshotImage::Startup();
+    }
+    int64_t start = OS::CurrentMonotonicNanos();
+    Isolate* isolate = new Isolate(snapshot, snapshot_length, i, policy);
+    int64_t stop = OS::CurrentMonotonicNanos();
+    delete isolate;
+    ASSERT((last_event.from_image != 0) == from_image);
+
+    samples[kClusters][i] = last_event.clusters;
+    samples[kNodes][i] = last_event.nodes;
+    samples[kEdges][i] = last_event.edges;
+    samples[kClasses][i] = last_event.classes;
+    samples[kImage][i] = last_event.image;
+    samples[kInitialize][i] = last_event.initialize;
+    samples[kTotal][i] = last_event.total;
+    samples[kIsolate][i] = stop - start;
+  }
+
+  OS::Print("{\"snapshot\": ");
+  PrintJSONString(filename);
+  OS::Print(", \"mode\": \"%s\", \"bytes\": %" Pd64 ", \"objects\": %" Pd64
+            ", \"iterations\": %" Pd,
+            from_image ? "image" : "read", last_event.snapshot_length,
+            last_event.num_objects, iterations);
+  for (intptr_t phase = 0; phase < kNumPhases; phase++) {
+    int64_t* sorted = samples[phase];
+    qsort(sorted, iterations, sizeof(int64_t), CompareSamples);
+    OS::Print(", \"%s\": {\"min\": %" Pd64 ", \"p50\": %" Pd64
+              ", \"p90\": %" Pd64 ", \"p99\": %" Pd64 ", \"max\": %" Pd64 "}",
+              kPhaseNames[phase], sorted[0],
+              Percentile(sorted, iterations, 50),
+              Percentile(sorted, iterations, 90),
+              Percentile(sorted, iterations, 99),
+              sorted[iterations - 1]);
+    delete[] sorted;
+  }
+  OS::Print("}\n");
+}
+
+}  // namespace psoup
+
+int main(int argc, const char** argv) {
+  intptr_t iterations = 20;
+  int first = 1;
+  static const char kIterations[] = "--iterations=";
+  while ((first < argc) &&
+         (strncmp(argv[first], kIterations, sizeof(kIterations) - 1) == 0)) {
+    iterations = atoi(argv[first] + sizeof(kIterations) - 1);
+    first++;
+  }
+  if ((first >= argc) || (iterations < 1)) {
+    psoup::OS::PrintErr("Usage: %s [--iterations=<n>] <snapshot.vfuel>...\n",
+                        argv[0]);
+    return -1;
+  }
+
+  PrimordialSoup_Startup();
+  psoup::Deserializer::SetEventCallback(psoup::RecordEvent);
+  for (int i = first; i < argc; i++) {
+    psoup::VirtualMemory file = psoup::VirtualMemory::MapReadOnly(argv[i]);
+    void* snapshot = reinterpret_cast<void*>(file.base());
+    size_t snapshot_length = file.size();
+    if (psoup::CompressedSnapshot::IsCompressed(snapshot, snapshot_length)) {
+      snapshot = psoup::CompressedSnapshot::Decompress(
+          snapshot, snapshot_length, &snapshot_length);
+    }
+    psoup::Measure(argv[i], snapshot, snapshot_length, false, iterations);
+    psoup::Measure(argv[i], snapshot, snapshot_length, true, iterations);
+    // The file stays mapped until exit, as decompressed copies are kept by
+    // the address they came from until shutdown.
+  }
+  psoup::Deserializer::SetEventCallback(nullptr);
+  PrimordialSoup_Shutdown();
+  return 0;
+}
+
+#endif  // !defined(OS_EMSCRIPTEN)
@@ -0,0 +1,275 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/sockets.h"
+
+#include <errno.h>
+
+#if defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+#include "vm/assert.h"
+
+namespace psoup {
+
+#if defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0  // macOS, where SO_NOSIGPIPE is set instead.
+#endif
+
+bool SocketAddress::Parse(const char* address, bool passive) {
+  if (strncmp(address, "unix:", 5) == 0) {
+    const char* path = address + 5;
+    size_t length = strlen(path);
+    if ((length == 0) || (length >= sizeof(unix_.sun_path))) {
+      return false;
+    }
+    memset(&unix_, 0, sizeof(unix_));
+    unix_.sun_family = AF_UNIX;
+    memcpy(unix_.sun_path, path, length);
+    family_ = AF_UNIX;
+    type_ = SOCK_STREAM;
+    length_ = sizeof(unix_);
+    return true;
+  }
+  if (strncmp(address, "tcp:", 4) == 0) {
+    type_ = SOCK_STREAM;
+  } else if (strncmp(address, "udp:", 4) == 0) {
+    type_ = SOCK_DGRAM;
+  } else {
+    return false;
+  }
+  const char* host = address + 4;
+  const char* colon = strrchr(host, ':');
+  if ((colon == nullptr) || (colon == host) || (colon[1] == '\0')) {
+    return false;
+  }
+  char host_name[256];
+  size_t host_length = colon - host;
+  if (host_length >= sizeof(host_name)) {
+    return false;
+  }
+  memcpy(host_name, host, host_length);
+  host_name[host_length] = '\0';
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = type_;
+  hints.ai_flags = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+  if (getaddrinfo(host_name, colon + 1, &hints, &info_) != 0) {
+    info_ = nullptr;
+    return false;
+  }
+  family_ = info_->ai_family;
+  length_ = info_->ai_addrlen;
+  return true;
+}
+
+static bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return (flags != -1) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+int Sockets::Open(int family, int type) {
+  int fd = socket(family, type, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (!SetNonBlocking(fd)) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+#if defined(OS_MACOS)
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  return fd;
+}
+
+intptr_t Sockets::Connect(const char* address) {
+  SocketAddress parsed;
+  if (!parsed.Parse(address, false)) {
+    errno = EINVAL;
+    return -1;
+  }
+  int fd = Open(parsed.family(), parsed.type());
+  if (fd == -1) {
+    return -1;
+  }
+  if ((connect(fd, parsed.address(), parsed.length()) != 0) &&
+      (errno != EINPROGRESS)) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
+
+intptr_t Sockets::Listen(const char* address, intptr_t backlog) {
+  SocketAddress parsed;
+  if (!parsed.Parse(address, true)) {
+    errno = EINVAL;
+    return -1;
+  }
+  int fd = Open(parsed.family(), parsed.type());
+  if (fd == -1) {
+    return -1;
+  }
+  if (parsed.family() != AF_UNIX) {
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  }
+  if ((bind(fd, parsed.address(), parsed.length()) != 0) ||
+      ((parsed.type() == SOCK_STREAM) && (listen(fd, backlog) != 0))) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
+
+intptr_t Sockets::Accept(intptr_t fd) {
+  for (;;) {
+    int result = accept(fd, nullptr, nullptr);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EWOULDBLOCK) {
+        errno = EAGAIN;
+      }
+      return -1;
+    }
+    fcntl(result, F_SETFD, FD_CLOEXEC);
+    if (!SetNonBlocking(result)) {
+      close(result);
+      continue;
+    }
+#if defined(OS_MACOS)
+    int one = 1;
+    setsockopt(result, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    return result;
+  }
+}
+
+intptr_t Sockets::Read(intptr_t fd, uint8_t* data, intptr_t length) {
+  for (;;) {
+    ssize_t result = recv(fd, data, length, 0);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EWOULDBLOCK) {
+        errno = EAGAIN;
+      }
+    }
+    return result;
+  }
+}
+
+intptr_t Sockets::Write(intptr_t fd, const uint8_t* data, intptr_t length) {
+  for (;;) {
+    ssize_t result = send(fd, data, length, MSG_NOSIGNAL);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EWOULDBLOCK) {
+        errno = EAGAIN;
+      }
+    }
+    return result;
+  }
+}
+
+intptr_t Sockets::PendingError(intptr_t fd) {
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+    return errno;
+  }
+  return error;
+}
+
+intptr_t Sockets::LocalPort(intptr_t fd) {
+  struct sockaddr_storage bound;
+  socklen_t length = sizeof(bound);
+  if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&bound),
+                  &length) != 0) {
+    return -1;
+  }
+  if (bound.ss_family == AF_INET6) {
+    return ntohs(reinterpret_cast<struct sockaddr_in6*>(&bound)->sin6_port);
+  }
+  if (bound.ss_family == AF_INET) {
+    return ntohs(reinterpret_cast<struct sockaddr_in*>(&bound)->sin_port);
+  }
+  errno = EAFNOSUPPORT;
+  return -1;
+}
+
+intptr_t Sockets::Close(intptr_t fd) {
+  return close(fd);
+}
+
+#else  // defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+
+intptr_t Sockets::Connect(const char* address) {
+  errno = ENOSYS;
+  return -1;
+}
+
+intptr_t Sockets::Listen(const char* address, intptr_t backlog) {
+  errno = ENOSYS;
+  return -1;
+}
+
+intptr_t Sockets::Accept(intptr_t fd) {
+  errno = ENOSYS;
+  return -1;
+}
+
+intptr_t Sockets::Read(intptr_t fd, uint8_t* data, intptr_t length) {
+  errno = ENOSYS;
+  return -1;
+}
+
+intptr_t Sockets::Write(intptr_t fd, const uint8_t* data, intptr_t length) {
+  errno = ENOSYS;
+  return -1;
+}
+
+intptr_t Sockets::PendingError(intptr_t fd) {
+  return ENOSYS;
+}
+
+intptr_t Sockets::LocalPort(intptr_t fd) {
+  errno = ENOSYS;
+  return -1;
+}
+
+intptr_t Sockets::Close(intptr_t fd) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int Sockets::Open(int family, int type) {
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif  // defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+
+}  // namespace psoup
@@ -0,0 +1,104 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_SOCKETS_H_
+#define VM_SOCKETS_H_
+
+#include "vm/globals.h"
+
+#if defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "vm/allocation.h"
+
+namespace psoup {
+
+#if defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+// A socket address parsed from "tcp:<host>:<port>", "udp:<host>:<port>" or
+// "unix:<path>".
+class SocketAddress {
+ public:
+  SocketAddress()
+      : info_(nullptr), length_(0), family_(AF_UNSPEC), type_(SOCK_STREAM) {}
+  ~SocketAddress() {
+    if (info_ != nullptr) {
+      freeaddrinfo(info_);
+    }
+  }
+
+  // Resolves host names, so may block.
+  bool Parse(const char* address, bool passive);
+
+  int family() const { return family_; }
+  // SOCK_STREAM, or SOCK_DGRAM for udp.
+  int type() const { return type_; }
+  const struct sockaddr* address() const {
+    return info_ != nullptr
+        ? info_->ai_addr
+        : reinterpret_cast<const struct sockaddr*>(&unix_);
+  }
+  socklen_t length() const { return length_; }
+
+ private:
+  struct addrinfo* info_;
+  struct sockaddr_un unix_;
+  socklen_t length_;
+  int family_;
+  int type_;
+
+  DISALLOW_COPY_AND_ASSIGN(SocketAddress);
+};
+#endif
+
+// Non-blocking sockets an isolate reads and writes itself, on its own thread.
+// Nothing here waits: an operation that cannot proceed fails with EAGAIN, and
+// the isolate awaits its descriptor on its message loop before trying again,
+// so one loop drives all of an isolate's sockets and the readiness of many is
+// taken in one poll. Reads and writes copy straight between the socket and
+// the caller's buffer.
+//
+// Only on Linux, Android and macOS. Elsewhere every operation fails with
+// ENOSYS.
+class Sockets : public AllStatic {
+ public:
+  // Each answers a descriptor, or -1 with errno set. Addresses are as for
+  // SocketAddress, and resolving them may block.
+  //
+  // A connection may still be in progress, and completes or fails once the
+  // socket is writable; see PendingError. A datagram socket only exchanges
+  // datagrams with the address it connected to.
+  static intptr_t Connect(const char* address);
+  // For a stream, accepts connections at |address|. For datagrams, receives
+  // them from any sender, but cannot send. Port 0 lets the OS choose; see
+  // LocalPort.
+  static intptr_t Listen(const char* address, intptr_t backlog);
+  // Fails with EAGAIN if no connection is waiting.
+  static intptr_t Accept(intptr_t fd);
+
+  // Each answers the number of bytes, or -1 with errno set, EAGAIN if the
+  // socket is not ready. Read answers 0 at the end of a stream, and cuts a
+  // datagram longer than |length| short. Write may write only some of a
+  // stream's bytes.
+  static intptr_t Read(intptr_t fd, uint8_t* data, intptr_t length);
+  static intptr_t Write(intptr_t fd, const uint8_t* data, intptr_t length);
+
+  // The errno value of a failure not yet reported, such as of a connection,
+  // or 0.
+  static intptr_t PendingError(intptr_t fd);
+  // Answers -1 with errno set if |fd| has no port.
+  static intptr_t LocalPort(intptr_t fd);
+  // Answers 0, or -1 with errno set.
+  static intptr_t Close(intptr_t fd);
+
+  // A non-blocking socket closed on exec, or -1 with errno set. Writing to it
+  // never raises SIGPIPE.
+  static int Open(int family, int type);
+};
+
+}  // namespace psoup
+
+#endif  // VM_SOCKETS_H_
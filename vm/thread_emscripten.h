@@ -9,11 +9,56 @@
 #error Do not include thread_emscripten.h directly; use thread.h instead.
 #endif
 
+#if defined(EMSCRIPTEN_THREADS)
+#include <pthread.h>
+#endif
+
 #include "vm/assert.h"
 #include "vm/globals.h"
 
 namespace psoup {
 
+#if defined(EMSCRIPTEN_THREADS)
+
+typedef pthread_t ThreadId;
+typedef pthread_t ThreadJoinId;
+
+class MutexData {
+ private:
+  MutexData() {}
+  ~MutexData() {}
+
+  pthread_mutex_t* mutex() { return &mutex_; }
+
+  pthread_mutex_t mutex_;
+
+  friend class Mutex;
+
+  DISALLOW_ALLOCATION();
+  DISALLOW_COPY_AND_ASSIGN(MutexData);
+};
+
+
+class MonitorData {
+ private:
+  MonitorData() {}
+  ~MonitorData() {}
+
+  pthread_mutex_t* mutex() { return &mutex_; }
+  pthread_cond_t* cond() { return &cond_; }
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+
+  friend class Monitor;
+
+  DISALLOW_ALLOCATION();
+  DISALLOW_COPY_AND_ASSIGN(MonitorData);
+};
+
+#else  // defined(EMSCRIPTEN_THREADS)
+
+// The page's only thread runs everything, so there is nothing to lock.
 typedef intptr_t ThreadId;
 typedef intptr_t ThreadJoinId;
 
@@ -40,6 +85,8 @@ class MonitorData {
   DISALLOW_COPY_AND_ASSIGN(MonitorData);
 };
 
+#endif  // defined(EMSCRIPTEN_THREADS)
+
 }  // namespace psoup
 
 #endif  // VM_THREAD_EMSCRIPTEN_H_
@@ -10,6 +10,13 @@
 
 namespace psoup {
 
+#if defined(OS_EMSCRIPTEN) && !defined(EMSCRIPTEN_THREADS)
+ThreadPool::Worker* ThreadPool::current_worker_ = NULL;
+#else
+thread_local ThreadPool::Worker* ThreadPool::current_worker_ = NULL;
+#endif
+
+
 ThreadPool::ThreadPool()
     : shutting_down_(false),
       all_workers_(NULL),
@@ -18,6 +25,12 @@ ThreadPool::ThreadPool()
       count_stopped_(0),
       count_running_(0),
       count_idle_(0),
+      deque_workers_(NULL),
+      count_deques_(0),
+      queued_(0),
+      searching_(0),
+      max_queued_(0),
+      count_stolen_(0),
       shutting_down_workers_(NULL),
       join_list_(NULL) {}
 
@@ -28,7 +41,17 @@ ThreadPool::~ThreadPool() {
 
 
 bool ThreadPool::Run(Task* task) {
-  Worker* worker = NULL;
+  Worker* worker = current_worker_;
+  if ((worker != NULL) && (worker->pool_ == this)) {
+    // Left for this worker, or whichever worker steals it first. Accepted
+    // even during shutdown, since this worker may wait for it.
+    worker->Push(task);
+    if (searching_ == 0) {
+      WakeWorker();
+    }
+    return true;
+  }
+
   bool new_worker = false;
   {
     // We need ThreadPool::mutex_ to access worker lists and other
@@ -37,38 +60,162 @@ bool ThreadPool::Run(Task* task) {
     if (shutting_down_) {
       return false;
     }
-    if (idle_workers_ == NULL) {
-      worker = new Worker(this);
-      ASSERT(worker != NULL);
-      new_worker = true;
-      count_started_++;
-
-      // Add worker to the all_workers_ list.
-      worker->all_next_ = all_workers_;
-      all_workers_ = worker;
-      worker->owned_ = true;
-      count_running_++;
-    } else {
-      // Get the first worker from the idle worker list.
-      worker = idle_workers_;
-      idle_workers_ = worker->idle_next_;
-      worker->idle_next_ = NULL;
-      count_idle_--;
-      count_running_++;
-    }
+    worker = ClaimWorkerLocked(&new_worker);
+    worker->Push(task);
   }
 
   // Release ThreadPool::mutex_ before calling Worker functions.
-  ASSERT(worker != NULL);
-  worker->SetTask(task);
   if (new_worker) {
-    // Call StartThread after we've assigned the first task.
     worker->StartThread();
+  } else {
+    worker->Wake();
+  }
+  return true;
+}
+
+
+ThreadPool::Worker* ThreadPool::ClaimWorkerLocked(bool* new_worker) {
+  DEBUG_ASSERT(mutex_.IsOwnedByCurrentThread());
+  Worker* worker;
+  if (shutting_down_) {
+    worker = new Worker(this);
+    ASSERT(worker != NULL);
+    *new_worker = true;
+    count_started_++;
+    count_stopped_++;
+    // Shutdown waits for it like the others. The claiming worker is still on
+    // the shutdown list, so the list cannot have emptied meanwhile.
+    worker->done_ = true;
+    {
+      MonitorLocker eml(&exit_monitor_);
+      AddWorkerToShutdownList(worker);
+    }
+    worker->deque_next_ = deque_workers_;
+    deque_workers_ = worker;
+    count_deques_++;
+  } else if (idle_workers_ == NULL) {
+    worker = new Worker(this);
+    ASSERT(worker != NULL);
+    *new_worker = true;
+    count_started_++;
+
+    // Add worker to the all_workers_ list.
+    worker->all_next_ = all_workers_;
+    all_workers_ = worker;
+    worker->owned_ = true;
+    count_running_++;
+    worker->deque_next_ = deque_workers_;
+    deque_workers_ = worker;
+    count_deques_++;
+  } else {
+    // Get the first worker from the idle worker list.
+    worker = idle_workers_;
+    idle_workers_ = worker->idle_next_;
+    worker->idle_next_ = NULL;
+    *new_worker = false;
+    count_idle_--;
+    count_running_++;
+  }
+  searching_++;
+  return worker;
+}
+
+
+void ThreadPool::WakeWorker() {
+  Worker* worker = NULL;
+  bool new_worker = false;
+  {
+    MutexLocker ml(&mutex_);
+    if (searching_ > 0) {
+      return;
+    }
+    worker = ClaimWorkerLocked(&new_worker);
+  }
+  if (new_worker) {
+    worker->StartThread();
+  } else {
+    worker->Wake();
+  }
+}
+
+
+void ThreadPool::RunTasks(Worker* worker) {
+  while (true) {
+    Task* task = worker->Pop();
+    if (task == NULL) {
+      task = StealTask(worker);
+      if (task == NULL) {
+        return;  // Still counted as searching until it goes idle.
+      }
+    }
+    // The task may block, so another worker must look after the rest.
+    searching_--;
+    if ((queued_ > 0) && (searching_ == 0)) {
+      WakeWorker();
+    }
+    task->Run();
+    delete task;
+    searching_++;
+  }
+}
+
+
+ThreadPool::Task* ThreadPool::StealTask(Worker* thief) {
+  if (queued_ == 0) {
+    return NULL;
+  }
+  // Holding mutex_ keeps the victims from exiting.
+  MutexLocker ml(&mutex_);
+  if (count_deques_ <= 1) {
+    return NULL;
+  }
+  Worker* start = deque_workers_;
+  for (uint64_t skip = thief->NextRandom() % count_deques_;
+       (skip > 0) && (start != NULL); skip--) {
+    start = start->deque_next_;
+  }
+  for (Worker* victim = start; victim != NULL; victim = victim->deque_next_) {
+    Task* task = victim == thief ? NULL : victim->Steal();
+    if (task != NULL) {
+      return task;
+    }
+  }
+  for (Worker* victim = deque_workers_; victim != start;
+       victim = victim->deque_next_) {
+    Task* task = victim == thief ? NULL : victim->Steal();
+    if (task != NULL) {
+      return task;
+    }
+  }
+  return NULL;
+}
+
+
+bool ThreadPool::StopSearching() {
+  // A task queued while this worker was looking may have seen it searching
+  // and not woken anyone, so it must look again.
+  searching_--;
+  if (queued_ > 0) {
+    searching_++;
+    return false;
   }
   return true;
 }
 
 
+void ThreadPool::RemoveWorkerFromDequeList(Worker* worker) {
+  DEBUG_ASSERT(mutex_.IsOwnedByCurrentThread());
+  Worker** link = &deque_workers_;
+  while (*link != worker) {
+    ASSERT(*link != NULL);
+    link = &(*link)->deque_next_;
+  }
+  *link = worker->deque_next_;
+  worker->deque_next_ = NULL;
+  count_deques_--;
+}
+
+
 void ThreadPool::Shutdown() {
   Worker* saved = NULL;
   {
@@ -203,27 +350,30 @@ bool ThreadPool::RemoveWorkerFromAllList(Worker* worker) {
 }
 
 
-void ThreadPool::SetIdleLocked(Worker* worker) {
+bool ThreadPool::SetIdleLocked(Worker* worker) {
   DEBUG_ASSERT(mutex_.IsOwnedByCurrentThread());
   ASSERT(worker->owned_ && !IsIdle(worker));
+  if (!StopSearching()) {
+    return false;
+  }
   worker->idle_next_ = idle_workers_;
   idle_workers_ = worker;
   count_idle_++;
   count_running_--;
+  return true;
 }
 
 
-void ThreadPool::SetIdleAndReapExited(Worker* worker) {
+bool ThreadPool::SetIdleAndReapExited(Worker* worker) {
   JoinList* list = NULL;
   {
     MutexLocker ml(&mutex_);
     if (shutting_down_) {
-      return;
+      return StopSearching();
     }
     if (join_list_ == NULL) {
       // Nothing to join, add to the idle list and return.
-      SetIdleLocked(worker);
-      return;
+      return SetIdleLocked(worker);
     }
     // There is something to join. Grab the join list, drop the lock, do the
     // join, then grab the lock again and add to the idle list.
@@ -235,9 +385,9 @@ void ThreadPool::SetIdleAndReapExited(Worker* worker) {
   {
     MutexLocker ml(&mutex_);
     if (shutting_down_) {
-      return;
+      return StopSearching();
     }
-    SetIdleLocked(worker);
+    return SetIdleLocked(worker);
   }
 }
 
@@ -254,6 +404,7 @@ bool ThreadPool::ReleaseIdleWorker(Worker* worker) {
   // Remove from all list.
   bool found = RemoveWorkerFromAllList(worker);
   ASSERT(found);
+  RemoveWorkerFromDequeList(worker);
 
   // The thread for worker will exit. Add its ThreadId to the join_list_
   // so that we can join on it at the next opportunity.
@@ -321,15 +472,26 @@ ThreadPool::Task::~Task() {}
 
 ThreadPool::Worker::Worker(ThreadPool* pool)
     : pool_(pool),
-      task_(NULL),
       id_(Thread::kInvalidThreadId),
       done_(false),
+      wake_(false),
+      random_(static_cast<uint32_t>(OS::CurrentMonotonicNanos()) | 1),
+      deque_(NULL),
+      deque_capacity_(0),
+      deque_top_(0),
+      deque_bottom_(0),
       owned_(false),
       all_next_(NULL),
       idle_next_(NULL),
       shutdown_next_(NULL) {}
 
 
+ThreadPool::Worker::~Worker() {
+  ASSERT(deque_top_ == deque_bottom_);
+  delete[] deque_;
+}
+
+
 ThreadId ThreadPool::Worker::id() {
   MonitorLocker ml(&monitor_);
   return id_;
@@ -337,13 +499,6 @@ ThreadId ThreadPool::Worker::id() {
 
 
 void ThreadPool::Worker::StartThread() {
-#if defined(DEBUG)
-  // Must call SetTask before StartThread.
-  {  // NOLINT
-    MonitorLocker ml(&monitor_);
-    ASSERT(task_ != NULL);
-  }
-#endif
   int result = Thread::Start("PSoup ThreadPool Worker", &Worker::Main,
                              reinterpret_cast<uword>(this));
   if (result != 0) {
@@ -352,47 +507,96 @@ void ThreadPool::Worker::StartThread() {
 }
 
 
-void ThreadPool::Worker::SetTask(Task* task) {
+void ThreadPool::Worker::Wake() {
   MonitorLocker ml(&monitor_);
-  ASSERT(task_ == NULL);
-  task_ = task;
+  ASSERT(!wake_);
+  wake_ = true;
   ml.Notify();
 }
 
 
+void ThreadPool::Worker::Push(Task* task) {
+  MutexLocker ml(&deque_mutex_);
+  intptr_t length = deque_bottom_ - deque_top_;
+  if (length == deque_capacity_) {
+    intptr_t new_capacity = deque_capacity_ == 0 ? 16 : deque_capacity_ * 2;
+    Task** new_deque = new Task*[new_capacity];
+    for (intptr_t i = 0; i < length; i++) {
+      new_deque[i] = deque_[(deque_top_ + i) & (deque_capacity_ - 1)];
+    }
+    delete[] deque_;
+    deque_ = new_deque;
+    deque_capacity_ = new_capacity;
+    deque_top_ = 0;
+    deque_bottom_ = length;
+  }
+  deque_[deque_bottom_ & (deque_capacity_ - 1)] = task;
+  deque_bottom_++;
+
+  intptr_t queued = ++pool_->queued_;
+  intptr_t max_queued = pool_->max_queued_.load(std::memory_order_relaxed);
+  while ((queued > max_queued) &&
+         !pool_->max_queued_.compare_exchange_weak(
+             max_queued, queued, std::memory_order_relaxed)) {
+  }
+}
+
+
+ThreadPool::Task* ThreadPool::Worker::Pop() {
+  MutexLocker ml(&deque_mutex_);
+  if (deque_top_ == deque_bottom_) {
+    return NULL;
+  }
+  deque_bottom_--;
+  pool_->queued_--;
+  return deque_[deque_bottom_ & (deque_capacity_ - 1)];
+}
+
+
+ThreadPool::Task* ThreadPool::Worker::Steal() {
+  MutexLocker ml(&deque_mutex_);
+  if (deque_top_ == deque_bottom_) {
+    return NULL;
+  }
+  Task* task = deque_[deque_top_ & (deque_capacity_ - 1)];
+  deque_top_++;
+  pool_->queued_--;
+  pool_->count_stolen_.fetch_add(1, std::memory_order_relaxed);
+  return task;
+}
+
+
 bool ThreadPool::Worker::Loop() {
   MonitorLocker ml(&monitor_);
   int64_t idle_start;
   while (true) {
-    ASSERT(task_ != NULL);
-    Task* task = task_;
-    task_ = NULL;
-
-    // Release monitor while handling the task.
+    // Release monitor while handling tasks.
     ml.Exit();
-    task->Run();
-    // ASSERT(Isolate::Current() == NULL);
-    delete task;
+    pool_->RunTasks(this);
     ml.Enter();
 
-    ASSERT(task_ == NULL);
     if (IsDone()) {
-      return false;
+      if (pool_->StopSearching()) {
+        return false;
+      }
+      continue;
+    }
+    if (!pool_->SetIdleAndReapExited(this)) {
+      continue;  // Tasks were queued meanwhile.
     }
-    ASSERT(!done_);
-    pool_->SetIdleAndReapExited(this);
     idle_start = OS::CurrentMonotonicNanos();
     while (true) {
       int64_t deadline =
           idle_start + (static_cast<int64_t>(5) * kNanosecondsPerSecond);
       Monitor::WaitResult result = ml.WaitUntilNanos(deadline);
-      if (task_ != NULL) {
-        // We've found a task.  Process it, regardless of whether the
-        // worker is done_.
+      if (wake_) {
+        // We've been taken off the idle list to look for tasks, regardless
+        // of whether the worker is done_.
+        wake_ = false;
         break;
       }
       if (IsDone()) {
-        return false;
+        return false;  // Already stopped searching.
       }
       if ((result == Monitor::kTimedOut) && pool_->ReleaseIdleWorker(this)) {
         return true;
@@ -419,10 +623,10 @@ void ThreadPool::Worker::Main(uword args) {
 
   {
     MonitorLocker ml(&worker->monitor_);
-    ASSERT(worker->task_);
     worker->id_ = id;
     pool = worker->pool_;
   }
+  current_worker_ = worker;
 
   bool released = worker->Loop();
 
@@ -439,6 +643,7 @@ void ThreadPool::Worker::Main(uword args) {
     {
       MutexLocker ml(&pool->mutex_);
       JoinList::AddLocked(join_id, &pool->join_list_);
+      pool->RemoveWorkerFromDequeList(worker);
     }
 
     // worker->id_ should never be read again, so set to invalid in debug mode
@@ -5,11 +5,18 @@
 #ifndef VM_THREAD_POOL_H_
 #define VM_THREAD_POOL_H_
 
+#include <atomic>
+
 #include "vm/globals.h"
 #include "vm/thread.h"
 
 namespace psoup {
 
+// Each worker has a deque of tasks. A task run from a worker goes on that
+// worker's deque, which it works through newest first; a worker with nothing
+// of its own steals the oldest task of another, starting at a random one. As
+// tasks may block, whenever tasks are queued and no worker is looking for
+// them, an idle worker is woken or a new one started.
 class ThreadPool {
  public:
   // Subclasses of Task are able to run on a ThreadPool.
@@ -41,17 +48,20 @@ class ThreadPool {
   uint64_t workers_idle() const { return count_idle_; }
   uint64_t workers_started() const { return count_started_; }
   uint64_t workers_stopped() const { return count_stopped_; }
+  intptr_t tasks_queued() const { return queued_; }
+  intptr_t max_tasks_queued() const { return max_queued_; }
+  uint64_t tasks_stolen() const { return count_stolen_; }
 
  private:
   class Worker {
    public:
     explicit Worker(ThreadPool* pool);
+    ~Worker();
 
-    // Sets a task on the worker.
-    void SetTask(Task* task);
+    // Wakes the worker after it has been taken off the idle list.
+    void Wake();
 
-    // Starts the thread for the worker.  This should only be called
-    // after a task has been set by the initial call to SetTask().
+    // Starts the thread for the worker.
     void StartThread();
 
     // Main loop for a worker. Returns true if worker is removed from thread
@@ -72,12 +82,32 @@ class ThreadPool {
 
     bool IsDone() const { return done_; }
 
+    // The owner pushes and pops at the bottom, thieves take from the top.
+    void Push(Task* task);
+    Task* Pop();
+    Task* Steal();
+
+    uint32_t NextRandom() {
+      // xorshift32
+      random_ ^= random_ << 13;
+      random_ ^= random_ >> 17;
+      random_ ^= random_ << 5;
+      return random_;
+    }
+
     // Fields owned by Worker.
     Monitor monitor_;
     ThreadPool* pool_;
-    Task* task_;
     ThreadId id_;
     bool done_;
+    bool wake_;  // Protected by monitor_.
+    uint32_t random_;
+
+    Mutex deque_mutex_;
+    Task** deque_;  // Ring buffer.
+    intptr_t deque_capacity_;
+    intptr_t deque_top_;
+    intptr_t deque_bottom_;
 
     // Fields owned by ThreadPool.  Workers should not look at these
     // directly.  It's like looking at the sun.
@@ -86,6 +116,7 @@ class ThreadPool {
     Worker* idle_next_;  // Protected by ThreadPool::mutex_
 
     Worker* shutdown_next_;  // Protected by ThreadPool::exit_monitor
+    Worker* deque_next_;     // Protected by ThreadPool::mutex_
 
     DISALLOW_COPY_AND_ASSIGN(Worker);
   };
@@ -122,10 +153,28 @@ class ThreadPool {
 
   void ReapExitedIdleThreads();
 
+  // Takes a worker off the idle list, or makes a new one, to look for tasks.
+  // During shutdown the new worker only runs tasks already queued.
+  Worker* ClaimWorkerLocked(bool* new_worker);  // Assumes mutex_ is held.
+  // Unless a worker is already looking for tasks.
+  void WakeWorker();
+  void RemoveWorkerFromDequeList(Worker* worker);  // Assumes mutex_ is held.
+
   // Worker operations.
-  void SetIdleLocked(Worker* worker);  // Assumes mutex_ is held.
-  void SetIdleAndReapExited(Worker* worker);
+  void RunTasks(Worker* worker);
+  Task* StealTask(Worker* thief);
+  // Both return false, leaving the worker running, if tasks are queued.
+  bool SetIdleLocked(Worker* worker);  // Assumes mutex_ is held.
+  bool SetIdleAndReapExited(Worker* worker);
   bool ReleaseIdleWorker(Worker* worker);
+  // Returns false, leaving the worker searching, if tasks are queued.
+  bool StopSearching();
+
+#if defined(OS_EMSCRIPTEN) && !defined(EMSCRIPTEN_THREADS)
+  static Worker* current_worker_;
+#else
+  static thread_local Worker* current_worker_;
+#endif
 
   Mutex mutex_;
   bool shutting_down_;
@@ -135,6 +184,16 @@ class ThreadPool {
   uint64_t count_stopped_;
   uint64_t count_running_;
   uint64_t count_idle_;
+  // Workers that may have tasks to steal, including those shutting down.
+  Worker* deque_workers_;
+  uint64_t count_deques_;
+
+  // Sequentially consistent, so a worker giving up on finding tasks and a
+  // task being queued cannot miss each other.
+  std::atomic<intptr_t> queued_;
+  std::atomic<intptr_t> searching_;  // Workers looking for tasks.
+  std::atomic<intptr_t> max_queued_;
+  std::atomic<uint64_t> count_stolen_;
 
   Monitor exit_monitor_;
   Worker* shutting_down_workers_;
@@ -0,0 +1,292 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/timer_wheel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/assert.h"
+#include "vm/utils.h"
+
+namespace psoup {
+
+TimerWheel::TimerWheel()
+    : current_(0), next_serial_(0), pending_(0),
+      entries_(nullptr), num_entries_(0), capacity_(0), free_(-1),
+      fired_(nullptr), num_fired_(0), fired_capacity_(0) {
+  for (intptr_t level = 0; level < kLevels; level++) {
+    occupied_[level] = 0;
+    for (intptr_t slot = 0; slot < kSlots; slot++) {
+      heads_[level][slot] = -1;
+    }
+  }
+}
+
+
+TimerWheel::~TimerWheel() {
+  delete[] entries_;
+  delete[] fired_;
+}
+
+
+intptr_t TimerWheel::NewEntry() {
+  if (free_ != -1) {
+    intptr_t index = free_;
+    free_ = entries_[index].next;
+    return index;
+  }
+  if (num_entries_ == kMaxTimers) {
+    return -1;
+  }
+  if (num_entries_ == capacity_) {
+    intptr_t new_capacity = capacity_ == 0 ? 64 : capacity_ * 2;
+    if (new_capacity > kMaxTimers) {
+      new_capacity = kMaxTimers;
+    }
+    Entry* new_entries = new Entry[new_capacity];
+    if (entries_ != nullptr) {
+      memcpy(new_entries, entries_, num_entries_ * sizeof(Entry));
+      delete[] entries_;
+    }
+    entries_ = new_entries;
+    capacity_ = new_capacity;
+  }
+  intptr_t index = num_entries_++;
+  entries_[index].generation = 0;
+  return index;
+}
+
+
+intptr_t TimerWheel::Schedule(int64_t due, int64_t now) {
+  intptr_t index = NewEntry();
+  if (index == -1) {
+    return 0;
+  }
+  // An empty wheel may have stood still for a long time.
+  int64_t now_tick = now / kTickNanos;
+  if ((pending_ == 0) && (current_ < now_tick)) {
+    current_ = now_tick;
+  }
+  Entry* entry = &entries_[index];
+  entry->due = due;
+  entry->tick = (due + kTickNanos - 1) / kTickNanos;
+  entry->serial = next_serial_++;
+  intptr_t id = (entry->generation << kIndexBits) | (index + 1);
+  if (entry->tick < current_) {
+    // The wheel has already turned past it.
+    AddFired(index);
+    Free(index);
+    return id;
+  }
+  Place(index);
+  pending_++;
+  return id;
+}
+
+
+bool TimerWheel::Cancel(intptr_t id) {
+  intptr_t index = (id & kMaxTimers) - 1;
+  if ((index < 0) || (index >= num_entries_)) {
+    return false;
+  }
+  Entry* entry = &entries_[index];
+  if ((entry->level == -1) || (entry->generation != (id >> kIndexBits))) {
+    return false;
+  }
+  Unlink(index);
+  Free(index);
+  pending_--;
+  return true;
+}
+
+
+void TimerWheel::Place(intptr_t index) {
+  Entry* entry = &entries_[index];
+  ASSERT(entry->tick >= current_);
+  intptr_t level = 0;
+  while ((level < kLevels) &&
+         (((entry->tick >> (level * kSlotBits)) -
+           (current_ >> (level * kSlotBits))) >= kSlots)) {
+    level++;
+  }
+  intptr_t slot;
+  if (level < kLevels) {
+    slot = (entry->tick >> (level * kSlotBits)) & kSlotMask;
+  } else {
+    // Beyond the wheel. Cascades back here until it comes within reach.
+    level = kLevels - 1;
+    slot = ((current_ >> (level * kSlotBits)) + kSlots - 1) & kSlotMask;
+  }
+  entry->level = level;
+  entry->slot = slot;
+  entry->prev = -1;
+  entry->next = heads_[level][slot];
+  if (entry->next != -1) {
+    entries_[entry->next].prev = index;
+  }
+  heads_[level][slot] = index;
+  occupied_[level] |= static_cast<uint64_t>(1) << slot;
+}
+
+
+void TimerWheel::Unlink(intptr_t index) {
+  Entry* entry = &entries_[index];
+  if (entry->prev != -1) {
+    entries_[entry->prev].next = entry->next;
+  } else {
+    heads_[entry->level][entry->slot] = entry->next;
+    if (entry->next == -1) {
+      occupied_[entry->level] &= ~(static_cast<uint64_t>(1) << entry->slot);
+    }
+  }
+  if (entry->next != -1) {
+    entries_[entry->next].prev = entry->prev;
+  }
+}
+
+
+void TimerWheel::Free(intptr_t index) {
+  Entry* entry = &entries_[index];
+  entry->generation = (entry->generation + 1) & kGenerationMask;
+  entry->level = -1;
+  entry->next = free_;
+  free_ = index;
+}
+
+
+void TimerWheel::AddFired(intptr_t index) {
+  if (num_fired_ == fired_capacity_) {
+    intptr_t new_capacity = fired_capacity_ == 0 ? 64 : fired_capacity_ * 2;
+    Fired* new_fired = new Fired[new_capacity];
+    if (fired_ != nullptr) {
+      memcpy(new_fired, fired_, num_fired_ * sizeof(Fired));
+      delete[] fired_;
+    }
+    fired_ = new_fired;
+    fired_capacity_ = new_capacity;
+  }
+  Entry* entry = &entries_[index];
+  Fired* fired = &fired_[num_fired_++];
+  fired->due = entry->due;
+  fired->serial = entry->serial;
+  fired->id = (entry->generation << kIndexBits) | (index + 1);
+}
+
+
+void TimerWheel::Fire(intptr_t slot) {
+  intptr_t index = heads_[0][slot];
+  heads_[0][slot] = -1;
+  occupied_[0] &= ~(static_cast<uint64_t>(1) << slot);
+  while (index != -1) {
+    intptr_t next = entries_[index].next;
+    AddFired(index);
+    Free(index);
+    pending_--;
+    index = next;
+  }
+}
+
+
+void TimerWheel::Cascade(intptr_t level) {
+  intptr_t slot = (current_ >> (level * kSlotBits)) & kSlotMask;
+  intptr_t index = heads_[level][slot];
+  heads_[level][slot] = -1;
+  occupied_[level] &= ~(static_cast<uint64_t>(1) << slot);
+  while (index != -1) {
+    intptr_t next = entries_[index].next;
+    Place(index);
+    index = next;
+  }
+}
+
+
+// The distance from |from| to the first set bit of |bits|, wrapping around.
+static intptr_t CyclicDistance(uint64_t bits, intptr_t from) {
+  ASSERT(bits != 0);
+  uint64_t rotated = from == 0 ? bits : (bits >> from) | (bits << (64 - from));
+  return Utils::CountTrailingZeros(rotated);
+}
+
+
+int64_t TimerWheel::NextTick(bool include_current) const {
+  int64_t next = -1;
+  if (occupied_[0] != 0) {
+    intptr_t from = (current_ + (include_current ? 0 : 1)) & kSlotMask;
+    next = current_ + (include_current ? 0 : 1) +
+           CyclicDistance(occupied_[0], from);
+  }
+  for (intptr_t level = 1; level < kLevels; level++) {
+    if (occupied_[level] == 0) {
+      continue;
+    }
+    // A level's current slot has already cascaded.
+    int64_t block = current_ >> (level * kSlotBits);
+    intptr_t from = (block + 1) & kSlotMask;
+    int64_t tick = (block + 1 + CyclicDistance(occupied_[level], from))
+                   << (level * kSlotBits);
+    if ((next == -1) || (tick < next)) {
+      next = tick;
+    }
+  }
+  return next;
+}
+
+
+int TimerWheel::CompareFired(const void* a, const void* b) {
+  const Fired* x = reinterpret_cast<const Fired*>(a);
+  const Fired* y = reinterpret_cast<const Fired*>(b);
+  if (x->due != y->due) {
+    return x->due < y->due ? -1 : 1;
+  }
+  if (x->serial != y->serial) {
+    return x->serial < y->serial ? -1 : 1;
+  }
+  return 0;
+}
+
+
+intptr_t TimerWheel::Expire(int64_t now) {
+  int64_t now_tick = now / kTickNanos;
+  while ((pending_ != 0) && (current_ <= now_tick)) {
+    intptr_t slot = current_ & kSlotMask;
+    if ((occupied_[0] & (static_cast<uint64_t>(1) << slot)) != 0) {
+      Fire(slot);
+    }
+    int64_t next = pending_ == 0 ? -1 : NextTick(false);
+    if ((next == -1) || (next > now_tick + 1)) {
+      next = now_tick + 1;
+    }
+    ASSERT(next > current_);
+    current_ = next;
+    for (intptr_t level = kLevels - 1; level > 0; level--) {
+      if ((current_ & ((static_cast<int64_t>(1) << (level * kSlotBits)) - 1))
+          == 0) {
+        Cascade(level);
+      }
+    }
+  }
+  if (current_ <= now_tick) {
+    current_ = now_tick + 1;  // Empty.
+  }
+  if (num_fired_ > 1) {
+    qsort(fired_, num_fired_, sizeof(Fired), CompareFired);
+  }
+  return num_fired_;
+}
+
+
+int64_t TimerWheel::NextDue() const {
+  if (num_fired_ != 0) {
+    return (current_ - 1) * kTickNanos;  // Already.
+  }
+  if (pending_ == 0) {
+    return 0;
+  }
+  int64_t tick = NextTick(true);
+  ASSERT(tick != -1);
+  return tick * kTickNanos;
+}
+
+}  // namespace psoup
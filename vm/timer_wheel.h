@@ -0,0 +1,115 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_TIMER_WHEEL_H_
+#define VM_TIMER_WHEEL_H_
+
+#include "vm/globals.h"
+
+namespace psoup {
+
+// A message loop's timers, so an isolate with many pending timeouts neither
+// keeps them sorted itself nor resets the OS timer as each is scheduled: the
+// loop only asks its backend to wake it at NextDue.
+//
+// Timers are counted in ticks of a millisecond on a hierarchical wheel of
+// four levels of 64 slots each, as in George Varghese and Tony Lauck.
+// "Hashed and Hierarchical Timing Wheels." SOSP. 1987. Each level's slots
+// span 64 times those of the level below, and a timer goes on the lowest
+// level whose slots reach it. When the wheel turns into a slot of a higher
+// level, its timers cascade down to lower ones. A bitmap of each level's
+// occupied slots lets the wheel skip past empty ones, so scheduling and
+// cancelling take constant time, and expiring takes time in the number of
+// timers that fire or cascade rather than in the ticks passed.
+class TimerWheel {
+ public:
+  // Timers are rounded up to whole ticks, so they never fire early.
+  static constexpr int64_t kTickNanos = kNanosecondsPerMillisecond;
+
+  TimerWheel();
+  ~TimerWheel();
+
+  // Answers the id of a timer due at |due| in monotonic nanoseconds, which
+  // fits in a SmallInteger and is never 0, or 0 if too many are pending.
+  intptr_t Schedule(int64_t due, int64_t now);
+  // Answers false if |id| already fired or was cancelled.
+  bool Cancel(intptr_t id);
+
+  // Fires the timers due by |now| and answers how many fired timers are
+  // waiting to be taken.
+  intptr_t Expire(int64_t now);
+  // The fired timers in order of due time, and of scheduling among those due
+  // together.
+  intptr_t fired_id(intptr_t i) const { return fired_[i].id; }
+  void ClearFired() { num_fired_ = 0; }
+
+  // When the wheel next needs to turn to fire or cascade timers, in monotonic
+  // nanoseconds, or 0 if none are pending. In the past if timers scheduled
+  // after the wheel turned past their due time are waiting to be taken.
+  int64_t NextDue() const;
+
+  intptr_t pending() const { return pending_; }
+
+ private:
+  static constexpr intptr_t kLevels = 4;
+  static constexpr intptr_t kSlotBits = 6;
+  static constexpr intptr_t kSlots = 1 << kSlotBits;
+  static constexpr intptr_t kSlotMask = kSlots - 1;
+  // Ids are an entry's index + 1 below its generation, which counts how often
+  // the entry was reused.
+  static constexpr intptr_t kIndexBits = 20;
+  static constexpr intptr_t kMaxTimers = (1 << kIndexBits) - 1;
+  static constexpr intptr_t kGenerationMask =
+      (static_cast<intptr_t>(1) << (kBitsPerWord - 2 - kIndexBits)) - 1;
+
+  struct Entry {
+    int64_t tick;
+    int64_t due;
+    int64_t serial;
+    intptr_t generation;
+    intptr_t level;  // -1 when free.
+    intptr_t slot;
+    intptr_t prev;
+    intptr_t next;  // Also links free entries.
+  };
+
+  struct Fired {
+    int64_t due;
+    int64_t serial;
+    intptr_t id;
+  };
+
+  intptr_t NewEntry();
+  void Place(intptr_t index);
+  void Unlink(intptr_t index);
+  void Free(intptr_t index);
+  void AddFired(intptr_t index);
+  void Fire(intptr_t slot);
+  void Cascade(intptr_t level);
+  // The first tick at which a level 0 slot fires or a higher one cascades,
+  // from the current tick or the one after, or -1 if none is occupied.
+  int64_t NextTick(bool include_current) const;
+  static int CompareFired(const void* a, const void* b);
+
+  int64_t current_;  // The next tick to fire.
+  int64_t next_serial_;
+  intptr_t pending_;
+  uint64_t occupied_[kLevels];
+  intptr_t heads_[kLevels][kSlots];
+
+  Entry* entries_;
+  intptr_t num_entries_;
+  intptr_t capacity_;
+  intptr_t free_;
+
+  Fired* fired_;
+  intptr_t num_fired_;
+  intptr_t fired_capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+}  // namespace psoup
+
+#endif  // VM_TIMER_WHEEL_H_
@@ -0,0 +1,364 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/trace_events.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vm/atomic.h"
+#include "vm/os.h"
+#include "vm/pprof.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+namespace {
+
+struct Event {
+  int64_t nanos;
+  const char* name;
+  const void* isolate;
+  uint64_t id;
+  intptr_t kind;
+};
+
+struct Chunk {
+  static constexpr intptr_t kCapacity = 4096;
+
+  Chunk() : next(nullptr), count(0) {}
+
+  // Both published with release stores by the owning thread, so a reader
+  // sees every event counted.
+  Chunk* next;
+  intptr_t count;
+  Event events[kCapacity];
+};
+
+// Past this, a thread's further events are dropped rather than letting a long
+// run exhaust memory.
+static constexpr intptr_t kMaxChunksPerThread = 256;
+
+struct ThreadBuffer {
+  explicit ThreadBuffer(intptr_t tid)
+      : next(nullptr), tid(tid), first(new Chunk()), last(first),
+        chunks(1), dropped(0) {}
+
+  ThreadBuffer* next;  // In the list of all buffers.
+  intptr_t tid;
+  Chunk* first;
+  Chunk* last;  // Only used by the owning thread.
+  intptr_t chunks;
+  intptr_t dropped;
+};
+
+// Walks a buffer's events, possibly while its thread is still adding more.
+class EventCursor {
+ public:
+  explicit EventCursor(ThreadBuffer* buffer)
+      : chunk_(buffer->first), index_(0) {
+    Settle();
+  }
+
+  const Event* Peek() const {
+    return chunk_ == nullptr ? nullptr : &chunk_->events[index_];
+  }
+  void Advance() {
+    index_++;
+    Settle();
+  }
+
+ private:
+  void Settle() {
+    while ((chunk_ != nullptr) &&
+           (index_ == AtomicOperations::LoadAcquire(&chunk_->count))) {
+      chunk_ = AtomicOperations::LoadAcquire(&chunk_->next);
+      index_ = 0;
+    }
+  }
+
+  Chunk* chunk_;
+  intptr_t index_;
+};
+
+}  // namespace
+
+bool TraceEvents::enabled_ = false;
+static char* filename_ = nullptr;
+static int64_t start_nanos_ = 0;
+static uint64_t next_flow_id_ = 1;
+// Buffers are pushed here as threads first record and are never freed, since
+// a thread may still be recording when the trace is written.
+static ThreadBuffer* buffers_ = nullptr;
+
+#if defined(OS_EMSCRIPTEN) && !defined(EMSCRIPTEN_THREADS)
+static ThreadBuffer* current_buffer_ = nullptr;
+#else
+static thread_local ThreadBuffer* current_buffer_ = nullptr;
+#endif
+
+static ThreadBuffer* CurrentBuffer() {
+  ThreadBuffer* buffer = current_buffer_;
+  if (buffer != nullptr) {
+    return buffer;
+  }
+  buffer = new ThreadBuffer(
+      Thread::ThreadIdToIntPtr(Thread::GetCurrentThreadTraceId()));
+  ThreadBuffer* head = AtomicOperations::LoadAcquire(&buffers_);
+  do {
+    buffer->next = head;
+  } while (!AtomicOperations::CompareAndSwap(&buffers_, &head, buffer));
+  current_buffer_ = buffer;
+  return buffer;
+}
+
+
+void TraceEvents::Start(const char* filename) {
+  ASSERT(!enabled_);
+  filename_ = CopyCString(filename);
+  start_nanos_ = OS::CurrentMonotonicNanos();
+  enabled_ = true;
+}
+
+
+void TraceEvents::Record(Kind kind, const char* name, const void* isolate,
+                         uint64_t id) {
+  if (!enabled_) {
+    return;
+  }
+  ThreadBuffer* buffer = CurrentBuffer();
+  Chunk* chunk = buffer->last;
+  intptr_t count = chunk->count;
+  if (count == Chunk::kCapacity) {
+    if (buffer->chunks == kMaxChunksPerThread) {
+      AtomicOperations::StoreRelaxed(&buffer->dropped, buffer->dropped + 1);
+      return;
+    }
+    Chunk* next = new Chunk();
+    AtomicOperations::StoreRelease(&chunk->next, next);
+    buffer->last = chunk = next;
+    buffer->chunks++;
+    count = 0;
+  }
+  Event* event = &chunk->events[count];
+  event->nanos = OS::CurrentMonotonicNanos();
+  event->name = name;
+  event->isolate = isolate;
+  event->id = id;
+  event->kind = kind;
+  AtomicOperations::StoreRelease(&chunk->count, count + 1);
+}
+
+
+uint64_t TraceEvents::NextFlowId() {
+  return AtomicOperations::FetchAndAddRelaxed(&next_flow_id_,
+                                              static_cast<uint64_t>(1));
+}
+
+
+// The Chrome trace event format, with timestamps in microseconds.
+static void WriteJSON(FILE* file, ThreadBuffer* buffers) {
+  static const char* const kPhases[] = {"B", "E", "i", "s", "f"};
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  const char* separator = "\n";
+  for (ThreadBuffer* buffer = buffers; buffer != nullptr;
+       buffer = buffer->next) {
+    for (EventCursor cursor(buffer); cursor.Peek() != nullptr;
+         cursor.Advance()) {
+      const Event* event = cursor.Peek();
+      double micros = (event->nanos - start_nanos_) / 1000.0;
+      fprintf(file,
+              "%s{\"name\":\"%s\",\"cat\":\"psoup\",\"ph\":\"%s\","
+              "\"ts\":%.3f,\"pid\":1,\"tid\":%" Pd,
+              separator, event->name, kPhases[event->kind], micros,
+              buffer->tid);
+      separator = ",\n";
+      switch (event->kind) {
+        case TraceEvents::kInstant:
+          fprintf(file, ",\"s\":\"t\"");
+          break;
+        case TraceEvents::kFlowStart:
+          fprintf(file, ",\"id\":%" Pu64, event->id);
+          break;
+        case TraceEvents::kFlowEnd:
+          fprintf(file, ",\"id\":%" Pu64 ",\"bp\":\"e\"", event->id);
+          break;
+        default:
+          break;
+      }
+      if (event->isolate != nullptr) {
+        fprintf(file, ",\"args\":{\"isolate\":\"%" Px "\"}",
+                reinterpret_cast<uword>(event->isolate));
+      }
+      fprintf(file, "}");
+    }
+  }
+  fprintf(file, "\n]}\n");
+}
+
+
+// Fields of Perfetto's trace.proto.
+enum {
+  kTracePacket = 1,
+
+  kPacketTimestamp = 8,
+  kPacketSequenceId = 10,
+  kPacketTrackEvent = 11,
+  kPacketSequenceFlags = 13,
+  kPacketTrackDescriptor = 60,
+
+  kTrackUuid = 1,
+  kTrackName = 2,
+  kTrackProcess = 3,
+  kTrackThread = 4,
+  kTrackParentUuid = 5,
+
+  kProcessPid = 1,
+  kProcessName = 6,
+
+  kThreadPid = 1,
+  kThreadTid = 2,
+
+  kEventDebugAnnotation = 4,
+  kEventType = 9,
+  kEventTrackUuid = 11,
+  kEventName = 23,
+  kEventFlowIds = 47,
+  kEventTerminatingFlowIds = 48,
+
+  kAnnotationPointerValue = 7,
+  kAnnotationName = 10,
+
+  kTypeSliceBegin = 1,
+  kTypeSliceEnd = 2,
+  kTypeInstant = 3,
+
+  kIncrementalStateCleared = 1,
+};
+
+static constexpr intptr_t kPid = 1;
+static constexpr intptr_t kSequenceId = 1;
+static constexpr uint64_t kProcessUuid = 1;
+
+static void WritePacket(FILE* file, const ProtoBuffer& packet) {
+  ProtoBuffer trace;
+  trace.AddMessageField(kTracePacket, packet);
+  intptr_t length;
+  uint8_t* bytes = trace.Take(&length);
+  fwrite(bytes, 1, length, file);
+  delete[] bytes;
+}
+
+
+static void WritePerfetto(FILE* file, ThreadBuffer* buffers) {
+  {
+    ProtoBuffer process;
+    process.AddIntField(kProcessPid, kPid);
+    process.AddStringField(kProcessName, "primordialsoup");
+    ProtoBuffer track;
+    track.AddIntField(kTrackUuid, kProcessUuid);
+    track.AddMessageField(kTrackProcess, process);
+    ProtoBuffer packet;
+    packet.AddIntField(kPacketSequenceId, kSequenceId);
+    packet.AddIntField(kPacketSequenceFlags, kIncrementalStateCleared);
+    packet.AddMessageField(kPacketTrackDescriptor, track);
+    WritePacket(file, packet);
+  }
+
+  uint64_t uuid = kProcessUuid;
+  for (ThreadBuffer* buffer = buffers; buffer != nullptr;
+       buffer = buffer->next) {
+    uuid++;
+    {
+      ProtoBuffer thread;
+      thread.AddIntField(kThreadPid, kPid);
+      thread.AddIntField(kThreadTid, buffer->tid);
+      ProtoBuffer track;
+      track.AddIntField(kTrackUuid, uuid);
+      track.AddIntField(kTrackParentUuid, kProcessUuid);
+      track.AddMessageField(kTrackThread, thread);
+      ProtoBuffer packet;
+      packet.AddIntField(kPacketSequenceId, kSequenceId);
+      packet.AddMessageField(kPacketTrackDescriptor, track);
+      WritePacket(file, packet);
+    }
+
+    EventCursor cursor(buffer);
+    while (cursor.Peek() != nullptr) {
+      const Event* event = cursor.Peek();
+      cursor.Advance();
+      intptr_t type;
+      switch (event->kind) {
+        case TraceEvents::kBegin: type = kTypeSliceBegin; break;
+        case TraceEvents::kEnd: type = kTypeSliceEnd; break;
+        case TraceEvents::kInstant: type = kTypeInstant; break;
+        default: continue;  // A flow with no event to attach to.
+      }
+      ProtoBuffer track_event;
+      track_event.AddIntField(kEventType, type);
+      track_event.AddIntField(kEventTrackUuid, uuid);
+      if (type != kTypeSliceEnd) {
+        track_event.AddStringField(kEventName, event->name);
+      }
+      if (event->isolate != nullptr) {
+        ProtoBuffer annotation;
+        annotation.AddStringField(kAnnotationName, "isolate");
+        annotation.AddIntField(kAnnotationPointerValue,
+                               reinterpret_cast<uword>(event->isolate));
+        track_event.AddMessageField(kEventDebugAnnotation, annotation);
+      }
+      // Flows are recorded just after the event they belong to.
+      for (const Event* flow = cursor.Peek();
+           (flow != nullptr) && ((flow->kind == TraceEvents::kFlowStart) ||
+                                 (flow->kind == TraceEvents::kFlowEnd));
+           cursor.Advance(), flow = cursor.Peek()) {
+        track_event.AddFixed64Field(flow->kind == TraceEvents::kFlowStart
+                                        ? kEventFlowIds
+                                        : kEventTerminatingFlowIds,
+                                    flow->id);
+      }
+      ProtoBuffer packet;
+      packet.AddIntField(kPacketTimestamp, event->nanos);
+      packet.AddIntField(kPacketSequenceId, kSequenceId);
+      packet.AddMessageField(kPacketTrackEvent, track_event);
+      WritePacket(file, packet);
+    }
+  }
+}
+
+
+bool TraceEvents::Stop() {
+  ASSERT(enabled_);
+  enabled_ = false;
+  ThreadBuffer* buffers = AtomicOperations::LoadAcquire(&buffers_);
+
+  intptr_t dropped = 0;
+  for (ThreadBuffer* buffer = buffers; buffer != nullptr;
+       buffer = buffer->next) {
+    dropped += AtomicOperations::LoadRelaxed(&buffer->dropped);
+  }
+  if (dropped != 0) {
+    OS::PrintErr("Trace dropped %" Pd " events\n", dropped);
+  }
+
+  FILE* file = fopen(filename_, "wb");
+  if (file == nullptr) {
+    delete[] filename_;
+    filename_ = nullptr;
+    return false;
+  }
+  intptr_t length = strlen(filename_);
+  if ((length >= 5) && (strcmp(&filename_[length - 5], ".json") == 0)) {
+    WriteJSON(file, buffers);
+  } else {
+    WritePerfetto(file, buffers);
+  }
+  bool failed = ferror(file) != 0;
+  failed = (fclose(file) != 0) || failed;
+  delete[] filename_;
+  filename_ = nullptr;
+  return !failed;
+}
+
+}  // namespace psoup
@@ -0,0 +1,81 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_TRACE_EVENTS_H_
+#define VM_TRACE_EVENTS_H_
+
+#include "vm/allocation.h"
+#include "vm/globals.h"
+
+namespace psoup {
+
+// Records timestamped events from every thread, for seeing how isolates
+// interact: when they start and exit, when messages are posted and
+// dispatched, when they wait for signals and when they pause to collect
+// garbage. Each thread appends to a buffer of its own without locking; the
+// buffers are only read when the trace is written.
+//
+// A message's post and dispatch are joined by a flow, so the time it spent
+// queued shows as an arrow between the two.
+class TraceEvents : public AllStatic {
+ public:
+  enum Kind {
+    kBegin,
+    kEnd,
+    kInstant,
+    // Joins the event just recorded on this thread to the one recorded
+    // before a kFlowEnd with the same id.
+    kFlowStart,
+    kFlowEnd,
+  };
+
+  // Starts recording, for writing to |filename| when stopped: as Chrome trace
+  // event JSON if its name ends in ".json", and otherwise as a Perfetto
+  // trace. Both load in ui.perfetto.dev. Call before running any isolate.
+  static void Start(const char* filename);
+  // Stops recording and writes the trace. Answers false if it could not be
+  // written. The events of threads still running may be left out.
+  static bool Stop();
+
+  static bool enabled() { return enabled_; }
+
+  // |name| must outlive the trace. |isolate| identifies the isolate the event
+  // is for, or is NULL.
+  static void Record(Kind kind, const char* name, const void* isolate,
+                     uint64_t id = 0);
+
+  // For joining a message's post to its dispatch. Never 0.
+  static uint64_t NextFlowId();
+
+ private:
+  static bool enabled_;
+};
+
+// Records the rest of the enclosing scope as a slice named |name| if
+// recording.
+class TraceScope {
+ public:
+  TraceScope(const char* name, const void* isolate)
+      : name_(name), isolate_(isolate), recorded_(TraceEvents::enabled()) {
+    if (recorded_) {
+      TraceEvents::Record(TraceEvents::kBegin, name_, isolate_);
+    }
+  }
+  ~TraceScope() {
+    if (recorded_) {
+      TraceEvents::Record(TraceEvents::kEnd, name_, isolate_);
+    }
+  }
+
+ private:
+  const char* name_;
+  const void* isolate_;
+  bool recorded_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceScope);
+};
+
+}  // namespace psoup
+
+#endif  // VM_TRACE_EVENTS_H_
@@ -0,0 +1,638 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/transport.h"
+
+#if defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "vm/assert.h"
+#include "vm/lockers.h"
+#include "vm/message_loop.h"
+#include "vm/sockets.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+#if defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0  // macOS, where SO_NOSIGPIPE is set instead.
+#endif
+
+static constexpr intptr_t kHeaderSize = 16;
+// Frames gathered into one write.
+static constexpr intptr_t kMaxBatch = 64;
+// Longer messages are not sent, and from a peer are taken as a broken stream.
+// A peer's announced length is allocated before any of the message arrives,
+// so this bounds what any connection can make this process reserve.
+static constexpr int64_t kMaxLength = static_cast<int64_t>(64) * MB;
+
+// A message waiting to be written, its header and bytes following.
+struct Frame {
+  Frame* next;
+  intptr_t size;
+
+  uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+};
+
+// A pooled connection to an address this process sends to. Peers are kept
+// until shutdown, reconnecting as needed.
+struct Peer {
+  char* address;
+  // Guarded by the mutex.
+  Frame* first;
+  Frame* last;
+  Peer* next;
+  // Only used by the I/O thread.
+  int fd;  // -1 when not connected.
+  bool connecting;
+  intptr_t written;  // Of the first frame.
+};
+
+// A connection from a process sending to this one. Only used by the I/O
+// thread.
+struct Inbound {
+  int fd;
+  uint8_t header[kHeaderSize];
+  intptr_t header_read;
+  uint8_t* data;
+  intptr_t length;
+  intptr_t data_read;
+  Inbound* next;
+};
+
+static Mutex* mutex_ = nullptr;
+static bool running_ = false;
+static bool shutting_down_ = false;
+static bool started_ = false;
+static Monitor* start_monitor_ = nullptr;
+static ThreadJoinId join_id_;
+static int wake_fds_[2] = {-1, -1};
+static int listen_fd_ = -1;
+static char* address_ = nullptr;
+static Peer* peers_ = nullptr;
+static Inbound* inbound_ = nullptr;
+
+static void WriteInt64(uint8_t* bytes, int64_t value) {
+  for (intptr_t i = 0; i < 8; i++) {
+    bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+static int64_t ReadInt64(const uint8_t* bytes) {
+  uint64_t value = 0;
+  for (intptr_t i = 0; i < 8; i++) {
+    value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+  }
+  return static_cast<int64_t>(value);
+}
+
+static bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return (flags != -1) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+static int OpenSocket(int family) {
+  int fd = Sockets::Open(family, SOCK_STREAM);
+  if (fd == -1) {
+    return -1;
+  }
+  if (family != AF_UNIX) {
+    // Batches are written whole, so there is nothing to gain by waiting.
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+static void Wake() {
+  uint8_t byte = 0;
+  ssize_t result;
+  do {
+    result = write(wake_fds_[1], &byte, 1);
+  } while ((result == -1) && (errno == EINTR));
+  // EAGAIN means a wakeup is already pending.
+}
+
+// Drops the frames queued for |peer| and closes its connection.
+static void Fail(Peer* peer) {
+  if (peer->fd != -1) {
+    close(peer->fd);
+    peer->fd = -1;
+  }
+  peer->connecting = false;
+  peer->written = 0;
+  Frame* frame;
+  {
+    MutexLocker ml(mutex_);
+    frame = peer->first;
+    peer->first = peer->last = nullptr;
+  }
+  while (frame != nullptr) {
+    Frame* next = frame->next;
+    free(frame);
+    frame = next;
+  }
+}
+
+static void Connect(Peer* peer) {
+  ASSERT(peer->fd == -1);
+  SocketAddress address;
+  if (!address.Parse(peer->address, false)) {
+    Fail(peer);
+    return;
+  }
+  int fd = OpenSocket(address.family());
+  if (fd == -1) {
+    Fail(peer);
+    return;
+  }
+  peer->fd = fd;
+  if (connect(fd, address.address(), address.length()) == 0) {
+    peer->connecting = false;
+  } else if (errno == EINPROGRESS) {
+    peer->connecting = true;
+  } else {
+    Fail(peer);
+  }
+}
+
+// Writes as many of |peer|'s frames as the socket takes, gathered together.
+static void Flush(Peer* peer) {
+  struct iovec iov[kMaxBatch];
+  intptr_t count = 0;
+  {
+    MutexLocker ml(mutex_);
+    for (Frame* frame = peer->first;
+         (frame != nullptr) && (count < kMaxBatch);
+         frame = frame->next) {
+      intptr_t skip = count == 0 ? peer->written : 0;
+      iov[count].iov_base = frame->bytes() + skip;
+      iov[count].iov_len = frame->size - skip;
+      count++;
+    }
+  }
+  if (count == 0) {
+    return;
+  }
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = iov;
+  message.msg_iovlen = count;
+  ssize_t written;
+  do {
+    written = sendmsg(peer->fd, &message, MSG_NOSIGNAL);
+  } while ((written == -1) && (errno == EINTR));
+  if (written == -1) {
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+      Fail(peer);
+    }
+    return;
+  }
+  Frame* done = nullptr;
+  {
+    MutexLocker ml(mutex_);
+    intptr_t remaining = peer->written + written;
+    while ((peer->first != nullptr) && (remaining >= peer->first->size)) {
+      Frame* frame = peer->first;
+      remaining -= frame->size;
+      peer->first = frame->next;
+      frame->next = done;
+      done = frame;
+    }
+    if (peer->first == nullptr) {
+      peer->last = nullptr;
+    }
+    peer->written = remaining;
+  }
+  while (done != nullptr) {
+    Frame* next = done->next;
+    free(done);
+    done = next;
+  }
+}
+
+static void CloseInbound(Inbound* connection) {
+  for (Inbound** link = &inbound_; *link != nullptr; link = &(*link)->next) {
+    if (*link == connection) {
+      *link = connection->next;
+      break;
+    }
+  }
+  close(connection->fd);
+  free(connection->data);
+  delete connection;
+}
+
+// Reads what has arrived and posts each message completed.
+static void Receive(Inbound* connection) {
+  for (;;) {
+    uint8_t* target;
+    intptr_t wanted;
+    if (connection->header_read < kHeaderSize) {
+      target = &connection->header[connection->header_read];
+      wanted = kHeaderSize - connection->header_read;
+    } else {
+      target = &connection->data[connection->data_read];
+      wanted = connection->length - connection->data_read;
+    }
+    ssize_t result = wanted == 0 ? 0 : read(connection->fd, target, wanted);
+    if (wanted != 0) {
+      if ((result == -1) && (errno == EINTR)) {
+        continue;
+      }
+      if ((result == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        return;
+      }
+      if (result <= 0) {
+        CloseInbound(connection);
+        return;
+      }
+    }
+    if (connection->header_read < kHeaderSize) {
+      connection->header_read += result;
+      if (connection->header_read < kHeaderSize) {
+        continue;
+      }
+      int64_t length = ReadInt64(&connection->header[8]);
+      if ((length < 0) || (length > kMaxLength)) {
+        CloseInbound(connection);
+        return;
+      }
+      connection->length = length;
+      connection->data_read = 0;
+      // One extra byte so an empty message still has a buffer.
+      connection->data =
+          reinterpret_cast<uint8_t*>(malloc(connection->length + 1));
+      if (connection->data == nullptr) {
+        CloseInbound(connection);
+        return;
+      }
+      continue;
+    }
+    connection->data_read += result;
+    if (connection->data_read < connection->length) {
+      continue;
+    }
+    Port port = ReadInt64(&connection->header[0]);
+    // Dropped if the port is closed.
+    PortMap::PostMessage(IsolateMessage::NewBytes(port, connection->data,
+                                                  connection->length));
+    free(connection->data);
+    connection->data = nullptr;
+    connection->header_read = 0;
+  }
+}
+
+static void Accept() {
+  for (;;) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;  // EAGAIN, or a connection that went away.
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (!SetNonBlocking(fd)) {
+      close(fd);
+      continue;
+    }
+    Inbound* connection = new Inbound();
+    connection->fd = fd;
+    connection->header_read = 0;
+    connection->data = nullptr;
+    connection->length = 0;
+    connection->data_read = 0;
+    connection->next = inbound_;
+    inbound_ = connection;
+  }
+}
+
+static void IOMain(uword parameter) {
+  {
+    MonitorLocker ml(start_monitor_);
+    join_id_ = Thread::GetCurrentThreadJoinId();
+    started_ = true;
+    ml.Notify();
+  }
+
+  struct pollfd* fds = nullptr;
+  void** owners = nullptr;
+  intptr_t capacity = 0;
+  for (;;) {
+    int listen_fd;
+    // Peers are only added at the front, so the list from here on is stable.
+    Peer* peers;
+    intptr_t num_peers = 0;
+    {
+      MutexLocker ml(mutex_);
+      if (shutting_down_) {
+        break;
+      }
+      listen_fd = listen_fd_;
+      peers = peers_;
+      for (Peer* peer = peers; peer != nullptr; peer = peer->next) {
+        num_peers++;
+      }
+    }
+    intptr_t num_inbound = 0;
+    for (Inbound* c = inbound_; c != nullptr; c = c->next) {
+      num_inbound++;
+    }
+    intptr_t needed = 2 + num_peers + num_inbound;
+    if (needed > capacity) {
+      delete[] fds;
+      delete[] owners;
+      capacity = needed * 2;
+      fds = new struct pollfd[capacity];
+      owners = new void*[capacity];
+    }
+
+    intptr_t n = 0;
+    fds[n].fd = wake_fds_[0];
+    fds[n].events = POLLIN;
+    owners[n++] = nullptr;
+    if (listen_fd != -1) {
+      fds[n].fd = listen_fd;
+      fds[n].events = POLLIN;
+      owners[n++] = nullptr;
+    }
+    intptr_t first_peer = n;
+    for (Peer* peer = peers; peer != nullptr; peer = peer->next) {
+      bool queued;
+      {
+        MutexLocker ml(mutex_);
+        queued = peer->first != nullptr;
+      }
+      if (queued && (peer->fd == -1)) {
+        Connect(peer);
+      }
+      if (peer->fd == -1) {
+        continue;
+      }
+      fds[n].fd = peer->fd;
+      fds[n].events = peer->connecting
+          ? POLLOUT
+          : POLLIN | (queued ? POLLOUT : 0);
+      owners[n++] = peer;
+    }
+    intptr_t first_inbound = n;
+    for (Inbound* c = inbound_; c != nullptr; c = c->next) {
+      fds[n].fd = c->fd;
+      fds[n].events = POLLIN;
+      owners[n++] = c;
+    }
+    for (intptr_t i = 0; i < n; i++) {
+      fds[i].revents = 0;
+    }
+
+    if (poll(fds, n, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      FATAL("Transport poll failed: %s", strerror(errno));
+    }
+
+    if ((fds[0].revents & POLLIN) != 0) {
+      uint8_t buffer[64];
+      while (read(wake_fds_[0], buffer, sizeof(buffer)) > 0) {
+      }
+    }
+    if ((listen_fd != -1) && ((fds[1].revents & POLLIN) != 0)) {
+      Accept();
+    }
+    for (intptr_t i = first_peer; i < first_inbound; i++) {
+      Peer* peer = reinterpret_cast<Peer*>(owners[i]);
+      intptr_t revents = fds[i].revents;
+      if (revents == 0) {
+        continue;
+      }
+      if (peer->connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if ((getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0)
+            || (error != 0)) {
+          Fail(peer);
+          continue;
+        }
+        peer->connecting = false;
+      } else if ((revents & (POLLIN | POLLERR | POLLHUP)) != 0) {
+        // Peers never write back, so this is the connection closing.
+        Fail(peer);
+        continue;
+      }
+      Flush(peer);
+    }
+    for (intptr_t i = first_inbound; i < n; i++) {
+      if (fds[i].revents != 0) {
+        Receive(reinterpret_cast<Inbound*>(owners[i]));
+      }
+    }
+  }
+
+  delete[] fds;
+  delete[] owners;
+}
+
+void Transport::Startup() {
+  mutex_ = new Mutex();
+  start_monitor_ = new Monitor();
+}
+
+// Starts the I/O thread on first use. Called with the mutex held.
+static bool EnsureRunning() {
+  if (running_) {
+    return true;
+  }
+  if (pipe(wake_fds_) != 0) {
+    return false;
+  }
+  for (intptr_t i = 0; i < 2; i++) {
+    fcntl(wake_fds_[i], F_SETFD, FD_CLOEXEC);
+    SetNonBlocking(wake_fds_[i]);
+  }
+  MonitorLocker ml(start_monitor_);
+  if (Thread::Start("PSoup Transport", &IOMain, 0) != 0) {
+    close(wake_fds_[0]);
+    close(wake_fds_[1]);
+    wake_fds_[0] = wake_fds_[1] = -1;
+    return false;
+  }
+  while (!started_) {
+    ml.Wait();
+  }
+  running_ = true;
+  return true;
+}
+
+void Transport::Shutdown() {
+  bool join;
+  {
+    MutexLocker ml(mutex_);
+    shutting_down_ = true;
+    join = running_;
+    if (join) {
+      Wake();
+    }
+  }
+  if (join) {
+    Thread::Join(join_id_);
+    close(wake_fds_[0]);
+    close(wake_fds_[1]);
+  }
+  while (peers_ != nullptr) {
+    Peer* peer = peers_;
+    peers_ = peer->next;
+    Fail(peer);
+    free(peer->address);
+    delete peer;
+  }
+  while (inbound_ != nullptr) {
+    CloseInbound(inbound_);
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+    if (strncmp(address_, "unix:", 5) == 0) {
+      unlink(address_ + 5);
+    }
+  }
+  free(address_);
+  delete start_monitor_;
+  delete mutex_;
+}
+
+bool Transport::Listen(const char* address) {
+  SocketAddress parsed;
+  if (!parsed.Parse(address, true) || (parsed.type() != SOCK_STREAM)) {
+    return false;
+  }
+  MutexLocker ml(mutex_);
+  if ((listen_fd_ != -1) || !EnsureRunning()) {
+    return false;
+  }
+  int fd = OpenSocket(parsed.family());
+  if (fd == -1) {
+    return false;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if ((bind(fd, parsed.address(), parsed.length()) != 0) ||
+      (listen(fd, SOMAXCONN) != 0)) {
+    close(fd);
+    return false;
+  }
+
+  if (parsed.family() == AF_UNIX) {
+    address_ = strdup(address);
+  } else {
+    // Name the port the OS chose, if it was asked to.
+    struct sockaddr_storage bound;
+    socklen_t length = sizeof(bound);
+    getsockname(fd, reinterpret_cast<struct sockaddr*>(&bound), &length);
+    int port = bound.ss_family == AF_INET6
+        ? ntohs(reinterpret_cast<struct sockaddr_in6*>(&bound)->sin6_port)
+        : ntohs(reinterpret_cast<struct sockaddr_in*>(&bound)->sin_port);
+    const char* host = address + 4;
+    intptr_t host_length = strrchr(host, ':') - host;
+    intptr_t size = 4 + host_length + 1 + 5 + 1;
+    address_ = reinterpret_cast<char*>(malloc(size));
+    snprintf(address_, size, "tcp:%.*s:%d",
+             static_cast<int>(host_length), host, port);
+  }
+  listen_fd_ = fd;
+  Wake();
+  return true;
+}
+
+const char* Transport::address() {
+  MutexLocker ml(mutex_);
+  return address_;
+}
+
+bool Transport::Send(const char* address, Port port,
+                     const uint8_t* data, intptr_t length) {
+  if ((strncmp(address, "tcp:", 4) != 0) &&
+      (strncmp(address, "unix:", 5) != 0)) {
+    return false;
+  }
+  if (length > kMaxLength) {
+    return false;
+  }
+  Frame* frame =
+      reinterpret_cast<Frame*>(malloc(sizeof(Frame) + kHeaderSize + length));
+  if (frame == nullptr) {
+    return false;
+  }
+  frame->next = nullptr;
+  frame->size = kHeaderSize + length;
+  WriteInt64(frame->bytes(), port);
+  WriteInt64(frame->bytes() + 8, length);
+  memcpy(frame->bytes() + kHeaderSize, data, length);
+
+  MutexLocker ml(mutex_);
+  if (shutting_down_ || !EnsureRunning()) {
+    free(frame);
+    return false;
+  }
+  Peer* peer = peers_;
+  while ((peer != nullptr) && (strcmp(peer->address, address) != 0)) {
+    peer = peer->next;
+  }
+  if (peer == nullptr) {
+    peer = new Peer();
+    peer->address = strdup(address);
+    peer->first = peer->last = nullptr;
+    peer->fd = -1;
+    peer->connecting = false;
+    peer->written = 0;
+    peer->next = peers_;
+    peers_ = peer;
+  }
+  if (peer->last == nullptr) {
+    peer->first = peer->last = frame;
+    // The I/O thread only needs waking for a peer it is not already
+    // writing to.
+    Wake();
+  } else {
+    peer->last->next = frame;
+    peer->last = frame;
+  }
+  return true;
+}
+
+#else  // defined(OS_ANDROID) || defined(OS_LINUX) || defined(OS_MACOS)
+
+void Transport::Startup() {}
+
+void Transport::Shutdown() {}
+
+bool Transport::Listen(const char* address) {
+  return false;
+}
+
+const char* Transport::address() {
+  return nullptr;
+}
+
+bool Transport::Send(const char* address, Port port,
+                     const uint8_t* data, intptr_t length) {
+  return false;
+}
+
+#endif
+
+}  // namespace psoup
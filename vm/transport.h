@@ -0,0 +1,55 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_TRANSPORT_H_
+#define VM_TRANSPORT_H_
+
+#include "vm/allocation.h"
+#include "vm/globals.h"
+#include "vm/port.h"
+
+namespace psoup {
+
+// Messages for ports in other processes, on this host or others. A process
+// listens at an address, "tcp:<host>:<port>" or "unix:<path>", and a port in
+// it is named elsewhere by that address and the port's id, which is random
+// across 63 bits and so unlikely to be shared by two processes.
+//
+// Each message is framed as its port and length, both 64-bit little-endian,
+// followed by the bytes the Serializer wrote, and is posted to its port as
+// it arrives, so the receiver reads it as it would one from a local isolate.
+//
+// One thread does all the transport's I/O, polling every socket. Connections
+// are pooled by address: every isolate sending to an address shares one,
+// opened by the first send. Messages queued while a connection is busy or
+// still opening are written together with a single gathering write. If a
+// connection fails, the messages queued on it are dropped, as they would be
+// for a closed port, and the next send opens another.
+//
+// Only on Linux, Android and macOS. Elsewhere a process can neither listen
+// nor send.
+class Transport : public AllStatic {
+ public:
+  static void Startup();
+  // Stops the I/O thread. Messages not yet written are dropped.
+  static void Shutdown();
+
+  // Accepts connections at |address|, which for TCP may give port 0 for one
+  // the OS chooses. Answers false if the address is malformed or cannot be
+  // listened at, or this process already listens.
+  static bool Listen(const char* address);
+  // The address listened at, with the port the OS chose, or nullptr. Stays
+  // valid until shutdown.
+  static const char* address();
+
+  // Queues a copy of |data| for |port| at |address|. Answers false if the
+  // address is malformed, |data| is longer than the 64 MB a peer accepts, or
+  // this process cannot send. Delivery is not confirmed.
+  static bool Send(const char* address, Port port,
+                   const uint8_t* data, intptr_t length);
+};
+
+}  // namespace psoup
+
+#endif  // VM_TRANSPORT_H_
@@ -0,0 +1,226 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/utf8.h"
+
+#include <string.h>
+
+#include "vm/assert.h"
+#include "vm/utils.h"
+
+namespace psoup {
+
+static const uintptr_t kHighBits = static_cast<uintptr_t>(0x8080808080808080);
+
+static inline uintptr_t LoadWord(const uint8_t* bytes) {
+  uintptr_t word;
+  memcpy(&word, bytes, kWordSize);
+  return word;
+}
+
+// The high bit of each byte of the result is set where that byte of |word| is
+// a continuation byte, 10xxxxxx.
+static inline uintptr_t ContinuationBits(uintptr_t word) {
+  return word & ~(word << 1) & kHighBits;
+}
+
+static inline intptr_t LeadBytesInWord(uintptr_t word) {
+  return kWordSize - Utils::CountOneBits(ContinuationBits(word));
+}
+
+static inline bool IsContinuation(uint8_t byte) {
+  return (byte & 0xC0) == 0x80;
+}
+
+bool UTF8::IsValid(const uint8_t* bytes, intptr_t length) {
+  intptr_t i = 0;
+  while (i < length) {
+    if (i + 2 * kWordSize <= length) {
+      uintptr_t words = LoadWord(&bytes[i]) | LoadWord(&bytes[i + kWordSize]);
+      if ((words & kHighBits) == 0) {
+        i += 2 * kWordSize;
+        continue;
+      }
+    }
+    uint8_t lead = bytes[i];
+    if (lead < 0x80) {
+      i++;
+      continue;
+    }
+    intptr_t trailing;
+    uint8_t second_min = 0x80;
+    uint8_t second_max = 0xBF;
+    if ((lead >= 0xC2) && (lead <= 0xDF)) {
+      trailing = 1;
+    } else if ((lead >= 0xE0) && (lead <= 0xEF)) {
+      trailing = 2;
+      if (lead == 0xE0) second_min = 0xA0;  // Overlong.
+      if (lead == 0xED) second_max = 0x9F;  // Surrogates.
+    } else if ((lead >= 0xF0) && (lead <= 0xF4)) {
+      trailing = 3;
+      if (lead == 0xF0) second_min = 0x90;  // Overlong.
+      if (lead == 0xF4) second_max = 0x8F;  // Above U+10FFFF.
+    } else {
+      return false;
+    }
+    if (i + trailing >= length) {
+      return false;
+    }
+    uint8_t second = bytes[i + 1];
+    if ((second < second_min) || (second > second_max)) {
+      return false;
+    }
+    for (intptr_t j = 2; j <= trailing; j++) {
+      if (!IsContinuation(bytes[i + j])) {
+        return false;
+      }
+    }
+    i += trailing + 1;
+  }
+  return true;
+}
+
+intptr_t UTF8::CodePointCount(const uint8_t* bytes, intptr_t length) {
+  intptr_t count = 0;
+  intptr_t i = 0;
+  for (; i + kWordSize <= length; i += kWordSize) {
+    count += LeadBytesInWord(LoadWord(&bytes[i]));
+  }
+  for (; i < length; i++) {
+    if (!IsContinuation(bytes[i])) {
+      count++;
+    }
+  }
+  return count;
+}
+
+intptr_t UTF8::CodePointOffset(const uint8_t* bytes, intptr_t length,
+                               intptr_t index) {
+  ASSERT(index >= 0);
+  intptr_t remaining = index;
+  intptr_t i = 0;
+  for (; i + kWordSize <= length; i += kWordSize) {
+    intptr_t leads = LeadBytesInWord(LoadWord(&bytes[i]));
+    if (leads > remaining) {
+      break;
+    }
+    remaining -= leads;
+  }
+  for (; i < length; i++) {
+    if (!IsContinuation(bytes[i])) {
+      if (remaining == 0) {
+        return i;
+      }
+      remaining--;
+    }
+  }
+  return -1;
+}
+
+intptr_t UTF8::UTF16Length(const uint8_t* bytes, intptr_t length) {
+  // One unit per code point, and another for those outside the BMP.
+  intptr_t count = CodePointCount(bytes, length);
+  for (intptr_t i = 0; i < length; i++) {
+    if (bytes[i] >= 0xF0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static inline void StoreUnit(uint8_t* units, intptr_t index, uint32_t unit) {
+  units[2 * index] = static_cast<uint8_t>(unit);
+  units[2 * index + 1] = static_cast<uint8_t>(unit >> 8);
+}
+
+static inline uint32_t LoadUnit(const uint8_t* units, intptr_t index) {
+  return units[2 * index] | (units[2 * index + 1] << 8);
+}
+
+void UTF8::DecodeToUTF16(const uint8_t* bytes, intptr_t length,
+                         uint8_t* units) {
+  intptr_t i = 0;
+  intptr_t j = 0;
+  while (i < length) {
+    uint32_t lead = bytes[i];
+    if (lead < 0x80) {
+      StoreUnit(units, j++, lead);
+      i++;
+    } else if (lead < 0xE0) {
+      StoreUnit(units, j++, ((lead & 0x1F) << 6) | (bytes[i + 1] & 0x3F));
+      i += 2;
+    } else if (lead < 0xF0) {
+      StoreUnit(units, j++,
+                ((lead & 0x0F) << 12) | ((bytes[i + 1] & 0x3F) << 6) |
+                (bytes[i + 2] & 0x3F));
+      i += 3;
+    } else {
+      uint32_t code_point =
+          ((lead & 0x07) << 18) | ((bytes[i + 1] & 0x3F) << 12) |
+          ((bytes[i + 2] & 0x3F) << 6) | (bytes[i + 3] & 0x3F);
+      code_point -= 0x10000;
+      StoreUnit(units, j++, 0xD800 | (code_point >> 10));
+      StoreUnit(units, j++, 0xDC00 | (code_point & 0x3FF));
+      i += 4;
+    }
+  }
+}
+
+static inline bool IsHighSurrogate(uint32_t unit) {
+  return (unit & 0xFC00) == 0xD800;
+}
+
+static inline bool IsLowSurrogate(uint32_t unit) {
+  return (unit & 0xFC00) == 0xDC00;
+}
+
+intptr_t UTF8::LengthOfUTF16(const uint8_t* units, intptr_t count) {
+  intptr_t length = 0;
+  for (intptr_t i = 0; i < count; i++) {
+    uint32_t unit = LoadUnit(units, i);
+    if (unit < 0x80) {
+      length += 1;
+    } else if (unit < 0x800) {
+      length += 2;
+    } else if (IsHighSurrogate(unit) && (i + 1 < count) &&
+               IsLowSurrogate(LoadUnit(units, i + 1))) {
+      length += 4;
+      i++;
+    } else {
+      length += 3;
+    }
+  }
+  return length;
+}
+
+void UTF8::EncodeUTF16(const uint8_t* units, intptr_t count, uint8_t* bytes) {
+  intptr_t j = 0;
+  for (intptr_t i = 0; i < count; i++) {
+    uint32_t code_point = LoadUnit(units, i);
+    if (code_point < 0x80) {
+      bytes[j++] = code_point;
+    } else if (code_point < 0x800) {
+      bytes[j++] = 0xC0 | (code_point >> 6);
+      bytes[j++] = 0x80 | (code_point & 0x3F);
+    } else if (IsHighSurrogate(code_point) && (i + 1 < count) &&
+               IsLowSurrogate(LoadUnit(units, i + 1))) {
+      code_point = 0x10000 + ((code_point & 0x3FF) << 10) +
+                   (LoadUnit(units, i + 1) & 0x3FF);
+      i++;
+      bytes[j++] = 0xF0 | (code_point >> 18);
+      bytes[j++] = 0x80 | ((code_point >> 12) & 0x3F);
+      bytes[j++] = 0x80 | ((code_point >> 6) & 0x3F);
+      bytes[j++] = 0x80 | (code_point & 0x3F);
+    } else {
+      if (IsHighSurrogate(code_point) || IsLowSurrogate(code_point)) {
+        code_point = 0xFFFD;
+      }
+      bytes[j++] = 0xE0 | (code_point >> 12);
+      bytes[j++] = 0x80 | ((code_point >> 6) & 0x3F);
+      bytes[j++] = 0x80 | (code_point & 0x3F);
+    }
+  }
+}
+
+}  // namespace psoup
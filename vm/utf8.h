@@ -0,0 +1,45 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_UTF8_H_
+#define VM_UTF8_H_
+
+#include "vm/allocation.h"
+#include "vm/globals.h"
+
+namespace psoup {
+
+// Strings and ByteArrays are often UTF-8, so these look at their bytes as such.
+// Runs of ASCII, the common case, are skipped a word at a time.
+class UTF8 : public AllStatic {
+ public:
+  // Rejects overlong forms, surrogates and code points above U+10FFFF.
+  static bool IsValid(const uint8_t* bytes, intptr_t length);
+
+  // The number of bytes that do not continue a sequence, which for valid
+  // UTF-8 is the number of code points.
+  static intptr_t CodePointCount(const uint8_t* bytes, intptr_t length);
+
+  // The offset of the first byte of the code point at |index|, counting as
+  // CodePointCount does, or -1 if there are not that many.
+  static intptr_t CodePointOffset(const uint8_t* bytes, intptr_t length,
+                                  intptr_t index);
+
+  // |bytes| must be valid.
+  static intptr_t UTF16Length(const uint8_t* bytes, intptr_t length);
+  // Writes UTF16Length(bytes, length) little-endian code units to |units|.
+  static void DecodeToUTF16(const uint8_t* bytes, intptr_t length,
+                            uint8_t* units);
+
+  // |units| are |count| little-endian code units. Unpaired surrogates become
+  // U+FFFD.
+  static intptr_t LengthOfUTF16(const uint8_t* units, intptr_t count);
+  // Writes LengthOfUTF16(units, count) bytes to |bytes|.
+  static void EncodeUTF16(const uint8_t* units, intptr_t count,
+                          uint8_t* bytes);
+};
+
+}  // namespace psoup
+
+#endif  // VM_UTF8_H_
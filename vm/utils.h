@@ -42,6 +42,35 @@ class Utils {
 #endif
   }
 
+  static inline int CountTrailingZeros(uint64_t x) {
+    ASSERT(x != 0);
+#if defined(__GNUC__)
+    ASSERT(sizeof(long long) == sizeof(uint64_t));  // NOLINT
+    return __builtin_ctzll(x);
+#else
+    int r = 0;
+    if ((x & 0xFFFFFFFF) == 0) { x >>= 32; r += 32; }
+    if ((x & 0xFFFF) == 0) { x >>= 16; r += 16; }
+    if ((x & 0xFF) == 0) { x >>= 8; r += 8; }
+    if ((x & 0xF) == 0) { x >>= 4; r += 4; }
+    if ((x & 0x3) == 0) { x >>= 2; r += 2; }
+    if ((x & 0x1) == 0) r += 1;
+    return r;
+#endif
+  }
+
+  static inline int CountOneBits(uint64_t x) {
+#if defined(__GNUC__)
+    ASSERT(sizeof(long long) == sizeof(uint64_t));  // NOLINT
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555);
+    x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0F;
+    return static_cast<int>((x * 0x0101010101010101) >> 56);
+#endif
+  }
+
   static int BitLength(int64_t value) {
     // Flip bits if negative (-1 becomes 0).
     value ^= value >> (8 * sizeof(value) - 1);
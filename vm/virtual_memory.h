@@ -21,21 +21,46 @@ class VirtualMemory {
   static VirtualMemory Allocate(size_t size,
                                 Protection protection,
                                 const char* name);
+
+  // A read-write mapping of |size| rounded up to kHugePageSize that the OS is
+  // asked to back with huge pages, aligned to them where the OS has them.
+  // Falls back to ordinary pages if the OS refuses.
+  static VirtualMemory AllocateHuge(size_t size, const char* name);
+  static constexpr size_t kHugePageSize = 2 * MB;
   void Free();
   bool Protect(Protection protection);
 
+  // Returns the physical pages in [start, start + size), which must be
+  // page-aligned and inside this mapping, to the OS. The range stays mapped,
+  // and its contents are undefined until written again.
+  void Decommit(uword start, size_t size);
+
+  // Moves the pages from |offset|, which must be page-aligned, to the end of
+  // this mapping into the same place in |destination|, a mapping of the same
+  // size, without copying them. This mapping then ends at |offset|. Returns
+  // false where the OS cannot move pages.
+  bool MovePages(size_t offset, VirtualMemory* destination);
+
+  // Asks the OS to place this mapping's pages on NUMA node |node|, below 64,
+  // as they are first touched. Returns false where the OS cannot.
+  bool BindToNode(intptr_t node);
+
+  static size_t PageSize();
+
   uword base() const { return reinterpret_cast<uword>(address_); }
   uword limit() const { return base() + size(); }
   size_t size() const { return size_; }
 
-  VirtualMemory() : address_(0), size_(0) { }
+  VirtualMemory() : address_(0), size_(0), large_pages_(false) { }
 
  private:
-  VirtualMemory(void* address, size_t size)
-      : address_(address), size_(size) { }
+  VirtualMemory(void* address, size_t size, bool large_pages = false)
+      : address_(address), size_(size), large_pages_(large_pages) { }
 
   void* address_;
   size_t size_;
+  // Backed by locked large pages, which cannot be decommitted piecemeal.
+  bool large_pages_;
 };
 
 }  // namespace psoup
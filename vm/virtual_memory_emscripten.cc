@@ -9,6 +9,7 @@
 
 #include "vm/assert.h"
 #include "vm/os.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -29,6 +30,12 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
 }
 
 
+VirtualMemory VirtualMemory::AllocateHuge(size_t size, const char* name) {
+  // No huge page hint; Wasm memory has a single page size.
+  return Allocate(Utils::RoundUp(size, kHugePageSize), kReadWrite, name);
+}
+
+
 void VirtualMemory::Free() {
   free(address_);
 }
@@ -38,6 +45,27 @@ bool VirtualMemory::Protect(Protection protection) {
   return true;
 }
 
+
+
+void VirtualMemory::Decommit(uword start, size_t size) {
+  // Wasm memory cannot be returned to the host.
+}
+
+
+bool VirtualMemory::MovePages(size_t offset, VirtualMemory* destination) {
+  return false;
+}
+
+
+bool VirtualMemory::BindToNode(intptr_t node) {
+  return false;
+}
+
+
+size_t VirtualMemory::PageSize() {
+  return 64 * KB;
+}
+
 }  // namespace psoup
 
 #endif  // defined(OS_EMSCRIPTEN)
@@ -14,6 +14,7 @@
 #include <zircon/syscalls.h>
 
 #include "vm/assert.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -87,6 +88,12 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
 }
 
 
+VirtualMemory VirtualMemory::AllocateHuge(size_t size, const char* name) {
+  // No huge page hint; the kernel decides how VMOs are backed.
+  return Allocate(Utils::RoundUp(size, kHugePageSize), kReadWrite, name);
+}
+
+
 void VirtualMemory::Free() {
   zx_handle_t vmar = zx_vmar_root_self();
   zx_status_t status = zx_vmar_unmap(vmar,
@@ -124,6 +131,35 @@ bool VirtualMemory::Protect(Protection protection) {
   return true;
 }
 
+
+
+void VirtualMemory::Decommit(uword start, size_t size) {
+  ASSERT(Utils::IsAligned(start, PageSize()));
+  ASSERT(Utils::IsAligned(size, PageSize()));
+  ASSERT((start >= base()) && (start + size <= limit()));
+  zx_handle_t vmar = zx_vmar_root_self();
+  zx_status_t status = zx_vmar_op_range(vmar, ZX_VMAR_OP_DECOMMIT, start, size,
+                                        NULL, 0);
+  if (status != ZX_OK) {
+    FATAL("zx_vmar_op_range failed: %s\n", zx_status_get_string(status));
+  }
+}
+
+
+bool VirtualMemory::MovePages(size_t offset, VirtualMemory* destination) {
+  return false;
+}
+
+
+bool VirtualMemory::BindToNode(intptr_t node) {
+  return false;
+}
+
+
+size_t VirtualMemory::PageSize() {
+  return zx_system_get_page_size();
+}
+
 }  // namespace psoup
 
 #endif  // defined(OS_FUCHSIA)
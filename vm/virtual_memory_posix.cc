@@ -9,13 +9,21 @@
 
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #if defined(OS_ANDROID) || defined(OS_LINUX)
+#include <linux/mempolicy.h>
 #include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(OS_MACOS)
+#include <mach/vm_statistics.h>
 #endif
 
 #include "vm/assert.h"
 #include "vm/os.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -78,6 +86,41 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
 }
 
 
+VirtualMemory VirtualMemory::AllocateHuge(size_t size, const char* name) {
+  size = Utils::RoundUp(size, kHugePageSize);
+
+#if defined(OS_MACOS) && defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+  // Superpages are wired and only exist on some hardware.
+  void* superpage = mmap(0, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANON,
+                         VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+  if (superpage != MAP_FAILED) {
+    return VirtualMemory(superpage, size, true);
+  }
+#endif
+
+  // Over-reserve so an aligned range can be cut out, then unmap the excess on
+  // either side.
+  VirtualMemory reserved = Allocate(size + kHugePageSize, kReadWrite, name);
+  uword start = Utils::RoundUp(reserved.base(), kHugePageSize);
+  uword end = start + size;
+  if (start > reserved.base()) {
+    munmap(reinterpret_cast<void*>(reserved.base()), start - reserved.base());
+  }
+  if (reserved.limit() > end) {
+    munmap(reinterpret_cast<void*>(end), reserved.limit() - end);
+  }
+  void* address = reinterpret_cast<void*>(start);
+
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  // Fails harmlessly when transparent huge pages are disabled.
+  madvise(address, size, MADV_HUGEPAGE);
+#endif
+
+  return VirtualMemory(address, size);
+}
+
+
 void VirtualMemory::Free() {
   int result = munmap(address_, size_);
   if (result != 0) {
@@ -101,6 +144,73 @@ bool VirtualMemory::Protect(Protection protection) {
   return result == 0;
 }
 
+
+
+void VirtualMemory::Decommit(uword start, size_t size) {
+  ASSERT(Utils::IsAligned(start, PageSize()));
+  ASSERT(Utils::IsAligned(size, PageSize()));
+  ASSERT((start >= base()) && (start + size <= limit()));
+  if (large_pages_) {
+    return;
+  }
+#if defined(OS_MACOS)
+  // MADV_DONTNEED does not release anonymous memory on macOS.
+  int advice = MADV_FREE;
+#else
+  int advice = MADV_DONTNEED;
+#endif
+  int result = madvise(reinterpret_cast<void*>(start), size, advice);
+  if (result != 0) {
+    FATAL("Failed to madvise %" Pd " bytes\n", size);
+  }
+}
+
+
+bool VirtualMemory::MovePages(size_t offset, VirtualMemory* destination) {
+  ASSERT(Utils::IsAligned(offset, PageSize()));
+  ASSERT((offset < size_) && (destination->size_ == size_));
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  if (large_pages_ || destination->large_pages_) {
+    return false;
+  }
+  // Replaces the destination's pages in one step, so the range never lies
+  // unmapped where another thread could map something.
+  void* from = reinterpret_cast<void*>(base() + offset);
+  void* to = reinterpret_cast<void*>(destination->base() + offset);
+  void* result = mremap(from, size_ - offset, size_ - offset,
+                        MREMAP_MAYMOVE | MREMAP_FIXED, to);
+  if (result == MAP_FAILED) {
+    return false;
+  }
+  ASSERT(result == to);
+  size_ = offset;
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool VirtualMemory::BindToNode(intptr_t node) {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  ASSERT((node >= 0) && (node < 64));
+  // Through the system call rather than libnuma, which may not be installed.
+  // Preferred rather than bound, so a full node spills onto the others
+  // instead of failing the allocation.
+  uint64_t nodes = static_cast<uint64_t>(1) << node;
+  return syscall(__NR_mbind, address_, size_, MPOL_PREFERRED, &nodes,
+                 sizeof(nodes) * kBitsPerByte + 1, 0) == 0;
+#else
+  return false;
+#endif
+}
+
+
+size_t VirtualMemory::PageSize() {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
 }  // namespace psoup
 
 #endif  // defined(OS_ANDROID) || defined(OS_MACOS) || defined(OS_LINUX)
@@ -9,6 +9,7 @@
 
 #include "vm/assert.h"
 #include "vm/os.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -65,6 +66,60 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
 }
 
 
+static bool EnableLockMemoryPrivilege() {
+  HANDLE token;
+  if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token)) {
+    return false;
+  }
+  TOKEN_PRIVILEGES privileges;
+  privileges.PrivilegeCount = 1;
+  privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+  bool result =
+      LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME,
+                           &privileges.Privileges[0].Luid) &&
+      AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+      (GetLastError() == ERROR_SUCCESS);
+  CloseHandle(token);
+  return result;
+}
+
+
+VirtualMemory VirtualMemory::AllocateHuge(size_t size, const char* name) {
+  size = Utils::RoundUp(size, kHugePageSize);
+
+  // Large pages need SeLockMemoryPrivilege, which the account must have been
+  // granted, and are committed and locked for the life of the mapping.
+  static const bool has_privilege = EnableLockMemoryPrivilege();
+  size_t minimum = GetLargePageMinimum();
+  if (has_privilege && (minimum != 0) && Utils::IsAligned(size, minimum)) {
+    void* address = VirtualAlloc(NULL, size,
+                                 MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES,
+                                 PAGE_READWRITE);
+    if (address != NULL) {
+      return VirtualMemory(address, size, true);
+    }
+  }
+
+  // Reserve enough to find an aligned range, release it and claim the aligned
+  // part. Another thread may take the range in between, so retry.
+  for (;;) {
+    void* reserved = VirtualAlloc(NULL, size + kHugePageSize, MEM_RESERVE,
+                                  PAGE_NOACCESS);
+    if (reserved == NULL) {
+      FATAL("Failed to VirtualAlloc %" Pd " bytes\n", size);
+    }
+    uword start = Utils::RoundUp(reinterpret_cast<uword>(reserved),
+                                 kHugePageSize);
+    VirtualFree(reserved, 0, MEM_RELEASE);
+    void* address = VirtualAlloc(reinterpret_cast<void*>(start), size,
+                                 MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (address != NULL) {
+      return VirtualMemory(address, size);
+    }
+  }
+}
+
+
 void VirtualMemory::Free() {
   if (VirtualFree(address_, 0, MEM_RELEASE) == 0) {
     FATAL("VirtualFree failed %d", GetLastError());
@@ -87,6 +142,43 @@ bool VirtualMemory::Protect(Protection protection) {
   return result;
 }
 
+
+
+void VirtualMemory::Decommit(uword start, size_t size) {
+  ASSERT(Utils::IsAligned(start, PageSize()));
+  ASSERT(Utils::IsAligned(size, PageSize()));
+  ASSERT((start >= base()) && (start + size <= limit()));
+  if (large_pages_) {
+    return;
+  }
+  void* address = reinterpret_cast<void*>(start);
+  if (VirtualFree(address, size, MEM_DECOMMIT) == 0) {
+    FATAL("VirtualFree failed %d", GetLastError());
+  }
+  // Commit again so the range stays accessible. Fresh pages are zero-filled
+  // on demand, so they do not count against the working set until touched.
+  if (VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+    FATAL("Failed to VirtualAlloc %" Pd " bytes\n", size);
+  }
+}
+
+
+bool VirtualMemory::MovePages(size_t offset, VirtualMemory* destination) {
+  return false;
+}
+
+
+bool VirtualMemory::BindToNode(intptr_t node) {
+  return false;
+}
+
+
+size_t VirtualMemory::PageSize() {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+}
+
 }  // namespace psoup
 
 #endif  // defined(OS_WINDOWS)